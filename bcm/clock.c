@@ -23,7 +23,7 @@ enum {
 	ARMTIMER	= VIRTIO+0xB400,
 
 	SystimerFreq	= 1*Mhz,
-	MaxPeriod	= SystimerFreq / HZ,
+	MaxPeriod	= SystimerFreq,		/* tickless idle sleeps up to 1s */
 	MinPeriod	= SystimerFreq / (100*HZ),
 };
 
@@ -14,6 +14,7 @@ enum {
 
 typedef struct Conf	Conf;
 typedef struct Confmem	Confmem;
+typedef struct Dmaseg	Dmaseg;
 typedef struct FPsave	FPsave;
 typedef struct ISAConf	ISAConf;
 typedef struct Label	Label;
@@ -92,6 +93,15 @@ enum
 	FPillegal= 0x100,
 };
 
+/*
+ * a piece of memory for scatter-gather dma
+ */
+struct Dmaseg
+{
+	void	*addr;
+	int	len;
+};
+
 struct Confmem
 {
 	uintptr	base;
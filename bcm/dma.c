@@ -26,6 +26,7 @@ enum {
 	Nchan		= 7,		/* number of dma channels */
 	Regsize		= 0x100,	/* size of regs for each chan */
 	Cbalign		= 32,		/* control block byte alignment */
+	Ncb		= 32,		/* control blocks chained for one transfer */
 	Dbg		= 0,
 	
 	/* registers for each dma controller */
@@ -79,7 +80,7 @@ typedef struct Cb Cb;
 
 struct Ctlr {
 	u32int	*regs;
-	Cb	*cb;
+	Cb	*cb;		/* Ncb of them */
 	Rendez	r;
 	int	dmadone;
 };
@@ -134,17 +135,15 @@ dmainterrupt(Ureg*, void *a)
 	wakeup(&ctlr->r);
 }
 
-void
-dmastart(int chan, int dev, int dir, void *src, void *dst, int len)
+static Ctlr*
+dmactlr(int chan)
 {
 	Ctlr *ctlr;
-	Cb *cb;
-	int ti;
 
 	ctlr = &dma[chan];
 	if(ctlr->regs == nil){
 		ctlr->regs = (u32int*)(DMAREGS + chan*Regsize);
-		ctlr->cb = xspanalloc(sizeof(Cb), Cbalign, 0);
+		ctlr->cb = xspanalloc(Ncb*sizeof(Cb), Cbalign, 0);
 		assert(ctlr->cb != nil);
 		dmaregs[Enable] |= 1<<chan;
 		ctlr->regs[Cs] = Reset;
@@ -152,6 +151,40 @@ dmastart(int chan, int dev, int dir, void *src, void *dst, int len)
 			;
 		intrenable(IRQDMA(chan), dmainterrupt, ctlr, 0, "dma");
 	}
+	return ctlr;
+}
+
+static void
+dmago(Ctlr *ctlr, int ncb)
+{
+	Cb *cb;
+
+	cb = ctlr->cb;
+	cachedwbse(cb, ncb*sizeof(Cb));
+	ctlr->regs[Cs] = 0;
+	microdelay(1);
+	ctlr->regs[Conblkad] = DMAADDR(cb);
+	DBG print("dma start: %ux %ux %ux %ux %ux %ux\n",
+		cb->ti, cb->sourcead, cb->destad, cb->txfrlen,
+		cb->stride, cb->nextconbk);
+	DBG print("intstatus %ux\n", dmaregs[Intstatus]);
+	dmaregs[Intstatus] = 0;
+	ctlr->regs[Cs] = Int;
+	microdelay(1);
+	coherence();
+	DBG dumpdregs("before Active", ctlr->regs);
+	ctlr->regs[Cs] = Active;
+	DBG dumpdregs("after Active", ctlr->regs);
+}
+
+void
+dmastart(int chan, int dev, int dir, void *src, void *dst, int len)
+{
+	Ctlr *ctlr;
+	Cb *cb;
+	int ti;
+
+	ctlr = dmactlr(chan);
 	cb = ctlr->cb;
 	ti = 0;
 	switch(dir){
@@ -179,21 +212,46 @@ dmastart(int chan, int dev, int dir, void *src, void *dst, int len)
 	cb->txfrlen = len;
 	cb->stride = 0;
 	cb->nextconbk = 0;
-	cachedwbse(cb, sizeof(Cb));
-	ctlr->regs[Cs] = 0;
-	microdelay(1);
-	ctlr->regs[Conblkad] = DMAADDR(cb);
-	DBG print("dma start: %ux %ux %ux %ux %ux %ux\n",
-		cb->ti, cb->sourcead, cb->destad, cb->txfrlen,
-		cb->stride, cb->nextconbk);
-	DBG print("intstatus %ux\n", dmaregs[Intstatus]);
-	dmaregs[Intstatus] = 0;
-	ctlr->regs[Cs] = Int;
-	microdelay(1);
-	coherence();
-	DBG dumpdregs("before Active", ctlr->regs);
-	ctlr->regs[Cs] = Active;
-	DBG dumpdregs("after Active", ctlr->regs);
+	dmago(ctlr, 1);
+}
+
+/*
+ * Scatter-gather between the device register io and the
+ * memory segments in seg, one control block for each:
+ * only the last interrupts.
+ */
+void
+dmastartv(int chan, int dev, int dir, void *io, Dmaseg *seg, int nseg)
+{
+	Ctlr *ctlr;
+	Cb *cb;
+	int i, ti;
+
+	assert(nseg > 0 && nseg <= Ncb && dir != DmaM2M);
+	ctlr = dmactlr(chan);
+	for(i = 0; i < nseg; i++){
+		cb = &ctlr->cb[i];
+		if(dir == DmaD2M){
+			cachedwbinvse(seg[i].addr, seg[i].len);
+			ti = Srcdreq | Destinc;
+			cb->sourcead = DMAIO(io);
+			cb->destad = DMAADDR(seg[i].addr);
+		}else{
+			cachedwbse(seg[i].addr, seg[i].len);
+			ti = Destdreq | Srcinc;
+			cb->sourcead = DMAADDR(seg[i].addr);
+			cb->destad = DMAIO(io);
+		}
+		cb->ti = ti | dev<<Permapshift;
+		cb->txfrlen = seg[i].len;
+		cb->stride = 0;
+		if(i == nseg-1){
+			cb->ti |= Inten;
+			cb->nextconbk = 0;
+		}else
+			cb->nextconbk = DMAADDR(cb+1);
+	}
+	dmago(ctlr, nseg);
 }
 
 int
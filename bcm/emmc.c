@@ -359,25 +359,26 @@ emmciosetup(int write, void *buf, int bsize, int bcount)
 	WR(Blksizecnt, bcount<<16 | bsize);
 }
 
+/*
+ * The data of one command, chained through the
+ * dma control blocks for a scattered buffer.
+ */
 static void
-emmcio(int write, uchar *buf, int len)
+emmcxfer(int write, Dmaseg *seg, int nseg)
 {
 	u32int *r;
 	int i;
 
 	r = (u32int*)EMMCREGS;
-	assert((len&3) == 0);
+	for(i = 0; i < nseg; i++)
+		assert((seg[i].len&3) == 0);
 	okay(1);
 	if(waserror()){
 		okay(0);
 		nexterror();
 	}
-	if(write)
-		dmastart(DmaChanEmmc, DmaDevEmmc, DmaM2D,
-			buf, &r[Data], len);
-	else
-		dmastart(DmaChanEmmc, DmaDevEmmc, DmaD2M,
-			&r[Data], buf, len);
+	dmastartv(DmaChanEmmc, DmaDevEmmc, write? DmaM2D: DmaD2M,
+		&r[Data], seg, nseg);
 	if(dmawait(DmaChanEmmc) < 0)
 		error(Eio);
 	WR(Irpten, Datadone|Err);
@@ -403,6 +404,30 @@ emmcio(int write, uchar *buf, int len)
 	okay(0);
 }
 
+static void
+emmcio(int write, uchar *buf, int len)
+{
+	Dmaseg seg;
+
+	seg.addr = buf;
+	seg.len = len;
+	emmcxfer(write, &seg, 1);
+}
+
+static void
+emmciov(int write, SDiov *v, int nv)
+{
+	Dmaseg seg[SDmaxiov];
+	int i;
+
+	assert(nv <= SDmaxiov);
+	for(i = 0; i < nv; i++){
+		seg[i].addr = v[i].data;
+		seg[i].len = v[i].len;
+	}
+	emmcxfer(write, seg, nv);
+}
+
 static void
 mmcinterrupt(Ureg*, void*)
 {	
@@ -424,4 +449,5 @@ SDio sdio = {
 	emmccmd,
 	emmciosetup,
 	emmcio,
+	emmciov,
 };
@@ -24,6 +24,7 @@ extern void cpwr(int cp, int op1, int crn, int crm, int op2, ulong val);
 extern void cpwrsc(int op1, int crn, int crm, int op2, ulong val);
 #define cycles(ip) *(ip) = lcycles()
 extern void dmastart(int, int, int, void*, void*, int);
+extern void dmastartv(int, int, int, void*, Dmaseg*, int);
 extern int dmawait(int);
 extern int fbblank(int);
 extern void* fbinit(int, int*, int*, int*);
@@ -0,0 +1,177 @@
+/*
+ * memmove and memset for the kernel, in place of libc's:
+ * the bulk goes 32 bytes at a time through movm with the
+ * line after next preloaded.  when from and to are aligned
+ * differently, whole words are shifted together.
+ * only R0-R8 are used, never R9 (up) or R10 (m).
+ * v5te and later; also assembled for tools/bench/membench.
+ */
+
+#ifndef MEMMOVE
+#define MEMMOVE	memmove
+#define MEMCPY	memcpy
+#define MEMSET	memset
+#endif
+
+#define PLD(r, o)	WORD	$(0xf5d0f000 | (r)<<16 | (o))	/* preload o(Rr) */
+
+TEXT MEMCPY(SB), 1, $-4
+	B	MEMMOVE(SB)
+
+/* void* memmove(void *to, void *from, ulong n); R0 is returned */
+TEXT MEMMOVE(SB), 1, $-4
+	MOVW	4(FP), R1		/* from */
+	MOVW	8(FP), R3		/* n */
+	MOVW	R0, R2			/* to */
+	CMP	R1, R2
+	BLS	_fwd			/* to <= from */
+	ADD	R3, R1, R4
+	CMP	R4, R2
+	BLO	_back			/* to inside from[0:n] */
+
+_fwd:
+	CMP	$16, R3
+	BLO	_fbyte
+_falign:				/* to a word boundary */
+	AND.S	$3, R2, R4
+	BEQ	_faligned
+	MOVBU.P	1(R1), R4
+	MOVBU.P	R4, 1(R2)
+	SUB	$1, R3
+	B	_falign
+_faligned:
+	AND.S	$3, R1, R4
+	BNE	_fshift
+_f32:
+	CMP	$32, R3
+	BLO	_f4
+	PLD(1, 64)
+	MOVM.IA.W (R1), [R4-R7]
+	MOVM.IA.W [R4-R7], (R2)
+	MOVM.IA.W (R1), [R4-R7]
+	MOVM.IA.W [R4-R7], (R2)
+	SUB	$32, R3
+	B	_f32
+_f4:
+	CMP	$4, R3
+	BLO	_fbyte
+	MOVW.P	4(R1), R4
+	MOVW.P	R4, 4(R2)
+	SUB	$4, R3
+	B	_f4
+_fbyte:
+	CMP	$0, R3
+	BEQ	_ret
+	MOVBU.P	1(R1), R4
+	MOVBU.P	R4, 1(R2)
+	SUB	$1, R3
+	B	_fbyte
+_ret:
+	RET
+
+/*
+ * from is R4 (1-3) bytes past a word: read whole words
+ * and make each word of to from two of them.
+ */
+_fshift:
+	BIC	$3, R1
+	MOVW.P	4(R1), R5
+	MOVW	R4<<3, R6		/* bits of R5 already used */
+	RSB	$32, R6, R7
+_fs4:
+	CMP	$4, R3
+	BLO	_fsdone
+	MOVW.P	4(R1), R8
+	MOVW	R5>>R6, R5
+	ORR	R8<<R7, R5
+	MOVW.P	R5, 4(R2)
+	MOVW	R8, R5
+	SUB	$4, R3
+	B	_fs4
+_fsdone:
+	SUB	$4, R1
+	ADD	R4, R1			/* back to the next byte of from */
+	B	_fbyte
+
+/* overlapping, to above from: copy down from the ends */
+_back:
+	ADD	R3, R1
+	ADD	R3, R2
+_balign:
+	CMP	$0, R3
+	BEQ	_ret
+	AND.S	$3, R2, R4
+	BEQ	_baligned
+	MOVBU.W	-1(R1), R4
+	MOVBU.W	R4, -1(R2)
+	SUB	$1, R3
+	B	_balign
+_baligned:
+	AND.S	$3, R1, R4
+	BNE	_bbyte			/* rare enough to do bytewise */
+_b32:
+	CMP	$32, R3
+	BLO	_b4
+	MOVM.DB.W (R1), [R4-R7]
+	MOVM.DB.W [R4-R7], (R2)
+	MOVM.DB.W (R1), [R4-R7]
+	MOVM.DB.W [R4-R7], (R2)
+	SUB	$32, R3
+	B	_b32
+_b4:
+	CMP	$4, R3
+	BLO	_bbyte
+	MOVW.W	-4(R1), R4
+	MOVW.W	R4, -4(R2)
+	SUB	$4, R3
+	B	_b4
+_bbyte:
+	CMP	$0, R3
+	BEQ	_ret
+	MOVBU.W	-1(R1), R4
+	MOVBU.W	R4, -1(R2)
+	SUB	$1, R3
+	B	_bbyte
+
+/* void* memset(void *p, int c, ulong n); R0 is returned */
+TEXT MEMSET(SB), 1, $-4
+	MOVW	4(FP), R1		/* c */
+	MOVW	8(FP), R3		/* n */
+	MOVW	R0, R2
+	AND	$0xff, R1
+	ORR	R1<<8, R1
+	ORR	R1<<16, R1
+	CMP	$16, R3
+	BLO	_sbyte
+_salign:
+	AND.S	$3, R2, R4
+	BEQ	_saligned
+	MOVBU.P	R1, 1(R2)
+	SUB	$1, R3
+	B	_salign
+_saligned:
+	MOVW	R1, R4
+	MOVW	R1, R5
+	MOVW	R1, R6
+	MOVW	R1, R7
+_s32:
+	CMP	$32, R3
+	BLO	_s4
+	MOVM.IA.W [R4-R7], (R2)
+	MOVM.IA.W [R4-R7], (R2)
+	SUB	$32, R3
+	B	_s32
+_s4:
+	CMP	$4, R3
+	BLO	_sbyte
+	MOVW.P	R1, 4(R2)
+	SUB	$4, R3
+	B	_s4
+_sbyte:
+	CMP	$0, R3
+	BEQ	_sret
+	MOVBU.P	R1, 1(R2)
+	SUB	$1, R3
+	B	_sbyte
+_sret:
+	RET
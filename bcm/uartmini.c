@@ -129,6 +129,8 @@ interrupt(Ureg*, void *arg)
 {
 	Uart *uart;
 	u32int *ap;
+	uchar buf[8];	/* the depth of the fifo */
+	int n;
 
 	uart = arg;
 	ap = (u32int*)uart->regs;
@@ -146,7 +148,11 @@ interrupt(Ureg*, void *arg)
 				uart->putc = nil;
 		}
 		do{
-			uartrecv(uart, ap[MuIo] & 0xFF);
+			n = 0;
+			do
+				buf[n++] = ap[MuIo];
+			while(n < sizeof buf && (ap[MuLsr] & RxRdy));
+			uartrecvn(uart, buf, n);
 		}while(ap[MuLsr] & RxRdy);
 	}
 	coherence();
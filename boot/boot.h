@@ -66,6 +66,7 @@ extern int	connectlocal(void);
 
 extern void	configpaq(Method*);
 extern int	connectpaq(void);
+extern char*	paqcache(void);
 
 extern void	configembed(Method*);
 extern int	connectembed(void);
@@ -49,10 +49,12 @@ connectembed(void)
 	case -1:
 		fatal("fork");
 	case 0:
-		arg = malloc((bargc+5)*sizeof(char*));
+		arg = malloc((bargc+7)*sizeof(char*));
 		argp = arg;
 		*argp++ = "/boot/paqfs";
 		*argp++ = "-iv";
+		*argp++ = "-c";
+		*argp++ = paqcache();
 		*argp++ = paqfile;
 		for(i=1; i<bargc; i++)
 			*argp++ = bargv[i];
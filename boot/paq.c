@@ -28,6 +28,30 @@ configpaq(Method*)
 		if(fprint(fd, fparts[i]) < 0)
 			fatal(fparts[i]);
 	close(fd);
+
+	/* read the archive from a copy in memory, not the flash */
+	if(getenv("paqmem") != nil){
+		fd = open("/dev/flash/ramdiskctl", OWRITE);
+		if(fd < 0 || fprint(fd, "mem") < 0)
+			warning("paqmem");
+		close(fd);
+	}
+}
+
+/*
+ * paqfs keeps this many blocks decompressed, so that hot
+ * blocks of the root are not inflated again on every read.
+ * plan9.ini's paqcache overrides.
+ */
+char*
+paqcache(void)
+{
+	char *s;
+
+	s = getenv("paqcache");
+	if(s == nil || atoi(s) <= 0)
+		return "128";
+	return s;
 }
 
 int
@@ -48,6 +72,8 @@ connectpaq(void)
 		*argp++ = "paqfs";
 		*argp++ = "-v";
 		*argp++ = "-i";
+		*argp++ = "-c";
+		*argp++ = paqcache();
 		*argp++ = "/dev/flash/ramdisk";
 		*argp = 0;
 
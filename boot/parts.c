@@ -27,6 +27,7 @@ enum {
 	Maxsec = 2048,
 	Cdsec = 2048,
 	Normsec = 512,			/* disks */
+	Chunk = 64*1024,		/* read from disks at a time */
 
 	NAMELEN = 256,			/* hack */
 };
@@ -51,6 +52,11 @@ typedef struct SDunit {
 	ulong	secsize;
 	SDpart*	part;
 	int	npart;			/* of valid partitions */
+
+	/* the last Chunk read, aligned; tables are mostly near the front */
+	uchar*	chunk;
+	vlong	chunkoff;
+	long	nchunk;
 } SDunit;
 
 static uchar *mbrbuf, *partbuf;
@@ -136,9 +142,22 @@ sdread(SDunit *unit, SDpart *pp, void* va, long len, vlong off)
 	if(bno >= pp->end || nb == 0)
 		return 0;
 
-	seek(unit->data, bno * secsize, 0);
 	assert(va);				/* "sdread" */
-	l = read(unit->data, va, len);
+	off = bno * secsize;
+	if(len <= Chunk && unit->chunk != nil){
+		if(off < unit->chunkoff || off+len > unit->chunkoff+unit->nchunk){
+			unit->chunkoff = off & ~(vlong)(Chunk-1);
+			unit->nchunk = pread(unit->data, unit->chunk, Chunk,
+				unit->chunkoff);
+			if(unit->nchunk < 0)
+				unit->nchunk = 0;
+		}
+		if(off+len <= unit->chunkoff+unit->nchunk){
+			memmove(va, unit->chunk + (off - unit->chunkoff), len);
+			return len;
+		}
+	}
+	l = pread(unit->data, va, len, off);
 	if (l < 0)
 		return 0;
 	return l;
@@ -535,12 +554,49 @@ rdgeom(SDunit *unit)
 	seek(unit->ctl, 0, 0);
 }
 
+/*
+ * leave the layout found in $sdXXpart, in the form devsd takes
+ * from plan9.ini.  copied there, it saves the next boot probing.
+ */
+static void
+savepartitions(SDunit *unit)
+{
+	char *s, *e, var[NAMELEN+8];
+	SDpart *pp;
+	int i;
+
+	if(unit->npart <= 1)
+		return;
+	s = malloc(SDnpart*(NAMELEN+48));
+	if(s == nil)
+		return;
+	e = s;
+	*e = '\0';
+	for(i = 1, pp = &unit->part[i]; i < unit->npart; i++, pp++)
+		if(pp->valid)
+			e = seprint(e, s + SDnpart*(NAMELEN+48), "%s%s %lld %lld",
+				e == s? "": "/", pp->name, pp->start, pp->end);
+	snprint(var, sizeof var, "%spart", unit->name);
+	setenv(var, s);
+	if(debugboot)
+		print("%s=%s\n", var, s);
+	free(s);
+}
+
 static void
 setpartitions(char *name, int ctl, int data)
 {
 	SDunit sdunit;
 	SDunit *unit;
 	SDpart *part0;
+	char var[NAMELEN+8], *p;
+
+	/* devsd has already made the partitions given in plan9.ini */
+	snprint(var, sizeof var, "%spart", name);
+	if((p = getenv(var)) != nil){
+		free(p);
+		return;
+	}
 
 	unit = &sdunit;
 	memset(unit, 0, sizeof *unit);
@@ -561,19 +617,48 @@ setpartitions(char *name, int ctl, int data)
 
 	mbrbuf = malloc(Maxsec);
 	partbuf = malloc(Maxsec);
+	unit->chunk = malloc(Chunk);
 	partition(unit);
+	savepartitions(unit);
+	free(unit->chunk);
 	free(unit->part);
 }
 
+static void
+readpart(char *name)
+{
+	int ctl, data;
+	char *ctlname, *dataname;
+
+	ctlname  = smprint("/dev/%s/ctl", name);
+	dataname = smprint("/dev/%s/data", name);
+	if (ctlname == nil || dataname == nil) {
+		free(ctlname);
+		free(dataname);
+		return;
+	}
+
+	ctl  = open(ctlname, ORDWR);
+	data = open(dataname, OREAD);
+	free(ctlname);
+	free(dataname);
+
+	if (ctl >= 0 && data >= 0)
+		setpartitions(name, ctl, data);
+	close(ctl);
+	close(data);
+}
+
 /*
  * read disk partition tables so that readnvram via factotum
- * can see them.
+ * can see them.  each disk is read by its own process, so a
+ * slow one doesn't hold up the rest.
  */
 int
 readparts(void)
 {
-	int i, n, ctl, data, fd;
-	char *name, *ctlname, *dataname;
+	int i, j, n, fd, pid, nproc, *pids;
+	char *name;
 	Dir *dir;
 
 	fd = open("/dev", OREAD);
@@ -582,29 +667,31 @@ readparts(void)
 	n = dirreadall(fd, &dir);
 	close(fd);
 
+	pids = malloc(n*sizeof(int) + 1);
+	nproc = 0;
 	for(i = 0; i < n; i++) {
 		name = dir[i].name;
 		if (strncmp(name, "sd", 2) != 0)
 			continue;
-
-		ctlname  = smprint("/dev/%s/ctl", name);
-		dataname = smprint("/dev/%s/data", name);
-		if (ctlname == nil || dataname == nil) {
-			free(ctlname);
-			free(dataname);
-			continue;
+		switch(pid = (pids == nil? -1: fork())){
+		case -1:
+			readpart(name);
+			break;
+		case 0:
+			readpart(name);
+			exits(0);
+		default:
+			pids[nproc++] = pid;
+			break;
 		}
-
-		ctl  = open(ctlname, ORDWR);
-		data = open(dataname, OREAD);
-		free(ctlname);
-		free(dataname);
-
-		if (ctl >= 0 && data >= 0)
-			setpartitions(dataname, ctl, data);
-		close(ctl);
-		close(data);
 	}
+	while(nproc > 0 && (pid = waitpid()) != -1)
+		for(j = 0; j < nproc; j++)
+			if(pids[j] == pid){
+				pids[j] = pids[--nproc];
+				break;
+			}
+	free(pids);
 	free(dir);
 	return 0;
 }
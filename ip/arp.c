@@ -14,8 +14,11 @@
 
 enum
 {
-	NHASH		= (1<<6),
+	Lhash		= 8,
+	NHASH		= (1<<Lhash),
 	NCACHE		= 256,
+	Arpstale	= 15*60*1000,	/* ms before an entry is asked again */
+	Nrxmitsol	= 16,		/* solicitations rxmitsols sends at once */
 
 	AOK		= 1,
 	AWAIT		= 2,
@@ -29,7 +32,9 @@ char *arpstate[] =
 };
 
 /*
- *  one per Fs
+ *  one per Fs.  Changes are made with it qlocked, and those to
+ *  what lookups read between arpchanging and arpchanged, so
+ *  resolved addresses can be looked up without the lock.
  */
 struct Arp
 {
@@ -41,11 +46,67 @@ struct Arp
 	Proc	*rxmitp;	/* neib sol re-transmit proc */
 	Rendez	rxmtq;
 	Block 	*dropf, *dropl;
+	ulong	gen;		/* odd while changing */
 };
 
 char *Ebadarp = "bad arp";
 
-#define haship(s) ((s)[IPaddrlen-1]%NHASH)
+static int
+haship(uchar *s)
+{
+	ulong h;
+
+	h = nhgetl(s+IPaddrlen-4) ^ nhgetl(s+IPaddrlen-8);
+	return (h * 0x9e3779b1UL) >> (32-Lhash) & (NHASH-1);
+}
+
+static void
+arpchanging(Arp *arp)
+{
+	arp->gen++;
+	coherence();
+}
+
+static void
+arpchanged(Arp *arp)
+{
+	coherence();
+	arp->gen++;
+}
+
+/*
+ *  the mac of a resolved address without the lock, a sequence
+ *  lock on gen; -1 if it isn't found so, and the caller
+ *  must lock and look
+ */
+static int
+arpfast(Arp *arp, uchar *ip, Medium *type, uchar *mac)
+{
+	Arpent *a;
+	ulong gen;
+	int i, n;
+
+	for(i = 0; i < 3; i++){
+		gen = arp->gen;
+		coherence();
+		if(gen & 1)
+			continue;
+		n = 0;
+		for(a = arp->hash[haship(ip)]; a != nil && n++ < NCACHE; a = a->hash)
+			if(a->type == type && memcmp(ip, a->ip, sizeof(a->ip)) == 0)
+				break;
+		if(a == nil || a->type != type || a->state != AOK ||
+		    NOW - a->ctime > Arpstale)
+			return -1;
+		memmove(mac, a->mac, type->maclen);
+		coherence();
+		if(arp->gen == gen){
+			a->utime = NOW;
+			return 0;
+		}
+	}
+	return -1;
+}
 
 extern int 	ReTransTimer = RETRANS_TIMER;
 
@@ -201,7 +262,8 @@ cleanarpent(Arp *arp, Arpent *a)
  *  fill in the media address if we have it.  Otherwise return an
  *  Arpent that represents the state of the address resolution FSM
  *  for ip.  Add the packet to be sent onto the list of packets
- *  waiting for ip->mac to be resolved.
+ *  waiting for ip->mac to be resolved.  A resolved address takes
+ *  no lock.
  */
 Arpent*
 arpget(Arp *arp, Block *bp, int version, Ipifc *ifc, uchar *ip, uchar *mac)
@@ -215,6 +277,8 @@ arpget(Arp *arp, Block *bp, int version, Ipifc *ifc, uchar *ip, uchar *mac)
 		v4tov6(v6ip, ip);
 		ip = v6ip;
 	}
+	if(arpfast(arp, ip, type, mac) == 0)
+		return nil;
 
 	qlock(arp);
 	hash = haship(ip);
@@ -225,8 +289,10 @@ arpget(Arp *arp, Block *bp, int version, Ipifc *ifc, uchar *ip, uchar *mac)
 	}
 
 	if(a == nil){
+		arpchanging(arp);
 		a = newarp6(arp, ip, ifc, (version != V4));
 		a->state = AWAIT;
+		arpchanged(arp);
 	}
 	a->utime = NOW;
 	if(a->state == AWAIT){
@@ -244,8 +310,11 @@ arpget(Arp *arp, Block *bp, int version, Ipifc *ifc, uchar *ip, uchar *mac)
 	memmove(mac, a->mac, a->type->maclen);
 
 	/* remove old entries */
-	if(NOW - a->ctime > 15*60*1000)
+	if(NOW - a->ctime > Arpstale){
+		arpchanging(arp);
 		cleanarpent(arp, a);
+		arpchanged(arp);
+	}
 
 	qunlock(arp);
 	return nil;
@@ -254,6 +323,29 @@ arpget(Arp *arp, Block *bp, int version, Ipifc *ifc, uchar *ip, uchar *mac)
 /*
  * called with arp locked
  */
+/*
+ *  the media address for ip if it is resolved, without
+ *  starting to resolve it; -1 if it isn't
+ */
+int
+arplook(Arp *arp, int version, Ipifc *ifc, uchar *ip, uchar *mac)
+{
+	uchar v6ip[IPaddrlen];
+
+	if(version == V4){
+		v4tov6(v6ip, ip);
+		ip = v6ip;
+	}
+	return arpfast(arp, ip, ifc->m, mac);
+}
+
+/* changes whenever an entry does, for caches of what arplook says */
+ulong
+arpgen(Arp *arp)
+{
+	return arp->gen;
+}
+
 void
 arprelease(Arp *arp, Arpent*)
 {
@@ -283,9 +375,11 @@ arpresolve(Arp *arp, Arpent *a, Medium *type, uchar *mac)
 		}
 	}
 
+	arpchanging(arp);
 	memmove(a->mac, mac, type->maclen);
 	a->type = type;
 	a->state = AOK;
+	arpchanged(arp);
 	a->utime = NOW;
 	bp = a->hold;
 	a->hold = nil;
@@ -340,6 +434,7 @@ arpenter(Fs *fs, int version, uchar *ip, uchar *mac, int n, int refresh)
 			continue;
 
 		if(ipcmp(a->ip, ip) == 0){
+			arpchanging(arp);
 			a->state = AOK;
 			memmove(a->mac, mac, type->maclen);
 
@@ -363,6 +458,7 @@ arpenter(Fs *fs, int version, uchar *ip, uchar *mac, int n, int refresh)
 				ip += IPv4off;
 			a->utime = NOW;
 			a->ctime = a->utime;
+			arpchanged(arp);
 			qunlock(arp);
 
 			while(bp){
@@ -388,11 +484,13 @@ arpenter(Fs *fs, int version, uchar *ip, uchar *mac, int n, int refresh)
 	}
 
 	if(refresh == 0){
+		arpchanging(arp);
 		a = newarp6(arp, ip, ifc, 0);
 		a->state = AOK;
 		a->type = type;
 		a->ctime = NOW;
 		memmove(a->mac, mac, type->maclen);
+		arpchanged(arp);
 	}
 
 	qunlock(arp);
@@ -424,6 +522,7 @@ arpwrite(Fs *fs, char *s, int len)
 	n = getfields(buf, f, 4, 1, " ");
 	if(strcmp(f[0], "flush") == 0){
 		qlock(arp);
+		arpchanging(arp);
 		for(a = arp->cache; a < &arp->cache[NCACHE]; a++){
 			memset(a->ip, 0, sizeof(a->ip));
 			memset(a->mac, 0, sizeof(a->mac));
@@ -437,6 +536,7 @@ arpwrite(Fs *fs, char *s, int len)
 			}
 		}
 		memset(arp->hash, 0, sizeof(arp->hash));
+		arpchanged(arp);
 		/* clear all pkts on these lists (rxmt, dropf/l) */
 		arp->rxmt = nil;
 		arp->dropf = nil;
@@ -479,6 +579,7 @@ arpwrite(Fs *fs, char *s, int len)
 		if (parseip(ip, f[1]) == -1)
 			error(Ebadip);
 		qlock(arp);
+		arpchanging(arp);
 
 		l = &arp->hash[haship(ip)];
 		for(a = *l; a; a = a->hash){
@@ -508,6 +609,7 @@ arpwrite(Fs *fs, char *s, int len)
 			memset(a->ip, 0, sizeof(a->ip));
 			memset(a->mac, 0, sizeof(a->mac));
 		}
+		arpchanged(arp);
 		qunlock(arp);
 	} else
 		error(Ebadarp);
@@ -570,23 +672,27 @@ rxmitsols(Arp *arp)
 	uchar ipsrc[IPaddrlen];
 	Ipifc *ifc = nil;
 	long nrxt;
+	int i, n;
+	struct {
+		Ipifc	*ifc;
+		ulong	ifcid;
+		uchar	ip[IPaddrlen];
+	} sol[Nrxmitsol];
 
 	qlock(arp);
 	f = arp->f;
 
-	a = arp->rxmt;
-	if(a==nil){
-		nrxt = 0;
-		goto dodrops; 		/* return nrxt; */
-	}
-	nrxt = a->rtime - NOW;
-	if(nrxt > 3*ReTransTimer/4)
-		goto dodrops; 		/* return nrxt; */
-
-	for(; a; a = a->nextrxt){
+	/*
+	 *  take the solicitations that are due off the head of the
+	 *  chain in one pass, to send them after letting go of arp
+	 */
+	n = 0;
+	while((a = arp->rxmt) != nil && n < Nrxmitsol){
+		if(a->rtime - NOW > 3*ReTransTimer/4)
+			break;
 		ifc = a->ifc;
 		assert(ifc != nil);
-		if((a->rxtsrem <= 0) || !(canrlock(ifc)) || (a->ifcid != ifc->ifcid)){
+		if((a->rxtsrem <= 0) || (a->ifcid != ifc->ifcid)){
 			xp = a->hold;
 			a->hold = nil;
 
@@ -597,38 +703,26 @@ rxmitsols(Arp *arp)
 					arp->dropl->list = xp;
 			}
 
+			arpchanging(arp);
 			cleanarpent(arp, a);
+			arpchanged(arp);
+			continue;
 		}
-		else
-			break;
-	}
-	if(a == nil)
-		goto dodrops;
-
+		sol[n].ifc = ifc;
+		sol[n].ifcid = a->ifcid;
+		ipmove(sol[n].ip, a->ip);
+		n++;
 
-	qunlock(arp);	/* for icmpns */
-	if((sflag = ipv6anylocal(ifc, ipsrc)) != SRC_UNSPEC)
-		icmpns(f, ipsrc, sflag, a->ip, TARG_MULTI, ifc->mac);
-
-	runlock(ifc);
-	qlock(arp);
-
-	/* put to the end of re-transmit chain */
-	l = &arp->rxmt;
-	for(b = *l; b; b = b->nextrxt){
-		if(b == a){
-			*l = a->nextrxt;
-			break;
-		}
-		l = &b->nextrxt;
-	}
-	for(b = *l; b; b = b->nextrxt){
-		l = &b->nextrxt;
+		/* put to the end of re-transmit chain */
+		arp->rxmt = a->nextrxt;
+		l = &arp->rxmt;
+		for(b = *l; b; b = b->nextrxt)
+			l = &b->nextrxt;
+		*l = a;
+		a->rxtsrem--;
+		a->nextrxt = nil;
+		a->rtime = NOW + ReTransTimer;
 	}
-	*l = a;
-	a->rxtsrem--;
-	a->nextrxt = nil;
-	a->rtime = NOW + ReTransTimer;
 
 	a = arp->rxmt;
 	if(a==nil)
@@ -636,12 +730,21 @@ rxmitsols(Arp *arp)
 	else
 		nrxt = a->rtime - NOW;
 
-dodrops:
 	xp = arp->dropf;
 	arp->dropf = nil;
 	arp->dropl = nil;
 	qunlock(arp);
 
+	for(i = 0; i < n; i++){
+		ifc = sol[i].ifc;
+		if(!canrlock(ifc))
+			continue;
+		if(ifc->ifcid == sol[i].ifcid)
+		if((sflag = ipv6anylocal(ifc, ipsrc)) != SRC_UNSPEC)
+			icmpns(f, ipsrc, sflag, sol[i].ip, TARG_MULTI, ifc->mac);
+		runlock(ifc);
+	}
+
 	for(; xp; xp = next){
 		next = xp->list;
 		icmphostunr(f, ifc, xp, Icmp6_adr_unreach, 1);
@@ -757,6 +757,10 @@ setluniqueport(Conv* c, int lport)
 		&& xp->rport == c->rport
 		&& ipcmp(xp->raddr, c->raddr) == 0
 		&& ipcmp(xp->laddr, c->laddr) == 0){
+			/* listeners of one owner may share; iphtlook picks one per flow */
+			if(xp->state == Announced && xp->reuseport && c->reuseport
+			&& strcmp(xp->owner, c->owner) == 0)
+				continue;
 			qunlock(p);
 			return "address in use";
 		}
@@ -1092,6 +1096,7 @@ ipwrite(Chan* ch, void *v, long n, vlong off)
 	Cmdbuf *cb;
 	uchar ia[IPaddrlen], ma[IPaddrlen];
 	Fs *f;
+	Block *bp;
 	char *a;
 	ulong offset = off;
 
@@ -1108,6 +1113,22 @@ ipwrite(Chan* ch, void *v, long n, vlong off)
 		if(c->wq == nil)
 			error(Eperm);
 
+		if(c->batch && n > qiomaxatomic)
+			error(Etoobig);	/* qwrite would cut a datagram */
+		if(x->sumwrite && !c->batch && n <= qiomaxatomic){
+			/* one block, summed in the copy from the user */
+			bp = allocb(n);
+			if(waserror()){
+				freeb(bp);
+				nexterror();
+			}
+			bp->checksum = ptclcpsum(bp->wp, (uchar*)a, n);
+			bp->wp += n;
+			bp->flag |= Bpktck;
+			poperror();
+			qbwrite(c->wq, bp);
+			break;
+		}
 		qwrite(c->wq, a, n);
 		break;
 	case Qarp:
@@ -1145,6 +1166,8 @@ ipwrite(Chan* ch, void *v, long n, vlong off)
 			tosctlmsg(c, cb);
 		else if(strcmp(cb->f[0], "ignoreadvice") == 0)
 			c->ignoreadvice = 1;
+		else if(strcmp(cb->f[0], "reuseport") == 0)
+			c->reuseport = 1;
 		else if(strcmp(cb->f[0], "addmulti") == 0){
 			if(cb->nf < 2)
 				error("addmulti needs interface address");
@@ -1206,16 +1229,90 @@ ipbwrite(Chan* ch, Block* bp, ulong offset)
 		if(c->wq == nil)
 			error(Eperm);
 
-		if(bp->next)
-			bp = concatblock(bp);
-		n = BLEN(bp);
-		qbwrite(c->wq, bp);
-		return n;
+		/* qbwrite makes it one block unless the protocol takes chains */
+		return qbwrite(c->wq, bp);
 	default:
 		return devbwrite(ch, bp, offset);
 	}
 }
 
+/*
+ *  a vectored write to a data file is one block, and so one
+ *  message or one atomic stream write, for a single copy
+ */
+static long
+ipwritev(Chan* ch, Iovec *io, int nio, vlong off)
+{
+	Conv *c;
+	Proto *x;
+	Fs *f;
+	Block *bp;
+	long n;
+
+	n = iovlen(io, nio);
+	if(TYPE(ch->qid) != Qdata || n > qiomaxatomic)
+		return devwritev(ch, io, nio, off);
+
+	f = ipfs[ch->dev];
+	x = f->p[PROTO(ch->qid)];
+	c = x->conv[CONV(ch->qid)];
+
+	if(c->wq == nil)
+		error(Eperm);
+
+	bp = allocb(n);
+	if(waserror()){
+		freeb(bp);
+		nexterror();
+	}
+	bp->wp += iovgather(io, nio, 0, bp->wp, n);
+	poperror();
+
+	return qbwrite(c->wq, bp);
+}
+
+/*
+ *  data is ready as its queues are; an announced conversation's
+ *  ctl is readable when opening listen would not block
+ */
+static int
+ippoll(Chan* ch, Pollw *w)
+{
+	Conv *c;
+	Fs *f;
+	int r;
+
+	f = ipfs[ch->dev];
+	switch(TYPE(ch->qid)){
+	case Qdata:
+		c = f->p[PROTO(ch->qid)]->conv[CONV(ch->qid)];
+		r = 0;
+		if(w->mask & Pollin)
+			r |= qpoll(c->rq, w, Pollin);
+		if(w->mask & Pollout){
+			if(c->wq == nil)
+				r |= Pollout;
+			else
+				r |= qpoll(c->wq, w, Pollout);
+		}
+		return r;
+	case Qerr:
+		c = f->p[PROTO(ch->qid)]->conv[CONV(ch->qid)];
+		return qpoll(c->eq, w, Pollin);
+	case Qctl:
+		c = f->p[PROTO(ch->qid)]->conv[CONV(ch->qid)];
+		if(c->state != Announced)
+			break;
+		pollon(w, &c->listenp);
+		if(c->incall != nil)
+			return Pollin|Pollout;
+		if(qisclosed(c->rq))
+			return Pollin|Pollout|Pollhup;
+		return Pollout;
+	}
+	return Pollin|Pollout;
+}
+
 Dev ipdevtab = {
 	'I',
 	"ip",
@@ -1235,6 +1332,11 @@ Dev ipdevtab = {
 	ipbwrite,
 	ipremove,
 	ipwstat,
+	devpower,
+	devconfig,
+	nil,
+	ipwritev,
+	ippoll,
 };
 
 int
@@ -1340,6 +1442,7 @@ retry:
 	c->lport = 0;
 	c->rport = 0;
 	c->restricted = 0;
+	c->reuseport = 0;
 	c->maxfragsize = 0;
 	c->ttl = MAXTTL;
 	qreopen(c->rq);
@@ -1430,6 +1533,7 @@ Fsnewcall(Conv *c, uchar *raddr, ushort rport, uchar *laddr, ushort lport, uchar
 	qunlock(c);
 
 	wakeup(&c->listenr);
+	pollwakeup(&c->listenp);
 
 	return nc;
 }
@@ -16,6 +16,7 @@
 #include	"ip.h"
 #include	"ipv6.h"
 #include	"libsec.h"
+#include	"../port/aes.h"
 
 #define BITS2BYTES(bi) (((bi) + BI2BY - 1) / BI2BY)
 #define BYTES2BITS(by)  ((by) * BI2BY)
@@ -27,6 +28,7 @@ typedef struct Espcb Espcb;
 typedef struct Esphdr Esphdr;
 typedef struct Esppriv Esppriv;
 typedef struct Esptail Esptail;
+typedef struct Hmac Hmac;
 typedef struct Userhdr Userhdr;
 
 enum {
@@ -45,6 +47,13 @@ enum {
 
 	Aesblk	 = BITS2BYTES(128),
 	Aeskeysz = BITS2BYTES(128),
+
+	Gcmsaltsz = 4,
+	Gcmivsz	 = 8,
+	Gcmicvsz = 16,
+
+	Espburst = 16,	/* packets encapsulated per qlock */
+	Nspihash = 64,
 };
 
 struct Esphdr
@@ -116,6 +125,9 @@ struct Esppriv
 {
 	uvlong	in;
 	ulong	inerrors;
+
+	Lock	spilock;
+	Conv	*spihash[Nspihash];	/* incoming convs by spi */
 };
 
 /*
@@ -134,6 +146,7 @@ struct Espcb
 	int	espivlen;	/* in bytes */
 	int	espblklen;
 	int	(*cipher)(Espcb*, uchar *buf, int len);
+	int	(*ciphern)(Espcb*, uchar **buf, long *len, int n);	/* outgoing, a burst at once */
 
 	char	*ahalg;
 	void	*ahstate;	/* other state for esp */
@@ -141,6 +154,17 @@ struct Espcb
 	int	ahblklen;
 	int	(*auth)(Espcb*, uchar *buf, int len, uchar *hash);
 	DigestState *ds;
+
+	Conv	*spinext;	/* in the spi hash */
+};
+
+/* hmac with the padded key already hashed, rfc2104 */
+struct Hmac
+{
+	DigestState	in;
+	DigestState	out;
+	DigestState*	(*fn)(uchar*, ulong, uchar*, DigestState*);
+	int	dlen;
 };
 
 struct Algorithm
@@ -151,6 +175,8 @@ struct Algorithm
 };
 
 static	Conv* convlookup(Proto *esp, ulong spi);
+static	void spihashin(Proto *esp, Conv *c);
+static	void spihashout(Proto *esp, Conv *c);
 static	char *setalg(Espcb *ecb, char **f, int n, Algorithm *alg);
 static	void espkick(void *x);
 
@@ -158,6 +184,7 @@ static	void nullespinit(Espcb*, char*, uchar *key, unsigned keylen);
 static	void des3espinit(Espcb*, char*, uchar *key, unsigned keylen);
 static	void aescbcespinit(Espcb*, char*, uchar *key, unsigned keylen);
 static	void aesctrespinit(Espcb*, char*, uchar *key, unsigned keylen);
+static	void aesgcmespinit(Espcb*, char*, uchar *key, unsigned keylen);
 static	void desespinit(Espcb *ecb, char *name, uchar *k, unsigned n);
 
 static	void nullahinit(Espcb*, char*, uchar *key, unsigned keylen);
@@ -165,12 +192,16 @@ static	void shaahinit(Espcb*, char*, uchar *key, unsigned keylen);
 static	void aesahinit(Espcb*, char*, uchar *key, unsigned keylen);
 static	void md5ahinit(Espcb*, char*, uchar *key, unsigned keylen);
 
+static	int aesgcmcipher(Espcb*, uchar*, int);
+static	int aesgcmauth(Espcb*, uchar*, int, uchar*);
+
 static Algorithm espalg[] =
 {
 	"null",		0,	nullespinit,
 	"des3_cbc",	192,	des3espinit,	/* new rfc2451, des-ede3 */
 	"aes_128_cbc",	128,	aescbcespinit,	/* new rfc3602 */
 	"aes_ctr",	128,	aesctrespinit,	/* new rfc3686 */
+	"aes_gcm_128",	160,	aesgcmespinit,	/* rfc4106, key then salt */
 	"des_56_cbc",	64,	desespinit,	/* rfc2405, deprecated */
 	/* rc4 was never required, was used in original bandt */
 //	"rc4_128",	128,	rc4espinit,
@@ -209,6 +240,7 @@ espconnect(Conv *c, char **argv, int argc)
 			break;
 		}
 		findlocalip(c->p->f, c->laddr, c->raddr);
+		spihashout(c->p, c);
 		ecb->incoming = 0;
 		ecb->seq = 0;
 		if(strcmp(p, "*") == 0) {
@@ -218,9 +250,10 @@ espconnect(Conv *c, char **argv, int argc)
 				if(convlookup(c->p, spi) == nil)
 					break;
 			}
-			qunlock(c->p);
 			ecb->spi = spi;
 			ecb->incoming = 1;
+			spihashin(c->p, c);
+			qunlock(c->p);
 			qhangup(c->wq, nil);
 		} else {
 			spi = strtoul(p, &pp, 10);
@@ -265,6 +298,7 @@ espclose(Conv *c)
 	ipmove(c->raddr, IPnoaddr);
 
 	ecb = (Espcb*)c->ptcl;
+	spihashout(c->p, c);
 	free(ecb->espstate);
 	free(ecb->ahstate);
 	memset(ecb, 0, sizeof(Espcb));
@@ -338,38 +372,22 @@ getpktspiaddrs(uchar *pkt, Versdep *vp)
 }
 
 /*
- * encapsulate next IP packet on x's write queue in IP/ESP packet
- * and initiate output of the result.
+ * wrap IP packet bp in an ESP header, padding and trailer, leaving
+ * room for the IP header in front and the auth data behind.
+ * *np gets the length of the part to encrypt, iv first.
  */
-static void
-espkick(void *x)
+static Block*
+espwrap(Espcb *ecb, Versdep *vp, Block *bp, long *np)
 {
 	int nexthdr, payload, pad, align;
-	uchar *auth;
-	Block *bp;
-	Conv *c = x;
-	Esp4hdr *eh4;
-	Esp6hdr *eh6;
-	Espcb *ecb;
 	Esptail *et;
 	Userhdr *uh;
-	Versdep vers;
-
-	getverslens(convipvers(c), &vers);
-	bp = qget(c->wq);
-	if(bp == nil)
-		return;
-
-	qlock(c);
-	ecb = c->ptcl;
 
 	if(ecb->header) {
 		/* make sure the message has a User header */
 		bp = pullupblock(bp, Userhdrlen);
-		if(bp == nil) {
-			qunlock(c);
-			return;
-		}
+		if(bp == nil)
+			return nil;
 		uh = (Userhdr*)bp->rp;
 		nexthdr = uh->nexthdr;
 		bp->rp += Userhdrlen;
@@ -380,8 +398,7 @@ espkick(void *x)
 	payload = BLEN(bp) + ecb->espivlen;
 
 	/* Make space to fit ip header */
-	bp = padblock(bp, vers.hdrlen + ecb->espivlen);
-	getpktspiaddrs(bp->rp, &vers);
+	bp = padblock(bp, vp->hdrlen + ecb->espivlen);
 
 	align = 4;
 	if(ecb->espblklen > align)
@@ -398,18 +415,24 @@ espkick(void *x)
 	bp = padblock(bp, -(pad+Esptaillen+ecb->ahlen));
 	bp->wp += pad+Esptaillen+ecb->ahlen;
 
-	et = (Esptail*)(bp->rp + vers.hdrlen + payload + pad);
+	et = (Esptail*)(bp->rp + vp->hdrlen + payload + pad);
 
 	/* fill in tail */
 	et->pad = pad;
 	et->nexthdr = nexthdr;
 
-	/* encrypt the payload */
-	ecb->cipher(ecb, bp->rp + vers.hdrlen, payload + pad + Esptaillen);
-	auth = bp->rp + vers.hdrlen + payload + pad + Esptaillen;
+	*np = payload + pad + Esptaillen;
+	return bp;
+}
+
+/* fill in head; construct a new IP header and an ESP header */
+static void
+esphead(Conv *c, Espcb *ecb, Versdep *vp, Block *bp)
+{
+	Esp4hdr *eh4;
+	Esp6hdr *eh6;
 
-	/* fill in head; construct a new IP header and an ESP header */
-	if (vers.version == V4) {
+	if (vp->version == V4) {
 		eh4 = (Esp4hdr *)bp->rp;
 		eh4->vihl = IP_VER4;
 		v6tov4(eh4->espsrc, c->laddr);
@@ -430,17 +453,73 @@ espkick(void *x)
 		hnputl(eh6->espspi, ecb->spi);
 		hnputl(eh6->espseq, ++ecb->seq);
 	}
+}
 
-	/* compute secure hash */
-	ecb->auth(ecb, bp->rp + vers.iphdrlen, (vers.hdrlen - vers.iphdrlen) +
-		payload + pad + Esptaillen, auth);
+/* compute secure hash over the esp header and the n encrypted bytes */
+static void
+espsign(Espcb *ecb, Versdep *vp, Block *bp, long n)
+{
+	ecb->auth(ecb, bp->rp + vp->iphdrlen, (vp->hdrlen - vp->iphdrlen) + n,
+		bp->rp + vp->hdrlen + n);
+}
 
-	qunlock(c);
-	/* print("esp: pass down: %uld\n", BLEN(bp)); */
-	if (vers.version == V4)
-		ipoput4(c->p->f, bp, 0, c->ttl, c->tos, c);
-	else
-		ipoput6(c->p->f, bp, 0, c->ttl, c->tos, c);
+/*
+ * encapsulate the IP packets on x's write queue in IP/ESP packets
+ * and initiate output of the results, up to Espburst for each
+ * qlock.  a cipher with ciphern encrypts the whole burst in one
+ * call; the others go a packet at a time, heading each after its
+ * encryption since gcm's iv is the sequence number to come.
+ */
+static void
+espkick(void *x)
+{
+	int i, n;
+	long len[Espburst];
+	uchar *p[Espburst];
+	Block *bp, *b[Espburst];
+	Conv *c = x;
+	Espcb *ecb;
+	Versdep vers;
+
+	getverslens(convipvers(c), &vers);
+	do {
+		qlock(c);
+		ecb = c->ptcl;
+		n = 0;
+		while(n < Espburst && (bp = qget(c->wq)) != nil){
+			bp = espwrap(ecb, &vers, bp, &len[n]);
+			if(bp != nil)
+				b[n++] = bp;
+		}
+		if(n == 0){
+			qunlock(c);
+			return;
+		}
+
+		if(ecb->ciphern != nil){
+			for(i = 0; i < n; i++){
+				esphead(c, ecb, &vers, b[i]);
+				p[i] = b[i]->rp + vers.hdrlen;
+			}
+			ecb->ciphern(ecb, p, len, n);
+			for(i = 0; i < n; i++)
+				espsign(ecb, &vers, b[i], len[i]);
+		} else {
+			for(i = 0; i < n; i++){
+				ecb->cipher(ecb, b[i]->rp + vers.hdrlen, len[i]);
+				esphead(c, ecb, &vers, b[i]);
+				espsign(ecb, &vers, b[i], len[i]);
+			}
+		}
+		qunlock(c);
+
+		/* print("esp: pass down: %uld\n", BLEN(bp)); */
+		for(i = 0; i < n; i++)
+			if (vers.version == V4)
+				ipoput4(c->p->f, b[i], 0, c->ttl, c->tos, c);
+			else
+				ipoput6(c->p->f, b[i], 0, c->ttl, c->tos, c);
+	} while(n == Espburst);
 }
 
 /*
@@ -470,11 +549,18 @@ espiput(Proto *esp, Ipifc*, Block *bp)
 	}
 	getpktspiaddrs(bp->rp, &vers);
 
-	qlock(esp);
 	/* Look for a conversation structure for this port */
 	c = convlookup(esp, vers.spi);
+	if(c != nil) {
+		qlock(c);
+		/* closed or reconnected since the lookup? */
+		ecb = c->ptcl;
+		if(!ecb->incoming || ecb->spi != vers.spi) {
+			qunlock(c);
+			c = nil;
+		}
+	}
 	if(c == nil) {
-		qunlock(esp);
 		netlog(f, Logesp, "esp: no conv %I -> %I!%lud\n", vers.raddr,
 			vers.laddr, vers.spi);
 		icmpnoconv(f, bp);
@@ -482,10 +568,6 @@ espiput(Proto *esp, Ipifc*, Block *bp)
 		return;
 	}
 
-	qlock(c);
-	qunlock(esp);
-
-	ecb = c->ptcl;
 	/* too hard to do decryption/authentication on block lists */
 	if(bp->next)
 		bp = concatblock(bp);
@@ -574,11 +656,17 @@ espctl(Conv *c, char **f, int n)
 	Espcb *ecb = c->ptcl;
 	char *e = nil;
 
-	if(strcmp(f[0], "esp") == 0)
+	if(strcmp(f[0], "esp") == 0){
 		e = setalg(ecb, f, n, espalg);
-	else if(strcmp(f[0], "ah") == 0)
-		e = setalg(ecb, f, n, ahalg);
-	else if(strcmp(f[0], "header") == 0)
+		/* gcm's icv goes with its cipher */
+		if(ecb->auth == aesgcmauth && ecb->cipher != aesgcmcipher)
+			nullahinit(ecb, "null", nil, 0);
+	}else if(strcmp(f[0], "ah") == 0){
+		if(ecb->auth == aesgcmauth)
+			e = "esp algorithm does its own authentication";
+		else
+			e = setalg(ecb, f, n, ahalg);
+	}else if(strcmp(f[0], "header") == 0)
 		ecb->header = 1;
 	else if(strcmp(f[0], "noheader") == 0)
 		ecb->header = 0;
@@ -648,19 +736,61 @@ espremote(Conv *c, char *buf, int len)
 	return n;
 }
 
+/*
+ * incoming convs are hashed by spi.  espiput looks them up without
+ * qlocking the protocol, so it must check the conv again once it
+ * has it qlocked.
+ */
 static	Conv*
 convlookup(Proto *esp, ulong spi)
 {
-	Conv *c, **p;
+	Conv *c;
+	Esppriv *ep;
+
+	ep = esp->priv;
+	lock(&ep->spilock);
+	for(c = ep->spihash[spi%Nspihash]; c != nil; c = ((Espcb*)c->ptcl)->spinext)
+		if(((Espcb*)c->ptcl)->spi == spi)
+			break;
+	unlock(&ep->spilock);
+	return c;
+}
+
+static void
+spihashin(Proto *esp, Conv *c)
+{
+	Esppriv *ep;
 	Espcb *ecb;
+	Conv **l;
 
-	for(p=esp->conv; *p; p++){
-		c = *p;
-		ecb = c->ptcl;
-		if(ecb->incoming && ecb->spi == spi)
-			return c;
-	}
-	return nil;
+	ep = esp->priv;
+	ecb = c->ptcl;
+	lock(&ep->spilock);
+	l = &ep->spihash[ecb->spi%Nspihash];
+	ecb->spinext = *l;
+	*l = c;
+	unlock(&ep->spilock);
+}
+
+static void
+spihashout(Proto *esp, Conv *c)
+{
+	Esppriv *ep;
+	Espcb *ecb;
+	Conv **l;
+
+	ep = esp->priv;
+	ecb = c->ptcl;
+	if(!ecb->incoming)
+		return;
+	lock(&ep->spilock);
+	for(l = &ep->spihash[ecb->spi%Nspihash]; *l != nil; l = &((Espcb*)(*l)->ptcl)->spinext)
+		if(*l == c){
+			*l = ecb->spinext;
+			break;
+		}
+	ecb->spinext = nil;
+	unlock(&ep->spilock);
 }
 
 static char *
@@ -729,6 +859,7 @@ nullespinit(Espcb *ecb, char *name, uchar*, unsigned)
 	ecb->espblklen = 1;
 	ecb->espivlen = 0;
 	ecb->cipher = nullcipher;
+	ecb->ciphern = nil;
 }
 
 static int
@@ -748,42 +879,60 @@ nullahinit(Espcb *ecb, char *name, uchar*, unsigned)
 
 
 /*
- * sha1
+ * hmac, rfc2104, for sha1 and md5
  */
 
+/* hash the key's inner and outer pads once, for every packet to start from */
 static void
-seanq_hmac_sha1(uchar hash[SHA1dlen], uchar *t, long tlen, uchar *key, long klen)
+hmacsetup(Hmac *h, DigestState *(*fn)(uchar*, ulong, uchar*, DigestState*),
+	int dlen, uchar *key, long klen)
 {
 	int i;
-	uchar ipad[Hmacblksz+1], opad[Hmacblksz+1], innerhash[SHA1dlen];
-	DigestState *digest;
+	uchar ipad[Hmacblksz], opad[Hmacblksz];
+	DigestState *s;
 
 	memset(ipad, 0x36, Hmacblksz);
 	memset(opad, 0x5c, Hmacblksz);
-	ipad[Hmacblksz] = opad[Hmacblksz] = 0;
 	for(i = 0; i < klen; i++){
 		ipad[i] ^= key[i];
 		opad[i] ^= key[i];
 	}
-	digest = sha1(ipad, Hmacblksz, nil, nil);
-	sha1(t, tlen, innerhash, digest);
-	digest = sha1(opad, Hmacblksz, nil, nil);
-	sha1(innerhash, SHA1dlen, hash, digest);
+	s = (*fn)(ipad, Hmacblksz, nil, nil);
+	h->in = *s;
+	h->in.malloced = 0;
+	free(s);
+	s = (*fn)(opad, Hmacblksz, nil, nil);
+	h->out = *s;
+	h->out.malloced = 0;
+	free(s);
+	h->fn = fn;
+	h->dlen = dlen;
 }
 
 static int
-shaauth(Espcb *ecb, uchar *t, int tlen, uchar *auth)
+hmacauth(Espcb *ecb, uchar *t, int tlen, uchar *auth)
 {
 	int r;
-	uchar hash[SHA1dlen];
+	uchar hash[SHA1dlen], innerhash[SHA1dlen];
+	DigestState s;
+	Hmac *h;
 
+	h = ecb->ahstate;
 	memset(hash, 0, SHA1dlen);
-	seanq_hmac_sha1(hash, t, tlen, (uchar*)ecb->ahstate, BITS2BYTES(128));
+	s = h->in;
+	(*h->fn)(t, tlen, innerhash, &s);
+	s = h->out;
+	(*h->fn)(innerhash, h->dlen, hash, &s);
 	r = memcmp(auth, hash, ecb->ahlen) == 0;
 	memmove(auth, hash, ecb->ahlen);
 	return r;
 }
 
+
+/*
+ * sha1
+ */
+
 static void
 shaahinit(Espcb *ecb, char *name, uchar *key, unsigned klen)
 {
@@ -794,9 +943,9 @@ shaahinit(Espcb *ecb, char *name, uchar *key, unsigned klen)
 	ecb->ahalg = name;
 	ecb->ahblklen = 1;
 	ecb->ahlen = BITS2BYTES(96);
-	ecb->auth = shaauth;
-	ecb->ahstate = smalloc(klen);
-	memmove(ecb->ahstate, key, klen);
+	ecb->auth = hmacauth;
+	ecb->ahstate = smalloc(sizeof(Hmac));
+	hmacsetup(ecb->ahstate, sha1, SHA1dlen, key, klen);
 }
 
 
@@ -837,40 +986,31 @@ aesahinit(Espcb *ecb, char *name, uchar *key, unsigned klen)
 static int
 aescbccipher(Espcb *ecb, uchar *p, int n)	/* 128-bit blocks */
 {
-	uchar tmp[AESbsize], q[AESbsize];
-	uchar *pp, *tp, *ip, *eip, *ep;
 	AESstate *ds = ecb->espstate;
 
-	ep = p + n;
 	if(ecb->incoming) {
 		memmove(ds->ivec, p, AESbsize);
-		p += AESbsize;
-		while(p < ep){
-			memmove(tmp, p, AESbsize);
-			aes_decrypt(ds->dkey, ds->rounds, p, q);
-			memmove(p, q, AESbsize);
-			tp = tmp;
-			ip = ds->ivec;
-			for(eip = ip + AESbsize; ip < eip; ){
-				*p++ ^= *ip;
-				*ip++ = *tp++;
-			}
-		}
+		aescbcdec(ds, p + AESbsize, n - AESbsize);
 	} else {
-		memmove(p, ds->ivec, AESbsize);
-		for(p += AESbsize; p < ep; p += AESbsize){
-			pp = p;
-			ip = ds->ivec;
-			for(eip = ip + AESbsize; ip < eip; )
-				*pp++ ^= *ip++;
-			aes_encrypt(ds->ekey, ds->rounds, p, q);
-			memmove(ds->ivec, q, AESbsize);
-			memmove(p, q, AESbsize);
-		}
+		randomread(p, AESbsize);
+		memmove(ds->ivec, p, AESbsize);
+		aescbcenc(ds, p + AESbsize, n - AESbsize);
 	}
 	return 1;
 }
 
+/* each packet gets a random iv, so a burst encrypts independently */
+static int
+aescbcciphern(Espcb *ecb, uchar **p, long *n, int np)
+{
+	int i;
+
+	for(i = 0; i < np; i++)
+		randomread(p[i], AESbsize);
+	aescbcencn(ecb->espstate, p, n, np);
+	return 1;
+}
+
 static void
 aescbcespinit(Espcb *ecb, char *name, uchar *k, unsigned n)
 {
@@ -888,47 +1028,11 @@ aescbcespinit(Espcb *ecb, char *name, uchar *k, unsigned n)
 	ecb->espblklen = Aesblk;
 	ecb->espivlen = Aesblk;
 	ecb->cipher = aescbccipher;
+	ecb->ciphern = aescbcciphern;
 	ecb->espstate = smalloc(sizeof(AESstate));
 	setupAESstate(ecb->espstate, key, n /* keybytes */, ivec);
 }
 
-static int
-aesctrcipher(Espcb *ecb, uchar *p, int n)	/* 128-bit blocks */
-{
-	uchar tmp[AESbsize], q[AESbsize];
-	uchar *pp, *tp, *ip, *eip, *ep;
-	AESstate *ds = ecb->espstate;
-
-	ep = p + n;
-	if(ecb->incoming) {
-		memmove(ds->ivec, p, AESbsize);
-		p += AESbsize;
-		while(p < ep){
-			memmove(tmp, p, AESbsize);
-			aes_decrypt(ds->dkey, ds->rounds, p, q);
-			memmove(p, q, AESbsize);
-			tp = tmp;
-			ip = ds->ivec;
-			for(eip = ip + AESbsize; ip < eip; ){
-				*p++ ^= *ip;
-				*ip++ = *tp++;
-			}
-		}
-	} else {
-		memmove(p, ds->ivec, AESbsize);
-		for(p += AESbsize; p < ep; p += AESbsize){
-			pp = p;
-			ip = ds->ivec;
-			for(eip = ip + AESbsize; ip < eip; )
-				*pp++ ^= *ip++;
-			aes_encrypt(ds->ekey, ds->rounds, p, q);
-			memmove(ds->ivec, q, AESbsize);
-			memmove(p, q, AESbsize);
-		}
-	}
-	return 1;
-}
-
 static void
 aesctrespinit(Espcb *ecb, char *name, uchar *k, unsigned n)
 {
@@ -945,49 +1049,70 @@ aesctrespinit(Espcb *ecb, char *name, uchar *k, unsigned n)
 	ecb->espalg = name;
 	ecb->espblklen = Aesblk;
 	ecb->espivlen = Aesblk;
-	ecb->cipher = aesctrcipher;
+	/* has always been cbc on the wire; rfc3686 counter mode is still to do */
+	ecb->cipher = aescbccipher;
+	ecb->ciphern = aescbcciphern;
 	ecb->espstate = smalloc(sizeof(AESstate));
 	setupAESstate(ecb->espstate, key, n /* keybytes */, ivec);
 }
 
-
 /*
- * md5
+ * aes_gcm_128, rfc4106.  The last 4 bytes of the key are the salt,
+ * the 8-byte iv is the sequence number the packet is about to get,
+ * and the 16-byte icv is gcm's tag over the esp header, iv and
+ * ciphertext, so the cipher brings its own ah.
  */
-
-static void
-seanq_hmac_md5(uchar hash[MD5dlen], uchar *t, long tlen, uchar *key, long klen)
+static int
+aesgcmcipher(Espcb *ecb, uchar *p, int n)
 {
-	int i;
-	uchar ipad[Hmacblksz+1], opad[Hmacblksz+1], innerhash[MD5dlen];
-	DigestState *digest;
-
-	memset(ipad, 0x36, Hmacblksz);
-	memset(opad, 0x5c, Hmacblksz);
-	ipad[Hmacblksz] = opad[Hmacblksz] = 0;
-	for(i = 0; i < klen; i++){
-		ipad[i] ^= key[i];
-		opad[i] ^= key[i];
+	if(!ecb->incoming) {
+		hnputl(p, 0);
+		hnputl(p + 4, ecb->seq + 1);
 	}
-	digest = md5(ipad, Hmacblksz, nil, nil);
-	md5(t, tlen, innerhash, digest);
-	digest = md5(opad, Hmacblksz, nil, nil);
-	md5(innerhash, MD5dlen, hash, digest);
+	aesgcmcrypt(ecb->espstate, p, p + Gcmivsz, n - Gcmivsz);
+	return 1;
 }
 
 static int
-md5auth(Espcb *ecb, uchar *t, int tlen, uchar *auth)
+aesgcmauth(Espcb *ecb, uchar *t, int tlen, uchar *auth)
 {
-	uchar hash[MD5dlen];
-	int r;
-
-	memset(hash, 0, MD5dlen);
-	seanq_hmac_md5(hash, t, tlen, (uchar*)ecb->ahstate, BITS2BYTES(128));
-	r = memcmp(auth, hash, ecb->ahlen) == 0;
-	memmove(auth, hash, ecb->ahlen);
+	int r, hl;
+	uchar tag[Gcmicvsz];
+
+	hl = sizeof(Esphdr);
+	aesgcmtag(ecb->espstate, t + hl, t, hl, t + hl + Gcmivsz,
+		tlen - hl - Gcmivsz, tag);
+	r = memcmp(auth, tag, ecb->ahlen) == 0;
+	memmove(auth, tag, ecb->ahlen);
 	return r;
 }
 
+static void
+aesgcmespinit(Espcb *ecb, char *name, uchar *k, unsigned n)
+{
+	Aesgcm *g;
+
+	n = BITS2BYTES(n) - Gcmsaltsz;
+	g = smalloc(sizeof(Aesgcm));
+	setupaesgcm(g, k, n, k + n);
+	ecb->espalg = name;
+	ecb->espblklen = 4;
+	ecb->espivlen = Gcmivsz;
+	ecb->cipher = aesgcmcipher;
+	ecb->ciphern = nil;
+	ecb->espstate = g;
+
+	ecb->ahalg = name;
+	ecb->ahblklen = 1;
+	ecb->ahlen = Gcmicvsz;
+	ecb->auth = aesgcmauth;
+}
+
+
+/*
+ * md5
+ */
+
 static void
 md5ahinit(Espcb *ecb, char *name, uchar *key, unsigned klen)
 {
@@ -997,9 +1122,9 @@ md5ahinit(Espcb *ecb, char *name, uchar *key, unsigned klen)
 	ecb->ahalg = name;
 	ecb->ahblklen = 1;
 	ecb->ahlen = BITS2BYTES(96);
-	ecb->auth = md5auth;
-	ecb->ahstate = smalloc(klen);
-	memmove(ecb->ahstate, key, klen);
+	ecb->auth = hmacauth;
+	ecb->ahstate = smalloc(sizeof(Hmac));
+	hmacsetup(ecb->ahstate, md5, MD5dlen, key, klen);
 }
 
 
@@ -1055,6 +1180,7 @@ desespinit(Espcb *ecb, char *name, uchar *k, unsigned n)
 	ecb->espivlen = Desblk;
 
 	ecb->cipher = descipher;
+	ecb->ciphern = nil;
 	ecb->espstate = smalloc(sizeof(DESstate));
 	setupDESstate(ecb->espstate, key, ivec);
 }
@@ -1077,6 +1203,7 @@ des3espinit(Espcb *ecb, char *name, uchar *k, unsigned n)
 	ecb->espivlen = Desblk;
 
 	ecb->cipher = des3cipher;
+	ecb->ciphern = nil;
 	ecb->espstate = smalloc(sizeof(DES3state));
 	setupDES3state(ecb->espstate, key, ivec);
 }
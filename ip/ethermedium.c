@@ -31,6 +31,10 @@ static void	etherread6(void *a);
 static void	etherbind(Ipifc *ifc, int argc, char **argv);
 static void	etherunbind(Ipifc *ifc);
 static void	etherbwrite(Ipifc *ifc, Block *bp, int version, uchar *ip);
+static void	ethersend(Ipifc *ifc, Block *bp, int version, uchar *mac);
+static void	etherhdr(Ipifc *ifc, int version, uchar *mac, uchar *p);
+static int	etherlinkhdr(Ipifc *ifc, int version, uchar *ip, uchar *hdr);
+static void	etherhwrite(Ipifc *ifc, Block *bp, int version);
 static void	etheraddmulti(Ipifc *ifc, uchar *a, uchar *ia);
 static void	etherremmulti(Ipifc *ifc, uchar *a, uchar *ia);
 static Block*	multicastarp(Fs *f, Arpent *a, Medium*, uchar *mac);
@@ -56,6 +60,9 @@ Medium ethermedium =
 .ares=		arpenter,
 .areg=		sendgarp,
 .pref2addr=	etherpref2addr,
+.linkhdr=	etherlinkhdr,
+.hwrite=	etherhwrite,
+.csum=		1,
 };
 
 Medium gbemedium =
@@ -73,6 +80,9 @@ Medium gbemedium =
 .ares=		arpenter,
 .areg=		sendgarp,
 .pref2addr=	etherpref2addr,
+.linkhdr=	etherlinkhdr,
+.hwrite=	etherhwrite,
+.csum=		1,
 };
 
 typedef struct	Etherrock Etherrock;
@@ -87,6 +97,8 @@ struct Etherrock
 	Chan	*cchan4;	/* Control channel for v4 */
 	Chan	*mchan6;	/* Data channel for v6 */
 	Chan	*cchan6;	/* Control channel for v6 */
+	int	tso;		/* largest super-frame the device cuts up */
+	int	csum;		/* device sums tcp and udp */
 };
 
 /*
@@ -128,7 +140,7 @@ etherbind(Ipifc *ifc, int argc, char **argv)
 	char addr[Maxpath];	//char addr[2*KNAMELEN];
 	char dir[Maxpath];	//char dir[2*KNAMELEN];
 	char *buf;
-	int n;
+	int n, tso, csum;
 	char *ptr;
 	Etherrock *er;
 
@@ -195,6 +207,18 @@ etherbind(Ipifc *ifc, int argc, char **argv)
 	} else
 		ifc->mbps = 100;
 
+	ptr = strstr(buf, "tso: ");
+	if(ptr)
+		tso = atoi(ptr + 5);
+	else
+		tso = 0;
+
+	ptr = strstr(buf, "csum: ");
+	if(ptr)
+		csum = atoi(ptr + 6);
+	else
+		csum = 0;
+
 	/*
  	 *  open arp conversation
 	 */
@@ -222,7 +246,17 @@ etherbind(Ipifc *ifc, int argc, char **argv)
 	er->mchan6 = mchan6;
 	er->cchan6 = cchan6;
 	er->f = ifc->conv->p->f;
+	er->tso = tso;
+	er->csum = csum;
 	ifc->arg = er;
+	ifc->csum = csum != 0;
+
+	/* offer tcp the device's super-frames, less our header */
+	if(tso > ifc->m->hsize){
+		ifc->tso = tso - ifc->m->hsize;
+		if(ifc->tso >= IP_MAX)
+			ifc->tso = IP_MAX-1;
+	}
 
 	free(buf);
 	poperror();
@@ -271,7 +305,7 @@ etherunbind(Ipifc *ifc)
 static void
 etherbwrite(Ipifc *ifc, Block *bp, int version, uchar *ip)
 {
-	Etherhdr *eh;
+	Block *hbp;
 	Arpent *a;
 	uchar mac[6];
 	Etherrock *er = ifc->arg;
@@ -296,32 +330,107 @@ etherbwrite(Ipifc *ifc, Block *bp, int version, uchar *ip)
 		}
 	}
 
-	/* make it a single block with space for the ether header */
-	bp = padblock(bp, ifc->m->hsize);
+	/*
+	 *  cut up a tcp super-segment the device can't, and any to
+	 *  ourselves: it would loop back with its checksum unfinished
+	 */
+	if((bp->flag & Btso) && (blocklen(bp) + ifc->m->hsize > er->tso ||
+	    memcmp(mac, ifc->mac, sizeof(mac)) == 0)){
+		for(bp = ipsegment4(bp); bp != nil; bp = hbp){
+			hbp = bp->list;
+			bp->list = nil;
+			ethersend(ifc, bp, version, mac);
+		}
+		return;
+	}
+
+	/*
+	 *  likewise sum what the device can't, and what loops back
+	 *  to us: broadcast, multicast and our own address
+	 */
+	if((bp->flag & Bcsum) && (er->csum == 0 || (mac[0] & 1) ||
+	    memcmp(mac, ifc->mac, sizeof(mac)) == 0))
+		ipfinishcsum4(bp);
+	ethersend(ifc, bp, version, mac);
+}
+
+/*
+ *  put the ether header on a packet and write it to the device
+ */
+static void
+ethersend(Ipifc *ifc, Block *bp, int version, uchar *mac)
+{
+	Block *hbp;
+
+	/*
+	 *  make it a single block with space for the ether header,
+	 *  copying the payload at most once
+	 */
+	if(bp->next == nil || bp->rp - bp->base >= ifc->m->hsize)
+		bp = padblock(bp, ifc->m->hsize);
+	else {
+		hbp = allocb(ifc->m->hsize);
+		hbp->wp += ifc->m->hsize;
+		hbp->next = bp;
+		bp = hbp;
+	}
 	if(bp->next)
 		bp = concatblock(bp);
-	if(BLEN(bp) < ifc->mintu)
-		bp = adjustblock(bp, ifc->mintu);
-	eh = (Etherhdr*)bp->rp;
+	etherhdr(ifc, version, mac, bp->rp);
+	etherhwrite(ifc, bp, version);
+}
 
-	/* copy in mac addresses and ether type */
+/* copy in mac addresses and ether type */
+static void
+etherhdr(Ipifc *ifc, int version, uchar *mac, uchar *p)
+{
+	Etherhdr *eh;
+
+	eh = (Etherhdr*)p;
 	memmove(eh->s, ifc->mac, sizeof(eh->s));
 	memmove(eh->d, mac, sizeof(eh->d));
-
  	switch(version){
 	case V4:
 		eh->t[0] = 0x08;
 		eh->t[1] = 0x00;
-		devtab[er->mchan4->type]->bwrite(er->mchan4, bp, 0);
 		break;
 	case V6:
 		eh->t[0] = 0x86;
 		eh->t[1] = 0xDD;
-		devtab[er->mchan6->type]->bwrite(er->mchan6, bp, 0);
 		break;
 	default:
 		panic("etherbwrite2: version %d", version);
 	}
+}
+
+/*
+ *  the ether header to a resolved next hop, for the
+ *  forwarding cache; it doesn't start resolving one
+ */
+static int
+etherlinkhdr(Ipifc *ifc, int version, uchar *ip, uchar *hdr)
+{
+	Etherrock *er = ifc->arg;
+	uchar mac[6];
+
+	if(arplook(er->f->arp, version, ifc, ip, mac) < 0)
+		return -1;
+	etherhdr(ifc, version, mac, hdr);
+	return ifc->m->hsize;
+}
+
+/* write a single block with its ether header on */
+static void
+etherhwrite(Ipifc *ifc, Block *bp, int version)
+{
+	Etherrock *er = ifc->arg;
+
+	if(BLEN(bp) < ifc->mintu)
+		bp = adjustblock(bp, ifc->mintu);
+	if(version == V4)
+		devtab[er->mchan4->type]->bwrite(er->mchan4, bp, 0);
+	else
+		devtab[er->mchan6->type]->bwrite(er->mchan6, bp, 0);
 	ifc->out++;
 }
 
@@ -29,6 +29,7 @@ enum {
 
 	Nring		= 1 << 10,	/* power of two, please */
 	Ringmask	= Nring - 1,
+	Grebatch	= 32,		/* blocks taken off a ring at a time */
 
 	GREctlraw	= 0,
 	GREctlcooked,
@@ -66,13 +67,32 @@ typedef struct GREpriv GREpriv;
 struct GREpriv{
 	/* non-MIB stats */
 	ulong	lenerr;			/* short packet */
+
+	Conv	*hint;			/* tunnel of the last forwarded packet */
 };
 
+/*
+ * single producer, single consumer: only the input path adds
+ * and only the ctl side takes off, so neither locks the other.
+ */
 typedef struct Bring	Bring;
 struct Bring{
 	Block	*ring[Nring];
-	long	produced;
-	long	consumed;
+	ulong	produced;		/* written by the producer only */
+	ulong	consumed;		/* written by the consumer only */
+};
+
+/* per-tunnel counts, bumped without locks */
+typedef struct Grestats	Grestats;
+struct Grestats{
+	ulong	dlin;
+	ulong	dlbin;
+	ulong	ulin;
+	ulong	ulbin;
+	ulong	out;
+	ulong	bout;
+	ulong	fwd;			/* sent again by resume or forward */
+	ulong	ringdrops;		/* a ring was full */
 };
 
 typedef struct GREconv	GREconv;
@@ -89,10 +109,13 @@ struct GREconv{
 	int	ulsusp;				/* Uplink suspended? */
 	ulong	ulkey;				/* GRE key */
 
-	QLock	lock;				/* Lock for rings */
+	QLock	lock;				/* ctl side, the rings' consumer */
+	Lock	in;				/* input paths, the rings' producer */
 	Bring	dlpending;			/* Ring of pending packets */
 	Bring	dlbuffered;			/* Received while suspended */
 	Bring	ulbuffered;			/* Received while suspended */
+
+	Grestats stats;
 };
 
 typedef struct Metablock Metablock;
@@ -146,26 +169,58 @@ getring(Bring *r)
 	if(r->consumed == r->produced)
 		return nil;
 
+	coherence();		/* see the block before the count */
 	bp = r->ring[r->consumed & Ringmask];
 	r->ring[r->consumed & Ringmask] = nil;
+	coherence();
 	r->consumed++;
 	return bp;
 }
 
-static void
+/* the producer never takes blocks back, so a full ring refuses bp */
+static int
 addring(Bring *r, Block *bp)
 {
-	Block *tbp;
-
-	if(r->produced - r->consumed > Ringmask){
-		/* Full! */
-		tbp = r->ring[r->produced & Ringmask];
-		assert(tbp);
-		freeb(tbp);
-		r->consumed++;
-	}
+	if(r->produced - r->consumed > Ringmask)
+		return -1;
 	r->ring[r->produced & Ringmask] = bp;
+	coherence();		/* publish the block before the count */
 	r->produced++;
+	return 0;
+}
+
+/* add bp under the producer lock, or drop it */
+static void
+greadd(GREconv *grec, Bring *r, Block *bp)
+{
+	if(addring(r, bp) < 0){
+		grec->stats.ringdrops++;
+		freeb(bp);
+	}
+}
+
+/*
+ * the ctl side changed dlsusp or ulsusp: wait for any input path
+ * that saw the old value to finish with the rings.
+ */
+static void
+grequiesce(GREconv *grec)
+{
+	coherence();
+	lock(&grec->in);
+	unlock(&grec->in);
+}
+
+/* take up to n blocks off r */
+static int
+getrings(Bring *r, Block **b, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++)
+		if((b[i] = getring(r)) == nil)
+			break;
+	return i;
 }
 
 static char *
@@ -216,13 +271,16 @@ static int
 grestate(Conv *c, char *state, int n)
 {
 	GREconv *grec;
+	Grestats *s;
 	char *ep, *p;
 
 	grec = c->ptcl;
+	s    = &grec->stats;
 	p    = state;
 	ep   = p + n;
 	p    = seprint(p, ep, "%s%s%s%shoa %V north %V south %V seq %ulx "
-	 "pending %uld  %uld buffered dl %uld %uld ul %uld %uld ulkey %.8ulx\n",
+	 "pending %uld  %uld buffered dl %uld %uld ul %uld %uld ulkey %.8ulx "
+	 "in dl %lud %lud ul %lud %lud out %lud %lud fwd %lud drops %lud\n",
 			c->inuse? "Open ": "Closed ",
 			grec->raw? "raw ": "",
 			grec->dlsusp? "DL suspended ": "",
@@ -231,7 +289,9 @@ grestate(Conv *c, char *state, int n)
 			grec->dlpending.consumed, grec->dlpending.produced,
 			grec->dlbuffered.consumed, grec->dlbuffered.produced,
 			grec->ulbuffered.consumed, grec->ulbuffered.produced,
-			grec->ulkey);
+			grec->ulkey,
+			s->dlin, s->dlbin, s->ulin, s->ulbin,
+			s->out, s->bout, s->fwd, s->ringdrops);
 	return p - state;
 }
 
@@ -255,6 +315,7 @@ greclose(Conv *c)
 	memset(grec->south, 0, sizeof grec->south);
 
 	qlock(&grec->lock);
+	grequiesce(grec);
 	while((bp = getring(&grec->dlpending)) != nil)
 		freeb(bp);
 
@@ -264,9 +325,6 @@ greclose(Conv *c)
 	while((bp = getring(&grec->ulbuffered)) != nil)
 		freeb(bp);
 
-	grec->dlpending.produced = grec->dlpending.consumed = 0;
-	grec->dlbuffered.produced = grec->dlbuffered.consumed = 0;
-	grec->ulbuffered.produced = grec->ulbuffered.consumed = 0;
 	qunlock(&grec->lock);
 
 	grec->raw = 0;
@@ -327,6 +385,8 @@ grekick(void *x, Block *bp)
 
 	grepdout++;
 	grebdout += BLEN(bp);
+	grec->stats.out++;
+	grec->stats.bout += BLEN(bp);
 	ipoput4(c->p->f, bp, 0, c->ttl, c->tos, nil);
 }
 
@@ -336,7 +396,7 @@ gredownlink(Conv *c, Block *bp)
 	Metablock *m;
 	GREconv *grec;
 	GREhdr *gre;
-	int hdrlen, suspended, extra;
+	int hdrlen, extra;
 	ushort flags;
 	ulong seq;
 
@@ -384,6 +444,7 @@ gredownlink(Conv *c, Block *bp)
 		assert(BLEN(bp) >= sizeof(GREhdr) + sizeof(ulong));
 		gre = (GREhdr *)bp->rp;
 	}
+	lock(&grec->in);
 	seq = grec->seq++;
 	hnputs(gre->flags, GRE_seq);
 	hnputl(bp->rp + sizeof(GREhdr), seq);
@@ -398,42 +459,17 @@ gredownlink(Conv *c, Block *bp)
 	m->seq = seq;
 
 	/*
-	 * Here we make a decision what we're doing with the packet.  We're
-	 * doing this w/o holding a lock which means that later on in the
-	 * process we may discover we've done the wrong thing.  I don't want
-	 * to call ipoput with the lock held.
+	 * Suspended packets wait in dlbuffered for resume or forward.
+	 * The others are sent, then kept in dlpending until a report
+	 * says they arrived.  ipoput is not called with the lock held.
 	 */
-restart:
-	suspended = grec->dlsusp;
-	if(suspended){
-		if(!canqlock(&grec->lock)){
-			/*
-			 * just give up.  too bad, we lose a packet.  this
-			 * is just too hard and my brain already hurts.
-			 */
-			freeb(bp);
-			return;
-		}
-
-		if(!grec->dlsusp){
-			/*
-			 * suspend race.  We though we were suspended, but
-			 * we really weren't.
-			 */
-			qunlock(&grec->lock);
-			goto restart;
-		}
-
-		/* Undo the incorrect ref count addition */
-		addring(&grec->dlbuffered, bp);
-		qunlock(&grec->lock);
+	if(grec->dlsusp){
+		greadd(grec, &grec->dlbuffered, bp);
+		unlock(&grec->in);
 		return;
 	}
+	unlock(&grec->in);
 
-	/*
-	 * When we get here, we're not suspended.  Proceed to send the
-	 * packet.
-	 */
 	memmove(gre->src, grec->coa, sizeof gre->dst);
 	memmove(gre->dst, grec->south, sizeof gre->dst);
 
@@ -443,21 +479,13 @@ restart:
 	_xinc(&bp->ref);
 	assert(bp->ref == 2);
 
-	ipoput4(c->p->f, bp, 0, gre->ttl - 1, gre->tos, nil);
 	grepdout++;
 	grebdout += BLEN(bp);
+	ipoput4(c->p->f, bp, 0, gre->ttl - 1, gre->tos, nil);
 
-	/*
-	 * Now make sure we didn't do the wrong thing.
-	 */
-	if(!canqlock(&grec->lock)){
-		freeb(bp);		/* The packet just goes away */
-		return;
-	}
-
-	/* We did the right thing */
-	addring(&grec->dlpending, bp);
-	qunlock(&grec->lock);
+	lock(&grec->in);
+	greadd(grec, &grec->dlpending, bp);
+	unlock(&grec->in);
 }
 
 static void
@@ -468,8 +496,10 @@ greuplink(Conv *c, Block *bp)
 	ushort flags;
 
 	gre = (GREhdr *)bp->rp;
-	if(gre->ttl == 1)
+	if(gre->ttl == 1){
+		freeb(bp);
 		return;
+	}
 
 	grec = c->ptcl;
 	memmove(gre->src, grec->coa, sizeof gre->src);
@@ -506,19 +536,47 @@ greuplink(Conv *c, Block *bp)
 		hnputl(bp->rp + sizeof(GREhdr), grec->ulkey);
 	}
 
-	if(!canqlock(&grec->lock)){
-		freeb(bp);
+	lock(&grec->in);
+	if(grec->ulsusp){
+		greadd(grec, &grec->ulbuffered, bp);
+		unlock(&grec->in);
 		return;
 	}
+	unlock(&grec->in);
 
-	if(grec->ulsusp)
-		addring(&grec->ulbuffered, bp);
-	else{
-		ipoput4(c->p->f, bp, 0, gre->ttl - 1, gre->tos, nil);
-		grepuout++;
-		grebuout += BLEN(bp);
+	grepuout++;
+	grebuout += BLEN(bp);
+	ipoput4(c->p->f, bp, 0, gre->ttl - 1, gre->tos, nil);
+}
+
+/*
+ * pass bp to c if it is to or from c's home address.
+ * Do not stop this session - blocking here
+ * implies that etherread is blocked.
+ */
+static int
+gretunnel(Conv *c, Block *bp, Ip4hdr *ip)
+{
+	GREconv *grec;
+
+	grec = c->ptcl;
+	if(memcmp(ip->dst, grec->hoa, sizeof ip->dst) == 0){
+		grepdin++;
+		grebdin += BLEN(bp);
+		grec->stats.dlin++;
+		grec->stats.dlbin += BLEN(bp);
+		gredownlink(c, bp);
+		return 1;
 	}
-	qunlock(&grec->lock);
+	if(memcmp(ip->src, grec->hoa, sizeof ip->src) == 0){
+		grepuin++;
+		grebuin += BLEN(bp);
+		grec->stats.ulin++;
+		grec->stats.ulbin += BLEN(bp);
+		greuplink(c, bp);
+		return 1;
+	}
+	return 0;
 }
 
 static void
@@ -577,35 +635,26 @@ greiput(Proto *proto, Ipifc *, Block *bp)
 	}
 	ip = (Ip4hdr *)(bp->rp + hdrlen);
 
-	qlock(proto);
 	/*
 	 * Look for a conversation structure for this port and address, or
-	 * match the retunnel part, or match on the raw flag.
+	 * match the retunnel part, or match on the raw flag.  Convs are
+	 * never freed, so the table is searched without qlocking proto;
+	 * a tunnel coming or going as we look just sees the packet
+	 * earlier or later.  Most packets belong to the same tunnel as
+	 * the one before.
 	 */
+	gpriv = proto->priv;
+	c = gpriv->hint;
+	if(c != nil && c->inuse && gretunnel(c, bp, ip))
+		return;
 	for(p = proto->conv; *p; p++) {
 		c = *p;
 
 		if(c->inuse == 0)
 			continue;
 
-		/*
-		 * Do not stop this session - blocking here
-		 * implies that etherread is blocked.
-		 */
-		grec = c->ptcl;
-		if(memcmp(ip->dst, grec->hoa, sizeof ip->dst) == 0){
-			grepdin++;
-			grebdin += BLEN(bp);
-			gredownlink(c, bp);
-			qunlock(proto);
-			return;
-		}
-
-		if(memcmp(ip->src, grec->hoa, sizeof ip->src) == 0){
-			grepuin++;
-			grebuin += BLEN(bp);
-			greuplink(c, bp);
-			qunlock(proto);
+		if(gretunnel(c, bp, ip)){
+			gpriv->hint = c;
 			return;
 		}
 	}
@@ -630,8 +679,6 @@ greiput(Proto *proto, Ipifc *, Block *bp)
 			break;
 	}
 
-	qunlock(proto);
-
 	if(*p == nil){
 		freeb(bp);
 		return;
@@ -739,6 +786,7 @@ grectlreport(Conv *c, int, char **argv)
 	qlock(&grec->lock);
 	r = &grec->dlpending;
 	while(r->produced - r->consumed > 0){
+		coherence();
 		bp = r->ring[r->consumed & Ringmask];
 
 		assert(bp && bp->rp - bp->base >= sizeof(Metablock));
@@ -747,6 +795,7 @@ grectlreport(Conv *c, int, char **argv)
 			break;
 
 		r->ring[r->consumed & Ringmask] = nil;
+		coherence();
 		r->consumed++;
 
 		freeb(bp);
@@ -761,10 +810,14 @@ grectldlsuspend(Conv *c, int, char **)
 	GREconv *grec;
 
 	grec = c->ptcl;
-	if(grec->dlsusp)
+	qlock(&grec->lock);
+	if(grec->dlsusp){
+		qunlock(&grec->lock);
 		return "already suspended";
-
+	}
 	grec->dlsusp = 1;
+	grequiesce(grec);
+	qunlock(&grec->lock);
 	return nil;
 }
 
@@ -774,19 +827,24 @@ grectlulsuspend(Conv *c, int, char **)
 	GREconv *grec;
 
 	grec = c->ptcl;
-	if(grec->ulsusp)
+	qlock(&grec->lock);
+	if(grec->ulsusp){
+		qunlock(&grec->lock);
 		return "already suspended";
-
+	}
 	grec->ulsusp = 1;
+	grequiesce(grec);
+	qunlock(&grec->lock);
 	return nil;
 }
 
 static char *
 grectldlresume(Conv *c, int, char **)
 {
+	int i, n;
 	GREconv *grec;
 	GREhdr *gre;
-	Block *bp;
+	Block *b[Grebatch];
 
 	grec = c->ptcl;
 
@@ -796,22 +854,38 @@ grectldlresume(Conv *c, int, char **)
 		return "not suspended";
 	}
 
-	while((bp = getring(&grec->dlbuffered)) != nil){
-		gre = (GREhdr *)bp->rp;
-		qunlock(&grec->lock);
+	/*
+	 * send what was buffered, then resume and send what came
+	 * in while the input paths still saw dlsusp.
+	 */
+	for(;;){
+		n = getrings(&grec->dlbuffered, b, Grebatch);
+		if(n == 0){
+			if(!grec->dlsusp)
+				break;
+			grec->dlsusp = 0;
+			grequiesce(grec);
+			continue;
+		}
+		for(i = 0; i < n; i++){
+			gre = (GREhdr *)b[i]->rp;
 
-		/*
-		 * Make sure the packet does not go away.
-		 */
-		_xinc(&bp->ref);
-		assert(bp->ref == 2);
+			/*
+			 * Make sure the packet does not go away.
+			 */
+			_xinc(&b[i]->ref);
+			assert(b[i]->ref == 2);
 
-		ipoput4(c->p->f, bp, 0, gre->ttl - 1, gre->tos, nil);
+			ipoput4(c->p->f, b[i], 0, gre->ttl - 1, gre->tos, nil);
+			grec->stats.fwd++;
+		}
 
-		qlock(&grec->lock);
-		addring(&grec->dlpending, bp);
+		/* dlpending is the input paths' to fill */
+		lock(&grec->in);
+		for(i = 0; i < n; i++)
+			greadd(grec, &grec->dlpending, b[i]);
+		unlock(&grec->in);
 	}
-	grec->dlsusp = 0;
 	qunlock(&grec->lock);
 	return nil;
 }
@@ -819,32 +893,57 @@ grectldlresume(Conv *c, int, char **)
 static char *
 grectlulresume(Conv *c, int, char **)
 {
+	int i, n;
 	GREconv *grec;
 	GREhdr *gre;
-	Block *bp;
+	Block *b[Grebatch];
 
 	grec = c->ptcl;
 
 	qlock(&grec->lock);
-	while((bp = getring(&grec->ulbuffered)) != nil){
-		gre = (GREhdr *)bp->rp;
-
-		qunlock(&grec->lock);
-		ipoput4(c->p->f, bp, 0, gre->ttl - 1, gre->tos, nil);
-		qlock(&grec->lock);
+	for(;;){
+		n = getrings(&grec->ulbuffered, b, Grebatch);
+		if(n == 0){
+			if(!grec->ulsusp)
+				break;
+			grec->ulsusp = 0;
+			grequiesce(grec);
+			continue;
+		}
+		for(i = 0; i < n; i++){
+			gre = (GREhdr *)b[i]->rp;
+			ipoput4(c->p->f, b[i], 0, gre->ttl - 1, gre->tos, nil);
+			grec->stats.fwd++;
+		}
 	}
-	grec->ulsusp = 0;
 	qunlock(&grec->lock);
 	return nil;
 }
 
+/* send b[0:n] on to grec's new south */
+static void
+greforward(Conv *c, GREconv *grec, Block **b, int n)
+{
+	int i;
+	GREhdr *gre;
+
+	for(i = 0; i < n; i++){
+		gre = (GREhdr *)b[i]->rp;
+		memmove(gre->src, grec->coa, sizeof gre->dst);
+		memmove(gre->dst, grec->south, sizeof gre->dst);
+
+		ipoput4(c->p->f, b[i], 0, gre->ttl - 1, gre->tos, nil);
+		grec->stats.fwd++;
+	}
+}
+
 static char *
 grectlforward(Conv *c, int, char **argv)
 {
-	int len;
-	Block *bp, *nbp;
+	int i, n, len;
+	ulong npending;
+	Block *bp, *nbp, *b[Grebatch];
 	GREconv *grec;
-	GREhdr *gre;
 	Metablock *m;
 
 	grec = c->ptcl;
@@ -859,59 +958,52 @@ grectlforward(Conv *c, int, char **argv)
 	}
 	grec->dlsusp = 0;
 	grec->ulsusp = 0;
+	grequiesce(grec);
 
-	while((bp = getring(&grec->dlpending)) != nil){
-
-		assert(bp->rp - bp->base >= sizeof(Metablock));
-		m = (Metablock *)bp->base;
-		assert(m->rp >= bp->base && m->rp < bp->lim);
+	/*
+	 * resend what was pending when we resumed, not what the
+	 * input paths have sent to the new south since.
+	 */
+	npending = grec->dlpending.produced - grec->dlpending.consumed;
+	while(npending > 0){
+		n = Grebatch;
+		if(n > npending)
+			n = npending;
+		n = getrings(&grec->dlpending, b, n);
+		if(n == 0)
+			break;
+		npending -= n;
+		for(i = 0; i < n; i++){
+			bp = b[i];
+			assert(bp->rp - bp->base >= sizeof(Metablock));
+			m = (Metablock *)bp->base;
+			assert(m->rp >= bp->base && m->rp < bp->lim);
 
-		/*
-		 * If the packet is still held inside the IP transmit
-		 * system, make a copy of the packet first.
-		 */
-		if(bp->ref > 1){
-			len = bp->wp - m->rp;
-			nbp = allocb(len);
-			memmove(nbp->wp, m->rp, len);
-			nbp->wp += len;
-			freeb(bp);
-			bp  = nbp;
-		}
-		else{
-			/* Patch up rp */
-			bp->rp = m->rp;
+			/*
+			 * If the packet is still held inside the IP transmit
+			 * system, make a copy of the packet first.
+			 */
+			if(bp->ref > 1){
+				len = bp->wp - m->rp;
+				nbp = allocb(len);
+				memmove(nbp->wp, m->rp, len);
+				nbp->wp += len;
+				freeb(bp);
+				b[i] = nbp;
+			}
+			else{
+				/* Patch up rp */
+				bp->rp = m->rp;
+			}
 		}
-
-		gre = (GREhdr *)bp->rp;
-		memmove(gre->src, grec->coa, sizeof gre->dst);
-		memmove(gre->dst, grec->south, sizeof gre->dst);
-
-		qunlock(&grec->lock);
-		ipoput4(c->p->f, bp, 0, gre->ttl - 1, gre->tos, nil);
-		qlock(&grec->lock);
+		greforward(c, grec, b, n);
 	}
 
-	while((bp = getring(&grec->dlbuffered)) != nil){
-		gre = (GREhdr *)bp->rp;
-		memmove(gre->src, grec->coa, sizeof gre->dst);
-		memmove(gre->dst, grec->south, sizeof gre->dst);
-
-		qunlock(&grec->lock);
-		ipoput4(c->p->f, bp, 0, gre->ttl - 1, gre->tos, nil);
-		qlock(&grec->lock);
-	}
-
-	while((bp = getring(&grec->ulbuffered)) != nil){
-		gre = (GREhdr *)bp->rp;
-
-		memmove(gre->src, grec->coa, sizeof gre->dst);
-		memmove(gre->dst, grec->south, sizeof gre->dst);
-
-		qunlock(&grec->lock);
-		ipoput4(c->p->f, bp, 0, gre->ttl - 1, gre->tos, nil);
-		qlock(&grec->lock);
-	}
+	/* nothing is added to the buffered rings once resumed */
+	while((n = getrings(&grec->dlbuffered, b, Grebatch)) > 0)
+		greforward(c, grec, b, n);
+	while((n = getrings(&grec->ulbuffered, b, Grebatch)) > 0)
+		greforward(c, grec, b, n);
 	qunlock(&grec->lock);
 	return nil;
 }
@@ -9,6 +9,11 @@
 
 #define BLKIPVER(xp)	(((Ip4hdr*)((xp)->rp))->vihl&0xF0)
 
+enum
+{
+	Fwdlife	= 10*1000,	/* ms a forwarding cache entry lasts */
+};
+
 static char *statnames[] =
 {
 [Forwarding]	"Forwarding",
@@ -117,6 +122,24 @@ iprouting(Fs *f, int on)
 		f->ip->stats[Forwarding] = 1;
 }
 
+/*
+ *  the id of a packet, or the first of the ids of the
+ *  segments a super-segment will be cut into
+ */
+static ushort
+ip4id(IP *ip, Block *bp)
+{
+	long id;
+
+	if((bp->flag & Btso) == 0)
+		return incref(&ip->id4);
+	lock(&ip->id4);
+	id = ip->id4.ref + 1;
+	ip->id4.ref += (BLEN(bp) + bp->mss - 1) / bp->mss;
+	unlock(&ip->id4);
+	return id;
+}
+
 int
 ipoput4(Fs *f, Block *bp, int gating, int ttl, int tos, Conv *c)
 {
@@ -197,9 +220,30 @@ ipoput4(Fs *f, Block *bp, int gating, int ttl, int tos, Conv *c)
 		medialen = c->maxfragsize - ifc->m->hsize;
 	else
 		medialen = ifc->maxtu - ifc->m->hsize;
-	if(len <= medialen) {
+
+	/*
+	 *  a tcp super-segment goes whole to an interface that
+	 *  will cut it up, else is cut up here and sent in pieces
+	 */
+	if((bp->flag & Btso) && (len > ifc->tso || bp->mss + 2*IP4HDR > medialen)){
+		runlock(ifc);
+		poperror();
+		for(bp = ipsegment4(bp); bp != nil; bp = nb){
+			nb = bp->list;
+			bp->list = nil;
+			if(ipoput4(f, bp, 0, ttl, tos, c) < 0)
+				rv = -1;
+		}
+		return rv;
+	}
+
+	/* sum what the interface won't, or fragments would split */
+	if((bp->flag & Bcsum) && (ifc->csum == 0 || len > medialen))
+		ipfinishcsum4(bp);
+
+	if(len <= medialen || (bp->flag & Btso)) {
 		if(!gating)
-			hnputs(eh->id, incref(&ip->id4));
+			hnputs(eh->id, ip4id(ip, bp));
 		hnputs(eh->length, len);
 		if(!gating){
 			eh->frag[0] = 0;
@@ -209,7 +253,7 @@ ipoput4(Fs *f, Block *bp, int gating, int ttl, int tos, Conv *c)
 		eh->cksum[1] = 0;
 		hnputs(eh->cksum, ipcsum(&eh->vihl));
 		assert(bp->next == nil);
-		ifc->m->bwrite(ifc, bp, V4, gate);
+		ipifcoput(ifc, bp, V4, gate);
 		runlock(ifc);
 		poperror();
 		return 0;
@@ -293,7 +337,7 @@ if((eh->frag[0] & (IP_DF>>8)) && !gating) print("%V: DF set\n", eh->dst);
 		feh->cksum[0] = 0;
 		feh->cksum[1] = 0;
 		hnputs(feh->cksum, ipcsum(&feh->vihl));
-		ifc->m->bwrite(ifc, nb, V4, gate);
+		ipifcoput(ifc, nb, V4, gate);
 		ip->stats[FragCreates]++;
 	}
 	ip->stats[FragOKs]++;
@@ -305,6 +349,215 @@ free:
 	return rv;
 }
 
+/*
+ *  cut a tcp super-segment into packets of bp->mss bytes of
+ *  data, each with a copy of the headers and its own length,
+ *  id, sequence number and checksums; only the last keeps
+ *  fin and psh.  the packets are linked by list.
+ */
+Block*
+ipsegment4(Block *bp)
+{
+	Block *nb, *first, **l;
+	Ip4hdr *eh;
+	uchar *th;
+	int hlen, tlen, dlen, off, n, id;
+	ulong seq, sum, dsum;
+
+	if(bp->next != nil)
+		bp = concatblock(bp);
+	eh = (Ip4hdr*)bp->rp;
+	hlen = (eh->vihl & 0xF) << 2;
+	tlen = (bp->rp[hlen+12] >> 4) << 2;
+	dlen = BLEN(bp) - hlen - tlen;
+	id = nhgets(eh->id);
+	seq = nhgetl(bp->rp + hlen + 4);
+	first = nil;
+	l = &first;
+	for(off = 0; off < dlen; off += n){
+		n = dlen - off;
+		if(n > bp->mss)
+			n = bp->mss;
+		nb = allocb(hlen + tlen + n);
+		memmove(nb->wp, bp->rp, hlen + tlen);
+		/* tlen is even, so the data's sum adds straight in */
+		dsum = ptclcpsum(nb->wp + hlen + tlen, bp->rp + hlen + tlen + off, n);
+		nb->wp += hlen + tlen + n;
+
+		eh = (Ip4hdr*)nb->rp;
+		hnputs(eh->length, hlen + tlen + n);
+		hnputs(eh->id, id++);
+		eh->cksum[0] = 0;
+		eh->cksum[1] = 0;
+		hnputs(eh->cksum, ipcsum(&eh->vihl));
+
+		th = nb->rp + hlen;
+		hnputl(th + 4, seq + off);
+		if(off + n < dlen)
+			th[13] &= ~0x09;	/* FIN|PSH */
+		th[16] = 0;
+		th[17] = 0;
+		sum = ptclbsum(eh->src, 2*IPv4addrlen) + 6 + tlen + n;	/* tcp pseudo header */
+		sum += ptclbsum(th, tlen) + dsum;
+		while(sum >> 16)
+			sum = (sum & 0xffff) + (sum >> 16);
+		hnputs(th + 16, ~sum);
+
+		*l = nb;
+		l = &nb->list;
+	}
+	freeb(bp);
+	return first;
+}
+
+/*
+ *  finish the tcp or udp checksum of a packet marked Bcsum,
+ *  whose checksum field holds the sum of the pseudo header
+ */
+void
+ipfinishcsum4(Block *bp)
+{
+	int hlen, off;
+	ushort csum;
+
+	hlen = (bp->rp[0] & 0xF) << 2;
+	off = hlen + (bp->rp[9] == 6 ? 16 : 6);	/* tcp, else udp */
+	csum = ptclcsum(bp, hlen, blocklen(bp) - hlen);
+	if(csum == 0 && bp->rp[9] != 6)
+		csum = 0xffff;	/* 0 is no udp checksum */
+	hnputs(bp->rp + off, csum);
+	bp->flag &= ~Bcsum;
+}
+
+static int
+fwdhash(uchar *a)
+{
+	return ((nhgetl(a) * 0x9e3779b1UL) >> 16) % Nipfwd;
+}
+
+/*
+ *  forward on the cached next hop for the destination: no
+ *  route lookup, no arp, the checksum patched for the ttl.
+ *  returns 0 if the packet must go the long way.
+ */
+static int
+ipfwdfast(Fs *f, Ipifc *in, Block *bp)
+{
+	IP *ip;
+	Ip4hdr *h;
+	Ipfwd *fw;
+	Ipifc *ifc;
+	ulong sum;
+	int len, hsize;
+	uchar hdr[Fwdhdr];
+
+	h = (Ip4hdr*)bp->rp;
+	if(h->vihl != (IP_VER4|IP_HLEN4) || h->ttl <= 1 ||
+	    bp->next != nil || (bp->flag & Btso))
+		return 0;
+	len = nhgets(h->length);
+	if(len < IP4HDR || len > BLEN(bp))
+		return 0;
+
+	ip = f->ip;
+	fw = &ip->fwd[fwdhash(h->dst)];
+	lock(fw);
+	if(fw->ifc == nil || fw->in != in ||
+	    memcmp(fw->dst, h->dst, IPv4addrlen) != 0 ||
+	    fw->rgen != v4routegen() || fw->agen != arpgen(f->arp) ||
+	    fw->ifcid != fw->ifc->ifcid || (long)(NOW - fw->expire) >= 0 ||
+	    len > fw->mtu){
+		unlock(fw);
+		return 0;
+	}
+	ifc = fw->ifc;
+	hsize = fw->hsize;
+	memmove(hdr, fw->hdr, hsize);
+	unlock(fw);
+
+	if(bp->rp - bp->base < hsize)
+		return 0;
+	if(!canrlock(ifc))
+		return 0;
+	if(ifc->m == nil || ifc->m->hwrite == nil || ifc->fq != nil){
+		runlock(ifc);
+		return 0;
+	}
+
+	/* ttl is the high byte of its word */
+	h->ttl--;
+	sum = nhgets(h->cksum) + 0x100;
+	hnputs(h->cksum, sum + (sum >> 16));
+	bp->wp = bp->rp + len;
+	bp->rp -= hsize;
+	memmove(bp->rp, hdr, hsize);
+
+	ip->stats[ForwDatagrams]++;
+	ip->stats[OutRequests]++;
+	if(!waserror()){
+		(*ifc->m->hwrite)(ifc, bp, V4);
+		poperror();
+	}
+	runlock(ifc);
+	return 1;
+}
+
+/*
+ *  remember the next hop of a packet about to be forwarded
+ *  the long way; rgen is the route generation r was looked up in
+ */
+static void
+ipfwdfill(Fs *f, Ipifc *in, Route *r, Ip4hdr *h, ulong rgen)
+{
+	Ipfwd *fw;
+	Ipifc *ifc;
+	uchar *gate, hdr[Fwdhdr], ifcid;
+	ulong agen;
+	int n, mtu;
+
+	ifc = r->ifc;
+	if(ifc == nil || ifc->reassemble || (r->type & (Rbcast|Rmulti|Runi)) ||
+	    (h->dst[0] & 0xe0) == 0xe0)
+		return;
+	if(r->type & Rifc)
+		gate = h->dst;
+	else
+		gate = r->v4.gate;
+
+	agen = arpgen(f->arp);
+	if(!canrlock(ifc))
+		return;
+	if(ifc->m == nil || ifc->m->linkhdr == nil || ifc->m->hwrite == nil ||
+	    ifc->m->hsize > Fwdhdr){
+		runlock(ifc);
+		return;
+	}
+	n = -1;
+	if(!waserror()){
+		n = (*ifc->m->linkhdr)(ifc, V4, gate, hdr);
+		poperror();
+	}
+	mtu = ifc->maxtu - ifc->m->hsize;
+	ifcid = ifc->ifcid;
+	runlock(ifc);
+	if(n <= 0 || n > Fwdhdr)
+		return;
+
+	fw = &f->ip->fwd[fwdhash(h->dst)];
+	lock(fw);
+	memmove(fw->dst, h->dst, IPv4addrlen);
+	fw->in = in;
+	fw->ifc = ifc;
+	fw->ifcid = ifcid;
+	fw->rgen = rgen;
+	fw->agen = agen;
+	fw->expire = NOW + Fwdlife;
+	fw->mtu = mtu;
+	fw->hsize = n;
+	memmove(fw->hdr, hdr, n);
+	unlock(fw);
+}
+
 void
 ipiput4(Fs *f, Ipifc *ifc, Block *bp)
 {
@@ -318,6 +571,7 @@ ipiput4(Fs *f, Ipifc *ifc, Block *bp)
 	IP *ip;
 	Route *r;
 	Conv conv;
+	ulong rgen;
 
 	if(BLKIPVER(bp) != IP_VER4) {
 		ipiput6(f, ifc, bp);
@@ -327,6 +581,9 @@ ipiput4(Fs *f, Ipifc *ifc, Block *bp)
 	ip = f->ip;
 	ip->stats[InReceives]++;
 
+	/* the header is rewritten in place below */
+	bp = unshareblock(bp);
+
 	/*
 	 *  Ensure we have all the header info in the first
 	 *  block.  Make life easier for other protocols by
@@ -382,10 +639,13 @@ ipiput4(Fs *f, Ipifc *ifc, Block *bp)
 			freeblist(bp);
 			return;
 		}
+		if(ipfwdfast(f, ifc, bp))
+			return;
 
 		/* don't forward to source's network */
 		memset(&conv, 0, sizeof conv);
 		conv.r = nil;
+		rgen = v4routegen();
 		r = v4lookup(f, h->dst, &conv);
 		if(r == nil || r->ifc == ifc){
 			ip->stats[OutDiscards]++;
@@ -417,6 +677,7 @@ if(r->ifc == nil) panic("nil route rfc");
 			}
 		}
 
+		ipfwdfill(f, ifc, r, h, rgen);
 		ip->stats[ForwDatagrams]++;
 		tos = h->tos;
 		hop = h->ttl;
@@ -468,19 +729,72 @@ ipstats(Fs *f, char *buf, int len)
 	return p - buf;
 }
 
+static int
+fraghash4(ulong src, ulong dst, ushort id, uchar proto)
+{
+	ulong h;
+
+	h = (src ^ dst ^ (id<<16 | proto)) * 0x9e3779b1UL;
+	return h >> 26 & (Nfraghash-1);
+}
+
+/*
+ *  free queues that have timed out, at most once a second;
+ *  assume hold fraglock4
+ */
+static void
+fragsweep4(IP *ip)
+{
+	Fragment4 *f, *fnext;
+
+	if((long)(NOW - ip->fragsweep4) < 0)
+		return;
+	ip->fragsweep4 = NOW + 1000;
+	for(f = ip->flisthead4; f; f = fnext){
+		fnext = f->next;	/* because ipfragfree4 changes the list */
+		if(f->age < NOW){
+			ip->stats[ReasmTimeout]++;
+			ipfragfree4(ip, f);
+		}
+	}
+}
+
+/*
+ *  while the queues hold too much, give up on the oldest
+ *  that isn't keep; assume hold fraglock4
+ */
+static void
+fragtrim4(IP *ip, Fragment4 *keep)
+{
+	Fragment4 *f, *old;
+
+	while(ip->fragmem4 > Fragmem){
+		old = nil;
+		for(f = ip->flisthead4; f; f = f->next)
+			if(f != keep)
+				old = f;
+		if(old == nil)
+			break;
+		ip->stats[ReasmFails]++;
+		ipfragfree4(ip, old);
+	}
+}
+
 Block*
 ip4reassemble(IP *ip, int offset, Block *bp, Ip4hdr *ih)
 {
-	int fend;
+	int fend, h;
 	ushort id;
-	Fragment4 *f, *fnext;
+	uchar proto;
+	Fragment4 *f;
 	ulong src, dst;
 	Block *bl, **l, *last, *prev;
-	int ovlap, len, fragsize, pktposn;
+	int ovlap, len, fragsize;
 
 	src = nhgetl(ih->src);
 	dst = nhgetl(ih->dst);
 	id = nhgets(ih->id);
+	proto = ih->proto;
 
 	/*
 	 *  block lists are too hard, pullupblock into a single block
@@ -491,19 +805,15 @@ ip4reassemble(IP *ip, int offset, Block *bp, Ip4hdr *ih)
 	}
 
 	qlock(&ip->fraglock4);
+	fragsweep4(ip);
 
 	/*
 	 *  find a reassembly queue for this fragment
 	 */
-	for(f = ip->flisthead4; f; f = fnext){
-		fnext = f->next;	/* because ipfragfree4 changes the list */
-		if(f->src == src && f->dst == dst && f->id == id)
+	h = fraghash4(src, dst, id, proto);
+	for(f = ip->fraghash4[h]; f; f = f->hash)
+		if(f->src == src && f->dst == dst && f->id == id && f->proto == proto)
 			break;
-		if(f->age < NOW){
-			ip->stats[ReasmTimeout]++;
-			ipfragfree4(ip, f);
-		}
-	}
 
 	/*
 	 *  if this isn't a fragmented packet, accept it
@@ -533,8 +843,15 @@ ip4reassemble(IP *ip, int offset, Block *bp, Ip4hdr *ih)
 		f->id = id;
 		f->src = src;
 		f->dst = dst;
+		f->proto = proto;
+		f->hash = ip->fraghash4[h];
+		ip->fraghash4[h] = f;
 
 		f->blist = bp;
+		f->blast = bp;
+		f->size = BALLOC(bp);
+		ip->fragmem4 += f->size;
+		fragtrim4(ip, f);
 
 		qunlock(&ip->fraglock4);
 		ip->stats[ReasmReqds]++;
@@ -542,15 +859,27 @@ ip4reassemble(IP *ip, int offset, Block *bp, Ip4hdr *ih)
 	}
 
 	/*
-	 *  find the new fragment's position in the queue
+	 *  find the new fragment's position in the queue;
+	 *  one in order goes on the end
 	 */
-	prev = nil;
-	l = &f->blist;
-	bl = f->blist;
-	while(bl != nil && BKFG(bp)->foff > BKFG(bl)->foff) {
-		prev = bl;
-		l = &bl->next;
-		bl = bl->next;
+	if(BKFG(bp)->foff > BKFG(f->blast)->foff) {
+		prev = f->blast;
+		l = &prev->next;
+	} else {
+		prev = nil;
+		l = &f->blist;
+		bl = f->blist;
+		while(bl != nil && BKFG(bp)->foff > BKFG(bl)->foff) {
+			prev = bl;
+			l = &bl->next;
+			bl = bl->next;
+		}
+	}
+
+	/* landing in the contiguous run may trim it; count again */
+	if(BKFG(bp)->foff < f->contig) {
+		f->cend = nil;
+		f->contig = 0;
 	}
 
 	/* Check overlap of a previous fragment - trim away as necessary */
@@ -569,6 +898,8 @@ ip4reassemble(IP *ip, int offset, Block *bp, Ip4hdr *ih)
 	/* Link onto assembly queue */
 	bp->next = *l;
 	*l = bp;
+	f->size += BALLOC(bp);
+	ip->fragmem4 += BALLOC(bp);
 
 	/* Check to see if succeeding segments overlap */
 	if(bp->next) {
@@ -589,19 +920,25 @@ ip4reassemble(IP *ip, int offset, Block *bp, Ip4hdr *ih)
 			}
 			last = (*l)->next;
 			(*l)->next = nil;
+			f->size -= BALLOC(*l);
+			ip->fragmem4 -= BALLOC(*l);
 			freeblist(*l);
 			*l = last;
 		}
 	}
+	if(bp->next == nil)
+		f->blast = bp;
 
 	/*
-	 *  look for a complete packet.  if we get to a fragment
-	 *  without IP_MF set, we're done.
+	 *  look for a complete packet, carrying on from the end of
+	 *  the fragments already known to run from offset 0.  if we
+	 *  get to a fragment without IP_MF set, we're done.
 	 */
-	pktposn = 0;
-	for(bl = f->blist; bl; bl = bl->next) {
-		if(BKFG(bl)->foff != pktposn)
+	for(bl = f->cend != nil ? f->cend->next : f->blist; bl; bl = bl->next) {
+		if(BKFG(bl)->foff != f->contig)
 			break;
+		f->cend = bl;
+		f->contig += BKFG(bl)->flen;
 		if((BLKIP(bl)->frag[0]&(IP_MF>>8)) == 0) {
 			bl = f->blist;
 			len = nhgets(BLKIP(bl)->length);
@@ -626,8 +963,8 @@ ip4reassemble(IP *ip, int offset, Block *bp, Ip4hdr *ih)
 			ip->stats[ReasmOKs]++;
 			return bl;
 		}
-		pktposn += BKFG(bl)->flen;
 	}
+	fragtrim4(ip, f);
 	qunlock(&ip->fraglock4);
 	return nil;
 }
@@ -642,10 +979,25 @@ ipfragfree4(IP *ip, Fragment4 *frag)
 
 	if(frag->blist)
 		freeblist(frag->blist);
+	ip->fragmem4 -= frag->size;
+
+	l = &ip->fraghash4[fraghash4(frag->src, frag->dst, frag->id, frag->proto)];
+	for(fl = *l; fl; fl = fl->hash) {
+		if(fl == frag) {
+			*l = frag->hash;
+			break;
+		}
+		l = &fl->hash;
+	}
 
 	frag->src = 0;
 	frag->id = 0;
 	frag->blist = nil;
+	frag->blast = nil;
+	frag->cend = nil;
+	frag->contig = 0;
+	frag->size = 0;
+	frag->hash = nil;
 
 	l = &ip->flisthead4;
 	for(fl = *l; fl; fl = fl->next) {
@@ -679,7 +1031,7 @@ ipfragallo4(IP *ip)
 	ip->fragfree4 = f->next;
 	f->next = ip->flisthead4;
 	ip->flisthead4 = f;
-	f->age = NOW + 30000;
+	f->age = NOW + Fraglife;
 
 	return f;
 }
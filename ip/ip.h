@@ -13,7 +13,11 @@ typedef struct	Iplink	Iplink;
 typedef struct	Iplifc	Iplifc;
 typedef struct	Ipmulti	Ipmulti;
 typedef struct	Ipifc	Ipifc;
+typedef struct	Ipfq	Ipfq;
+typedef struct	Ipfwd	Ipfwd;
 typedef struct	Iphash	Iphash;
+typedef struct	Iphtb	Iphtb;
+typedef struct	Lpm	Lpm;
 typedef struct	Ipht	Ipht;
 typedef struct	Netlog	Netlog;
 typedef struct	Medium	Medium;
@@ -37,7 +41,6 @@ enum
 {
 	Addrlen=	64,
 	Maxproto=	20,
-	Nhash=		64,
 	Maxincall=	10,
 	Nchans=		1024,
 	MAClen=		16,		/* longest mac address */
@@ -61,6 +64,12 @@ enum
 	IP4HDR=		20,		/* sizeof(Ip4hdr) */
 	IP_MAX=		64*1024,	/* Max. Internet packet size, v4 & v6 */
 
+	Nipfwd=		256,		/* destinations the forwarding cache holds */
+	Fwdhdr=		32,		/* longest link header it keeps */
+	Nfraghash=	64,		/* reassembly queue hash buckets */
+	Fraglife=	30*1000,	/* ms a datagram has to reassemble */
+	Fragmem=	1024*1024,	/* bytes held for reassembly, per version */
+
 	/* 2^Lroot trees in the root table */
 	Lroot=		10,
 
@@ -106,20 +115,31 @@ struct Fragment4
 {
 	Block*	blist;
 	Fragment4*	next;
+	Fragment4*	hash;	/* next in fraghash4 bucket */
 	ulong 	src;
 	ulong 	dst;
 	ushort	id;
+	uchar	proto;
 	ulong 	age;
+	Block*	blast;		/* last fragment on blist */
+	Block*	cend;		/* last of those contiguous from offset 0 */
+	int	contig;		/* bytes they make up */
+	long	size;		/* memory held in blist */
 };
 
 struct Fragment6
 {
 	Block*	blist;
 	Fragment6*	next;
+	Fragment6*	hash;
 	uchar 	src[IPaddrlen];
 	uchar 	dst[IPaddrlen];
 	uint	id;
 	ulong 	age;
+	Block*	blast;
+	Block*	cend;
+	int	contig;
+	long	size;
 };
 
 struct Ipfrag
@@ -133,6 +153,26 @@ struct Ipfrag
 #define IPFRAGSZ offsetof(Ipfrag, payload[0])
 
 /* an instance of IP */
+/*
+ *  how a forwarded destination went: while the route, the arp
+ *  entry and the interface are as they were, the link header goes
+ *  on as it is
+ */
+struct Ipfwd
+{
+	Lock;
+	uchar	dst[IPv4addrlen];
+	Ipifc	*in;		/* where it came from */
+	Ipifc	*ifc;		/* where it goes */
+	uchar	ifcid;
+	ulong	rgen;		/* v4routegen() when looked up */
+	ulong	agen;		/* arpgen() when looked up */
+	ulong	expire;
+	int	mtu;		/* longest packet that goes whole */
+	int	hsize;
+	uchar	hdr[Fwdhdr];
+};
+
 struct IP
 {
 	uvlong		stats[Nipstats];
@@ -140,14 +180,22 @@ struct IP
 	QLock		fraglock4;
 	Fragment4*	flisthead4;
 	Fragment4*	fragfree4;
+	Fragment4*	fraghash4[Nfraghash];
+	long		fragmem4;	/* memory held by all v4 queues */
+	ulong		fragsweep4;	/* when to next look for stale */
 	Ref		id4;
 
 	QLock		fraglock6;
 	Fragment6*	flisthead6;
 	Fragment6*	fragfree6;
+	Fragment6*	fraghash6[Nfraghash];
+	long		fragmem6;
+	ulong		fragsweep6;
 	Ref		id6;
 
 	int		iprouting;	/* true if we route like a gateway */
+
+	Ipfwd		fwd[Nipfwd];	/* forwarding cache */
 };
 
 /* on the wire packet header */
@@ -179,6 +227,7 @@ struct Conv
 	uint	ttl;			/* max time to live */
 	uint	tos;			/* type of service */
 	int	ignoreadvice;		/* don't terminate connection on icmp errors */
+	int	reuseport;		/* may announce a port other reuseport listeners have */
 
 	uchar	ipversion;
 	uchar	laddr[IPaddrlen];	/* local IP address */
@@ -197,6 +246,7 @@ struct Conv
 	/* udp specific */
 	int	headers;		/* data src/dst headers in udp */
 	int	reliable;		/* true if reliable udp */
+	int	batch;			/* many length-prefixed datagrams per read and write */
 
 	Conv*	incall;			/* calls waiting to be listened for */
 	Conv*	next;
@@ -213,6 +263,7 @@ struct Conv
 
 	QLock	listenq;
 	Rendez	listenr;
+	Pollq	listenp;		/* event sets watching for incall */
 
 	Ipmulti	*multi;			/* multicast bindings for this interface */
 
@@ -256,7 +307,12 @@ struct Medium
 	/* v6 address generation */
 	void	(*pref2addr)(uchar *pref, uchar *ea);
 
+	/* forwarding: the link header to ip if known, and a write with it on */
+	int	(*linkhdr)(Ipifc *ifc, int version, uchar *ip, uchar *hdr);
+	void	(*hwrite)(Ipifc *ifc, Block *b, int version);
+
 	int	unbindonclose;	/* if non-zero, unbind on last close */
+	int	csum;		/* finishes Bcsum checksums its device can't */
 };
 
 /* logical interface associated with a physical one */
@@ -317,6 +373,9 @@ struct Ipifc
 	int	maxtu;		/* Maximum transfer unit */
 	int	mintu;		/* Minumum tranfer unit */
 	int	mbps;		/* megabits per second */
+	int	tso;		/* largest tcp super-segment it takes, 0 if none */
+	int	csum;		/* finishes tcp and udp checksums on v4 */
+	Ipfq	*fq;		/* fair queue in front of the medium, nil if none */
 	void	*arg;		/* medium specific */
 	int	reassemble;	/* reassemble IP packets before forwarding */
 
@@ -351,11 +410,14 @@ struct Ipmulti
 };
 
 /*
- *  hash table for 2 ip addresses + 2 ports
+ *  hash table for 2 ip addresses + 2 ports.  Each bucket has
+ *  its own lock; the table is write locked only to grow it.
  */
 enum
 {
-	Nipht=		521,	/* convenient prime */
+	Niphtmin=	512,	/* buckets to start with */
+	Niphtmax=	1<<15,
+	Niphtload=	2,	/* entries per bucket before it grows */
 
 	IPmatchexact=	0,	/* match on 4 tuple */
 	IPmatchany,		/* *!* */
@@ -368,11 +430,21 @@ struct Iphash
 	Iphash	*next;
 	Conv	*c;
 	int	match;
+	ulong	hv;		/* whole hash, to move it when growing */
 };
-struct Ipht
+struct Iphtb
 {
 	Lock;
-	Iphash	*tab[Nipht];
+	Iphash	*h;
+};
+struct Ipht
+{
+	RWlock;			/* read to use a bucket, write to resize */
+	Lock	nl;
+	int	n;		/* entries */
+	int	size;		/* buckets, a power of 2 */
+	Iphtb	*tab;
+	ulong	key[2];		/* random, so collisions can't be chosen */
 };
 void iphtadd(Ipht*, Conv*);
 void iphtrem(Ipht*, Conv*);
@@ -387,6 +459,7 @@ struct Proto
 	char*		name;		/* protocol name */
 	int		x;		/* protocol index */
 	int		ipproto;	/* ip protocol type */
+	int		sumwrite;	/* sum data as it is written: kick takes whole blocks */
 
 	char*		(*connect)(Conv*, char**, int);
 	char*		(*announce)(Conv*, char**, int);
@@ -437,6 +510,7 @@ struct Fs
 	Route	*v4root[1<<Lroot];	/* v4 routing forest */
 	Route	*v6root[1<<Lroot];	/* v6 routing forest */
 	Route	*queue;			/* used as temp when reinjecting routes */
+	Lpm	*v4lpm;			/* v4 forest as a trie, for lookups */
 
 	Netlog	*alog;
 
@@ -587,6 +661,7 @@ extern void	v6addroute(Fs *f, char *tag, uchar *a, uchar *mask, uchar *gate, int
 extern void	v4delroute(Fs *f, uchar *a, uchar *mask, int dolock);
 extern void	v6delroute(Fs *f, uchar *a, uchar *mask, int dolock);
 extern Route*	v4lookup(Fs *f, uchar *a, Conv *c);
+extern ulong	v4routegen(void);
 extern Route*	v6lookup(Fs *f, uchar *a, Conv *c);
 extern long	routeread(Fs *f, char*, ulong, int);
 extern long	routewrite(Fs *f, Chan*, char*, int);
@@ -636,6 +711,8 @@ extern int	arpread(Arp*, char*, ulong, int);
 extern int	arpwrite(Fs*, char*, int);
 extern Arpent*	arpget(Arp*, Block *bp, int version, Ipifc *ifc, uchar *ip, uchar *h);
 extern void	arprelease(Arp*, Arpent *a);
+extern int	arplook(Arp*, int version, Ipifc *ifc, uchar *ip, uchar *mac);
+extern ulong	arpgen(Arp*);
 extern Block*	arpresolve(Arp*, Arpent *a, Medium *type, uchar *mac);
 extern void	arpenter(Fs*, int version, uchar *ip, uchar *mac, int len, int norefresh);
 
@@ -704,6 +781,7 @@ extern char*	ipifcrem(Ipifc *ifc, char **argv, int argc);
 extern char*	ipifcadd(Ipifc *ifc, char **argv, int argc, int tentative, Iplifc *lifcp);
 extern long	ipselftabread(Fs*, char *a, ulong offset, int n);
 extern char*	ipifcadd6(Ipifc *ifc, char**argv, int argc);
+extern void	ipifcoput(Ipifc *ifc, Block *bp, int version, uchar *gate);
 /*
  *  ip.c
  */
@@ -716,9 +794,12 @@ extern void	ipiput4(Fs*, Ipifc*, Block*);
 extern void	ipiput6(Fs*, Ipifc*, Block*);
 extern int	ipoput4(Fs*, Block*, int, int, int, Conv*);
 extern int	ipoput6(Fs*, Block*, int, int, int, Conv*);
+extern Block*	ipsegment4(Block*);
+extern void	ipfinishcsum4(Block*);
 extern int	ipstats(Fs*, char*, int);
 extern ushort	ptclbsum(uchar*, int);
 extern ushort	ptclcsum(Block*, int, int);
+extern ushort	ptclcpsum(uchar*, uchar*, int);
 extern void	ip_init(Fs*);
 extern void	update_mtucache(uchar*, ulong);
 extern ulong	restrict_mtu(uchar*, ulong);
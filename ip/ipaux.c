@@ -186,6 +186,66 @@ ptclcsum(Block *bp, int offset, int len)
 	return ~losum & 0xffff;
 }
 
+static	short	endian	= 1;
+#define	LITTLE	(*(uchar*)&endian)
+
+/*
+ *  copy n bytes from src to dst and return their ptclbsum,
+ *  summing the words as they go by when the two are aligned
+ *  alike, as ptclbsum does
+ */
+ushort
+ptclcpsum(uchar *dst, uchar *src, int n)
+{
+	uvlong sum;
+	ulong *w, *d, x;
+	int swap;
+
+	if((((uintptr)dst ^ (uintptr)src) & 3) != 0){
+		memmove(dst, src, n);
+		return ptclbsum(src, n);
+	}
+	swap = ((uintptr)src & 1) ^ LITTLE;
+	sum = 0;
+	for(; n > 0 && ((uintptr)src & 3) != 0; n--, src++){
+		*dst++ = *src;
+		sum += (((uintptr)src & 1) != LITTLE) ? *src : *src << 8;
+	}
+	w = (ulong*)src;
+	d = (ulong*)dst;
+	for(; n >= 16; n -= 16, w += 4, d += 4){
+		x = w[0];
+		d[0] = x;
+		sum += x;
+		x = w[1];
+		d[1] = x;
+		sum += x;
+		x = w[2];
+		d[2] = x;
+		sum += x;
+		x = w[3];
+		d[3] = x;
+		sum += x;
+	}
+	for(; n >= 4; n -= 4){
+		x = *w++;
+		*d++ = x;
+		sum += x;
+	}
+	src = (uchar*)w;
+	dst = (uchar*)d;
+	for(; n > 0; n--, src++){
+		*dst++ = *src;
+		sum += (((uintptr)src & 1) != LITTLE) ? *src : *src << 8;
+	}
+
+	while(sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	if(swap)
+		sum = (sum >> 8 | sum << 8) & 0xffff;
+	return sum;
+}
+
 enum
 {
 	Isprefix= 16,
@@ -233,61 +293,254 @@ parsemac(uchar *to, char *from, int len)
 }
 
 /*
- *  hashing tcp, udp, ... connections
+ *  hashing tcp, udp, ... connections, with HalfSipHash-1-3
+ *  over the whole 4 tuple under a key chosen when the table
+ *  is made, so a peer can't pick addresses that collide
  */
-ulong
-iphash(uchar *sa, ushort sp, uchar *da, ushort dp)
+#define ROTL(x, b)	(((x) << (b)) | ((x) >> (32 - (b))))
+#define HSIPROUND \
+	v0 += v1; v1 = ROTL(v1, 5); v1 ^= v0; v0 = ROTL(v0, 16); \
+	v2 += v3; v3 = ROTL(v3, 8); v3 ^= v2; \
+	v0 += v3; v3 = ROTL(v3, 7); v3 ^= v0; \
+	v2 += v1; v1 = ROTL(v1, 13); v1 ^= v2; v2 = ROTL(v2, 16)
+
+static ulong
+iphash(Ipht *ht, uchar *sa, ushort sp, uchar *da, ushort dp)
 {
-	return ((sa[IPaddrlen-1]<<24) ^ (sp << 16) ^ (da[IPaddrlen-1]<<8) ^ dp ) % Nhash;
+	ulong v0, v1, v2, v3, m;
+	int i;
+
+	v0 = ht->key[0];
+	v1 = ht->key[1];
+	v2 = 0x6c796765 ^ v0;
+	v3 = 0x74656462 ^ v1;
+	for(i = 0; i < 2*IPaddrlen/4 + 1; i++){
+		if(i < IPaddrlen/4)
+			m = nhgetl(sa + 4*i);
+		else if(i < 2*IPaddrlen/4)
+			m = nhgetl(da + 4*i - IPaddrlen);
+		else
+			m = (sp << 16) | dp;
+		v3 ^= m;
+		HSIPROUND;
+		v0 ^= m;
+	}
+	m = (2*IPaddrlen + 4) << 24;
+	v3 ^= m;
+	HSIPROUND;
+	v0 ^= m;
+	v2 ^= 0xff;
+	HSIPROUND;
+	HSIPROUND;
+	HSIPROUND;
+	return v1 ^ v3;
+}
+
+/*
+ *  hash of the parts of c's addresses that its kind of match uses
+ */
+static ulong
+iphtkey(Ipht *ht, Conv *c, int match)
+{
+	switch(match){
+	case IPmatchexact:
+		return iphash(ht, c->raddr, c->rport, c->laddr, c->lport);
+	case IPmatchpa:
+		return iphash(ht, IPnoaddr, 0, c->laddr, c->lport);
+	case IPmatchport:
+		return iphash(ht, IPnoaddr, 0, IPnoaddr, c->lport);
+	case IPmatchaddr:
+		return iphash(ht, IPnoaddr, 0, c->laddr, 0);
+	}
+	return iphash(ht, IPnoaddr, 0, IPnoaddr, 0);
+}
+
+static Iphtb*
+iphtbucket(Ipht *ht, ulong hv)
+{
+	return &ht->tab[hv & (ht->size - 1)];
+}
+
+/*
+ *  the first table is made on the first add, which can sleep
+ *  for the key; called write locked
+ */
+static void
+iphtinit(Ipht *ht)
+{
+	ht->tab = smalloc(Niphtmin*sizeof(Iphtb));
+	ht->size = Niphtmin;
+	randomread(ht->key, sizeof(ht->key));
+}
+
+/*
+ *  double the buckets; called write locked, so nothing is in
+ *  a bucket.  Without the memory, the chains just get longer.
+ */
+static void
+iphtgrow(Ipht *ht)
+{
+	Iphtb *ot, *b;
+	Iphash *h, *next;
+	int i, osize;
+
+	if(ht->n <= Niphtload*ht->size || ht->size >= Niphtmax)
+		return;
+	ot = ht->tab;
+	osize = ht->size;
+	ht->tab = malloc(2*osize*sizeof(Iphtb));
+	if(ht->tab == nil){
+		ht->tab = ot;
+		return;
+	}
+	ht->size = 2*osize;
+	for(i = 0; i < osize; i++)
+		for(h = ot[i].h; h != nil; h = next){
+			next = h->next;
+			b = iphtbucket(ht, h->hv);
+			h->next = b->h;
+			b->h = h;
+		}
+	free(ot);
+}
+
+static int
+iphtmatch(Conv *c)
+{
+	if(ipcmp(c->raddr, IPnoaddr) != 0)
+		return IPmatchexact;
+	if(ipcmp(c->laddr, IPnoaddr) != 0){
+		if(c->lport == 0)
+			return IPmatchaddr;
+		return IPmatchpa;
+	}
+	if(c->lport == 0)
+		return IPmatchany;
+	return IPmatchport;
 }
 
 void
 iphtadd(Ipht *ht, Conv *c)
 {
-	ulong hv;
 	Iphash *h;
+	Iphtb *b;
+	int grow;
 
-	hv = iphash(c->raddr, c->rport, c->laddr, c->lport);
 	h = smalloc(sizeof(*h));
-	if(ipcmp(c->raddr, IPnoaddr) != 0)
-		h->match = IPmatchexact;
-	else {
-		if(ipcmp(c->laddr, IPnoaddr) != 0){
-			if(c->lport == 0)
-				h->match = IPmatchaddr;
-			else
-				h->match = IPmatchpa;
-		} else {
-			if(c->lport == 0)
-				h->match = IPmatchany;
-			else
-				h->match = IPmatchport;
-		}
-	}
+	h->match = iphtmatch(c);
 	h->c = c;
 
-	lock(ht);
-	h->next = ht->tab[hv];
-	ht->tab[hv] = h;
-	unlock(ht);
+	if(ht->tab == nil){
+		wlock(ht);
+		if(ht->tab == nil)
+			iphtinit(ht);
+		wunlock(ht);
+	}
+
+	rlock(ht);
+	h->hv = iphtkey(ht, c, h->match);
+	b = iphtbucket(ht, h->hv);
+	lock(b);
+	h->next = b->h;
+	b->h = h;
+	unlock(b);
+	lock(&ht->nl);
+	ht->n++;
+	grow = ht->n > Niphtload*ht->size && ht->size < Niphtmax;
+	unlock(&ht->nl);
+	runlock(ht);
+
+	if(grow){
+		wlock(ht);
+		iphtgrow(ht);
+		wunlock(ht);
+	}
 }
 
 void
 iphtrem(Ipht *ht, Conv *c)
 {
-	ulong hv;
 	Iphash **l, *h;
+	Iphtb *b;
+
+	h = nil;
+	rlock(ht);
+	if(ht->tab != nil){
+		b = iphtbucket(ht, iphtkey(ht, c, iphtmatch(c)));
+		lock(b);
+		for(l = &b->h; (*l) != nil; l = &(*l)->next)
+			if((*l)->c == c){
+				h = *l;
+				(*l) = h->next;
+				break;
+			}
+		unlock(b);
+		if(h != nil){
+			lock(&ht->nl);
+			ht->n--;
+			unlock(&ht->nl);
+		}
+	}
+	runlock(ht);
+	free(h);
+}
 
-	hv = iphash(c->raddr, c->rport, c->laddr, c->lport);
-	lock(ht);
-	for(l = &ht->tab[hv]; (*l) != nil; l = &(*l)->next)
-		if((*l)->c == c){
-			h = *l;
-			(*l) = h->next;
-			free(h);
-			break;
+/*
+ *  the weight of listener c for a flow: the heaviest of the
+ *  listeners sharing a port takes it, so a flow always goes
+ *  to the same one and a listener leaving moves only its own
+ */
+static ulong
+iphtweight(ulong flow, Conv *c)
+{
+	ulong w;
+
+	w = (flow ^ (c->x * 0x9e3779b1UL)) * 0x85ebca6bUL;
+	return w ^ (w >> 15);
+}
+
+/*
+ *  the conversation that matches the parts of the
+ *  addresses that match uses.  flow is the hash of
+ *  the whole of them, to choose among reuseport listeners.
+ */
+static Conv*
+iphtfind(Ipht *ht, int match, ulong flow, uchar *sa, ushort sp, uchar *da, ushort dp)
+{
+	ulong hv, w, bw;
+	Iphtb *b;
+	Iphash *h;
+	Conv *c, *best;
+
+	if(match == IPmatchexact)
+		hv = flow;
+	else
+		hv = iphash(ht, sa, sp, da, dp);
+	b = iphtbucket(ht, hv);
+	if(b->h == nil)
+		return nil;
+	best = nil;
+	bw = 0;
+	lock(b);
+	for(h = b->h; h != nil; h = h->next){
+		if(h->match != match || h->hv != hv)
+			continue;
+		c = h->c;
+		if(dp == c->lport && ipcmp(da, c->laddr) == 0
+		&& (match != IPmatchexact || sp == c->rport && ipcmp(sa, c->raddr) == 0)){
+			if(!c->reuseport){
+				unlock(b);
+				return c;
+			}
+			w = iphtweight(flow, c);
+			if(best == nil || w > bw){
+				best = c;
+				bw = w;
+			}
 		}
-	unlock(ht);
+	}
+	unlock(b);
+	return best;
 }
 
 /* look for a matching conversation with the following precedence
@@ -300,69 +553,24 @@ iphtrem(Ipht *ht, Conv *c)
 Conv*
 iphtlook(Ipht *ht, uchar *sa, ushort sp, uchar *da, ushort dp)
 {
-	ulong hv;
-	Iphash *h;
 	Conv *c;
+	ulong flow;
 
-	/* exact 4 pair match (connection) */
-	hv = iphash(sa, sp, da, dp);
-	lock(ht);
-	for(h = ht->tab[hv]; h != nil; h = h->next){
-		if(h->match != IPmatchexact)
-			continue;
-		c = h->c;
-		if(sp == c->rport && dp == c->lport
-		&& ipcmp(sa, c->raddr) == 0 && ipcmp(da, c->laddr) == 0){
-			unlock(ht);
-			return c;
-		}
-	}
-
-	/* match local address and port */
-	hv = iphash(IPnoaddr, 0, da, dp);
-	for(h = ht->tab[hv]; h != nil; h = h->next){
-		if(h->match != IPmatchpa)
-			continue;
-		c = h->c;
-		if(dp == c->lport && ipcmp(da, c->laddr) == 0){
-			unlock(ht);
-			return c;
-		}
-	}
-
-	/* match just port */
-	hv = iphash(IPnoaddr, 0, IPnoaddr, dp);
-	for(h = ht->tab[hv]; h != nil; h = h->next){
-		if(h->match != IPmatchport)
-			continue;
-		c = h->c;
-		if(dp == c->lport){
-			unlock(ht);
-			return c;
-		}
-	}
-
-	/* match local address */
-	hv = iphash(IPnoaddr, 0, da, 0);
-	for(h = ht->tab[hv]; h != nil; h = h->next){
-		if(h->match != IPmatchaddr)
-			continue;
-		c = h->c;
-		if(ipcmp(da, c->laddr) == 0){
-			unlock(ht);
-			return c;
-		}
-	}
-
-	/* look for something that matches anything */
-	hv = iphash(IPnoaddr, 0, IPnoaddr, 0);
-	for(h = ht->tab[hv]; h != nil; h = h->next){
-		if(h->match != IPmatchany)
-			continue;
-		c = h->c;
-		unlock(ht);
-		return c;
+	rlock(ht);
+	if(ht->tab == nil){
+		runlock(ht);
+		return nil;
 	}
-	unlock(ht);
-	return nil;
+	flow = iphash(ht, sa, sp, da, dp);
+	c = iphtfind(ht, IPmatchexact, flow, sa, sp, da, dp);
+	if(c == nil)
+		c = iphtfind(ht, IPmatchpa, flow, IPnoaddr, 0, da, dp);
+	if(c == nil)
+		c = iphtfind(ht, IPmatchport, flow, IPnoaddr, 0, IPnoaddr, dp);
+	if(c == nil)
+		c = iphtfind(ht, IPmatchaddr, flow, IPnoaddr, 0, da, 0);
+	if(c == nil)
+		c = iphtfind(ht, IPmatchany, flow, IPnoaddr, 0, IPnoaddr, 0);
+	runlock(ht);
+	return c;
 }
@@ -16,6 +16,13 @@ enum {
 	NHASH		= 1<<6,
 	NCACHE		= 256,
 	QMAX		= 192*1024-1,
+
+	/* fair queueing */
+	Nfqflow		= 64,		/* flows hashed to */
+	Fqring		= 32,		/* packets a flow holds, a power of 2 */
+	Fqlimit		= 256*1024,	/* bytes queued before the fattest flow drops */
+	TCPproto	= 6,
+	UDPproto	= 17,
 };
 
 Medium *media[Maxmedia] = { 0 };
@@ -54,6 +61,52 @@ struct Ipmcast
 	uchar	ia[IPaddrlen];	/* interface address */
 };
 
+/*
+ *  optional output discipline: deficit round robin over hashed
+ *  flows, new flows first, as fq_codel does without the codel.
+ *  A kproc feeds the medium from it.
+ */
+typedef struct Fqpkt Fqpkt;
+typedef struct Fqflow Fqflow;
+typedef struct Fqlist Fqlist;
+
+struct Fqpkt
+{
+	Block	*bp;
+	int	version;
+	uchar	gate[IPaddrlen];
+};
+
+struct Fqflow
+{
+	Fqflow	*next;		/* on new or old */
+	int	listed;
+	int	deficit;
+	int	len;		/* bytes queued */
+	uint	rd;
+	uint	wr;
+	Fqpkt	q[Fqring];
+};
+
+struct Fqlist
+{
+	Fqflow	*head;
+	Fqflow	*tail;
+};
+
+struct Ipfq
+{
+	Lock;
+	Rendez	r;
+	int	dying;
+	Ipifc	*ifc;
+	int	quantum;
+	int	len;		/* bytes queued */
+	Fqlist	new;
+	Fqlist	old;
+	Fqflow	flow[Nfqflow];
+};
+
 /* quick hash for ip addresses */
 #define hashipa(a) ( ( ((a)[IPaddrlen-2]<<8) | (a)[IPaddrlen-1] )%NHASH )
 
@@ -65,6 +118,7 @@ static char*	ipifcjoinmulti(Ipifc *ifc, char **argv, int argc);
 static char*	ipifcleavemulti(Ipifc *ifc, char **argv, int argc);
 static void	ipifcregisterproxy(Fs*, Ipifc*, uchar*);
 static char*	ipifcremlifc(Ipifc*, Iplifc*);
+static void	fqstop(Ipifc*);
 
 /*
  *  link in a new medium
@@ -125,7 +179,9 @@ ipifcbind(Conv *c, char **argv, int argc)
 		nexterror();
 	}
 
-	/* do medium specific binding */
+	/* do medium specific binding; it turns on tso and csum if it can */
+	ifc->tso = 0;
+	ifc->csum = 0;
 	(*m->bind)(ifc, argc, argv);
 
 	/* set the bound device name */
@@ -202,6 +258,7 @@ ipifcunbind(Ipifc *ifc)
 	memset(ifc->dev, 0, sizeof(ifc->dev));
 	ifc->arg = nil;
 	ifc->reassemble = 0;
+	fqstop(ifc);
 
 	/* close queues to stop queuing of packets */
 	qclose(ifc->conv->rq);
@@ -358,6 +415,304 @@ ipifcsetmtu(Ipifc *ifc, char **argv, int argc)
 	return nil;
 }
 
+/*
+ *  set the largest tcp super-segment handed to the medium,
+ *  0 for none; the medium cuts up what its device can't
+ */
+char*
+ipifcsettso(Ipifc *ifc, char **argv, int argc)
+{
+	int tso;
+
+	if(argc < 2 || ifc->m == nil)
+		return Ebadarg;
+	tso = strtoul(argv[1], 0, 0);
+	if(tso != 0 && (tso < 2*ifc->maxtu || tso >= IP_MAX))
+		return Ebadarg;
+	ifc->tso = tso;
+	return nil;
+}
+
+/*
+ *  leave tcp and udp checksums to the medium or not;
+ *  it finishes in software those its device can't
+ */
+char*
+ipifcsetcsum(Ipifc *ifc, char **argv, int argc)
+{
+	if(ifc->m == nil)
+		return "ipifc not yet bound to device";
+	if(argc > 1 && strcmp(argv[1], "off") == 0)
+		ifc->csum = 0;
+	else if(argc > 1 && strcmp(argv[1], "on") != 0)
+		return Ebadarg;
+	else if(ifc->m->csum == 0)
+		return "medium can't offload checksums";
+	else
+		ifc->csum = 1;
+	return nil;
+}
+
+static void
+fqpush(Fqlist *l, Fqflow *fl)
+{
+	fl->next = nil;
+	if(l->head == nil)
+		l->head = fl;
+	else
+		l->tail->next = fl;
+	l->tail = fl;
+}
+
+static Fqflow*
+fqpop(Fqlist *l)
+{
+	Fqflow *fl;
+
+	fl = l->head;
+	if(fl != nil)
+		l->head = fl->next;
+	return fl;
+}
+
+/* a flow is the addresses, the protocol and, unfragmented, the ports */
+static ulong
+fqhash(Block *bp, int version)
+{
+	uchar *p;
+	ulong h;
+	int i, n, hl, proto;
+
+	p = bp->rp;
+	n = BLEN(bp);
+	h = 0;
+	if(version == V4){
+		if(n < IP4HDR)
+			return 0;
+		for(i = 12; i < 20; i++)
+			h = h*31 + p[i];
+		hl = (p[0] & 0xf) << 2;
+		proto = p[9];
+		if(nhgets(p+6) & (IP_MF|0x1fff))
+			proto = 0;
+	} else {
+		if(n < IP6HDR)
+			return 0;
+		for(i = 8; i < 40; i++)
+			h = h*31 + p[i];
+		hl = IP6HDR;
+		proto = p[6];
+	}
+	h = h*31 + proto;
+	if((proto == TCPproto || proto == UDPproto) && n >= hl+4)
+		for(i = hl; i < hl+4; i++)
+			h = h*31 + p[i];
+	return h ^ h>>16;
+}
+
+/* drop the oldest packet of a flow; called with fq locked */
+static void
+fqdrop(Ipfq *fq, Fqflow *fl)
+{
+	Fqpkt *p;
+	int n;
+
+	p = &fl->q[fl->rd++ & (Fqring-1)];
+	n = BLEN(p->bp);
+	fl->len -= n;
+	fq->len -= n;
+	freeblist(p->bp);
+	p->bp = nil;
+	fq->ifc->outerr++;
+}
+
+static void
+fqput(Ipfq *fq, Block *bp, int version, uchar *gate)
+{
+	Fqflow *fl, *fat;
+	Fqpkt *p;
+	int i, n;
+
+	fl = &fq->flow[fqhash(bp, version) % Nfqflow];
+	n = BLEN(bp);
+	lock(fq);
+	if(fl->wr - fl->rd == Fqring)
+		fqdrop(fq, fl);
+	p = &fl->q[fl->wr++ & (Fqring-1)];
+	p->bp = bp;
+	p->version = version;
+	memmove(p->gate, gate, version == V4 ? IPv4addrlen : IPaddrlen);
+	fl->len += n;
+	fq->len += n;
+	if(!fl->listed){
+		fl->listed = 1;
+		fl->deficit = fq->quantum;
+		fqpush(&fq->new, fl);
+	}
+	while(fq->len > Fqlimit){
+		fat = fq->flow;
+		for(i = 1; i < Nfqflow; i++)
+			if(fq->flow[i].len > fat->len)
+				fat = &fq->flow[i];
+		fqdrop(fq, fat);
+	}
+	unlock(fq);
+	wakeup(&fq->r);
+}
+
+static Block*
+fqget(Ipfq *fq, int *version, uchar *gate)
+{
+	Fqlist *l;
+	Fqflow *fl;
+	Fqpkt *p;
+	Block *bp;
+
+	lock(fq);
+	for(;;){
+		l = &fq->new;
+		if(l->head == nil)
+			l = &fq->old;
+		fl = l->head;
+		if(fl == nil){
+			unlock(fq);
+			return nil;
+		}
+		if(fl->deficit <= 0){
+			fl->deficit += fq->quantum;
+			fqpop(l);
+			fqpush(&fq->old, fl);
+			continue;
+		}
+		if(fl->rd == fl->wr){
+			/* an emptied new flow waits its turn once among the old */
+			fqpop(l);
+			if(l == &fq->new)
+				fqpush(&fq->old, fl);
+			else
+				fl->listed = 0;
+			continue;
+		}
+		break;
+	}
+	p = &fl->q[fl->rd++ & (Fqring-1)];
+	bp = p->bp;
+	p->bp = nil;
+	*version = p->version;
+	ipmove(gate, p->gate);
+	fl->len -= BLEN(bp);
+	fq->len -= BLEN(bp);
+	fl->deficit -= BLEN(bp);
+	unlock(fq);
+	return bp;
+}
+
+static int
+fqready(void *a)
+{
+	Ipfq *fq;
+
+	fq = a;
+	return fq->dying || fq->new.head != nil || fq->old.head != nil;
+}
+
+static void
+fqproc(void *a)
+{
+	Ipfq *fq;
+	Ipifc *ifc;
+	Block *bp;
+	uchar gate[IPaddrlen];
+	int version;
+
+	fq = a;
+	ifc = fq->ifc;
+	while(!fq->dying){
+		sleep(&fq->r, fqready, fq);
+		bp = fqget(fq, &version, gate);
+		if(bp == nil)
+			continue;
+		rlock(ifc);
+		if(ifc->m == nil || ifc->fq != fq){
+			runlock(ifc);
+			freeblist(bp);
+			continue;
+		}
+		if(!waserror()){
+			ifc->m->bwrite(ifc, bp, version, gate);
+			poperror();
+		}
+		runlock(ifc);
+	}
+	while((bp = fqget(fq, &version, gate)) != nil)
+		freeblist(bp);
+	free(fq);
+	pexit("", 1);
+}
+
+/* called with ifc wlocked; the kproc frees what is queued */
+static void
+fqstop(Ipifc *ifc)
+{
+	Ipfq *fq;
+
+	fq = ifc->fq;
+	if(fq == nil)
+		return;
+	ifc->fq = nil;
+	fq->dying = 1;
+	wakeup(&fq->r);
+}
+
+/*
+ *  turn fair queueing in front of the medium on or off
+ */
+char*
+ipifcsetfq(Ipifc *ifc, char **argv, int argc)
+{
+	Ipfq *fq;
+
+	if(argc > 1 && strcmp(argv[1], "off") == 0){
+		wlock(ifc);
+		fqstop(ifc);
+		wunlock(ifc);
+		return nil;
+	}
+	if(argc > 1 && strcmp(argv[1], "on") != 0)
+		return Ebadarg;
+	wlock(ifc);
+	if(ifc->m == nil){
+		wunlock(ifc);
+		return "ipifc not yet bound to device";
+	}
+	if(ifc->fq == nil){
+		fq = malloc(sizeof *fq);
+		if(fq == nil){
+			wunlock(ifc);
+			return Enomem;
+		}
+		fq->ifc = ifc;
+		fq->quantum = ifc->maxtu;
+		ifc->fq = fq;
+		kproc("ipfq", fqproc, fq);
+	}
+	wunlock(ifc);
+	return nil;
+}
+
+/*
+ *  hand a packet to the medium, through the fair queue if
+ *  there is one.  called with ifc rlocked.
+ */
+void
+ipifcoput(Ipifc *ifc, Block *bp, int version, uchar *gate)
+{
+	if(ifc->fq == nil)
+		ifc->m->bwrite(ifc, bp, version, gate);
+	else
+		fqput(ifc->fq, bp, version, gate);
+}
+
 /*
  *  add an address to an interface.
  */
@@ -772,6 +1127,12 @@ ipifcctl(Conv* c, char**argv, int argc)
 		return ipifcleavemulti(ifc, argv, argc);
 	else if(strcmp(argv[0], "mtu") == 0)
 		return ipifcsetmtu(ifc, argv, argc);
+	else if(strcmp(argv[0], "tso") == 0)
+		return ipifcsettso(ifc, argv, argc);
+	else if(strcmp(argv[0], "csum") == 0)
+		return ipifcsetcsum(ifc, argv, argc);
+	else if(strcmp(argv[0], "fq") == 0)
+		return ipifcsetfq(ifc, argv, argc);
 	else if(strcmp(argv[0], "reassemble") == 0){
 		ifc->reassemble = 1;
 		return nil;
@@ -13,6 +13,8 @@
 
 typedef struct Ipmuxrock  Ipmuxrock;
 typedef struct Ipmux      Ipmux;
+typedef struct Ipmuxsw    Ipmuxsw;
+typedef struct Ipmuxent   Ipmuxent;
 
 typedef struct Myip4hdr Myip4hdr;
 struct Myip4hdr
@@ -50,6 +52,8 @@ enum
 	Cmlong,		/* single long with mask */
 	Cifc,
 	Cmifc,
+
+	Nmuxswmin = 4,	/* shortest run of tests worth a switch */
 };
 
 char *ftname[] =
@@ -82,6 +86,25 @@ struct Ipmux
 
 	int	ref;		/* so we can garbage collect */
 	Conv	*conv;
+
+	Ipmuxsw	*sw;		/* compiled run of no's testing this field */
+};
+
+/*
+ *  a run of nodes down the no side that test the same field
+ *  against one value each, hashed by value: one probe finds
+ *  the node that matches, or that none does
+ */
+struct Ipmuxent
+{
+	ulong	key;
+	Ipmux	*mux;
+};
+struct Ipmuxsw
+{
+	Ipmux	*next;		/* first node after the run */
+	int	size;		/* entries, a power of 2 */
+	Ipmuxent	tab[1];
 };
 
 /*
@@ -417,6 +440,7 @@ ipmuxcopy(Ipmux *f)
 	*nf = *f;
 	nf->no = ipmuxcopy(f->no);
 	nf->yes = ipmuxcopy(f->yes);
+	nf->sw = nil;
 	nf->val = smalloc(f->n*f->len);
 	nf->e = nf->val + f->len*f->n;
 	memmove(nf->val, f->val, f->n*f->len);
@@ -428,6 +452,7 @@ ipmuxfree(Ipmux *f)
 {
 	if(f->val != nil)
 		free(f->val);
+	free(f->sw);
 	free(f);
 }
 
@@ -534,6 +559,97 @@ ipmuxremove(Ipmux **l, Ipmux *f)
 	return ipmuxremove(&ft->yes, f->yes);
 }
 
+/*
+ *  the bytes of a field under its mask, as one number
+ */
+static ulong
+ipmuxkey(uchar *p, uchar *m, int len)
+{
+	ulong k;
+
+	k = 0;
+	while(len-- > 0)
+		k = k<<8 | (*p++ & *m++);
+	return k;
+}
+
+static int
+ipmuxhash(ulong k, int size)
+{
+	return (k * 0x9e3779b1UL) >> 16 & (size - 1);
+}
+
+/*
+ *  can e join a switch on x's field?  only single values of
+ *  up to a long, so that one key is the whole test.
+ */
+static int
+ipmuxswable(Ipmux *x, Ipmux *e)
+{
+	return e->n == 1 && e->ctype != Cother && ipmuxcmp(x, e) == 0;
+}
+
+static Ipmuxsw*
+ipmuxswmake(Ipmux *x, Ipmux *end, int n)
+{
+	Ipmuxsw *sw;
+	Ipmuxent *te;
+	int size;
+	ulong k;
+
+	for(size = 1; size < 2*n; size <<= 1)
+		;
+	sw = malloc(sizeof(Ipmuxsw) + (size-1)*sizeof(Ipmuxent));
+	if(sw == nil)
+		return nil;
+	sw->next = end;
+	sw->size = size;
+	for(; x != end; x = x->no){
+		k = ipmuxkey(x->val, x->mask, x->len);
+		if(k != ipmuxkey(x->val, x->val, x->len))
+			continue;	/* value outside the mask never matches */
+		for(te = &sw->tab[ipmuxhash(k, size)]; te->mux != nil; ){
+			if(te->key == k)
+				break;	/* only the first of a value is reached */
+			if(++te == &sw->tab[size])
+				te = sw->tab;
+		}
+		if(te->mux == nil){
+			te->key = k;
+			te->mux = x;
+		}
+	}
+	return sw;
+}
+
+/*
+ *  turn each run of at least Nmuxswmin tests of one field
+ *  down a no chain into a switch on its first node.  the
+ *  tree itself is unchanged, and walked where there's no
+ *  switch.  called write locked after every change.
+ */
+static void
+ipmuxcompile(Ipmux *f)
+{
+	Ipmux *x, *e;
+	int n;
+
+	for(x = f; x != nil; x = x->no){
+		free(x->sw);
+		x->sw = nil;
+		ipmuxcompile(x->yes);
+	}
+	for(x = f; x != nil; x = e){
+		n = 0;
+		for(e = x; e != nil && ipmuxswable(x, e); e = e->no)
+			n++;
+		if(n >= Nmuxswmin)
+			x->sw = ipmuxswmake(x, e, n);
+		if(e == x)
+			e = x->no;
+	}
+}
+
 /*
  *  connection request is a semi separated list of filters
  *  e.g. proto=17;data[0:4]=11aa22bb;ifc=135.104.9.2&255.255.255.0
@@ -580,6 +696,7 @@ ipmuxconnect(Conv *c, char **argv, int argc)
 	/* add the chain to the protocol demultiplexor tree */
 	wlock(f);
 	f->ipmux->priv = ipmuxmerge(f->ipmux->priv, mux);
+	ipmuxcompile(f->ipmux->priv);
 	wunlock(f);
 
 	Fsconnected(c, nil);
@@ -630,6 +747,7 @@ ipmuxclose(Conv *c)
 
 	wlock(f);
 	ipmuxremove(&(c->p->priv), r->chain);
+	ipmuxcompile(c->p->priv);
 	wunlock(f);
 	ipmuxtreefree(r->chain);
 	r->chain = nil;
@@ -664,6 +782,9 @@ ipmuxiput(Proto *p, Ipifc *ifc, Block *bp)
 	uchar *m, *h, *v, *e, *ve, *hp;
 	Conv *c;
 	Ipmux *mux;
+	Ipmuxsw *sw;
+	Ipmuxent *te;
+	ulong k;
 	Myip4hdr *ip;
 	Ip6hdr *ip6;
 
@@ -681,11 +802,27 @@ ipmuxiput(Proto *p, Ipifc *ifc, Block *bp)
 	c = nil;
 	mux = f->ipmux->priv;
 	while(mux != nil){
+		sw = mux->sw;
 		if(mux->eoff > len){
-			mux = mux->no;
+			mux = sw != nil ? sw->next : mux->no;
 			continue;
 		}
 		hp = h + mux->off + ((int)mux->skiphdr)*hl;
+		if(sw != nil){
+			if(mux->type == Tifc)
+				hp = ifc->lifc->local + IPv4off;
+			k = ipmuxkey(hp, mux->mask, mux->len);
+			for(te = &sw->tab[ipmuxhash(k, sw->size)]; te->mux != nil; ){
+				if(te->key == k){
+					mux = te->mux;
+					goto yes;
+				}
+				if(++te == &sw->tab[sw->size])
+					te = sw->tab;
+			}
+			mux = sw->next;
+			continue;
+		}
 		switch(mux->ctype){
 		case Cbyte:
 			if(*mux->val == *hp)
@@ -10,6 +10,7 @@
 static void	walkadd(Fs*, Route**, Route*);
 static void	addnode(Fs*, Route**, Route*);
 static void	calcd(Route*);
+Route**	looknode(Route**, Route*);
 
 /* these are used for all instances of IP */
 static Route*	v4freelist;
@@ -17,6 +18,38 @@ static Route*	v6freelist;
 static RWlock	routelock;
 static ulong	v4routegeneration, v6routegeneration;
 
+/*
+ *  the v4 forest again as a 16-8-8 multibit trie, so a lookup
+ *  is a read a level.  An entry holds the longest prefix over
+ *  its block of addresses or, if longer ones start within it,
+ *  the next level.  Kept up to date under routelock as routes
+ *  come and go; lookups take no lock, as with the forest.
+ *  Routes with masks that aren't prefixes send lookups back
+ *  to the forest while there are any.
+ */
+enum
+{
+	Lpmtop	= 16,		/* bits the first level takes */
+	Lpmsub	= 8,		/* and each of the other two */
+};
+
+typedef struct Lpment Lpment;
+
+struct Lpment
+{
+	Route	*r;
+	Lpment	*sub;		/* 1<<Lpmsub entries for the next level */
+	int	len;		/* prefix length of r */
+};
+
+struct Lpm
+{
+	int	odd;		/* routes in the forest it can't hold */
+	Lpment	e[1<<Lpmtop];
+};
+
+static int lpmend[] = { Lpmtop, Lpmtop+Lpmsub, Lpmtop+2*Lpmsub };
+
 static void
 freeroute(Route *r)
 {
@@ -287,6 +320,156 @@ addnode(Fs *f, Route **cur, Route *new)
 
 #define	V4H(a)	((a&0x07ffffff)>>(32-Lroot-5))
 
+/* length of a prefix mask, -1 if it isn't one */
+static int
+masklen(ulong m)
+{
+	int n;
+
+	for(n = 0; n < 32 && (m & (1UL<<(31-n))) != 0; n++)
+		;
+	if(n < 32 && (m << n) != 0)
+		return -1;
+	return n;
+}
+
+static void
+lpmgrow(Lpment *e)
+{
+	Lpment *s;
+	int i;
+
+	s = malloc(sizeof(Lpment) << Lpmsub);
+	if(s == nil)
+		panic("out of routing nodes");
+	for(i = 0; i < 1<<Lpmsub; i++){
+		s[i].r = e->r;
+		s[i].len = e->len;
+	}
+	e->sub = s;
+}
+
+/* r goes wherever nothing longer than len is */
+static void
+lpmfill(Lpment *e, Route *r, int len)
+{
+	int i;
+
+	if(e->sub != nil)
+		for(i = 0; i < 1<<Lpmsub; i++)
+			lpmfill(&e->sub[i], r, len);
+	if(e->r == nil || e->len <= len){
+		e->r = r;
+		e->len = len;
+	}
+}
+
+/* what a gone prefix of length len held goes to r */
+static void
+lpmclear(Lpment *e, int len, Route *r, int rlen)
+{
+	int i;
+
+	if(e->sub != nil)
+		for(i = 0; i < 1<<Lpmsub; i++)
+			lpmclear(&e->sub[i], len, r, rlen);
+	if(e->r != nil && e->len == len){
+		e->r = r;
+		e->len = rlen;
+	}
+}
+
+/*
+ *  the entries of level lv the prefix a/len covers get r, of
+ *  length rlen, or, when del is set, lose what a/len put
+ *  there to r
+ */
+static void
+lpmchange(Lpment *tab, int lv, ulong a, int len, Route *r, int rlen, int del)
+{
+	Lpment *e, *ee;
+	int bits;
+
+	bits = lv == 0 ? Lpmtop : Lpmsub;
+	e = &tab[(a >> (32 - lpmend[lv])) & ((1<<bits) - 1)];
+	if(len > lpmend[lv]){
+		if(e->sub == nil){
+			if(del)
+				return;
+			lpmgrow(e);
+		}
+		lpmchange(e->sub, lv+1, a, len, r, rlen, del);
+		return;
+	}
+	for(ee = e + (1 << (lpmend[lv] - len)); e < ee; e++)
+		if(del)
+			lpmclear(e, len, r, rlen);
+		else
+			lpmfill(e, r, len);
+}
+
+/* the route for the prefix a/len, if there is one */
+static Route*
+v4findprefix(Fs *f, ulong a, int len)
+{
+	Route **r, rt;
+	ulong m;
+
+	m = len == 0 ? 0 : ~0UL << (32 - len);
+	rt.v4.address = a & m;
+	rt.v4.endaddress = rt.v4.address | ~m;
+	rt.type = Rv4;
+	r = looknode(&f->v4root[V4H(rt.v4.address)], &rt);
+	if(r == nil)
+		return nil;
+	return *r;
+}
+
+/* a route has been added to the forest; called with routelock */
+static void
+lpmadd(Fs *f, ulong sa, ulong m)
+{
+	Route *r;
+	int len;
+
+	if(f->v4lpm == nil){
+		f->v4lpm = malloc(sizeof(Lpm));
+		if(f->v4lpm == nil)
+			panic("out of routing nodes");
+	}
+	len = masklen(m);
+	if(len < 0){
+		f->v4lpm->odd++;
+		return;
+	}
+	r = v4findprefix(f, sa, len);
+	if(r != nil)
+		lpmchange(f->v4lpm->e, 0, sa, len, r, len, 0);
+}
+
+/* a route has gone from the forest; called with routelock */
+static void
+lpmdel(Fs *f, ulong sa, ulong m)
+{
+	Route *r;
+	int len, plen;
+
+	if(f->v4lpm == nil)
+		return;
+	len = masklen(m);
+	if(len < 0){
+		f->v4lpm->odd--;
+		return;
+	}
+	r = nil;
+	for(plen = len-1; plen >= 0; plen--)
+		if((r = v4findprefix(f, sa, plen)) != nil)
+			break;
+	if(r == nil)
+		plen = 0;
+	lpmchange(f->v4lpm->e, 0, sa, len, r, plen, 1);
+}
+
 void
 v4addroute(Fs *f, char *tag, uchar *a, uchar *mask, uchar *gate, int type)
 {
@@ -317,6 +500,9 @@ v4addroute(Fs *f, char *tag, uchar *a, uchar *mask, uchar *gate, int type)
 		}
 		wunlock(&routelock);
 	}
+	wlock(&routelock);
+	lpmadd(f, sa, m);
+	wunlock(&routelock);
 	v4routegeneration++;
 
 	ipifcaddroute(f, Rv4, a, mask, gate, type);
@@ -401,7 +587,7 @@ v4delroute(Fs *f, uchar *a, uchar *mask, int dolock)
 {
 	Route **r, *p;
 	Route rt;
-	int h, eh;
+	int h, eh, found;
 	ulong m;
 
 	m = nhgetl(mask);
@@ -409,12 +595,14 @@ v4delroute(Fs *f, uchar *a, uchar *mask, int dolock)
 	rt.v4.endaddress = rt.v4.address | ~m;
 	rt.type = Rv4;
 
+	found = 0;
 	eh = V4H(rt.v4.endaddress);
 	for(h=V4H(rt.v4.address); h<=eh; h++) {
 		if(dolock)
 			wlock(&routelock);
 		r = looknode(&f->v4root[h], &rt);
 		if(r) {
+			found = 1;
 			p = *r;
 			if(--(p->ref) == 0){
 				*r = 0;
@@ -432,6 +620,14 @@ v4delroute(Fs *f, uchar *a, uchar *mask, int dolock)
 		if(dolock)
 			wunlock(&routelock);
 	}
+	if(found){
+		if(dolock)
+			wlock(&routelock);
+		if(looknode(&f->v4root[V4H(rt.v4.address)], &rt) == nil)
+			lpmdel(f, rt.v4.address, m);
+		if(dolock)
+			wunlock(&routelock);
+	}
 	v4routegeneration++;
 
 	ipifcremroute(f, Rv4, a, mask);
@@ -488,21 +684,32 @@ v4lookup(Fs *f, uchar *a, Conv *c)
 	ulong la;
 	uchar gate[IPaddrlen];
 	Ipifc *ifc;
+	Lpment *e;
 
 	if(c != nil && c->r != nil && c->r->ifc != nil && c->rgen == v4routegeneration)
 		return c->r;
 
 	la = nhgetl(a);
 	q = nil;
-	for(p=f->v4root[V4H(la)]; p;)
-		if(la >= p->v4.address) {
-			if(la <= p->v4.endaddress) {
-				q = p;
-				p = p->mid;
+	if(f->v4lpm != nil && f->v4lpm->odd == 0){
+		e = &f->v4lpm->e[la >> (32-Lpmtop)];
+		if(e->sub != nil){
+			e = &e->sub[(la >> (32-Lpmtop-Lpmsub)) & ((1<<Lpmsub)-1)];
+			if(e->sub != nil)
+				e = &e->sub[la & ((1<<Lpmsub)-1)];
+		}
+		q = e->r;
+	} else {
+		for(p=f->v4root[V4H(la)]; p;)
+			if(la >= p->v4.address) {
+				if(la <= p->v4.endaddress) {
+					q = p;
+					p = p->mid;
+				} else
+					p = p->right;
 			} else
-				p = p->right;
-		} else
-			p = p->left;
+				p = p->left;
+	}
 
 	if(q && (q->ifc == nil || q->ifcid != q->ifc->ifcid)){
 		if(q->type & Rifc) {
@@ -525,6 +732,13 @@ v4lookup(Fs *f, uchar *a, Conv *c)
 	return q;
 }
 
+/* changes whenever a v4 route does, for caches of lookups */
+ulong
+v4routegen(void)
+{
+	return v4routegeneration;
+}
+
 Route*
 v6lookup(Fs *f, uchar *a, Conv *c)
 {
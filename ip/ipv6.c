@@ -118,7 +118,7 @@ ipoput6(Fs *f, Block *bp, int gating, int ttl, int tos, Conv *c)
 	medialen = ifc->maxtu - ifc->m->hsize;
 	if(len <= medialen) {
 		hnputs(eh->ploadlen, len - IP6HDR);
-		ifc->m->bwrite(ifc, bp, V6, gate);
+		ipifcoput(ifc, bp, V6, gate);
 		runlock(ifc);
 		poperror();
 		return 0;
@@ -209,7 +209,7 @@ ipoput6(Fs *f, Block *bp, int gating, int ttl, int tos, Conv *c)
 				xp = xp->next;
 		}
 
-		ifc->m->bwrite(ifc, nb, V6, gate);
+		ipifcoput(ifc, nb, V6, gate);
 		ip->stats[FragCreates]++;
 	}
 	ip->stats[FragOKs]++;
@@ -236,6 +236,9 @@ ipiput6(Fs *f, Ipifc *ifc, Block *bp)
 	ip = f->ip;
 	ip->stats[InReceives]++;
 
+	/* the header is rewritten in place below */
+	bp = unshareblock(bp);
+
 	/*
 	 *  Ensure we have all the header info in the first
 	 *  block.  Make life easier for other protocols by
@@ -338,6 +341,54 @@ ipiput6(Fs *f, Ipifc *ifc, Block *bp)
 	freeblist(bp);
 }
 
+static int
+fraghash6(uchar *src, uchar *dst, uint id)
+{
+	ulong h;
+
+	h = nhgetl(src+IPaddrlen-4) ^ nhgetl(src+IPaddrlen-8) ^ nhgetl(dst+IPaddrlen-4) ^ id;
+	h *= 0x9e3779b1UL;
+	return h >> 26 & (Nfraghash-1);
+}
+
+/*
+ * fragsweep6 and fragtrim6 - as fragsweep4 and fragtrim4 -
+ * assume hold fraglock6
+ */
+static void
+fragsweep6(IP *ip)
+{
+	Fragment6 *f, *fnext;
+
+	if((long)(NOW - ip->fragsweep6) < 0)
+		return;
+	ip->fragsweep6 = NOW + 1000;
+	for(f = ip->flisthead6; f; f = fnext){
+		fnext = f->next;
+		if(f->age < NOW){
+			ip->stats[ReasmTimeout]++;
+			ipfragfree6(ip, f);
+		}
+	}
+}
+
+static void
+fragtrim6(IP *ip, Fragment6 *keep)
+{
+	Fragment6 *f, *old;
+
+	while(ip->fragmem6 > Fragmem){
+		old = nil;
+		for(f = ip->flisthead6; f; f = f->next)
+			if(f != keep)
+				old = f;
+		if(old == nil)
+			break;
+		ip->stats[ReasmFails]++;
+		ipfragfree6(ip, old);
+	}
+}
+
 /*
  * ipfragfree6 - copied from ipfragfree4 - assume hold fraglock6
  */
@@ -348,10 +399,25 @@ ipfragfree6(IP *ip, Fragment6 *frag)
 
 	if(frag->blist)
 		freeblist(frag->blist);
+	ip->fragmem6 -= frag->size;
+
+	l = &ip->fraghash6[fraghash6(frag->src, frag->dst, frag->id)];
+	for(fl = *l; fl; fl = fl->hash) {
+		if(fl == frag) {
+			*l = frag->hash;
+			break;
+		}
+		l = &fl->hash;
+	}
 
 	memset(frag->src, 0, IPaddrlen);
 	frag->id = 0;
 	frag->blist = nil;
+	frag->blast = nil;
+	frag->cend = nil;
+	frag->contig = 0;
+	frag->size = 0;
+	frag->hash = nil;
 
 	l = &ip->flisthead6;
 	for(fl = *l; fl; fl = fl->next) {
@@ -384,7 +450,7 @@ ipfragallo6(IP *ip)
 	ip->fragfree6 = f->next;
 	f->next = ip->flisthead6;
 	ip->flisthead6 = f;
-	f->age = NOW + 30000;
+	f->age = NOW + Fraglife;
 
 	return f;
 }
@@ -453,12 +519,12 @@ procopts(Block *bp)
 Block*
 ip6reassemble(IP* ip, int uflen, Block* bp, Ip6hdr* ih)
 {
-	int fend, offset, ovlap, len, fragsize, pktposn;
+	int fend, offset, ovlap, len, fragsize, h;
 	uint id;
 	uchar src[IPaddrlen], dst[IPaddrlen];
 	Block *bl, **l, *last, *prev;
 	Fraghdr6 *fraghdr;
-	Fragment6 *f, *fnext;
+	Fragment6 *f;
 
 	fraghdr = (Fraghdr6 *)(bp->rp + uflen);
 	memmove(src, ih->src, IPaddrlen);
@@ -472,22 +538,19 @@ ip6reassemble(IP* ip, int uflen, Block* bp, Ip6hdr* ih)
 	if(bp->next){
 		bp = pullupblock(bp, blocklen(bp));
 		ih = (Ip6hdr *)bp->rp;
+		fraghdr = (Fraghdr6 *)(bp->rp + uflen);
 	}
 
 	qlock(&ip->fraglock6);
+	fragsweep6(ip);
 
 	/*
 	 *  find a reassembly queue for this fragment
 	 */
-	for(f = ip->flisthead6; f; f = fnext){
-		fnext = f->next;
+	h = fraghash6(src, dst, id);
+	for(f = ip->fraghash6[h]; f; f = f->hash)
 		if(ipcmp(f->src, src)==0 && ipcmp(f->dst, dst)==0 && f->id == id)
 			break;
-		if(f->age < NOW){
-			ip->stats[ReasmTimeout]++;
-			ipfragfree6(ip, f);
-		}
-	}
 
 	/*
 	 *  if this isn't a fragmented packet, accept it
@@ -517,8 +580,14 @@ ip6reassemble(IP* ip, int uflen, Block* bp, Ip6hdr* ih)
 		f->id = id;
 		memmove(f->src, src, IPaddrlen);
 		memmove(f->dst, dst, IPaddrlen);
+		f->hash = ip->fraghash6[h];
+		ip->fraghash6[h] = f;
 
 		f->blist = bp;
+		f->blast = bp;
+		f->size = BALLOC(bp);
+		ip->fragmem6 += f->size;
+		fragtrim6(ip, f);
 
 		qunlock(&ip->fraglock6);
 		ip->stats[ReasmReqds]++;
@@ -526,15 +595,27 @@ ip6reassemble(IP* ip, int uflen, Block* bp, Ip6hdr* ih)
 	}
 
 	/*
-	 *  find the new fragment's position in the queue
+	 *  find the new fragment's position in the queue;
+	 *  one in order goes on the end
 	 */
-	prev = nil;
-	l = &f->blist;
-	bl = f->blist;
-	while(bl != nil && BKFG(bp)->foff > BKFG(bl)->foff) {
-		prev = bl;
-		l = &bl->next;
-		bl = bl->next;
+	if(BKFG(bp)->foff > BKFG(f->blast)->foff) {
+		prev = f->blast;
+		l = &prev->next;
+	} else {
+		prev = nil;
+		l = &f->blist;
+		bl = f->blist;
+		while(bl != nil && BKFG(bp)->foff > BKFG(bl)->foff) {
+			prev = bl;
+			l = &bl->next;
+			bl = bl->next;
+		}
+	}
+
+	/* landing in the contiguous run may trim it; count again */
+	if(BKFG(bp)->foff < f->contig) {
+		f->cend = nil;
+		f->contig = 0;
 	}
 
 	/* Check overlap of a previous fragment - trim away as necessary */
@@ -553,6 +634,8 @@ ip6reassemble(IP* ip, int uflen, Block* bp, Ip6hdr* ih)
 	/* Link onto assembly queue */
 	bp->next = *l;
 	*l = bp;
+	f->size += BALLOC(bp);
+	ip->fragmem6 += BALLOC(bp);
 
 	/* Check to see if succeeding segments overlap */
 	if(bp->next) {
@@ -574,17 +657,26 @@ ip6reassemble(IP* ip, int uflen, Block* bp, Ip6hdr* ih)
 			}
 			last = (*l)->next;
 			(*l)->next = nil;
+			f->size -= BALLOC(*l);
+			ip->fragmem6 -= BALLOC(*l);
 			freeblist(*l);
 			*l = last;
 		}
 	}
+	if(bp->next == nil)
+		f->blast = bp;
 
 	/*
-	 *  look for a complete packet.  if we get to a fragment
-	 *  with the trailing bit of fraghdr->offsetRM[1] set, we're done.
+	 *  look for a complete packet, carrying on from the end of
+	 *  the fragments already known to run from offset 0.  if we
+	 *  get to a fragment with the trailing bit of
+	 *  fraghdr->offsetRM[1] clear, we're done.
 	 */
-	pktposn = 0;
-	for(bl = f->blist; bl && BKFG(bl)->foff == pktposn; bl = bl->next) {
+	for(bl = f->cend != nil ? f->cend->next : f->blist; bl; bl = bl->next) {
+		if(BKFG(bl)->foff != f->contig)
+			break;
+		f->cend = bl;
+		f->contig += BKFG(bl)->flen;
 		fraghdr = (Fraghdr6 *)(bl->rp + uflen);
 		if((fraghdr->offsetRM[1] & 1) == 0) {
 			bl = f->blist;
@@ -614,8 +706,8 @@ ip6reassemble(IP* ip, int uflen, Block* bp, Ip6hdr* ih)
 			ip->stats[ReasmOKs]++;
 			return bl;
 		}
-		pktposn += BKFG(bl)->flen;
 	}
+	fragtrim6(ip, f);
 	qunlock(&ip->fraglock6);
 	return nil;
 }
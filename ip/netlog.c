@@ -7,7 +7,29 @@
 #include	"../ip/ip.h"
 
 enum {
-	Nlog		= 16*1024,
+	Nlogent		= 128,		/* entries per processor */
+	Nlogmsg		= 240,		/* longest entry */
+};
+
+/*
+ *  one processor's entries, appended splhi by that processor
+ *  alone and read by netlogread.  an entry's seq is 0 while
+ *  it is being written, then its index+1; a reader that sees
+ *  it change while copying knows the entry was overwritten.
+ */
+typedef struct Netlogent Netlogent;
+struct Netlogent {
+	ulong	seq;
+	uvlong	ts;			/* fastticks when logged */
+	int	n;
+	char	msg[Nlogmsg];
+};
+
+typedef struct Netlogring Netlogring;
+struct Netlogring {
+	ulong	head;			/* entries ever written */
+	ulong	tail;			/* next for the reader */
+	Netlogent	*ent;
 };
 
 /*
@@ -16,10 +38,8 @@ enum {
 struct Netlog {
 	Lock;
 	int	opens;
-	char*	buf;
-	char	*end;
-	char	*rptr;
-	int	len;
+	int	nring;
+	Netlogring	ring[MAXMACH];
 
 	int	logmask;			/* mask of things to debug */
 	uchar	iponly[IPaddrlen];		/* ip address to print debugging for */
@@ -27,6 +47,10 @@ struct Netlog {
 
 	QLock;
 	Rendez;
+	int	sleeping;		/* reader wants a wakeup */
+	char	pend[Nlogmsg];		/* rest of the entry being read */
+	char	*rp;
+	int	npend;
 };
 
 typedef struct Netlogflag {
@@ -74,24 +98,38 @@ netloginit(Fs *f)
 	f->alog = smalloc(sizeof(Netlog));
 }
 
+/*
+ *  the rings stay once made: writers don't lock, so
+ *  there's no safe time to free them
+ */
 void
 netlogopen(Fs *f)
 {
-	lock(f->alog);
+	Netlog *l;
+	Netlogring *r;
+	int i;
+
+	l = f->alog;
+	lock(l);
 	if(waserror()){
-		unlock(f->alog);
+		unlock(l);
 		nexterror();
 	}
-	if(f->alog->opens == 0){
-		if(f->alog->buf == nil)
-			f->alog->buf = malloc(Nlog);
-		if(f->alog->buf == nil)
-			error(Enomem);
-		f->alog->rptr = f->alog->buf;
-		f->alog->end = f->alog->buf + Nlog;
+	if(l->opens == 0){
+		for(i = 0; i < conf.nmach; i++){
+			r = &l->ring[i];
+			if(r->ent == nil)
+				r->ent = malloc(Nlogent*sizeof(Netlogent));
+			if(r->ent == nil)
+				error(Enomem);
+			r->tail = r->head;
+		}
+		l->nring = conf.nmach;
+		l->npend = 0;
+		coherence();
 	}
-	f->alog->opens++;
-	unlock(f->alog);
+	l->opens++;
+	unlock(l);
 	poperror();
 }
 
@@ -99,70 +137,107 @@ void
 netlogclose(Fs *f)
 {
 	lock(f->alog);
-	if(waserror()){
-		unlock(f->alog);
-		nexterror();
-	}
 	f->alog->opens--;
-	if(f->alog->opens == 0){
-		free(f->alog->buf);
-		f->alog->buf = nil;
-	}
 	unlock(f->alog);
-	poperror();
 }
 
 static int
 netlogready(void *a)
 {
-	Fs *f = a;
+	Netlog *l;
+	int i;
+
+	l = ((Fs*)a)->alog;
+	for(i = 0; i < l->nring; i++)
+		if(l->ring[i].tail != l->ring[i].head)
+			return 1;
+	return 0;
+}
+
+/*
+ *  take the oldest entry of all the rings into pend,
+ *  passing over any overwritten before or as it's copied.
+ *  returns 0 if there are none.
+ */
+static int
+netlognext(Netlog *l)
+{
+	Netlogring *r, *best;
+	Netlogent *e;
+	ulong seq, t;
+	int i, n;
 
-	return f->alog->len;
+	for(;;){
+		best = nil;
+		for(i = 0; i < l->nring; i++){
+			r = &l->ring[i];
+			if(r->head - r->tail > Nlogent)
+				r->tail = r->head - Nlogent;
+			if(r->tail == r->head)
+				continue;
+			if(best == nil || r->ent[r->tail % Nlogent].ts < best->ent[best->tail % Nlogent].ts)
+				best = r;
+		}
+		if(best == nil)
+			return 0;
+
+		t = best->tail++;
+		e = &best->ent[t % Nlogent];
+		seq = e->seq;
+		coherence();
+		n = e->n;
+		if(n < 0 || n > Nlogmsg)
+			n = 0;
+		memmove(l->pend, e->msg, n);
+		coherence();
+		if(seq == t+1 && e->seq == seq){
+			l->rp = l->pend;
+			l->npend = n;
+			return 1;
+		}
+	}
 }
 
 long
 netlogread(Fs *f, void *a, ulong, long n)
 {
-	int i, d;
-	char *p, *rptr;
+	Netlog *l;
+	char *p;
+	long i, tot;
 
-	qlock(f->alog);
+	l = f->alog;
+	qlock(l);
 	if(waserror()){
-		qunlock(f->alog);
+		qunlock(l);
 		nexterror();
 	}
 
+	p = a;
+	tot = 0;
 	for(;;){
-		lock(f->alog);
-		if(f->alog->len){
-			if(n > f->alog->len)
-				n = f->alog->len;
-			d = 0;
-			rptr = f->alog->rptr;
-			f->alog->rptr += n;
-			if(f->alog->rptr >= f->alog->end){
-				d = f->alog->rptr - f->alog->end;
-				f->alog->rptr = f->alog->buf + d;
-			}
-			f->alog->len -= n;
-			unlock(f->alog);
-
-			i = n-d;
-			p = a;
-			memmove(p, rptr, i);
-			memmove(p+i, f->alog->buf, d);
-			break;
+		while(tot < n){
+			if(l->npend == 0 && netlognext(l) == 0)
+				break;
+			i = n - tot;
+			if(i > l->npend)
+				i = l->npend;
+			memmove(p+tot, l->rp, i);
+			l->rp += i;
+			l->npend -= i;
+			tot += i;
 		}
-		else
-			unlock(f->alog);
+		if(tot > 0)
+			break;
 
-		sleep(f->alog, netlogready, f);
+		l->sleeping = 1;
+		sleep(l, netlogready, f);
+		l->sleeping = 0;
 	}
 
-	qunlock(f->alog);
+	qunlock(l);
 	poperror();
 
-	return n;
+	return tot;
 }
 
 void
@@ -225,40 +300,51 @@ netlogctl(Fs *f, char* s, int n)
 	poperror();
 }
 
+/*
+ *  append to this processor's ring, without a lock.
+ *  costs only the mask test when nothing is logged.
+ */
 void
 netlog(Fs *f, int mask, char *fmt, ...)
 {
-	char buf[256], *t, *fp;
-	int i, n;
+	char buf[Nlogmsg];
+	Netlog *l;
+	Netlogring *r;
+	Netlogent *e;
+	int n, s;
+	ulong h;
 	va_list arg;
 
-	if(!(f->alog->logmask & mask))
+	l = f->alog;
+	if(!(l->logmask & mask))
 		return;
 
-	if(f->alog->opens == 0)
+	if(l->opens == 0)
 		return;
 
 	va_start(arg, fmt);
 	n = vseprint(buf, buf+sizeof(buf), fmt, arg) - buf;
 	va_end(arg);
 
-	lock(f->alog);
-	i = f->alog->len + n - Nlog;
-	if(i > 0){
-		f->alog->len -= i;
-		f->alog->rptr += i;
-		if(f->alog->rptr >= f->alog->end)
-			f->alog->rptr = f->alog->buf + (f->alog->rptr - f->alog->end);
-	}
-	t = f->alog->rptr + f->alog->len;
-	fp = buf;
-	f->alog->len += n;
-	while(n-- > 0){
-		if(t >= f->alog->end)
-			t = f->alog->buf + (t - f->alog->end);
-		*t++ = *fp++;
+	s = splhi();
+	r = &l->ring[m->machno];
+	if(r->ent == nil){
+		splx(s);
+		return;
 	}
-	unlock(f->alog);
-
-	wakeup(f->alog);
+	h = r->head;
+	e = &r->ent[h % Nlogent];
+	e->seq = 0;
+	coherence();
+	e->ts = fastticks(nil);
+	e->n = n;
+	memmove(e->msg, buf, n);
+	coherence();
+	e->seq = h+1;
+	r->head = h+1;
+	coherence();
+	splx(s);
+
+	if(l->sleeping)
+		wakeup(l);
 }
@@ -10,63 +10,34 @@ static	short	endian	= 1;
 static	uchar*	aendian	= (uchar*)&endian;
 #define	LITTLE	*aendian
 
+/*
+ *  the ones' complement sum of the 16-bit big-endian words
+ *  starting at addr.  whole words are added in machine order
+ *  into 64 bits, so no carry is lost, and the folded sum put
+ *  right by a byte swap: the sum is the same whichever byte
+ *  of each word is high.
+ */
 ushort
 ptclbsum(uchar *addr, int len)
 {
-	ulong losum, hisum, mdsum, x;
-	ulong t1, t2;
+	uvlong sum;
+	ulong *w;
+	int swap;
 
-	losum = 0;
-	hisum = 0;
-	mdsum = 0;
+	swap = ((uintptr)addr & 1) ^ LITTLE;
+	sum = 0;
+	for(; len > 0 && ((uintptr)addr & 3) != 0; len--, addr++)
+		sum += (((uintptr)addr & 1) != LITTLE) ? *addr : *addr << 8;
+	for(w = (ulong*)addr; len >= 32; len -= 32, w += 8)
+		sum += (uvlong)w[0] + w[1] + w[2] + w[3] + w[4] + w[5] + w[6] + w[7];
+	for(; len >= 4; len -= 4)
+		sum += *w++;
+	for(addr = (uchar*)w; len > 0; len--, addr++)
+		sum += (((uintptr)addr & 1) != LITTLE) ? *addr : *addr << 8;
 
-	x = 0;
-	if((ulong)addr & 1) {
-		if(len) {
-			hisum += addr[0];
-			len--;
-			addr++;
-		}
-		x = 1;
-	}
-	while(len >= 16) {
-		t1 = *(ushort*)(addr+0);
-		t2 = *(ushort*)(addr+2);	mdsum += t1;
-		t1 = *(ushort*)(addr+4);	mdsum += t2;
-		t2 = *(ushort*)(addr+6);	mdsum += t1;
-		t1 = *(ushort*)(addr+8);	mdsum += t2;
-		t2 = *(ushort*)(addr+10);	mdsum += t1;
-		t1 = *(ushort*)(addr+12);	mdsum += t2;
-		t2 = *(ushort*)(addr+14);	mdsum += t1;
-		mdsum += t2;
-		len -= 16;
-		addr += 16;
-	}
-	while(len >= 2) {
-		mdsum += *(ushort*)addr;
-		len -= 2;
-		addr += 2;
-	}
-	if(x) {
-		if(len)
-			losum += addr[0];
-		if(LITTLE)
-			losum += mdsum;
-		else
-			hisum += mdsum;
-	} else {
-		if(len)
-			hisum += addr[0];
-		if(LITTLE)
-			hisum += mdsum;
-		else
-			losum += mdsum;
-	}
-
-	losum += hisum >> 8;
-	losum += (hisum & 0xff) << 8;
-	while(hisum = losum>>16)
-		losum = hisum + (losum & 0xffff);
-
-	return losum & 0xffff;
+	while(sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	if(swap)
+		sum = (sum >> 8 | sum << 8) & 0xffff;
+	return sum;
 }
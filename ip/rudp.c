@@ -33,10 +33,16 @@ enum
 	IP_UDPPROTO	= 254,
 	UDP_USEAD7	= 52,	/* size of new ipv6 headers struct */
 
-	Rudprxms	= 200,
+	Rudprxms	= 200,	/* retransmit timeout before any rtt is measured */
 	Rudptickms	= 50,
+	Rudpminrto	= 2*Rudptickms,
+	Rudpmaxrto	= 8000,
 	Rudpmaxxmit	= 10,
+	Rudpburst	= 8,	/* most packets resent for one ack, or paced in one tick */
 	Maxunacked	= 100,
+
+	Sackbits	= 64,	/* selective ack bitmap in an ack's data */
+	Sacklen		= 8,
 };
 
 #define Hangupgen	0xffffffff	/* used only in hangup messages */
@@ -124,10 +130,27 @@ struct Reliable
 	ulong	acksent;	/* last ack sent */
 	ulong	ackrcvd;	/* last msg for which ack was rcvd */
 
+	/*
+	 *  retransmission.  bit i of sacked and resent is the
+	 *  i'th unacked message, from ackrcvd+1.
+	 */
+	int	rto;		/* retransmit timeout, ms */
+	int	srtt;		/* smoothed round trip time, ms<<3 */
+	int	rttvar;		/*  and its mean deviation, ms<<2 */
+	ulong	rttseq;		/* msg being timed, or 0 */
+	ulong	rttstart;	/*  and when it was sent */
+	uvlong	sacked;		/* selectively acked by the peer */
+	uvlong	resent;		/* retransmitted since the last timeout */
+
+	/* out of order arrivals; hold[i] is rcvseq+1+i */
+	Block	*hold[1+Sackbits];
+
 	/* flow control */
 	QLock	lock;
 	Rendez	vous;
 	int	blocked;
+	int	tokens;		/* msgs that may be sent before the next tick */
+	int	pacems;		/*  and the part of one earned so far, in 1/1000 */
 };
 
 
@@ -155,6 +178,8 @@ struct Rudppriv
 	ulong	lenerr;			/* short packet */
 	ulong	rxmits;			/* # of retransmissions */
 	ulong	orders;			/* # of out of order pkts */
+	ulong	fastrxmits;		/* # of retransmissions for selective acks */
+	ulong	holds;			/* # of out of order pkts held */
 
 	/* keeping track of the ack kproc */
 	int	ackprocstarted;
@@ -174,6 +199,7 @@ struct Rudpcb
 	QLock;
 	uchar	headers;
 	uchar	randdrop;
+	int	pace;		/* msgs a second to each peer, 0 for no limit */
 	Reliable *r;
 };
 
@@ -181,7 +207,8 @@ struct Rudpcb
  * local functions
  */
 void	relsendack(Conv*, Reliable*, int);
-int	reliput(Conv*, Block*, uchar*, ushort);
+int	reliput(Conv*, Block*, uchar*, ushort, Reliable**);
+void	relrecv(Conv*, Reliable*, int, Block*);
 Reliable *relstate(Rudpcb*, uchar*, ushort, char*);
 void	relput(Reliable*);
 void	relforget(Conv *, uchar*, int, int);
@@ -189,6 +216,7 @@ void	relackproc(void *);
 void	relackq(Reliable *, Block*);
 void	relhangup(Conv *, Reliable*);
 void	relrexmit(Conv *, Reliable*);
+void	relsackrexmit(Conv*, Reliable*);
 void	relput(Reliable*);
 void	rudpkick(void *x);
 
@@ -296,6 +324,7 @@ rudpclose(Conv *c)
 
 	ucb->headers = 0;
 	ucb->randdrop = 0;
+	ucb->pace = 0;
 	qlock(ucb);
 	for(r = ucb->r; r; r = nr){
 		if(r->acksent != r->rcvseq)
@@ -329,7 +358,7 @@ flow(void *v)
 {
 	Reliable *r = v;
 
-	return UNACKED(r) <= Maxunacked;
+	return UNACKED(r) <= Maxunacked && r->tokens > 0;
 }
 
 void
@@ -432,6 +461,12 @@ rudpkick(void *x)
 	hnputs(uh->udpcksum, ptclcsum(bp, UDP_IPHDR, dlen+UDP_RHDRSIZE));
 
 	relackq(r, bp);
+	if(r->rttseq == 0){
+		r->rttseq = r->sndseq;
+		r->rttstart = NOW;
+	}
+	if(ucb->pace)
+		r->tokens--;
 	qunlock(ucb);
 
 	upriv->ustats.rudpOutDatagrams++;
@@ -447,9 +482,9 @@ rudpkick(void *x)
 		nexterror();
 	}
 
-	/* flow control of sorts */
+	/* flow control and pacing */
 	qlock(&r->lock);
-	if(UNACKED(r) > Maxunacked){
+	if(!flow(r)){
 		r->blocked = 1;
 		sleep(&r->vous, flow, r);
 		r->blocked = 0;
@@ -470,8 +505,10 @@ rudpiput(Proto *rudp, Ipifc *ifc, Block *bp)
 	uchar raddr[IPaddrlen], laddr[IPaddrlen];
 	ushort rport, lport;
 	Rudppriv *upriv;
+	Reliable *r;
 	Fs *f;
 	uchar *p;
+	int slot;
 
 	upriv = rudp->priv;
 	f = rudp->f;
@@ -524,7 +561,8 @@ rudpiput(Proto *rudp, Ipifc *ifc, Block *bp)
 	qlock(ucb);
 	qunlock(rudp);
 
-	if(reliput(c, bp, raddr, rport) < 0){
+	slot = reliput(c, bp, raddr, rport, &r);
+	if(slot < 0){
 		qunlock(ucb);
 		freeb(bp);
 		return;
@@ -542,6 +580,8 @@ rudpiput(Proto *rudp, Ipifc *ifc, Block *bp)
 		DPRINT("rudp: len err %I.%d -> %I.%d\n",
 			raddr, rport, laddr, lport);
 		upriv->lenerr++;
+		relput(r);
+		qunlock(ucb);
 		return;
 	}
 
@@ -577,14 +617,8 @@ rudpiput(Proto *rudp, Ipifc *ifc, Block *bp)
 	if(bp->next)
 		bp = concatblock(bp);
 
-	if(qfull(c->rq)) {
-		netlog(f, Logrudp, "rudp: qfull %I.%d -> %I.%d\n", raddr, rport,
-			laddr, lport);
-		freeblist(bp);
-	}
-	else
-		qpass(c->rq, bp);
-
+	relrecv(c, r, slot, bp);
+	relput(r);
 	qunlock(ucb);
 }
 
@@ -622,6 +656,14 @@ rudpctl(Conv *c, char **f, int n)
 			return "illegal rudp drop rate";
 		ucb->randdrop = x;
 		return nil;
+	} else if(strcmp(f[0], "pace") == 0){
+		if(n < 2)
+			return "bad syntax";
+		x = atoi(f[1]);
+		if(x < 0)
+			return "illegal rudp pace";
+		ucb->pace = x;
+		return nil;
 	}
 	return rudpunknown;
 }
@@ -662,13 +704,15 @@ rudpstats(Proto *rudp, char *buf, int len)
 	Rudppriv *upriv;
 
 	upriv = rudp->priv;
-	return snprint(buf, len, "%lud %lud %lud %lud %lud %lud\n",
+	return snprint(buf, len, "%lud %lud %lud %lud %lud %lud %lud %lud\n",
 		upriv->ustats.rudpInDatagrams,
 		upriv->ustats.rudpNoPorts,
 		upriv->ustats.rudpInErrors,
 		upriv->ustats.rudpOutDatagrams,
 		upriv->rxmits,
-		upriv->orders);
+		upriv->orders,
+		upriv->fastrxmits,
+		upriv->holds);
 }
 
 void
@@ -715,11 +759,64 @@ relackq(Reliable *r, Block *bp)
 		r->timeout = 0;
 		r->xmits = 1;
 		r->unacked = np;
+		r->sacked = 0;
+		r->resent = 0;
 	}
 	r->unackedtail = np;
 	np->list = nil;
 }
 
+/*
+ *  give r its tick's worth of msgs at the conversation's pace
+ */
+static void
+relpace(Rudpcb *ucb, Reliable *r)
+{
+	int n, max;
+
+	if(ucb->pace == 0){
+		r->tokens = Maxunacked;
+		r->pacems = 0;
+	}else{
+		r->pacems += ucb->pace*Rudptickms;
+		n = r->pacems/1000;
+		r->pacems %= 1000;
+		max = ucb->pace*Rudptickms/1000;
+		if(max < Rudpburst)
+			max = Rudpburst;
+		r->tokens += n;
+		if(r->tokens > max)
+			r->tokens = max;
+	}
+	if(r->blocked && flow(r))
+		wakeup(&r->vous);
+}
+
+/*
+ *  fold a round trip time measurement into the retransmit timeout
+ */
+static void
+relrtt(Reliable *r, int ms)
+{
+	int delta;
+
+	if(r->srtt == 0){
+		r->srtt = ms<<3;
+		r->rttvar = ms<<1;
+	}else{
+		delta = ms - (r->srtt>>3);
+		r->srtt += delta;
+		if(delta < 0)
+			delta = -delta;
+		r->rttvar += delta - (r->rttvar>>2);
+	}
+	r->rto = (r->srtt>>3) + r->rttvar;
+	if(r->rto < Rudpminrto)
+		r->rto = Rudpminrto;
+	if(r->rto > Rudpmaxrto)
+		r->rto = Rudpmaxrto;
+}
+
 /*
  *  retransmit unacked blocks
  */
@@ -742,10 +839,17 @@ loop:
 		qlock(ucb);
 
 		for(r = ucb->r; r; r = r->next) {
+			relpace(ucb, r);
 			if(r->unacked != nil){
 				r->timeout += Rudptickms;
-				if(r->timeout > Rudprxms*r->xmits)
+				if(r->timeout > r->rto){
+					/* back off; the selective acks may be stale */
+					r->rto *= 2;
+					if(r->rto > Rudpmaxrto)
+						r->rto = Rudpmaxrto;
+					r->resent = 0;
 					relrexmit(c, r);
+				}
 			}
 			if(r->acksent != r->rcvseq)
 				relsendack(c, r, 0);
@@ -793,6 +897,8 @@ relstate(Rudpcb *ucb, uchar *addr, ushort port, char *from)
 		r->acksent = 0;
 		r->xmits = 0;
 		r->timeout = 0;
+		r->rto = Rudprxms;
+		r->tokens = Rudpburst;
 		r->ref = 0;
 		incref(r);	/* one reference for being in the list */
 
@@ -836,13 +942,15 @@ relforget(Conv *c, uchar *ip, int port, int originator)
 }
 
 /*
- *  process a rcvd reliable packet. return -1 if not to be passed to user process,
- *  0 therwise.
+ *  process a rcvd reliable packet.  return -1 if not to be passed to
+ *  user process, 0 if it is next in sequence, or n if it is to be held
+ *  in r->hold[n] till the ones before it come.  unless -1, *rp is set
+ *  to the state, with a reference for the caller.
  *
  *  called with ucb locked.
  */
 int
-reliput(Conv *c, Block *bp, uchar *addr, ushort port)
+reliput(Conv *c, Block *bp, uchar *addr, ushort port, Reliable **rp)
 {
 	Block *nbp;
 	Rudpcb *ucb;
@@ -850,7 +958,9 @@ reliput(Conv *c, Block *bp, uchar *addr, ushort port)
 	Udphdr *uh;
 	Reliable *r;
 	Rudphdr *rh;
-	ulong seq, ack, sgen, agen, ackreal;
+	ulong seq, ack, sgen, agen, ackreal, d;
+	uvlong sack;
+	uchar *p;
 	int rv = -1;
 
 	/* get fields */
@@ -861,6 +971,15 @@ reliput(Conv *c, Block *bp, uchar *addr, ushort port)
 	ack = nhgetl(rh->relack);
 	agen = nhgetl(rh->relagen);
 
+	/* an ack without a message may carry a selective ack */
+	sack = 0;
+	if(seq == 0
+	&& nhgets(uh->udplen) >= (UDP_RHDRSIZE-UDP_PHDRSIZE)+Sacklen
+	&& BLEN(bp) >= UDP_IPHDR+UDP_RHDRSIZE+Sacklen){
+		p = bp->rp + UDP_IPHDR+UDP_RHDRSIZE;
+		sack = (uvlong)nhgetl(p)<<32 | nhgetl(p+4);
+	}
+
 	upriv = c->p->priv;
 	ucb = (Rudpcb*)c->ptcl;
 	r = relstate(ucb, addr, port, "input");
@@ -902,65 +1021,127 @@ reliput(Conv *c, Block *bp, uchar *addr, ushort port)
 			       ack, agen, r->sndgen);
 			freeb(nbp);
 			r->ackrcvd = NEXTSEQ(r->ackrcvd);
+			r->sacked >>= 1;
+			r->resent >>= 1;
+			if(r->ackrcvd == r->rttseq){
+				relrtt(r, NOW - r->rttstart);
+				r->rttseq = 0;
+			}
 			ackreal = 1;
 		}
 
+		/* bit i of sack is rcvseq+2+i, one past our bit i */
+		if(ack == r->ackrcvd)
+			r->sacked |= sack<<1;
+
 		/* flow control */
 		if(UNACKED(r) < Maxunacked/8 && r->blocked)
 			wakeup(&r->vous);
 
-		/*
-		 *  retransmit next packet if the acked packet
-		 *  was transmitted more than once
-		 */
-		if(ackreal && r->unacked != nil){
-			r->timeout = 0;
-			if(r->xmits > 1){
+		if(r->unacked != nil){
+			if(ackreal)
+				r->timeout = 0;
+
+			/*
+			 *  resend the holes the peer has told us of; else
+			 *  retransmit next packet if the acked packet
+			 *  was transmitted more than once
+			 */
+			if(r->sacked != 0)
+				relsackrexmit(c, r);
+			else if(ackreal && r->xmits > 1){
 				r->xmits = 1;
 				relrexmit(c, r);
 			}
 		}
-
 	}
 
 	/* no message or input queue full */
 	if(seq == 0 || qfull(c->rq))
 		goto out;
 
-	/* refuse out of order delivery */
-	if(seq != NEXTSEQ(r->rcvseq)){
+	/* hold out of order messages in the selective ack window */
+	d = SEQDIFF(seq, r->rcvseq);
+	if(d != 1){
+		if(d >= 2 && d <= Sackbits+1 && r->hold[d-1] == nil){
+			upriv->holds++;
+			*rp = r;
+			return d-1;
+		}
 		relsendack(c, r, 0);	/* tell him we got it already */
 		upriv->orders++;
 		DPRINT("out of sequence %lud not %lud\n", seq, NEXTSEQ(r->rcvseq));
 		goto out;
 	}
 	r->rcvseq = seq;
+	if(r->hold[0] != nil)
+		freeb(r->hold[0]);
+	memmove(r->hold, r->hold+1, Sackbits*sizeof(Block*));
+	r->hold[Sackbits] = nil;
 
-	rv = 0;
+	*rp = r;
+	return 0;
 out:
 	relput(r);
 	return rv;
 }
 
+/*
+ *  pass a message to the user process, with any held ones
+ *  that now follow it, or hold it for later.
+ *
+ *  called with ucb locked.
+ */
+void
+relrecv(Conv *c, Reliable *r, int slot, Block *bp)
+{
+	if(slot > 0){
+		r->hold[slot] = bp;
+		relsendack(c, r, 0);	/* tell him what's missing */
+		return;
+	}
+	qpass(c->rq, bp);
+	while((bp = r->hold[0]) != nil && !qfull(c->rq)){
+		memmove(r->hold, r->hold+1, Sackbits*sizeof(Block*));
+		r->hold[Sackbits] = nil;
+		r->rcvseq = NEXTSEQ(r->rcvseq);
+		qpass(c->rq, bp);
+	}
+}
+
 void
 relsendack(Conv *c, Reliable *r, int hangup)
 {
 	Udphdr *uh;
 	Block *bp;
 	Rudphdr *rh;
-	int ptcllen;
+	int i, ptcllen, slen;
+	uvlong sack;
 	Fs *f;
 
-	bp = allocb(UDP_IPHDR + UDP_RHDRSIZE);
+	/* bit i is rcvseq+2+i */
+	sack = 0;
+	for(i = 0; i < Sackbits; i++)
+		if(r->hold[i+1] != nil)
+			sack |= (uvlong)1<<i;
+	slen = 0;
+	if(sack != 0 && !hangup)
+		slen = Sacklen;
+
+	bp = allocb(UDP_IPHDR + UDP_RHDRSIZE + slen);
 	if(bp == nil)
 		return;
-	bp->wp += UDP_IPHDR + UDP_RHDRSIZE;
+	bp->wp += UDP_IPHDR + UDP_RHDRSIZE + slen;
 	f = c->p->f;
 	uh = (Udphdr *)(bp->rp);
 	uh->vihl = IP_VER4;
 	rh = (Rudphdr*)uh;
+	if(slen){
+		hnputl(rh+1, sack>>32);
+		hnputl((uchar*)(rh+1)+4, sack);
+	}
 
-	ptcllen = (UDP_RHDRSIZE-UDP_PHDRSIZE);
+	ptcllen = (UDP_RHDRSIZE-UDP_PHDRSIZE) + slen;
 	uh->Unused = 0;
 	uh->udpproto = IP_UDPPROTO;
 	uh->frag[0] = 0;
@@ -988,7 +1169,7 @@ relsendack(Conv *c, Reliable *r, int hangup)
 
 	uh->udpcksum[0] = 0;
 	uh->udpcksum[1] = 0;
-	hnputs(uh->udpcksum, ptclcsum(bp, UDP_IPHDR, UDP_RHDRSIZE));
+	hnputs(uh->udpcksum, ptclcsum(bp, UDP_IPHDR, UDP_RHDRSIZE + slen));
 
 	DPRINT("sendack: %lud/%lud, %lud/%lud\n", 0L, r->sndgen, r->rcvseq, r->rcvgen);
 	doipoput(c, f, bp, 0, c->ttl, c->tos);
@@ -1001,7 +1182,7 @@ relsendack(Conv *c, Reliable *r, int hangup)
 void
 relhangup(Conv *c, Reliable *r)
 {
-	int n;
+	int i, n;
 	Block *bp;
 	char hup[ERRMAX];
 
@@ -1010,12 +1191,22 @@ relhangup(Conv *c, Reliable *r)
 
 	/*
 	 *  dump any unacked outgoing messages
+	 *  and held incoming ones
 	 */
 	for(bp = r->unacked; bp != nil; bp = r->unacked){
 		r->unacked = bp->list;
 		bp->list = nil;
 		freeb(bp);
 	}
+	for(i = 0; i <= Sackbits; i++){
+		if(r->hold[i] != nil){
+			freeb(r->hold[i]);
+			r->hold[i] = nil;
+		}
+	}
+	r->sacked = 0;
+	r->resent = 0;
+	r->rttseq = 0;
 
 	r->rcvgen = 0;
 	r->rcvseq = 0;
@@ -1049,7 +1240,50 @@ relrexmit(Conv *c, Reliable *r)
 	}
 
 	upriv->rxmits++;
+	r->resent |= 1;
+	r->rttseq = 0;		/* its ack could be for either copy */
+	if(((Rudpcb*)c->ptcl)->pace)
+		r->tokens--;
 	np = copyblock(r->unacked, blocklen(r->unacked));
 	DPRINT("rxmit r->ackrvcd+1 = %lud\n", r->ackrcvd+1);
 	doipoput(c, f, np, 0, c->ttl, c->tos);
 }
+
+/*
+ *  retransmit, once each until the next timeout, the unacked
+ *  blocks before the last one the peer has selectively acked.
+ *  at most Rudpburst go for one ack, and no more than the
+ *  pace allows, so a lossy link doesn't get a storm.
+ *
+ *  called with ucb locked
+ */
+void
+relsackrexmit(Conv *c, Reliable *r)
+{
+	Rudppriv *upriv;
+	Block *bp, *np;
+	uvlong bit;
+	int n, paced;
+	Fs *f;
+
+	upriv = c->p->priv;
+	f = c->p->f;
+	paced = ((Rudpcb*)c->ptcl)->pace;
+	n = 0;
+	bit = 1;
+	for(bp = r->unacked; bp != nil && bit != 0 && bit <= r->sacked; bp = bp->list){
+		if((r->sacked & bit) == 0 && (r->resent & bit) == 0){
+			if(n == Rudpburst || paced && r->tokens <= 0)
+				break;
+			r->resent |= bit;
+			r->rttseq = 0;
+			if(paced)
+				r->tokens--;
+			n++;
+			upriv->fastrxmits++;
+			np = copyblock(bp, blocklen(bp));
+			doipoput(c, f, np, 0, c->ttl, c->tos);
+		}
+		bit <<= 1;
+	}
+}
@@ -44,8 +44,15 @@ enum
 	MSS_LENGTH	= 4,		/* Maximum segment size */
 	WSOPT		= 3,
 	WS_LENGTH	= 3,		/* Bits to scale window size by */
+	SACKPERMOPT	= 4,
+	SACKPERM_LENGTH	= 2,		/* Selective acks permitted */
+	SACKOPT		= 5,
+	Nsackopt	= 4,		/* sack blocks an option holds */
+	Nscore		= 32,		/* sacked ranges the sender keeps */
+	Reseqmax	= 60*1024,	/* bytes one resequence entry gathers */
 	MSL2		= 10,
 	MSPTICK		= 50,		/* Milliseconds per timer tick */
+	Npacedue	= 32,		/* paced conversations an ack proc kicks at once */
 	DEF_MSS		= 1460,		/* Default maximum segment */
 	DEF_MSS6	= 1280,		/* Default maximum segment (min) for v6 */
 	DEF_RTT		= 500,		/* Default round trip */
@@ -90,6 +97,9 @@ enum
 	Defadvscale	= 4,		/* default advertisement */
 };
 
+/* NOP NOP SACK len, then n blocks */
+#define SACK_LENGTH(n)	(4 + 8*(n))
+
 /* Must correspond to the enumeration above */
 char *tcpstates[] =
 {
@@ -99,11 +109,14 @@ char *tcpstates[] =
 };
 
 typedef struct Tcptimer Tcptimer;
+typedef struct Tcpack Tcpack;
+typedef struct Tcpcc Tcpcc;
 struct Tcptimer
 {
 	Tcptimer	*next;
 	Tcptimer	*prev;
 	Tcptimer	*readynext;
+	Tcpack	*ack;			/* the ack proc it runs on */
 	int	state;
 	int	start;
 	int	count;
@@ -167,6 +180,13 @@ struct Tcp6hdr
  *  a packet in ntohtcp{4,6}() and stuck into
  *  a packet in htontcp{4,6}().
  */
+typedef struct Sackblk Sackblk;
+struct Sackblk
+{
+	ulong	left;
+	ulong	right;
+};
+
 typedef struct Tcp Tcp;
 struct	Tcp
 {
@@ -181,11 +201,16 @@ struct	Tcp
 	ushort	urg;
 	ushort	mss;	/* max segment size option (if not zero) */
 	ushort	len;	/* size of data */
+	uchar	sackok;	/* sack permitted option */
+	uchar	nsack;	/* sack option blocks */
+	Sackblk	sack[Nsackopt];
 };
 
 /*
  *  this header is malloc'd to thread together fragments
- *  waiting to be coalesced
+ *  waiting to be coalesced.  segments that arrive end to end
+ *  are gathered into one entry, so the queue holds a run of
+ *  data between each pair of holes.
  */
 typedef struct Reseq Reseq;
 struct Reseq
@@ -193,6 +218,7 @@ struct Reseq
 	Reseq	*next;
 	Tcp	seg;
 	Block	*bp;
+	Block	*ebp;		/* last block of bp */
 	ushort	length;
 };
 
@@ -222,6 +248,7 @@ struct Tcpctl
 		int	rto;
 		ulong	rxt;		/* right window marker for recovery */
 					/* "recover" rfc3782 */
+		ulong	sackrxt;	/* holes are resent up to here */
 	} snd;
 	struct {
 		ulong	nxt;		/* Receive pointer to next uchar slot */
@@ -240,9 +267,37 @@ struct Tcpctl
 	ulong	abcbytes;		/* appropriate byte counting rfc 3465 */
 	uint	scale;			/* desired snd.scale */
 	ulong	ssthresh;		/* Slow start threshold */
+	Tcpcc	*cc;			/* congestion control */
+	ulong	delivered;		/* bytes acked, for rate samples */
+	ulong	rttsent;		/* NOW when rttseq went out */
+	int	minrtt;			/* least rtt (ms) in the last Minrttwin */
+	ulong	minrtttime;		/* NOW when minrtt was seen */
+	ulong	rate;			/* bytes/s the window comes to */
+	int	pace;			/* hold segments to the pacing rate */
+	int	paceq;			/* on its ack proc's paced list */
+	Conv	*pacenext;
+	uvlong	pacens;			/* ns the next segment may go at */
+	struct {
+		ulong	wmax;		/* cwind at the last loss */
+		ulong	origin;		/* cwind the curve levels off at */
+		ulong	epoch;		/* NOW when growth resumed, 0 if not yet */
+		int	k;		/* ms from epoch to origin */
+	} cubic;
+	struct {
+		int	mode;
+		int	round;		/* rtt samples taken */
+		ulong	btlbw;		/* best delivery rate, bytes/s */
+		int	btlround;	/* round btlbw was seen in */
+		ulong	fullbw;		/* startup: rate before the plateau */
+		int	fullcnt;	/* rounds it hasn't grown */
+		int	cycle;		/* probing gain phase */
+		ulong	stamp;		/* NOW at the last sample */
+		ulong	sdelivered;	/* delivered at the last sample */
+	} bbr;
 	int	resent;			/* Bytes just resent */
 	int	irs;			/* Initial received squence */
 	ushort	mss;			/* Maximum segment size */
+	int	tso;			/* Largest super-segment the 1st hop cuts up */
 	int	rerecv;			/* Overlap of data rerecevived */
 	ulong	window;			/* Our receive window (queue) */
 	uint	qscale;			/* Log2 of our receive window (queue) */
@@ -250,8 +305,13 @@ struct Tcpctl
 	int	backedoff;		/* ms we've backed off for rexmits */
 	uchar	flags;			/* State flags */
 	Reseq	*reseq;			/* Resequencing queue */
+	Reseq	*reseqtail;
+	Reseq	*reseqlast;		/* holds the latest arrival */
 	int	nreseq;
 	int	reseqlen;
+	int	sack;			/* both ends do selective acks */
+	int	nsacks;
+	Sackblk	sacks[Nscore];		/* scoreboard, sorted and disjoint */
 	Tcptimer	timer;			/* Activity timer */
 	Tcptimer	acktimer;		/* Acknowledge timer */
 	Tcptimer	rtt_timer;		/* Round trip timer */
@@ -272,6 +332,21 @@ struct Tcpctl
 	} protohdr;		/* prototype header */
 };
 
+/*
+ *  a congestion controller.  congestion sets ssthresh on a loss
+ *  or timeout, acked grows cwind for acks outside recovery,
+ *  rtt takes each ms round trip sample that karn allows, and
+ *  pacerate is what a paced conversation sends at.
+ */
+struct Tcpcc
+{
+	char	*name;
+	void	(*congestion)(Tcpctl*);
+	void	(*acked)(Tcpctl*, uint);
+	void	(*rtt)(Tcpctl*, int);
+	ulong	(*pacerate)(Tcpctl*);	/* bytes/s, if pacing */
+};
+
 /*
  *  New calls are put in limbo rather than having a conversation structure
  *  allocated.  Thus, a SYN attack results in lots of limbo'd calls but not
@@ -302,6 +377,7 @@ struct Limbo
 	ulong	lastsend;	/* last time we sent a synack */
 	uchar	version;	/* v4 or v6 */
 	uchar	rexmits;	/* number of retransmissions */
+	uchar	sackok;		/* the SYN offered sacks */
 };
 
 int	tcp_irtt = DEF_RTT;	/* Initial guess at round trip time */
@@ -339,6 +415,7 @@ enum {
 	RecoveryNoSeq,
 	RecoveryCwind,
 	RecoveryPA,
+	SackRxmits,
 
 	Nstats
 };
@@ -375,14 +452,35 @@ static char *statnames[Nstats] =
 [RecoveryNoSeq]	"RecoveryNoSeq",
 [RecoveryCwind]	"RecoveryCwind",
 [RecoveryPA]	"RecoveryPA",
+[SackRxmits]	"SackRetransSegs",
 };
 
-typedef struct Tcppriv Tcppriv;
-struct Tcppriv
+/*
+ *  an ack proc, wired to one processor, and the active
+ *  timers of the conversations it looks after
+ */
+struct Tcpack
 {
-	/* List of active timers */
 	QLock 	tl;
 	Tcptimer *timers;
+	int	n;
+	Proto	*tcp;
+	int	machno;
+	ulong	ticked;		/* NOW at the last tick */
+
+	/* paced conversations waiting to send, under tl */
+	Conv	*paced;
+	Rendez	r;
+	int	pacewoke;
+	Timer	pacet;		/* wakes the proc for the first of them */
+	uvlong	pacedue;	/* ns pacet is set for, 0 if not */
+};
+
+typedef struct Tcppriv Tcppriv;
+struct Tcppriv
+{
+	/* one ack proc per processor */
+	Tcpack	ack[MAXMACH];
 
 	/* hash table for matching conversations */
 	Ipht	ht;
@@ -395,6 +493,9 @@ struct Tcppriv
 	QLock	apl;
 	int	ackprocstarted;
 
+	/* congestion control new conversations start with */
+	Tcpcc	*cc;
+
 	uvlong	stats[Nstats];
 };
 
@@ -422,6 +523,9 @@ static	void	tcpkeepalive(void*);
 static	void	tcpoutput(Conv*);
 static	void	tcprcvwin(Conv*);
 static	void	tcprxmit(Conv*);
+static	int	tcpsackblocks(Tcpctl*, Sackblk*, int);
+static	int	tcpsackrxmit(Conv*);
+static	void	tcpsackupdate(Tcpctl*, Tcp*);
 static	void	tcpsetkacounter(Tcpctl*);
 static	void	tcpsetscale(Conv*, Tcpctl*, ushort, ushort);
 static	void	tcpsettimer(Tcpctl*);
@@ -491,13 +595,16 @@ static int
 tcpstate(Conv *c, char *state, int n)
 {
 	Tcpctl *s;
+	char *cc;
 
 	s = (Tcpctl*)(c->ptcl);
+	cc = s->cc != nil ? s->cc->name : "none";
 
 	return snprint(state, n,
 		"%s qin %d qout %d rq %d.%d srtt %d mdev %d sst %lud cwin %lud "
 		"swin %lud>>%d rwin %lud>>%d qscale %d timer.start %d "
-		"timer.count %d rerecv %d katimer.start %d katimer.count %d\n",
+		"timer.count %d rerecv %d katimer.start %d katimer.count %d "
+		"cc %s minrtt %d rate %lud pace %d\n",
 		tcpstates[s->state],
 		c->rq ? qlen(c->rq) : 0,
 		c->wq ? qlen(c->wq) : 0,
@@ -506,7 +613,8 @@ tcpstate(Conv *c, char *state, int n)
 		s->cwind, s->snd.wnd, s->rcv.scale, s->rcv.wnd, s->snd.scale,
 		s->qscale,
 		s->timer.start, s->timer.count, s->rerecv,
-		s->katimer.start, s->katimer.count);
+		s->katimer.start, s->katimer.count,
+		cc, s->minrtt, s->rate, s->pace);
 }
 
 static int
@@ -663,6 +771,12 @@ tcpacktimer(void *v)
 
 static void
 tcpcongestion(Tcpctl *tcb)
+{
+	(*tcb->cc->congestion)(tcb);
+}
+
+static void
+renocongestion(Tcpctl *tcb)
 {
 	ulong inflight;
 
@@ -702,21 +816,275 @@ tcpabcincr(Tcpctl *tcb, uint acked)
 	}
 }
 
+/* what the window would send in an rtt, for the status file */
+static void
+tcpwinrate(Tcpctl *tcb, int rtt)
+{
+	tcb->rate = (uvlong)tcb->cwind * 1000 / rtt;
+}
+
+/*
+ *  spread the window over the smoothed rtt, a little faster so
+ *  pacing doesn't hold the window back: twice while slow starting
+ *  and 5/4 after, as linux does
+ */
+static ulong
+tcpwinpace(Tcpctl *tcb)
+{
+	uvlong rate;
+	int rtt;
+
+	rtt = tcb->srtt >> LOGAGAIN;
+	if(rtt <= 0)
+		rtt = 1;
+	rate = (uvlong)tcb->cwind * 1000 / rtt;
+	if(tcb->cwind < tcb->ssthresh)
+		rate *= 2;
+	else
+		rate = rate/4*5;
+	if(rate < tcb->mss)
+		rate = tcb->mss;
+	return rate;
+}
+
+/*
+ *  cubic, rfc 8312.  after a loss the window grows along
+ *  W(t) = C(t-K)³ + wmax, flat near the old wmax and fast away
+ *  from it, so a long fat pipe refills in seconds rather than the
+ *  rtts·segments reno takes.  never slower than reno would be.
+ */
+enum {
+	Cubictmax	= 60000,	/* ms; keeps t³ in a vlong */
+};
+
+static ulong
+icbrt(uvlong x)
+{
+	uvlong y, b;
+	int s;
+
+	y = 0;
+	for(s = 63; s >= 0; s -= 3){
+		y *= 2;
+		b = 3*y*(y+1) + 1;
+		if((x >> s) >= b){
+			x -= b << s;
+			y++;
+		}
+	}
+	return y;
+}
+
+static void
+cubiccongestion(Tcpctl *tcb)
+{
+	ulong w;
+
+	w = tcb->cwind;
+	if(w < tcb->cubic.wmax)
+		tcb->cubic.wmax = w/20*17;	/* fast convergence, (1+β)/2 */
+	else
+		tcb->cubic.wmax = w;
+	tcb->cubic.epoch = 0;
+	tcb->ssthresh = w/10*7;			/* β = 0.7 */
+	if(tcb->ssthresh < 2*tcb->mss)
+		tcb->ssthresh = 2*tcb->mss;
+}
+
+static void
+cubicacked(Tcpctl *tcb, uint acked)
+{
+	ulong now, mss, west, cnt, n;
+	vlong t, target;
+	int rtt;
+
+	if(tcb->cwind < tcb->ssthresh){
+		tcpabcincr(tcb, acked);
+		return;
+	}
+	tcb->snd.rto = 0;
+	mss = tcb->mss;
+	now = NOW;
+	if(tcb->cubic.epoch == 0){
+		tcb->cubic.epoch = now;
+		tcb->abcbytes = 0;
+		if(tcb->cwind < tcb->cubic.wmax){
+			/* K = ∛((wmax-cwind)/C), C = 0.4 segments/s³ */
+			n = (tcb->cubic.wmax - tcb->cwind) / mss;
+			tcb->cubic.k = icbrt((uvlong)n * 5/2 * 1000000000ULL);
+			tcb->cubic.origin = tcb->cubic.wmax;
+		}else{
+			tcb->cubic.k = 0;
+			tcb->cubic.origin = tcb->cwind;
+		}
+	}
+	rtt = tcb->srtt >> LOGAGAIN;
+	if(rtt <= 0)
+		rtt = 1;
+	t = now - tcb->cubic.epoch + (tcb->minrtt ? tcb->minrtt : rtt);
+	if(t > Cubictmax)
+		t = Cubictmax;
+
+	/* C(t-K)³ in bytes, t in ms */
+	target = t - tcb->cubic.k;
+	target = target*target*target * 2 * mss / 5000000000LL;
+	target += tcb->cubic.origin;
+
+	/* where reno would be: αt/rtt above β·wmax, α = 3(1-β)/(1+β) */
+	west = tcb->cubic.wmax/10*7 + (uvlong)t * mss * 9 / (17 * rtt);
+	if(target < west)
+		target = west;
+
+	/* bytes to ack per mss of growth */
+	if(target > tcb->cwind)
+		cnt = (uvlong)tcb->cwind * mss / (target - tcb->cwind);
+	else
+		cnt = 100 * tcb->cwind;
+	if(cnt < mss)
+		cnt = mss;
+	tcb->abcbytes += acked;
+	if(tcb->abcbytes >= cnt){
+		n = tcb->abcbytes / cnt;
+		tcb->cwind += n * mss;
+		tcb->abcbytes -= n * cnt;
+	}
+}
+
+/*
+ *  after bbr (cardwell et al., acm queue 14(5)): the window
+ *  follows the measured bottleneck rate times the least rtt rather
+ *  than the losses.  startup grows like slow start until three
+ *  rounds fail to raise the rate by a quarter; after that each
+ *  round sets cwind to twice the bdp, cycling a gain to probe for
+ *  more and then drain the queue it made.  the gain acts on the
+ *  window as well as the pacing rate, since pacing is optional.
+ */
+enum {
+	Bbrstartup,
+	Bbrprobe,
+
+	Bbrbwwin	= 10,		/* rounds btlbw is good for */
+	Minrttwin	= 10000,	/* ms minrtt is good for */
+};
+
+static int bbrgain[] = { 5, 3, 4, 4, 4, 4, 4, 4 };	/* in quarters */
+
+static ulong
+bbrbdp(Tcpctl *tcb)
+{
+	return (uvlong)tcb->bbr.btlbw * tcb->minrtt / 1000;
+}
+
+static ulong
+bbrpace(Tcpctl *tcb)
+{
+	if(tcb->rate == 0)
+		return tcpwinpace(tcb);
+	return tcb->rate;
+}
+
+static void
+bbrcongestion(Tcpctl *tcb)
+{
+	ulong bdp;
+
+	if(tcb->bbr.btlbw == 0){
+		renocongestion(tcb);
+		return;
+	}
+	/* a loss isn't a rate; hold on to what the path delivers */
+	tcb->bbr.mode = Bbrprobe;
+	bdp = bbrbdp(tcb);
+	tcb->ssthresh = bdp;
+	if(tcb->ssthresh < 2*tcb->mss)
+		tcb->ssthresh = 2*tcb->mss;
+}
+
+static void
+bbracked(Tcpctl *tcb, uint acked)
+{
+	if(tcb->bbr.mode == Bbrstartup)
+		tcpabcincr(tcb, acked);
+	else
+		tcb->snd.rto = 0;
+}
+
+static void
+bbrrtt(Tcpctl *tcb, int)
+{
+	ulong now, bw, w;
+	int gain;
+
+	now = NOW;
+	if(tcb->bbr.stamp != 0 && now != tcb->bbr.stamp){
+		bw = (uvlong)(tcb->delivered - tcb->bbr.sdelivered) * 1000 / (now - tcb->bbr.stamp);
+		tcb->bbr.round++;
+		if(bw >= tcb->bbr.btlbw || tcb->bbr.round - tcb->bbr.btlround > Bbrbwwin){
+			tcb->bbr.btlbw = bw;
+			tcb->bbr.btlround = tcb->bbr.round;
+		}
+	}
+	tcb->bbr.stamp = now;
+	tcb->bbr.sdelivered = tcb->delivered;
+	if(tcb->bbr.btlbw == 0)
+		return;
+
+	if(tcb->bbr.mode == Bbrstartup){
+		if(tcb->bbr.btlbw >= tcb->bbr.fullbw/4*5){
+			tcb->bbr.fullbw = tcb->bbr.btlbw;
+			tcb->bbr.fullcnt = 0;
+			tcb->rate = tcb->bbr.btlbw/4*11;	/* about 2/ln 2 */
+			return;
+		}
+		if(++tcb->bbr.fullcnt < 3){
+			tcb->rate = tcb->bbr.btlbw/4*11;
+			return;
+		}
+		tcb->bbr.mode = Bbrprobe;
+		tcb->bbr.cycle = 1;		/* drain first */
+	}
+	gain = bbrgain[tcb->bbr.cycle];
+	tcb->bbr.cycle = (tcb->bbr.cycle + 1) % nelem(bbrgain);
+	tcb->rate = tcb->bbr.btlbw/4*gain;
+	w = bbrbdp(tcb)/2*gain;
+	if(w < 4*tcb->mss)
+		w = 4*tcb->mss;
+	tcb->cwind = w;
+	tcb->ssthresh = w;
+}
+
+static Tcpcc tcpccs[] = {
+	{ "reno",	renocongestion,	tcpabcincr,	tcpwinrate,	tcpwinpace },
+	{ "cubic",	cubiccongestion,	cubicacked,	tcpwinrate,	tcpwinpace },
+	{ "bbr",	bbrcongestion,	bbracked,	bbrrtt,	bbrpace },
+};
+
+static Tcpcc*
+tcplookcc(char *name)
+{
+	Tcpcc *cc;
+
+	for(cc = tcpccs; cc < tcpccs + nelem(tcpccs); cc++)
+		if(strcmp(cc->name, name) == 0)
+			return cc;
+	return nil;
+}
+
 static void
 tcpcreate(Conv *c)
 {
 	c->rq = qopen(QMAX, Qcoalesce, tcpacktimer, c);
-	c->wq = qopen(QMAX, Qkick, tcpkick, c);
+	c->wq = qopen(QMAX, Qkick|Qchain, tcpkick, c);
 }
 
 static void
-timerstate(Tcppriv *priv, Tcptimer *t, int newstate)
+timerstate(Tcpack *a, Tcptimer *t, int newstate)
 {
 	if(newstate != TcptimerON){
 		if(t->state == TcptimerON){
 			/* unchain */
-			if(priv->timers == t){
-				priv->timers = t->next;
+			if(a->timers == t){
+				a->timers = t->next;
 				if(t->prev != nil)
 					panic("timerstate1");
 			}
@@ -725,6 +1093,7 @@ timerstate(Tcppriv *priv, Tcptimer *t, int newstate)
 			if(t->prev)
 				t->prev->next = t->next;
 			t->next = t->prev = nil;
+			a->n--;
 		}
 	} else {
 		if(t->state != TcptimerON){
@@ -732,82 +1101,239 @@ timerstate(Tcppriv *priv, Tcptimer *t, int newstate)
 			if(t->prev != nil || t->next != nil)
 				panic("timerstate2");
 			t->prev = nil;
-			t->next = priv->timers;
+			t->next = a->timers;
 			if(t->next)
 				t->next->prev = t;
-			priv->timers = t;
+			a->timers = t;
+			a->n++;
 		}
 	}
 	t->state = newstate;
 }
 
+static int
+tcppacewoke(void *v)
+{
+	return ((Tcpack*)v)->pacewoke;
+}
+
+/* at interrupt level: only wake the ack proc, which owns the list */
+static void
+tcppacetimer(Ureg*, Timer *t)
+{
+	Tcpack *a;
+
+	a = t->ta;
+	a->pacewoke = 1;
+	wakeup(&a->r);
+}
+
+/*
+ *  kick the paced conversations whose time has come and set
+ *  the timer for the first of the rest
+ */
+static void
+tcppaceout(Tcpack *a)
+{
+	Conv *s, **l, *due[Npacedue];
+	Tcpctl *tcb;
+	uvlong now, next;
+	int i, n;
+
+	qlock(&a->tl);
+	now = fastticks2ns(fastticks(nil));
+	n = 0;
+	next = 0;
+	for(l = &a->paced; (s = *l) != nil;){
+		tcb = (Tcpctl*)s->ptcl;
+		if(tcb->pacens <= now && n < nelem(due)){
+			*l = tcb->pacenext;
+			tcb->paceq = 0;
+			due[n++] = s;
+			continue;
+		}
+		if(next == 0 || tcb->pacens < next)
+			next = tcb->pacens;
+		l = &tcb->pacenext;
+	}
+	a->pacedue = next;
+	if(next != 0){
+		if(next <= now)
+			a->pacewoke = 1;
+		else{
+			a->pacet.tns = next - now;
+			timeradd(&a->pacet);
+		}
+	}
+	qunlock(&a->tl);
+
+	for(i = 0; i < n; i++){
+		if(!waserror()){
+			tcpkick(due[i]);
+			poperror();
+		}
+	}
+}
+
+/*
+ *  called with s qlocked when its next segment must wait
+ *  until tcb->pacens
+ */
+static void
+tcppacewait(Conv *s, uvlong now)
+{
+	Tcpctl *tcb;
+	Tcpack *a;
+
+	tcb = (Tcpctl*)s->ptcl;
+	a = tcb->timer.ack;
+	qlock(&a->tl);
+	if(!tcb->paceq){
+		tcb->pacenext = a->paced;
+		a->paced = s;
+		tcb->paceq = 1;
+	}
+	if(a->pacedue == 0 || tcb->pacens < a->pacedue){
+		a->pacedue = tcb->pacens;
+		a->pacet.tns = tcb->pacens - now;
+		timeradd(&a->pacet);
+	}
+	qunlock(&a->tl);
+}
+
+static void
+tcppacestop(Conv *s)
+{
+	Tcpctl *tcb;
+	Tcpack *a;
+	Conv **l;
+
+	tcb = (Tcpctl*)s->ptcl;
+	a = tcb->timer.ack;
+	if(a == nil || !tcb->paceq)
+		return;
+	qlock(&a->tl);
+	for(l = &a->paced; *l != nil; l = &((Tcpctl*)(*l)->ptcl)->pacenext)
+		if(*l == s){
+			*l = tcb->pacenext;
+			tcb->paceq = 0;
+			break;
+		}
+	qunlock(&a->tl);
+}
+
+/*
+ *  each proc's tick is a tsleep on its own processor's timer
+ *  wheel, and it runs the timeouts of its conversations there.
+ *  The first also retransmits for the calls in limbo.  Between
+ *  ticks the pacing timer wakes it to send for paced conversations.
+ */
 static void
-tcpackproc(void *a)
+tcpackproc(void *v)
 {
 	Tcptimer *t, *tp, *timeo;
-	Proto *tcp;
-	Tcppriv *priv;
+	Tcpack *a;
 	int loop;
+	long ms;
 
-	tcp = a;
-	priv = tcp->priv;
+	a = v;
+	procwired(up, a->machno);
+	sched();
 
 	for(;;) {
-		tsleep(&up->sleep, return0, 0, MSPTICK);
+		ms = MSPTICK - (long)(NOW - a->ticked);
+		if(ms > 0)
+			tsleep(&a->r, tcppacewoke, a, ms);
+		a->pacewoke = 0;
+		tcppaceout(a);
+		if((long)(NOW - a->ticked) < MSPTICK)
+			continue;
+		a->ticked = NOW;
 
-		qlock(&priv->tl);
+		qlock(&a->tl);
 		timeo = nil;
 		loop = 0;
-		for(t = priv->timers; t != nil; t = tp) {
-			if(loop++ > 10000)
+		for(t = a->timers; t != nil; t = tp) {
+			if(loop++ > a->n)
 				panic("tcpackproc1");
 			tp = t->next;
  			if(t->state == TcptimerON) {
 				t->count--;
 				if(t->count == 0) {
-					timerstate(priv, t, TcptimerDONE);
+					timerstate(a, t, TcptimerDONE);
 					t->readynext = timeo;
 					timeo = t;
 				}
 			}
 		}
-		qunlock(&priv->tl);
+		qunlock(&a->tl);
 
-		loop = 0;
 		for(t = timeo; t != nil; t = t->readynext) {
-			if(loop++ > 10000)
-				panic("tcpackproc2");
 			if(t->state == TcptimerDONE && t->func != nil && !waserror()){
 				(*t->func)(t->arg);
 				poperror();
 			}
 		}
 
-		limborexmit(tcp);
+		if(a->machno == 0)
+			limborexmit(a->tcp);
 	}
 }
 
 static void
-tcpgo(Tcppriv *priv, Tcptimer *t)
+tcpgo(Tcppriv*, Tcptimer *t)
 {
+	Tcpack *a;
+
 	if(t == nil || t->start == 0)
 		return;
 
-	qlock(&priv->tl);
+	a = t->ack;
+	qlock(&a->tl);
 	t->count = t->start;
-	timerstate(priv, t, TcptimerON);
-	qunlock(&priv->tl);
+	timerstate(a, t, TcptimerON);
+	qunlock(&a->tl);
 }
 
 static void
-tcphalt(Tcppriv *priv, Tcptimer *t)
+tcphalt(Tcppriv*, Tcptimer *t)
 {
+	Tcpack *a;
+
 	if(t == nil)
 		return;
 
-	qlock(&priv->tl);
-	timerstate(priv, t, TcptimerOFF);
-	qunlock(&priv->tl);
+	a = t->ack;
+	if(a == nil){
+		t->state = TcptimerOFF;
+		return;
+	}
+	qlock(&a->tl);
+	timerstate(a, t, TcptimerOFF);
+	qunlock(&a->tl);
+}
+
+/*
+ *  all of a conversation's timers run on the same ack proc
+ */
+static void
+tcptimersinit(Conv *s)
+{
+	Tcpctl *tcb;
+	Tcppriv *tpriv;
+	Tcpack *a;
+
+	tpriv = s->p->priv;
+	tcb = (Tcpctl*)s->ptcl;
+	a = &tpriv->ack[s->x % conf.nmach];
+	tcb->timer.ack = a;
+	tcb->timer.arg = s;
+	tcb->acktimer.ack = a;
+	tcb->acktimer.arg = s;
+	tcb->katimer.ack = a;
+	tcb->katimer.arg = s;
+	tcb->rtt_timer.ack = a;
+	tcb->rtt_timer.arg = s;
 }
 
 static int
@@ -831,14 +1357,17 @@ localclose(Conv *s, char *reason)	/* called with tcb locked */
 	tcphalt(tpriv, &tcb->rtt_timer);
 	tcphalt(tpriv, &tcb->acktimer);
 	tcphalt(tpriv, &tcb->katimer);
+	tcppacestop(s);
 
 	/* Flush reassembly queue; nothing more can arrive */
 	dumpreseq(tcb);
 
 	if(tcb->state == Syn_sent)
 		Fsconnected(s, reason);
-	if(s->state == Announced)
+	if(s->state == Announced){
 		wakeup(&s->listenr);
+		pollwakeup(&s->listenp);
+	}
 
 	qhangup(s->rq, reason);
 	qhangup(s->wq, reason);
@@ -876,6 +1405,20 @@ tcpmtu(Proto *tcp, uchar *addr, int version, uint *scale)
 	return mtu;
 }
 
+/* payload of the largest super-segment the 1st hop cuts into mss pieces */
+static int
+tcptso(Proto *tcp, uchar *addr, int version)
+{
+	Ipifc *ifc;
+
+	if(version != V4)
+		return 0;
+	ifc = findipifc(tcp->f, addr, 0);
+	if(ifc == nil || ifc->tso == 0)
+		return 0;
+	return ifc->tso - (TCP4_PKT + TCP4_HDRSIZE);
+}
+
 static void
 inittcpctl(Conv *s, int mode)
 {
@@ -885,25 +1428,26 @@ inittcpctl(Conv *s, int mode)
 	Tcppriv *tpriv;
 	int mss;
 
+	tpriv = s->p->priv;
 	tcb = (Tcpctl*)s->ptcl;
 
+	tcppacestop(s);
 	memset(tcb, 0, sizeof(Tcpctl));
 
 	tcb->ssthresh = QMAX;			/* reset by tcpsetscale() */
+	tcb->cc = tpriv->cc;
 	tcb->srtt = tcp_irtt<<LOGAGAIN;
 	tcb->mdev = 0;
 
 	/* setup timers */
+	tcptimersinit(s);
 	tcb->timer.start = tcp_irtt / MSPTICK;
 	tcb->timer.func = tcptimeout;
-	tcb->timer.arg = s;
 	tcb->rtt_timer.start = MAX_TIME;
 	tcb->acktimer.start = TCP_ACK / MSPTICK;
 	tcb->acktimer.func = tcpacktimer;
-	tcb->acktimer.arg = s;
 	tcb->katimer.start = DEF_KAT / MSPTICK;
 	tcb->katimer.func = tcpkeepalive;
-	tcb->katimer.arg = s;
 
 	mss = DEF_MSS;
 
@@ -939,7 +1483,6 @@ inittcpctl(Conv *s, int mode)
 
 	tcb->mss = tcb->cwind = mss;
 	tcb->abcbytes = 0;
-	tpriv = s->p->priv;
 	tpriv->stats[Mss] = tcb->mss;
 
 	/* default is no window scaling */
@@ -954,15 +1497,25 @@ tcpstart(Conv *s, int mode)
 {
 	Tcpctl *tcb;
 	Tcppriv *tpriv;
+	Tcpack *a;
 	char kpname[KNAMELEN];
+	int i;
 
 	tpriv = s->p->priv;
 
 	if(tpriv->ackprocstarted == 0){
 		qlock(&tpriv->apl);
 		if(tpriv->ackprocstarted == 0){
-			snprint(kpname, sizeof kpname, "#I%dtcpack", s->p->f->dev);
-			kproc(kpname, tcpackproc, s->p);
+			for(i = 0; i < conf.nmach; i++){
+				a = &tpriv->ack[i];
+				a->tcp = s->p;
+				a->machno = i;
+				a->pacet.tmode = Trelative;
+				a->pacet.tf = tcppacetimer;
+				a->pacet.ta = a;
+				snprint(kpname, sizeof kpname, "#I%dtcpack%d", s->p->f->dev, i);
+				kproc(kpname, tcpackproc, a);
+			}
 			tpriv->ackprocstarted = 1;
 		}
 		qunlock(&tpriv->apl);
@@ -1012,6 +1565,25 @@ tcpflag(char *buf, char *e, ushort flag)
 	return buf;
 }
 
+/*
+ *  sack blocks, after two NOPs to keep them aligned
+ */
+static void
+sackopt(uchar *opt, Tcp *tcph)
+{
+	int i;
+
+	*opt++ = NOOPOPT;
+	*opt++ = NOOPOPT;
+	*opt++ = SACKOPT;
+	*opt++ = SACK_LENGTH(tcph->nsack) - 2;
+	for(i = 0; i < tcph->nsack; i++){
+		hnputl(opt, tcph->sack[i].left);
+		hnputl(opt+4, tcph->sack[i].right);
+		opt += 8;
+	}
+}
+
 static Block*
 htontcp6(Tcp *tcph, Block *data, Tcp6hdr *ph, Tcpctl *tcb)
 {
@@ -1027,11 +1599,14 @@ htontcp6(Tcp *tcph, Block *data, Tcp6hdr *ph, Tcpctl *tcb)
 			hdrlen += MSS_LENGTH;
 		if(tcph->ws)
 			hdrlen += WS_LENGTH;
+		if(tcph->sackok)
+			hdrlen += SACKPERM_LENGTH;
 		optpad = hdrlen & 3;
 		if(optpad)
 			optpad = 4 - optpad;
 		hdrlen += optpad;
-	}
+	} else if(tcph->nsack)
+		hdrlen += SACK_LENGTH(tcph->nsack);
 
 	if(data) {
 		dlen = blocklen(data);
@@ -1076,9 +1651,14 @@ htontcp6(Tcp *tcph, Block *data, Tcp6hdr *ph, Tcpctl *tcb)
 			*opt++ = WS_LENGTH;
 			*opt++ = tcph->ws;
 		}
+		if(tcph->sackok){
+			*opt++ = SACKPERMOPT;
+			*opt++ = SACKPERM_LENGTH;
+		}
 		while(optpad-- > 0)
 			*opt++ = NOOPOPT;
-	}
+	} else if(tcph->nsack)
+		sackopt(h->tcpopt, tcph);
 
 	if(tcb != nil && tcb->nochecksum){
 		h->tcpcksum[0] = h->tcpcksum[1] = 0;
@@ -1111,11 +1691,14 @@ htontcp4(Tcp *tcph, Block *data, Tcp4hdr *ph, Tcpctl *tcb)
 			hdrlen += MSS_LENGTH;
 		if(1)
 			hdrlen += WS_LENGTH;
+		if(tcph->sackok)
+			hdrlen += SACKPERM_LENGTH;
 		optpad = hdrlen & 3;
 		if(optpad)
 			optpad = 4 - optpad;
 		hdrlen += optpad;
-	}
+	} else if(tcph->nsack)
+		hdrlen += SACK_LENGTH(tcph->nsack);
 
 	if(data) {
 		dlen = blocklen(data);
@@ -1157,15 +1740,32 @@ htontcp4(Tcp *tcph, Block *data, Tcp4hdr *ph, Tcpctl *tcb)
 			*opt++ = WS_LENGTH;
 			*opt++ = tcph->ws;
 		}
+		if(tcph->sackok){
+			*opt++ = SACKPERMOPT;
+			*opt++ = SACKPERM_LENGTH;
+		}
 		while(optpad-- > 0)
 			*opt++ = NOOPOPT;
-	}
+	} else if(tcph->nsack)
+		sackopt(h->tcpopt, tcph);
 
-	if(tcb != nil && tcb->nochecksum){
+	if(tcb != nil && dlen > tcb->mss){
+		/*
+		 *  a super-segment: whoever cuts it up sums the pieces,
+		 *  starting from the pseudo header without the length
+		 */
+		data->flag |= Btso;
+		data->mss = tcb->mss;
+		hnputs(h->tcplen, 0);
+		csum = ptclcsum(data, TCP4_IPLEN, TCP4_PHDRSIZE);
+		hnputs(h->tcpcksum, ~csum);
+	} else if(tcb != nil && tcb->nochecksum){
 		h->tcpcksum[0] = h->tcpcksum[1] = 0;
 	} else {
-		csum = ptclcsum(data, TCP4_IPLEN, hdrlen+dlen+TCP4_PHDRSIZE);
-		hnputs(h->tcpcksum, csum);
+		/* ipoput4 or the device sums the rest */
+		data->flag |= Bcsum;
+		csum = ptclcsum(data, TCP4_IPLEN, TCP4_PHDRSIZE);
+		hnputs(h->tcpcksum, ~csum);
 	}
 
 	return data;
@@ -1178,7 +1778,7 @@ ntohtcp6(Tcp *tcph, Block **bpp)
 	uchar *optr;
 	ushort hdrlen;
 	ushort optlen;
-	int n;
+	int n, i;
 
 	*bpp = pullupblock(*bpp, TCP6_PKT+TCP6_HDRSIZE);
 	if(*bpp == nil)
@@ -1200,6 +1800,8 @@ ntohtcp6(Tcp *tcph, Block **bpp)
 	tcph->urg = nhgets(h->tcpurg);
 	tcph->mss = 0;
 	tcph->ws = 0;
+	tcph->sackok = 0;
+	tcph->nsack = 0;
 	tcph->update = 0;
 	tcph->len = nhgets(h->ploadlen) - hdrlen;
 
@@ -1227,6 +1829,17 @@ ntohtcp6(Tcp *tcph, Block **bpp)
 			if(optlen == WS_LENGTH && *(optr+2) <= 14)
 				tcph->ws = *(optr+2);
 			break;
+		case SACKPERMOPT:
+			if(optlen == SACKPERM_LENGTH)
+				tcph->sackok = 1;
+			break;
+		case SACKOPT:
+			for(i = 2; i+8 <= optlen && tcph->nsack < Nsackopt; i += 8){
+				tcph->sack[tcph->nsack].left = nhgetl(optr+i);
+				tcph->sack[tcph->nsack].right = nhgetl(optr+i+4);
+				tcph->nsack++;
+			}
+			break;
 		}
 		n -= optlen;
 		optr += optlen;
@@ -1241,7 +1854,7 @@ ntohtcp4(Tcp *tcph, Block **bpp)
 	uchar *optr;
 	ushort hdrlen;
 	ushort optlen;
-	int n;
+	int n, i;
 
 	*bpp = pullupblock(*bpp, TCP4_PKT+TCP4_HDRSIZE);
 	if(*bpp == nil)
@@ -1264,6 +1877,8 @@ ntohtcp4(Tcp *tcph, Block **bpp)
 	tcph->urg = nhgets(h->tcpurg);
 	tcph->mss = 0;
 	tcph->ws = 0;
+	tcph->sackok = 0;
+	tcph->nsack = 0;
 	tcph->update = 0;
 	tcph->len = nhgets(h->length) - (hdrlen + TCP4_PKT);
 
@@ -1291,6 +1906,17 @@ ntohtcp4(Tcp *tcph, Block **bpp)
 			if(optlen == WS_LENGTH && *(optr+2) <= 14)
 				tcph->ws = *(optr+2);
 			break;
+		case SACKPERMOPT:
+			if(optlen == SACKPERM_LENGTH)
+				tcph->sackok = 1;
+			break;
+		case SACKOPT:
+			for(i = 2; i+8 <= optlen && tcph->nsack < Nsackopt; i += 8){
+				tcph->sack[tcph->nsack].left = nhgetl(optr+i);
+				tcph->sack[tcph->nsack].right = nhgetl(optr+i+4);
+				tcph->nsack++;
+			}
+			break;
 		}
 		n -= optlen;
 		optr += optlen;
@@ -1320,6 +1946,7 @@ tcpsndsyn(Conv *s, Tcpctl *tcb)
 
 	/* set desired mss and scale */
 	tcb->mss = tcpmtu(s->p, s->laddr, s->ipversion, &tcb->scale);
+	tcb->tso = tcptso(s->p, s->laddr, s->ipversion);
 	tpriv = s->p->priv;
 	tpriv->stats[Mss] = tcb->mss;
 }
@@ -1389,6 +2016,8 @@ sndrst(Proto *tcp, uchar *source, uchar *dest, ushort length, Tcp *seg, uchar ve
 	seg->urg = 0;
 	seg->mss = 0;
 	seg->ws = 0;
+	seg->sackok = 0;
+	seg->nsack = 0;
 	switch(version) {
 	case V4:
 		hbp = htontcp4(seg, nil, &ph4, nil);
@@ -1499,6 +2128,7 @@ sndsynack(Proto *tcp, Limbo *lp)
 	seg.urg = 0;
 	seg.mss = tcpmtu(tcp, lp->laddr, lp->version, &scale);
 	seg.wnd = QMAX;
+	seg.sackok = lp->sackok;
 
 	/* if the other side set scale, we should too */
 	if(lp->rcvscale){
@@ -1579,6 +2209,7 @@ limbo(Conv *s, uchar *source, uchar *dest, Tcp *seg, int version)
 		lp->rport = seg->source;
 		lp->mss = seg->mss;
 		lp->rcvscale = seg->ws;
+		lp->sackok = seg->sackok;
 		lp->irs = seg->seq;
 		lp->iss = (nrand(1<<16)<<16)|nrand(1<<16);
 	}
@@ -1747,13 +2378,10 @@ tcpincoming(Conv *s, Tcp *segp, uchar *src, uchar *dst, uchar version)
 	memmove(new->ptcl, s->ptcl, sizeof(Tcpctl));
 	tcb = (Tcpctl*)new->ptcl;
 	tcb->flags &= ~CLONE;
-	tcb->timer.arg = new;
+	tcptimersinit(new);
 	tcb->timer.state = TcptimerOFF;
-	tcb->acktimer.arg = new;
 	tcb->acktimer.state = TcptimerOFF;
-	tcb->katimer.arg = new;
 	tcb->katimer.state = TcptimerOFF;
-	tcb->rtt_timer.arg = new;
 	tcb->rtt_timer.state = TcptimerOFF;
 
 	tcb->irs = lp->irs;
@@ -1771,12 +2399,14 @@ tcpincoming(Conv *s, Tcp *segp, uchar *src, uchar *dst, uchar version)
 	tcb->snd.rxt = tcb->iss+1;
 	tcb->flgcnt = 0;
 	tcb->flags |= SYNACK;
+	tcb->sack = lp->sackok;
 
 	/* our sending max segment size cannot be bigger than what he asked for */
 	if(lp->mss != 0 && lp->mss < tcb->mss) {
 		tcb->mss = lp->mss;
 		tpriv->stats[Mss] = tcb->mss;
 	}
+	tcb->tso = tcptso(s->p, new->laddr, version);
 
 	/* window scaling */
 	tcpsetscale(new, tcb, lp->rcvscale, lp->sndscale);
@@ -1897,6 +2527,9 @@ update(Conv *s, Tcp *seg)
 	tpriv = s->p->priv;
 	tcb = (Tcpctl*)s->ptcl;
 
+	if(tcb->sack)
+		tcpsackupdate(tcb, seg);
+
 	/* catch zero-window updates, update window & recover */
 	if(tcb->snd.wnd == 0 && seg->wnd > 0 &&
 	    seq_lt(seg->ack, tcb->snd.ptr)){
@@ -1912,13 +2545,15 @@ update(Conv *s, Tcp *seg)
 recovery:
 		if(tcb->snd.recovery){
 			tpriv->stats[RecoveryCwind]++;
-			tcb->cwind += tcb->mss;
+			if(!tcpsackrxmit(s))
+				tcb->cwind += tcb->mss;
 		}else if(seq_le(tcb->snd.rxt, seg->ack)){
 			tpriv->stats[Recovery]++;
 			tcb->abcbytes = 0;
 			tcb->snd.recovery = 1;
 			tcb->snd.partialack = 0;
 			tcb->snd.rxt = tcb->snd.nxt;
+			tcb->snd.sackrxt = tcb->snd.una;
 			tcpcongestion(tcb);
 			tcb->cwind = tcb->ssthresh + 3*tcb->mss;
 			netlog(s->p->f, Logtcpwin, "recovery inflate %ld ss %ld @%lud\n",
@@ -1931,8 +2566,13 @@ recovery:
 			/* don't enter fast retransmit, don't change ssthresh */
 		}
 	}else if(tcb->snd.recovery){
+		/*
+		 *  each dupack is a segment out of the network: fill
+		 *  the next sacked-over hole with it, or else new data
+		 */
 		tpriv->stats[RecoveryCwind]++;
-		tcb->cwind += tcb->mss;
+		if(seg->ack != tcb->snd.una || !tcpsackrxmit(s))
+			tcb->cwind += tcb->mss;
 	}
 
 	/*
@@ -1967,6 +2607,7 @@ recovery:
 		tcb->flgcnt--;
 		goto done;
 	}
+	tcb->delivered += acked;
 
 	/*
 	 * congestion control
@@ -1999,7 +2640,7 @@ recovery:
 			tcb->snd.partialack++;
 		}
 	} else
-		tcpabcincr(tcb, acked);
+		(*tcb->cc->acked)(tcb, acked);
 
 	/* Adjust the timers according to the round trip time */
 	/* TODO: fix sloppy treatment of overflow cases here. */
@@ -2027,6 +2668,16 @@ recovery:
 					tcb->mdev = 1;
 			}
 			tcpsettimer(tcb);
+
+			rtt = NOW - tcb->rttsent;
+			if(rtt <= 0)
+				rtt = 1;
+			if(tcb->minrtt == 0 || rtt <= tcb->minrtt
+			|| NOW - tcb->minrtttime > Minrttwin){
+				tcb->minrtt = rtt;
+				tcb->minrtttime = NOW;
+			}
+			(*tcb->cc->rtt)(tcb, rtt);
 		}
 	}
 
@@ -2075,6 +2726,7 @@ tcpiput(Proto *tcp, Ipifc*, Block *bp)
 	Fs *f;
 	Tcppriv *tpriv;
 	uchar version;
+	int locked;
 
 	f = tcp->f;
 	tpriv = tcp->priv;
@@ -2164,16 +2816,21 @@ tcpiput(Proto *tcp, Ipifc*, Block *bp)
 		}
 	}
 
-	/* lock protocol while searching for a conversation */
-	qlock(tcp);
-
-	/* Look for a matching conversation */
+	/*
+	 *  a segment for a connected conversation is handled under
+	 *  the conversation's lock alone, so different conversations
+	 *  go in parallel.  The protocol is locked for listeners,
+	 *  their calls in limbo and the conversations made from them.
+	 */
+	locked = 0;
+again:
 	s = iphtlook(&tpriv->ht, source, seg.source, dest, seg.dest);
 	if(s == nil){
 		netlog(f, Logtcp, "iphtlook(src %I!%d, dst %I!%d) failed\n",
 			source, seg.source, dest, seg.dest);
 reset:
-		qunlock(tcp);
+		if(locked)
+			qunlock(tcp);
 		sndrst(tcp, source, dest, length, &seg, version, "no conversation");
 		freeblist(bp);
 		return;
@@ -2182,6 +2839,11 @@ reset:
 	/* if it's a listener, look for the right flags and get a new conv */
 	tcb = (Tcpctl*)s->ptcl;
 	if(tcb->state == Listen){
+		if(!locked){
+			qlock(tcp);
+			locked = 1;
+			goto again;
+		}
 		if(seg.flags & RST){
 			limborst(s, &seg, source, dest, version);
 			qunlock(tcp);
@@ -2210,13 +2872,23 @@ reset:
 	 * locked and implements the state machine directly out of the RFC.
 	 * Out-of-band data is ignored - it was always a bad idea.
 	 */
+	qlock(s);
+	if(locked)
+		qunlock(tcp);
+	else if(s->lport != seg.dest || s->rport != seg.source
+	|| ipcmp(s->laddr, dest) != 0 || ipcmp(s->raddr, source) != 0
+	|| ((Tcpctl*)s->ptcl)->state == Listen){
+		/* it was closed and used again before we locked it */
+		qunlock(s);
+		qlock(tcp);
+		locked = 1;
+		goto again;
+	}
 	tcb = (Tcpctl*)s->ptcl;
 	if(waserror()){
 		qunlock(s);
 		nexterror();
 	}
-	qlock(s);
-	qunlock(tcp);
 
 	/* fix up window */
 	seg.wnd <<= tcb->rcv.scale;
@@ -2553,7 +3225,8 @@ tcpoutput(Conv *s)
 	Tcpctl *tcb;
 	Block *hbp, *bp;
 	int sndcnt;
-	ulong ssize, dsize, sent;
+	ulong ssize, dsize, sent, mss, burst, rate;
+	uvlong now;
 	Fs *f;
 	Tcppriv *tpriv;
 	uchar version;
@@ -2599,6 +3272,14 @@ tcpoutput(Conv *s)
 			tcb->flags |= FORCE;
 		}
 
+		/* tell of the data past the holes; it costs segment room */
+		seg.nsack = 0;
+		if(tcb->sack && tcb->reseq != nil)
+			seg.nsack = tcpsackblocks(tcb, seg.sack, Nsackopt);
+		mss = tcb->mss;
+		if(seg.nsack)
+			mss -= SACK_LENGTH(seg.nsack);
+
 		sndcnt = qlen(s->wq)+tcb->flgcnt;
 		sent = tcb->snd.ptr - tcb->snd.una;
 		ssize = sndcnt;
@@ -2624,8 +3305,40 @@ tcpoutput(Conv *s)
 				ssize = 0;
 			else {
 				ssize -= sent;
-				if(ssize > tcb->mss)
-					ssize = tcb->mss;
+				if(ssize > mss){
+					/* whole segments, as many as the 1st hop cuts up */
+					if(tcb->tso > tcb->mss && tcb->state == Established &&
+					    tcb->snd.retransmit == 0 && seg.nsack == 0){
+						if(ssize > tcb->tso)
+							ssize = tcb->tso;
+						ssize -= ssize % tcb->mss;
+					} else
+						ssize = mss;
+				}
+			}
+		}
+
+		/*
+		 *  a paced conversation's new data goes at the pacing
+		 *  rate, a millisecond's worth at a time; waiting, an
+		 *  ack that must go goes bare
+		 */
+		if(tcb->pace && ssize != 0 && tcb->state == Established &&
+		    tcb->snd.retransmit == 0){
+			now = fastticks2ns(fastticks(nil));
+			if(now < tcb->pacens){
+				tcppacewait(s, now);
+				ssize = 0;
+			} else {
+				rate = (*tcb->cc->pacerate)(tcb);
+				burst = rate / 1000;
+				if(burst < 2*tcb->mss)
+					burst = 2*tcb->mss;
+				if(ssize > burst)
+					ssize = burst - burst % tcb->mss;
+				if(tcb->pacens < now)
+					tcb->pacens = now;
+				tcb->pacens += (uvlong)ssize * 1000000000 / rate;
 			}
 		}
 
@@ -2634,7 +3347,7 @@ tcpoutput(Conv *s)
 
 		if(!(tcb->flags & FORCE))
 			if(ssize == 0 ||
-			    ssize < tcb->mss && tcb->snd.nxt == tcb->snd.ptr &&
+			    ssize < mss && tcb->snd.nxt == tcb->snd.ptr &&
 			    sent > TCPREXMTTHRESH * tcb->mss)
 				break;
 
@@ -2647,6 +3360,7 @@ tcpoutput(Conv *s)
 		seg.flags = ACK;
 		seg.mss = 0;
 		seg.ws = 0;
+		seg.sackok = 0;
 		seg.update = 0;
 		switch(tcb->state){
 		case Syn_sent:
@@ -2656,6 +3370,7 @@ tcpoutput(Conv *s)
 				dsize--;
 				seg.mss = tcb->mss;
 				seg.ws = tcb->scale;
+				seg.sackok = 1;
 			}
 			break;
 		case Syn_received:
@@ -2670,6 +3385,7 @@ tcpoutput(Conv *s)
 				ssize = 1;
 				seg.mss = tcb->mss;
 				seg.ws = tcb->scale;
+				seg.sackok = tcb->sack;
 			}
 			break;
 		}
@@ -2737,13 +3453,17 @@ tcpoutput(Conv *s)
 			 */
 			if(tcb->snd.retransmit == 0)
 			if(tcb->rtt_timer.state != TcptimerON)
-			if(ssize == tcb->mss) {
+			if(ssize >= mss) {
 				tcpgo(tpriv, &tcb->rtt_timer);
 				tcb->rttseq = tcb->snd.ptr;
+				tcb->rttsent = NOW;
 			}
 		}
 
-		tpriv->stats[OutSegs]++;
+		if(dsize > tcb->mss)
+			tpriv->stats[OutSegs] += (dsize + tcb->mss - 1) / tcb->mss;
+		else
+			tpriv->stats[OutSegs]++;
 		if(tcb->snd.retransmit)
 			tpriv->stats[RetransSegsSent]++;
 		tcb->rcv.ackptr = seg.ack;
@@ -2910,11 +3630,32 @@ tcpsetchecksum(Conv *s, char **f, int)
 }
 
 /*
- *  retransmit (at most) one segment at snd.una.
+ *  turn pacing on/off
+ */
+static char*
+tcpsetpace(Conv *s, char **f, int n)
+{
+	Tcpctl *tcb;
+
+	tcb = (Tcpctl*)s->ptcl;
+	if(n < 2 || strcmp(f[1], "on") == 0)
+		tcb->pace = 1;
+	else if(strcmp(f[1], "off") == 0){
+		tcb->pace = 0;
+		tcppacestop(s);
+		tcpoutput(s);
+	} else
+		return "usage: pace [on|off]";
+
+	return nil;
+}
+
+/*
+ *  retransmit (at most) len bytes at seq.
  *  preserve cwind & snd.ptr
  */
 static void
-tcprxmit(Conv *s)
+tcprxmitseq(Conv *s, ulong seq, ulong len)
 {
 	Tcpctl *tcb;
 	Tcppriv *tpriv;
@@ -2925,8 +3666,8 @@ tcprxmit(Conv *s)
 
 	tptr = tcb->snd.ptr;
 	tcwind = tcb->cwind;
-	tcb->snd.ptr = tcb->snd.una;
-	tcb->cwind = tcb->mss;
+	tcb->snd.ptr = seq;
+	tcb->cwind = seq - tcb->snd.una + len;
 	tcb->snd.retransmit = 1;
 	tcpoutput(s);
 	tcb->snd.retransmit = 0;
@@ -2937,6 +3678,20 @@ tcprxmit(Conv *s)
 	tpriv->stats[RetransSegs]++;
 }
 
+/*
+ *  retransmit (at most) one segment at snd.una.
+ */
+static void
+tcprxmit(Conv *s)
+{
+	Tcpctl *tcb;
+
+	tcb = (Tcpctl*)s->ptcl;
+	tcprxmitseq(s, tcb->snd.una, tcb->mss);
+	if(seq_lt(tcb->snd.sackrxt, tcb->snd.una + tcb->mss))
+		tcb->snd.sackrxt = tcb->snd.una + tcb->mss;
+}
+
 /*
  *  TODO: RFC 4138 F-RTO
  */
@@ -2978,6 +3733,10 @@ tcptimeout(void *arg)
 			tcpcongestion(tcb);
 		tcprxmit(s);
 		tcb->snd.ptr = tcb->snd.una;
+
+		/* go back n resends it all; the peer may have reneged */
+		tcb->nsacks = 0;
+		tcb->snd.sackrxt = tcb->snd.una;
 		tcb->cwind = tcb->mss;
 		tcb->snd.rto = 1;
 		tpriv->stats[RetransTimeouts]++;
@@ -3035,6 +3794,7 @@ procsyn(Conv *s, Tcp *seg)
 	}
 
 	tcb->snd.wnd = seg->wnd;
+	tcb->sack = seg->sackok;
 	initialwindow(tcb);
 }
 
@@ -3049,6 +3809,8 @@ dumpreseq(Tcpctl *tcb)
 		free(r);
 	}
 	tcb->reseq = nil;
+	tcb->reseqtail = nil;
+	tcb->reseqlast = nil;
 	tcb->nreseq = 0;
 	tcb->reseqlen = 0;
 	return -1;
@@ -3074,35 +3836,98 @@ logreseq(Fs *f, Reseq *r, ulong n)
 	}
 }
 
+/*
+ *  can the segment go on the end of rp's run?
+ */
+static int
+reseqjoins(Reseq *rp, Tcp *seg, ushort length)
+{
+	if(rp->seg.seq + rp->length != seg->seq)
+		return 0;
+	if(rp->length == 0 || length == 0 || rp->length + length > Reseqmax)
+		return 0;
+	return (rp->seg.flags & (SYN|FIN|URG)) == 0 && (seg->flags & (SYN|URG)) == 0;
+}
+
+static void
+reseqjoin(Reseq *rp, Tcp *seg, Block *bp, ushort length)
+{
+	rp->ebp->next = bp;
+	while(bp->next != nil)
+		bp = bp->next;
+	rp->ebp = bp;
+	rp->length += length;
+	rp->seg.len += length;
+	rp->seg.flags |= seg->flags & (PSH|FIN);
+}
+
 static int
 addreseq(Fs *f, Tcpctl *tcb, Tcppriv *tpriv, Tcp *seg, Block *bp, ushort length)
 {
-	Reseq *rp, **rr;
+	Reseq *rp, *p, *n;
 	int qmax;
 
-	rp = malloc(sizeof *rp);
-	if(rp == nil){
-		freeblist(bp);		/* bp always consumed by addreseq */
+	/*
+	 *  find the entry it goes after.  behind a hole,
+	 *  segments mostly arrive in order, so try the tail first.
+	 */
+	p = tcb->reseqtail;
+	if(p == nil || seq_lt(seg->seq, p->seg.seq)){
+		p = nil;
+		for(n = tcb->reseq; n != nil && seq_ge(seg->seq, n->seg.seq); n = n->next)
+			p = n;
+	}
+	tpriv->stats[Resequenced]++;
+	if(p != tcb->reseqtail)
+		tpriv->stats[OutOfOrder]++;
+
+	/* already have it */
+	if(p != nil && length != 0 && (seg->flags & (SYN|FIN)) == 0
+	&& seq_le(seg->seq + length, p->seg.seq + p->length)){
+		tcb->rerecv += length;
+		freeblist(bp);
+		tcb->reseqlast = p;
 		return 0;
 	}
 
-	rp->seg = *seg;
-	rp->bp = bp;
-	rp->length = length;
-
-	tcb->reseqlen += length;
-	tcb->nreseq++;
-
-	/* Place on reassembly list sorting by starting seq number */
-	for(rr = &tcb->reseq; ; rr = &(*rr)->next)
-		if(*rr == nil || seq_lt(seg->seq, (*rr)->seg.seq)){
-			rp->next = *rr;
-			*rr = rp;
-			tpriv->stats[Resequenced]++;
-			if(rp->next != nil)
-				tpriv->stats[OutOfOrder]++;
-			break;
+	if(p != nil && reseqjoins(p, seg, length)){
+		reseqjoin(p, seg, bp, length);
+		rp = p;
+	} else {
+		rp = malloc(sizeof *rp);
+		if(rp == nil){
+			freeblist(bp);		/* bp always consumed by addreseq */
+			return 0;
+		}
+		rp->seg = *seg;
+		rp->bp = bp;
+		for(rp->ebp = bp; bp != nil && bp->next != nil; bp = bp->next)
+			rp->ebp = bp->next;
+		rp->length = length;
+		if(p == nil){
+			rp->next = tcb->reseq;
+			tcb->reseq = rp;
+		} else {
+			rp->next = p->next;
+			p->next = rp;
 		}
+		if(rp->next == nil)
+			tcb->reseqtail = rp;
+		tcb->nreseq++;
+	}
+	tcb->reseqlen += length;
+
+	/* a filled hole joins the next run too */
+	n = rp->next;
+	if(n != nil && reseqjoins(rp, &n->seg, n->length)){
+		reseqjoin(rp, &n->seg, n->bp, n->length);
+		rp->next = n->next;
+		if(tcb->reseqtail == n)
+			tcb->reseqtail = rp;
+		free(n);
+		tcb->nreseq--;
+	}
+	tcb->reseqlast = rp;
 
 	qmax = tcb->window;
 	if(tcb->reseqlen > qmax){
@@ -3133,6 +3958,10 @@ getreseq(Tcpctl *tcb, Tcp *seg, Block **bp, ushort *length)
 		return;
 
 	tcb->reseq = rp->next;
+	if(tcb->reseqtail == rp)
+		tcb->reseqtail = nil;
+	if(tcb->reseqlast == rp)
+		tcb->reseqlast = nil;
 
 	*seg = rp->seg;
 	*bp = rp->bp;
@@ -3144,6 +3973,141 @@ getreseq(Tcpctl *tcb, Tcp *seg, Block **bp, ushort *length)
 	free(rp);
 }
 
+/*
+ *  sack blocks for the runs in the resequence queue, the one
+ *  holding the latest arrival first; rfc 2018 §4
+ */
+static int
+tcpsackblocks(Tcpctl *tcb, Sackblk *sb, int nsb)
+{
+	Reseq *r;
+	Sackblk b;
+	int n, last;
+
+	n = 0;
+	for(r = tcb->reseq; r != nil; ){
+		b.left = r->seg.seq;
+		b.right = r->seg.seq + r->length;
+		last = r == tcb->reseqlast;
+		for(r = r->next; r != nil && seq_le(r->seg.seq, b.right); r = r->next){
+			if(seq_gt(r->seg.seq + r->length, b.right))
+				b.right = r->seg.seq + r->length;
+			last |= r == tcb->reseqlast;
+		}
+		if(!seq_gt(b.right, b.left) || seq_le(b.right, tcb->rcv.nxt))
+			continue;
+		if(last){
+			if(n == nsb)
+				n--;
+			memmove(sb+1, sb, n*sizeof *sb);
+			sb[0] = b;
+			n++;
+		} else if(n < nsb)
+			sb[n++] = b;
+	}
+	return n;
+}
+
+/*
+ *  fold the peer's sack blocks into the scoreboard, which is
+ *  kept sorted, disjoint and above snd.una.  when it's full the
+ *  highest range goes: the lowest holes are the ones to fill.
+ */
+static void
+tcpsackupdate(Tcpctl *tcb, Tcp *seg)
+{
+	Sackblk *sb, b;
+	ulong una;
+	int i, j, k;
+
+	una = tcb->snd.una;
+	if(seq_gt(seg->ack, una) && seq_le(seg->ack, tcb->snd.nxt))
+		una = seg->ack;
+
+	sb = tcb->sacks;
+	for(i = 0; i < tcb->nsacks && seq_le(sb[i].right, una); i++)
+		;
+	if(i > 0){
+		tcb->nsacks -= i;
+		memmove(sb, sb+i, tcb->nsacks*sizeof *sb);
+	}
+	if(tcb->nsacks > 0 && seq_lt(sb[0].left, una))
+		sb[0].left = una;
+
+	for(i = 0; i < seg->nsack; i++){
+		b = seg->sack[i];
+		if(!seq_lt(b.left, b.right) || seq_le(b.right, una)
+		|| seq_gt(b.right, tcb->snd.nxt))
+			continue;
+		if(seq_lt(b.left, una))
+			b.left = una;
+
+		/* ranges j..k-1 touch b */
+		for(j = 0; j < tcb->nsacks && seq_lt(sb[j].right, b.left); j++)
+			;
+		for(k = j; k < tcb->nsacks && seq_le(sb[k].left, b.right); k++){
+			if(seq_lt(sb[k].left, b.left))
+				b.left = sb[k].left;
+			if(seq_gt(sb[k].right, b.right))
+				b.right = sb[k].right;
+		}
+		if(k == j){
+			if(tcb->nsacks == Nscore){
+				if(j == Nscore)
+					continue;
+				tcb->nsacks--;
+			}
+			memmove(sb+j+1, sb+j, (tcb->nsacks-j)*sizeof *sb);
+			tcb->nsacks++;
+		} else if(k > j+1){
+			memmove(sb+j+1, sb+k, (tcb->nsacks-k)*sizeof *sb);
+			tcb->nsacks -= k-j-1;
+		}
+		sb[j] = b;
+	}
+}
+
+/*
+ *  resend the first hole past snd.sackrxt that the peer has
+ *  sacked at least TCPREXMTTHRESH segments beyond, so it's lost
+ *  rather than reordered; rfc 6675 NextSeg() rule 1
+ */
+static int
+tcpsackrxmit(Conv *s)
+{
+	Tcpctl *tcb;
+	Tcppriv *tpriv;
+	Sackblk *b, *e, *h;
+	ulong seq, len, above;
+
+	tcb = (Tcpctl*)s->ptcl;
+	if(!tcb->sack || tcb->nsacks == 0)
+		return 0;
+	seq = tcb->snd.sackrxt;
+	if(seq_lt(seq, tcb->snd.una))
+		seq = tcb->snd.una;
+	e = tcb->sacks + tcb->nsacks;
+	for(h = tcb->sacks; h < e && seq_ge(seq, h->left); h++)
+		if(seq_lt(seq, h->right))
+			seq = h->right;
+	if(h == e)
+		return 0;
+	above = 0;
+	for(b = h; b < e; b++)
+		above += b->right - b->left;
+	if(above < TCPREXMTTHRESH*tcb->mss)
+		return 0;
+
+	len = h->left - seq;
+	if(len > tcb->mss)
+		len = tcb->mss;
+	tcprxmitseq(s, seq, len);
+	tcb->snd.sackrxt = seq + len;
+	tpriv = s->p->priv;
+	tpriv->stats[SackRxmits]++;
+	return 1;
+}
+
 static int
 tcptrim(Tcpctl *tcb, Tcp *seg, Block **bp, ushort *length)
 {
@@ -3280,6 +4244,43 @@ tcpporthogdefensectl(char *val)
 	return nil;
 }
 
+/*
+ *  switch the conversation's congestion control;
+ *  the new one starts from the window as it is
+ */
+static char*
+tcpsetcc(Conv *c, char *name)
+{
+	Tcpctl *tcb;
+	Tcpcc *cc;
+
+	cc = tcplookcc(name);
+	if(cc == nil)
+		return "unknown congestion control";
+	tcb = (Tcpctl*)c->ptcl;
+	tcb->cc = cc;
+	tcb->abcbytes = 0;
+	memset(&tcb->cubic, 0, sizeof tcb->cubic);
+	memset(&tcb->bbr, 0, sizeof tcb->bbr);
+	tcb->rate = 0;
+	return nil;
+}
+
+/* the congestion control conversations start with from now on */
+static char*
+tcpdefcc(Proto *tcp, char *name)
+{
+	Tcppriv *tpriv;
+	Tcpcc *cc;
+
+	cc = tcplookcc(name);
+	if(cc == nil)
+		return "unknown congestion control";
+	tpriv = tcp->priv;
+	tpriv->cc = cc;
+	return nil;
+}
+
 /* called with c qlocked */
 static char*
 tcpctl(Conv* c, char** f, int n)
@@ -3292,6 +4293,12 @@ tcpctl(Conv* c, char** f, int n)
 		return tcpsetchecksum(c, f, n);
 	if(n >= 1 && strcmp(f[0], "tcpporthogdefense") == 0)
 		return tcpporthogdefensectl(f[1]);
+	if(n == 2 && strcmp(f[0], "cc") == 0)
+		return tcpsetcc(c, f[1]);
+	if(n == 2 && strcmp(f[0], "tcpcc") == 0)
+		return tcpdefcc(c->p, f[1]);
+	if(n >= 1 && strcmp(f[0], "pace") == 0)
+		return tcpsetpace(c, f, n);
 	return "unknown control request";
 }
 
@@ -3396,6 +4403,7 @@ tcpinit(Fs *fs)
 	tcp->nc = scalednconv();
 	tcp->ptclsize = sizeof(Tcpctl);
 	tpriv->stats[MaxConn] = tcp->nc;
+	tpriv->cc = tcpccs;
 
 	Fsproto(fs, tcp);
 }
@@ -24,6 +24,7 @@ enum
 
 	IP_UDPPROTO	= 17,
 	UDP_USEAD7	= 52,
+	UDP_BATCHLEN	= 2,	/* length before each datagram of a batch */
 
 	Udprxms		= 200,
 	Udptickms	= 100,
@@ -174,18 +175,63 @@ udpclose(Conv *c)
 
 	ucb = (Udpcb*)c->ptcl;
 	ucb->headers = 0;
+	c->batch = 0;
+	qcoalesce(c->rq, 0);
 }
 
+static void udpsend(Conv*, Block*);
+
 void
 udpkick(void *x, Block *bp)
 {
 	Conv *c = x;
+	Udpcb *ucb;
+	Block *nb;
+	int n;
+
+	if(bp == nil)
+		return;
+	if(c->batch == 0){
+		udpsend(c, bp);
+		return;
+	}
+
+	/*
+	 *  a batch: datagrams one after another, each after
+	 *  its length.  each is copied out to be sent on its
+	 *  own, summed on the way; a short tail is dropped.
+	 */
+	ucb = (Udpcb*)c->ptcl;
+	if(bp->next != nil)
+		bp = concatblock(bp);
+	while(BLEN(bp) >= UDP_BATCHLEN){
+		n = nhgets(bp->rp);
+		bp->rp += UDP_BATCHLEN;
+		if(n > BLEN(bp))
+			break;
+		nb = allocb(n);
+		if(ucb->headers == 0){
+			nb->checksum = ptclcpsum(nb->wp, bp->rp, n);
+			nb->flag |= Bpktck;
+		} else
+			memmove(nb->wp, bp->rp, n);
+		nb->wp += n;
+		bp->rp += n;
+		udpsend(c, nb);
+	}
+	freeb(bp);
+}
+
+static void
+udpsend(Conv *c, Block *bp)
+{
 	Udp4hdr *uh4;
 	Udp6hdr *uh6;
 	ushort rport;
 	uchar laddr[IPaddrlen], raddr[IPaddrlen];
 	Udpcb *ucb;
-	int dlen, ptcllen;
+	int dlen, ptcllen, dsum;
+	ulong sum;
 	Udppriv *upriv;
 	Fs *f;
 	int version;
@@ -195,10 +241,12 @@ udpkick(void *x, Block *bp)
 	f = c->p->f;
 
 //	netlog(c->p->f, Logudp, "udp: kick\n");	/* frequent and uninteresting */
-	if(bp == nil)
-		return;
-
 	ucb = (Udpcb*)c->ptcl;
+	/* ipwrite may have summed the data on the way in; useless if it holds headers */
+	dsum = -1;
+	if((bp->flag & Bpktck) && bp->next == nil && ucb->headers == 0)
+		dsum = bp->checksum;
+	bp->flag &= ~Bpktck;
 	switch(ucb->headers) {
 	case 7:
 		/* get user specified addresses */
@@ -267,11 +315,24 @@ udpkick(void *x, Block *bp)
 		}
 		hnputs(uh4->udpsport, c->lport);
 		hnputs(uh4->udplen, ptcllen);
-		uh4->udpcksum[0] = 0;
-		uh4->udpcksum[1] = 0;
-		hnputs(uh4->udpcksum,
-		       ptclcsum(bp, UDP4_PHDR_OFF, dlen+UDP_UDPHDR_SZ+UDP4_PHDR_SZ));
+		if(dsum >= 0){
+			/* only the pseudo and udp headers are left to sum */
+			uh4->udpcksum[0] = 0;
+			uh4->udpcksum[1] = 0;
+			sum = ptclbsum(bp->rp + UDP4_PHDR_OFF, UDP4_PHDR_SZ + UDP_UDPHDR_SZ) + dsum;
+			while(sum >> 16)
+				sum = (sum & 0xffff) + (sum >> 16);
+			sum = ~sum & 0xffff;
+			if(sum == 0)
+				sum = 0xffff;	/* 0 is no udp checksum */
+			hnputs(uh4->udpcksum, sum);
+		} else {
+			/* ipoput4 or the device sums the rest */
+			bp->flag |= Bcsum;
+			hnputs(uh4->udpcksum, ~ptclcsum(bp, UDP4_PHDR_OFF, UDP4_PHDR_SZ));
+		}
 		uh4->vihl = IP_VER4;
+		bp->flag |= Bdirect;
 		ipoput4(f, bp, 0, c->ttl, c->tos, rc);
 		break;
 
@@ -312,6 +373,7 @@ udpkick(void *x, Block *bp)
 		uh6->viclfl[0] = IP_VER6;
 		hnputs(uh6->len, ptcllen);
 		uh6->nextheader = IP_UDPPROTO;
+		bp->flag |= Bdirect;
 		ipoput6(f, bp, 0, c->ttl, c->tos, rc);
 		break;
 
@@ -359,7 +421,7 @@ udpiput(Proto *udp, Ipifc *ifc, Block *bp)
 		lport = nhgets(uh4->udpdport);
 		rport = nhgets(uh4->udpsport);
 
-		if(nhgets(uh4->udpcksum)) {
+		if(nhgets(uh4->udpcksum) && (bp->flag & Budpck) == 0) {
 			if(ptclcsum(bp, UDP4_PHDR_OFF, len+UDP4_PHDR_SZ)) {
 				upriv->ustats.udpInErrors++;
 				netlog(f, Logudp, "udp: checksum error %I\n", raddr);
@@ -498,6 +560,11 @@ udpiput(Proto *udp, Ipifc *ifc, Block *bp)
 	if(bp->next)
 		bp = concatblock(bp);
 
+	if(c->batch){
+		bp = padblock(bp, UDP_BATCHLEN);
+		hnputs(bp->rp, BLEN(bp) - UDP_BATCHLEN);
+	}
+
 	if(qfull(c->rq)){
 		qunlock(c);
 		netlog(f, Logudp, "udp: qfull %I.%d -> %I.%d\n", raddr, rport,
@@ -522,6 +589,12 @@ udpctl(Conv *c, char **f, int n)
 			ucb->headers = 7;	/* new headers format */
 			return nil;
 		}
+		if(strcmp(f[0], "batch") == 0){
+			/* reads take as many whole datagrams as fit */
+			c->batch = 1;
+			qcoalesce(c->rq, 1);
+			return nil;
+		}
 	}
 	return "unknown control request";
 }
@@ -613,6 +686,7 @@ udpinit(Fs *fs)
 	udp->advise = udpadvise;
 	udp->stats = udpstats;
 	udp->ipproto = IP_UDPPROTO;
+	udp->sumwrite = 1;
 	udp->nc = Nchans;
 	udp->ptclsize = sizeof(Udpcb);
 
@@ -15,8 +15,8 @@
 enum {
 	Tcycles		= CLOCKFREQ / HZ,	/* cycles per clock tick */
 	Dogperiod	= 15 * CLOCKFREQ, /* at most 21 s.; must fit in ulong */
-	MaxPeriod	= Tcycles,
-	MinPeriod	= MaxPeriod / 100,
+	MaxPeriod	= Tcycles * HZ,		/* tickless idle sleeps up to 1s */
+	MinPeriod	= Tcycles / 100,
 
 	/* timer ctl bits */
 	Tmr0enable	= 1<<0,
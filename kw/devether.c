@@ -169,7 +169,8 @@ etheriq(Ether* ether, Block* bp, int fromwire)
 	 * Multiplex the packet to all the connections which want it.
 	 * If the packet is not to be used subsequently (fromwire != 0),
 	 * attempt to simply pass it into one of the connections, thereby
-	 * saving a copy of the data (usual case hopefully).
+	 * saving a copy of the data (usual case hopefully), and give any
+	 * others a Block sharing its buffer, which they only read.
 	 */
 	for(fp = ether->f; fp < ep; fp++){
 		if(f = *fp)
@@ -181,6 +182,10 @@ etheriq(Ether* ether, Block* bp, int fromwire)
 			if(!f->headersonly){
 				if(fromwire && fx == 0)
 					fx = f;
+				else if(fromwire && (xbp = shareblock(bp, bp->rp, bp->wp)) != nil){
+					if(qpass(f->in, xbp) < 0)
+						ether->soverflows++;
+				}
 				else if(xbp = iallocb(len)){
 					memmove(xbp->wp, pkt, len);
 					xbp->wp += len;
@@ -152,6 +152,8 @@ struct Ctlr {
 	ulong	rxdiscard;
 	ulong	rxoverrun;
 	ulong	nofirstlast;
+	ulong	rxcsum;		/* tcp/udp sums checked by the mac */
+	ulong	txcsum;		/* tcp/udp sums made by the mac */
 
 	Mibstats;
 };
@@ -486,6 +488,7 @@ rxfreeb(Block *b)
 {
 	/* freeb(b) will have previously decremented b->ref to 0; raise to 1 */
 	_xinc(&b->ref);
+	b->flag &= ~(Bipck | Budpck | Btcpck | Bpktck);
 	b->wp = b->rp =
 		(uchar*)((uintptr)(b->lim - Rxblklen) & ~(Bufalign - 1));
 	assert(((uintptr)b->rp & (Bufalign - 1)) == 0);
@@ -595,6 +598,34 @@ ethercheck(Ether *ether)
 	}
 }
 
+/*
+ * the mac checks the ip header and the tcp or udp sum of
+ * unfragmented ipv4 packets; tell ip which it need not.
+ */
+static void
+rxcsum(Ctlr *ctlr, Block *b, ulong cs)
+{
+	uchar *ip;
+
+	if((cs & (RCSl3ip4|RCSip4headok)) != (RCSl3ip4|RCSip4headok))
+		return;
+	b->flag |= Bipck;
+	ip = b->rp + ETHERHDRSIZE;
+	if((cs & (RCSl4chkok|RCSvlan)) != RCSl4chkok ||
+	    (nhgets(ip+6) & 0x3fff) != 0)	/* fragment */
+		return;
+	switch(cs & RCSl4mask){
+	case RCSl4tcp4:
+		b->flag |= Btcpck;
+		ctlr->rxcsum++;
+		break;
+	case RCSl4udp4:
+		b->flag |= Budpck;
+		ctlr->rxcsum++;
+		break;
+	}
+}
+
 static void
 receive(Ether *ether)
 {
@@ -640,6 +671,7 @@ receive(Ether *ether)
 		 * in memory (mv-s104860-u0 §8.3.4.1)
 		 */
 		b->rp += 2;
+		rxcsum(ctlr, b, r->cs);
 		etheriq(ether, b, 1);
 		etheractive(ether);
 		if (i % (Nrx / 2) == 0) {
@@ -680,6 +712,8 @@ static void
 transmit(Ether *ether)
 {
 	int i, kick, len;
+	ulong cs;
+	uchar *ip;
 	Block *b;
 	Ctlr *ctlr = ether->ctlr;
 	Gbereg *reg = ctlr->reg;
@@ -716,11 +750,21 @@ transmit(Ether *ether)
 		/* set up the transmit descriptor */
 		t->buf = PADDR(b->rp);
 		t->countchk = len << 16;
+		cs = 0;
+		if(b->flag & Bcsum){
+			/* the mac sums all of the tcp or udp segment */
+			ip = b->rp + ETHERHDRSIZE;
+			cs = TCSgl4chk | TCSl4chkmode |
+				(ip[0] & 0xF) << TCSipv4hdlenshift;
+			if(ip[9] != 6)
+				cs |= TCSl4type;	/* udp */
+			ctlr->txcsum++;
+		}
 		coherence();
 
 		/* and fire */
 		t->cs = TCSpadding | TCSfirst | TCSlast | TCSdmaown |
-			TCSenableintr;
+			TCSenableintr | cs;
 		coherence();
 
 		kick++;
@@ -1632,6 +1676,8 @@ ifstat(Ether *ether, void *a, long n, ulong off)
 	p = seprint(p, e, "rx discarded frames: %lud\n", ctlr->rxdiscard);
 	p = seprint(p, e, "rx overrun frames: %lud\n", ctlr->rxoverrun);
 	p = seprint(p, e, "no first+last flag: %lud\n", ctlr->nofirstlast);
+	p = seprint(p, e, "rx checksums offloaded: %lud\n", ctlr->rxcsum);
+	p = seprint(p, e, "tx checksums offloaded: %lud\n", ctlr->txcsum);
 
 	p = seprint(p, e, "duplex: %s\n", (reg->ps0 & PS0fd)? "full": "half");
 	p = seprint(p, e, "flow control: %s\n", (reg->ps0 & PS0flctl)? "on": "off");
@@ -1741,6 +1787,7 @@ iprint("ether1116: reset: zero ether->ea\n");
 	ether->arg = ether;
 	ether->promiscuous = promiscuous;
 	ether->multicast = multicast;
+	ether->csum = 1;
 	return 0;
 }
 
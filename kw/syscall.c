@@ -246,6 +246,7 @@ syscall(Ureg* ureg)
 
 	/*	iprint("%s: syscall %s\n", up->text, sysctab[scallnr]?sysctab[scallnr]:"huh?"); */
 
+		up->stats.nsys[sysclass[scallnr]]++;
 		ret = systab[scallnr](up->s.args);
 		poperror();
 	}else{
@@ -36,7 +36,7 @@ enum {
 	Tcycles		= Clockfreqbase / HZ,	/* cycles per clock tick */
 
 	MinPeriod	= (Tcycles / 100 < 2? 2: Tcycles / 100),
-	MaxPeriod	= Tcycles,
+	MaxPeriod	= Tcycles * HZ,		/* tickless idle sleeps up to 1s */
 
 	Dogtimeout	= 20 * Clockfreqbase,	/* was 4 s.; must be ≤ 21 s. */
 };
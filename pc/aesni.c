@@ -0,0 +1,206 @@
+#include	"u.h"
+#include	"../port/lib.h"
+#include	"mem.h"
+#include	"dat.h"
+#include	"fns.h"
+#include	<libsec.h>
+#include	"../port/aes.h"
+
+/*
+ *  AES and GHASH on the processor's AES-NI and PCLMULQDQ.
+ *  The sse registers are taken from whichever process has
+ *  them, at splhi, and its state comes back on its next
+ *  floating point instruction.
+ */
+
+enum
+{
+	Chunk	= 4096,		/* bytes done between giving the fpu back */
+};
+
+void	aesniecb(ulong*, int, uchar*, uchar*, long);
+void	aesnicbce(ulong*, int, uchar*, uchar*, long);
+void	aesnicbcd(ulong*, int, uchar*, uchar*, long);
+void	pclmulgcm(uchar*, uchar*, uchar*, long);
+
+static Aesops aesniops;
+
+static int
+sseon(void)
+{
+	int s;
+
+	s = splhi();
+	if(up != nil && up->fpstate == FPactive){
+		fpsave(&up->fpsave);
+		up->fpstate = FPinactive;
+	}
+	fpinit();
+	return s;
+}
+
+static void
+sseoff(int s)
+{
+	fpoff();
+	splx(s);
+}
+
+/*
+ *  libsec keeps round keys as big-endian words;
+ *  the instructions want them in memory order
+ */
+static ulong*
+aesnikeys(ulong *buf, ulong *k, int nr)
+{
+	int i;
+	ulong *rk, w;
+
+	rk = (ulong*)(((uintptr)buf+15) & ~15);
+	for(i = 0; i < 4*(nr+1); i++){
+		w = k[i];
+		rk[i] = w>>24 | (w>>8)&0xff00 | (w<<8)&0xff0000 | w<<24;
+	}
+	return rk;
+}
+
+static void
+aesnicbc(AESstate *s, uchar *p, long n, int dec)
+{
+	int x;
+	long m;
+	ulong buf[4*(AESmaxrounds+1)+4], *rk;
+
+	if(dec)
+		rk = aesnikeys(buf, s->dkey, s->rounds);
+	else
+		rk = aesnikeys(buf, s->ekey, s->rounds);
+	while(n >= AESbsize){
+		m = n & ~(AESbsize-1);
+		if(m > Chunk)
+			m = Chunk;
+		x = sseon();
+		if(dec)
+			aesnicbcd(rk, s->rounds, s->ivec, p, m/AESbsize);
+		else
+			aesnicbce(rk, s->rounds, s->ivec, p, m/AESbsize);
+		sseoff(x);
+		p += m;
+		n -= m;
+	}
+	/* libsec's treatment of a short last block */
+	if(n > 0){
+		if(dec)
+			aesCBCdecrypt(p, n, s);
+		else
+			aesCBCencrypt(p, n, s);
+	}
+}
+
+static void
+aesnicbcenc(AESstate *s, uchar *p, long n)
+{
+	aesnicbc(s, p, n, 0);
+}
+
+static void
+aesnicbcdec(AESstate *s, uchar *p, long n)
+{
+	aesnicbc(s, p, n, 1);
+}
+
+/*
+ *  a burst of independent buffers, each led by its iv, with the
+ *  round keys converted once and the sse unit taken once a Chunk
+ */
+static void
+aesnicbcencn(AESstate *s, uchar **p, long *n, int nb)
+{
+	int i, x;
+	long m, k, done;
+	ulong buf[4*(AESmaxrounds+1)+4], *rk;
+	uchar iv[AESbsize], *q;
+
+	rk = aesnikeys(buf, s->ekey, s->rounds);
+	x = sseon();
+	done = 0;
+	for(i = 0; i < nb; i++){
+		memmove(iv, p[i], AESbsize);
+		q = p[i] + AESbsize;
+		m = n[i] - AESbsize;
+		while(m >= AESbsize){
+			k = m & ~(AESbsize-1);
+			if(k > Chunk)
+				k = Chunk;
+			if(done+k > Chunk){
+				sseoff(x);
+				x = sseon();
+				done = 0;
+			}
+			aesnicbce(rk, s->rounds, iv, q, k/AESbsize);
+			done += k;
+			q += k;
+			m -= k;
+		}
+		/* libsec's treatment of a short last block */
+		if(m > 0){
+			memmove(s->ivec, iv, AESbsize);
+			aesCBCencrypt(q, m, s);
+		}
+	}
+	sseoff(x);
+}
+
+static void
+aesniecbenc(AESstate *s, uchar *in, uchar *out, long nblk)
+{
+	int x;
+	long m;
+	ulong buf[4*(AESmaxrounds+1)+4], *rk;
+
+	rk = aesnikeys(buf, s->ekey, s->rounds);
+	while(nblk > 0){
+		m = nblk;
+		if(m > Chunk/AESbsize)
+			m = Chunk/AESbsize;
+		x = sseon();
+		aesniecb(rk, s->rounds, in, out, m);
+		sseoff(x);
+		in += m*AESbsize;
+		out += m*AESbsize;
+		nblk -= m;
+	}
+}
+
+static void
+aesnighash(Aesgcm *g, uchar *x, uchar *p, long nblk)
+{
+	int s;
+	long m;
+
+	while(nblk > 0){
+		m = nblk;
+		if(m > Chunk/AESbsize)
+			m = Chunk/AESbsize;
+		s = sseon();
+		pclmulgcm(x, g->h, p, m);
+		sseoff(s);
+		p += m*AESbsize;
+		nblk -= m;
+	}
+}
+
+void
+aesnilink(void)
+{
+	if((m->cpuidcx & Aesni) == 0 || (m->cpuiddx & Fxsr) == 0)
+		return;
+	aesniops.cbcenc = aesnicbcenc;
+	aesniops.cbcdec = aesnicbcdec;
+	aesniops.ecbenc = aesniecbenc;
+	aesniops.cbcencn = aesnicbcencn;
+	aesniops.ghash = aesops->ghash;
+	if(m->cpuidcx & Pclmul)
+		aesniops.ghash = aesnighash;
+	aesops = &aesniops;
+}
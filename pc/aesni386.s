@@ -0,0 +1,303 @@
+/*
+ * AES and GHASH on the AES-NI and PCLMULQDQ instructions,
+ * which 8a does not know.  Round keys are at (DI), byte order
+ * as the instructions want them and 16-byte aligned; data
+ * need not be.  The caller owns the sse registers.
+ */
+
+#define	RR(d, s)	BYTE $(0xC0|((d)<<3)|(s))
+#define	MDI(x)		BYTE $(((x)<<3)|7)			/* (DI) */
+#define	MAX(x)		BYTE $(((x)<<3)|0)			/* (AX) */
+#define	MDX(x)		BYTE $(((x)<<3)|2)			/* (DX) */
+#define	MSI(x, o)	BYTE $(0x40|((x)<<3)|6); BYTE $(o)	/* o(SI) */
+#define	MBX(x, o)	BYTE $(0x40|((x)<<3)|3); BYTE $(o)	/* o(BX) */
+
+#define	OP66		BYTE $0x66; BYTE $0x0F
+#define	AESENC		OP66; BYTE $0x38; BYTE $0xDC
+#define	AESENCLAST	OP66; BYTE $0x38; BYTE $0xDD
+#define	AESDEC		OP66; BYTE $0x38; BYTE $0xDE
+#define	AESDECLAST	OP66; BYTE $0x38; BYTE $0xDF
+#define	PSHUFB		OP66; BYTE $0x38; BYTE $0x00
+#define	PCLMULQDQ	OP66; BYTE $0x3A; BYTE $0x44		/* modrm, then imm */
+#define	PXOR		OP66; BYTE $0xEF
+#define	POR		OP66; BYTE $0xEB
+#define	MOVDQA		OP66; BYTE $0x6F			/* register to register */
+#define	MOVDQUL		BYTE $0xF3; BYTE $0x0F; BYTE $0x6F	/* load */
+#define	MOVDQUS		BYTE $0xF3; BYTE $0x0F; BYTE $0x7F	/* store */
+
+#define	PSLLD(x, n)	OP66; BYTE $0x72; RR(6, x); BYTE $(n)
+#define	PSRLD(x, n)	OP66; BYTE $0x72; RR(2, x); BYTE $(n)
+#define	PSLLDQ(x, n)	OP66; BYTE $0x73; RR(7, x); BYTE $(n)
+#define	PSRLDQ(x, n)	OP66; BYTE $0x73; RR(3, x); BYTE $(n)
+
+/*
+ * aesniecb(rk, nr, in, out, nblk): encrypt nblk blocks,
+ * four at a time while there are four
+ */
+TEXT aesniecb(SB), $0
+	MOVL	in+8(FP), SI
+	MOVL	out+12(FP), BX
+	MOVL	nblk+16(FP), CX
+_enc4:
+	CMPL	CX, $4
+	JLT	_enc1
+	MOVDQUL; MSI(0, 0)
+	MOVDQUL; MSI(1, 16)
+	MOVDQUL; MSI(2, 32)
+	MOVDQUL; MSI(3, 48)
+	MOVL	rk+0(FP), DI
+	PXOR; MDI(0)
+	PXOR; MDI(1)
+	PXOR; MDI(2)
+	PXOR; MDI(3)
+	MOVL	nr+4(FP), DX
+	DECL	DX
+_enc4round:
+	ADDL	$16, DI
+	AESENC; MDI(0)
+	AESENC; MDI(1)
+	AESENC; MDI(2)
+	AESENC; MDI(3)
+	DECL	DX
+	JNE	_enc4round
+	ADDL	$16, DI
+	AESENCLAST; MDI(0)
+	AESENCLAST; MDI(1)
+	AESENCLAST; MDI(2)
+	AESENCLAST; MDI(3)
+	MOVDQUS; MBX(0, 0)
+	MOVDQUS; MBX(1, 16)
+	MOVDQUS; MBX(2, 32)
+	MOVDQUS; MBX(3, 48)
+	ADDL	$64, SI
+	ADDL	$64, BX
+	SUBL	$4, CX
+	JMP	_enc4
+_enc1:
+	TESTL	CX, CX
+	JEQ	_encdone
+	MOVDQUL; MSI(0, 0)
+	MOVL	rk+0(FP), DI
+	PXOR; MDI(0)
+	MOVL	nr+4(FP), DX
+	DECL	DX
+_enc1round:
+	ADDL	$16, DI
+	AESENC; MDI(0)
+	DECL	DX
+	JNE	_enc1round
+	ADDL	$16, DI
+	AESENCLAST; MDI(0)
+	MOVDQUS; MBX(0, 0)
+	ADDL	$16, SI
+	ADDL	$16, BX
+	DECL	CX
+	JMP	_enc1
+_encdone:
+	RET
+
+/*
+ * aesnicbce(rk, nr, iv, p, nblk): cbc encrypt in place;
+ * X1 carries the chain and goes back to iv
+ */
+TEXT aesnicbce(SB), $0
+	MOVL	iv+8(FP), AX
+	MOVL	p+12(FP), SI
+	MOVL	nblk+16(FP), CX
+	MOVDQUL; MAX(1)
+_cbce:
+	TESTL	CX, CX
+	JEQ	_cbcedone
+	MOVDQUL; MSI(0, 0)
+	PXOR; RR(0, 1)
+	MOVL	rk+0(FP), DI
+	PXOR; MDI(0)
+	MOVL	nr+4(FP), DX
+	DECL	DX
+_cbceround:
+	ADDL	$16, DI
+	AESENC; MDI(0)
+	DECL	DX
+	JNE	_cbceround
+	ADDL	$16, DI
+	AESENCLAST; MDI(0)
+	MOVDQA; RR(1, 0)
+	MOVDQUS; MSI(0, 0)
+	ADDL	$16, SI
+	DECL	CX
+	JMP	_cbce
+_cbcedone:
+	MOVDQUS; MAX(1)
+	RET
+
+/*
+ * aesnicbcd(rk, nr, iv, p, nblk): cbc decrypt in place with
+ * the decryption schedule; X4 carries the chain, X5 is scratch
+ */
+TEXT aesnicbcd(SB), $0
+	MOVL	iv+8(FP), AX
+	MOVL	p+12(FP), SI
+	MOVL	nblk+16(FP), CX
+	MOVDQUL; MAX(4)
+_cbcd4:
+	CMPL	CX, $4
+	JLT	_cbcd1
+	MOVDQUL; MSI(0, 0)
+	MOVDQUL; MSI(1, 16)
+	MOVDQUL; MSI(2, 32)
+	MOVDQUL; MSI(3, 48)
+	MOVL	rk+0(FP), DI
+	PXOR; MDI(0)
+	PXOR; MDI(1)
+	PXOR; MDI(2)
+	PXOR; MDI(3)
+	MOVL	nr+4(FP), DX
+	DECL	DX
+_cbcd4round:
+	ADDL	$16, DI
+	AESDEC; MDI(0)
+	AESDEC; MDI(1)
+	AESDEC; MDI(2)
+	AESDEC; MDI(3)
+	DECL	DX
+	JNE	_cbcd4round
+	ADDL	$16, DI
+	AESDECLAST; MDI(0)
+	AESDECLAST; MDI(1)
+	AESDECLAST; MDI(2)
+	AESDECLAST; MDI(3)
+	PXOR; RR(0, 4)
+	MOVDQUL; MSI(5, 0)
+	PXOR; RR(1, 5)
+	MOVDQUL; MSI(5, 16)
+	PXOR; RR(2, 5)
+	MOVDQUL; MSI(5, 32)
+	PXOR; RR(3, 5)
+	MOVDQUL; MSI(4, 48)
+	MOVDQUS; MSI(0, 0)
+	MOVDQUS; MSI(1, 16)
+	MOVDQUS; MSI(2, 32)
+	MOVDQUS; MSI(3, 48)
+	ADDL	$64, SI
+	SUBL	$4, CX
+	JMP	_cbcd4
+_cbcd1:
+	TESTL	CX, CX
+	JEQ	_cbcddone
+	MOVDQUL; MSI(0, 0)
+	MOVDQA; RR(5, 0)
+	MOVL	rk+0(FP), DI
+	PXOR; MDI(0)
+	MOVL	nr+4(FP), DX
+	DECL	DX
+_cbcd1round:
+	ADDL	$16, DI
+	AESDEC; MDI(0)
+	DECL	DX
+	JNE	_cbcd1round
+	ADDL	$16, DI
+	AESDECLAST; MDI(0)
+	PXOR; RR(0, 4)
+	MOVDQA; RR(4, 5)
+	MOVDQUS; MSI(0, 0)
+	ADDL	$16, SI
+	DECL	CX
+	JMP	_cbcd1
+_cbcddone:
+	MOVDQUS; MAX(4)
+	RET
+
+/*
+ * pclmulgcm(x, h, p, nblk): x = (x^p[i])·h for each block,
+ * after Gueron and Kounavis, "Intel carry-less multiplication
+ * instruction and its usage for computing the GCM mode".
+ * Values are kept byte-reflected; X7 holds the shuffle.
+ */
+TEXT pclmulgcm(SB), $0
+	MOVL	$bswap<>(SB), DX
+	MOVDQUL; MDX(7)
+	MOVL	h+4(FP), AX
+	MOVDQUL; MAX(1)
+	PSHUFB; RR(1, 7)
+	MOVL	x+0(FP), AX
+	MOVDQUL; MAX(0)
+	PSHUFB; RR(0, 7)
+	MOVL	p+8(FP), SI
+	MOVL	nblk+12(FP), CX
+_ghash:
+	TESTL	CX, CX
+	JEQ	_ghashdone
+	MOVDQUL; MSI(2, 0)
+	PSHUFB; RR(2, 7)
+	PXOR; RR(0, 2)
+
+	/* 256-bit product in X3:X2 */
+	MOVDQA; RR(2, 0)
+	PCLMULQDQ; RR(2, 1); BYTE $0x00
+	MOVDQA; RR(3, 0)
+	PCLMULQDQ; RR(3, 1); BYTE $0x11
+	MOVDQA; RR(4, 0)
+	PCLMULQDQ; RR(4, 1); BYTE $0x10
+	MOVDQA; RR(5, 0)
+	PCLMULQDQ; RR(5, 1); BYTE $0x01
+	PXOR; RR(4, 5)
+	MOVDQA; RR(5, 4)
+	PSLLDQ(5, 8)
+	PSRLDQ(4, 8)
+	PXOR; RR(2, 5)
+	PXOR; RR(3, 4)
+
+	/* shift left one bit for the reflection */
+	MOVDQA; RR(4, 2)
+	PSRLD(4, 31)
+	MOVDQA; RR(5, 3)
+	PSRLD(5, 31)
+	PSLLD(2, 1)
+	PSLLD(3, 1)
+	MOVDQA; RR(0, 4)
+	PSRLDQ(0, 12)
+	PSLLDQ(5, 4)
+	PSLLDQ(4, 4)
+	POR; RR(2, 4)
+	POR; RR(3, 5)
+	POR; RR(3, 0)
+
+	/* reduce modulo x^128+x^7+x^2+x+1 */
+	MOVDQA; RR(4, 2)
+	PSLLD(4, 31)
+	MOVDQA; RR(5, 2)
+	PSLLD(5, 30)
+	MOVDQA; RR(0, 2)
+	PSLLD(0, 25)
+	PXOR; RR(4, 5)
+	PXOR; RR(4, 0)
+	MOVDQA; RR(5, 4)
+	PSRLDQ(5, 4)
+	PSLLDQ(4, 12)
+	PXOR; RR(2, 4)
+	MOVDQA; RR(0, 2)
+	PSRLD(0, 1)
+	MOVDQA; RR(4, 2)
+	PSRLD(4, 2)
+	MOVDQA; RR(6, 2)
+	PSRLD(6, 7)
+	PXOR; RR(0, 4)
+	PXOR; RR(0, 6)
+	PXOR; RR(0, 5)
+	PXOR; RR(2, 0)
+	PXOR; RR(3, 2)
+	MOVDQA; RR(0, 3)
+
+	ADDL	$16, SI
+	DECL	CX
+	JMP	_ghash
+_ghashdone:
+	PSHUFB; RR(0, 7)
+	MOVDQUS; MAX(0)
+	RET
+
+DATA	bswap<>+0(SB)/4, $0x0C0D0E0F
+DATA	bswap<>+4(SB)/4, $0x08090A0B
+DATA	bswap<>+8(SB)/4, $0x04050607
+DATA	bswap<>+12(SB)/4, $0x00010203
+GLOBL	bswap<>(SB), $16
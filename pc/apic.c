@@ -388,10 +388,11 @@ lapictimerset(uvlong next)
 			panic("lapictimerset: zero lapictimer.div");
 		period /= lapictimer.div;
 
+		/* a tickless idle processor may sleep for up to a second */
 		if(period < lapictimer.min)
 			period = lapictimer.min;
-		else if(period > lapictimer.max - lapictimer.min)
-			period = lapictimer.max;
+		else if(period > lapictimer.hz)
+			period = lapictimer.hz;
 	}
 	lapicw(LapicTICR, period);
 
@@ -26,6 +26,8 @@ PCArch archmp = {
 .reset=		mpshutdown,
 .intrinit=	mpinit,
 .intrenable=	mpintrenable,
+.intrmsi=	mpintrmsi,
+.intraffinity=	mpintraffinity,
 .intron=	lapicintron,
 .introff=	lapicintroff,
 .fastclock=	i8253read,
@@ -76,39 +78,67 @@ identify(void)
 	if(sum || (pcmp->version != 1 && pcmp->version != 4))
 		return 1;
 
-	if(cpuserver && m->havetsc)
+	if(m->havetsc && (cpuserver || m->tscinvariant))
 		archmp.fastclock = tscticks;
 	return 0;
 }
 
 Lock mpsynclock;
 
+/*
+ * An invariant tsc is never written: firmware has usually
+ * started them together, so a processor within a couple of µs
+ * of cpu0 (about what the handshake costs) is taken as being in
+ * step, and any other gets an offset.  Only if all are in step
+ * can user processes read the time from the time page.
+ */
 void
 syncclock(void)
 {
-	uvlong x;
+	uvlong x, t;
+	vlong d, slop;
 
 	if(arch->fastclock != tscticks)
 		return;
 
 	if(m->machno == 0){
-		wrmsr(0x10, 0);
+		if(!m->tscinvariant)
+			wrmsr(0x10, 0);
+		m->tscoff = 0;
 		m->tscticks = 0;
+		todfastuser = m->tscinvariant;
 	} else {
 		x = MACHP(0)->tscticks;
 		while(x == MACHP(0)->tscticks)
 			;
-		wrmsr(0x10, MACHP(0)->tscticks);
-		cycles(&m->tscticks);
+		if(m->tscinvariant && MACHP(0)->tscinvariant){
+			cycles(&t);
+			d = t - MACHP(0)->tscticks;
+			slop = 2*MACHP(0)->cpuhz/1000000;
+			if(d > -slop && d < slop)
+				d = 0;
+			else
+				todfastuser = 0;
+			m->tscoff = d;
+		} else {
+			wrmsr(0x10, MACHP(0)->tscticks);
+			todfastuser = 0;
+		}
+		tscticks(nil);
 	}
 }
 
 uvlong
 tscticks(uvlong *hz)
 {
-	if(hz != nil)
-		*hz = m->cpuhz;
+	if(hz != nil){
+		if(m->tscinvariant)
+			*hz = MACHP(0)->cpuhz;	/* calibrated once */
+		else
+			*hz = m->cpuhz;
+	}
 
 	cycles(&m->tscticks);	/* Uses the rdtsc instruction */
+	m->tscticks -= m->tscoff;
 	return m->tscticks;
 }
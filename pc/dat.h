@@ -152,6 +152,8 @@ struct PMMU
 	Page*	kmaptable;		/* page table used by kmap */
 	uint	lastkmap;		/* last entry used by kmap */
 	int	nkmap;			/* number of current kmaps */
+	ulong	mmubig[1024/32];	/* pdes mapping a 4MB user page */
+	int	nmmubig;
 };
 
 /*
@@ -246,12 +248,15 @@ struct Mach
 	uvlong	cyclefreq;		/* Frequency of user readable cycle counter */
 	uvlong	cpuhz;
 	int	cpuidax;
+	int	cpuidcx;
 	int	cpuiddx;
 	char	cpuidid[16];
 	char*	cpuidtype;
 	int	havetsc;
 	int	havepge;
 	uvlong	tscticks;
+	int	tscinvariant;		/* constant rate, runs in all C-states */
+	vlong	tscoff;			/* subtracted to agree with cpu0 */
 	int	pdballoc;
 	int	pdbfree;
 	FPsave	*fpsavalign;
@@ -295,6 +300,8 @@ struct PCArch
 
 	void	(*intrinit)(void);
 	int	(*intrenable)(Vctl*);
+	int	(*intrmsi)(Vctl*, int, ulong*);	/* vector and address for an msi */
+	int	(*intraffinity)(Vctl*, int, int);	/* steer vector to a processor */
 	int	(*intrvecno)(int);
 	int	(*intrdisable)(int);
 	void	(*introff)(void);
@@ -319,14 +326,21 @@ enum {
 	Mce	= 1<<7,		/* machine-check exception */
 	Cmpxchg8b = 1<<8,
 	Cpuapic	= 1<<9,
+	Sep	= 1<<11,	/* sysenter/sysexit */
 	Mtrr	= 1<<12,	/* memory-type range regs.  */
 	Pge	= 1<<13,	/* page global extension */
+	Pat	= 1<<16,	/* page attribute table */
 	Pse2	= 1<<17,	/* more page size extensions */
 	Clflush = 1<<19,
 	Mmx	= 1<<23,
 	Fxsr	= 1<<24,	/* have SSE FXSAVE/FXRSTOR */
 	Sse	= 1<<25,	/* thus sfence instr. */
 	Sse2	= 1<<26,	/* thus mfence & lfence instr.s */
+
+	/* cx */
+	Pclmul	= 1<<1,		/* carry-less multiply */
+	Aesni	= 1<<25,	/* aes round instructions */
+	Rdrnd	= 1<<30,	/* hardware random numbers */
 };
 
 /*
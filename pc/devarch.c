@@ -49,6 +49,11 @@ enum {				/* cpuid standard function codes */
 	Procserial,
 };
 
+enum {				/* cpuid extended function codes */
+	Exthighfunc = 1ul << 31,
+	Extpowermgmt = Exthighfunc|7,
+};
+
 typedef long Rdwrfn(Chan*, void*, long, vlong);
 
 static Rdwrfn *readfn[Qmax];
@@ -761,6 +766,7 @@ cpuidentify(void)
 
 	cpuid(Procsig, regs);
 	m->cpuidax = regs[0];
+	m->cpuidcx = regs[2];
 	m->cpuiddx = regs[3];
 
 	if(strncmp(m->cpuidid, "AuthenticAMD", 12) == 0 ||
@@ -789,10 +795,19 @@ cpuidentify(void)
 	if(m->cpuiddx & Tsc){
 		m->havetsc = 1;
 		cycles = _cycles;
-		if(m->cpuiddx & Cpumsr)
+		cpuid(Exthighfunc, regs);
+		if(regs[0] >= Extpowermgmt){
+			cpuid(Extpowermgmt, regs);
+			m->tscinvariant = (regs[3] & (1<<8)) != 0;
+		}
+		/* resetting an invariant tsc would only put it out of step */
+		if(!m->tscinvariant && (m->cpuiddx & Cpumsr))
 			wrmsr(0x10, 0);
 	}
 
+	if(m->cpuidcx & Rdrnd)
+		hwrandom = rdrand;
+
 	/*
 	 *  use i8253 to guess our cpu speed
 	 */
@@ -904,6 +919,7 @@ archctlread(Chan*, void *a, long nn, vlong offset)
 	p = seprint(p, ep, "i8253set %s\n", doi8253set ? "on" : "off");
 	n = p - buf;
 	n += mtrrprint(p, ep - p);
+	n += mmubigprint(buf + n, ep - (buf + n));
 	buf[n] = '\0';
 
 	n = readstr(offset, a, nn, buf);
@@ -130,13 +130,45 @@ etherrtrace(Netfile* f, Etherpkt* pkt, int len)
 	qpass(f->in, bp);
 }
 
-Block*
-etheriq(Ether* ether, Block* bp, int fromwire)
+/*
+ *  packets demultiplexed from a receive loop but not yet passed
+ *  to their Netfiles, so each file gets them under one lock
+ */
+typedef struct Etherbatch Etherbatch;
+struct Etherbatch {
+	Netfile	*f[Ntypes];
+	Block	*head[Ntypes];
+	Block	*tail[Ntypes];
+	int	n[Ntypes];
+};
+
+static void
+etherpass(Ether* ether, Netfile **fp, Block* bp, Etherbatch* eb)
+{
+	int i;
+
+	if(eb == nil){
+		if(qpass((*fp)->in, bp) < 0)
+			ether->soverflows++;
+		return;
+	}
+	i = fp - ether->f;
+	eb->f[i] = *fp;
+	if(eb->head[i] == nil)
+		eb->head[i] = bp;
+	else
+		eb->tail[i]->next = bp;
+	eb->tail[i] = bp;
+	eb->n[i]++;
+}
+
+static Block*
+etherdemux(Ether* ether, Block* bp, int fromwire, Etherbatch* eb)
 {
 	Etherpkt *pkt;
 	ushort type;
 	int len, multi, tome, fromme;
-	Netfile **ep, *f, **fp, *fx;
+	Netfile **ep, *f, **fp, **fx;
 	Block *xbp;
 
 	ether->inpackets++;
@@ -167,7 +199,8 @@ etheriq(Ether* ether, Block* bp, int fromwire)
 	 * Multiplex the packet to all the connections which want it.
 	 * If the packet is not to be used subsequently (fromwire != 0),
 	 * attempt to simply pass it into one of the connections, thereby
-	 * saving a copy of the data (usual case hopefully).
+	 * saving a copy of the data (usual case hopefully), and give any
+	 * others a Block sharing its buffer, which they only read.
 	 */
 	for(fp = ether->f; fp < ep; fp++){
 		if(f = *fp)
@@ -178,14 +211,13 @@ etheriq(Ether* ether, Block* bp, int fromwire)
 				continue;
 			if(!f->headersonly){
 				if(fromwire && fx == 0)
-					fx = f;
+					fx = fp;
+				else if(fromwire && (xbp = shareblock(bp, bp->rp, bp->wp)) != nil)
+					etherpass(ether, fp, xbp, eb);
 				else if(xbp = iallocb(len)){
 					memmove(xbp->wp, pkt, len);
 					xbp->wp += len;
-					if(qpass(f->in, xbp) < 0){
-						// print("soverflow for f->in\n");
-						ether->soverflows++;
-					}
+					etherpass(ether, fp, xbp, eb);
 				}
 				else{
 					// print("soverflow iallocb\n");
@@ -198,10 +230,7 @@ etheriq(Ether* ether, Block* bp, int fromwire)
 	}
 
 	if(fx){
-		if(qpass(fx->in, bp) < 0){
-			// print("soverflow for fx->in\n");
-			ether->soverflows++;
-		}
+		etherpass(ether, fx, bp, eb);
 		return 0;
 	}
 	if(fromwire){
@@ -212,6 +241,218 @@ etheriq(Ether* ether, Block* bp, int fromwire)
 	return bp;
 }
 
+Block*
+etheriq(Ether* ether, Block* bp, int fromwire)
+{
+	return etherdemux(ether, bp, fromwire, nil);
+}
+
+/*
+ *  tcp segments of one flow that arrive in a row, in order and
+ *  with checksums the hardware has checked, go up to ip as one
+ *  packet.  Only plain ones coalesce: ipv4 without options or
+ *  fragments carrying tcp without options, flagged ack and at
+ *  most a final psh.  The packet grows in the first one's buffer
+ *  if there is room, else in a new Block.
+ */
+enum {
+	Grosize	= 9*1024,		/* allocb's largest cached size */
+	Groip	= ETHERHDRSIZE,		/* offset of the ip header */
+	Grotcp	= Groip+20,		/* of the tcp header */
+	Grodata	= Grotcp+20,		/* of the payload */
+};
+
+/* tcp payload of a packet that might coalesce, else 0 */
+static int
+grolen(Block *bp)
+{
+	uchar *p;
+	int len;
+
+	if((bp->flag & (Bipck|Btcpck)) != (Bipck|Btcpck) || BLEN(bp) < Grodata)
+		return 0;
+	p = bp->rp;
+	if(p[12] != 0x08 || p[13] != 0x00 || p[Groip] != 0x45 || p[Groip+9] != 6)
+		return 0;
+	if((p[Groip+6] & 0x3F) != 0 || p[Groip+7] != 0)
+		return 0;		/* a fragment */
+	if(p[Grotcp+12] != 0x50 || (p[Grotcp+13] & ~0x08) != 0x10 || p[Grotcp+18] || p[Grotcp+19])
+		return 0;		/* options, flags other than ack and psh, or urgent */
+	len = (p[Groip+2]<<8 | p[Groip+3]) - (Grodata-Groip);
+	if(len <= 0 || Grodata + len > BLEN(bp))
+		return 0;
+	return len;
+}
+
+/* can bp's len bytes follow the n in h? */
+static int
+grofollows(Block *h, int n, Block *bp, int len)
+{
+	uchar *p, *q;
+
+	p = h->rp;
+	q = bp->rp;
+	return Grodata + n + len <= Grosize
+		&& p[Grotcp+13] == 0x10		/* no psh yet */
+		&& p[Groip+1] == q[Groip+1]
+		&& memcmp(p+Groip+12, q+Groip+12, 8+4) == 0	/* addresses and ports */
+		&& memcmp(p+Grotcp+8, q+Grotcp+8, 4) == 0	/* ack */
+		&& nhgetl(p+Grotcp+4) + n == nhgetl(q+Grotcp+4);
+}
+
+static void
+groipsum(uchar *ip)
+{
+	ulong sum;
+	int i;
+
+	ip[10] = ip[11] = 0;
+	sum = 0;
+	for(i = 0; i < 20; i += 2)
+		sum += ip[i]<<8 | ip[i+1];
+	while(sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = ~sum;
+	ip[10] = sum>>8;
+	ip[11] = sum;
+}
+
+/* coalesce a Netfile's list of packets, adjusting its count in *np */
+static Block*
+ethercoalesce(Block* bp, int* np)
+{
+	Block *first, **l, *h, *nb, *next;
+	int n, len;
+	uchar *p;
+
+	first = nil;
+	l = &first;
+	h = nil;
+	n = 0;
+	for(; bp != nil; bp = next){
+		next = bp->next;
+		bp->next = nil;
+		len = grolen(bp);
+		if(h == nil || n == 0 || len == 0 || !grofollows(h, n, bp, len)){
+			/* starts a packet of its own */
+			if(h != nil)
+				l = &h->next;
+			*l = h = bp;
+			n = len;
+			continue;
+		}
+		/* grow in place only in a buffer no other Block shares */
+		if(h->ref > 1 || h->lim - h->rp < Grodata + n + len){
+			if((nb = iallocb(Grosize)) == nil){
+				l = &h->next;
+				*l = h = bp;
+				n = len;
+				continue;
+			}
+			memmove(nb->wp, h->rp, Grodata + n);
+			nb->flag |= Bipck|Btcpck;
+			freeb(h);
+			*l = h = nb;
+		}
+		h->wp = h->rp + Grodata + n;
+		h->flag &= ~Bpktck;
+		memmove(h->wp, bp->rp + Grodata, len);
+		h->wp += len;
+		n += len;
+		p = h->rp;
+		p[Groip+2] = (Grodata-Groip + n)>>8;
+		p[Groip+3] = Grodata-Groip + n;
+		groipsum(p+Groip);
+		p[Grotcp+13] = bp->rp[Grotcp+13];
+		memmove(p+Grotcp+14, bp->rp+Grotcp+14, 2);	/* window */
+		freeb(bp);
+		(*np)--;
+	}
+	return first;
+}
+
+/*
+ *  etheriq for a list of packets from the wire, linked by next,
+ *  passing each Netfile its share of them at once
+ */
+void
+etheriqlist(Ether* ether, Block* bp)
+{
+	Etherbatch eb;
+	Block *next;
+	int i;
+
+	memset(&eb, 0, sizeof eb);
+	for(; bp != nil; bp = next){
+		next = bp->next;
+		bp->next = nil;
+		etherdemux(ether, bp, 1, &eb);
+	}
+	for(i = 0; i < Ntypes; i++){
+		if(eb.head[i] == nil)
+			continue;
+		if(eb.f[i]->type == 0x800)	/* ipv4 */
+			eb.head[i] = ethercoalesce(eb.head[i], &eb.n[i]);
+		if(qpass(eb.f[i]->in, eb.head[i]) < 0)
+			ether->soverflows += eb.n[i];
+	}
+}
+
+/*
+ *  poll mode for rx kprocs.  Having taken n packets with the
+ *  rx interrupt still masked, keep polling if there were any,
+ *  yielding between passes; only an empty pass turns the
+ *  interrupt back on.  Drivers take at most budget per pass.
+ */
+int
+etherpoll(Etherpoll* p, int n)
+{
+	p->npkt += n;
+	if(n == 0)
+		return 0;
+	p->polls++;
+	yield();
+	return 1;
+}
+
+/*
+ *  adaptive interrupt moderation: from the packets counted by
+ *  etherpoll, pick an interrupt rate every Itrms.  When quiet
+ *  there is no moderation, to keep latency down; as the rate
+ *  climbs, fewer interrupts each drain more.  Returns the new
+ *  interrupts per second, 0 for unmoderated, or -1 if unchanged.
+ */
+enum {
+	Itrms	= 50,
+	Itrlow	= 10000,		/* packets/s below which not to moderate */
+	Itrhigh	= 100000,		/* and above which to moderate most */
+};
+
+int
+etheritr(Etherpoll* p)
+{
+	ulong now, ms;
+	int ips;
+
+	now = TK2MS(MACHP(0)->ticks);
+	ms = now - p->last;
+	if(ms < Itrms)
+		return -1;
+	p->rate = (3*p->rate + (uvlong)p->npkt*1000/ms) / 4;
+	p->last = now;
+	p->npkt = 0;
+	if(p->rate < Itrlow)
+		ips = 0;
+	else if(p->rate < Itrhigh)
+		ips = 20000;
+	else
+		ips = 8000;
+	if(ips == p->ips)
+		return -1;
+	p->ips = ips;
+	return ips;
+}
+
 static int
 etheroq(Ether* ether, Block* bp)
 {
@@ -317,7 +558,7 @@ etherbwrite(Chan* chan, Block* bp, ulong)
 	}
 	ether = etherxx[chan->dev];
 
-	if(n > ether->mtu){
+	if(n > ether->mtu && ((bp->flag & Btso) == 0 || n > ether->tso)){
 		freeb(bp);
 		error(Etoobig);
 	}
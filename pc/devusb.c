@@ -742,6 +742,20 @@ usbreset(void)
 		print("usbreset: bug: Nhcis (%d) too small\n", Nhcis);
 }
 
+static void
+hciinit(void *a)
+{
+	Hci *hp;
+
+	hp = a;
+	hp->init(hp);
+}
+
+/*
+ * the controllers are started in order, as before, but by a kproc
+ * while other devices are probed.  the root hubs are made here
+ * so that they are numbered in controller order.
+ */
 static void
 usbinit(void)
 {
@@ -755,7 +769,7 @@ usbinit(void)
 		hp = hcis[ctlrno];
 		if(hp != nil){
 			if(hp->init != nil)
-				hp->init(hp);
+				devasync("usb", hciinit, hp, "usb");
 			d = newdev(hp, 1, 1);		/* new root hub */
 			d->dev->state = Denabled;	/* although addr == 0 */
 			d->maxpkt = 64;
@@ -369,6 +369,7 @@ enum {					/* Tdesc control */
 	PtypeIP		= 0x02000000,	/* IP Packet Type (CD) */
 	Ifcs		= 0x02000000,	/* Insert FCS (DD) */
 	Tse		= 0x04000000,	/* TCP Segmentation Enable */
+	Ic		= 0x04000000,	/* Insert Checksum (legacy DD) */
 	Rs		= 0x08000000,	/* Report Status */
 	Rps		= 0x10000000,	/* Report Status Sent */
 	Dext		= 0x20000000,	/* Descriptor Extension */
@@ -893,7 +894,7 @@ i82563transmit(Ether* edev)
 	Td *td;
 	Block *bp;
 	Ctlr *ctlr;
-	int tdh, tdt, m;
+	int tdh, tdt, m, css;
 
 	ctlr = edev->ctlr;
 
@@ -920,6 +921,13 @@ i82563transmit(Ether* edev)
 		td = &ctlr->tdba[tdt];
 		td->addr[0] = PCIWADDR(bp->rp);
 		td->control = Ide|Rs|Ifcs|Teop|BLEN(bp);
+		td->status = 0;
+		if(bp->flag & Bcsum){
+			/* the hardware sums from css to the end, into cso */
+			css = ETHERHDRSIZE + ((bp->rp[ETHERHDRSIZE] & 0xF)<<2);
+			td->control |= Ic | (css + (bp->rp[ETHERHDRSIZE+9] == 6? 16: 6))<<16;
+			td->status = css<<8;
+		}
 		ctlr->tb[tdt] = bp;
 		tdt = Next(tdt, m);
 	}
@@ -1737,6 +1745,7 @@ pnp(Ether* edev, int type)
 	edev->tbdf = ctlr->pcidev->tbdf;
 	edev->mbps = 1000;
 	edev->maxmtu = ctlr->rbsz;
+	edev->csum = 1;
 	memmove(edev->ea, ctlr->ra, Eaddrlen);
 
 	/*
@@ -23,8 +23,13 @@ enum {
 
 	/* tunable parameters */
 	Nrd	= 256,		/* multiple of 8, power of 2 for NEXTPOW2 */
+	Nrq	= 4,		/* most rx queues; no more than conf.nmach used */
 	Nrb	= 1024,
 	Ntd	= 128,		/* multiple of 8, power of 2 for NEXTPOW2 */
+	Rbatch	= 32,		/* received packets passed up at once */
+	Tsobuf	= 16*1024,	/* most data per tso descriptor */
+	Tsomax	= 64*1024,	/* largest tso frame */
+	Ntsod	= 1 + Tsomax/Tsobuf + 1,	/* descriptors one takes */
 	Goslow	= 0,		/* flag: go slow by throttling intrs, etc. */
 };
 
@@ -103,7 +108,7 @@ enum {
 	Imirext		= 0x05aa0/4,	/* immediate irq rx ext (598 only) */
 	Imirvp		= 0x05ac0/4,	/* immediate irq vlan priority (598 only) */
 	Reta		= 0x05c00/4,	/* redirection table */
-	Rssrk		= 0x05c80/4,	/* rss random key */
+	Rssrk		= 0x05c80/4,	/* rss random key (0-9) */
 
 	/* tx */
 	Tdbal		= 0x06000/4,	/* tx desc base low +0x40n array */
@@ -177,13 +182,22 @@ enum {
 	/* Rxcsum */
 	Ippcse		= 1<<12,	/* ip payload checksum enable */
 
+	/* Mrqc */
+	Mrqrss		= 1<<0,		/* rss only */
+	Rsstcp4		= 1<<16,	/* hash tcp/ipv4 ports */
+	Rssip4		= 1<<17,
+	Rssip6		= 1<<20,
+	Rsstcp6		= 1<<21,
+
 	/* Eerd */
 	EEstart		= 1<<0,		/* Start Read */
 	EEdone		= 1<<1,		/* Read done */
 
-	/* interrupts */
-	Irx0		= 1<<0,		/* driver defined */
-	Itx0		= 1<<1,		/* driver defined */
+	/* interrupts; causes 0-15 are mapped from queues by Ivar */
+	Vrx0		= 0,		/* driver defined; rx queue n is Vrx0+n */
+	Vtx0		= 15,		/* driver defined */
+	Irx0		= 1<<Vrx0,
+	Itx0		= 1<<Vtx0,
 	Lsc		= 1<<20,	/* link status change */
 
 	/* Links */
@@ -204,6 +218,7 @@ enum {
 
 typedef struct Ctlr Ctlr;
 typedef struct Rd Rd;
+typedef struct Rxq Rxq;
 typedef struct Td Td;
 
 typedef struct {
@@ -291,6 +306,65 @@ struct Td {			/* Transmit Descriptor */
 	ushort	vlan;
 };
 
+/*
+ * tcp segmentation takes the advanced descriptors, which share
+ * the ring with the legacy ones: a context descriptor describing
+ * the headers, then data descriptors.  Tdd is in the same place.
+ */
+enum {
+	/* Tdctx tucmd and Tdadv cmd */
+	Dtypctx	= 2<<20,
+	Dtypdata= 3<<20,
+	Dext	= 1<<29,
+
+	/* Tdctx tucmd */
+	Tuipv4	= 1<<10,
+	Tutcp	= 1<<11,
+
+	/* Tdadv cmd */
+	Aeop	= 1<<24,
+	Aifcs	= 1<<25,
+	Ars	= 1<<27,
+	Atse	= 1<<31,
+
+	/* Tdadv olinfo */
+	Ixsm_	= 1<<8,		/* insert ip checksum */
+	Txsm	= 1<<9,		/* insert tcp checksum */
+	Paylenshift= 14,
+};
+
+typedef struct {		/* context descriptor */
+	u32int	maclen;		/* vlan, maclen<<9 | iplen */
+	u32int	seed;
+	u32int	tucmd;
+	u32int	mss;		/* mss<<16 | l4len<<8 */
+} Tdctx;
+
+typedef struct {		/* advanced data descriptor */
+	u32int	addr[2];
+	u32int	cmd;		/* cmd, type and length */
+	u32int	olinfo;		/* payload length, options and status */
+} Tdadv;
+
+/*
+ * rss spreads flows over the rx queues by the toeplitz hash
+ * of their addresses and ports; each queue has its own ring
+ * and kproc, wired to its own processor when there are enough.
+ */
+struct Rxq {
+	Ctlr	*ctlr;
+	int	n;			/* queue number */
+	Rendez	rendez;
+	uint	rim;
+
+	Rd*	rdba;			/* receive descriptor base address */
+	Block**	rb;			/* receive buffers */
+	int	rdt;			/* receive descriptor tail */
+	int	rdfree;			/* rx descriptors awaiting packets */
+};
+
+#define RXQREG(r, n)	((r) + (n)*0x40/4)	/* per-queue rx dma registers */
+
 struct Ctlr {
 	Pcidev	*p;
 	Ether	*edev;
@@ -317,23 +391,20 @@ struct Ctlr {
 	QLock	tlock;
 	Rendez	lrendez;
 	Rendez	trendez;
-	Rendez	rrendez;
 
 	uint	im;			/* interrupt mask */
 	uint	lim;
-	uint	rim;
 	uint	tim;
 	Lock	imlock;
 
-	Rd*	rdba;			/* receive descriptor base address */
-	Block**	rb;			/* receive buffers */
-	int	rdt;			/* receive descriptor tail */
-	int	rdfree;			/* rx descriptors awaiting packets */
+	int	nrq;			/* rx queues in use */
+	Rxq	rxq[Nrq];
 
 	Td*	tdba;			/* transmit descriptor base address */
 	int	tdh;			/* transmit descriptor head */
 	int	tdt;			/* transmit descriptor tail */
 	Block**	tb;			/* transmit buffers */
+	ushort*	tlast;			/* last descriptor of the packet at each */
 
 	uchar	ra[Eaddrlen];		/* receive address */
 	uchar	mta[128];		/* multicast table array */
@@ -388,8 +459,11 @@ ifstat(Ether *e, void *a, long n, ulong offset)
 	t = c->speeds;
 	p = seprint(p, q, "speeds: 0:%d 1000:%d 10000:%d\n", t[0], t[1], t[2]);
 	p = seprint(p, q, "mtu: min:%d max:%d\n", e->minmtu, e->maxmtu);
-	seprint(p, q, "rdfree %d rdh %d rdt %d\n", c->rdfree, c->reg[Rdt],
-		c->reg[Rdh]);
+	for(i = 0; i < c->nrq; i++)
+		p = seprint(p, q, "rxq %d: rdfree %d rdh %d rdt %d\n", i,
+			c->rxq[i].rdfree, c->reg[RXQREG(Rdh, i)],
+			c->reg[RXQREG(Rdt, i)]);
+	USED(p);
 	n = readstr(offset, a, n, s);
 	free(s);
 
@@ -472,20 +546,78 @@ static int
 cleanup(Ctlr *c, int tdh)
 {
 	Block *b;
-	uint m, n;
+	uint m, n, last;
 
 	m = c->ntd - 1;
-	while(c->tdba[n = NEXTPOW2(tdh, m)].status & Tdd){
-		tdh = n;
-		b = c->tb[tdh];
-		c->tb[tdh] = 0;
-		if (b)
-			freeb(b);
-		c->tdba[tdh].status = 0;
+	while(c->tdba[last = c->tlast[NEXTPOW2(tdh, m)]].status & Tdd){
+		do{
+			tdh = n = NEXTPOW2(tdh, m);
+			b = c->tb[n];
+			c->tb[n] = 0;
+			if (b)
+				freeb(b);
+			c->tdba[n].status = 0;
+		}while(n != last);
 	}
 	return tdh;
 }
 
+/*
+ * fill descriptors from tdt on for a tcp super-frame,
+ * returning the tdt after them.  the ip checksum is
+ * inserted, so it must start zero.
+ */
+static uint
+tsoput(Ctlr *c, Block *b, uint tdt)
+{
+	uint m, iplen, hlen, start, n, len;
+	uchar *ip;
+	uintptr pa;
+	Tdctx *x;
+	Tdadv *d;
+
+	m = c->ntd - 1;
+	ip = b->rp + ETHERHDRSIZE;
+	iplen = (ip[0] & 0xf) << 2;
+	hlen = (ip[iplen+12] >> 4) << 2;
+	ip[10] = ip[11] = 0;
+
+	start = tdt;
+	x = (Tdctx*)(c->tdba + tdt);
+	x->maclen = ETHERHDRSIZE<<9 | iplen;
+	x->seed = 0;
+	x->tucmd = Dtypctx | Dext | Tuipv4 | Tutcp;
+	x->mss = b->mss<<16 | hlen<<8;
+	c->tb[tdt] = 0;
+
+	pa = PCIWADDR(b->rp);
+	len = BLEN(b);
+	for(;;){
+		tdt = NEXTPOW2(tdt, m);
+		n = len;
+		if(n > Tsobuf)
+			n = Tsobuf;
+		d = (Tdadv*)(c->tdba + tdt);
+		d->addr[0] = pa;
+		d->addr[1] = 0;
+		d->cmd = n | Dtypdata | Dext | Aifcs | Atse;
+		if(tdt == NEXTPOW2(start, m))
+			d->olinfo = (BLEN(b) - ETHERHDRSIZE - iplen - hlen) << Paylenshift |
+				Ixsm_ | Txsm;
+		else
+			d->olinfo = 0;
+		c->tb[tdt] = 0;
+		pa += n;
+		len -= n;
+		if(len == 0)
+			break;
+	}
+	d->cmd |= Aeop | Ars;
+	c->tb[tdt] = b;
+	c->tlast[start] = tdt;
+	return NEXTPOW2(tdt, m);
+}
+
 void
 transmit(Ether *e)
 {
@@ -503,20 +635,35 @@ transmit(Ether *e)
 	tdt = c->tdt;
 	m = c->ntd - 1;
 	for(i = 0; ; i++){
-		if(NEXTPOW2(tdt, m) == tdh){	/* ring full? */
+		if(((tdh - tdt) & m) <= Ntsod){	/* ring full? */
 			ienable(c, Itx0);
 			break;
 		}
 		if((b = qget(e->oq)) == nil)
 			break;
 		assert(c->tdba != nil);
+		if(b->flag & Btso){
+			tdt = tsoput(c, b, tdt);
+			continue;
+		}
 		t = c->tdba + tdt;
 		t->addr[0] = PCIWADDR(b->rp);
+		t->addr[1] = 0;
 		t->length = BLEN(b);
+		t->cso = 0;
 		t->cmd = Ifcs | Teop;
 		if (!Goslow)
 			t->cmd |= Rs;
+		t->css = 0;
+		if(b->flag & Bcsum){
+			/* the hardware sums from css to the end, into cso */
+			t->css = ETHERHDRSIZE + ((b->rp[ETHERHDRSIZE] & 0xF)<<2);
+			t->cso = t->css + (b->rp[ETHERHDRSIZE+9] == 6? 16: 6);
+			t->cmd |= Ic;
+		}
+		t->vlan = 0;
 		c->tb[tdt] = b;
+		c->tlast[tdt] = tdt;
 		tdt = NEXTPOW2(tdt, m);
 	}
 	if(i) {
@@ -550,20 +697,63 @@ tproc(void *v)
 }
 
 static void
-rxinit(Ctlr *c)
+rxqinit(Rxq *q)
 {
-	int i, is598;
+	int i;
 	Block *b;
+	Ctlr *c;
 
-	c->reg[Rxctl] &= ~Rxen;
-	c->reg[Rxdctl] = 0;
+	c = q->ctlr;
+	c->reg[RXQREG(Rxdctl, q->n)] = 0;
 	for(i = 0; i < c->nrd; i++){
-		b = c->rb[i];
-		c->rb[i] = 0;
+		b = q->rb[i];
+		q->rb[i] = 0;
 		if(b)
 			freeb(b);
 	}
-	c->rdfree = 0;
+	q->rdfree = 0;
+	coherence();
+
+	c->reg[Srrctl + q->n] = (c->rbsz + 1024 - 1) / 1024;
+	c->reg[RXQREG(Rbal, q->n)] = PCIWADDR(q->rdba);
+	c->reg[RXQREG(Rbah, q->n)] = 0;
+	c->reg[RXQREG(Rdlen, q->n)] = c->nrd*sizeof(Rd);	/* must be multiple of 128 */
+	c->reg[RXQREG(Rdh, q->n)] = 0;
+	c->reg[RXQREG(Rdt, q->n)] = q->rdt = 0;
+	coherence();
+}
+
+static void
+rssinit(Ctlr *c)
+{
+	int i, j;
+	u32int r;
+
+	if(c->nrq <= 1){
+		c->reg[Mrqc] = 0;
+		return;
+	}
+	for(i = 0; i < 10; i++)
+		c->reg[Rssrk + i] = nrand(1<<16)<<16 | nrand(1<<16);
+
+	/* 128 one-byte entries, dealt out to the queues in turn */
+	for(i = 0; i < 128; i += 4){
+		r = 0;
+		for(j = 0; j < 4; j++)
+			r |= ((i + j) % c->nrq) << 8*j;
+		c->reg[Reta + i/4] = r;
+	}
+	c->reg[Mrqc] = Mrqrss | Rsstcp4 | Rssip4 | Rsstcp6 | Rssip6;
+}
+
+static void
+rxinit(Ctlr *c)
+{
+	int i, is598;
+
+	c->reg[Rxctl] &= ~Rxen;
+	for(i = 0; i < c->nrq; i++)
+		rxqinit(&c->rxq[i]);
 
 	coherence();
 	c->reg[Fctrl] |= Bam;
@@ -573,15 +763,8 @@ rxinit(Ctlr *c)
 	c->reg[Rxcsum] &= ~Ippcse;
 	c->reg[Hlreg0] &= ~Jumboen;		/* jumbos are a bad idea */
 	c->reg[Hlreg0] |= Txcrcen | Rxcrcstrip | Txpaden;
-	c->reg[Srrctl] = (c->rbsz + 1024 - 1) / 1024;
 	c->reg[Mhadd] = c->rbsz << 16;
-
-	c->reg[Rbal] = PCIWADDR(c->rdba);
-	c->reg[Rbah] = 0;
-	c->reg[Rdlen] = c->nrd*sizeof(Rd);	/* must be multiple of 128 */
-	c->reg[Rdh] = 0;
-	c->reg[Rdt] = c->rdt = 0;
-	coherence();
+	rssinit(c);
 
 	is598 = (c->type == I82598);
 	if (is598)
@@ -590,40 +773,45 @@ rxinit(Ctlr *c)
 		c->reg[Rdrxctl] |= Crcstrip;
 		c->reg[Rdrxctl] &= ~Rscfrstsize;
 	}
-	if (Goslow && is598)
-		c->reg[Rxdctl] = 8<<Wthresh | 8<<Pthresh | 4<<Hthresh | Renable;
-	else
-		c->reg[Rxdctl] = Renable;
-	coherence();
-	while (!(c->reg[Rxdctl] & Renable))
-		;
+	for(i = 0; i < c->nrq; i++){
+		if (Goslow && is598)
+			c->reg[RXQREG(Rxdctl, i)] = 8<<Wthresh | 8<<Pthresh |
+				4<<Hthresh | Renable;
+		else
+			c->reg[RXQREG(Rxdctl, i)] = Renable;
+		coherence();
+		while (!(c->reg[RXQREG(Rxdctl, i)] & Renable))
+			;
+	}
 	c->reg[Rxctl] |= Rxen | (c->type == I82598? Dmbyps: 0);
 }
 
 static void
-replenish(Ctlr *c, uint rdh)
+replenish(Rxq *q, uint rdh)
 {
 	int rdt, m, i;
 	Block *b;
+	Ctlr *c;
 	Rd *r;
 
+	c = q->ctlr;
 	m = c->nrd - 1;
 	i = 0;
-	for(rdt = c->rdt; NEXTPOW2(rdt, m) != rdh; rdt = NEXTPOW2(rdt, m)){
-		r = c->rdba + rdt;
+	for(rdt = q->rdt; NEXTPOW2(rdt, m) != rdh; rdt = NEXTPOW2(rdt, m)){
+		r = q->rdba + rdt;
 		if((b = rballoc()) == nil){
 			print("82598: no buffers\n");
 			break;
 		}
-		c->rb[rdt] = b;
+		q->rb[rdt] = b;
 		r->addr[0] = PCIWADDR(b->rp);
 		r->status = 0;
-		c->rdfree++;
+		q->rdfree++;
 		i++;
 	}
 	if(i) {
 		coherence();
-		c->reg[Rdt] = c->rdt = rdt;	/* hand back recycled rdescs */
+		c->reg[RXQREG(Rdt, q->n)] = q->rdt = rdt;	/* hand back recycled rdescs */
 		coherence();
 	}
 }
@@ -631,43 +819,63 @@ replenish(Ctlr *c, uint rdh)
 static int
 rim(void *v)
 {
-	return ((Ctlr*)v)->rim != 0;
+	return ((Rxq*)v)->rim != 0;
 }
 
 void
 rproc(void *v)
 {
 	uint m, rdh;
-	Block *b;
+	int nb;
+	Block *b, *bl, **bt;
 	Ctlr *c;
 	Ether *e;
 	Rd *r;
+	Rxq *q;
 
-	e = v;
-	c = e->ctlr;
+	q = v;
+	c = q->ctlr;
+	e = c->edev;
+	if(c->nrq > 1)
+		procwired(up, q->n % conf.nmach);
 	m = c->nrd - 1;
 	for (rdh = 0; ; ) {
-		replenish(c, rdh);
-		ienable(c, Irx0);
-		sleep(&c->rrendez, rim, c);
+		replenish(q, rdh);
+		ienable(c, Irx0 << q->n);
+		sleep(&q->rendez, rim, q);
+		bl = nil;
+		bt = &bl;
+		nb = 0;
 		for (;;) {
-			c->rim = 0;
-			r = c->rdba + rdh;
+			q->rim = 0;
+			r = q->rdba + rdh;
 			if(!(r->status & Rdd))
 				break;		/* wait for pkts to arrive */
-			b = c->rb[rdh];
-			c->rb[rdh] = 0;
+			b = q->rb[rdh];
+			q->rb[rdh] = 0;
 			if (r->length > ETHERMAXTU)
 				print("82598: got jumbo of %d bytes\n", r->length);
 			b->wp += r->length;
 			b->lim = b->wp;			/* lie like a dog */
 //			r->status = 0;
-			etheriq(e, b, 1);
-			c->rdfree--;
+
+			/* pass packets up a batch at a time */
+			b->next = nil;
+			*bt = b;
+			bt = &b->next;
+			if(++nb == Rbatch){
+				etheriqlist(e, bl);
+				bl = nil;
+				bt = &bl;
+				nb = 0;
+			}
+			q->rdfree--;
 			rdh = NEXTPOW2(rdh, m);
-			if (c->rdfree <= c->nrd - 16)
-				replenish(c, rdh);
+			if (q->rdfree <= c->nrd - 16)
+				replenish(q, rdh);
 		}
+		if(bl != nil)
+			etheriqlist(e, bl);
 	}
 }
 
@@ -715,20 +923,28 @@ multicast(void *a, uchar *ea, int on)
 static void
 freemem(Ctlr *c)
 {
+	int i;
 	Block *b;
+	Rxq *q;
 
 	while(b = rballoc()){
 		b->free = 0;
 		freeb(b);
 	}
-	free(c->rdba);
-	c->rdba = nil;
+	for(i = 0; i < Nrq; i++){
+		q = &c->rxq[i];
+		free(q->rdba);
+		q->rdba = nil;
+		free(q->rb);
+		q->rb = nil;
+	}
+	c->nrq = 0;
 	free(c->tdba);
 	c->tdba = nil;
-	free(c->rb);
-	c->rb = nil;
 	free(c->tb);
 	c->tb = nil;
+	free(c->tlast);
+	c->tlast = nil;
 }
 
 static int
@@ -815,6 +1031,27 @@ eeload(Ctlr *c)
 	return 0;
 }
 
+/*
+ * point rx or tx queue n at interrupt cause vec.  the 598
+ * has a byte per queue, rx then tx; the 599 packs an rx
+ * and tx pair of queues into each register.
+ */
+static void
+setivar(Ctlr *c, int tx, int n, int vec)
+{
+	int r, sh;
+
+	if(c->type == I82598){
+		n += tx? 64: 0;
+		r = Ivar + n/4;
+		sh = 8*(n%4);
+	}else{
+		r = Ivar + n/2;
+		sh = 16*(n&1) + 8*tx;
+	}
+	c->reg[r] = c->reg[r] & ~(0xff<<sh) | (vec | 1<<7)<<sh;
+}
+
 static int
 reset(Ctlr *c)
 {
@@ -848,19 +1085,19 @@ reset(Ctlr *c)
 		c->reg[Fcrtl] = c->reg[Fcrth] = c->reg[Rcrtv] = 0;
 
 	/* configure interrupt mapping (don't ask) */
-	c->reg[Ivar+0] =     0 | 1<<7;
-	c->reg[Ivar+64/4] =  1 | 1<<7;
-//	c->reg[Ivar+97/4] = (2 | 1<<7) << (8*(97%4));
+	for(i = 0; i < Nrq; i++)
+		setivar(c, 0, i, Vrx0 + i);
+	setivar(c, 1, 0, Vtx0);
 
 	if (Goslow) {
 		/* interrupt throttling goes here. */
 		for(i = Itr; i < Itr + 20; i++)
 			c->reg[i] = 128;		/* ¼µs intervals */
-		c->reg[Itr + Itx0] = 256;
+		c->reg[Itr + Vtx0] = 256;
 	} else {					/* don't throttle */
 		for(i = Itr; i < Itr + 20; i++)
 			c->reg[i] = 0;			/* ¼µs intervals */
-		c->reg[Itr + Itx0] = 0;
+		c->reg[Itr + Vtx0] = 0;
 	}
 	return 0;
 }
@@ -883,6 +1120,7 @@ txinit(Ctlr *c)
 		c->tb[i] = 0;
 		if(b)
 			freeb(b);
+		c->tlast[i] = i;
 	}
 
 	assert(c->tdba != nil);
@@ -906,8 +1144,10 @@ txinit(Ctlr *c)
 static void
 attach(Ether *e)
 {
+	int i;
 	Block *b;
 	Ctlr *c;
+	Rxq *q;
 	char buf[KNAMELEN];
 
 	c = e->ctlr;
@@ -918,15 +1158,25 @@ attach(Ether *e)
 		freemem(c);
 		nexterror();
 	}
-	if(c->rdba == nil) {
+	if(c->tdba == nil) {
 		c->nrd = Nrd;
 		c->ntd = Ntd;
-		c->rdba = mallocalign(c->nrd * sizeof *c->rdba, Descalign, 0, 0);
+		c->nrq = conf.nmach;
+		if(c->nrq > Nrq)
+			c->nrq = Nrq;
+		for(i = 0; i < c->nrq; i++){
+			q = &c->rxq[i];
+			q->ctlr = c;
+			q->n = i;
+			q->rdba = mallocalign(c->nrd * sizeof *q->rdba, Descalign, 0, 0);
+			q->rb = malloc(c->nrd * sizeof(Block *));
+			if(q->rdba == nil || q->rb == nil)
+				error(Enomem);
+		}
 		c->tdba = mallocalign(c->ntd * sizeof *c->tdba, Descalign, 0, 0);
-		c->rb = malloc(c->nrd * sizeof(Block *));
 		c->tb = malloc(c->ntd * sizeof(Block *));
-		if (c->rdba == nil || c->tdba == nil ||
-		    c->rb == nil || c->tb == nil)
+		c->tlast = malloc(c->ntd * sizeof(ushort));
+		if (c->tdba == nil || c->tb == nil || c->tlast == nil)
 			error(Enomem);
 
 		for(c->nrb = 0; c->nrb < 2*Nrb; c->nrb++){
@@ -943,8 +1193,10 @@ attach(Ether *e)
 		if (!c->procsrunning) {
 			snprint(buf, sizeof buf, "#l%dl", e->ctlrno);
 			kproc(buf, lproc, e);
-			snprint(buf, sizeof buf, "#l%dr", e->ctlrno);
-			kproc(buf, rproc, e);
+			for(i = 0; i < c->nrq; i++){
+				snprint(buf, sizeof buf, "#l%dr%d", e->ctlrno, i);
+				kproc(buf, rproc, &c->rxq[i]);
+			}
 			snprint(buf, sizeof buf, "#l%dt", e->ctlrno);
 			kproc(buf, tproc, e);
 			c->procsrunning = 1;
@@ -958,9 +1210,10 @@ attach(Ether *e)
 static void
 interrupt(Ureg*, void *v)
 {
-	int icr, im;
+	int icr, im, i;
 	Ctlr *c;
 	Ether *e;
+	Rxq *q;
 
 	e = v;
 	c = e->ctlr;
@@ -968,11 +1221,13 @@ interrupt(Ureg*, void *v)
 	c->reg[Imc] = ~0;			/* disable all intrs */
 	im = c->im;
 	while((icr = c->reg[Icr] & c->im) != 0){
-		if(icr & Irx0){
-			im &= ~Irx0;
-			c->rim = Irx0;
-			wakeup(&c->rrendez);
-		}
+		for(i = 0; i < c->nrq; i++)
+			if(icr & Irx0<<i){
+				q = &c->rxq[i];
+				im &= ~(Irx0<<i);
+				q->rim = Irx0<<i;
+				wakeup(&q->rendez);
+			}
 		if(icr & Itx0){
 			im &= ~Itx0;
 			c->tim = Itx0;
@@ -1092,6 +1347,8 @@ pnp(Ether *e)
 	e->tbdf = c->p->tbdf;
 	e->mbps = 10000;
 	e->maxmtu = ETHERMAXTU;
+	e->tso = Tsomax;
+	e->csum = 1;
 	memmove(e->ea, c->ra, Eaddrlen);
 	e->arg = e;
 	e->attach = attach;
@@ -4,6 +4,21 @@ enum {
 };
 
 typedef struct Ether Ether;
+typedef struct Etherpoll Etherpoll;
+
+/*
+ * receive interrupt moderation and polling state kept by a
+ * driver's rx kproc; see etherpoll and etheritr in devether.c.
+ */
+struct Etherpoll {
+	int	budget;			/* most packets taken per poll */
+	uint	npkt;			/* received this interval */
+	ulong	last;			/* ms at start of interval */
+	uint	rate;			/* smoothed packets per second */
+	int	ips;			/* interrupts per second; 0 unmoderated */
+	uint	polls;			/* passes made without an interrupt */
+};
+
 struct Ether {
 	ISAConf;			/* hardware info */
 
@@ -27,6 +42,9 @@ struct Ether {
 };
 
 extern Block* etheriq(Ether*, Block*, int);
+extern void etheriqlist(Ether*, Block*);
+extern int etherpoll(Etherpoll*, int);
+extern int etheritr(Etherpoll*);
 extern void addethercard(char*, int(*)(Ether*));
 extern ulong ethercrc(uchar*, int);
 extern int parseether(uchar*, char*);
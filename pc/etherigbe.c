@@ -58,6 +58,7 @@ enum {
 	Fcah		= 0x0000002C,	/* Flow Control Address High */
 	Fct		= 0x00000030,	/* Flow Control Type */
 	Icr		= 0x000000C0,	/* Interrupt Cause Read */
+	Itr		= 0x000000C4,	/* Interrupt Throttling Rate (82540 on) */
 	Ics		= 0x000000C8,	/* Interrupt Cause Set */
 	Ims		= 0x000000D0,	/* Interrupt Mask Set/Read */
 	Imc		= 0x000000D8,	/* Interrupt mask Clear */
@@ -417,6 +418,7 @@ enum {					/* Td control */
 	PtypeIP		= 0x02000000,	/* IP Packet Type (CD) */
 	Ifcs		= 0x02000000,	/* Insert FCS (DD) */
 	Tse		= 0x04000000,	/* TCP Segmentation Enable */
+	Ic		= 0x04000000,	/* Insert Checksum (legacy DD) */
 	Rs		= 0x08000000,	/* Report Status */
 	Rps		= 0x10000000,	/* Report Status Sent */
 	Dext		= 0x20000000,	/* Descriptor Extension */
@@ -447,6 +449,7 @@ enum {
 	Ntd		= 64,		/* multiple of 8 */
 	Nrb		= 1024,		/* private receive buffers per Ctlr */
 	Rbsz		= 2048,
+	Rbatch		= 32,		/* received packets passed up at once */
 };
 
 typedef struct Ctlr Ctlr;
@@ -500,6 +503,7 @@ struct Ctlr {
 	int	rdh;			/* receive descriptor head */
 	int	rdt;			/* receive descriptor tail */
 	int	rdtr;			/* receive delay timer ring value */
+	Etherpoll poll;			/* rx moderation and polling */
 
 	Lock	tlock;
 	int	tdfree;
@@ -642,6 +646,8 @@ igbeifstat(Ether* edev, void* a, long n, ulong offset)
 		ctlr->lintr, ctlr->lsleep);
 	l += snprint(p+l, READSTR-l, "rintr: %ud %ud\n",
 		ctlr->rintr, ctlr->rsleep);
+	l += snprint(p+l, READSTR-l, "rpoll: %ud rate %ud ips %d\n",
+		ctlr->poll.polls, ctlr->poll.rate, ctlr->poll.ips);
 	l += snprint(p+l, READSTR-l, "tintr: %ud %ud\n",
 		ctlr->tintr, ctlr->txdw);
 	l += snprint(p+l, READSTR-l, "ixcs: %ud %ud %ud\n",
@@ -979,9 +985,9 @@ static void
 igbetransmit(Ether* edev)
 {
 	Td *td;
-	Block *bp;
+	Block *bp, *bl;
 	Ctlr *ctlr;
-	int tdh, tdt;
+	int n, tdh, tdt, css;
 
 	ctlr = edev->ctlr;
 
@@ -1002,16 +1008,29 @@ igbetransmit(Ether* edev)
 	ctlr->tdh = tdh;
 
 	/*
-	 * Try to fill the ring back up.
+	 * Try to fill the ring back up, taking as many packets
+	 * as there are free descriptors from the queue at once.
 	 */
 	tdt = ctlr->tdt;
+	n = (tdh - tdt - 1 + ctlr->ntd) % ctlr->ntd;
+	bl = n > 0 ? qgetn(edev->oq, n) : nil;
 	while(NEXT(tdt, ctlr->ntd) != tdh){
-		if((bp = qget(edev->oq)) == nil)
+		if((bp = bl) == nil)
 			break;
+		bl = bp->next;
+		bp->next = nil;
 		td = &ctlr->tdba[tdt];
 		td->addr[0] = PCIWADDR(bp->rp);
-		td->control = ((BLEN(bp) & LenMASK)<<LenSHIFT);
-		td->control |= Dext|Ifcs|Teop|DtypeDD;
+		if(bp->flag & Bcsum){
+			/* a legacy descriptor says where to sum and put it */
+			css = ETHERHDRSIZE + ((bp->rp[ETHERHDRSIZE] & 0xF)<<2);
+			td->control = BLEN(bp) | (css + (bp->rp[ETHERHDRSIZE+9] == 6? 16: 6))<<16;
+			td->control |= Ifcs|Teop|Ic;
+			td->status = css<<8;
+		}else{
+			td->control = ((BLEN(bp) & LenMASK)<<LenSHIFT);
+			td->control |= Dext|Ifcs|Teop|DtypeDD;
+		}
 		ctlr->tb[tdt] = bp;
 		tdt = NEXT(tdt, ctlr->ntd);
 		if(NEXT(tdt, ctlr->ntd) == tdh){
@@ -1114,13 +1133,27 @@ igberim(void* ctlr)
 	return ((Ctlr*)ctlr)->rim != 0;
 }
 
+static int
+igbehasitr(Ctlr* ctlr)
+{
+	switch(ctlr->id){
+	case i82542:
+	case i82543gc:
+	case i82544ei:
+	case i82544eif:
+	case i82544gc:
+		return 0;
+	}
+	return 1;
+}
+
 static void
 igberproc(void* arg)
 {
 	Rd *rd;
-	Block *bp;
+	Block *bp, *bl, **bt;
 	Ctlr *ctlr;
-	int r, rdh;
+	int r, rdh, nb, n, ips, polling;
 	Ether *edev;
 
 	edev = arg;
@@ -1131,14 +1164,22 @@ igberproc(void* arg)
 	r |= Ren;
 	csr32w(ctlr, Rctl, r);
 
+	ctlr->poll.budget = ctlr->nrd/2;
+	polling = 0;
 	for(;;){
-		ctlr->rim = 0;
-		igbeim(ctlr, Rxt0|Rxo|Rxdmt0|Rxseq);
-		ctlr->rsleep++;
-		sleep(&ctlr->rrendez, igberim, ctlr);
+		/* the rx interrupt stays masked while polling */
+		if(!polling){
+			ctlr->rim = 0;
+			igbeim(ctlr, Rxt0|Rxo|Rxdmt0|Rxseq);
+			ctlr->rsleep++;
+			sleep(&ctlr->rrendez, igberim, ctlr);
+		}
 
 		rdh = ctlr->rdh;
-		for(;;){
+		bl = nil;
+		bt = &bl;
+		nb = 0;
+		for(n = 0; n < ctlr->poll.budget; n++){
 			rd = &ctlr->rdba[rdh];
 
 			if(!(rd->status & Rdd))
@@ -1177,7 +1218,15 @@ igberproc(void* arg)
 					bp->checksum = rd->checksum;
 					bp->flag |= Bpktck;
 				}
-				etheriq(edev, bp, 1);
+				/* pass packets up a batch at a time */
+				*bt = bp;
+				bt = &bp->next;
+				if(++nb == Rbatch){
+					etheriqlist(edev, bl);
+					bl = nil;
+					bt = &bl;
+					nb = 0;
+				}
 			}
 			else if(ctlr->rb[rdh] != nil){
 				freeb(ctlr->rb[rdh]);
@@ -1190,9 +1239,15 @@ igberproc(void* arg)
 			rdh = NEXT(rdh, ctlr->nrd);
 		}
 		ctlr->rdh = rdh;
+		if(bl != nil)
+			etheriqlist(edev, bl);
 
 		if(ctlr->rdfree < ctlr->nrd/2 || (ctlr->rim & Rxdmt0))
 			igbereplenish(ctlr);
+
+		polling = etherpoll(&ctlr->poll, n);
+		if((ips = etheritr(&ctlr->poll)) >= 0 && igbehasitr(ctlr))
+			csr32w(ctlr, Itr, ips? 1000000000/(256*ips): 0);	/* 256ns units */
 	}
 }
 
@@ -2024,6 +2079,7 @@ igbepnp(Ether* edev)
 	edev->irq = ctlr->pcidev->intl;
 	edev->tbdf = ctlr->pcidev->tbdf;
 	edev->mbps = 1000;
+	edev->csum = 1;
 	memmove(edev->ea, ctlr->ra, Eaddrlen);
 
 	/*
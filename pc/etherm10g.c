@@ -38,6 +38,7 @@ enum {
 	Align	= 4096,
 	Maxmtu	= 9000,
 	Noconf	= 0xffffffff,
+	Rbatch	= 32,		/* received packets passed up at once */
 
 	Fwoffset= 1*MiB,
 	Cmdoff	= 0xf80000,	/* command port offset */
@@ -105,7 +106,16 @@ enum {
 	SFsmall	= 1,
 	SFfirst	= 2,
 	SFalign	= 4,
+	SFcksum	= 8,
 	SFnotso	= 16,
+
+	/* the same bits mean other things in a tso request */
+	SFtsohdr	= 1,
+	SFtsolast	= 8,
+	SFtsochop	= 16,
+	SFtsopld	= 32,
+
+	Smallsz	= 1520,
 };
 
 typedef struct {
@@ -1078,7 +1088,8 @@ m10rx(void *v)
 {
 	Ether *e;
 	Ctlr *c;
-	Block *b;
+	Block *b, *bl, **bt;
+	int nb;
 
 	e = v;
 	c = e->ctlr;
@@ -1086,8 +1097,24 @@ m10rx(void *v)
 		replenish(&c->sm);
 		replenish(&c->bg);
 		sleep(&c->rxrendez, rxcansleep, c);
-		while(b = nextblock(c))
-			etheriq(e, b, 1);
+
+		/* pass packets up a batch at a time */
+		bl = nil;
+		bt = &bl;
+		nb = 0;
+		while(b = nextblock(c)){
+			b->next = nil;
+			*bt = b;
+			bt = &b->next;
+			if(++nb == Rbatch){
+				etheriqlist(e, bl);
+				bl = nil;
+				bt = &bl;
+				nb = 0;
+			}
+		}
+		if(bl != nil)
+			etheriqlist(e, bl);
 	}
 }
 
@@ -1185,12 +1212,90 @@ nsegments(Block *b, int segsz)
 	return i;
 }
 
+/*
+ * fill requests from s on for a tcp super-segment, which the
+ * firmware cuts into b->mss payloads, after myricom's linux
+ * driver: a request ending a segment is chopped, the one after
+ * starts the next, and the first request of each segment counts
+ * the dma reads to the cut, filled in once they are known.
+ */
+static int
+tsorequests(Tx *tx, Block *b, Send *s)
+{
+	int cum, cumnext, chop, first, rdma, hlen, iphlen, len, slen, n;
+	ulong bus, end, segsz, j;
+	uchar flags, fnext;
+	Send *h;
+
+	h = tx->host;
+	segsz = tx->segsz;
+	iphlen = (b->rp[ETHERHDRSIZE] & 0xf) << 2;
+	hlen = ETHERHDRSIZE + iphlen + ((b->rp[ETHERHDRSIZE+iphlen+12] >> 4) << 2);
+	j = s - h;
+	flags = SFtsohdr|SFfirst;
+	cum = -hlen;		/* negative in the header */
+	rdma = 0;
+	n = 0;
+	bus = PCIWADDR(b->rp);
+	for(len = BLEN(b); len; len -= slen){
+		end = (bus + segsz) & ~(segsz-1);
+		slen = end - bus;
+		if(slen > len)
+			slen = len;
+		fnext = flags & ~SFfirst;
+		cumnext = cum + slen;
+		h[(j - rdma) & tx->m].nrdma = rdma + 1;
+		if(cum >= 0){
+			chop = cumnext > b->mss;
+			cumnext %= b->mss;
+			first = cumnext == 0;
+			if(chop)
+				flags |= SFtsochop;
+			if(first)
+				fnext |= SFfirst;
+			rdma |= -(chop | first);
+			rdma += chop & ~first;
+		}else if(cumnext >= 0){
+			/* the header ends here */
+			rdma = -1;
+			cumnext = 0;
+			slen = -cum;
+			fnext = SFtsopld|SFfirst;
+			if(b->mss <= Smallsz)
+				fnext |= SFsmall;
+		}
+		s = h + (j & tx->m);
+		s->low = pbit32(bus);
+		s->hdroff = pbit16(b->mss);
+		s->len = pbit16(slen);
+		s->pad = 0;
+		s->nrdma = 1;
+		s->chkoff = ETHERHDRSIZE + iphlen;
+		s->flags = flags;
+		if(cum & 1)
+			s->flags |= SFalign;
+
+		bus += slen;
+		cum = cumnext;
+		flags = fnext;
+		j++;
+		n++;
+		rdma++;
+	}
+	h[(j - rdma) & tx->m].nrdma = rdma;
+	do{
+		j--;
+		h[j & tx->m].flags |= SFtsolast;
+	}while((h[j & tx->m].flags & (SFtsochop|SFfirst)) == 0);
+	return n;
+}
+
 static void
 m10gtransmit(Ether *e)
 {
 	ushort slen;
-	ulong i, cnt, rdma, nseg, count, end, bus, len, segsz;
-	uchar flags;
+	ulong i, cnt, rdma, nseg, count, end, bus, len, segsz, ntso, cum;
+	uchar flags, css, cso;
 	Block *b;
 	Ctlr *c;
 	Send *s, *s0, *s0m8;
@@ -1207,30 +1312,51 @@ m10gtransmit(Ether *e)
 	s0 =   tx->host + (cnt & tx->m);
 	s0m8 = tx->host + ((cnt - 8) & tx->m);
 	i = tx->i;
-	for(; s >= s0 || s < s0m8; i += nseg){
+	/* leave room for a tso frame, one more request where its header splits off */
+	ntso = e->tso/segsz + 2;
+	for(; (s >= s0 || s < s0m8) && i - cnt + ntso <= tx->n - 8; i += nseg){
 		if((b = qget(e->oq)) == nil)
 			break;
-		flags = SFfirst|SFnotso;
-		if((len = BLEN(b)) < 1520)
-			flags |= SFsmall;
-		rdma = nseg = nsegments(b, segsz);
-		bus = PCIWADDR(b->rp);
-		for(; len; len -= slen){
-			end = (bus + segsz) & ~(segsz-1);
-			slen = end - bus;
-			if(slen > len)
-				slen = len;
-			s->low = pbit32(bus);
-			s->len = pbit16(slen);
-			s->nrdma = rdma;
-			s->flags = flags;
-
-			bus += slen;
-			if(++s ==  tx->host + tx->n)
-				s = tx->host;
-			count++;
-			flags &= ~SFfirst;
-			rdma = 1;
+		if(b->flag & Btso){
+			count = nseg = tsorequests(tx, b, s);
+			s = tx->host + ((i + nseg) & tx->m);
+		}else{
+			flags = SFfirst|SFnotso;
+			if((len = BLEN(b)) < 1520)
+				flags |= SFsmall;
+			rdma = nseg = nsegments(b, segsz);
+			bus = PCIWADDR(b->rp);
+			css = cso = 0;
+			if(b->flag & Bcsum){
+				/* the firmware sums from chkoff on, into hdroff */
+				css = ETHERHDRSIZE + ((b->rp[ETHERHDRSIZE] & 0xf) << 2);
+				cso = css + (b->rp[ETHERHDRSIZE+9] == 6? 16: 6);
+				flags |= SFcksum;
+			}
+			cum = 0;
+			for(; len; len -= slen){
+				end = (bus + segsz) & ~(segsz-1);
+				slen = end - bus;
+				if(slen > len)
+					slen = len;
+				s->low = pbit32(bus);
+				s->hdroff = pbit16(cso);
+				s->len = pbit16(slen);
+				s->nrdma = rdma;
+				s->chkoff = css;
+				s->flags = flags;
+				if((flags & SFcksum) && (cum & 1))
+					s->flags |= SFalign;
+				css = css > slen? css - slen: 0;
+				cum += slen;
+
+				bus += slen;
+				if(++s ==  tx->host + tx->n)
+					s = tx->host;
+				count++;
+				flags &= ~SFfirst;
+				rdma = 1;
+			}
 		}
 		tx->bring[(i + nseg - 1) & tx->m] = b;
 		if(1 || count > 0){
@@ -1591,6 +1717,16 @@ m10gpci(void)
 	}
 }
 
+/*
+ * booting the firmware takes a while; do it alongside the
+ * other devices' probes rather than at the first attach.
+ */
+static void
+m10gboot(void *a)
+{
+	m10gattach(a);
+}
+
 static int
 m10gpnp(Ether *e)
 {
@@ -1613,6 +1749,8 @@ m10gpnp(Ether *e)
 	e->irq = c->pcidev->intl;
 	e->tbdf = c->pcidev->tbdf;
 	e->mbps = 10000;
+	e->tso = 64*1024;
+	e->csum = 1;
 	memmove(e->ea, c->ra, Eaddrlen);
 
 	e->attach = m10gattach;
@@ -1628,6 +1766,7 @@ m10gpnp(Ether *e)
 	e->promiscuous = m10gpromiscuous;
 	e->multicast = m10gmulticast;
 
+	devasync(e->name, m10gboot, e, nil);	/* named by netifinit by then */
 	return 0;
 }
 
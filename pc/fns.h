@@ -78,6 +78,7 @@ ulong	inl(int);
 void	insl(int, void*, int);
 int	intrdisable(int, void (*)(Ureg *, void *), void*, int, char*);
 void	intrenable(int, void (*)(Ureg*, void*), void*, int, char*);
+int	intrenablemsi(Pcidev*, int, int, void (*)(Ureg*, void*), void*, char*);
 void	introff(void);
 void	intron(void);
 void	invlpg(ulong);
@@ -105,6 +106,7 @@ void	memorysummary(void);
 void	mfence(void);
 #define mmuflushtlb(pdb) putcr3(pdb)
 void	mmuinit(void);
+int	mmubigprint(char*, long);
 ulong*	mmuwalk(ulong*, ulong, int, int);
 int	mtrr(uvlong, uvlong, char *);
 void	mtrrclock(void);
@@ -118,8 +120,10 @@ void	outss(int, void*, int);
 void	outl(int, ulong);
 void	outsl(int, void*, int);
 ulong	paddr(void*);
+void	patinit(void);
 ulong	pcibarsize(Pcidev*, int);
 void	pcibussize(Pcidev*, ulong*, ulong*);
+int	pcicap(Pcidev*, int);
 int	pcicfgr8(Pcidev*, int);
 int	pcicfgr16(Pcidev*, int);
 int	pcicfgr32(Pcidev*, int);
@@ -134,6 +138,8 @@ void	pcihinv(Pcidev*);
 uchar	pciipin(Pcidev*, uchar);
 Pcidev* pcimatch(Pcidev*, int, int);
 Pcidev* pcimatchtbdf(int);
+int	pcimsienable(Pcidev*, int, ulong, ulong);
+int	pcimsixcount(Pcidev*);
 void	pcireset(void);
 int	pciscan(int, Pcidev**);
 void	pcisetbme(Pcidev*);
@@ -156,6 +162,7 @@ void	putcr0(ulong);
 void	putcr3(ulong);
 void	putcr4(ulong);
 void*	rampage(void);
+int	rdrand(ulong*);
 void	rdmsr(int, vlong*);
 void	realmode(Ureg*);
 void	screeninit(void);
@@ -163,6 +170,8 @@ void	(*screenputs)(char*, int);
 void*	sigsearch(char*);
 void	syncclock(void);
 void	syscallfmt(int syscallno, ulong pc, va_list list);
+void	_sysenter(void);
+void	sysenterinit(void);
 void	sysretfmt(int syscallno, va_list list, long ret, uvlong start, uvlong stop);
 void*	tmpmap(Page*);
 void	tmpunmap(void*);
@@ -179,9 +188,10 @@ void	umbrwfree(ulong, int);
 ulong	upaalloc(int, int);
 void	upafree(ulong, int);
 void	upareserve(ulong, int);
-#define	userureg(ur) (((ur)->cs & 0xFFFF) == UESEL)
+#define	userureg(ur) (((ur)->cs & 0xFFFF) == UESEL || ((ur)->cs & 0xFFFF) == SYSUESEL)
 void	vectortable(void);
 void*	vmap(ulong, int);
+void*	vmapwc(ulong, int);
 int	vmapsync(ulong);
 void	vunmap(void*, int);
 void	wbinvd(void);
@@ -35,6 +35,8 @@ enum {
 	IrqTIMER	= 18,
 	IrqERROR	= 19,
 	IrqPCINT	= 20,
+	IrqWAKE		= 21,		/* ipi out of tickless idle */
+	IrqTLB		= 22,		/* ipi for tlb shootdowns */
 	IrqSPURIOUS	= 31,		/* must have bits [3-0] == 0x0F */
 	MaxIrqLAPIC	= 31,
 
@@ -56,6 +58,9 @@ typedef struct Vctl {
 
 	void	(*f)(Ureg*, void*);	/* handler to call */
 	void*	a;			/* argument to call it with */
+
+	int	ismsi;			/* message signalled, by intrenablemsi */
+	int	msin;			/* and its msi-x entry, or -1 for msi */
 } Vctl;
 
 enum {
@@ -112,10 +117,18 @@ enum {					/* type 0 & type 1 pre-defined header */
 	PciBAR0		= 0x10,		/* base address */
 	PciBAR1		= 0x14,
 
+	PciCAP		= 0x34,		/* capabilities pointer */
 	PciINTL		= 0x3C,		/* interrupt line */
 	PciINTP		= 0x3D,		/* interrupt pin */
 };
 
+/* capability list ids */
+enum {
+	PciCapPMG	= 0x01,		/* power management */
+	PciCapMSI	= 0x05,		/* message signalled interrupts */
+	PciCapMSIX	= 0x11,		/* and their extended table form */
+};
+
 /* ccrb (base class code) values; controller types */
 enum {
 	Pcibcpci1	= 0,		/* pci 1.0; no class codes defined */
@@ -259,6 +272,7 @@ struct Pcidev
 	} ioa, mema;
 
 	int	pmrb;			/* power management register block */
+	u32int	*msixtab;		/* msi-x table, once mapped */
 };
 
 enum {
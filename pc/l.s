@@ -671,6 +671,20 @@ TEXT lcycles(SB),1,$0
 	RDTSC
 	RET
 
+/*
+ * int rdrand(ulong*): 0 if the generator had nothing ready
+ */
+TEXT rdrand(SB), $0
+	BYTE $0x0F; BYTE $0xC7; BYTE $0xF0		/* RDRAND AX */
+	JCC	_rdrandnone
+	MOVL	p+0(FP), CX
+	MOVL	AX, 0(CX)
+	MOVL	$1, AX
+	RET
+_rdrandnone:
+	XORL	AX, AX
+	RET
+
 TEXT rdmsr(SB), $0				/* model-specific register */
 	MOVL	index+0(FP), CX
 	RDMSR
@@ -104,6 +104,8 @@ main(void)
 	printinit();
 	cpuidprint();
 	mmuinit();
+	sysenterinit();
+	patinit();
 	if(arch->intrinit)	/* launches other processors on an mp */
 		arch->intrinit();
 	timersinit();
@@ -90,7 +90,12 @@
 #define	APMCSEG16	7	/* APM 16-bit code segment */
 #define	APMDSEG		8	/* APM data segment */
 #define	KESEG16		9	/* kernel executable 16-bit */
-#define	NGDT		10	/* number of GDT entries required */
+/* sysenter/sysexit want these four in a row, in this order */
+#define	SYSKESEG	10	/* kernel executable, sysenter */
+#define	SYSKDSEG	11	/* kernel data/stack, sysenter */
+#define	SYSUESEG	12	/* user executable, sysexit */
+#define	SYSUDSEG	13	/* user data/stack, sysexit */
+#define	NGDT		14	/* number of GDT entries required */
 /* #define	APM40SEG	8	/* APM segment 0x40 */
 
 #define	SELGDT	(0<<2)	/* selector is in gdt */
@@ -107,6 +112,9 @@
 #define	APMCSEL 	SELECTOR(APMCSEG, SELGDT, 0)
 #define	APMCSEL16	SELECTOR(APMCSEG16, SELGDT, 0)
 #define	APMDSEL		SELECTOR(APMDSEG, SELGDT, 0)
+#define	SYSKESEL	SELECTOR(SYSKESEG, SELGDT, 0)
+#define	SYSUESEL	SELECTOR(SYSUESEG, SELGDT, 3)
+#define	SYSUDSEL	SELECTOR(SYSUDSEG, SELGDT, 3)
 /* #define	APM40SEL	SELECTOR(APM40SEG, SELGDT, 0) */
 
 /*
@@ -148,7 +156,10 @@
 #define	PTERONLY	(0<<1)
 #define	PTEKERNEL	(0<<2)
 #define	PTEUSER		(1<<2)
+#define	PTEACCESSED	(1<<5)
 #define	PTESIZE		(1<<7)
+#define	PTEPAT		(1<<7)		/* pat index bit, 4K pte */
+#define	PDEPAT		(1<<12)		/* pat index bit, 4MB pde */
 #define	PTEGLOBAL	(1<<8)
 
 /*
@@ -57,11 +57,24 @@ Segdesc gdt[NGDT] =
 [UESEG]		EXECSEGM(3),		/* user code */
 [TSSSEG]	TSSSEGM(0,0),		/* tss segment */
 [KESEG16]		EXEC16SEGM(0),	/* kernel code 16-bit */
+[SYSKESEG]	EXECSEGM(0),		/* kernel code, sysenter */
+[SYSKDSEG]	DATASEGM(0),		/* kernel data/stack, sysenter */
+[SYSUESEG]	EXECSEGM(3),		/* user code, sysexit */
+[SYSUDSEG]	DATASEGM(3),		/* user data/stack, sysexit */
 };
 
 static int didmmuinit;
+
+/* 4MB pages mapped, and physical segment faults that had to use 4K */
+static struct {
+	ulong	kernel;
+	ulong	user;
+	ulong	fallback;
+} bigpages;
 static void taskswitch(ulong, ulong);
 static void memglobal(void);
+static int pcmmuref(Proc*, ulong);
+static void pcmmuflushva(ulong);
 
 #define	vpt ((ulong*)VPT)
 #define	VPTX(va)		(((ulong)(va))>>12)
@@ -80,6 +93,8 @@ mmuinit(void)
 	ushort ptr[3];
 
 	didmmuinit = 1;
+	mmuref = pcmmuref;
+	mmuflushva = pcmmuflushva;
 
 	if(0) print("vpt=%#.8ux vpd=%#p kmap=%#.8ux\n",
 		VPT, vpd, KMAP);
@@ -131,6 +146,39 @@ mmuinit(void)
 	ltr(TSSSEL);
 }
 
+/*
+ * Fast system call entry.  Sysenter arrives with the stack
+ * pointing at tss->esp0, which _sysenter loads as the real
+ * kernel stack; the int $64 gate stays for everyone else.
+ * Needs cpuidentify and the tss, so it follows both.
+ * Early Pentium Pros claim Sep but don't have it.
+ */
+void
+sysenterinit(void)
+{
+	if((m->cpuiddx & Sep) == 0)
+		return;
+	if(((m->cpuidax>>8) & 0xF) == 6 && (m->cpuidax & 0xFFF) < 0x633)
+		return;
+	wrmsr(0x174, SYSKESEL);
+	wrmsr(0x175, (ulong)&m->tss->esp0);
+	wrmsr(0x176, (ulong)_sysenter);
+}
+
+/*
+ * Turn pat entry 4 (the pte PAT bit alone), which nothing else
+ * uses, from write-back into write-combining for vmapwc.  The
+ * other entries keep their reset values.  Every processor must
+ * agree, so each does its own after cpuidentify.
+ */
+void
+patinit(void)
+{
+	if((m->cpuiddx & Pat) == 0)
+		return;
+	wrmsr(0x277, 0x0007040100070406LL);
+}
+
 /* 
  * On processors that support it, we set the PTEGLOBAL bit in
  * page table and page directory entries that map kernel memory.
@@ -258,13 +306,21 @@ static void
 mmuptefree(Proc* proc)
 {
 	int s;
+	int i;
 	ulong *pdb;
 	Page **last, *page;
 
-	if(proc->mmupdb == nil || proc->mmuused == nil)
+	if(proc->mmupdb == nil || (proc->mmuused == nil && proc->nmmubig == 0))
 		return;
 	s = splhi();
 	pdb = tmpmap(proc->mmupdb);
+	if(proc->nmmubig){
+		for(i = 0; i < nelem(proc->mmubig)*32; i++)
+			if(proc->mmubig[i/32] & (1<<(i%32)))
+				pdb[i] = 0;
+		memset(proc->mmubig, 0, sizeof proc->mmubig);
+		proc->nmmubig = 0;
+	}
 	last = &proc->mmuused;
 	for(page = *last; page; page = page->next){
 		pdb[page->daddr] = 0;
@@ -403,17 +459,48 @@ upallocpdb(void)
 	splx(s);
 }
 
+static int
+havepse(void)
+{
+	return (MACHP(0)->cpuiddx & Pse) && (getcr4() & 0x10);
+}
+
+/*
+ * A fault in a contiguous physical segment can map the whole
+ * aligned 4MB around va with one pde, if the segment covers it
+ * and pa lines up with va.
+ */
+static int
+bigpageok(ulong va, ulong pa)
+{
+	Segment *s;
+	ulong base;
+
+	s = seg(up, va, 0);
+	if(s == nil || (s->type&SG_TYPE) != SG_PHYSICAL || s->pseg->pgalloc != nil)
+		return 0;
+	base = va & ~(BY2XPG-1);
+	if(base < s->base || base+BY2XPG > s->top)
+		return 0;
+	if(((va ^ PPN(pa)) & (BY2XPG-1)) != 0 || !havepse()){
+		bigpages.fallback++;
+		return 0;
+	}
+	return 1;
+}
+
 /*
  * Update the mmu in response to a user fault.  pa may have PTEWRITE set.
  */
 void
 putmmu(ulong va, ulong pa, Page*)
 {
-	int old, s;
+	int old, s, big, x;
 	Page *page;
 
 	if(up->mmupdb == nil)
 		upallocpdb();
+	big = bigpageok(va, pa);
 
 	/*
 	 * We should be able to get through this with interrupts
@@ -430,6 +517,23 @@ putmmu(ulong va, ulong pa, Page*)
 	 */
 	
 	s = splhi();
+	x = PDX(va);
+	if(vpd[x] & PTESIZE){
+		/* fault under a 4MB page; map this 4MB with 4K pages instead */
+		vpd[x] = 0;
+		up->mmubig[x/32] &= ~(1<<(x%32));
+		up->nmmubig--;
+		putcr3(getcr3());
+		bigpages.fallback++;
+	}
+	if(big && !(vpd[x]&PTEVALID)){
+		vpd[x] = (PPN(pa) & ~(BY2XPG-1))|(pa & 0xFFF)|PTEUSER|PTESIZE;
+		up->mmubig[x/32] |= 1<<(x%32);
+		up->nmmubig++;
+		bigpages.user++;
+		splx(s);
+		return;
+	}
 	if(!(vpd[PDX(va)]&PTEVALID)){
 		if(up->mmufree == 0){
 			spllo();
@@ -465,6 +569,8 @@ checkmmu(ulong va, ulong pa)
 {
 	if(up->mmupdb == 0)
 		return;
+	if(vpd[PDX(va)] & PTESIZE)
+		return;
 	if(!(vpd[PDX(va)]&PTEVALID) || !(vpt[VPTX(va)]&PTEVALID))
 		return;
 	if(PPN(vpt[VPTX(va)]) != pa)
@@ -473,6 +579,70 @@ checkmmu(ulong va, ulong pa)
 			va, pa, vpt[VPTX(va)]);
 }
 
+/*
+ * Drop the current process's mapping of va from its page
+ * tables and this processor's tlb, for procflushva.  A 4MB
+ * page goes as a whole and is faulted back in pieces.
+ */
+static void
+pcmmuflushva(ulong va)
+{
+	int x;
+
+	if(up == nil || up->mmupdb == nil)
+		return;
+	x = PDX(va);
+	if(vpd[x] & PTESIZE){
+		vpd[x] = 0;
+		up->mmubig[x/32] &= ~(1<<(x%32));
+		up->nmmubig--;
+	}else if(vpd[x] & PTEVALID)
+		vpt[VPTX(va)] = 0;
+	else
+		return;
+	invlpg(va);
+}
+
+/*
+ * Test and clear the accessed bit of proc's mapping of va, for
+ * the pager's clock.  proc is not running: canflush has seen to
+ * that, and its tlb is flushed before it runs again.
+ */
+static int
+pcmmuref(Proc *proc, ulong va)
+{
+	int s, ref;
+	ulong *pdb, *pt, pde;
+	Page *page;
+
+	if(proc->mmupdb == nil)
+		return 0;
+	ref = 0;
+	s = splhi();
+	pdb = tmpmap(proc->mmupdb);
+	pde = pdb[PDX(va)];
+	if((pde & (PTESIZE|PTEACCESSED)) == (PTESIZE|PTEACCESSED)){
+		pdb[PDX(va)] &= ~PTEACCESSED;
+		ref = 1;
+	}
+	tmpunmap(pdb);
+	if((pde & (PTESIZE|PTEVALID)) == PTEVALID){
+		for(page = proc->mmuused; page; page = page->next)
+			if(page->daddr == PDX(va))
+				break;
+		if(page != nil){
+			pt = tmpmap(page);
+			if(pt[PTX(va)] & PTEACCESSED){
+				pt[PTX(va)] &= ~PTEACCESSED;
+				ref = 1;
+			}
+			tmpunmap(pt);
+		}
+	}
+	splx(s);
+	return ref;
+}
+
 /*
  * Walk the page-table pointed to by pdb and return a pointer
  * to the entry for virtual address va at the requested level.
@@ -538,8 +708,8 @@ static void pdbunmap(ulong*, ulong, int);
 /*
  * Add a device mapping to the vmap range.
  */
-void*
-vmap(ulong pa, int size)
+static void*
+vmapflag(ulong pa, int size, ulong flag)
 {
 	int osize;
 	ulong o, va;
@@ -559,7 +729,7 @@ vmap(ulong pa, int size)
 	}
 	ilock(&vmaplock);
 	if((va = vmapalloc(size)) == 0 
-	|| pdbmap(MACHP(0)->pdb, pa|PTEUNCACHED|PTEWRITE, va, size) < 0){
+	|| pdbmap(MACHP(0)->pdb, pa|flag|PTEWRITE, va, size) < 0){
 		iunlock(&vmaplock);
 		return 0;
 	}
@@ -573,6 +743,25 @@ vmap(ulong pa, int size)
 	return (void*)(va + o);
 }
 
+void*
+vmap(ulong pa, int size)
+{
+	return vmapflag(pa, size, PTEUNCACHED);
+}
+
+/*
+ * Write-combining, for frame buffers: pat entry 4, which
+ * patinit sets to WC.  Without a pat it's an ordinary vmap
+ * and an mtrr has to do the job.
+ */
+void*
+vmapwc(ulong pa, int size)
+{
+	if((MACHP(0)->cpuiddx & Pat) == 0)
+		return vmap(pa, size);
+	return vmapflag(pa, size, PTEPAT);
+}
+
 static int
 findhole(ulong *a, int n, int count)
 {
@@ -698,10 +887,7 @@ pdbmap(ulong *pdb, ulong pa, ulong va, int size)
 	flag = pa&0xFFF;
 	pa &= ~0xFFF;
 
-	if((MACHP(0)->cpuiddx & Pse) && (getcr4() & 0x10))
-		pse = 1;
-	else
-		pse = 0;
+	pse = havepse();
 
 	for(off=0; off<size; off+=pgsz){
 		table = &pdb[PDX(va+off)];
@@ -714,8 +900,11 @@ pdbmap(ulong *pdb, ulong pa, ulong va, int size)
 		 * va, pa aligned and size >= 4MB and processor can do it.
 		 */
 		if(pse && (pa+off)%(4*MB) == 0 && (va+off)%(4*MB) == 0 && (size-off) >= 4*MB){
-			*table = (pa+off)|flag|PTESIZE|PTEVALID;
+			*table = (pa+off)|(flag&~PTEPAT)|PTESIZE|PTEVALID;
+			if(flag & PTEPAT)
+				*table |= PDEPAT;
 			pgsz = 4*MB;
+			bigpages.kernel++;
 		}else{
 			pte = mmuwalk(pdb, va+off, 2, 1);
 			if(*pte&PTEVALID)
@@ -728,6 +917,13 @@ pdbmap(ulong *pdb, ulong pa, ulong va, int size)
 	return 0;
 }
 
+int
+mmubigprint(char *buf, long n)
+{
+	return snprint(buf, n, "bigpages %s kernel %lud user %lud fallback %lud\n",
+		havepse() ? "on" : "off", bigpages.kernel, bigpages.user, bigpages.fallback);
+}
+
 /*
  * Remove mappings.  Must already exist, for sanity.
  * Only used for kernel mappings, so okay to use KADDR.
@@ -404,6 +404,8 @@ squidboy(Apic* apic)
 	cpuidentify();
 	cpuidprint();
 	checkmtrr();
+	sysenterinit();
+	patinit();
 
 	apic->online = 1;
 	coherence();
@@ -511,6 +513,45 @@ trympacpi(void)
 	}
 }
 
+/*
+ *  the interrupt is all it takes to bring a processor
+ *  out of halt in idlehands; runproc does the rest.
+ */
+static void
+mpwakeintr(Ureg*, void*)
+{
+}
+
+static void
+mpidlewake(ulong mask)
+{
+	int i, s;
+
+	s = splhi();
+	for(i = 0; i < conf.nmach; i++)
+		if(mask & (1<<i))
+			lapicicrw(machno2apicno[i]<<24, ApicFIXED|ApicEDGE|(VectorPIC+IrqWAKE));
+	splx(s);
+}
+
+static void
+mptlbintr(Ureg*, void*)
+{
+	tlbshootintr();
+}
+
+static void
+mptlbshoot(ulong mask)
+{
+	int i, s;
+
+	s = splhi();
+	for(i = 0; i < conf.nmach; i++)
+		if(mask & (1<<i))
+			lapicicrw(machno2apicno[i]<<24, ApicFIXED|ApicEDGE|(VectorPIC+IrqTLB));
+	splx(s);
+}
+
 void
 mpinit(void)
 {
@@ -630,6 +671,10 @@ mpinit(void)
 	intrenable(IrqTIMER, lapicclock, 0, BUSUNKNOWN, "clock");
 	intrenable(IrqERROR, lapicerror, 0, BUSUNKNOWN, "lapicerror");
 	intrenable(IrqSPURIOUS, lapicspurious, 0, BUSUNKNOWN, "lapicspurious");
+	intrenable(IrqWAKE, mpwakeintr, 0, BUSUNKNOWN, "wake");
+	idlewake = mpidlewake;
+	intrenable(IrqTLB, mptlbintr, 0, BUSUNKNOWN, "tlbshoot");
+	tlbshoot = mptlbshoot;
 	lapiconline();
 
 	checkmtrr();
@@ -844,6 +889,75 @@ mpintrenablex(Vctl* v, int tbdf)
 	return vno;
 }
 
+/*
+ * a vector for a message signalled interrupt on processor cpu,
+ * or round-robin if cpu is -1, with the message address to
+ * deliver it there in *addr.  The message data is the vector;
+ * the interrupt is fixed and edge triggered, with no ioapic
+ * in the way.
+ */
+int
+mpintrmsi(Vctl* v, int cpu, ulong* addr)
+{
+	int vno, apicno;
+
+	if(cpu >= conf.nmach)
+		return -1;
+	vno = VectorAPIC + (incref(&mpvnoref)-1)*8;
+	if(vno > MaxVectorAPIC){
+		print("mpintrmsi: vno %d, tbdf %uX\n", vno, v->tbdf);
+		return -1;
+	}
+	if(cpu < 0)
+		apicno = mpintrcpu();
+	else
+		apicno = machno2apicno[cpu];
+	*addr = 0xFEE00000 | apicno<<12;
+	v->isr = lapicisr;
+	v->eoi = lapiceoi;
+	return vno;
+}
+
+/*
+ * deliver vector vno, enabled for v, to processor cpu from now on:
+ * rewrite the destination of the message, or of every unmasked
+ * ioapic redirection entry with that vector.
+ */
+int
+mpintraffinity(Vctl* v, int vno, int cpu)
+{
+	Bus *bus;
+	Aintr *aintr;
+	Apic *apic;
+	Pcidev *p;
+	int apicno, hi, lo, n;
+
+	if(cpu < 0 || cpu >= conf.nmach)
+		return -1;
+	apicno = machno2apicno[cpu];
+	if(v->ismsi){
+		if((p = pcimatchtbdf(v->tbdf)) == nil)
+			return -1;
+		return pcimsienable(p, v->msin, 0xFEE00000 | apicno<<12, vno);
+	}
+
+	n = 0;
+	for(bus = mpbus; bus != nil; bus = bus->next){
+		for(aintr = bus->aintr; aintr != nil; aintr = aintr->next){
+			apic = aintr->apic;
+			if(!(apic->flags & PcmpEN) || apic->type != PcmpIOAPIC)
+				continue;
+			ioapicrdtr(apic, aintr->intr->intin, &hi, &lo);
+			if((lo & ApicIMASK) || (lo & 0xFF) != vno)
+				continue;
+			lo &= ~(ApicRemoteIRR|ApicDELIVS);
+			ioapicrdtw(apic, aintr->intr->intin, apicno<<24, lo);
+			n++;
+		}
+	}
+	return n > 0? 0: -1;
+}
+
 int
 mpintrenable(Vctl* v)
 {
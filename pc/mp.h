@@ -230,6 +230,8 @@ extern void lapictimerset(uvlong);
 
 extern void mpinit(void);
 extern int mpintrenable(Vctl*);
+extern int mpintrmsi(Vctl*, int, ulong*);
+extern int mpintraffinity(Vctl*, int, int);
 extern void mpshutdown(void);
 
 extern _MP_ *_mp_;
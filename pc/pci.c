@@ -1401,37 +1401,36 @@ pciclrmwi(Pcidev* p)
 	pcicfgw16(p, PciPCR, p->pcr);
 }
 
-static int
-pcigetpmrb(Pcidev* p)
+/*
+ * offset in p's configuration space of capability cap,
+ * or -1 if p hasn't got it.
+ */
+int
+pcicap(Pcidev* p, int cap)
 {
-	int ptr;
-
-	if(p->pmrb != 0)
-		return p->pmrb;
-	p->pmrb = -1;
+	int i, ptr;
 
 	/*
 	 * If there are no extended capabilities implemented,
-	 * (bit 4 in the status register) assume there's no standard
-	 * power management method.
+	 * (bit 4 in the status register) there's no list.
 	 * Find the capabilities pointer based on PCI header type.
 	 */
 	if(!(pcicfgr16(p, PciPSR) & 0x0010))
 		return -1;
-	switch(pcicfgr8(p, PciHDT)){
+	switch(pcicfgr8(p, PciHDT) & 0x7F){
 	default:
 		return -1;
 	case 0:					/* all other */
 	case 1:					/* PCI to PCI bridge */
-		ptr = 0x34;
+		ptr = PciCAP;
 		break;
 	case 2:					/* CardBus bridge */
 		ptr = 0x14;
 		break;
 	}
-	ptr = pcicfgr32(p, ptr);
+	ptr = pcicfgr8(p, ptr);
 
-	while(ptr != 0){
+	for(i = 0; ptr != 0 && i < 48; i++){
 		/*
 		 * Check for validity.
 		 * Can't be in standard header and must be double
@@ -1439,10 +1438,8 @@ pcigetpmrb(Pcidev* p)
 		 */
 		if(ptr < 0x40 || (ptr & ~0xFC))
 			return -1;
-		if(pcicfgr8(p, ptr) == 0x01){
-			p->pmrb = ptr;
+		if(pcicfgr8(p, ptr) == cap)
 			return ptr;
-		}
 
 		ptr = pcicfgr8(p, ptr+1);
 	}
@@ -1450,6 +1447,14 @@ pcigetpmrb(Pcidev* p)
 	return -1;
 }
 
+static int
+pcigetpmrb(Pcidev* p)
+{
+	if(p->pmrb == 0)
+		p->pmrb = pcicap(p, PciCapPMG);
+	return p->pmrb;
+}
+
 int
 pcigetpms(Pcidev* p)
 {
@@ -1506,3 +1511,77 @@ pcisetpms(Pcidev* p, int state)
 
 	return ostate;
 }
+
+/*
+ * number of msi-x table entries p has, or 0 if it hasn't
+ * msi-x and will have to make do with one plain msi.
+ */
+int
+pcimsixcount(Pcidev* p)
+{
+	int c;
+
+	if((c = pcicap(p, PciCapMSIX)) == -1)
+		return 0;
+	return (pcicfgr16(p, c+2) & 0x7FF) + 1;
+}
+
+/*
+ * point p's msi (n < 0) or its msi-x table entry n (n >= 0)
+ * at the message address addr with data, and turn it on.
+ *
+ * Msi capability:
+ *  offset 2:	control; 0 enable, 4-6 messages enabled, 7 64-bit
+ *	   4:	address
+ *	   8:	data, or upper address if 64-bit, then data at 12
+ * Msi-x capability:
+ *  offset 2:	control; 0-10 table size-1, 14 mask all, 15 enable
+ *	   4:	table offset in the bar given by the low 3 bits
+ * with 16-byte table entries: address, upper address, data
+ * and vector control, whose bit 0 masks the entry.
+ */
+int
+pcimsienable(Pcidev* p, int n, ulong addr, ulong data)
+{
+	int c, f, t;
+	ulong bar;
+	u32int *e;
+
+	if(n < 0){
+		if((c = pcicap(p, PciCapMSI)) == -1)
+			return -1;
+		f = pcicfgr16(p, c+2) & ~(7<<4);	/* one message */
+		pcicfgw32(p, c+4, addr);
+		if(f & (1<<7)){
+			pcicfgw32(p, c+8, 0);
+			pcicfgw16(p, c+12, data);
+		}else
+			pcicfgw16(p, c+8, data);
+		pcicfgw16(p, c+2, f | 1);
+		return 0;
+	}
+
+	if((c = pcicap(p, PciCapMSIX)) == -1)
+		return -1;
+	f = pcicfgr16(p, c+2);
+	if(n > (f & 0x7FF))
+		return -1;
+	if(p->msixtab == nil){
+		t = pcicfgr32(p, c+4);
+		if((t & 7) >= nelem(p->mem) || (bar = p->mem[t & 7].bar & ~0xF) == 0)
+			return -1;
+		p->msixtab = vmap(bar + (t & ~7), ((f & 0x7FF) + 1)*16);
+		if(p->msixtab == nil)
+			return -1;
+	}
+	e = p->msixtab + 4*n;
+	e[3] |= 1;
+	coherence();
+	e[0] = addr;
+	e[1] = 0;
+	e[2] = data;
+	coherence();
+	e[3] &= ~1;
+	pcicfgw16(p, c+2, (f | 1<<15) & ~(1<<14));
+	return 0;
+}
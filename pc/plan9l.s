@@ -5,6 +5,8 @@
  */
 #define VectorSYSCALL	0x40
 
+#define SYSEXIT		BYTE $0x0F; BYTE $0x35
+
 /*
  *  Used to get to the first process:
  * 	set up an interrupt return frame and IRET to user level.
@@ -50,3 +52,53 @@ TEXT _syscallintr(SB), $0
 	POPL	DS
 	ADDL	$8, SP				/* pop error code and trap type */
 	IRETL
+
+/*
+ * Sysenter entry, set up by sysenterinit.  The user puts the
+ * system call number in AX, its stack pointer in CX and the
+ * return pc in DX; CX and DX are lost across the call.  We
+ * arrive at CPL 0 with interrupts off and SP pointing at
+ * tss->esp0, and build the same Ureg as _syscallintr.  Frames
+ * that noted or exec reset to UESEL go back through IRETL.
+ */
+TEXT _sysenter(SB), $0
+	MOVL	0(SP), SP			/* tss->esp0 */
+	PUSHL	$(SYSUDSEL)			/* old ss */
+	PUSHL	CX				/* old sp */
+	PUSHFL
+	ORL	$0x200, 0(SP)			/* old flags, as user saw them */
+	PUSHL	$(SYSUESEL)			/* old cs */
+	PUSHL	DX				/* old pc */
+	PUSHL	$0				/* error code */
+	PUSHL	$VectorSYSCALL			/* trap type */
+
+	PUSHL	DS
+	PUSHL	ES
+	PUSHL	FS
+	PUSHL	GS
+	PUSHAL
+	MOVL	$(KDSEL), AX
+	MOVW	AX, DS
+	MOVW	AX, ES
+	PUSHL	SP
+	CALL	syscall(SB)
+
+	POPL	AX
+	POPAL
+	POPL	GS
+	POPL	FS
+	POPL	ES
+	POPL	DS
+	ADDL	$8, SP				/* pop error code and trap type */
+	CMPL	4(SP), $(SYSUESEL)
+	JNE	_sysenteriret
+	MOVL	0(SP), DX			/* pc */
+	MOVL	12(SP), CX			/* sp */
+	ADDL	$8, SP				/* pop pc and cs */
+	ANDL	$0xCD5, 0(SP)			/* arithmetic flags only */
+	POPFL
+	STI					/* takes effect after SYSEXIT */
+	SYSEXIT
+
+_sysenteriret:
+	IRETL
@@ -131,7 +131,7 @@ screenaperture(int size, int align)
 	scr->paddr = upaalloc(size, align);
 	if(scr->paddr == 0)
 		return -1;
-	scr->vaddr = vmap(scr->paddr, size);
+	scr->vaddr = vmapwc(scr->paddr, size);
 	if(scr->vaddr == nil)
 		return -1;
 	scr->apsize = size;
@@ -531,14 +531,18 @@ vgalinearaddr(VGAscr *scr, ulong paddr, int size)
 	 */
 	if(nsize > 64*MB)
 		nsize = 64*MB;
-	scr->vaddr = vmap(npaddr, nsize);
+	scr->vaddr = vmapwc(npaddr, nsize);
 	if(scr->vaddr == 0)
 		error("cannot allocate vga frame buffer");
 	scr->vaddr = (char*)scr->vaddr+x;
 	scr->paddr = paddr;
 	scr->apsize = nsize;
-	/* let mtrr harmlessly fail on old CPUs, e.g., P54C */
-	if(!waserror()){
+	/*
+	 * vmapwc did it with the pat if there is one; otherwise
+	 * let mtrr harmlessly fail on old CPUs, e.g., P54C, or
+	 * when it's out of registers.
+	 */
+	if((m->cpuiddx & Pat) == 0 && !waserror()){
 		mtrr(npaddr, nsize, "wc");
 		poperror();
 	}
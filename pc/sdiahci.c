@@ -39,6 +39,10 @@ enum {
 
 	Obs	= 0xa0,			/* obsolete device bits */
 
+	Nslot	= 32,			/* command slots */
+	Ncqmax	= 4*1024*1024,		/* bytes one prd can describe */
+	Ncqfails= 3,			/* errors before ncq is turned off */
+
 	/*
 	 * if we get more than this many interrupts per tick for a drive,
 	 * either the hardware is broken or we've got a bug in this driver.
@@ -122,6 +126,7 @@ static char *flagname[] = {
 typedef struct Asleep Asleep;
 typedef struct Ctlr Ctlr;
 typedef struct Drive Drive;
+typedef struct Qsleep Qsleep;
 
 struct Drive {
 	Lock;
@@ -159,6 +164,14 @@ struct Drive {
 
 	ulong	lastintr0;
 	ulong	intrs;
+
+	int	ncq;		/* queued slots in use; 0 is off */
+	ulong	ncqbusy;	/* slots at the drive */
+	ulong	ncqerr;		/* slots that completed with an error */
+	int	ncqfail;
+	Rendez	ncqr;		/* a slot frees or the queue drains */
+	Rendez	ncqw[Nslot];
+	Actab	*ncqtab[Nslot];
 };
 
 struct Ctlr {
@@ -191,6 +204,11 @@ struct Asleep {
 	int	i;
 };
 
+struct Qsleep {
+	Drive	*d;
+	ulong	bit;
+};
+
 extern SDifc sdiahciifc;
 
 static	Ctlr	iactlr[NCtlr];
@@ -730,7 +748,7 @@ ahciconfigdrive(Drive *d)
 	pm = d->portc.m;
 	if(pm->list == 0){
 		setupfis(&pm->fis);
-		pm->list = malign(sizeof *pm->list, 1024);
+		pm->list = malign(Nslot * sizeof *pm->list, 1024);
 		pm->ctab = malign(sizeof *pm->ctab, 128);
 	}
 
@@ -847,6 +865,81 @@ idmove(char *p, ushort *a, int n)
 	memmove(op, p, n - (e - p));
 }
 
+/*
+ * native command queueing.  Reads and writes of a drive that
+ * supports ncq go out in any of its first d->ncq slots, as many
+ * as both drive and controller have, and devsd keeps that many
+ * at the drive at once.  An unqueued command waits for them to
+ * drain and then has slot 0 to itself.
+ */
+static ulong
+ncqmask(int n)
+{
+	if(n >= Nslot)
+		return ~0UL;
+	return (1UL<<n) - 1;
+}
+
+static void
+ncqidentify(Drive *d, ushort *id)
+{
+	int i, n;
+
+	n = 0;
+	if(d->infosz >= 77*sizeof(ushort) && d->ctlr->hba->cap & Hsncq &&
+	    id[76] & 1<<8 && (d->portm.feat & Datapi) == 0 &&
+	    d->ncqfail < Ncqfails){
+		n = (id[75] & 0x1f) + 1;
+		i = ((d->ctlr->hba->cap >> 8) & 0x1f) + 1;
+		if(n > i)
+			n = i;
+	}
+	for(i = 0; i < n; i++)
+		if(d->ncqtab[i] == nil)
+			d->ncqtab[i] = malign(sizeof(Actab), 128);
+	d->ncq = n;
+	d->unit->iodepth = n > 0? n: 1;
+}
+
+/* drive must be locked */
+static void
+ncqwake(Drive *d, ulong bits)
+{
+	int i;
+
+	for(i = 0; i < Nslot; i++)
+		if(bits & 1UL<<i)
+			wakeup(&d->ncqw[i]);
+	wakeup(&d->ncqr);
+}
+
+/* drive must be locked */
+static void
+ncqcomplete(Drive *d)
+{
+	ulong done;
+
+	done = d->ncqbusy & ~(d->port->sactive | d->port->ci);
+	if(done){
+		d->ncqbusy &= ~done;
+		ncqwake(d, done);
+	}
+}
+
+/* drive must be locked */
+static void
+ncqabort(Drive *d)
+{
+	ulong bits;
+
+	bits = d->ncqbusy;
+	if(bits == 0)
+		return;
+	d->ncqerr |= bits;
+	d->ncqbusy = 0;
+	ncqwake(d, bits);
+}
+
 static int
 identify(Drive *d)
 {
@@ -889,6 +982,8 @@ identify(Drive *d)
 	u->inquiry[4] = sizeof u->inquiry - 4;
 	memmove(u->inquiry+8, d->model, 40);
 
+	ncqidentify(d, id);
+
 	if(osectors != s || memcmp(oserial, d->serial, sizeof oserial) != 0){
 		d->mediachange = 1;
 		u->sectors = 0;
@@ -929,6 +1024,8 @@ updatedrive(Drive *d)
 		pr = 0;
 	}else if(cause & Adps)
 		pr = 0;
+	if(d->ncqbusy)
+		ncqcomplete(d);
 	if(cause & Ifatal){
 		ewake = 1;
 		dprint("ahci: updatedrive: %s: fatal\n", name);
@@ -981,6 +1078,7 @@ updatedrive(Drive *d)
 	}
 	p->serror = serr;
 	if(ewake){
+		ncqabort(d);
 		clearci(p);
 		wakeup(&d->portm);
 	}
@@ -1045,6 +1143,7 @@ resetdisk(Drive *d)
 	state = d->state;
 	if(d->state != Dready || d->state != Dnew)
 		d->portm.flag |= Ferror;
+	ncqabort(d);
 	clearci(p);			/* satisfy sleep condition. */
 	wakeup(&d->portm);
 	if(stat != (Devpresent|Devphycomm)){
@@ -1260,6 +1359,7 @@ portreset:
 		dprint("%s: portreset [%s]: mode %d; status %06#ux\n",
 			name, diskstates[d->state], d->mode, s);
 		d->portm.flag |= Ferror;
+		ncqabort(d);
 		clearci(d->port);
 		wakeup(&d->portm);
 		if((s & Devdet) == 0){	/* no device */
@@ -1507,6 +1607,27 @@ iaonline(SDunit *unit)
 	return r;
 }
 
+static int
+ncqidle(void *v)
+{
+	Drive *d;
+
+	d = v;
+	return d->ncqbusy == 0 || d->state != Dready;
+}
+
+/* portm must be locked; keep unqueued commands off a busy queue */
+static void
+ncqdrain(Drive *d)
+{
+	if(d->ncqbusy == 0)
+		return;
+	while(waserror())
+		;
+	sleep(&d->ncqr, ncqidle, d);
+	poperror();
+}
+
 /* returns locked list! */
 static Alist*
 ahcibuild(Drive *d, uchar *cmd, void *data, int n, vlong lba)
@@ -1523,6 +1644,7 @@ ahcibuild(Drive *d, uchar *cmd, void *data, int n, vlong lba)
 	llba = pm->feat&Dllba? 1: 0;
 	acmd = tab[dir][llba];
 	qlock(pm);
+	ncqdrain(d);
 	l = pm->list;
 	t = pm->ctab;
 	c = t->cfis;
@@ -1656,10 +1778,12 @@ lockready(Drive *d)
 	int i;
 
 	qlock(&d->portm);
+	ncqdrain(d);
 	while ((i = waitready(d)) == 1) {
 		qunlock(&d->portm);
 		esleep(1);
 		qlock(&d->portm);
+		ncqdrain(d);
 	}
 	return i;
 }
@@ -1785,6 +1909,167 @@ retry:
 	return SDok;
 }
 
+/*
+ * after an error the drive aborts everything queued and
+ * refuses more until its ncq error log has been read.
+ */
+static int
+ncqreadlog(Aportc *pc)
+{
+	int r;
+	uchar *c, *log;
+	Aprdt *p;
+
+	log = malloc(512);
+	if(log == nil)
+		return -1;
+	c = cfissetup(pc);
+	c[2] = 0x2f;		/* read log ext */
+	c[4] = 0x10;		/* ncq command error log */
+	c[7] = 0x40;
+	c[12] = 1;
+	listsetup(pc, 1<<16);
+
+	p = &pc->m->ctab->prdt;
+	p->dba = PCIWADDR(log);
+	p->dbahi = 0;
+	p->count = 1<<31 | (512-2) | 1;
+	r = ahciwait(pc, 3*1000);
+	free(log);
+	return r;
+}
+
+static int
+ncqslotfree(void *v)
+{
+	Drive *d;
+
+	d = v;
+	return d->ncqbusy != ncqmask(d->ncq) || d->state != Dready;
+}
+
+static int
+ncqslotdone(void *v)
+{
+	Qsleep *q;
+
+	q = v;
+	return (q->d->ncqbusy & q->bit) == 0;
+}
+
+/* drive must be locked */
+static void
+ncqbuild(Drive *d, int slot, int write, void *data, int n, vlong lba)
+{
+	uchar *c;
+	Alist *l;
+	Actab *t;
+	Aprdt *p;
+
+	t = d->ncqtab[slot];
+	c = t->cfis;
+	memset(c, 0, 0x20);
+
+	c[0] = 0x27;
+	c[1] = 0x80;
+	c[2] = write? 0x61: 0x60;	/* write/read fpdma queued */
+	c[3] = n;		/* sector count is in the features */
+
+	c[4] = lba;
+	c[5] = lba >> 8;
+	c[6] = lba >> 16;
+	c[7] = 0x40;		/* lba */
+
+	c[8] = lba >> 24;
+	c[9] = lba >> 32;
+	c[10] = lba >> 40;
+	c[11] = n >> 8;
+
+	c[12] = slot << 3;	/* tag */
+
+	l = d->portm.list + slot;
+	l->flags = 1<<16 | 0x5;
+	if(write)
+		l->flags |= Lwrite;
+	l->len = 0;
+	l->ctab = PCIWADDR(t);
+	l->ctabhi = 0;
+
+	p = &t->prdt;
+	p->dba = PCIWADDR(data);
+	p->dbahi = 0;
+	p->count = 1<<31 | (d->unit->secsize*n - 2) | 1;
+}
+
+/*
+ * one read or write in a queued slot.  -1 sends the caller
+ * down the unqueued path, which also recovers the drive.
+ */
+static int
+iancq(Drive *d, int write, void *data, int count, vlong lba)
+{
+	int slot;
+	ulong err;
+	char *name;
+	Aport *p;
+	Qsleep q;
+
+	if(count == 0 || count*d->unit->secsize > Ncqmax)
+		return -1;
+	p = d->port;
+	qlock(&d->portm);
+	while(waserror())
+		;
+	sleep(&d->ncqr, ncqslotfree, d);
+	poperror();
+
+	ilock(d);
+	if(d->state != Dready || d->ncq == 0){
+		iunlock(d);
+		qunlock(&d->portm);
+		return -1;
+	}
+	for(slot = 0; slot < d->ncq; slot++)
+		if((d->ncqbusy & 1UL<<slot) == 0)
+			break;
+	ncqbuild(d, slot, write, data, count, lba);
+	q.d = d;
+	q.bit = 1UL<<slot;
+	d->ncqbusy |= q.bit;
+	d->ncqerr &= ~q.bit;
+	p->sactive = q.bit;
+	p->ci = q.bit;
+	d->intick = MACHP(0)->ticks;
+	d->active++;
+	iunlock(d);
+	qunlock(&d->portm);
+
+	while(waserror())
+		;
+	sleep(&d->ncqw[slot], ncqslotdone, &q);
+	poperror();
+
+	ilock(d);
+	d->active--;
+	err = d->ncqerr & q.bit;
+	iunlock(d);
+	if(err == 0)
+		return 0;
+
+	name = d->unit->name;
+	qlock(&d->portm);
+	ncqdrain(d);
+	if(d->state == Dready && ncqreadlog(&d->portc) == -1)
+		ahcirecover(&d->portc);
+	qunlock(&d->portm);
+	if(++d->ncqfail >= Ncqfails && d->ncq){
+		print("%s: ncq off after %d errors\n", name, d->ncqfail);
+		d->ncq = 0;
+		d->unit->iodepth = 1;
+	}
+	return -1;
+}
+
 static int
 iario(SDreq *r)
 {
@@ -1832,6 +2117,13 @@ iario(SDreq *r)
 		count = r->dlen / unit->secsize;
 	max = 128;
 
+	if(d->ncq && d->state == Dready &&
+	    iancq(d, *cmd == 0x2a, r->data, count, lba) == 0){
+		r->rlen = count * unit->secsize;
+		r->status = SDok;
+		return SDok;
+	}
+
 	try = 0;
 retry:
 	data = r->data;
@@ -2139,6 +2431,11 @@ print("iarctl: nil u->dev->ctlr\n");
 				smarttab[d->portm.smart]);
 		p = seprint(p, e, "flag\t");
 		p = pflag(p, e, d->portm.feat);
+		if(d->ncq)
+			p = seprint(p, e, "ncq\t%d slots busy %#lux errors %d\n",
+				d->ncq, d->ncqbusy, d->ncqfail);
+		else
+			p = seprint(p, e, "ncq\toff\n");
 	}else
 		p = seprint(p, e, "no disk present [%s]\n", diskstates[d->state]);
 	serrstr(o->serror, buf, buf + sizeof buf - 1);
@@ -2192,6 +2489,20 @@ runsmartable(Drive *d, int i)
 	poperror();
 }
 
+static void
+forcencq(Drive *d, char *on)
+{
+	qlock(&d->portm);
+	ncqdrain(d);
+	if(strcmp(on, "off") == 0)
+		d->ncqfail = Ncqfails;
+	else
+		d->ncqfail = 0;
+	if(d->ncqbusy == 0 && d->info != nil)
+		ncqidentify(d, d->info);
+	qunlock(&d->portm);
+}
+
 static void
 forcestate(Drive *d, char *state)
 {
@@ -2246,6 +2557,8 @@ iawctl(SDunit *u, Cmdbuf *cmd)
 		dprint("ahci: %04d %#ux\n", i, d->info[i]);
 	}else if(strcmp(f[0], "mode") == 0)
 		forcemode(d, f[1]? f[1]: "satai");
+	else if(strcmp(f[0], "ncq") == 0)
+		forcencq(d, f[1]? f[1]: "on");
 	else if(strcmp(f[0], "nop") == 0){
 		if((d->portm.feat & Dnop) == 0){
 			cmderror(cmd, "no drive support");
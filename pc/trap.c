@@ -24,9 +24,13 @@ static Vctl *vctl[256];
 
 enum
 {
-	Ntimevec = 20		/* number of time buckets for each intr */
+	Ntimevec = 20,		/* number of time buckets for each intr */
+	Ncycvec = 20,		/* and of cycle buckets: under 2^9, then doubling */
 };
 ulong intrtimes[256][Ntimevec];
+ulong intrcycles[256][Ncycvec];
+ulong intrcount[256];
+uchar intrcpu[256];		/* processor that took it last */
 
 void
 intrenable(int irq, void (*f)(Ureg*, void*), void* a, int tbdf, char *name)
@@ -69,6 +73,54 @@ intrenable(int irq, void (*f)(Ureg*, void*), void* a, int tbdf, char *name)
 	iunlock(&vctllock);
 }
 
+/*
+ * like intrenable, but for p's msi (n < 0) or its msi-x table
+ * entry n, delivered to processor cpu (-1 for any).  Each gets
+ * a vector of its own.  Returns -1 if the device or the
+ * interrupt controllers can't, for the caller to fall back
+ * to intrenable.
+ */
+int
+intrenablemsi(Pcidev *p, int n, int cpu, void (*f)(Ureg*, void*), void* a, char *name)
+{
+	int vno;
+	ulong addr;
+	Vctl *v;
+
+	if(f == nil || arch->intrmsi == nil)
+		return -1;
+
+	v = xalloc(sizeof(Vctl));
+	v->isintr = 1;
+	v->irq = -1;
+	v->tbdf = p->tbdf;
+	v->ismsi = 1;
+	v->msin = n;
+	v->f = f;
+	v->a = a;
+	strncpy(v->name, name, KNAMELEN-1);
+	v->name[KNAMELEN-1] = 0;
+
+	ilock(&vctllock);
+	vno = arch->intrmsi(v, cpu, &addr);
+	if(vno == -1 || vctl[vno] != nil){
+		iunlock(&vctllock);
+		xfree(v);
+		return -1;
+	}
+	vctl[vno] = v;
+	iunlock(&vctllock);
+
+	if(pcimsienable(p, n, addr, vno) < 0){
+		ilock(&vctllock);
+		vctl[vno] = nil;
+		iunlock(&vctllock);
+		xfree(v);
+		return -1;
+	}
+	return vno;
+}
+
 int
 intrdisable(int irq, void (*f)(Ureg *, void *), void *a, int tbdf, char *name)
 {
@@ -140,6 +192,69 @@ irqallocread(Chan*, void *vbuf, long n, vlong offset)
 	return oldn - n;
 }
 
+/*
+ *  "vno cpu" delivers vector vno to processor cpu
+ */
+static long
+irqallocwrite(Chan*, void *a, long n, vlong)
+{
+	int vno, cpu;
+	Cmdbuf *cb;
+
+	cb = parsecmd(a, n);
+	if(waserror()){
+		free(cb);
+		nexterror();
+	}
+	if(cb->nf != 2)
+		cmderror(cb, Ecmdargs);
+	vno = strtol(cb->f[0], nil, 0);
+	cpu = strtol(cb->f[1], nil, 0);
+	if(vno < VectorPIC || vno >= nelem(vctl) || cpu < 0 || cpu >= conf.nmach)
+		error(Ebadarg);
+	if(arch->intraffinity == nil)
+		error("interrupts can't be steered on this architecture");
+	ilock(&vctllock);
+	if(vctl[vno] == nil || !vctl[vno]->isintr || arch->intraffinity(vctl[vno], vno, cpu) < 0){
+		iunlock(&vctllock);
+		error("can't steer that vector");
+	}
+	iunlock(&vctllock);
+	free(cb);
+	poperror();
+	return n;
+}
+
+/*
+ *  per vector: count, processor it last ran on, and
+ *  handler cycles in buckets: under 2^9, under 2^10, ...
+ */
+static long
+irqstatread(Chan*, void *a, long n, vlong offset)
+{
+	char *buf, *p, *e;
+	int i, j, vno;
+
+	p = buf = malloc(READSTR*4);
+	if(buf == nil)
+		error(Enomem);
+	e = buf + READSTR*4;
+	for(vno = 0; vno < nelem(vctl); vno++){
+		if(intrcount[vno] == 0 || vctl[vno] == nil)
+			continue;
+		p = seprint(p, e, "%3d %11lud %2d %-*.*s", vno, intrcount[vno],
+			intrcpu[vno], KNAMELEN, KNAMELEN, vctl[vno]->name);
+		for(i = Ncycvec; i > 0 && intrcycles[vno][i-1] == 0; i--)
+			;
+		for(j = 0; j < i; j++)
+			p = seprint(p, e, " %lud", intrcycles[vno][j]);
+		p = seprint(p, e, "\n");
+	}
+	n = readstr(offset, a, n, buf);
+	free(buf);
+	return n;
+}
+
 void
 trapenable(int vno, void (*f)(Ureg*, void*), void* a, char *name)
 {
@@ -226,7 +341,8 @@ trapinit(void)
 	trapenable(Vector15, unexpected, 0, "unexpected");
 	nmienable();
 
-	addarchfile("irqalloc", 0444, irqallocread, nil);
+	addarchfile("irqalloc", 0664, irqallocread, irqallocwrite);
+	addarchfile("irqstat", 0444, irqstatread, nil);
 	trapinited = 1;
 }
 
@@ -273,6 +389,7 @@ intrtime(Mach*, int vno)
 {
 	ulong diff;
 	ulong x;
+	int i;
 
 	x = perfticks();
 	diff = x - m->perf.intrts;
@@ -282,6 +399,12 @@ intrtime(Mach*, int vno)
 	if(up == nil && m->perf.inidle > diff)
 		m->perf.inidle -= diff;
 
+	intrcount[vno]++;
+	intrcpu[vno] = m->machno;
+	for(i = 0; i < Ncycvec-1 && diff>>(i+9) != 0; i++)
+		;
+	intrcycles[vno][i]++;
+
 	diff /= m->cpumhz*100;		/* quantum = 100µsec */
 	if(diff >= Ntimevec)
 		diff = Ntimevec-1;
@@ -326,7 +449,7 @@ trap(Ureg* ureg)
 	}
 
 	m->perf.intrts = perfticks();
-	user = (ureg->cs & 0xFFFF) == UESEL;
+	user = userureg(ureg);
 	if(user){
 		up->dbgreg = ureg;
 		cycles(&up->kentry);
@@ -619,7 +742,7 @@ fault386(Ureg* ureg, void*)
 	addr = getcr2();
 	read = !(ureg->ecode & 2);
 
-	user = (ureg->cs & 0xFFFF) == UESEL;
+	user = userureg(ureg);
 	if(!user){
 		if(vmapsync(addr))
 			return;
@@ -666,7 +789,7 @@ syscall(Ureg* ureg)
 	ulong scallnr;
 	vlong startns, stopns;
 
-	if((ureg->cs & 0xFFFF) != UESEL)
+	if(!userureg(ureg))
 		panic("syscall: cs 0x%4.4luX", ureg->cs);
 
 	cycles(&up->kentry);
@@ -722,6 +845,7 @@ syscall(Ureg* ureg)
 		up->s = *((Sargs*)(sp+BY2WD));
 		up->psstate = sysctab[scallnr];
 
+		up->stats.nsys[sysclass[scallnr]]++;
 		ret = systab[scallnr](up->s.args);
 		poperror();
 	}else{
@@ -896,7 +1020,7 @@ noted(Ureg* ureg, ulong arg0)
 	 * Take care with the comparisons as different processor
 	 * generations push segment descriptors in different ways.
 	 */
-	if((nureg->cs & 0xFFFF) != UESEL || (nureg->ss & 0xFFFF) != UDSEL
+	if(!userureg(nureg) || ((nureg->ss & 0xFFFF) != UDSEL && (nureg->ss & 0xFFFF) != SYSUDSEL)
 	  || (nureg->ds & 0xFFFF) != UDSEL || (nureg->es & 0xFFFF) != UDSEL
 	  || (nureg->fs & 0xFFFF) != UDSEL || (nureg->gs & 0xFFFF) != UDSEL){
 		qunlock(&up->debug);
@@ -908,6 +1032,9 @@ noted(Ureg* ureg, ulong arg0)
 	nureg->flags = (ureg->flags & ~0xCD5) | (nureg->flags & 0xCD5);
 
 	memmove(ureg, nureg, sizeof(Ureg));
+	/* sysexit would lose cx and dx; go back through iret */
+	ureg->cs = UESEL;
+	ureg->ss = UDSEL;
 
 	switch(arg0){
 	case NCONT:
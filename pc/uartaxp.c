@@ -576,7 +576,7 @@ static void
 axprecv(Cc* cc)
 {
 	Ccb *ccb;
-	uchar *ep, *mem, *rp, *wp;
+	uchar *ep, *mem, *rp, *wp, *e;
 
 	ccb = cc->ccb;
 
@@ -585,8 +585,13 @@ axprecv(Cc* cc)
 	wp = mem + ccb->ibwp;
 	ep = mem + ccb->ibea;
 
+	/* the card fills the ring itself; take it a run at a time */
 	while(rp != wp){
-		uartrecv(cc, *rp++);		/* ilocks cc->tlock */
+		e = wp;
+		if(wp < rp)
+			e = ep+1;
+		uartrecvn(cc, rp, e-rp);	/* ilocks cc->rlock */
+		rp = e;
 		if(rp > ep)
 			rp = mem + ccb->ibsa;
 		ccb->ibrp = rp - mem;
@@ -464,7 +464,8 @@ i8250interrupt(Ureg*, void* arg)
 {
 	Ctlr *ctlr;
 	Uart *uart;
-	int iir, lsr, old, r;
+	int iir, lsr, old, r, n;
+	uchar buf[64];
 
 	uart = arg;
 
@@ -506,7 +507,9 @@ i8250interrupt(Ureg*, void* arg)
 			 * parity or framing error, throw it away;
 			 * overrun is an indication that something has
 			 * already been tossed.
+			 * The whole fifo is handed up at once.
 			 */
+			n = 0;
 			while((lsr = csr8r(ctlr, Lsr)) & Dr){
 				if(lsr & (FIFOerr|Oe))
 					uart->oerr++;
@@ -516,8 +519,14 @@ i8250interrupt(Ureg*, void* arg)
 					uart->ferr++;
 				r = csr8r(ctlr, Rbr);
 				if(!(lsr & (Bi|Fe|Pe)))
-					uartrecv(uart, r);
+					buf[n++] = r;
+				if(n == sizeof buf){
+					uartrecvn(uart, buf, n);
+					n = 0;
+				}
 			}
+			if(n > 0)
+				uartrecvn(uart, buf, n);
 			break;
 
 		default:
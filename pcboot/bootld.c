@@ -595,7 +595,7 @@ readexec(Boot *b)
 		memmove(b->bp, &b->hdr, sizeof(Exechdr));
 		b->wp += sizeof(Exechdr);
 		print("elf64...");
-	} else if(isgzipped((uchar *)b->bp)) {
+	} else if(isgzipped((uchar *)b->bp) || islz4((uchar *)b->bp)) {
 		b->state = READGZIP;
 		/* could use Unzipbuf instead of smalloc() */
 		b->bp = (char*)smalloc(Kernelmax);
@@ -603,7 +603,7 @@ readexec(Boot *b)
 		b->ep = b->wp + Kernelmax;
 		memmove(b->bp, &b->hdr, sizeof(Exechdr));
 		b->wp += sizeof(Exechdr);
-		print("gz...");
+		print(islz4((uchar *)b->bp)? "lz4...": "gz...");
 	} else {
 		print("bad kernel format (magic %#lux)\n", magic);
 		return bootfail(b);
@@ -624,23 +624,28 @@ boot9(Boot *b, ulong magic, ulong entry)
 		print("bad magic %#lux\n", magic);
 }
 
-/* only returns upon failure */
+/* only returns upon failure; handles lz4 as well as gzip */
 static void
 readgzip(Boot *b)
 {
 	ulong entry, text, data, bss, magic, all, pentry;
 	uchar *sdata;
 	Exechdr *hdr;
+	int (*unzip)(uchar*, int, uchar*, int);
 
-	/* the whole gzipped kernel is now at b->bp */
+	/* the whole compressed kernel is now at b->bp */
 	hdr = &b->hdr;
-	if(!isgzipped((uchar *)b->bp)) {
+	if(isgzipped((uchar *)b->bp))
+		unzip = gunzip;
+	else if(islz4((uchar *)b->bp))
+		unzip = unlz4;
+	else {
 		print("lost magic\n");
 		return;
 	}
 	print("%ld => ", b->wp - b->bp);
-	/* just fill hdr from gzipped b->bp, to get various sizes */
-	if(gunzip((uchar*)hdr, sizeof *hdr, (uchar*)b->bp, b->wp - b->bp)
+	/* just fill hdr from compressed b->bp, to get various sizes */
+	if((*unzip)((uchar*)hdr, sizeof *hdr, (uchar*)b->bp, b->wp - b->bp)
 	    < sizeof *hdr) {
 		print("error uncompressing kernel exec header\n");
 		return;
@@ -660,9 +665,9 @@ readgzip(Boot *b)
 	if (PGROUND(pentry + text) + data > MB + Kernelmax)
 		panic("kernel larger than %d bytes", Kernelmax);
 
-	/* fill entry from gzipped b->bp */
+	/* fill entry from compressed b->bp */
 	all = sizeof(Exec) + text + data;
-	if(gunzip((uchar *)KADDR(PADDR(entry)) - sizeof(Exec), all,
+	if((*unzip)((uchar *)KADDR(PADDR(entry)) - sizeof(Exec), all,
 	    (uchar*)b->bp, b->wp - b->bp) < all) {
 		print("error uncompressing kernel\n");
 		return;
@@ -1,5 +1,5 @@
 /*
- * expand gzipped boot loader appended to this binary and execute it.
+ * expand gzipped or lz4 boot loader appended to this binary and execute it.
  *
  * due to Russ Cox, rsc@swtch.com.
  * see http://plan9.bell-labs.com/wiki/plan9/Replacing_9load
@@ -12,6 +12,7 @@
 #include "expand.h"
 
 #include "inflate.guts.c"
+#include "unlz4.guts.c"
 
 #define KB		1024
 #define MB		(1024*1024)
@@ -26,6 +27,10 @@ void wbinvd(void);
 /* inflate.guts.c */
 int gunzip(uchar*, int, uchar*, int);
 
+/* unlz4.guts.c */
+int islz4(uchar*);
+int unlz4(uchar*, int, uchar*, int);
+
 int isexec(void*);
 int isgzip(uchar*);
 void run(void*);
@@ -170,6 +175,13 @@ _main(void)
 			print("gzip failed.");
 			exits(0);
 		}
+	} else if(islz4(kernel)) {
+		print("lz4...");
+		memmove((uchar*)Unzipbuf, kernel, ksize);
+		if(unlz4(kernel, Bootkernmax, (uchar*)Unzipbuf, ksize) < 0){
+			print("lz4 failed.");
+			exits(0);
+		}
 	}
 	if(isexec(kernel))
 		run(kernel);
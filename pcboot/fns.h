@@ -10,6 +10,7 @@ int gunzip(uchar*, int, uchar*, int);
 void i8042a20(void);
 void (*i8237alloc)(void);
 void impulse(void);
+int islz4(uchar*);
 uintptr mapping(uintptr);
 void mkmultiboot(void);
 void mmuinit0(void);
@@ -20,6 +21,7 @@ Chan *namecopen(char *, int);
 void readlsconf(void);
 void trimnl(char *s);
 void unionrewind(Chan *c);
+int unlz4(uchar*, int, uchar*, int);
 void warp64(uvlong);
 
 /* boot.c */
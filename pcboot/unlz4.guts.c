@@ -0,0 +1,159 @@
+/*
+ * lz4 decoder; included by expand and 9boot with different header files.
+ *
+ * kernels are in the lz4 legacy frame format, as made by lz4k:
+ * a 4-byte magic, then blocks, each a 4-byte little-endian
+ * compressed length and an independent lz4 block of at most 8MB.
+ * a block is a run of sequences: a token (literal count in the
+ * top nibble, match length - 4 in the bottom; 15 continues in
+ * following bytes), the literals, a 2-byte little-endian offset
+ * back into the output and the match.  the last sequence is
+ * literals only.  there are no trees to build, and literals and
+ * matches are copied a run at a time, not a byte at a time.
+ */
+
+enum {
+	Lz4magic	= 0x184C2102,
+	Lz4minmatch	= 4,
+};
+
+static ulong
+lz4get4(uchar *p)
+{
+	return p[0] | p[1]<<8 | p[2]<<16 | (ulong)p[3]<<24;
+}
+
+int
+islz4(uchar *p)
+{
+	return lz4get4(p) == Lz4magic;
+}
+
+/* continue a length from a 15 nibble; -1 if the input ends */
+static long
+lz4len(uchar **ipp, uchar *ie)
+{
+	uchar *ip;
+	long n;
+	int c;
+
+	ip = *ipp;
+	n = 0;
+	do{
+		if(ip >= ie)
+			return -1;
+		c = *ip++;
+		n += c;
+	}while(c == 255);
+	*ipp = ip;
+	return n;
+}
+
+/*
+ * decode block in[0:ie] to out, stopping early if out fills at oe.
+ * returns the number of bytes decoded or -1 if the block is bad.
+ */
+static long
+lz4block(uchar *out, uchar *oe, uchar *in, uchar *ie)
+{
+	uchar *ip, *op, *m;
+	long n, c, l;
+	ulong off;
+	int tok;
+
+	ip = in;
+	op = out;
+	while(ip < ie){
+		tok = *ip++;
+		n = tok>>4;
+		if(n == 15){
+			if((l = lz4len(&ip, ie)) < 0)
+				return -1;
+			n += l;
+		}
+		if(n > ie-ip)
+			return -1;
+		c = n;
+		if(c > oe-op)
+			c = oe-op;
+		memmove(op, ip, c);
+		op += c;
+		ip += n;
+		if(c < n)
+			break;
+		if(ip == ie)
+			break;			/* the last sequence */
+
+		if(ie-ip < 2)
+			return -1;
+		off = ip[0] | ip[1]<<8;
+		ip += 2;
+		if(off == 0 || off > op-out)
+			return -1;
+		n = tok & 15;
+		if(n == 15){
+			if((l = lz4len(&ip, ie)) < 0)
+				return -1;
+			n += l;
+		}
+		n += Lz4minmatch;
+		if(n > oe-op)
+			n = oe-op;
+
+		/*
+		 * an overlapping match repeats its first off bytes;
+		 * each copy from m doubles what may be copied next.
+		 */
+		m = op - off;
+		while(n > 0){
+			c = op - m;
+			if(c > n)
+				c = n;
+			memmove(op, m, c);
+			op += c;
+			n -= c;
+		}
+		if(op == oe)
+			break;
+	}
+	return op - out;
+}
+
+/*
+ * decode the lz4 frame in[0:inn] to out, up to outn bytes.
+ * returns the number of bytes decoded or -1 on error.
+ */
+int
+unlz4(uchar *out, int outn, uchar *in, int inn)
+{
+	uchar *ip, *ie, *op, *oe;
+	ulong n;
+	long r;
+
+	if(inn < 4 || !islz4(in)){
+		print("bad magic\n");
+		return -1;
+	}
+	ip = in + 4;
+	ie = in + inn;
+	op = out;
+	oe = out + outn;
+	while(ie-ip >= 4 && op < oe){
+		n = lz4get4(ip);
+		ip += 4;
+		if(n == Lz4magic)
+			continue;		/* concatenated frames */
+		if(n > ie-ip){
+			print("lz4 block past end\n");
+			return -1;
+		}
+		r = lz4block(op, oe, ip, ip+n);
+		if(r < 0){
+			print("lz4 block corrupt\n");
+			return -1;
+		}
+		op += r;
+		ip += n;
+	}
+	return op - out;
+}
@@ -0,0 +1,259 @@
+#include	"u.h"
+#include	"../port/lib.h"
+#include	"mem.h"
+#include	"dat.h"
+#include	"fns.h"
+#include	<libsec.h>
+#include	"../port/aes.h"
+
+/*
+ *  AES for devtls and esp: cbc, and gcm (sp800-38d) in the form
+ *  rfc4106 uses, with a 4-byte salt and an 8-byte iv making up
+ *  the counter block.  The work goes through aesops, which is
+ *  libsec's until the machine installs something faster.
+ */
+
+enum
+{
+	Gcmbatch	= 8,	/* counter blocks encrypted at once */
+};
+
+static ushort gcmlast4[16] =
+{
+	0x0000, 0x1c20, 0x3840, 0x2460,
+	0x7080, 0x6ca0, 0x48c0, 0x54e0,
+	0xe100, 0xfd20, 0xd940, 0xc560,
+	0x9180, 0x8da0, 0xa9c0, 0xb5e0,
+};
+
+static void
+portcbcenc(AESstate *s, uchar *p, long n)
+{
+	aesCBCencrypt(p, n, s);
+}
+
+static void
+portcbcdec(AESstate *s, uchar *p, long n)
+{
+	aesCBCdecrypt(p, n, s);
+}
+
+/*
+ *  each buffer starts with its own iv, so none waits on another
+ */
+static void
+portcbcencn(AESstate *s, uchar **p, long *n, int nb)
+{
+	int i;
+
+	for(i = 0; i < nb; i++){
+		memmove(s->ivec, p[i], AESbsize);
+		aesCBCencrypt(p[i]+AESbsize, n[i]-AESbsize, s);
+	}
+}
+
+static void
+portecbenc(AESstate *s, uchar *in, uchar *out, long nblk)
+{
+	for(; nblk > 0; nblk--){
+		aes_encrypt(s->ekey, s->rounds, in, out);
+		in += AESbsize;
+		out += AESbsize;
+	}
+}
+
+static uvlong
+gcmget64(uchar *p)
+{
+	int i;
+	uvlong v;
+
+	v = 0;
+	for(i = 0; i < 8; i++)
+		v = v<<8 | p[i];
+	return v;
+}
+
+static void
+gcmput64(uchar *p, uvlong v)
+{
+	int i;
+
+	for(i = 7; i >= 0; i--){
+		p[i] = v;
+		v >>= 8;
+	}
+}
+
+/*
+ *  Shoup's 4-bit tables: hh and hl hold i·h for each nibble i,
+ *  bit-reflected as gcm has it
+ */
+static void
+gcmtable(Aesgcm *g)
+{
+	int i, j;
+	uvlong vh, vl, t;
+
+	vh = gcmget64(g->h);
+	vl = gcmget64(g->h+8);
+	g->hh[8] = vh;
+	g->hl[8] = vl;
+	for(i = 4; i > 0; i >>= 1){
+		t = (vl & 1) != 0 ? 0xe100000000000000ULL : 0;
+		vl = vh<<63 | vl>>1;
+		vh = vh>>1 ^ t;
+		g->hh[i] = vh;
+		g->hl[i] = vl;
+	}
+	for(i = 2; i <= 8; i *= 2)
+		for(j = 1; j < i; j++){
+			g->hh[i+j] = g->hh[i] ^ g->hh[j];
+			g->hl[i+j] = g->hl[i] ^ g->hl[j];
+		}
+}
+
+static void
+portghash(Aesgcm *g, uchar *x, uchar *p, long nblk)
+{
+	int i, n, rem;
+	uvlong zh, zl;
+	uchar y[AESbsize];
+
+	for(; nblk > 0; nblk--, p += AESbsize){
+		for(i = 0; i < AESbsize; i++)
+			y[i] = x[i] ^ p[i];
+		zh = 0;
+		zl = 0;
+		for(i = 2*AESbsize-1; i >= 0; i--){
+			if(i != 2*AESbsize-1){
+				rem = zl & 0xf;
+				zl = zh<<60 | zl>>4;
+				zh = zh>>4 ^ (uvlong)gcmlast4[rem]<<48;
+			}
+			n = i&1 ? y[i/2] & 0xf : y[i/2] >> 4;
+			zh ^= g->hh[n];
+			zl ^= g->hl[n];
+		}
+		gcmput64(x, zh);
+		gcmput64(x+8, zl);
+	}
+}
+
+Aesops portaesops = {
+	portcbcenc,
+	portcbcdec,
+	portecbenc,
+	portghash,
+	portcbcencn,
+};
+
+Aesops *aesops = &portaesops;
+
+void
+aescbcenc(AESstate *s, uchar *p, long n)
+{
+	aesops->cbcenc(s, p, n);
+}
+
+void
+aescbcdec(AESstate *s, uchar *p, long n)
+{
+	aesops->cbcdec(s, p, n);
+}
+
+void
+aescbcencn(AESstate *s, uchar **p, long *n, int nb)
+{
+	aesops->cbcencn(s, p, n, nb);
+}
+
+void
+setupaesgcm(Aesgcm *g, uchar *key, int keybytes, uchar *salt)
+{
+	uchar zero[AESbsize];
+
+	memset(g, 0, sizeof *g);
+	setupAESstate(&g->aes, key, keybytes, nil);
+	memmove(g->salt, salt, sizeof g->salt);
+	memset(zero, 0, sizeof zero);
+	aesops->ecbenc(&g->aes, zero, g->h, 1);
+	gcmtable(g);
+}
+
+static void
+gcmcounter(Aesgcm *g, uchar *iv, uchar *b, ulong n)
+{
+	memmove(b, g->salt, 4);
+	memmove(b+4, iv, 8);
+	b[12] = n>>24;
+	b[13] = n>>16;
+	b[14] = n>>8;
+	b[15] = n;
+}
+
+/*
+ *  encrypt or decrypt p in place; the first counter
+ *  block after the one for the tag is 2
+ */
+void
+aesgcmcrypt(Aesgcm *g, uchar *iv, uchar *p, long n)
+{
+	int i, nb, m;
+	ulong c;
+	uchar ctr[Gcmbatch*AESbsize], ks[Gcmbatch*AESbsize];
+
+	c = 2;
+	while(n > 0){
+		nb = (n+AESbsize-1)/AESbsize;
+		if(nb > Gcmbatch)
+			nb = Gcmbatch;
+		for(i = 0; i < nb; i++)
+			gcmcounter(g, iv, ctr+i*AESbsize, c++);
+		aesops->ecbenc(&g->aes, ctr, ks, nb);
+		m = nb*AESbsize;
+		if(m > n)
+			m = n;
+		for(i = 0; i < m; i++)
+			p[i] ^= ks[i];
+		p += m;
+		n -= m;
+	}
+}
+
+static void
+gcmhash(Aesgcm *g, uchar *x, uchar *p, long n)
+{
+	long m;
+	uchar b[AESbsize];
+
+	m = n & ~(AESbsize-1);
+	if(m > 0)
+		aesops->ghash(g, x, p, m/AESbsize);
+	if(n > m){
+		memset(b, 0, sizeof b);
+		memmove(b, p+m, n-m);
+		aesops->ghash(g, x, b, 1);
+	}
+}
+
+/*
+ *  the tag over additional data a and ciphertext c
+ */
+void
+aesgcmtag(Aesgcm *g, uchar *iv, uchar *a, long na, uchar *c, long nc, uchar *tag)
+{
+	int i;
+	uchar x[AESbsize], b[AESbsize];
+
+	memset(x, 0, sizeof x);
+	gcmhash(g, x, a, na);
+	gcmhash(g, x, c, nc);
+	gcmput64(b, (uvlong)na*8);
+	gcmput64(b+8, (uvlong)nc*8);
+	aesops->ghash(g, x, b, 1);
+	gcmcounter(g, iv, b, 1);
+	aesops->ecbenc(&g->aes, b, tag, 1);
+	for(i = 0; i < AESbsize; i++)
+		tag[i] ^= x[i];
+}
@@ -0,0 +1,32 @@
+/*
+ * AES modes for devtls and esp, over libsec's key schedule.
+ * A machine with instructions for them replaces aesops at boot.
+ */
+typedef struct Aesgcm Aesgcm;
+typedef struct Aesops Aesops;
+
+struct Aesgcm {
+	AESstate	aes;
+	uchar	h[AESbsize];		/* hash key, E(K, 0) */
+	uchar	salt[4];		/* first word of each counter block */
+	uvlong	hh[16];			/* multiples of h, for the portable ghash */
+	uvlong	hl[16];
+};
+
+struct Aesops {
+	void	(*cbcenc)(AESstate*, uchar*, long);
+	void	(*cbcdec)(AESstate*, uchar*, long);
+	void	(*ecbenc)(AESstate*, uchar*, uchar*, long);	/* in, out, blocks */
+	void	(*ghash)(Aesgcm*, uchar*, uchar*, long);	/* x, data, blocks */
+	void	(*cbcencn)(AESstate*, uchar**, long*, int);	/* bufs led by their ivs */
+};
+
+extern Aesops	*aesops;
+extern Aesops	portaesops;
+
+void	aescbcenc(AESstate*, uchar*, long);
+void	aescbcdec(AESstate*, uchar*, long);
+void	aescbcencn(AESstate*, uchar**, long*, int);
+void	setupaesgcm(Aesgcm*, uchar*, int, uchar*);
+void	aesgcmcrypt(Aesgcm*, uchar*, uchar*, long);
+void	aesgcmtag(Aesgcm*, uchar*, uchar*, long, uchar*, long, uchar*);
@@ -0,0 +1,514 @@
+#include	"u.h"
+#include	"../port/lib.h"
+#include	"mem.h"
+#include	"dat.h"
+#include	"fns.h"
+#include	"../port/error.h"
+
+/*
+ *  Asynchronous I/O.  A process shares one ring with the kernel,
+ *  in its own memory:
+ *
+ *	ulong	sqhead;		advanced by the kernel
+ *	ulong	sqtail;		advanced by the process
+ *	ulong	cqhead;		advanced by the process
+ *	ulong	cqtail;		advanced by the kernel
+ *	Aiosqe	sq[n];
+ *	Aiocqe	cq[n];
+ *
+ *  aiosetup(ring, n) registers it; aioenter(minwait, ms) takes the
+ *  submissions between sqhead and sqtail and waits for minwait
+ *  completions.  Worker kprocs run each request through the Dev's
+ *  bread or bwrite and store its completion straight into the
+ *  ring, so a process can reap them without entering the kernel.
+ *  At most n requests are in flight or unreaped, so the completion
+ *  ring cannot overflow; later submissions wait in the ring.
+ */
+
+enum
+{
+	Aioread		= 1,
+	Aiowrite	= 2,
+
+	Maxaio		= 4096,		/* ring entries */
+	Maxaiolen	= 64*1024,	/* bytes in one request */
+	Naioproc	= 8,		/* worker kprocs */
+	Aioerrlen	= 56,
+};
+
+typedef struct Aiosqe	Aiosqe;
+typedef struct Aiocqe	Aiocqe;
+typedef struct Aioreq	Aioreq;
+
+struct Aiosqe
+{
+	ulong	op;
+	long	fd;
+	ulong	buf;
+	ulong	len;
+	vlong	off;		/* -1 uses and advances the fd's offset */
+	ulong	tag;
+	ulong	flags;
+};
+
+struct Aiocqe
+{
+	ulong	tag;
+	long	ret;		/* bytes, or -1 and err */
+	char	err[Aioerrlen];
+};
+
+struct Aio
+{
+	Lock;
+	QLock	cq;		/* one completion stored at a time */
+	Rendez	r;		/* owner waits for completions */
+	Proc	*owner;
+	ulong	ring;
+	int	n;
+	ulong	sqhead;
+	ulong	cqtail;
+	int	inflight;
+	int	dead;
+};
+
+struct Aioreq
+{
+	Aioreq	*next;
+	Aio	*aio;
+	Proc	*proc;		/* worker running it */
+	Chan	*c;
+	int	op;
+	ulong	buf;
+	long	len;
+	vlong	off;
+	ulong	tag;
+	Block	*b;		/* data to write */
+};
+
+static struct
+{
+	Lock;
+	Rendez	r;
+	Aioreq	*head;
+	Aioreq	*tail;
+	Aioreq	*busy[Naioproc];
+	QLock	noteq[Naioproc];	/* notes for busy[i] only */
+	int	nproc;
+	int	idle;
+} aiowork;
+
+#define	SQ(a, i)	((a)->ring + 4*BY2WD + ((i)&((a)->n-1))*sizeof(Aiosqe))
+#define	CQ(a, i)	((a)->ring + 4*BY2WD + (a)->n*sizeof(Aiosqe) + ((i)&((a)->n-1))*sizeof(Aiocqe))
+
+/*
+ *  copy to or from p's memory from any process
+ */
+static void
+aiomemio(Proc *p, ulong addr, void *va, long n, int read)
+{
+	long m;
+
+	while(n > 0){
+		m = procctlmemio(p, addr, n, va, read);
+		addr += m;
+		va = (char*)va + m;
+		n -= m;
+	}
+}
+
+/*
+ *  store a completion; the entry is written before the tail
+ */
+static void
+aiopost(Aio *a, ulong tag, long ret, char *err)
+{
+	Aiocqe ce;
+	ulong t;
+
+	memset(&ce, 0, sizeof ce);
+	ce.tag = tag;
+	ce.ret = ret;
+	if(err != nil)
+		strncpy(ce.err, err, sizeof ce.err-1);
+
+	qlock(&a->cq);
+	t = a->cqtail;
+	if(!a->dead && !waserror()){
+		aiomemio(a->owner, CQ(a, t), &ce, sizeof ce, 0);
+		coherence();
+		t++;
+		aiomemio(a->owner, a->ring + 3*BY2WD, &t, sizeof t, 0);
+		poperror();
+	}
+	lock(a);
+	a->cqtail++;
+	unlock(a);
+	qunlock(&a->cq);
+	wakeup(&a->r);
+}
+
+static void
+aiofinish(Aioreq *r, long ret, char *err)
+{
+	Aio *a;
+
+	a = r->aio;
+	aiopost(a, r->tag, ret, err);
+	if(r->b != nil)
+		freeb(r->b);
+	cclose(r->c);
+	free(r);
+	lock(a);
+	a->inflight--;
+	unlock(a);
+	wakeup(&a->r);
+}
+
+static void
+aiodo(Aioreq *r)
+{
+	Chan *c;
+	Block *b, *bb;
+	long n, m;
+	vlong off;
+
+	c = r->c;
+	off = r->off;
+	if(off < 0)
+		off = c->offset;
+	switch(r->op){
+	case Aioread:
+		b = devtab[c->type]->bread(c, r->len, off);
+		if(waserror()){
+			freeblist(b);
+			nexterror();
+		}
+		n = 0;
+		for(bb = b; bb != nil && n < r->len; bb = bb->next){
+			m = BLEN(bb);
+			if(m > r->len - n)
+				m = r->len - n;
+			if(r->aio->dead)
+				error(Eintr);
+			aiomemio(r->aio->owner, r->buf+n, bb->rp, m, 0);
+			n += m;
+		}
+		poperror();
+		freeblist(b);
+		break;
+	case Aiowrite:
+		b = r->b;
+		r->b = nil;
+		n = devtab[c->type]->bwrite(c, b, off);
+		break;
+	default:
+		error(Ebadarg);
+		return;
+	}
+	USED(m);
+	iocount(r->aio->owner, c, n, r->op == Aioread? OREAD: OWRITE);
+	if(r->off < 0){
+		lock(c);
+		c->devoffset += n;
+		c->offset += n;
+		unlock(c);
+	}
+	aiofinish(r, n, nil);
+}
+
+static int
+aiohavework(void*)
+{
+	return aiowork.head != nil;
+}
+
+static void
+aioproc(void *x)
+{
+	int slot;
+	Aioreq *r;
+
+	slot = (int)x;
+	for(;;){
+		lock(&aiowork);
+		while((r = aiowork.head) == nil){
+			aiowork.idle++;
+			unlock(&aiowork);
+			if(!waserror()){
+				sleep(&aiowork.r, aiohavework, nil);
+				poperror();
+			}
+			lock(&aiowork);
+			aiowork.idle--;
+		}
+		aiowork.head = r->next;
+		r->proc = up;
+		aiowork.busy[slot] = r;
+		unlock(&aiowork);
+
+		if(waserror())
+			aiofinish(r, -1, up->errstr);
+		else{
+			aiodo(r);
+			poperror();
+		}
+
+		/* a note meant for r must not reach the next request */
+		qlock(&aiowork.noteq[slot]);
+		lock(&aiowork);
+		aiowork.busy[slot] = nil;
+		unlock(&aiowork);
+		up->nnote = 0;
+		up->notepending = 0;
+		qunlock(&aiowork.noteq[slot]);
+	}
+}
+
+static void
+aioqueue(Aioreq *r)
+{
+	int start;
+
+	start = -1;
+	lock(&aiowork);
+	r->next = nil;
+	if(aiowork.head == nil)
+		aiowork.head = r;
+	else
+		aiowork.tail->next = r;
+	aiowork.tail = r;
+	if(aiowork.idle == 0 && aiowork.nproc < Naioproc)
+		start = aiowork.nproc++;
+	unlock(&aiowork);
+	if(start >= 0)
+		kproc("aio", aioproc, (void*)start);
+	else
+		wakeup(&aiowork.r);
+}
+
+/*
+ *  turn one submission into a request, in the submitter's context
+ */
+static Aioreq*
+aioreq(Aio *a, Aiosqe *e)
+{
+	Aioreq *r;
+	Chan *c;
+	Block *b;
+
+	if(e->len > Maxaiolen)
+		error(Etoobig);
+	if(e->off < 0 && e->off != -1)
+		error(Enegoff);
+	switch(e->op){
+	case Aioread:
+		validaddr(e->buf, e->len, 1);
+		c = fdtochan(e->fd, OREAD, 1, 1);
+		break;
+	case Aiowrite:
+		validaddr(e->buf, e->len, 0);
+		c = fdtochan(e->fd, OWRITE, 1, 1);
+		break;
+	default:
+		error(Ebadarg);
+		return nil;
+	}
+	if(waserror()){
+		cclose(c);
+		nexterror();
+	}
+	if(c->qid.type & QTDIR)
+		error(Eisdir);
+	r = smalloc(sizeof(Aioreq));
+	r->aio = a;
+	r->c = c;
+	r->op = e->op;
+	r->buf = e->buf;
+	r->len = e->len;
+	r->off = e->off;
+	r->tag = e->tag;
+	if(e->op == Aiowrite){
+		b = allocb(e->len);
+		if(waserror()){
+			freeb(b);
+			free(r);
+			nexterror();
+		}
+		memmove(b->wp, (void*)e->buf, e->len);
+		b->wp += e->len;
+		poperror();
+		r->b = b;
+	}
+	poperror();
+	return r;
+}
+
+/*
+ *  aiosetup(ring, n): share ring, with n (a power of two) entries
+ *  in each of its queues.  n 0 detaches the ring once idle.
+ */
+long
+sysaiosetup(ulong *arg)
+{
+	Aio *a;
+	int n;
+
+	n = arg[1];
+	if(n == 0){
+		if(up->aio != nil){
+			aiofree(up->aio);
+			up->aio = nil;
+		}
+		return 0;
+	}
+	if(n < 0 || n > Maxaio || (n & (n-1)) != 0)
+		error(Ebadarg);
+	if(up->aio != nil)
+		error(Einuse);
+	validaddr(arg[0], 4*BY2WD + n*(sizeof(Aiosqe)+sizeof(Aiocqe)), 1);
+	evenaddr(arg[0]);
+	a = smalloc(sizeof(Aio));
+	a->owner = up;
+	a->ring = arg[0];
+	a->n = n;
+	a->sqhead = ((ulong*)a->ring)[1];
+	a->cqtail = ((ulong*)a->ring)[2];
+	((ulong*)a->ring)[0] = a->sqhead;
+	((ulong*)a->ring)[3] = a->cqtail;
+	up->aio = a;
+	return 0;
+}
+
+static int
+aioreaped(void *x)
+{
+	Aio *a;
+
+	a = x;
+	return a->inflight == 0;
+}
+
+typedef struct Aiowait	Aiowait;
+struct Aiowait
+{
+	Aio	*a;
+	ulong	want;
+};
+
+static int
+aiowaitdone(void *x)
+{
+	Aiowait *w;
+
+	w = x;
+	return (long)(w->a->cqtail - w->want) >= 0 || w->a->inflight == 0;
+}
+
+/*
+ *  aioenter(minwait, ms): submit what is in the ring, then wait
+ *  for minwait unreaped completions or ms milliseconds (ms < 0
+ *  waits for ever).  Returns the number submitted.
+ */
+long
+sysaioenter(ulong *arg)
+{
+	Aio *a;
+	Aiosqe e;
+	Aioreq *r;
+	Aiowait w;
+	ulong *ring, tail;
+	long room, n, ms;
+	int minwait;
+
+	if((a = up->aio) == nil)
+		error(Ebadarg);
+	minwait = arg[0];
+	ms = arg[1];
+	validaddr(a->ring, 4*BY2WD + a->n*(sizeof(Aiosqe)+sizeof(Aiocqe)), 1);
+	ring = (ulong*)a->ring;
+
+	/* completions still in the ring count against the window */
+	lock(a);
+	room = a->n - a->inflight - (a->cqtail - ring[2]);
+	unlock(a);
+	tail = ring[1];
+	for(n = 0; a->sqhead != tail && n < room; n++){
+		memmove(&e, (void*)SQ(a, a->sqhead), sizeof e);
+		a->sqhead++;
+		lock(a);
+		a->inflight++;
+		unlock(a);
+		if(waserror()){
+			aiopost(a, e.tag, -1, up->errstr);
+			lock(a);
+			a->inflight--;
+			unlock(a);
+			continue;
+		}
+		r = aioreq(a, &e);
+		poperror();
+		aioqueue(r);
+	}
+	ring[0] = a->sqhead;
+
+	/* an interrupted wait still reports what was submitted */
+	if(minwait > 0 && !waserror()){
+		w.a = a;
+		w.want = ring[2] + minwait;
+		if(ms < 0)
+			sleep(&a->r, aiowaitdone, &w);
+		else if(ms > 0)
+			tsleep(&a->r, aiowaitdone, &w, ms);
+		poperror();
+	}
+	return n;
+}
+
+/*
+ *  interrupt the requests still running and wait for them;
+ *  called by the owner, before its memory goes
+ */
+void
+aiofree(Aio *a)
+{
+	int i;
+	Proc *p;
+	Aioreq *r, **l;
+
+	a->dead = 1;
+	lock(&aiowork);
+	for(l = &aiowork.head; (r = *l) != nil; ){
+		if(r->aio == a){
+			*l = r->next;
+			unlock(&aiowork);
+			aiofinish(r, -1, Eintr);
+			lock(&aiowork);
+			l = &aiowork.head;
+			continue;
+		}
+		aiowork.tail = r;
+		l = &r->next;
+	}
+	unlock(&aiowork);
+	for(i = 0; i < Naioproc; i++){
+		qlock(&aiowork.noteq[i]);
+		lock(&aiowork);
+		p = nil;
+		if((r = aiowork.busy[i]) != nil && r->aio == a)
+			p = r->proc;
+		unlock(&aiowork);
+		if(p != nil)
+			postnote(p, 0, Eintr, NUser);
+		qunlock(&aiowork.noteq[i]);
+	}
+
+	while(a->inflight > 0){
+		if(!waserror()){
+			tsleep(&a->r, aioreaped, a, 100);
+			poperror();
+		}
+		up->notepending = 0;
+	}
+	free(a);
+}
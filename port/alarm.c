@@ -4,98 +4,110 @@
 #include	"dat.h"
 #include	"fns.h"
 
+/*
+ *  Each process's alarm is a Timer of its own.  When it goes off,
+ *  alarmintr puts the process on the alarms list and wakes
+ *  alarmkproc, which posts the notes; that takes qlocks, so it
+ *  cannot be done from the clock interrupt.
+ */
 static Alarms	alarms;
 static Rendez	alarmr;
 
+/* called with alarms ilocked */
+static void
+alarmqueue(Proc *p)
+{
+	if(p->alarmq)
+		return;
+	p->alarmq = 1;
+	p->palarm = nil;
+	if(alarms.head == nil)
+		alarms.head = p;
+	else
+		alarms.tail->palarm = p;
+	alarms.tail = p;
+}
+
+static int
+alarmsdue(void*)
+{
+	return alarms.head != nil;
+}
+
 void
 alarmkproc(void*)
 {
 	Proc *rp;
-	ulong now;
+	int pending;
 
 	for(;;){
-		now = MACHP(0)->ticks;
-		qlock(&alarms);
-		while((rp = alarms.head) && rp->alarm <= now){
-			if(rp->alarm != 0L){
-				if(canqlock(&rp->debug)){
-					if(!waserror()){
-						postnote(rp, 0, "alarm", NUser);
-						poperror();
-					}
-					qunlock(&rp->debug);
-					rp->alarm = 0L;
-				}else
-					break;
+		sleep(&alarmr, alarmsdue, 0);
+		for(;;){
+			ilock(&alarms);
+			if((rp = alarms.head) == nil){
+				iunlock(&alarms);
+				break;
 			}
 			alarms.head = rp->palarm;
+			rp->palarm = nil;
+			rp->alarmq = 0;
+			/* reset since it went off, or already delivered */
+			pending = rp->alarmt.tt != nil || rp->alarm == 0;
+			iunlock(&alarms);
+			if(pending)
+				continue;
+			if(canqlock(&rp->debug)){
+				if(!waserror()){
+					postnote(rp, 0, "alarm", NUser);
+					poperror();
+				}
+				qunlock(&rp->debug);
+				rp->alarm = 0L;
+			}else{
+				/* try again later */
+				ilock(&alarms);
+				alarmqueue(rp);
+				iunlock(&alarms);
+				tsleep(&up->sleep, return0, 0, 1000/HZ);
+			}
 		}
-		qunlock(&alarms);
-
-		sleep(&alarmr, return0, 0);
 	}
 }
 
-/*
- *  called every clock tick
- */
-void
-checkalarms(void)
+static void
+alarmintr(Ureg*, Timer *t)
 {
 	Proc *p;
-	ulong now;
-
-	p = alarms.head;
-	now = MACHP(0)->ticks;
 
-	if(p && p->alarm <= now)
-		wakeup(&alarmr);
+	p = t->ta;
+	ilock(&alarms);
+	alarmqueue(p);
+	iunlock(&alarms);
+	wakeup(&alarmr);
 }
 
 ulong
 procalarm(ulong time)
 {
-	Proc **l, *f;
-	ulong when, old;
+	ulong old;
 
 	if(up->alarm)
 		old = tk2ms(up->alarm - MACHP(0)->ticks);
 	else
 		old = 0;
+	timerdel(&up->alarmt);
 	if(time == 0) {
 		up->alarm = 0;
 		return old;
 	}
-	when = ms2tk(time)+MACHP(0)->ticks;
-
-	qlock(&alarms);
-	l = &alarms.head;
-	for(f = *l; f; f = f->palarm) {
-		if(up == f){
-			*l = f->palarm;
-			break;
-		}
-		l = &f->palarm;
-	}
-
-	up->palarm = 0;
-	if(alarms.head) {
-		l = &alarms.head;
-		for(f = *l; f; f = f->palarm) {
-			if(f->alarm > when) {
-				up->palarm = f;
-				*l = up;
-				goto done;
-			}
-			l = &f->palarm;
-		}
-		*l = up;
-	}
-	else
-		alarms.head = up;
-done:
-	up->alarm = when;
-	qunlock(&alarms);
+	up->alarm = ms2tk(time)+MACHP(0)->ticks;
+	if(up->alarm == 0)
+		up->alarm = 1;
+	up->alarmt.tmode = Trelative;
+	up->alarmt.tns = (vlong)time*1000000LL;
+	up->alarmt.tf = alarmintr;
+	up->alarmt.ta = up;
+	timeradd(&up->alarmt);
 
 	return old;
 }
@@ -116,6 +116,131 @@ punlock(Pool *p)
 	iprint("%.*s", sizeof pv->msg, msg);
 }
 
+/*
+ *  small allocations come in size classes of powers of two.
+ *  A freed small block keeps its class and goes on the freeing
+ *  processor's magazine for that class, for malloc there to reuse
+ *  without taking the pool lock; full or empty magazines move half
+ *  to or from the shared depot.  The blocks remain pool blocks,
+ *  so msize and realloc work on them as before.  Magazines are
+ *  only touched splhi by their own processor.
+ */
+enum {
+	Nslab		= 6,
+	Slabmin		= 32,		/* slab class c holds Slabmin<<c bytes */
+	Nmag		= 16,		/* blocks per processor and class */
+	Ndepot		= 64,		/* blocks per class in the depot */
+	Slabmagic	= 0x51AB5100,	/* | class, in a block's slab word */
+};
+
+typedef struct Mag Mag;
+struct Mag {
+	void	*head;
+	int	n;
+};
+
+static Mag mags[MAXMACH][Nslab];
+
+static struct {
+	Lock;
+	Mag	depot[Nslab];
+	ulong	hit[Nslab];
+	ulong	miss[Nslab];
+	ulong	cached[Nslab];
+} slabs;
+
+static int
+slabclass(ulong size)
+{
+	int c;
+
+	for(c = 0; c < Nslab; c++)
+		if(size <= Slabmin<<c)
+			return c;
+	return -1;
+}
+
+/* move blocks from one magazine to another until it holds want */
+static void
+magmove(Mag *from, Mag *to, int want)
+{
+	void *v;
+
+	while(to->n < want && (v = from->head) != nil){
+		from->head = *(void**)v;
+		from->n--;
+		*(void**)v = to->head;
+		to->head = v;
+		to->n++;
+	}
+}
+
+/* a cached block of class c, past its padding, or nil */
+static void*
+slabget(int c)
+{
+	Mag *mg;
+	void *v;
+	int s;
+
+	s = splhi();
+	mg = &mags[m->machno][c];
+	if(mg->head == nil){
+		ilock(&slabs);
+		magmove(&slabs.depot[c], mg, Nmag/2);
+		iunlock(&slabs);
+	}
+	v = mg->head;
+	if(v != nil){
+		mg->head = *(void**)v;
+		mg->n--;
+		slabs.hit[c]++;
+	}else
+		slabs.miss[c]++;
+	splx(s);
+	return v;
+}
+
+/* keep v, past its padding, for reuse; zero if there is no room */
+static int
+slabput(void *v, int c)
+{
+	Mag *mg, *d;
+	int s, want;
+
+	s = splhi();
+	mg = &mags[m->machno][c];
+	if(mg->n >= Nmag){
+		ilock(&slabs);
+		d = &slabs.depot[c];
+		want = d->n + Nmag/2;
+		if(want > Ndepot)
+			want = Ndepot;
+		magmove(mg, d, want);
+		iunlock(&slabs);
+		if(mg->n >= Nmag){
+			splx(s);
+			return 0;
+		}
+	}
+	*(void**)v = mg->head;
+	mg->head = v;
+	mg->n++;
+	slabs.cached[c]++;
+	splx(s);
+	return 1;
+}
+
+void
+slabsummary(void)
+{
+	int c;
+
+	for(c = 0; c < Nslab; c++)
+		print("slab %d: hit %lud miss %lud cached %lud depot %d\n",
+			Slabmin<<c, slabs.hit[c], slabs.miss[c], slabs.cached[c], slabs.depot[c].n);
+}
+
 void
 poolsummary(Pool *p)
 {
@@ -128,6 +253,7 @@ mallocsummary(void)
 {
 	poolsummary(mainmem);
 	poolsummary(imagmem);
+	slabsummary();
 }
 
 /* everything from here down should be the same in libc, libdebugmalloc, and the kernel */
@@ -164,6 +290,31 @@ enum {
 	ReallocOffset = 1
 };
 
+/*
+ * allocate size bytes past the padding, from a magazine if it
+ * is small; the result is not cleared.  Until the block is
+ * realloced, its realloc tag holds Slabmagic|class, or 0.
+ */
+static void*
+alloc(ulong size)
+{
+	void *v;
+	int c;
+
+	c = slabclass(size);
+	if(c >= 0){
+		if((v = slabget(c)) != nil)
+			return v;
+		size = Slabmin<<c;
+	}
+	v = poolalloc(mainmem, size+Npadlong*sizeof(ulong));
+	if(v == nil)
+		return nil;
+	v = (ulong*)v+Npadlong;
+	((ulong*)v)[-Npadlong+ReallocOffset] = c >= 0 ? Slabmagic|c : 0;
+	return v;
+}
+
 
 void*
 smalloc(ulong size)
@@ -171,32 +322,43 @@ smalloc(ulong size)
 	void *v;
 
 	for(;;) {
-		v = poolalloc(mainmem, size+Npadlong*sizeof(ulong));
+		v = alloc(size);
 		if(v != nil)
 			break;
 		tsleep(&up->sleep, return0, 0, 100);
 	}
-	if(Npadlong){
-		v = (ulong*)v+Npadlong;
-		setmalloctag(v, getcallerpc(&size));
-	}
+	setmalloctag(v, getcallerpc(&size));
 	memset(v, 0, size);
 	return v;
 }
 
+/* smalloc, optionally without clearing, for callers that fill it all */
+void*
+smallocz(ulong size, int clr)
+{
+	void *v;
+
+	for(;;) {
+		v = alloc(size);
+		if(v != nil)
+			break;
+		tsleep(&up->sleep, return0, 0, 100);
+	}
+	setmalloctag(v, getcallerpc(&size));
+	if(clr)
+		memset(v, 0, size);
+	return v;
+}
+
 void*
 malloc(ulong size)
 {
 	void *v;
 
-	v = poolalloc(mainmem, size+Npadlong*sizeof(ulong));
+	v = alloc(size);
 	if(v == nil)
 		return nil;
-	if(Npadlong){
-		v = (ulong*)v+Npadlong;
-		setmalloctag(v, getcallerpc(&size));
-		setrealloctag(v, 0);
-	}
+	setmalloctag(v, getcallerpc(&size));
 	memset(v, 0, size);
 	return v;
 }
@@ -206,13 +368,11 @@ mallocz(ulong size, int clr)
 {
 	void *v;
 
-	v = poolalloc(mainmem, size+Npadlong*sizeof(ulong));
-	if(Npadlong && v != nil){
-		v = (ulong*)v+Npadlong;
-		setmalloctag(v, getcallerpc(&size));
-		setrealloctag(v, 0);
-	}
-	if(clr && v != nil)
+	v = alloc(size);
+	if(v == nil)
+		return nil;
+	setmalloctag(v, getcallerpc(&size));
+	if(clr)
 		memset(v, 0, size);
 	return v;
 }
@@ -236,8 +396,14 @@ mallocalign(ulong size, ulong align, long offset, ulong span)
 void
 free(void *v)
 {
-	if(v != nil)
-		poolfree(mainmem, (ulong*)v-Npadlong);
+	ulong w;
+
+	if(v == nil)
+		return;
+	w = ((ulong*)v)[-Npadlong+ReallocOffset];
+	if((w & ~0xFF) == Slabmagic && (w & 0xFF) < Nslab && slabput(v, w & 0xFF))
+		return;
+	poolfree(mainmem, (ulong*)v-Npadlong);
 }
 
 void*
@@ -252,7 +418,7 @@ realloc(void *v, ulong size)
 
 	if(nv = poolrealloc(mainmem, v, size)){
 		nv = (ulong*)nv+Npadlong;
-		setrealloctag(nv, getcallerpc(&v));
+		setrealloctag(nv, getcallerpc(&v));	/* no longer of its class */
 		if(v == nil)
 			setmalloctag(nv, getcallerpc(&v));
 	}		
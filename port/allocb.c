@@ -9,13 +9,52 @@ enum
 {
 	Hdrspc		= 64,		/* leave room for high-level headers */
 	Bdead		= 0x51494F42,	/* "QIOB" */
+
+	Nbclass		= 3,
+	Bclassshift	= 6,		/* of Bclass in Block.flag */
+	Nbcache		= 32,		/* blocks per processor and class */
+	Nbbatch		= Nbcache/2,	/* moved at a time to or from bdepot */
+	Nbdepot		= 256,		/* blocks per class in bdepot */
 };
 
-struct
+/*
+ *  freed blocks of the common sizes are kept on the processor
+ *  that freed them, for allocb and iallocb there to reuse without
+ *  going to malloc.  A processor with too many, or none, moves a
+ *  batch to or from the shared depot.  The lists are only touched
+ *  splhi by their own processor.
+ */
+typedef struct Bcache Bcache;
+struct Bcache
+{
+	Block	*head;
+	int	n;
+};
+
+static int bclasssize[Nbclass] = { 128, 2048, 9*1024 };
+
+static Bcache	bcache[MAXMACH][Nbclass];
+
+static struct
 {
 	Lock;
-	ulong	bytes;
-} ialloc;
+	Block	*head[Nbclass];
+	int	n[Nbclass];
+} bdepot;
+
+static struct
+{
+	ulong	hit[Nbclass];
+	ulong	miss[Nbclass];
+	ulong	cached[Nbclass];	/* frees kept for reuse */
+	ulong	refill[Nbclass];	/* batches from bdepot */
+	ulong	spill[Nbclass];		/* batches to bdepot */
+} bstats;
+
+/* interrupt time allocation, counted by the processor that did it */
+static long	ibytes[MAXMACH];
+
+ulong	sharedcnt;	/* Blocks made by shareblock */
 
 static Block*
 _allocb(int size)
@@ -29,6 +68,7 @@ _allocb(int size)
 	b->next = nil;
 	b->list = nil;
 	b->free = 0;
+	b->shared = nil;
 	b->flag = 0;
 	b->ref = 0;
 	_xinc(&b->ref);
@@ -53,6 +93,144 @@ _allocb(int size)
 	return b;
 }
 
+static int
+bclass(int size)
+{
+	int c;
+
+	for(c = 0; c < Nbclass; c++)
+		if(size <= bclasssize[c])
+			return c;
+	return -1;
+}
+
+/* make a cached or new class block ready for size bytes */
+static Block*
+bclassinit(Block *b, int c, int size)
+{
+	b->next = nil;
+	b->list = nil;
+	b->free = 0;
+	b->shared = nil;
+	b->flag = (c+1)<<Bclassshift;
+	b->checksum = 0;
+	b->ref = 1;
+	b->rp = b->lim - ROUND(size, BLOCKALIGN);
+	b->wp = b->rp;
+	return b;
+}
+
+/* called splhi */
+static void
+brefill(Bcache *bc, int c)
+{
+	Block *b;
+
+	ilock(&bdepot);
+	while(bc->n < Nbbatch && (b = bdepot.head[c]) != nil){
+		bdepot.head[c] = b->next;
+		bdepot.n[c]--;
+		b->next = bc->head;
+		bc->head = b;
+		bc->n++;
+	}
+	iunlock(&bdepot);
+	if(bc->head != nil)
+		bstats.refill[c]++;
+}
+
+/* called splhi; returns non-zero if there is room in bc again */
+static int
+bspill(Bcache *bc, int c)
+{
+	Block *b;
+
+	ilock(&bdepot);
+	while(bc->n > Nbcache-Nbbatch && bdepot.n[c] < Nbdepot){
+		b = bc->head;
+		bc->head = b->next;
+		bc->n--;
+		b->next = bdepot.head[c];
+		bdepot.head[c] = b;
+		bdepot.n[c]++;
+	}
+	iunlock(&bdepot);
+	if(bc->n < Nbcache){
+		bstats.spill[c]++;
+		return 1;
+	}
+	return 0;
+}
+
+static Block*
+bcacheget(int size)
+{
+	Bcache *bc;
+	Block *b;
+	int c, s;
+
+	c = bclass(size);
+	if(c < 0)
+		return _allocb(size);
+	s = splhi();
+	bc = &bcache[m->machno][c];
+	if(bc->head == nil)
+		brefill(bc, c);
+	b = bc->head;
+	if(b != nil){
+		bc->head = b->next;
+		bc->n--;
+		bstats.hit[c]++;
+	}
+	splx(s);
+	if(b == nil){
+		bstats.miss[c]++;
+		if((b = _allocb(bclasssize[c])) == nil)
+			return nil;
+	}
+	return bclassinit(b, c, size);
+}
+
+/* keep a freed class block for reuse; zero if there is no room */
+static int
+bcacheput(Block *b)
+{
+	void *dead = (void*)Bdead;
+	Bcache *bc;
+	int c, s;
+
+	c = ((b->flag & Bclass) >> Bclassshift) - 1;
+	if(b->lim - b->base < ROUND(bclasssize[c], BLOCKALIGN))
+		return 0;	/* a driver trimmed lim */
+	s = splhi();
+	bc = &bcache[m->machno][c];
+	if(bc->n >= Nbcache && !bspill(bc, c)){
+		splx(s);
+		return 0;
+	}
+	/* poison what allocb resets, in case someone still holds b */
+	b->rp = dead;
+	b->wp = dead;
+	b->next = bc->head;
+	bc->head = b;
+	bc->n++;
+	bstats.cached[c]++;
+	splx(s);
+	return 1;
+}
+
+static long
+iallocbytes(void)
+{
+	long n;
+	int i;
+
+	n = 0;
+	for(i = 0; i < conf.nmach; i++)
+		n += ibytes[i];
+	return n;
+}
+
 Block*
 allocb(int size)
 {
@@ -64,7 +242,7 @@ allocb(int size)
 	 */
 	if(up == nil)
 		panic("allocb without up: %#p", getcallerpc(&size));
-	if((b = _allocb(size)) == nil){
+	if((b = bcacheget(size)) == nil){
 		xsummary();
 		mallocsummary();
 		panic("allocb: no memory for %d bytes", size);
@@ -78,46 +256,107 @@ Block*
 iallocb(int size)
 {
 	Block *b;
+	int s;
 	static int m1, m2, mp;
 
-	if(ialloc.bytes > conf.ialloc){
+	if(iallocbytes() > conf.ialloc){
 		if((m1++%10000)==0){
 			if(mp++ > 1000){
 				active.exiting = 1;
 				exit(0);
 			}
 			iprint("iallocb: limited %lud/%lud\n",
-				ialloc.bytes, conf.ialloc);
+				iallocbytes(), conf.ialloc);
 		}
 		return nil;
 	}
 
-	if((b = _allocb(size)) == nil){
+	if((b = bcacheget(size)) == nil){
 		if((m2++%10000)==0){
 			if(mp++ > 1000){
 				active.exiting = 1;
 				exit(0);
 			}
 			iprint("iallocb: no memory %lud/%lud\n",
-				ialloc.bytes, conf.ialloc);
+				iallocbytes(), conf.ialloc);
 		}
 		return nil;
 	}
 	setmalloctag(b, getcallerpc(&size));
-	b->flag = BINTR;
+	b->flag |= BINTR;
 
-	ilock(&ialloc);
-	ialloc.bytes += b->lim - b->base;
-	iunlock(&ialloc);
+	s = splhi();
+	ibytes[m->machno] += b->lim - b->base;
+	splx(s);
 
 	return b;
 }
 
+/*
+ *  a Block for bytes rp to wp of b's buffer, without copying them.
+ *  b stays allocated until it and every Block sharing it are freed.
+ *  The new Block has no room before rp or after wp, so padblock
+ *  and the like copy rather than write over b's other bytes.
+ *  Returns nil, for the caller to copy instead, if out of memory.
+ */
+Block*
+shareblock(Block *b, uchar *rp, uchar *wp)
+{
+	Block *nb;
+
+	if(rp < b->rp || wp > b->wp || rp > wp)
+		panic("shareblock %#p", getcallerpc(&b));
+	if(b->shared != nil)
+		b = b->shared;
+	if((nb = mallocz(sizeof(Block), 0)) == nil)
+		return nil;
+	setmalloctag(nb, getcallerpc(&b));
+	_xinc(&b->ref);
+	nb->next = nil;
+	nb->list = nil;
+	nb->free = 0;
+	nb->shared = b;
+	nb->flag = 0;
+	nb->checksum = 0;
+	nb->ref = 1;
+	nb->base = rp;
+	nb->lim = wp;
+	nb->rp = rp;
+	nb->wp = wp;
+	sharedcnt++;
+	return nb;
+}
+
+/*
+ *  b, or a private copy of it if any of its buffers is shared
+ *  with another Block, for a caller about to write into it in
+ *  place.  Sharers only ever read what they share.
+ */
+Block*
+unshareblock(Block *b)
+{
+	Block *p, *nb;
+
+	for(p = b; p != nil; p = p->next)
+		if(p->ref > 1 || p->shared != nil && p->shared->ref > 1)
+			break;
+	if(p == nil)
+		return b;
+	nb = copyblock(b, blocklen(b));
+	nb->flag |= b->flag & (Bipck|Budpck|Btcpck|Bpktck);
+	nb->checksum = b->checksum;
+	nb->mss = b->mss;
+	freeblist(b);
+	return nb;
+}
+
 void
 freeb(Block *b)
 {
 	void *dead = (void*)Bdead;
+	Block *sb;
 	long ref;
+	int s;
 
 	if(b == nil || (ref = _xdec(&b->ref)) > 0)
 		return;
@@ -127,6 +366,18 @@ freeb(Block *b)
 		panic("freeb: ref %ld; caller pc %#p", ref, getcallerpc(&b));
 	}
 
+	if(b->shared != nil){
+		sb = b->shared;
+		b->next = dead;
+		b->rp = dead;
+		b->wp = dead;
+		b->lim = dead;
+		b->base = dead;
+		free(b);
+		freeb(sb);
+		return;
+	}
+
 	/*
 	 * drivers which perform non cache coherent DMA manage their own buffer
 	 * pool of uncached buffers and provide their own free routine.
@@ -136,10 +387,12 @@ freeb(Block *b)
 		return;
 	}
 	if(b->flag & BINTR) {
-		ilock(&ialloc);
-		ialloc.bytes -= b->lim - b->base;
-		iunlock(&ialloc);
+		s = splhi();
+		ibytes[m->machno] -= b->lim - b->base;
+		splx(s);
 	}
+	if((b->flag & Bclass) && bcacheput(b))
+		return;
 
 	/* poison the block in case someone is still holding onto it */
 	b->next = dead;
@@ -181,5 +434,11 @@ checkb(Block *b, char *msg)
 void
 iallocsummary(void)
 {
-	print("ialloc %lud/%lud\n", ialloc.bytes, conf.ialloc);
+	int c;
+
+	print("ialloc %lud/%lud, shared %lud\n", iallocbytes(), conf.ialloc, sharedcnt);
+	for(c = 0; c < Nbclass; c++)
+		print("block %d: hit %lud miss %lud cached %lud refill %lud spill %lud depot %d\n",
+			bclasssize[c], bstats.hit[c], bstats.miss[c], bstats.cached[c],
+			bstats.refill[c], bstats.spill[c], bdepot.n[c]);
 }
@@ -5,22 +5,44 @@
 #include	"fns.h"
 #include	"../port/error.h"
 
+/*
+ * Each cached file keeps its data a page at a time, indexed by
+ * page number in a radix tree that grows in height with the file,
+ * so any offset can be cached and finding it costs one step per 6
+ * bits of page number.  An extent holds the one run of valid bytes
+ * in its page.  The pages themselves belong to the fscache Image
+ * and may be reclaimed at any time; cpage notices.
+ */
 enum
 {
-	NHASH		= 128,
-	MAXCACHE	= 1024*1024,
-	NFILE		= 4096,
+	NFILE		= 4096,		/* fewest files cached */
+	MAXFILE		= 65536,
 	NEXTENT		= 200,		/* extent allocation size */
+
+	Minahead	= 16*1024,	/* first read-ahead window */
+	Maxahead	= 256*1024,
+	Nahead		= 32,		/* read-aheads queued */
+	Naheadproc	= 4,		/* kprocs doing them */
+
+	Rshift		= 6,
+	Rsize		= 1<<Rshift,	/* slots in a tree node */
+	Rmask		= Rsize-1,
 };
 
 typedef struct Extent Extent;
 struct Extent
 {
 	int	bid;
-	ulong	start;
+	int	start;		/* of valid bytes in the page */
 	int	len;
 	Page	*cache;
-	Extent	*next;
+	Extent	*next;		/* free list */
+};
+
+typedef struct Cnode Cnode;
+struct Cnode
+{
+	void	*slot[Rsize];	/* Cnode* above the bottom level, Extent* on it */
 };
 
 typedef struct Mntcache Mntcache;
@@ -30,7 +52,12 @@ struct Mntcache
 	int	dev;
 	int	type;
 	QLock;
-	Extent	 *list;
+	Cnode	*root;
+	int	height;		/* levels in the tree; 0 if empty */
+	int	nextent;
+	vlong	seqoff;		/* where a sequential reader reads next */
+	vlong	aheadoff;	/* read ahead has been asked for up to here */
+	long	window;		/* bytes to keep read ahead; 0 if not sequential */
 	Mntcache *hash;
 	Mntcache *prev;
 	Mntcache *next;
@@ -41,9 +68,11 @@ struct Cache
 {
 	Lock;
 	int		pgno;
+	int		nfile;
+	int		nhash;
 	Mntcache	*head;
 	Mntcache	*tail;
-	Mntcache	*hash[NHASH];
+	Mntcache	**hash;
 };
 
 typedef struct Ecache Ecache;
@@ -52,13 +81,33 @@ struct Ecache
 	Lock;
 	int	total;
 	int	free;
+	int	max;		/* extents worth indexing: the pages there are */
 	Extent*	head;
 };
 
+typedef struct Ahead Ahead;
+struct Ahead
+{
+	Chan	*c;
+	vlong	off;
+	long	len;
+};
+
 static Image fscache;
 static Cache cache;
 static Ecache ecache;
-static int maxcache = MAXCACHE;
+
+static struct
+{
+	Lock;
+	Rendez	r;
+	int	nproc;
+	uint	rd;
+	uint	wr;
+	Ahead	q[Nahead];
+	ulong	issued;
+	ulong	dropped;
+} ahead;
 
 static void
 extentfree(Extent* e)
@@ -78,6 +127,10 @@ extentalloc(void)
 
 	lock(&ecache);
 	if(ecache.head == nil){
+		if(ecache.total >= ecache.max){
+			unlock(&ecache);
+			return nil;
+		}
 		e = xalloc(NEXTENT*sizeof(Extent));
 		if(e == nil){
 			unlock(&ecache);
@@ -107,18 +160,23 @@ cinit(void)
 	int i;
 	Mntcache *m;
 
-	cache.head = xalloc(sizeof(Mntcache)*NFILE);
+	/* a file for every 16 pages, and a hash chain for every 32 files */
+	cache.nfile = conf.npage/16;
+	if(cache.nfile < NFILE)
+		cache.nfile = NFILE;
+	if(cache.nfile > MAXFILE)
+		cache.nfile = MAXFILE;
+	for(cache.nhash = 1; cache.nhash < cache.nfile/32; cache.nhash <<= 1)
+		;
+	ecache.max = conf.npage;
+
+	cache.hash = xalloc(sizeof(Mntcache*)*cache.nhash);
+	cache.head = xalloc(sizeof(Mntcache)*cache.nfile);
 	m = cache.head;
-	if (m == nil)
+	if (m == nil || cache.hash == nil)
 		panic("cinit: no memory");
 
-	/* a better algorithm would be nice */
-//	if(conf.npage*BY2PG > 200*MB)
-//		maxcache = 10*MAXCACHE;
-//	if(conf.npage*BY2PG > 400*MB)
-//		maxcache = 50*MAXCACHE;
-
-	for(i = 0; i < NFILE-1; i++) {
+	for(i = 0; i < cache.nfile-1; i++) {
 		m->next = m+1;
 		m->prev = m-1;
 		m++;
@@ -131,34 +189,99 @@ cinit(void)
 	fscache.notext = 1;
 }
 
-void
-cprint(Chan *c, Mntcache *m, char *s)
+static Mntcache**
+chash(uvlong path)
 {
-	ulong o;
-	int nb, ct;
-	Extent *e;
+	return &cache.hash[path&(cache.nhash-1)];
+}
 
-	nb = 0;
-	ct = 1;
-	o = 0;
-	if(m->list)
-		o = m->list->start;
-	for(e = m->list; e; e = e->next) {
-		nb += e->len;
-		if(o != e->start)
-			ct = 0;
-		o = e->start+e->len;
+/*
+ * The slot for page pn, or nil if there is none and alloc is
+ * zero or memory is short.
+ */
+static Extent**
+cslot(Mntcache *m, uvlong pn, int alloc)
+{
+	Cnode *n, **l;
+	int h;
+
+	while(m->height == 0 || m->height*Rshift < 64 && (pn >> m->height*Rshift) != 0){
+		if(!alloc)
+			return nil;
+		if((n = mallocz(sizeof(Cnode), 1)) == nil)
+			return nil;
+		n->slot[0] = m->root;
+		m->root = n;
+		m->height++;
+	}
+	l = &m->root;
+	for(h = m->height-1; h > 0; h--){
+		n = *l;
+		l = (Cnode**)&n->slot[(pn >> h*Rshift) & Rmask];
+		if(*l == nil){
+			if(!alloc)
+				return nil;
+			if((*l = mallocz(sizeof(Cnode), 1)) == nil)
+				return nil;
+		}
 	}
-	pprint("%s: %#llux.%#lux %d %d %s (%d %c)\n",
-	s, m->qid.path, m->qid.vers, m->type, m->dev, c->path->s, nb, ct ? 'C' : 'N');
+	return (Extent**)&(*l)->slot[pn & Rmask];
+}
+
+static int
+cfreetree(Cnode *n, int h)
+{
+	int i, nf;
+
+	if(n == nil)
+		return 0;
+	nf = 0;
+	for(i = 0; i < Rsize; i++){
+		if(n->slot[i] == nil)
+			continue;
+		if(h == 1){
+			extentfree(n->slot[i]);
+			nf++;
+		}else
+			nf += cfreetree(n->slot[i], h-1);
+	}
+	free(n);
+	return nf;
+}
+
+static void
+ccount(Cnode *n, int h, int *nb, int *ne)
+{
+	Extent *e;
+	int i;
 
-	for(e = m->list; e; e = e->next) {
-		pprint("\t%4d %5lud %4d %#p\n",
-			e->bid, e->start, e->len, e->cache);
+	if(n == nil)
+		return;
+	for(i = 0; i < Rsize; i++){
+		if(n->slot[i] == nil)
+			continue;
+		if(h == 1){
+			e = n->slot[i];
+			*nb += e->len;
+			(*ne)++;
+		}else
+			ccount(n->slot[i], h-1, nb, ne);
 	}
 }
 
-Page*
+void
+cprint(Chan *c, Mntcache *m, char *s)
+{
+	int nb, ne;
+
+	nb = 0;
+	ne = 0;
+	ccount(m->root, m->height, &nb, &ne);
+	pprint("%s: %#llux.%#lux %d %d %s (%d bytes in %d extents, height %d)\n",
+		s, m->qid.path, m->qid.vers, m->type, m->dev, c->path->s, nb, ne, m->height);
+}
+
+static Page*
 cpage(Extent *e)
 {
 	/* Easy consistency check */
@@ -168,23 +291,20 @@ cpage(Extent *e)
 	return lookpage(&fscache, e->bid);
 }
 
-void
+static void
 cnodata(Mntcache *m)
 {
-	Extent *e, *n;
-
 	/*
 	 * Invalidate all extent data
 	 * Image lru will waste the pages
 	 */
-	for(e = m->list; e; e = n) {
-		n = e->next;
-		extentfree(e);
-	}
-	m->list = 0;
+	cfreetree(m->root, m->height);
+	m->root = nil;
+	m->height = 0;
+	m->nextent = 0;
 }
 
-void
+static void
 ctail(Mntcache *m)
 {
 	/* Unlink and send to the tail */
@@ -214,17 +334,14 @@ ctail(Mntcache *m)
 void
 copen(Chan *c)
 {
-	int h;
-	Extent *e, *next;
 	Mntcache *m, *f, **l;
 
 	/* directories aren't cacheable and append-only files confuse us */
 	if(c->qid.type&(QTDIR|QTAPPEND))
 		return;
 
-	h = c->qid.path%NHASH;
 	lock(&cache);
-	for(m = cache.hash[h]; m; m = m->hash) {
+	for(m = *chash(c->qid.path); m; m = m->hash) {
 		if(m->qid.path == c->qid.path)
 		if(m->qid.type == c->qid.type)
 		if(m->dev == c->dev && m->type == c->type) {
@@ -245,7 +362,7 @@ copen(Chan *c)
 
 	/* LRU the cache headers */
 	m = cache.head;
-	l = &cache.hash[m->qid.path%NHASH];
+	l = chash(m->qid.path);
 	for(f = *l; f; f = f->hash) {
 		if(f == m) {
 			*l = m->hash;
@@ -258,22 +375,19 @@ copen(Chan *c)
 	m->dev = c->dev;
 	m->type = c->type;
 
-	l = &cache.hash[h];
+	l = chash(c->qid.path);
 	m->hash = *l;
 	*l = m;
 	ctail(m);
 
 	qlock(m);
 	c->mcp = m;
-	e = m->list;
-	m->list = 0;
 	unlock(&cache);
 
-	while(e) {
-		next = e->next;
-		extentfree(e);
-		e = next;
-	}
+	cnodata(m);
+	m->seqoff = 0;
+	m->aheadoff = 0;
+	m->window = 0;
 	qunlock(m);
 }
 
@@ -301,9 +415,8 @@ cread(Chan *c, uchar *buf, int len, vlong off)
 	Mntcache *m;
 	Extent *e, **t;
 	int o, l, total;
-	ulong offset;
 
-	if(off+len > maxcache)
+	if(off < 0)
 		return 0;
 
 	m = c->mcp;
@@ -316,33 +429,25 @@ cread(Chan *c, uchar *buf, int len, vlong off)
 		return 0;
 	}
 
-	offset = off;
-	t = &m->list;
-	for(e = *t; e; e = e->next) {
-		if(offset >= e->start && offset < e->start+e->len)
-			break;
-		t = &e->next;
-	}
-
-	if(e == 0) {
-		qunlock(m);
-		return 0;
-	}
-
 	total = 0;
 	while(len) {
+		t = cslot(m, off/BY2PG, 0);
+		if(t == nil || (e = *t) == nil)
+			break;
+		o = off%BY2PG;
+		if(o < e->start || o >= e->start+e->len)
+			break;
 		p = cpage(e);
 		if(p == 0) {
-			*t = e->next;
+			*t = nil;
+			m->nextent--;
 			extentfree(e);
-			qunlock(m);
-			return total;
+			break;
 		}
 
-		o = offset - e->start;
 		l = len;
-		if(l > e->len-o)
-			l = e->len-o;
+		if(l > e->start+e->len-o)
+			l = e->start+e->len-o;
 
 		k = kmap(p);
 		if(waserror()) {
@@ -361,11 +466,9 @@ cread(Chan *c, uchar *buf, int len, vlong off)
 
 		buf += l;
 		len -= l;
-		offset += l;
+		off += l;
 		total += l;
-		t = &e->next;
-		e = e->next;
-		if(e == 0 || e->start != offset)
+		if(o+l < BY2PG)
 			break;
 	}
 
@@ -373,95 +476,135 @@ cread(Chan *c, uchar *buf, int len, vlong off)
 	return total;
 }
 
-Extent*
-cchain(uchar *buf, ulong offset, int len, Extent **tail)
+static int
+cbid(void)
 {
-	int l;
-	Page *p;
-	KMap *k;
-	Extent *e, *start, **t;
+	int bid;
 
-	start = 0;
-	*tail = 0;
-	t = &start;
-	while(len) {
-		e = extentalloc();
-		if(e == 0)
-			break;
-
-		p = auxpage();
-		if(p == 0) {
-			extentfree(e);
-			break;
-		}
-		l = len;
-		if(l > BY2PG)
-			l = BY2PG;
-
-		e->cache = p;
-		e->start = offset;
-		e->len = l;
-
-		lock(&cache);
-		e->bid = cache.pgno;
-		cache.pgno += BY2PG;
-		/* wrap the counter; low bits are unused by pghash but checked by lookpage */
-		if((cache.pgno & ~(BY2PG-1)) == 0){
-			if(cache.pgno == BY2PG-1){
-				print("cache wrapped\n");
-				cache.pgno = 0;
-			}else
-				cache.pgno++;
-		}
-		unlock(&cache);
-
-		p->daddr = e->bid;
-		k = kmap(p);
-		if(waserror()) {		/* buf may be virtual */
-			kunmap(k);
-			nexterror();
-		}
-		memmove((void*)VA(k), buf, l);
-		poperror();
-		kunmap(k);
-
-		cachepage(p, &fscache);
-		putpage(p);
+	lock(&cache);
+	bid = cache.pgno;
+	cache.pgno += BY2PG;
+	/* wrap the counter; low bits are unused by pghash but checked by lookpage */
+	if((cache.pgno & ~(BY2PG-1)) == 0){
+		if(cache.pgno == BY2PG-1){
+			print("cache wrapped\n");
+			cache.pgno = 0;
+		}else
+			cache.pgno++;
+	}
+	unlock(&cache);
+	return bid;
+}
 
-		buf += l;
-		offset += l;
-		len -= l;
+/*
+ * Out of extents: drop the least recently opened file that
+ * can be locked without waiting.
+ */
+static void
+creclaim(Mntcache *m)
+{
+	Mntcache *f;
 
-		*t = e;
-		*tail = e;
-		t = &e->next;
+	lock(&cache);
+	for(f = cache.head; f != nil; f = f->next)
+		if(f != m && f->nextent > 0 && canqlock(f))
+			break;
+	unlock(&cache);
+	if(f != nil){
+		cnodata(f);
+		qunlock(f);
 	}
-
-	return start;
 }
 
-int
-cpgmove(Extent *e, uchar *buf, int boff, int len)
+/*
+ * Copy l bytes at offset o of buf's page into the page's extent,
+ * making one if need be.  The extent's valid bytes grow to cover
+ * them, or are replaced by them if the two do not touch.
+ */
+static int
+cput(Mntcache *m, uvlong pn, uchar *buf, int o, int l)
 {
+	Extent *e, **t;
 	Page *p;
 	KMap *k;
+	int s;
 
-	p = cpage(e);
-	if(p == 0)
+	t = cslot(m, pn, 1);
+	if(t == nil)
 		return 0;
+	e = *t;
+	p = nil;
+	if(e != nil && (p = cpage(e)) == nil){
+		/* the page was reclaimed; start over in a fresh one */
+		*t = nil;
+		m->nextent--;
+		extentfree(e);
+		e = nil;
+	}
+	if(e == nil){
+		if((e = extentalloc()) == nil){
+			creclaim(m);
+			if((e = extentalloc()) == nil)
+				return 0;
+		}
+		if((p = auxpage()) == nil){
+			extentfree(e);
+			return 0;
+		}
+		e->cache = p;
+		e->bid = cbid();
+		p->daddr = e->bid;
+		cachepage(p, &fscache);
+		*t = e;
+		m->nextent++;
+	}
 
 	k = kmap(p);
-	if(waserror()) {		/* Since buf may be virtual */
+	if(waserror()) {		/* buf may be virtual */
 		kunmap(k);
+		putpage(p);
 		nexterror();
 	}
-
-	memmove((uchar*)VA(k)+boff, buf, len);
-
+	memmove((uchar*)VA(k)+o, buf, l);
 	poperror();
 	kunmap(k);
 	putpage(p);
 
+	if(e->len == 0 || o > e->start+e->len || o+l < e->start){
+		e->start = o;
+		e->len = l;
+	}else{
+		s = e->start;
+		if(o < s)
+			s = o;
+		if(o+l > e->start+e->len)
+			e->len = o+l - s;
+		else
+			e->len = e->start+e->len - s;
+		e->start = s;
+	}
+	return 1;
+}
+
+/*
+ * Returns 0 if some of the data could not be cached.
+ */
+static int
+cfill(Mntcache *m, uchar *buf, int len, vlong off)
+{
+	int o, l;
+
+	while(len > 0){
+		o = off%BY2PG;
+		l = BY2PG - o;
+		if(l > len)
+			l = len;
+		if(cput(m, off/BY2PG, buf, o, l) == 0)
+			return 0;
+		buf += l;
+		len -= l;
+		off += l;
+	}
 	return 1;
 }
 
@@ -469,12 +612,8 @@ void
 cupdate(Chan *c, uchar *buf, int len, vlong off)
 {
 	Mntcache *m;
-	Extent *tail;
-	Extent *e, *f, *p;
-	int o, ee, eblock;
-	ulong offset;
 
-	if(off > maxcache || len == 0)
+	if(off < 0 || len <= 0)
 		return;
 
 	m = c->mcp;
@@ -485,87 +624,21 @@ cupdate(Chan *c, uchar *buf, int len, vlong off)
 		qunlock(m);
 		return;
 	}
-
-	/*
-	 * Find the insertion point
-	 */
-	offset = off;
-	p = 0;
-	for(f = m->list; f; f = f->next) {
-		if(f->start > offset)
-			break;
-		p = f;
-	}
-
-	/* trim if there is a successor */
-	eblock = offset+len;
-	if(f != 0 && eblock > f->start) {
-		len -= (eblock - f->start);
-		if(len <= 0) {
-			qunlock(m);
-			return;
-		}
-	}
-
-	if(p == 0) {		/* at the head */
-		e = cchain(buf, offset, len, &tail);
-		if(e != 0) {
-			m->list = e;
-			tail->next = f;
-		}
+	if(waserror()){
 		qunlock(m);
-		return;
-	}
-
-	/* trim to the predecessor */
-	ee = p->start+p->len;
-	if(offset < ee) {
-		o = ee - offset;
-		len -= o;
-		if(len <= 0) {
-			qunlock(m);
-			return;
-		}
-		buf += o;
-		offset += o;
-	}
-
-	/* try and pack data into the predecessor */
-	if(offset == ee && p->len < BY2PG) {
-		o = len;
-		if(o > BY2PG - p->len)
-			o = BY2PG - p->len;
-		if(cpgmove(p, buf, p->len, o)) {
-			p->len += o;
-			buf += o;
-			len -= o;
-			offset += o;
-			if(len <= 0) {
-if(f && p->start + p->len > f->start) print("CACHE: p->start=%uld p->len=%d f->start=%uld\n", p->start, p->len, f->start);
-				qunlock(m);
-				return;
-			}
-		}
-	}
-
-	e = cchain(buf, offset, len, &tail);
-	if(e != 0) {
-		p->next = e;
-		tail->next = f;
+		nexterror();
 	}
+	cfill(m, buf, len, off);
+	poperror();
 	qunlock(m);
 }
 
 void
 cwrite(Chan* c, uchar *buf, int len, vlong off)
 {
-	int o, eo;
 	Mntcache *m;
-	ulong eblock, ee;
-	Extent *p, *f, *e, *tail;
-	ulong offset;
 
-	if(off > maxcache || len == 0)
+	if(off < 0 || len <= 0)
 		return;
 
 	m = c->mcp;
@@ -578,53 +651,145 @@ cwrite(Chan* c, uchar *buf, int len, vlong off)
 		return;
 	}
 
-	offset = off;
 	m->qid.vers++;
 	c->qid.vers++;
 
-	p = 0;
-	for(f = m->list; f; f = f->next) {
-		if(f->start >= offset)
-			break;
-		p = f;
+	if(waserror()){
+		cnodata(m);
+		qunlock(m);
+		nexterror();
 	}
+	/* what is not cached must not be left holding the old data */
+	if(cfill(m, buf, len, off) == 0)
+		cnodata(m);
+	poperror();
+	qunlock(m);
+}
 
-	if(p != 0) {
-		ee = p->start+p->len;
-		eo = offset - p->start;
-		/* pack in predecessor if there is space */
-		if(offset <= ee && eo < BY2PG) {
-			o = len;
-			if(o > BY2PG - eo)
-				o = BY2PG - eo;
-			if(cpgmove(p, buf, eo, o)) {
-				if(eo+o > p->len)
-					p->len = eo+o;
-				buf += o;
-				len -= o;
-				offset += o;
-			}
+static int
+aheadwork(void*)
+{
+	return ahead.rd != ahead.wr;
+}
+
+/*
+ * Read queued ranges into the cache, for as long as there
+ * is work, then exit as closeproc does.
+ */
+static void
+aheadproc(void*)
+{
+	Ahead a;
+	uchar *buf;
+	long n;
+
+	buf = smalloc(Maxahead);
+	for(;;){
+		if(!waserror()){
+			tsleep(&ahead.r, aheadwork, nil, 5000);
+			poperror();
+		}
+		lock(&ahead);
+		if(ahead.rd == ahead.wr){
+			ahead.nproc--;
+			unlock(&ahead);
+			free(buf);
+			pexit("no work", 1);
 		}
+		a = ahead.q[ahead.rd++ % Nahead];
+		unlock(&ahead);
+		if(!waserror()){
+			n = mntrdwr(Tread, a.c, buf, a.len, a.off);
+			cupdate(a.c, buf, n, a.off);
+			poperror();
+		}
+		cclose(a.c);
 	}
+}
 
-	/* free the overlap -- it's a rare case */
-	eblock = offset+len;
-	while(f && f->start < eblock) {
-		e = f->next;
-		extentfree(f);
-		f = e;
-	}
+/*
+ * Is the byte at off cached and its page still there?
+ */
+static int
+ccached(Mntcache *m, vlong off)
+{
+	Extent **t, *e;
+	int o;
 
-	/* link the block (if any) into the middle */
-	e = cchain(buf, offset, len, &tail);
-	if(e != 0) {
-		tail->next = f;
-		f = e;
+	t = cslot(m, off/BY2PG, 0);
+	if(t == nil || (e = *t) == nil)
+		return 0;
+	o = off%BY2PG;
+	return o >= e->start && o < e->start+e->len && e->cache->daddr == e->bid;
+}
+
+/*
+ * Called by mntread for each read of a cached file.  A read that
+ * starts where the last one ended doubles the read-ahead window,
+ * from Minahead up to Maxahead; any other read closes it.  The
+ * data past this read, up to the window, is then asked of the
+ * aheadproc kprocs unless it is cached already, so a sequential
+ * reader finds it in the cache instead of waiting on the server.
+ */
+void
+creadahead(Chan *c, vlong off, int len)
+{
+	Mntcache *m;
+	vlong s, e;
+	Ahead *a;
+	int start;
+
+	m = c->mcp;
+	if(m == 0 || off < 0 || len <= 0)
+		return;
+	qlock(m);
+	if(cdev(m, c) == 0) {
+		qunlock(m);
+		return;
+	}
+	if(off == m->seqoff){
+		if(m->window == 0)
+			m->window = Minahead;
+		else if(m->window < Maxahead)
+			m->window *= 2;
+	}else{
+		m->window = 0;
+		m->aheadoff = 0;
+	}
+	m->seqoff = off+len;
+	s = m->aheadoff;
+	if(s < off+len)
+		s = off+len;
+	e = off+len+m->window;
+	if(s >= e || ccached(m, s)){
+		qunlock(m);
+		return;
 	}
+	if(e-s > Maxahead)
+		e = s+Maxahead;
+	m->aheadoff = e;
+	qunlock(m);
 
-	if(p == 0)
-		m->list = f;
+	start = 0;
+	lock(&ahead);
+	if(ahead.wr - ahead.rd >= Nahead){
+		ahead.dropped++;
+		unlock(&ahead);
+		return;
+	}
+	a = &ahead.q[ahead.wr++ % Nahead];
+	incref(c);
+	a->c = c;
+	a->off = s;
+	a->len = e-s;
+	ahead.issued++;
+	if(ahead.nproc < Naheadproc && ahead.wr - ahead.rd > ahead.nproc){
+		ahead.nproc++;
+		start = 1;
+	}
+	unlock(&ahead);
+	if(start)
+		kproc("cacheahead", aheadproc, nil);
 	else
-		p->next = f;
-	qunlock(m);
+		wakeup(&ahead.r);
 }
@@ -12,6 +12,12 @@ enum
 {
 	PATHSLOP	= 20,
 	PATHMSLOP	= 20,
+
+	Nnegwalk	= 128,		/* negative walk cache entries per Pgrp */
+	Negttl		= 1000,		/* ms a negative entry is believed */
+
+	Chanbatch	= 16,		/* Chans moved between a cache and chanalloc */
+	Chancachemax	= 2*Chanbatch,	/* Chans a cache holds before draining */
 };
 
 struct
@@ -22,6 +28,22 @@ struct
 	Chan	*list;
 }chanalloc;
 
+/*
+ * Free Chans are kept first on a per-processor cache, which
+ * trades Chanbatch at a time with chanalloc.free, so opening
+ * and closing files seldom takes the global lock.  Chans are
+ * never given back to malloc (fdtochan depends on it).
+ */
+typedef struct Chancache Chancache;
+struct Chancache
+{
+	Lock;
+	Chan	*free;
+	int	nfree;
+};
+
+static Chancache chancache[MAXMACH];
+
 typedef struct Elemlist Elemlist;
 
 struct Elemlist
@@ -38,6 +60,21 @@ struct Elemlist
 
 #define SEP(c) ((c) == 0 || (c) == '/')
 
+/*
+ * A name that a mount driver's directory, at a given version,
+ * said it did not have.
+ */
+struct Negwalk
+{
+	ulong	gen;
+	ulong	ticks;
+	int	type;
+	int	dev;
+	uvlong	path;
+	ulong	vers;
+	char	name[KNAMELEN];
+};
+
 static void
 dumpmount(void)		/* DEBUGGING */
 {
@@ -60,7 +97,7 @@ dumpmount(void)		/* DEBUGGING */
 		nexterror();
 	}
 
-	he = &pg->mnthash[MNTHASH];
+	he = &pg->mnthash[1<<pg->mntlog];
 	for(h = pg->mnthash; h < he; h++){
 		for(f = *h; f; f = f->hash){
 			print("head: %#p: %s %#llux.%lud %C %lud -> \n", f,
@@ -187,12 +224,147 @@ kstrdup(char **p, char *s)
 
 static int debugstart = 1;
 
+/*
+ * asynchronous device initialisation.  a driver's reset or init
+ * hands a slow probe to devasync instead of doing it in place.
+ * once every init has run, chandevinit starts a kproc per chain
+ * of probes and waits for all of them, so boot sees the longest
+ * probe rather than their sum.  a probe naming another in after
+ * joins the end of that one's chain and runs once it is done.
+ */
+typedef struct Devasync Devasync;
+struct Devasync
+{
+	char	*name;
+	void	(*f)(void*);
+	void	*a;
+	Devasync *next;		/* run after this one, by the same kproc */
+	Devasync *chain;	/* next chain */
+};
+
+static struct
+{
+	Lock;
+	Devasync *chains;
+	int	started;
+	int	running;
+	Rendez	r;
+}devasyncs;
+
+void
+devasync(char *name, void (*f)(void*), void *a, char *after)
+{
+	Devasync *d, *c, *e, **l;
+
+	lock(&devasyncs);
+	if(devasyncs.started){
+		/* after boot: probe in place */
+		unlock(&devasyncs);
+		f(a);
+		return;
+	}
+	unlock(&devasyncs);
+
+	d = malloc(sizeof *d);
+	if(d == nil)
+		panic("devasync: no memory");
+	d->name = name;
+	d->f = f;
+	d->a = a;
+	lock(&devasyncs);
+	if(after != nil)
+		for(c = devasyncs.chains; c != nil; c = c->chain)
+			for(e = c; e != nil; e = e->next)
+				if(strcmp(e->name, after) == 0){
+					while(e->next != nil)
+						e = e->next;
+					e->next = d;
+					unlock(&devasyncs);
+					return;
+				}
+	for(l = &devasyncs.chains; *l != nil; l = &(*l)->chain)
+		;
+	*l = d;
+	unlock(&devasyncs);
+}
+
+/* run a chain of probes, reporting rather than passing on errors */
+static void
+devasyncchain(Devasync *d)
+{
+	Devasync *next;
+
+	for(; d != nil; d = next){
+		next = d->next;
+		if(debugstart)
+			iprint(" %s", d->name);
+		if(!waserror()){
+			d->f(d->a);
+			poperror();
+		}else
+			print("init %s: %s\n", d->name, up->errstr);
+		free(d);
+	}
+}
+
+static void
+devasyncproc(void *v)
+{
+	devasyncchain(v);
+	lock(&devasyncs);
+	if(--devasyncs.running == 0)
+		wakeup(&devasyncs.r);
+	unlock(&devasyncs);
+	pexit("", 1);
+}
+
+static int
+devasyncdone(void*)
+{
+	return devasyncs.running == 0;
+}
+
+/* run the chains of probes, all at once unless *noasyncinit is set */
+static void
+devasyncrun(void)
+{
+	Devasync *c, *next;
+	int serial;
+
+	lock(&devasyncs);
+	devasyncs.started = 1;
+	c = devasyncs.chains;
+	devasyncs.chains = nil;
+	unlock(&devasyncs);
+	if(c == nil)
+		return;
+
+	if(debugstart)
+		iprint("async:");
+	serial = getconf("*noasyncinit") != nil;
+	for(; c != nil; c = next){
+		next = c->chain;
+		if(serial){
+			devasyncchain(c);
+			continue;
+		}
+		lock(&devasyncs);
+		devasyncs.running++;
+		unlock(&devasyncs);
+		kproc(c->name, devasyncproc, c);
+	}
+	sleep(&devasyncs.r, devasyncdone, nil);
+	if(debugstart)
+		iprint("\n");
+}
+
 void
 chandevreset(void)
 {
 	int i;
 
 	todinit();	/* avoid later reentry causing infinite recursion */
+	todpageinit();
 	debugstart = getconf("*debugstart") != nil;
 	if(debugstart)
 		iprint("reset:");
@@ -219,6 +391,7 @@ chandevinit(void)
 	}
 	if(debugstart)
 		iprint("\n");
+	devasyncrun();
 }
 
 void
@@ -236,13 +409,28 @@ chandevshutdown(void)
 Chan*
 newchan(void)
 {
+	Chancache *cc;
 	Chan *c;
+	int i;
 
-	lock(&chanalloc);
-	c = chanalloc.free;
-	if(c != 0)
-		chanalloc.free = c->next;
-	unlock(&chanalloc);
+	cc = &chancache[m->machno];
+	lock(cc);
+	if(cc->free == nil){
+		lock(&chanalloc);
+		for(i = 0; i < Chanbatch && (c = chanalloc.free) != nil; i++){
+			chanalloc.free = c->next;
+			c->next = cc->free;
+			cc->free = c;
+			cc->nfree++;
+		}
+		unlock(&chanalloc);
+	}
+	c = cc->free;
+	if(c != nil){
+		cc->free = c->next;
+		cc->nfree--;
+	}
+	unlock(cc);
 
 	if(c == nil){
 		c = smalloc(sizeof(Chan));
@@ -288,7 +476,7 @@ newpath(char *s)
 	i = strlen(s);
 	p->len = i;
 	p->alen = i+PATHSLOP;
-	p->s = smalloc(p->alen);
+	p->s = smallocz(p->alen, 0);
 	memmove(p->s, s, i+1);
 	p->ref = 1;
 	incref(&npath);
@@ -320,7 +508,7 @@ copypath(Path *p)
 	
 	pp->len = p->len;
 	pp->alen = p->alen;
-	pp->s = smalloc(p->alen);
+	pp->s = smallocz(p->alen, 0);
 	memmove(pp->s, p->s, p->len+1);
 	
 	pp->mlen = p->mlen;
@@ -415,7 +603,7 @@ addelem(Path *p, char *s, Chan *from)
 	i = strlen(s);
 	if(p->len+1+i+1 > p->alen){
 		a = p->len+1+i+1 + PATHSLOP;
-		t = smalloc(a);
+		t = smallocz(a, 0);
 		memmove(t, p->s, p->len+1);
 		free(p->s);
 		p->s = t;
@@ -452,6 +640,9 @@ addelem(Path *p, char *s, Chan *from)
 void
 chanfree(Chan *c)
 {
+	Chancache *cc;
+	int i;
+
 	c->flag = CFREE;
 
 	if(c->dirrock != nil){
@@ -480,10 +671,22 @@ chanfree(Chan *c)
 	pathclose(c->path);
 	c->path = nil;
 
-	lock(&chanalloc);
-	c->next = chanalloc.free;
-	chanalloc.free = c;
-	unlock(&chanalloc);
+	cc = &chancache[m->machno];
+	lock(cc);
+	c->next = cc->free;
+	cc->free = c;
+	if(++cc->nfree > Chancachemax){
+		lock(&chanalloc);
+		for(i = 0; i < Chanbatch; i++){
+			c = cc->free;
+			cc->free = c->next;
+			cc->nfree--;
+			c->next = chanalloc.free;
+			chanalloc.free = c;
+		}
+		unlock(&chanalloc);
+	}
+	unlock(cc);
 }
 
 void
@@ -642,6 +845,34 @@ newmhead(Chan *from)
 	return mh;
 }
 
+/*
+ * Double the buckets when the chains average more than two
+ * heads; called with pg->ns write locked.  If there is no
+ * memory the chains just get longer.
+ */
+static void
+mntgrow(Pgrp *pg)
+{
+	Mhead **h, *m, *next;
+	int i, log;
+
+	if(pg->mntlog >= MNTMAXLOG)
+		return;
+	log = pg->mntlog+1;
+	h = malloc((1<<log)*sizeof(Mhead*));
+	if(h == nil)
+		return;
+	for(i = 0; i < 1<<pg->mntlog; i++)
+		for(m = pg->mnthash[i]; m != nil; m = next){
+			next = m->hash;
+			m->hash = h[MNTHASHV(m->from->type, m->from->dev, m->from->qid, log)];
+			h[MNTHASHV(m->from->type, m->from->dev, m->from->qid, log)] = m;
+		}
+	free(pg->mnthash);
+	pg->mnthash = h;
+	pg->mntlog = log;
+}
+
 int
 cmount(Chan **newp, Chan *old, int flag, char *spec)
 {
@@ -689,8 +920,9 @@ cmount(Chan **newp, Chan *old, int flag, char *spec)
 
 	pg = up->pgrp;
 	wlock(&pg->ns);
+	pg->neggen++;
 
-	l = &MOUNTH(pg, old->qid);
+	l = &MOUNTH(pg, old->type, old->dev, old->qid);
 	for(m = *l; m; m = m->hash){
 		if(eqchan(m->from, old, 1))
 			break;
@@ -704,6 +936,8 @@ cmount(Chan **newp, Chan *old, int flag, char *spec)
 		 */
 		m = newmhead(old);
 		*l = m;
+		if(++pg->nmhead > 2<<pg->mntlog)
+			mntgrow(pg);
 
 		/*
 		 *  if this is a union mount, add the old
@@ -781,8 +1015,9 @@ cunmount(Chan *mnt, Chan *mounted)
 
 	pg = up->pgrp;
 	wlock(&pg->ns);
+	pg->neggen++;
 
-	l = &MOUNTH(pg, mnt->qid);
+	l = &MOUNTH(pg, mnt->type, mnt->dev, mnt->qid);
 	for(m = *l; m; m = m->hash){
 		if(eqchan(m->from, mnt, 1))
 			break;
@@ -797,6 +1032,7 @@ cunmount(Chan *mnt, Chan *mounted)
 	wlock(&m->lock);
 	if(mounted == 0){
 		*l = m->hash;
+		pg->nmhead--;
 		wunlock(&pg->ns);
 		mountfree(m->mount);
 		m->mount = nil;
@@ -816,6 +1052,7 @@ cunmount(Chan *mnt, Chan *mounted)
 			mountfree(f);
 			if(m->mount == nil){
 				*l = m->hash;
+				pg->nmhead--;
 				cclose(m->from);
 				wunlock(&m->lock);
 				wunlock(&pg->ns);
@@ -859,7 +1096,7 @@ findmount(Chan **cp, Mhead **mp, int type, int dev, Qid qid)
 
 	pg = up->pgrp;
 	rlock(&pg->ns);
-	for(m = MOUNTH(pg, qid); m; m = m->hash){
+	for(m = MOUNTH(pg, type, dev, qid); m; m = m->hash){
 		rlock(&m->lock);
 		if(m->from == nil){
 			print("m %p m->from 0\n", m);
@@ -956,11 +1193,137 @@ ewalk(Chan *c, Chan *nc, char **name, int nname)
 	return wq;
 }
 
+static char Edoesnotexist[] = "does not exist";
+
+/*
+ * The negative walk cache remembers, per Pgrp, names that walks
+ * on mount driver directories failed to find, so that searching
+ * a union such as /bin, or probing for files that are not there,
+ * does not cost a Twalk each time.  An entry holds only while the
+ * directory's qid.vers is unchanged, for Negttl, and until the
+ * next mount or unmount in the group; creating the name drops it.
+ * Servers that leave directory versions at zero are not cached,
+ * since their directories change without saying so.
+ */
+static Negwalk*
+negwalkslot(Pgrp *pg, int type, int dev, uvlong path, char *name)
+{
+	ulong h;
+	char *p;
+
+	h = type*31 + dev*7 + (ulong)path;
+	for(p = name; *p; p++)
+		h = h*37 + *p;
+	return &pg->negwalk[h%Nnegwalk];
+}
+
+static int
+negwalklook(Chan *c, char *name)
+{
+	Pgrp *pg;
+	Negwalk *e;
+	int hit;
+
+	pg = up->pgrp;
+	if(pg == nil || pg->negwalk == nil || c->qid.vers == 0)
+		return 0;
+	hit = 0;
+	lock(&pg->neglock);
+	e = negwalkslot(pg, c->type, c->dev, c->qid.path, name);
+	if(e->gen == pg->neggen && e->type == c->type && e->dev == c->dev
+	&& e->path == c->qid.path && e->vers == c->qid.vers
+	&& TK2MS(MACHP(0)->ticks - e->ticks) < Negttl
+	&& strcmp(e->name, name) == 0)
+		hit = 1;
+	unlock(&pg->neglock);
+	return hit;
+}
+
+static void
+negwalkadd(Chan *c, Qid qid, char *name)
+{
+	Pgrp *pg;
+	Negwalk *e, *t;
+
+	pg = up->pgrp;
+	if(pg == nil || qid.vers == 0 || strlen(name) >= KNAMELEN)
+		return;
+	if(pg->negwalk == nil){
+		t = malloc(Nnegwalk*sizeof(Negwalk));
+		if(t == nil)
+			return;
+		lock(&pg->neglock);
+		if(pg->negwalk == nil){
+			pg->negwalk = t;
+			t = nil;
+		}
+		unlock(&pg->neglock);
+		free(t);
+	}
+	lock(&pg->neglock);
+	e = negwalkslot(pg, c->type, c->dev, qid.path, name);
+	e->gen = pg->neggen;
+	e->ticks = MACHP(0)->ticks;
+	e->type = c->type;
+	e->dev = c->dev;
+	e->path = qid.path;
+	e->vers = qid.vers;
+	strcpy(e->name, name);
+	unlock(&pg->neglock);
+}
+
+/*
+ * name has been created in directory c, whatever its version
+ */
+static void
+negwalkdrop(Chan *c, char *name)
+{
+	Pgrp *pg;
+	Negwalk *e;
+
+	pg = up->pgrp;
+	if(pg == nil || pg->negwalk == nil)
+		return;
+	lock(&pg->neglock);
+	e = negwalkslot(pg, c->type, c->dev, c->qid.path, name);
+	if(e->type == c->type && e->dev == c->dev && e->path == c->qid.path
+	&& strcmp(e->name, name) == 0)
+		e->gen = pg->neggen-1;
+	unlock(&pg->neglock);
+}
+
+/*
+ * ewalk, but on mount driver channels answer from the negative
+ * cache when it can, and feed it with the names that are missing.
+ */
+static Walkqid*
+cachewalk(Chan *c, char **name, int nname)
+{
+	Walkqid *wq;
+	int k;
+
+	if(devtab[c->type]->dc != 'M' || isdotdot(name[0]))
+		return ewalk(c, nil, name, nname);
+	if(negwalklook(c, name[0])){
+		strcpy(up->errstr, Edoesnotexist);
+		return nil;
+	}
+	wq = ewalk(c, nil, name, nname);
+	if(wq == nil){
+		if(strstr(up->errstr, "not exist") != nil || strstr(up->errstr, "not found") != nil)
+			negwalkadd(c, c->qid, name[0]);
+	}else if(wq->clone == nil && wq->nqid > 0 && wq->nqid < nname){
+		k = wq->nqid;
+		if(wq->qid[k-1].type & QTDIR)
+			negwalkadd(c, wq->qid[k-1], name[k]);
+	}
+	return wq;
+}
+
 /*
  * Either walks all the way or not at all.  No partial results in *cp.
  * *nerror is the number of names to display in an error message.
  */
-static char Edoesnotexist[] = "does not exist";
 int
 walk(Chan **cp, char **names, int nnames, int nomount, int *nerror)
 {
@@ -1023,7 +1386,7 @@ walk(Chan **cp, char **names, int nnames, int nomount, int *nerror)
 		type = c->type;
 		dev = c->dev;
 
-		if((wq = ewalk(c, nil, names+nhave, ntry)) == nil){
+		if((wq = cachewalk(c, names+nhave, ntry)) == nil){
 			/* try a union mount, if any */
 			if(mh && !nomount){
 				/*
@@ -1032,7 +1395,7 @@ walk(Chan **cp, char **names, int nnames, int nomount, int *nerror)
 				rlock(&mh->lock);
 				f = mh->mount;
 				for(f = (f? f->next: f); f; f = f->next)
-					if((wq = ewalk(f->to, nil, names+nhave, ntry)) != nil)
+					if((wq = cachewalk(f->to, names+nhave, ntry)) != nil)
 						break;
 				runlock(&mh->lock);
 				if(f != nil){
@@ -1613,8 +1976,10 @@ if(c->umh != nil){
 			cnew->path = c->path;
 			incref(cnew->path);
 
+			negwalkdrop(cnew, e.elems[e.nelems-1]);
 			devtab[cnew->type]->create(cnew, e.elems[e.nelems-1], omode&~(OEXCL|OCEXEC), perm);
 			poperror();
+			negwalkdrop(c, e.elems[e.nelems-1]);
 			if(omode & OCEXEC)
 				cnew->flag |= CCEXEC;
 			if(omode & ORCLOSE)
@@ -1627,7 +1992,10 @@ if(c->umh != nil){
 			break;
 		}
 
-		/* create failed */
+		/* create failed, perhaps because another got there first */
+		negwalkdrop(c, e.elems[e.nelems-1]);
+		if(cnew != nil)
+			negwalkdrop(cnew, e.elems[e.nelems-1]);
 		cclose(cnew);
 		if(m)
 			putmhead(m);
@@ -18,18 +18,31 @@
 #include "dat.h"
 #include "fns.h"
 #include "../port/error.h"
+#include "../port/edf.h"
+#include "../port/cognitive.h"
+#include "../port/matula.h"
 
 /*
  * Cognitive Extensions Data Structures
  */
 
-typedef struct CognitiveNamespace CognitiveNamespace;
-typedef struct NeuralChannel NeuralChannel;
-typedef struct CognitiveSwarm CognitiveSwarm;
-typedef struct NeuralMessage NeuralMessage;
+typedef struct NeuralMsgCache NeuralMsgCache;
+typedef struct NeuralAtom NeuralAtom;
+typedef struct NeuralRing NeuralRing;
+typedef struct NeuralSlot NeuralSlot;
+typedef struct NeuralLevel NeuralLevel;
+typedef struct NCShard NCShard;
+typedef struct NCSketch NCSketch;
 typedef struct EmergentPattern EmergentPattern;
 typedef struct RootedShell RootedShell;
 typedef struct RootedTree RootedTree;
+typedef struct RootedShellView RootedShellView;
+typedef struct ShellRef ShellRef;
+typedef struct Arena Arena;
+typedef struct ArenaChunk ArenaChunk;
+typedef struct TreeBits TreeBits;
+typedef struct SwarmAgent SwarmAgent;
+typedef struct SwarmCast SwarmCast;
 
 struct NeuralMessage {
     ulong tag;                    // Message tag
@@ -42,7 +55,107 @@ struct NeuralMessage {
     ulong payload_size;           // Payload size
     void *cognitive_payload;      // Cognitive data payload
     float confidence_level;       // Message confidence (0.0-1.0)
-    NeuralMessage *next;          // Queue linkage
+    NeuralMessage *next;          // Queue and free list linkage
+    Block *block;                 // Payload storage when wrapping a Block
+    uvlong created;               // fastticks when allocated
+    uvlong enqueued;              // fastticks when queued
+    long ref;                     // Holders; swarm casts share one message
+    uchar inline_payload[NMinline]; // Small payloads live here
+};
+
+/*
+ * Bounded multi-producer/single-consumer message ring.
+ *
+ * Each slot carries a sequence number: a producer owns slot i for
+ * position pos once seq == pos, claims it by advancing head with
+ * cmpswap, fills it and publishes seq = pos+1.  The consumer takes
+ * the slot when seq == pos+1 and releases it for the next lap by
+ * setting seq = pos+Nringslots.  Producers and the consumer touch
+ * head and tail on separate cache lines, so senders on different
+ * processors never contend on the consumer's index, and neither
+ * side needs a lock.
+ */
+enum {
+    Nringslots = 256,             // per priority level; power of two
+    Nringmask = Nringslots - 1,
+};
+
+struct NeuralSlot {
+    long seq;
+    NeuralMessage *msg;
+};
+
+struct NeuralRing {
+    long head;                    // Next position to claim (producers)
+    uchar pad0[CACHELINESZ - sizeof(long)];
+    long tail;                    // Next position to consume
+    uchar pad1[CACHELINESZ - sizeof(long)];
+    NeuralSlot slot[Nringslots];
+};
+
+/*
+ * Each channel queues messages in Nprio levels, level 0 being the
+ * most urgent.  A bitmap of non-empty levels lets the consumer find
+ * the highest waiting level in constant time.  A level whose oldest
+ * message has waited longer than its age_limit is served ahead of
+ * more urgent levels, so bulk traffic is delayed but never starved.
+ */
+enum {
+    Nprio = 4,
+    Nlathist = 24,                // log2(µs) residency buckets
+    NCloadwin = 8,                // Load samples in a channel's sliding window
+    NCbatch = 4,                  // Credits a cpu takes from a window at once
+    NCshardsize = 64,             // One shard per cache line
+};
+
+// A cpu's cache of a channel's credits, see neural_take_credit
+struct NCShard {
+    long credits;
+    uchar pad[NCshardsize - sizeof(long)];
+};
+
+/*
+ * Streaming summary of a channel's traffic, updated as messages
+ * are queued: a count-min sketch of message keys (type and tag)
+ * that also tracks the heaviest key seen, and a HyperLogLog of
+ * the distinct source domains.  Producers update it without
+ * locking, so counts are approximate under contention, which a
+ * sketch tolerates.  The adaptation kproc ages it every
+ * NCsketchepoch samples and compares the epoch's message count
+ * against an EWMA of earlier epochs to find rate spikes.
+ */
+enum {
+    NCcmrows = 4,                 // Count-min rows
+    NCcmbits = 6,
+    NCcmwidth = 1 << NCcmbits,    // Counters per row
+    NChllbits = 6,
+    NChllregs = 1 << NChllbits,   // HyperLogLog registers
+    NCsketchepoch = 100,          // Samples per epoch, about a second
+    NCspikemin = 16,              // Fewest messages in an epoch that can spike
+};
+
+struct NCSketch {
+    ulong cm[NCcmrows][NCcmwidth];
+    ulong topkey;                 // Heaviest key in the count-min sketch
+    ulong topcount;               // ... and its estimated count
+    uchar hll[NChllregs];
+    ulong sources;                // Distinct sources in the last epoch
+    ulong rate;                   // Messages queued in the last epoch
+    ulong rate_avg;               // EWMA of rate over earlier epochs
+    ulong rate_mark;              // enqueued at the start of the epoch
+    int spiking;                  // Last epoch's rate was a spike
+};
+
+struct NeuralLevel {
+    NeuralRing *ring;             // Lock-free MPSC message ring
+    NeuralMessage *overflow_head; // Spill list once the ring is full
+    NeuralMessage *overflow_tail;
+    ulong overflow_count;         // Messages currently on spill list
+    Lock queue_lock;              // Spill list protection
+    ulong age_limit;              // ms before aging promotes this level (0: never)
+    ulong dequeued;
+    ulong aged;                   // Dequeues due to aging
+    ulong lathist[Nlathist];      // Queue residency histogram
 };
 
 struct NeuralChannel {
@@ -50,15 +163,99 @@ struct NeuralChannel {
     char *channel_id;             // Unique channel identifier
     char *source_domain;          // Source cognitive domain
     char *target_domain;          // Target cognitive domain
-    ulong bandwidth_capacity;     // Neural bandwidth capacity
-    ulong current_load;           // Current cognitive load
+    ulong bandwidth_capacity;     // Credit window: messages that may be queued
+    ulong max_capacity;           // Hard bound on the window
+    ulong current_load;           // Credits out of the window, queued or cached in shard
+    NCShard *shard;               // Per-cpu credit caches, conf.nmach of them
     float adaptation_rate;        // Channel adaptation speed
     time_t last_evolution;        // Last evolutionary change
-    NeuralMessage *message_queue; // Pending neural messages
-    Lock queue_lock;              // Queue protection
+    int noblock;                  // Refuse rather than block senders
+    ulong refused;                // Sends refused for lack of credit
+    ulong enqueued;               // Messages accepted
+    ulong drained;                // Messages taken by consumers
+    ulong adapted;                // Window resizes
+    ulong e2ehist[Nlathist];      // Creation-to-dequeue latency histogram
+    ulong drain_mark;             // drained at last adaptation
+    uvlong drain_mark_ticks;      // fastticks at last adaptation
+    ulong drain_rate;             // EWMA of consumer drain, msgs/s
+    ulong res_avg;                // EWMA of queue residency, µs
+    ulong accept_avg;             // EWMA of sends accepted, permille
+    ulong accept_mark;            // enqueued at last sample
+    ulong refuse_mark;            // refused at last sample
+    ulong loadwin[NCloadwin];     // Last load samples, taken by the adaptation kproc
+    ulong loadsum;                // Sum of loadwin
+    int loadpos;                  // Next loadwin slot
+    NCSketch sketch;              // Traffic summary for correlation
+    NeuralLevel level[Nprio];     // Per-priority queues
+    long active;                  // Bitmap of possibly non-empty levels
+    Lock recv_lock;               // Serializes consumers
+    QLock wait_lock;              // One blocked receiver at a time
+    Rendez recv_rendez;           // Blocked receiver sleeps here
+    int receiver_waiting;         // Producers must wake recv_rendez
+    QLock send_lock;              // One blocked sender at a time
+    Rendez send_rendez;           // Sender waiting for credit
+    int sender_waiting;           // Consumers must wake send_rendez
+    Queue *q;                     // Block transport, one message per Block
+    int data_type;                // Header fields for data file writes
+    ulong data_prio;
+    ulong data_tag;
+    Proc *edfproc;                // Consumer holding an edf reservation
+    ulong edfpid;                 // Its pid, in case it has exited
+    ulong edfreleases;            // Releases of it by message arrival
+    ulong cpus;                   // Target domain's processors, for consumers
+    int adaptcpu;                 // Processor adapting it, -1 for cogadapt
+    int no;                       // Slot in the channel table, -1 if unregistered
+    ulong serial;                 // Registration number, never reused
+    NeuralChannel *hash_next;     // Registry chain
+};
+
+/*
+ * Block transport.  Alongside the message rings, every channel
+ * owns a message-mode Queue carrying one NeuralMessage per Block:
+ * an NBhdrlen header pushed into the Block's headroom followed by
+ * the payload.  Blocks received from devip or devpipe can be passed
+ * through without copying, consumers get the same Block back from
+ * qbread, and qsetlimit/qnoblock work on the Queue as usual.
+ *
+ *	magic[1] type[1] prio[1] flags[1] tag[4] enqueued[8]
+ */
+enum {
+    NBmagic = 0x4E,               // 'N'
+    NBhdrlen = 16,
+    NBavgmsg = 256,               // Queue limit = capacity * NBavgmsg bytes
+};
+/*
+ * Flow control.  As with qio's limit, a channel admits at most
+ * bandwidth_capacity queued messages; each send takes a credit and
+ * each receive returns one.  The window follows the measured drain
+ * rate of the consumers, sized to hold NCtargetms of drain, and never
+ * exceeds max_capacity, so a producer that outruns its consumer is
+ * refused or blocked instead of growing the channel without bound.
+ */
+enum {
+    NCtargetms = 100,             // Window holds this much consumer drain
+    NCminwindow = 16,
+    NCmaxgrowth = 4,              // max_capacity = NCmaxgrowth * initial bandwidth
+    NCadaptms = 10,               // Minimum sampling interval for drain rate
+};
+
+enum {
+    Narenafirst = 256,            // Bytes in an arena's first chunk
+    Narenachunk = BY2PG,          // Most bytes in any later one
+};
+
+struct Arena {
+    ArenaChunk *chunk;            // Newest first
+};
+
+struct ArenaChunk {
+    ArenaChunk *next;
+    ulong used;                   // Bytes handed out
+    ulong size;                   // Bytes after the header
 };
 
 struct CognitiveNamespace {
+    Arena arena;                  // Holds the namespace and its strings and arrays
     char *domain;                 // Cognitive domain name
     char *namespace_path;         // Namespace root path
     int cognitive_load;           // Current cognitive processing load
@@ -68,18 +265,53 @@ struct CognitiveNamespace {
     EmergentPattern **patterns;   // Detected emergent patterns
     int pattern_count;            // Number of patterns
     Lock adaptation_lock;         // Adaptation synchronization
+    ulong cpus;                   // Processors for its consumers, 0 for any
+    int adaptcpu;                 // Processor adapting it, -1 for cogadapt
+    CognitiveNamespace *hash_next; // Registry chain
+};
+
+enum {
+    Nswarmcast = 64,              // Fan-out ring entries; power of two
+};
+
+struct SwarmCast {
+    NeuralMessage *msg;           // Shared message, one reference held
+    ulong groups;                 // Agent groups it is addressed to
+};
+
+struct SwarmAgent {
+    Proc *p;                      // Member process
+    CognitiveSwarm *swarm;
+    ulong cursor;                 // Sequence number of next cast to read
+    ulong lost;                   // Casts overwritten before being read
+    ulong groups;                 // Multicast groups joined
+    Rendez r;                     // The agent sleeps here for casts
+    int waiting;                  // Asleep in swarm_receive
+    int gone;                     // Removed while asleep; waiter frees
 };
 
 struct CognitiveSwarm {
     Pgrp *pgrp;                   // Base Plan 9 process group
     char *swarm_id;               // Unique swarm identifier
     char *domain;                 // Cognitive domain
-    Proc **agents;                // Swarm member processes
+    SwarmAgent **agents;          // Swarm members
     int agent_count;              // Number of agents
+    int agent_cap;                // Slots allocated in agents
     NeuralChannel *coordination_channel; // Swarm coordination channel
+    SwarmCast cast[Nswarmcast];   // Broadcast fan-out ring
+    ulong cast_seq;               // Sequence number of next cast
+    int waiters;                  // Agents asleep in swarm_receive
+    ulong cpus;                   // Processors agents gather on; 0 for any
+    ulong cast_delivery;          // EWMA of casts read rather than lost, permille
+    ulong cast_latency;           // EWMA of cast-to-read latency, µs
     float coherence_level;        // Swarm coherence (0.0-1.0)
     time_t creation_time;         // Swarm creation time
     Lock swarm_lock;              // Swarm synchronization
+    CognitiveSwarm *hash_next;    // Registry chain
+};
+
+enum {
+    Npwin = 16,                   // Significance window, one slot per second
 };
 
 struct EmergentPattern {
@@ -92,6 +324,13 @@ struct EmergentPattern {
     float significance_score;     // Pattern significance (0.0-1.0)
     char **involved_domains;      // Domains exhibiting pattern
     int domain_count;             // Number of involved domains
+    ulong key;                    // Hash of name and domain set
+    ulong window[Npwin];          // Observations per second, by seconds() % Npwin
+    ulong window_sum;             // Sum of window
+    ulong window_time;            // seconds() of the newest slot
+    EmergentPattern *hash_next;   // Pattern table chain
+    EmergentPattern *lru_prev;    // Recency list, most recent first
+    EmergentPattern *lru_next;
 };
 
 /*
@@ -104,11 +343,25 @@ struct EmergentPattern {
  * configurations, which map to filesystem namespace hierarchies.
  */
 
-// Binary tree representation (bit-encoded parentheses)
-typedef uvlong tree;
+/*
+ * Wider trees use a multi-word bitstring in the same layout: bit i
+ * is 1 when character i of the parens string is '('.  A tree of up
+ * to Ntreefast nodes fits one tree word and never needs this.
+ */
+enum {
+    Ntreewords = 4,               // Words in a TreeBits
+    Ntreefast = 32,               // Most nodes a single tree holds
+    Ntreemax = Ntreewords*64/2,   // Most nodes a TreeBits holds
+};
+
+struct TreeBits {
+    int nbits;                    // Bits in use, two per node
+    uvlong w[Ntreewords];         // Least significant first
+};
 
 struct RootedTree {
     tree binary_rep;              // Binary encoding of tree structure
+    TreeBits *wide_rep;           // Encoding of trees above Ntreefast nodes
     char *parens_notation;        // Parentheses notation: "(()())" etc
     char *namespace_path;         // Corresponding namespace path
     int node_count;               // Number of nodes (shells) in tree
@@ -116,6 +369,8 @@ struct RootedTree {
     RootedTree **subtrees;        // Child subtrees
     int subtree_count;            // Number of subtrees
     uvlong matula_number;         // Matula number encoding (via prime factorization)
+    MatulaBig *matula_big;        // Exact Matula number when it exceeds 64 bits
+    uvlong matula_hash;           // matula_number, or a digest of matula_big
 };
 
 struct RootedShell {
@@ -142,23 +397,31 @@ struct RootedShell {
     
     time_t creation_time;         // When shell was created
     Lock shell_lock;              // Shell synchronization
+    RootedShell *index_next;      // Isomorphism index chain
 };
 
 /*
  * Rooted Tree Generation (A000081 sequence)
  * 
- * These arrays store generated rooted trees for efficient lookup.
+ * Trees of each size are kept in their own bitvector, sized from the
+ * known A000081 count and never moved once published, so readers
+ * index them without the lock.  A tree is stored as its balanced
+ * parentheses less the root's own pair, 2n-2 bits at a fixed stride,
+ * so tree k of size n is found by arithmetic and needs no select
+ * directory; 16-node trees take 30 bits, not a 64-bit word.  Sizes
+ * up to MAXSTORED are kept; MAXN is only ever streamed, since it
+ * needs just the smaller sizes.
  */
-#define MAXN 15  // Maximum tree size we can handle efficiently
+#define MAXSTORED (MAXN - 1)  // Largest size kept in memory
 
 static struct {
-    Lock;
-    tree *list;                   // All generated trees
-    int list_size;                // Current size
-    int list_capacity;            // Allocated capacity
-    ulong *offset;                // Offset[n] = index where n-trees start
+    QLock;                        // Serializes generation
+    uvlong *level[MAXSTORED + 1]; // level[n] holds the trees with n nodes
+    int list_size;                // Trees stored over all levels
     int max_n;                    // Maximum n we've generated
-} rooted_trees = { .list_size = 0, .max_n = 0 };
+    Rendez done;                  // Generator waits here for its spans
+    long pending;                 // Spans still being walked
+} rooted_trees;
 
 /*
  * Neural Message Types (9P Extensions)
@@ -191,1712 +454,9048 @@ enum {
 
 /*
  * Global Cognitive State
+ *
+ * Namespaces, channels and swarms are registered in hash tables
+ * keyed by domain name, channel_id and swarm_id.  Lookups are
+ * read-mostly and take the registry RWlock shared, so readers on
+ * different processors proceed in parallel; only registration and
+ * removal take it exclusively.
  */
+enum {
+    Nnshash = 256,
+    Nchhash = 1024,
+    Nchtabgrow = 64,              // Channel table grows by this many slots
+    Nswhash = 256,
+};
+
 static struct {
     Lock;
-    CognitiveNamespace **namespaces;
+    RWlock reglock;               // Protects the hash tables below
+    CognitiveNamespace *nshash[Nnshash];
     int namespace_count;
-    NeuralChannel **channels;
+    NeuralChannel *chhash[Nchhash];
     int channel_count;
-    CognitiveSwarm **swarms;
+    NeuralChannel **chantab;      // By slot number, for the device's qids
+    int nchantab;
+    CognitiveSwarm *swhash[Nswhash];
     int swarm_count;
-    EmergentPattern **patterns;
     int pattern_count;
     RootedShell **shells;
     int shell_count;
+    int shell_cap;                // Slots allocated in shells
+    RootedShell **shindex;        // Shells by domain and Matula number
+    ulong nshindex;               // Chains in shindex, a power of two
+    ulong serial;                 // Last channel serial handed out
 } cognitive_state = { .namespace_count = 0 };
 
 /*
- * Neural Channel Operations
+ * Versions of the status files, for the qid.vers the device reports.
+ * Each counts the changes of one kind; a file's version is the sum
+ * of those it shows, so a client caching over 9P (devmnt, cfs, an
+ * aggregator polling several cities) can tell from a stat that the
+ * file is unchanged.  Counters move every adaptation tick, so files
+ * showing them are current to one sample.
  */
+static long cognitive_versions[CVnum];
 
-NeuralChannel*
-create_neural_channel(char *source_domain, char *target_domain, ulong bandwidth)
+ulong
+cognitive_version(int kind)
 {
-    NeuralChannel *nc;
-    
-    nc = malloc(sizeof(NeuralChannel));
-    if (nc == nil)
-        return nil;
-        
-    // Initialize base channel
-    channelinit(&nc->chan);
-    
-    // Initialize cognitive properties
-    nc->channel_id = smprint("%s-%s-%lud", source_domain, target_domain, time(NULL));
-    nc->source_domain = strdup(source_domain);
-    nc->target_domain = strdup(target_domain);
-    nc->bandwidth_capacity = bandwidth;
-    nc->current_load = 0;
-    nc->adaptation_rate = 0.1; // 10% adaptation rate
-    nc->last_evolution = time(NULL);
-    nc->message_queue = nil;
-    
-    // Initialize locks
-    lock(&nc->queue_lock);
-    unlock(&nc->queue_lock);
-    
-    return nc;
+    return cognitive_versions[kind];
+}
+
+void
+cognitive_changed(int kind)
+{
+    _xinc(&cognitive_versions[kind]);
 }
 
+static ulong
+cognitive_hash(char *s, ulong nhash)
+{
+    ulong h;
+
+    h = 0;
+    while (*s)
+        h = h * 31 + (uchar)*s++;
+    return h % nhash;
+}
+
+/*
+ * Registry
+ */
+
 int
-send_neural_message(NeuralChannel *nc, NeuralMessage *msg)
+register_cognitive_namespace(CognitiveNamespace *cns)
 {
-    if (nc == nil || msg == nil)
-        return -1;
-        
-    // Check channel capacity
-    if (nc->current_load >= nc->bandwidth_capacity) {
-        // Try adaptive capacity increase
-        if (adapt_neural_channel_capacity(nc) < 0) {
-            // Queue message if adaptation fails
-            return queue_neural_message(nc, msg);
+    CognitiveNamespace **l;
+
+    wlock(&cognitive_state.reglock);
+    for (l = &cognitive_state.nshash[cognitive_hash(cns->domain, Nnshash)]; *l != nil; l = &(*l)->hash_next) {
+        if (strcmp((*l)->domain, cns->domain) == 0) {
+            wunlock(&cognitive_state.reglock);
+            return -1;
         }
     }
-    
-    // Update channel load
-    nc->current_load++;
-    
-    // Set message timestamp
-    msg->timestamp = time(NULL);
-    
-    // Route message through neural transport
-    return route_neural_message(nc, msg);
+    cns->hash_next = nil;
+    *l = cns;
+    cognitive_state.namespace_count++;
+    wunlock(&cognitive_state.reglock);
+    cognitive_changed(CVdomains);
+    return 0;
 }
 
-NeuralMessage*
-receive_neural_message(NeuralChannel *nc)
+CognitiveNamespace*
+lookup_cognitive_namespace(char *domain)
 {
-    NeuralMessage *msg;
-    
-    if (nc == nil)
-        return nil;
-        
-    lock(&nc->queue_lock);
-    
-    msg = nc->message_queue;
-    if (msg != nil) {
-        nc->message_queue = msg->next;
-        nc->current_load--;
+    CognitiveNamespace *cns;
+
+    rlock(&cognitive_state.reglock);
+    for (cns = cognitive_state.nshash[cognitive_hash(domain, Nnshash)]; cns != nil; cns = cns->hash_next)
+        if (strcmp(cns->domain, domain) == 0)
+            break;
+    runlock(&cognitive_state.reglock);
+    return cns;
+}
+
+void
+unregister_cognitive_namespace(CognitiveNamespace *cns)
+{
+    CognitiveNamespace **l;
+
+    wlock(&cognitive_state.reglock);
+    for (l = &cognitive_state.nshash[cognitive_hash(cns->domain, Nnshash)]; *l != nil; l = &(*l)->hash_next) {
+        if (*l == cns) {
+            *l = cns->hash_next;
+            cognitive_state.namespace_count--;
+            break;
+        }
     }
-    
-    unlock(&nc->queue_lock);
-    
-    return msg;
+    wunlock(&cognitive_state.reglock);
+    cognitive_changed(CVdomains);
 }
 
+static void cognitive_adapt_start(void);
+
 int
-queue_neural_message(NeuralChannel *nc, NeuralMessage *msg)
+register_neural_channel(NeuralChannel *nc)
 {
-    if (nc == nil || msg == nil)
-        return -1;
-        
-    lock(&nc->queue_lock);
-    
-    // Add to end of queue
-    msg->next = nil;
-    if (nc->message_queue == nil) {
-        nc->message_queue = msg;
-    } else {
-        NeuralMessage *tail = nc->message_queue;
-        while (tail->next != nil)
-            tail = tail->next;
-        tail->next = msg;
+    NeuralChannel **l, **tab;
+    int i;
+
+    wlock(&cognitive_state.reglock);
+    for (l = &cognitive_state.chhash[cognitive_hash(nc->channel_id, Nchhash)]; *l != nil; l = &(*l)->hash_next) {
+        if (strcmp((*l)->channel_id, nc->channel_id) == 0) {
+            wunlock(&cognitive_state.reglock);
+            return -1;
+        }
     }
-    
-    unlock(&nc->queue_lock);
-    
+    for (i = 0; i < cognitive_state.nchantab; i++)
+        if (cognitive_state.chantab[i] == nil)
+            break;
+    if (i == cognitive_state.nchantab) {
+        tab = realloc(cognitive_state.chantab, (i + Nchtabgrow) * sizeof(NeuralChannel*));
+        if (tab == nil) {
+            wunlock(&cognitive_state.reglock);
+            return -1;
+        }
+        memset(tab + i, 0, Nchtabgrow * sizeof(NeuralChannel*));
+        cognitive_state.chantab = tab;
+        cognitive_state.nchantab += Nchtabgrow;
+    }
+    cognitive_state.chantab[i] = nc;
+    nc->no = i;
+    nc->serial = ++cognitive_state.serial;
+    nc->hash_next = nil;
+    *l = nc;
+    cognitive_state.channel_count++;
+    wunlock(&cognitive_state.reglock);
+    cognitive_changed(CVchannels);
+    cognitive_adapt_start();
     return 0;
 }
 
-int
-adapt_neural_channel_capacity(NeuralChannel *nc)
+NeuralChannel*
+lookup_neural_channel(char *channel_id)
 {
-    float load_ratio;
-    ulong new_capacity;
-    
-    if (nc == nil)
-        return -1;
-        
-    load_ratio = (float)nc->current_load / nc->bandwidth_capacity;
-    
-    if (load_ratio > 0.8) { // High load threshold
-        // Increase capacity by adaptation rate
-        new_capacity = nc->bandwidth_capacity * (1.0 + nc->adaptation_rate);
-        nc->bandwidth_capacity = new_capacity;
-        nc->last_evolution = time(NULL);
-        
-        // Log adaptation
-        print("Neural channel %s adapted: new capacity %lud\n", 
-              nc->channel_id, new_capacity);
-        
-        return 0;
+    NeuralChannel *nc;
+
+    rlock(&cognitive_state.reglock);
+    for (nc = cognitive_state.chhash[cognitive_hash(channel_id, Nchhash)]; nc != nil; nc = nc->hash_next)
+        if (strcmp(nc->channel_id, channel_id) == 0)
+            break;
+    runlock(&cognitive_state.reglock);
+    return nc;
+}
+
+void
+unregister_neural_channel(NeuralChannel *nc)
+{
+    NeuralChannel **l;
+
+    wlock(&cognitive_state.reglock);
+    for (l = &cognitive_state.chhash[cognitive_hash(nc->channel_id, Nchhash)]; *l != nil; l = &(*l)->hash_next) {
+        if (*l == nc) {
+            *l = nc->hash_next;
+            cognitive_state.channel_count--;
+            cognitive_state.chantab[nc->no] = nil;
+            nc->no = -1;
+            break;
+        }
     }
-    
-    return -1;
+    wunlock(&cognitive_state.reglock);
+    cognitive_changed(CVchannels);
+}
+
+// Channel in table slot no, or nil.
+NeuralChannel*
+lookup_neural_channel_no(int no)
+{
+    NeuralChannel *nc;
+
+    nc = nil;
+    rlock(&cognitive_state.reglock);
+    if (no >= 0 && no < cognitive_state.nchantab)
+        nc = cognitive_state.chantab[no];
+    runlock(&cognitive_state.reglock);
+    return nc;
 }
 
+// One more than the highest slot number in use or free.
 int
-route_neural_message(NeuralChannel *nc, NeuralMessage *msg)
+neural_channel_slots(void)
 {
-    // Basic routing implementation
-    // In a full implementation, this would include:
-    // - Cognitive routing algorithms
-    // - Load balancing
-    // - QoS management
-    // - Pattern detection
-    
-    // For now, simple queuing
-    return queue_neural_message(nc, msg);
+    return cognitive_state.nchantab;
 }
 
-/*
- * Cognitive Namespace Operations
- */
+int
+neural_channel_no(NeuralChannel *nc)
+{
+    return nc->no;
+}
 
-CognitiveNamespace*
-create_cognitive_namespace(char *domain, char *namespace_path)
+// Distinguishes the channels that have held one slot, for qids.
+ulong
+neural_channel_serial(NeuralChannel *nc)
 {
-    CognitiveNamespace *cns;
-    
-    cns = malloc(sizeof(CognitiveNamespace));
-    if (cns == nil)
-        return nil;
-        
-    cns->domain = strdup(domain);
-    cns->namespace_path = strdup(namespace_path);
-    cns->cognitive_load = 0;
-    cns->last_adaptation = time(NULL);
-    cns->channels = nil;
-    cns->channel_count = 0;
-    cns->patterns = nil;
-    cns->pattern_count = 0;
-    
-    // Initialize adaptation lock
-    lock(&cns->adaptation_lock);
-    unlock(&cns->adaptation_lock);
-    
-    return cns;
+    return nc->serial;
 }
 
-int
-bind_neural_channel_to_namespace(CognitiveNamespace *cns, NeuralChannel *nc)
+char*
+neural_channel_id(NeuralChannel *nc)
 {
-    NeuralChannel **new_channels;
-    
-    if (cns == nil || nc == nil)
-        return -1;
-        
-    // Expand channel array
-    new_channels = realloc(cns->channels, 
-                          sizeof(NeuralChannel*) * (cns->channel_count + 1));
-    if (new_channels == nil)
-        return -1;
-        
-    cns->channels = new_channels;
-    cns->channels[cns->channel_count] = nc;
-    cns->channel_count++;
-    
-    print("Neural channel %s bound to cognitive namespace %s\n",
-          nc->channel_id, cns->domain);
-    
-    return 0;
+    return nc->channel_id;
 }
 
 int
-adapt_cognitive_namespace(CognitiveNamespace *cns)
+register_cognitive_swarm(CognitiveSwarm *swarm)
 {
-    int i;
-    float avg_load;
-    time_t current_time;
-    
-    if (cns == nil)
-        return -1;
-        
-    lock(&cns->adaptation_lock);
-    
-    current_time = time(NULL);
-    
-    // Calculate average channel load
-    if (cns->channel_count > 0) {
-        ulong total_load = 0;
-        for (i = 0; i < cns->channel_count; i++) {
-            total_load += cns->channels[i]->current_load;
+    CognitiveSwarm **l;
+
+    wlock(&cognitive_state.reglock);
+    for (l = &cognitive_state.swhash[cognitive_hash(swarm->swarm_id, Nswhash)]; *l != nil; l = &(*l)->hash_next) {
+        if (strcmp((*l)->swarm_id, swarm->swarm_id) == 0) {
+            wunlock(&cognitive_state.reglock);
+            return -1;
         }
-        avg_load = (float)total_load / cns->channel_count;
-    } else {
-        avg_load = 0.0;
     }
-    
-    // Update cognitive load
-    cns->cognitive_load = (int)avg_load;
-    
-    // Adapt if needed
-    if (avg_load > 100.0) { // High cognitive load
-        // Trigger channel adaptations
-        for (i = 0; i < cns->channel_count; i++) {
-            adapt_neural_channel_capacity(cns->channels[i]);
-        }
-        
-        cns->last_adaptation = current_time;
-        
-        print("Cognitive namespace %s adapted due to high load: %.2f\n",
-              cns->domain, avg_load);
-    }
-    
-    unlock(&cns->adaptation_lock);
-    
+    swarm->hash_next = nil;
+    *l = swarm;
+    cognitive_state.swarm_count++;
+    wunlock(&cognitive_state.reglock);
+    cognitive_changed(CVswarms);
+
+    // The coordination channel is reachable by id like any other
+    if (swarm->coordination_channel != nil)
+        register_neural_channel(swarm->coordination_channel);
     return 0;
 }
 
-/*
- * Cognitive Swarm Operations
- */
-
 CognitiveSwarm*
-create_cognitive_swarm(char *swarm_id, char *domain, Pgrp *pgrp)
+lookup_cognitive_swarm(char *swarm_id)
 {
     CognitiveSwarm *swarm;
-    
-    swarm = malloc(sizeof(CognitiveSwarm));
-    if (swarm == nil)
-        return nil;
-        
-    swarm->pgrp = pgrp;
-    swarm->swarm_id = strdup(swarm_id);
-    swarm->domain = strdup(domain);
-    swarm->agents = nil;
-    swarm->agent_count = 0;
-    swarm->coordination_channel = nil;
-    swarm->coherence_level = 1.0; // Start with perfect coherence
-    swarm->creation_time = time(NULL);
-    
-    // Initialize swarm lock
-    lock(&swarm->swarm_lock);
-    unlock(&swarm->swarm_lock);
-    
-    // Create coordination channel
-    swarm->coordination_channel = create_neural_channel(domain, "swarm-coordination", 1000);
-    
-    print("Cognitive swarm %s created for domain %s\n", swarm_id, domain);
-    
+
+    rlock(&cognitive_state.reglock);
+    for (swarm = cognitive_state.swhash[cognitive_hash(swarm_id, Nswhash)]; swarm != nil; swarm = swarm->hash_next)
+        if (strcmp(swarm->swarm_id, swarm_id) == 0)
+            break;
+    runlock(&cognitive_state.reglock);
     return swarm;
 }
 
-int
-add_agent_to_swarm(CognitiveSwarm *swarm, Proc *agent)
+void
+unregister_cognitive_swarm(CognitiveSwarm *swarm)
 {
-    Proc **new_agents;
-    
-    if (swarm == nil || agent == nil)
-        return -1;
-        
-    lock(&swarm->swarm_lock);
-    
-    // Expand agent array
-    new_agents = realloc(swarm->agents, 
-                        sizeof(Proc*) * (swarm->agent_count + 1));
-    if (new_agents == nil) {
-        unlock(&swarm->swarm_lock);
-        return -1;
+    CognitiveSwarm **l;
+
+    wlock(&cognitive_state.reglock);
+    for (l = &cognitive_state.swhash[cognitive_hash(swarm->swarm_id, Nswhash)]; *l != nil; l = &(*l)->hash_next) {
+        if (*l == swarm) {
+            *l = swarm->hash_next;
+            cognitive_state.swarm_count--;
+            break;
+        }
     }
-    
-    swarm->agents = new_agents;
-    swarm->agents[swarm->agent_count] = agent;
-    swarm->agent_count++;
-    
-    // Set agent's cognitive swarm reference
-    agent->aux = swarm; // Store swarm reference in process aux field
-    
-    unlock(&swarm->swarm_lock);
-    
-    print("Agent process %d added to cognitive swarm %s\n", 
-          agent->pid, swarm->swarm_id);
-    
-    return 0;
+    wunlock(&cognitive_state.reglock);
+    cognitive_changed(CVswarms);
 }
 
-float
-calculate_swarm_coherence(CognitiveSwarm *swarm)
+/*
+ * Event Stream
+ *
+ * Adaptation, emergence, swarm-join and overflow events are kept
+ * as text lines in a ring indexed by a global sequence number.
+ * Every open of the events file gets its own reader with a cursor
+ * into the ring and its own Rendez, so readers block independently
+ * and none consumes another's events.  A reader that falls more
+ * than Nevents behind is told how many events it lost.  With no
+ * readers, cognitive_event returns before formatting anything.
+ */
+enum {
+    Nevents = 256,                // power of two
+    Eventlen = 128,
+};
+
+struct CognitiveEventReader {
+    ulong cursor;                 // Sequence number of next event to read
+    QLock readq;                  // One sleeper per reader
+    Rendez r;
+    Pollq poll;                   // Event sets watching this reader
+    CognitiveEventReader *next;
+};
+
+static struct {
+    Lock;
+    ulong seq;                    // Sequence number of next event
+    char text[Nevents][Eventlen];
+    CognitiveEventReader *readers;
+    int nreaders;
+} cognitive_events;
+
+void
+cognitive_event(char *fmt, ...)
 {
-    // Simplified coherence calculation
-    // In a full implementation, this would analyze:
-    // - Agent coordination efficiency
-    // - Message passing success rates
-    // - Collective decision making effectiveness
-    // - Emergent behavior alignment
-    
-    if (swarm == nil || swarm->agent_count == 0)
-        return 0.0;
-        
-    // For now, calculate based on agent count and coordination channel load
-    float base_coherence = 1.0;
-    float load_factor = 1.0;
-    
-    if (swarm->coordination_channel != nil) {
-        load_factor = 1.0 - ((float)swarm->coordination_channel->current_load / 
-                            swarm->coordination_channel->bandwidth_capacity);
+    CognitiveEventReader *r;
+    char buf[Eventlen];
+    char *e;
+    va_list arg;
+
+    if (cognitive_events.nreaders == 0)
+        return;
+
+    e = seprint(buf, buf + sizeof buf, "%lud ", seconds());
+    va_start(arg, fmt);
+    e = vseprint(e, buf + sizeof buf - 1, fmt, arg);
+    va_end(arg);
+    *e++ = '\n';
+    *e = 0;
+
+    lock(&cognitive_events);
+    strcpy(cognitive_events.text[cognitive_events.seq % Nevents], buf);
+    cognitive_events.seq++;
+    for (r = cognitive_events.readers; r != nil; r = r->next) {
+        wakeup(&r->r);
+        pollwakeup(&r->poll);
     }
-    
-    // Agent count factor (larger swarms have coordination challenges)
-    float size_factor = 1.0 / (1.0 + (swarm->agent_count / 10.0));
-    
-    swarm->coherence_level = base_coherence * load_factor * size_factor;
-    
-    return swarm->coherence_level;
+    unlock(&cognitive_events);
+}
+
+CognitiveEventReader*
+cognitive_events_open(void)
+{
+    CognitiveEventReader *r;
+
+    r = smalloc(sizeof(CognitiveEventReader));
+    lock(&cognitive_events);
+    r->cursor = cognitive_events.seq;
+    r->next = cognitive_events.readers;
+    cognitive_events.readers = r;
+    cognitive_events.nreaders++;
+    unlock(&cognitive_events);
+    return r;
+}
+
+void
+cognitive_events_close(CognitiveEventReader *r)
+{
+    CognitiveEventReader **l;
+
+    lock(&cognitive_events);
+    for (l = &cognitive_events.readers; *l != nil; l = &(*l)->next) {
+        if (*l == r) {
+            *l = r->next;
+            cognitive_events.nreaders--;
+            break;
+        }
+    }
+    unlock(&cognitive_events);
+    pollclose(&r->poll);
+    free(r);
+}
+
+static int
+cognitive_events_ready(void *a)
+{
+    CognitiveEventReader *r;
+
+    r = a;
+    return r->cursor != cognitive_events.seq;
+}
+
+// Readable whenever a read would not sleep.
+int
+cognitive_events_poll(CognitiveEventReader *r, Pollw *w)
+{
+    pollon(w, &r->poll);
+    return cognitive_events_ready(r) ? Pollin : 0;
 }
 
 /*
- * Emergence Detection
+ * Block until at least one event is pending, then return as many
+ * whole lines as fit in n bytes.  Raises an error if interrupted.
  */
-
-EmergentPattern*
-detect_emergent_pattern(char *pattern_name, char **domains, int domain_count)
+long
+cognitive_events_read(CognitiveEventReader *r, void *a, long n)
 {
-    EmergentPattern *pattern;
-    int i;
-    
-    pattern = malloc(sizeof(EmergentPattern));
-    if (pattern == nil)
-        return nil;
-        
-    pattern->pattern_id = smprint("pattern-%lud", time(NULL));
-    pattern->pattern_name = strdup(pattern_name);
-    pattern->description = smprint("Emergent pattern observed across %d domains", domain_count);
-    pattern->first_observed = time(NULL);
-    pattern->last_observed = time(NULL);
-    pattern->observation_count = 1;
-    pattern->significance_score = 0.5; // Initial significance
-    
-    // Copy domain list
-    pattern->involved_domains = malloc(sizeof(char*) * domain_count);
-    pattern->domain_count = domain_count;
-    for (i = 0; i < domain_count; i++) {
-        pattern->involved_domains[i] = strdup(domains[i]);
+    char buf[Eventlen];
+    char *p;
+    ulong lost;
+    int len;
+
+    qlock(&r->readq);
+    if (waserror()) {
+        qunlock(&r->readq);
+        nexterror();
     }
-    
-    print("Emergent pattern detected: %s across domains: ", pattern_name);
-    for (i = 0; i < domain_count; i++) {
-        print("%s ", domains[i]);
+    sleep(&r->r, cognitive_events_ready, r);
+
+    p = a;
+    while (n > 0) {
+        lock(&cognitive_events);
+        if (r->cursor == cognitive_events.seq) {
+            unlock(&cognitive_events);
+            break;
+        }
+        lost = cognitive_events.seq - r->cursor;
+        if (lost > Nevents) {
+            // Overwritten; skip to the oldest event still held
+            lost -= Nevents;
+            snprint(buf, sizeof buf, "%lud lost %lud\n", seconds(), lost);
+        } else {
+            lost = 0;
+            strcpy(buf, cognitive_events.text[r->cursor % Nevents]);
+        }
+        len = strlen(buf);
+        if (len > n && p != a) {
+            unlock(&cognitive_events);
+            break;
+        }
+        if (len > n)
+            len = n;
+        r->cursor += lost != 0 ? lost : 1;
+        unlock(&cognitive_events);
+
+        memmove(p, buf, len);
+        p += len;
+        n -= len;
     }
-    print("\n");
-    
-    return pattern;
+    qunlock(&r->readq);
+    poperror();
+    return p - (char*)a;
 }
 
 /*
- * Initialization and Setup
+ * Operation Profile
+ *
+ * The hot operations count their calls and fastticks on the CPU
+ * they start on, so nothing is shared and nothing is locked; a
+ * count can be lost if a proc moves mid-update, which a profile
+ * can afford.  While profiling is off each operation pays one load
+ * and branch.  Times are inclusive: an ESN step includes its
+ * encode, and membrane steps include waiting on the worker pool.
+ * cognitive_prof_text reports every operation with the address of
+ * the function it times, so PC samples from kprof can be charged to
+ * the operation whose code they fall in.
  */
+typedef struct CogProf CogProf;
+struct CogProf {
+    uvlong calls;
+    uvlong ticks;
+    uvlong max;
+};
 
-void
-cognitive_cities_init(void)
+static struct {
+    int on;
+    struct {
+        CogProf op[Ncogprof];
+        uchar pad[64 - Ncogprof*sizeof(CogProf) % 64];   // One cache line apart
+    } mach[MAXMACH];
+} cogprof;
+
+static uvlong
+cogprof_start(void)
 {
-    // Initialize global cognitive state
-    lock(&cognitive_state);
-    
-    cognitive_state.namespaces = nil;
-    cognitive_state.namespace_count = 0;
-    cognitive_state.channels = nil;
-    cognitive_state.channel_count = 0;
-    cognitive_state.swarms = nil;
-    cognitive_state.swarm_count = 0;
-    cognitive_state.patterns = nil;
-    cognitive_state.pattern_count = 0;
-    
-    unlock(&cognitive_state);
-    
-    print("Cognitive Cities architecture initialized\n");
-    
-    // Create initial cognitive namespaces for main domains
-    create_initial_cognitive_domains();
+    return cogprof.on ? fastticks(nil) : 0;
 }
 
-void
-create_initial_cognitive_domains(void)
+static void
+cogprof_end(int op, uvlong t0)
 {
-    CognitiveNamespace *transportation, *energy, *governance, *environment;
-    
-    // Create core cognitive domain namespaces
-    transportation = create_cognitive_namespace("transportation", 
-                                               "/cognitive-cities/domains/transportation");
-    energy = create_cognitive_namespace("energy", 
-                                       "/cognitive-cities/domains/energy");
-    governance = create_cognitive_namespace("governance", 
-                                           "/cognitive-cities/domains/governance");
-    environment = create_cognitive_namespace("environment", 
-                                            "/cognitive-cities/domains/environment");
-    
-    // Add to global state
-    // (Implementation would add to cognitive_state arrays)
-    
-    print("Initial cognitive domains created: transportation, energy, governance, environment\n");
-    
-    // Create inter-domain neural transport channels
-    create_interdomain_channels(transportation, energy, governance, environment);
+    CogProf *p;
+    uvlong d;
+
+    if (t0 == 0)
+        return;
+    d = fastticks(nil) - t0;
+    p = &cogprof.mach[m->machno].op[op];
+    p->calls++;
+    p->ticks += d;
+    if (d > p->max)
+        p->max = d;
 }
 
+// start, startclr or stop, as kprof's kpctl
 void
-create_interdomain_channels(CognitiveNamespace *transportation, 
-                           CognitiveNamespace *energy,
-                           CognitiveNamespace *governance, 
-                           CognitiveNamespace *environment)
+cognitive_prof_ctl(int on, int clear)
 {
-    NeuralChannel *trans_energy, *trans_gov, *energy_env, *gov_env;
-    
-    // Create neural channels between domains
-    trans_energy = create_neural_channel("transportation", "energy", 500);
-    trans_gov = create_neural_channel("transportation", "governance", 300);
-    energy_env = create_neural_channel("energy", "environment", 400);
-    gov_env = create_neural_channel("governance", "environment", 200);
-    
-    // Bind channels to namespaces
-    bind_neural_channel_to_namespace(transportation, trans_energy);
-    bind_neural_channel_to_namespace(transportation, trans_gov);
-    bind_neural_channel_to_namespace(energy, trans_energy);
-    bind_neural_channel_to_namespace(energy, energy_env);
-    bind_neural_channel_to_namespace(governance, trans_gov);
-    bind_neural_channel_to_namespace(governance, gov_env);
-    bind_neural_channel_to_namespace(environment, energy_env);
-    bind_neural_channel_to_namespace(environment, gov_env);
-    
-    print("Inter-domain neural transport channels established\n");
+    if (clear)
+        memset(cogprof.mach, 0, sizeof cogprof.mach);
+    cogprof.on = on;
+    cognitive_changed(CVsample);
 }
 
 /*
- * Rooted Tree Generation Functions (A000081)
- * 
- * These functions implement the recursive assembly algorithm for generating
- * all rooted trees with n nodes, using binary encoding for compact storage.
+ * Neural Message Allocation
+ *
+ * Message headers come from per-processor caches that exchange
+ * batches of NMbatch headers with a global depot, so the common
+ * send/receive cycle touches only the local processor's cache.
+ * The depot is refilled by carving NMslab headers out of one
+ * malloc.  Domain and swarm names are interned as atoms so a
+ * message only stores pointers, and payloads of up to NMinline
+ * bytes are copied into the header itself.
  */
 
-static void
-init_rooted_trees(void)
+struct NeuralMsgCache {
+    Lock;
+    NeuralMessage *free;
+    int nfree;
+    ulong allocs;                 // Headers handed out
+    ulong hits;                   // ... satisfied without the depot
+    ulong frees;
+    ulong drains;                 // Batches returned to the depot
+};
+
+static struct {
+    Lock;
+    NeuralMessage *free;
+    int nfree;
+    ulong slabs;                  // Slab allocations made
+    ulong refills;                // Batches handed to per-cpu caches
+} msgdepot;
+
+static NeuralMsgCache msgcache[MAXMACH];
+
+static struct {
+    ulong inline_payloads;
+    ulong large_payloads;         // Payloads too big for inline storage
+} msgpayload;
+
+enum {
+    Natomhash = 64,
+};
+
+struct NeuralAtom {
+    NeuralAtom *next;
+    char name[1];                 // Allocated to fit
+};
+
+static struct {
+    Lock;
+    NeuralAtom *hash[Natomhash];
+    int count;
+} atoms;
+
+static ulong
+atomhash(char *s)
 {
-    lock(&rooted_trees);
-    
-    if (rooted_trees.list == nil) {
-        rooted_trees.list_capacity = 10000;  // Start with capacity for ~10k trees
-        rooted_trees.list = malloc(rooted_trees.list_capacity * sizeof(tree));
-        rooted_trees.offset = malloc((MAXN + 2) * sizeof(ulong));
-        
-        if (rooted_trees.list == nil || rooted_trees.offset == nil) {
-            print("rooted_trees: failed to allocate memory\n");
-            unlock(&rooted_trees);
-            return;
+    ulong h;
+
+    h = 0;
+    while (*s)
+        h = h * 31 + (uchar)*s++;
+    return h % Natomhash;
+}
+
+// Return the canonical copy of name; atoms are never freed.
+char*
+neural_atom(char *name)
+{
+    NeuralAtom *a;
+    ulong h;
+    int n;
+
+    if (name == nil)
+        return nil;
+    h = atomhash(name);
+    lock(&atoms);
+    for (a = atoms.hash[h]; a != nil; a = a->next) {
+        if (strcmp(a->name, name) == 0) {
+            unlock(&atoms);
+            return a->name;
         }
-        
-        // Initialize: offset[0] = 0, tree size 0 has no trees
-        rooted_trees.offset[0] = 0;
-        rooted_trees.list_size = 0;
-        rooted_trees.max_n = 0;
     }
-    
-    unlock(&rooted_trees);
+    n = strlen(name);
+    a = malloc(sizeof(NeuralAtom) + n);
+    if (a == nil) {
+        unlock(&atoms);
+        return nil;
+    }
+    memmove(a->name, name, n + 1);
+    a->next = atoms.hash[h];
+    atoms.hash[h] = a;
+    atoms.count++;
+    unlock(&atoms);
+    return a->name;
 }
 
+// Move a batch of headers from the depot into c; c is locked.
 static void
-append_tree(tree t)
+msgcache_refill(NeuralMsgCache *c)
 {
-    lock(&rooted_trees);
-    
-    // Expand list if needed
-    if (rooted_trees.list_size >= rooted_trees.list_capacity) {
-        int new_capacity = rooted_trees.list_capacity * 2;
-        tree *new_list = malloc(new_capacity * sizeof(tree));
-        
-        if (new_list == nil) {
-            print("append_tree: failed to expand list\n");
-            unlock(&rooted_trees);
-            return;
+    NeuralMessage *m, *slab;
+    int i;
+
+    lock(&msgdepot);
+    if (msgdepot.nfree < NMbatch) {
+        slab = malloc(NMslab * sizeof(NeuralMessage));
+        if (slab != nil) {
+            for (i = 0; i < NMslab; i++) {
+                slab[i].next = msgdepot.free;
+                msgdepot.free = &slab[i];
+            }
+            msgdepot.nfree += NMslab;
+            msgdepot.slabs++;
         }
-        
-        memmove(new_list, rooted_trees.list, rooted_trees.list_size * sizeof(tree));
-        free(rooted_trees.list);
-        rooted_trees.list = new_list;
-        rooted_trees.list_capacity = new_capacity;
     }
-    
-    // Add tree with sentinel bit: stored as (1 | t<<1)
-    rooted_trees.list[rooted_trees.list_size++] = 1ULL | (t << 1);
-    
-    unlock(&rooted_trees);
+    for (i = 0; i < NMbatch && (m = msgdepot.free) != nil; i++) {
+        msgdepot.free = m->next;
+        msgdepot.nfree--;
+        m->next = c->free;
+        c->free = m;
+        c->nfree++;
+    }
+    msgdepot.refills++;
+    unlock(&msgdepot);
 }
 
+// Return a batch of headers from c to the depot; c is locked.
 static void
-assemble_trees(uint n, tree t, uint sl, uint pos, uint rem)
+msgcache_drain(NeuralMsgCache *c)
 {
-    if (rem == 0) {
-        append_tree(t);
-        return;
-    }
-    
-    // Try adding a subtree of size sl
-    if (sl > rem) {
-        sl = rem;
-        pos = rooted_trees.offset[sl];
-    } else if (pos >= rooted_trees.offset[sl + 1]) {
-        sl--;
-        if (sl == 0)
-            return;
-        pos = rooted_trees.offset[sl];
+    NeuralMessage *m;
+    int i;
+
+    lock(&msgdepot);
+    for (i = 0; i < NMbatch && (m = c->free) != nil; i++) {
+        c->free = m->next;
+        c->nfree--;
+        m->next = msgdepot.free;
+        msgdepot.free = m;
+        msgdepot.nfree++;
     }
-    
-    // Recurse: add current subtree or try next
-    assemble_trees(n, (t << (2 * sl)) | rooted_trees.list[pos], sl, pos, rem - sl);
-    assemble_trees(n, t, sl, pos + 1, rem);
+    unlock(&msgdepot);
+    c->drains++;
 }
 
-static void
-generate_trees(uint n)
+NeuralMessage*
+neural_message_alloc(char *source, char *target, void *payload, ulong size)
 {
-    lock(&rooted_trees);
-    
-    if (n <= rooted_trees.max_n) {
-        unlock(&rooted_trees);
-        return;  // Already generated
+    NeuralMsgCache *c;
+    NeuralMessage *msg;
+
+    c = &msgcache[m->machno];
+    lock(c);
+    c->allocs++;
+    if (c->free == nil)
+        msgcache_refill(c);
+    else
+        c->hits++;
+    msg = c->free;
+    if (msg != nil) {
+        c->free = msg->next;
+        c->nfree--;
     }
-    
-    // Generate all trees up to size n
-    for (uint i = rooted_trees.max_n + 1; i <= n && i <= MAXN; i++) {
-        rooted_trees.offset[i] = rooted_trees.list_size;
-        
-        if (i == 1) {
-            // Base case: single node is just ()
-            append_tree(0);  // Empty tree inside parentheses
-        } else {
-            // Recursive case: assemble from smaller trees
-            assemble_trees(i, 0, i - 1, rooted_trees.offset[i - 1], i - 1);
+    unlock(c);
+    if (msg == nil)
+        return nil;
+
+    memset(msg, 0, offsetof(NeuralMessage, inline_payload[0]));
+    msg->ref = 1;
+    msg->created = fastticks(nil);
+    msg->source_domain = neural_atom(source);
+    msg->target_domain = neural_atom(target);
+    msg->payload_size = size;
+    if (size <= NMinline) {
+        if (payload != nil && size > 0)
+            memmove(msg->inline_payload, payload, size);
+        msg->cognitive_payload = msg->inline_payload;
+        msgpayload.inline_payloads++;
+    } else {
+        msg->cognitive_payload = malloc(size);
+        if (msg->cognitive_payload == nil) {
+            neural_message_free(msg);
+            return nil;
         }
+        if (payload != nil)
+            memmove(msg->cognitive_payload, payload, size);
+        msgpayload.large_payloads++;
     }
-    
-    rooted_trees.offset[n + 1] = rooted_trees.list_size;
-    rooted_trees.max_n = n;
-    
-    unlock(&rooted_trees);
+    return msg;
 }
 
 /*
- * Tree to String Conversion
+ * Wrap a Block as a message payload without copying;
+ * the message owns b and frees it with itself.
  */
-
-static void
-tree_to_parens_recursive(tree t, uint len, char *buf, int *pos)
+NeuralMessage*
+neural_message_alloc_block(char *source, char *target, Block *b)
 {
-    for (uint i = 0; i < len; i++) {
-        if (t & 1) {
-            buf[(*pos)++] = '(';
-        } else {
-            buf[(*pos)++] = ')';
-        }
-        t >>= 1;
+    NeuralMessage *msg;
+
+    if (b->next != nil)
+        b = concatblock(b);
+    msg = neural_message_alloc(source, target, nil, 0);
+    if (msg == nil) {
+        freeb(b);
+        return nil;
     }
+    msg->block = b;
+    msg->cognitive_payload = b->rp;
+    msg->payload_size = BLEN(b);
+    return msg;
 }
 
-static char*
-tree_to_parens(tree t, uint len)
+/*
+ * Take another reference to msg; each holder releases its own
+ * with neural_message_free.
+ */
+NeuralMessage*
+neural_message_ref(NeuralMessage *msg)
 {
-    char *buf = malloc((2 * len + 1) * sizeof(char));
-    if (buf == nil)
-        return nil;
-    
-    int pos = 0;
-    tree_to_parens_recursive(t, 2 * len, buf, &pos);
-    buf[pos] = '\0';
-    return buf;
+    _xinc(&msg->ref);
+    return msg;
+}
+
+void
+neural_message_free(NeuralMessage *msg)
+{
+    NeuralMsgCache *c;
+
+    if (msg == nil)
+        return;
+    // A sole holder need not pay for the atomic decrement
+    if (msg->ref != 1 && _xdec(&msg->ref) > 0)
+        return;
+    if (msg->block != nil) {
+        freeblist(msg->block);
+        msg->block = nil;
+    } else if (msg->cognitive_payload != nil && msg->cognitive_payload != msg->inline_payload)
+        free(msg->cognitive_payload);
+    msg->cognitive_payload = nil;
+
+    c = &msgcache[m->machno];
+    lock(c);
+    msg->next = c->free;
+    c->free = msg;
+    c->nfree++;
+    c->frees++;
+    if (c->nfree > NMcachemax)
+        msgcache_drain(c);
+    unlock(c);
+}
+
+int
+neural_slab_stats(char *buf, int len)
+{
+    NeuralMsgCache *c;
+    ulong allocs, hits;
+    int i, n;
+
+    n = snprint(buf, len, "depot free=%d slabs=%lud refills=%lud\n",
+                msgdepot.nfree, msgdepot.slabs, msgdepot.refills);
+    allocs = hits = 0;
+    for (i = 0; i < conf.nmach; i++) {
+        c = &msgcache[i];
+        allocs += c->allocs;
+        hits += c->hits;
+        n += snprint(buf + n, len - n,
+                     "cpu%d free=%d allocs=%lud hits=%lud frees=%lud drains=%lud\n",
+                     i, c->nfree, c->allocs, c->hits, c->frees, c->drains);
+    }
+    n += snprint(buf + n, len - n, "hitrate %lud%%\n",
+                 allocs ? (hits * 100) / allocs : 100);
+    n += snprint(buf + n, len - n, "payload inline=%lud large=%lud\n",
+                 msgpayload.inline_payloads, msgpayload.large_payloads);
+    n += snprint(buf + n, len - n, "atoms %d\n", atoms.count);
+    return n;
 }
 
 /*
- * Rooted Tree Structure Functions
+ * Neural Channel Operations
  */
 
-static RootedTree*
-create_rooted_tree(tree binary_rep, uint node_count)
+static NeuralRing*
+neural_ring_alloc(void)
 {
-    RootedTree *rt;
-    
-    rt = malloc(sizeof(RootedTree));
-    if (rt == nil)
-        return nil;
-    
-    rt->binary_rep = binary_rep;
-    rt->node_count = node_count;
-    rt->parens_notation = tree_to_parens(binary_rep, node_count);
-    if (rt->parens_notation == nil) {
-        free(rt);
+    NeuralRing *r;
+    int i;
+
+    r = mallocalign(sizeof(NeuralRing), CACHELINESZ, 0, 0);
+    if (r == nil)
         return nil;
+    memset(r, 0, sizeof(NeuralRing));
+    for (i = 0; i < Nringslots; i++)
+        r->slot[i].seq = i;
+    return r;
+}
+
+// Claim a slot and publish msg; returns -1 if the ring is full.
+static int
+neural_ring_put(NeuralRing *r, NeuralMessage *msg)
+{
+    NeuralSlot *s;
+    long pos, dif;
+
+    for (;;) {
+        pos = r->head;
+        s = &r->slot[pos & Nringmask];
+        dif = s->seq - pos;
+        if (dif == 0) {
+            if (cmpswap(&r->head, pos, pos + 1))
+                break;
+        } else if (dif < 0)
+            return -1;
+        // else another producer claimed pos; reload head
     }
-    rt->namespace_path = nil;  // Set later
-    rt->depth = 0;  // Calculate later
-    rt->subtrees = nil;
-    rt->subtree_count = 0;
-    rt->matula_number = 0;  // Calculate later
-    
-    // Compute Matula number
-    compute_matula_number(rt);
-    
-    return rt;
+    s->msg = msg;
+    coherence();
+    s->seq = pos + 1;
+    return 0;
 }
 
-static char*
-tree_to_namespace_path(char *parens, char *base_domain)
+// Oldest published message, without removing it.
+static NeuralMessage*
+neural_ring_peek(NeuralRing *r)
 {
-    // Convert parentheses notation to namespace path
-    // E.g., "(()())" becomes "/domain/shell0/shell1"
-    
-    char *path = malloc(1024);
-    if (path == nil)
+    NeuralSlot *s;
+
+    s = &r->slot[r->tail & Nringmask];
+    if (s->seq != r->tail + 1)
         return nil;
-    
-    int pos = 0;
-    int depth = 0;
-    int shell_num = 0;
-    
-    pos += snprint(path + pos, 1024 - pos, "/%s", base_domain);
-    
-    for (int i = 0; parens[i] != '\0' && pos < 1020; i++) {
-        if (parens[i] == '(') {
-            pos += snprint(path + pos, 1024 - pos, "/shell%d", shell_num++);
-            depth++;
-        } else {
-            depth--;
-        }
-    }
-    
-    return path;
+    return s->msg;
 }
 
-RootedTree*
-create_rooted_tree_from_parens(char *parens)
+// Single-consumer take; caller holds recv_lock.
+static NeuralMessage*
+neural_ring_get(NeuralRing *r)
 {
-    RootedTree *rt;
-    tree binary_rep;
-    int node_count;
-    
-    // For now, create a simple representation
-    // In full implementation, would parse parens to binary
-    binary_rep = 0;  // Simplified
-    node_count = strlen(parens) / 2; // Approximate
+    NeuralSlot *s;
+    NeuralMessage *msg;
+    long pos;
+
+    pos = r->tail;
+    s = &r->slot[pos & Nringmask];
+    if (s->seq != pos + 1)
+        return nil;       // empty, or producer still filling the slot
+    msg = s->msg;
+    s->msg = nil;
+    coherence();
+    s->seq = pos + Nringslots;
+    r->tail = pos + 1;
+    return msg;
+}
+
+static void
+atomic_setbits(long *p, long bits)
+{
+    long v;
+
+    do
+        v = *p;
+    while ((v & bits) != bits && !cmpswap(p, v, v | bits));
+}
+
+static void
+atomic_clearbits(long *p, long bits)
+{
+    long v;
+
+    do
+        v = *p;
+    while ((v & bits) != 0 && !cmpswap(p, v, v & ~bits));
+}
+
+// Map a 0-100 cognitive_priority to a queue level.
+int
+neural_prio_level(ulong priority)
+{
+    if (priority >= 90)
+        return 0;         // emergency
+    if (priority >= 60)
+        return 1;         // interactive coordination
+    if (priority >= 30)
+        return 2;         // normal
+    return 3;             // bulk telemetry
+}
+
+static ulong default_age_limit[Nprio] = { 0, 50, 250, 1000 };
+
+NeuralChannel*
+create_neural_channel(char *source_domain, char *target_domain, ulong bandwidth)
+{
+    NeuralChannel *nc;
+    int i;
     
-    rt = malloc(sizeof(RootedTree));
-    if (rt == nil)
+    nc = malloc(sizeof(NeuralChannel));
+    if (nc == nil)
         return nil;
+
+    for (i = 0; i < Nprio; i++) {
+        nc->level[i].ring = neural_ring_alloc();
+        if (nc->level[i].ring == nil) {
+            while (--i >= 0)
+                free(nc->level[i].ring);
+            free(nc);
+            return nil;
+        }
+        nc->level[i].age_limit = default_age_limit[i];
+    }
+        
+    // Initialize base channel
+    channelinit(&nc->chan);
     
-    rt->binary_rep = binary_rep;
-    rt->node_count = node_count;
-    rt->parens_notation = strdup(parens);
-    rt->namespace_path = nil;
-    rt->depth = 0;
-    rt->subtrees = nil;
-    rt->subtree_count = 0;
-    
-    // Compute Matula number from parentheses
-    rt->matula_number = parens_to_matula(parens);
+    // Initialize cognitive properties
+    nc->channel_id = smprint("%s-%s-%lud", source_domain, target_domain, time(NULL));
+    nc->source_domain = neural_atom(source_domain);
+    nc->target_domain = neural_atom(target_domain);
+    if (bandwidth < NCminwindow)
+        bandwidth = NCminwindow;
+    nc->bandwidth_capacity = bandwidth;
+    nc->max_capacity = bandwidth * NCmaxgrowth;
+    nc->current_load = 0;
+    nc->drain_mark_ticks = fastticks(nil);
+    nc->accept_avg = 1000;
+    nc->shard = mallocalign(conf.nmach * sizeof(NCShard), NCshardsize, 0, 0);
+    nc->q = qopen(bandwidth * NBavgmsg, Qmsg, nil, nil);
+    if (nc->q == nil || nc->shard == nil) {
+        if (nc->q != nil)
+            qfree(nc->q);
+        for (i = 0; i < Nprio; i++)
+            free(nc->level[i].ring);
+        free(nc->shard);
+        free(nc);
+        return nil;
+    }
+    memset(nc->shard, 0, conf.nmach * sizeof(NCShard));
+    nc->no = -1;
+    nc->adaptcpu = -1;
+    nc->data_prio = 50;
+    nc->adaptation_rate = 0.1; // 10% adaptation rate
+    nc->last_evolution = time(NULL);
+    nc->active = 0;
     
-    return rt;
+    return nc;
 }
 
 /*
- * Matula Number Functions
- * 
- * Matula numbers provide a bijection between rooted trees and natural numbers
- * using prime factorization. This encoding allows trees to be uniquely represented
- * as integers.
- * 
- * The mapping works as follows:
- * - The empty tree (single node) maps to 1
- * - A tree with children c1, c2, ..., cn maps to p(M(c1)) * p(M(c2)) * ... * p(M(cn))
- *   where p(k) is the k-th prime number and M(t) is the Matula number of tree t
- * 
- * Examples from A000081:
- * []              → 1 → becomes p(1) = 2
- * [[]]            → 2 → becomes p(2) = 3
- * [] []           → 1*1 → becomes 2^2 = 4
- * [[[]]]          → 3 → becomes p(3) = 5
- * [[] []]         → 2*1 → becomes 3*2 = 6
- * [[],[]]         → 4 → becomes p(4) = 7
- * [] [] []        → 1*1*1 → becomes 2^3 = 8
- */
-
-// Prime number table (first 100 primes, enough for most practical tree sizes)
-static uvlong primes[] = {
-    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71,
-    73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131, 137, 139, 149, 151,
-    157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223, 227, 229, 233,
-    239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311, 313, 317,
-    331, 337, 347, 349, 353, 359, 367, 373, 379, 383, 389, 397, 401, 409, 419,
-    421, 433, 439, 443, 449, 457, 461, 463, 467, 479, 487, 491, 499, 503, 509,
-    521, 523, 541, 547
-};
-#define NPRIMES (sizeof(primes)/sizeof(primes[0]))
-
-// Get the n-th prime number (1-indexed: prime(1) = 2, prime(2) = 3, etc.)
-static uvlong
-nth_prime(int n)
+ * Free a channel that was never registered or has been
+ * unregistered and drained.
+ */
+void
+free_neural_channel(NeuralChannel *nc)
 {
-    if (n < 1 || n > NPRIMES)
-        return 0;  // Out of range
-    return primes[n - 1];
+    int i;
+
+    if (nc == nil)
+        return;
+    for (i = 0; i < Nprio; i++)
+        free(nc->level[i].ring);
+    qfree(nc->q);
+    free(nc->shard);
+    free(nc->channel_id);
+    free(nc);
 }
 
-// Find which prime a number is (inverse of nth_prime)
-// Returns n such that primes[n-1] == p, or 0 if p is not prime
+/*
+ * Domain processor sets.  A domain given a set has the consumers of
+ * its channels preferred there by runproc, as a swarm's agents are,
+ * and its adaptation run by a cogadapt kproc wired to the first of
+ * them.  Consumers then free message headers into, and take credits
+ * from, the caches of the domain's processors, and domains on
+ * disjoint sets do not share them.  Sets are allocated round robin
+ * along with the swarms'.
+ */
+static struct {
+    Lock;
+    int next;                     // First processor of the next set
+    int steer;                    // Next processor a consumer is sent to
+} cogcpus;
+
+/*
+ * A set of ncpu processors, or 0 for any if ncpu is 0 or all of
+ * them.  Returns -1 if ncpu is out of range.
+ */
 static int
-prime_index(uvlong p)
+cognitive_cpu_alloc(int ncpu, ulong *maskp)
 {
-    for (int i = 0; i < NPRIMES; i++) {
-        if (primes[i] == p)
-            return i + 1;
-        if (primes[i] > p)
-            break;
+    ulong mask;
+    int i, first;
+
+    if (ncpu < 0 || ncpu > conf.nmach || ncpu > sizeof(ulong) * 8)
+        return -1;
+    // All processors is no preference at all
+    mask = 0;
+    if (ncpu > 0 && ncpu < conf.nmach) {
+        lock(&cogcpus);
+        first = cogcpus.next;
+        cogcpus.next = (first + ncpu) % conf.nmach;
+        unlock(&cogcpus);
+        for (i = 0; i < ncpu; i++)
+            mask |= 1UL << ((first + i) % conf.nmach);
     }
+    *maskp = mask;
     return 0;
 }
 
-// Simple prime factorization for Matula number decoding
-// Returns the exponents of each prime factor
+/*
+ * Give the consumer reading nc its target domain's preference.
+ * One running elsewhere is queued on one of the domain's processors,
+ * round robin, when next readied.  Kernel procs, wired procs and
+ * swarm agents are left alone.
+ */
 static void
-factorize(uvlong n, int *exponents, int max_primes)
+neural_channel_steer(NeuralChannel *nc)
 {
-    for (int i = 0; i < max_primes; i++)
-        exponents[i] = 0;
-    
-    for (int i = 0; i < NPRIMES && i < max_primes && n > 1; i++) {
-        while (n % primes[i] == 0) {
-            exponents[i]++;
-            n /= primes[i];
+    ulong cpus;
+    int i, c;
+
+    if (up == nil || up->kp || up->wired != nil || up->swarm != nil)
+        return;
+    cpus = nc->cpus;
+    if (up->swarmcpus == cpus)
+        return;
+    up->swarmcpus = cpus;
+    if (cpus == 0 || (cpus & (1UL << m->machno)))
+        return;
+    for (i = 0; i < conf.nmach; i++) {
+        c = (cogcpus.steer + i) % conf.nmach;
+        if (cpus & (1UL << c)) {
+            cogcpus.steer = c + 1;
+            up->mp = MACHP(c);
+            break;
         }
     }
 }
 
-// Parse parentheses notation to extract direct children as subtrees
-// Returns the number of direct children found
+/*
+ * Credits are cached per cpu so the common send and receive touch
+ * only the local shard.  A sender takes up to NCbatch credits from
+ * the window when its shard is empty; a receiver returns credits to
+ * its own shard and gives NCbatch back once it holds twice that.
+ * current_load counts credits out of the window, so the messages
+ * actually queued are current_load less what the shards hold; a
+ * sender that finds the window exhausted reclaims the shards before
+ * giving up.
+ */
+static void
+neural_add(long *p, long d)
+{
+    long v;
+
+    do
+        v = *p;
+    while (!cmpswap(p, v, v + d));
+}
+
 static int
-parse_children_from_parens(char *parens, char ***children_out)
+neural_shard_take(NCShard *s, long n)
 {
-    if (parens == nil || parens[0] == '\0')
-        return 0;
-    
-    // Skip outer parentheses if present
-    char *p = parens;
-    if (*p == '(')
-        p++;
-    
-    // Count and extract children
-    int child_count = 0;
-    int depth = 0;
-    int child_start = -1;
-    
-    // Allocate space for children (max = length of string)
-    int max_children = strlen(parens) / 2;
-    char **children = malloc(max_children * sizeof(char*));
-    if (children == nil)
-        return 0;
-    
-    for (int i = 0; p[i] != '\0'; i++) {
-        if (p[i] == '(') {
-            if (depth == 0)
-                child_start = i;
-            depth++;
-        } else if (p[i] == ')') {
-            depth--;
-            if (depth == 0 && child_start >= 0) {
-                // Found a complete child
-                int child_len = i - child_start + 1;
-                children[child_count] = malloc(child_len + 1);
-                if (children[child_count] != nil) {
-                    memcpy(children[child_count], p + child_start, child_len);
-                    children[child_count][child_len] = '\0';
-                    child_count++;
-                }
-                child_start = -1;
-            }
-        }
-    }
-    
-    *children_out = children;
-    return child_count;
+    long v;
+
+    do {
+        v = s->credits;
+        if (v < n)
+            return 0;
+    } while (!cmpswap(&s->credits, v, v - n));
+    return 1;
 }
 
-// Compute Matula number from parentheses notation
-// This is the main encoding function
-static uvlong
-parens_to_matula(char *parens)
+// Empty every shard back into the window; the credits recovered
+static long
+neural_reclaim_credits(NeuralChannel *nc)
 {
-    if (parens == nil || parens[0] == '\0')
-        return 1;  // Empty tree = 1
-    
-    // Single node: "()" or "( )"
-    if (strcmp(parens, "()") == 0)
-        return 1;
-    
-    // Parse children
-    char **children = nil;
-    int child_count = parse_children_from_parens(parens, &children);
-    
-    if (child_count == 0) {
-        // No children found, treat as single node
-        return 1;
+    long v, total;
+    int i;
+
+    total = 0;
+    for (i = 0; i < conf.nmach; i++) {
+        do
+            v = nc->shard[i].credits;
+        while (v > 0 && !cmpswap(&nc->shard[i].credits, v, 0));
+        if (v > 0)
+            total += v;
     }
-    
-    // Compute Matula numbers of children recursively
-    uvlong result = 1;
-    for (int i = 0; i < child_count; i++) {
-        uvlong child_matula = parens_to_matula(children[i]);
-        uvlong prime = nth_prime(child_matula);
-        
-        if (prime == 0) {
-            // Overflow or error
-            result = 0;
-            break;
-        }
-        
-        result *= prime;
-        if (result == 0) {
-            // Overflow
+    if (total > 0)
+        neural_add((long*)&nc->current_load, -total);
+    return total;
+}
+
+// Messages queued on nc, summing the shards
+static ulong
+neural_channel_load(NeuralChannel *nc)
+{
+    long load;
+    int i;
+
+    load = nc->current_load;
+    for (i = 0; i < conf.nmach; i++)
+        load -= nc->shard[i].credits;
+    return load > 0 ? load : 0;
+}
+
+// Claim one credit; -1 if the window is exhausted.
+static int
+neural_take_credit(NeuralChannel *nc)
+{
+    NCShard *s;
+    long v, k;
+    int reclaimed;
+
+    s = &nc->shard[m->machno];
+    if (neural_shard_take(s, 1))
+        return 0;
+    for (reclaimed = 0;; reclaimed = 1) {
+        do {
+            v = nc->current_load;
+            k = (long)nc->bandwidth_capacity - v;
+            if (k > NCbatch)
+                k = NCbatch;
+        } while (k > 0 && !cmpswap((long*)&nc->current_load, v, v + k));
+        if (k > 0)
             break;
-        }
+        if (reclaimed || neural_reclaim_credits(nc) == 0)
+            return -1;
     }
-    
-    // Free children
-    for (int i = 0; i < child_count; i++)
-        free(children[i]);
-    free(children);
-    
-    return result;
+    if (k > 1)
+        neural_add(&s->credits, k - 1);
+    return 0;
 }
 
-// Convert Matula number to parentheses notation
-// This is the main decoding function
-static char*
-matula_to_parens(uvlong matula)
+static void
+neural_return_credit(NeuralChannel *nc)
 {
-    if (matula == 1) {
-        // Single node
-        char *result = malloc(3);
-        if (result != nil)
-            strcpy(result, "()");
-        return result;
-    }
-    
-    // Factorize the Matula number
-    int exponents[NPRIMES];
-    factorize(matula, exponents, NPRIMES);
-    
-    // Build parentheses from factors
-    char *result = malloc(4096);  // Should be enough for reasonable trees
-    if (result == nil)
-        return nil;
-    
-    result[0] = '(';
-    int pos = 1;
-    
-    // For each prime factor, add corresponding children
-    for (int i = 0; i < NPRIMES && pos < 4090; i++) {
-        for (int j = 0; j < exponents[i] && pos < 4090; j++) {
-            // Prime primes[i] appears exponents[i] times
-            // This means we have exponents[i] children with Matula number (i+1)
-            char *child = matula_to_parens(i + 1);
-            if (child != nil) {
-                int child_len = strlen(child);
-                if (pos + child_len < 4090) {
-                    strcpy(result + pos, child);
-                    pos += child_len;
-                }
-                free(child);
-            }
-        }
-    }
-    
-    result[pos++] = ')';
-    result[pos] = '\0';
-    
-    return result;
+    NCShard *s;
+
+    s = &nc->shard[m->machno];
+    neural_add(&s->credits, 1);
+    if (s->credits > 2*NCbatch && neural_shard_take(s, NCbatch))
+        neural_add((long*)&nc->current_load, -NCbatch);
 }
 
-// Compute Matula number for a rooted tree structure
+static int
+neural_channel_notfull(void *a)
+{
+    NeuralChannel *nc;
+
+    nc = a;
+    return neural_channel_load(nc) < nc->bandwidth_capacity;
+}
+
+// Wake a blocked sender once the window is half drained, as qio does.
 static void
-compute_matula_number(RootedTree *rt)
+neural_channel_unblock(NeuralChannel *nc)
 {
-    if (rt == nil)
-        return;
-    
-    rt->matula_number = parens_to_matula(rt->parens_notation);
+    if (nc->sender_waiting && neural_channel_load(nc) <= nc->bandwidth_capacity / 2)
+        wakeup(&nc->send_rendez);
 }
 
 /*
- * Rooted Shell Functions
+ * Queue msg if the channel has credit.  Returns -1 without
+ * taking ownership of msg when the window is exhausted.
  */
-
-RootedShell*
-create_rooted_shell(char *domain, RootedTree *tree_structure)
+int
+send_neural_message(NeuralChannel *nc, NeuralMessage *msg)
 {
-    RootedShell *shell;
-    
-    shell = malloc(sizeof(RootedShell));
-    if (shell == nil)
-        return nil;
-    
-    shell->shell_id = smprint("shell-%s-%lud", domain, time(NULL));
-    shell->domain = strdup(domain);
-    shell->tree_structure = tree_structure;
-    
-    // Create namespace representation
-    char *ns_path = tree_to_namespace_path(tree_structure->parens_notation, domain);
-    if (ns_path == nil) {
-        free(shell->shell_id);
-        free(shell->domain);
-        free(shell);
-        return nil;
+    uvlong t0;
+    int r;
+
+    if (nc == nil || msg == nil)
+        return -1;
+        
+    // The window is resized in the background, see cognitive_adaptproc
+    t0 = cogprof_start();
+    if (neural_take_credit(nc) < 0) {
+        nc->refused++;
+        cognitive_event("overflow %s window=%lud", nc->channel_id, nc->bandwidth_capacity);
+        cogprof_end(CPsend, t0);
+        return -1;
     }
     
-    shell->as_namespace = create_cognitive_namespace(shell->shell_id, ns_path);
-    shell->namespace_mount_point = ns_path;
-    
-    // Create file representation
-    shell->file_path = smprint("%s.shell", ns_path);
-    shell->file_channel = nil;  // Created on first access
+    // Set message timestamp
+    msg->timestamp = seconds();
     
-    // Initialize relationships
-    shell->parent_shell = nil;
-    shell->child_shells = nil;
-    shell->child_count = 0;
-    
-    // Initialize addressing
-    shell->address_path = nil;
-    shell->path_depth = 0;
-    
-    shell->creation_time = time(NULL);
-    
-    // Initialize lock
-    lock(&shell->shell_lock);
-    unlock(&shell->shell_lock);
-    
-    // Add to global state
-    lock(&cognitive_state);
-    // Expand shells array if needed
-    RootedShell **new_shells = realloc(cognitive_state.shells, 
-                                       (cognitive_state.shell_count + 1) * sizeof(RootedShell*));
-    if (new_shells == nil) {
-        print("create_rooted_shell: failed to expand shells array\n");
-        unlock(&cognitive_state);
-        // Note: shell is still partially created, caller should handle
-        return shell;
-    }
-    cognitive_state.shells = new_shells;
-    cognitive_state.shells[cognitive_state.shell_count++] = shell;
-    unlock(&cognitive_state);
-    
-    return shell;
+    // Route message through neural transport
+    r = route_neural_message(nc, msg);
+    cogprof_end(CPsend, t0);
+    return r;
 }
 
-RootedShell*
-create_rooted_shell_from_parens(char *domain, char *parens_notation)
+/*
+ * Like send_neural_message, but waits for credit.  ms < 0 waits
+ * indefinitely; otherwise gives up after ms milliseconds.
+ * Channels marked noblock never wait.  Raises an error if
+ * interrupted.
+ */
+int
+send_neural_message_wait(NeuralChannel *nc, NeuralMessage *msg, long ms)
 {
-    // Count nodes from parentheses
-    int node_count = 0;
-    for (int i = 0; parens_notation[i] != '\0'; i++) {
-        if (parens_notation[i] == '(')
-            node_count++;
+    int r;
+
+    if (nc == nil || msg == nil)
+        return -1;
+    if (send_neural_message(nc, msg) == 0)
+        return 0;
+    if (nc->noblock || ms == 0)
+        return -1;
+
+    qlock(&nc->send_lock);
+    if (waserror()) {
+        nc->sender_waiting = 0;
+        qunlock(&nc->send_lock);
+        nexterror();
     }
-    
-    // Create tree structure
-    RootedTree *tree = create_rooted_tree(0, node_count);  // Binary rep can be calculated
-    tree->parens_notation = strdup(parens_notation);
-    
-    return create_rooted_shell(domain, tree);
+    for (;;) {
+        nc->sender_waiting = 1;
+        coherence();
+        if ((r = send_neural_message(nc, msg)) == 0)
+            break;
+        if (ms < 0)
+            sleep(&nc->send_rendez, neural_channel_notfull, nc);
+        else {
+            tsleep(&nc->send_rendez, neural_channel_notfull, nc, ms);
+            r = send_neural_message(nc, msg);
+            break;
+        }
+    }
+    nc->sender_waiting = 0;
+    poperror();
+    qunlock(&nc->send_lock);
+
+    return r;
+}
+
+void
+set_neural_channel_noblock(NeuralChannel *nc, int noblock)
+{
+    nc->noblock = noblock;
+    qnoblock(nc->q, noblock);
+    if (noblock && nc->sender_waiting)
+        wakeup(&nc->send_rendez);
+}
+
+/*
+ * Real-time consumers.  The proc that writes "edf T D C" to a
+ * channel's ctl is admitted, as through its proc ctl file, as a
+ * sporadic edf task whose jobs are the channel's messages.  Woken
+ * from a receive, edfready releases it at once if a period has
+ * passed since its last release; one that yields when done is
+ * released by the next arrival (edfarrive) instead of sleeping out
+ * its period.  Either way a message waits at most T+D, and at most
+ * D if messages come no faster than one a period.  Times are in µs;
+ * T of 0 drops the reservation.
+ */
+void
+set_neural_channel_edf(NeuralChannel *nc, long T, long D, long C)
+{
+    Proc *p;
+    char *e;
+
+    p = nc->edfproc;
+    if (p != nil && p->pid == nc->edfpid && p != up)
+        error("channel has an edf consumer");
+    nc->edfproc = nil;
+    if (up->edf != nil)
+        edfstop(up);
+    if (T == 0)
+        return;
+    if (up->edf == nil)
+        edfinit(up);
+    up->edf->T = T;
+    up->edf->D = D;
+    up->edf->C = C;
+    up->edf->flags |= Sporadic;
+    if ((e = edfadmit(up)) != nil)
+        error(e);
+    nc->edfpid = up->pid;
+    coherence();
+    nc->edfproc = up;
+}
+
+// A message has arrived: release a yielded edf consumer.
+static void
+neural_channel_arrive(NeuralChannel *nc)
+{
+    Proc *p;
+
+    p = nc->edfproc;
+    if (p != nil && p->pid == nc->edfpid && edfarrive(p))
+        nc->edfreleases++;
+}
+
+static Block*
+neural_block_header(Block *b, int type, ulong priority, ulong tag)
+{
+    uchar *p;
+    uvlong now;
+
+    if (b->next != nil)
+        b = concatblock(b);
+    b = padblock(b, NBhdrlen);
+    p = b->rp;
+    p[0] = NBmagic;
+    p[1] = type;
+    p[2] = priority > 255 ? 255 : priority;
+    p[3] = 0;
+    PBIT32(p + 4, tag);
+    now = fastticks(nil);
+    PBIT64(p + 8, now);
+    return b;
 }
 
+/*
+ * Queue a Block payload on the channel's Block transport without
+ * copying it.  Like qpass, never blocks: if the Queue is over its
+ * limit the Block is freed and -1 returned.
+ */
 int
-enumerate_rooted_shells(char *domain, int max_size, RootedShell ***shells_out)
+neural_pass_block(NeuralChannel *nc, Block *b, int type, ulong priority, ulong tag)
 {
-    // Initialize tree generation if needed
-    if (rooted_trees.list == nil)
-        init_rooted_trees();
-    
-    // Generate all trees up to max_size
-    if (max_size > MAXN)
-        max_size = MAXN;
-    generate_trees(max_size);
-    
-    // Count total trees
-    int total_count = rooted_trees.offset[max_size + 1] - rooted_trees.offset[1];
-    
-    // Allocate shell array
-    RootedShell **shells = malloc(total_count * sizeof(RootedShell*));
-    int shell_idx = 0;
-    
-    // Create shells for each tree size
-    for (int n = 1; n <= max_size; n++) {
-        ulong start = rooted_trees.offset[n];
-        ulong end = rooted_trees.offset[n + 1];
-        
-        for (ulong i = start; i < end; i++) {
-            RootedTree *tree = create_rooted_tree(rooted_trees.list[i], n);
-            shells[shell_idx++] = create_rooted_shell(domain, tree);
-        }
+    if (nc == nil || b == nil)
+        return -1;
+    b = neural_block_header(b, type, priority, tag);
+    if (qpass(nc->q, b) < 0) {
+        nc->refused++;
+        return -1;
     }
-    
-    *shells_out = shells;
-    return total_count;
+    neural_channel_arrive(nc);
+    return 0;
 }
 
-char*
-get_shell_info(RootedShell *shell)
+// As neural_pass_block, but waits for room like qbwrite.
+long
+neural_write_block(NeuralChannel *nc, Block *b, int type, ulong priority, ulong tag)
 {
-    char *info = malloc(2048);
-    
-    snprint(info, 2048,
-            "Shell ID: %s\n"
-            "Domain: %s\n"
-            "Tree Structure: %s\n"
-            "Matula Number: %llud\n"
-            "Node Count: %d\n"
-            "Namespace: %s\n"
-            "File Path: %s\n"
-            "Creation: %lud\n",
-            shell->shell_id,
-            shell->domain,
-            shell->tree_structure->parens_notation,
-            shell->tree_structure->matula_number,
-            shell->tree_structure->node_count,
-            shell->namespace_mount_point,
-            shell->file_path,
-            shell->creation_time);
-    
-    return info;
+    long n;
+
+    b = neural_block_header(b, type, priority, tag);
+    n = qbwrite(nc->q, b) - NBhdrlen;
+    neural_channel_arrive(nc);
+    return n;
 }
 
-void
-print_rooted_tree_stats(void)
+/*
+ * Next Block from the channel's Block transport, header intact.
+ * Blocks until one arrives unless the Queue is noblock.
+ */
+Block*
+neural_read_block(NeuralChannel *nc)
 {
-    print("Rooted Tree Statistics:\n");
-    print("  Max tree size generated: %d\n", rooted_trees.max_n);
-    print("  Total trees stored: %d\n", rooted_trees.list_size);
-    
-    for (int n = 1; n <= rooted_trees.max_n && n <= MAXN; n++) {
-        int count = rooted_trees.offset[n + 1] - rooted_trees.offset[n];
-        print("  %d-trees: %d\n", n, count);
+    Block *b;
+
+    neural_channel_steer(nc);
+    b = qbread(nc->q, NBmaxmsg + NBhdrlen);
+    if (b != nil && (BLEN(b) < NBhdrlen || b->rp[0] != NBmagic)) {
+        freeb(b);
+        error("bad neural block");
     }
-    
-    print("  Active shells: %d\n", cognitive_state.shell_count);
+    return b;
 }
 
 /*
- * List trees with their Matula numbers
- * Returns a formatted string showing tree structures and encodings
+ * Convert a Block from neural_read_block into a message whose payload
+ * still lives in the Block.
  */
-char*
-list_trees_with_matula(int max_size)
+NeuralMessage*
+neural_message_from_block(NeuralChannel *nc, Block *b)
 {
-    if (rooted_trees.list == nil)
-        init_rooted_trees();
-    
-    if (max_size > MAXN)
-        max_size = MAXN;
-    
-    generate_trees(max_size);
-    
-    // Allocate buffer for output
-    char *output = malloc(8192);
-    if (output == nil)
+    NeuralMessage *msg;
+    uchar *p;
+
+    p = b->rp;
+    b->rp += NBhdrlen;
+    msg = neural_message_alloc_block(nc->source_domain, nc->target_domain, b);
+    if (msg == nil)
         return nil;
-    
-    int pos = 0;
-    pos += snprint(output + pos, 8192 - pos, 
-                   "Rooted Trees with Matula Numbers\n");
-    pos += snprint(output + pos, 8192 - pos, 
-                   "================================\n\n");
-    pos += snprint(output + pos, 8192 - pos,
-                   "Size  Tree              Matula  Factorization\n");
-    pos += snprint(output + pos, 8192 - pos,
-                   "----  ---------------   ------  -------------\n");
-    
-    for (int n = 1; n <= max_size && n <= MAXN; n++) {
-        ulong start = rooted_trees.offset[n];
-        ulong end = rooted_trees.offset[n + 1];
-        
-        for (ulong i = start; i < end && pos < 8000; i++) {
-            RootedTree *tree = create_rooted_tree(rooted_trees.list[i], n);
-            if (tree != nil) {
-                pos += snprint(output + pos, 8192 - pos,
-                              " %2d   %-15s  %6llud\n",
-                              n, tree->parens_notation, tree->matula_number);
-                free(tree->parens_notation);
-                free(tree);
-            }
-        }
-    }
-    
-    return output;
+    msg->type = p[1];
+    msg->cognitive_priority = p[2];
+    msg->tag = GBIT32(p + 4);
+    msg->enqueued = GBIT64(p + 8);
+    msg->created = msg->enqueued;
+    msg->timestamp = seconds();
+    return msg;
 }
 
+// Oldest message at a level, or nil; caller holds recv_lock.
 /*
- * Demo Function - Traffic-Energy Coordination Example
+ * The channel's data file.  Writes carry a bare payload and take
+ * their header fields from the channel's data settings; reads
+ * return one message's payload, discarding whatever does not fit
+ * like a message-mode Queue.
  */
+long
+neural_channel_bwrite(NeuralChannel *nc, Block *b)
+{
+    return neural_write_block(nc, b, nc->data_type, nc->data_prio, nc->data_tag++);
+}
+
+// The data file is as ready as the Block transport.
+int
+neural_channel_poll(NeuralChannel *nc, Pollw *w)
+{
+    int r;
+
+    r = 0;
+    if (w->mask & Pollin)
+        r |= qpoll(nc->q, w, Pollin);
+    if (w->mask & Pollout)
+        r |= qpoll(nc->q, w, Pollout);
+    return r;
+}
+
+Block*
+neural_channel_bread(NeuralChannel *nc, long n)
+{
+    Block *b;
+
+    b = neural_read_block(nc);
+    if (b == nil)
+        return nil;
+    b->rp += NBhdrlen;
+    if (BLEN(b) > n)
+        b->wp = b->rp + n;
+    return b;
+}
 
 void
-demo_traffic_energy_coordination(void)
+set_neural_channel_data(NeuralChannel *nc, int type, ulong priority)
 {
-    CognitiveNamespace *transportation, *energy;
-    NeuralChannel *coord_channel;
-    NeuralMessage *traffic_msg, *energy_msg;
-    char *domains[2] = {"transportation", "energy"};
-    EmergentPattern *sync_pattern;
-    
-    print("Demonstrating traffic-energy coordination...\n");
-    
-    // Get namespaces (in real implementation, would lookup from global state)
-    transportation = create_cognitive_namespace("transportation", 
-                                               "/cognitive-cities/domains/transportation");
-    energy = create_cognitive_namespace("energy", 
-                                       "/cognitive-cities/domains/energy");
-    
-    // Create coordination channel
-    coord_channel = create_neural_channel("transportation", "energy", 1000);
-    
-    // Simulate traffic optimization request
-    traffic_msg = malloc(sizeof(NeuralMessage));
-    traffic_msg->type = Tneural;
-    traffic_msg->source_domain = "transportation";
-    traffic_msg->target_domain = "energy";
-    traffic_msg->cognitive_priority = 80; // High priority
-    traffic_msg->confidence_level = 0.9;
-    traffic_msg->payload_size = 256;
-    traffic_msg->cognitive_payload = "OPTIMIZE_TRAFFIC_FOR_ENERGY_EFFICIENCY";
-    
-    // Send message
-    send_neural_message(coord_channel, traffic_msg);
-    
-    // Simulate energy response
-    energy_msg = receive_neural_message(coord_channel);
-    if (energy_msg != nil) {
-        print("Energy domain received traffic optimization request\n");
-        print("Coordinating energy grid with traffic patterns...\n");
-        
-        // Detect emergent coordination pattern
-        sync_pattern = detect_emergent_pattern("traffic-energy-synchronization", 
-                                              domains, 2);
-        
-        print("Emergent pattern detected: %s\n", sync_pattern->pattern_name);
-        print("Significance score: %.2f\n", sync_pattern->significance_score);
-    }
-    
-    print("Traffic-energy coordination demo completed\n");
+    nc->data_type = type;
+    nc->data_prio = priority;
 }
 
 /*
- * ═══════════════════════════════════════════════════════════════════════
- * ECHO STATE NETWORK (ESN) IMPLEMENTATION
- * ═══════════════════════════════════════════════════════════════════════
- * 
- * An Echo State Network (ESN) is the bridge structure that unifies all
- * parallel cognitive frameworks in this system:
- * 
- * 1. Dyck/Parentheses Grammar   - ESN as continuously rewritten expressions
- * 2. Rooted Trees                - ESN as dynamic forest with grafting
- * 3. Matula Numbers              - ESN state as evolving integer factorization
- * 4. Membrane Systems            - ESN as echo-multiset network with decay
- * 5. Hypergraphs                 - ESN as weighted hypergraph automaton
- * 6. Multiplicative RNN          - ESN as prime-exponent flow field
- * 7. Statistical Physics         - ESN as deterministic microstate ensemble
- * 8. Quantum-like Dynamics       - ESN as mixed prime-mode superposition
- * 
- * The ESN provides a fixed reservoir with rich recurrent dynamics where:
- * - State evolves as: x(t+1) = f(W·x(t) + W_in·u(t))
- * - W = sparse, random, stable reservoir matrix (spectral radius < 1)
- * - Reservoir echoes input history through decaying activations
- * - Only readout layer is trained; reservoir structure is fixed
+ * Set the credit window and its bound.  The window may be raised
+ * later by adaptation up to max.
  */
+int
+set_neural_channel_capacity(NeuralChannel *nc, ulong window, ulong max)
+{
+    if (window < NCminwindow)
+        window = NCminwindow;
+    if (max < window)
+        max = window;
+    nc->max_capacity = max;
+    nc->bandwidth_capacity = window;
+    qsetlimit(nc->q, window * NBavgmsg);
+    if (nc->sender_waiting)
+        wakeup(&nc->send_rendez);
+    return 0;
+}
 
-/*
- * ESN Data Structures
- */
+static NeuralMessage*
+neural_level_peek(NeuralLevel *l)
+{
+    NeuralMessage *msg;
 
-typedef struct EchoStateNetwork EchoStateNetwork;
-typedef struct ReservoirNode ReservoirNode;
-typedef struct ReservoirConnection ReservoirConnection;
-typedef struct ESNState ESNState;
+    msg = neural_ring_peek(l->ring);
+    if (msg == nil && l->overflow_count != 0) {
+        lock(&l->queue_lock);
+        msg = l->overflow_head;
+        unlock(&l->queue_lock);
+    }
+    return msg;
+}
 
-// A single neuron/node in the reservoir
-struct ReservoirNode {
-    int node_id;                      // Unique node identifier
-    float activation;                 // Current activation value
-    float bias;                       // Node bias
-    
-    // Matula representation: node as prime
-    uvlong prime_index;               // This node's prime index
-    
-    // Rooted tree representation: node as tree
-    RootedTree *tree_structure;       // Node's structural identity
-    
-    // Membrane representation: node as membrane region
-    char *membrane_id;                // Membrane identifier
-    int object_count;                 // Multiset object count
-    float decay_rate;                 // Echo decay rate (spectral radius)
-    
-    ReservoirConnection **incoming;   // Incoming connections
-    int incoming_count;
-    ReservoirConnection **outgoing;   // Outgoing connections  
-    int outgoing_count;
-};
+static NeuralMessage*
+neural_level_get(NeuralLevel *l)
+{
+    NeuralMessage *msg;
 
-// Connection between reservoir nodes (hyperedge)
-struct ReservoirConnection {
-    int connection_id;
-    ReservoirNode *source;
-    ReservoirNode *target;
-    float weight;                     // Connection weight
-    
-    // Hypergraph representation
-    int hyperedge_id;                 // Part of which hyperedge
-    ReservoirNode **hyperedge_nodes;  // All nodes in this hyperedge
-    int hyperedge_size;
-};
+    // Ring entries are always older than anything on the spill list
+    msg = neural_ring_get(l->ring);
+    if (msg == nil && l->overflow_count != 0) {
+        lock(&l->queue_lock);
+        msg = l->overflow_head;
+        if (msg != nil) {
+            l->overflow_head = msg->next;
+            if (l->overflow_head == nil)
+                l->overflow_tail = nil;
+            l->overflow_count--;
+        }
+        unlock(&l->queue_lock);
+    }
+    return msg;
+}
 
-// Complete ESN state at time t
-struct ESNState {
-    uvlong matula_encoding;           // State as single Matula number
-    float *activations;               // State as activation vector
-    int reservoir_size;
-    
-    // Dyck grammar representation: stack profile
-    char *dyck_expression;            // Current parentheses configuration
-    int stack_depth;                  // Current nesting depth
-    
-    // Rooted tree representation: forest configuration
-    RootedTree **forest;              // Dynamic forest of trees
-    int forest_size;
+static void
+neural_latency_record(ulong *hist, uvlong us)
+{
+    int b;
+
+    for (b = 0; us > 1 && b < Nlathist - 1; b++)
+        us >>= 1;
+    hist[b]++;
+}
+
+// Exponentially weighted moving average giving a sample weight 1/8.
+static ulong
+cognitive_ewma(ulong avg, uvlong sample)
+{
+    return ((uvlong)avg * 7 + sample) / 8;
+}
+
+// Upper bound in µs of the bucket holding the given permille.
+ulong
+neural_latency_percentile(ulong *hist, int nhist, int permille)
+{
+    ulong total, sum;
+    int b;
+
+    total = 0;
+    for (b = 0; b < nhist; b++)
+        total += hist[b];
+    if (total == 0)
+        return 0;
+    sum = 0;
+    for (b = 0; b < nhist; b++) {
+        sum += hist[b];
+        if (sum * 1000 >= total * permille)
+            break;
+    }
+    return 1UL << (b < nhist ? b : nhist - 1);
+}
+
+// Take the next message by priority and age; caller holds recv_lock.
+static NeuralMessage*
+neural_dequeue(NeuralChannel *nc)
+{
+    NeuralLevel *l;
+    NeuralMessage *msg;
+    uvlong now, limit, us, t0;
+    int i, aged;
+
+    t0 = cogprof_start();
+    msg = nil;
+    l = nil;
+    aged = 0;
+
+    // An overdue lower level is served first
+    now = fastticks(nil);
+    for (i = Nprio - 1; i > 0; i--) {
+        l = &nc->level[i];
+        if ((nc->active & (1 << i)) == 0 || l->age_limit == 0)
+            continue;
+        msg = neural_level_peek(l);
+        if (msg == nil)
+            continue;
+        limit = ms2fastticks(l->age_limit);
+        if (now - msg->enqueued > limit) {
+            msg = neural_level_get(l);
+            aged = 1;
+            break;
+        }
+        msg = nil;
+    }
+
+    for (i = 0; msg == nil && i < Nprio; i++) {
+        if ((nc->active & (1 << i)) == 0)
+            continue;
+        l = &nc->level[i];
+        msg = neural_level_get(l);
+        if (msg == nil) {
+            // Level drained; clear its bit, then recheck for a racing producer
+            atomic_clearbits(&nc->active, 1 << i);
+            coherence();
+            msg = neural_level_get(l);
+            if (msg != nil)
+                atomic_setbits(&nc->active, 1 << i);
+        }
+    }
+
+    if (msg != nil) {
+        msg->next = nil;
+        neural_return_credit(nc);
+        nc->drained++;
+        l->dequeued++;
+        if (aged)
+            l->aged++;
+        now = fastticks(nil);
+        us = fastticks2us(now - msg->enqueued);
+        neural_latency_record(l->lathist, us);
+        nc->res_avg = cognitive_ewma(nc->res_avg, us);
+        neural_latency_record(nc->e2ehist, fastticks2us(now - msg->created));
+    }
+    cogprof_end(CPrecv, t0);
+    return msg;
+}
+
+NeuralMessage*
+receive_neural_message(NeuralChannel *nc)
+{
+    NeuralMessage *msg;
     
-    // Membrane representation: multiset configuration
-    int *multisets;                   // Object counts per membrane
-    int membrane_count;
+    if (nc == nil)
+        return nil;
+        
+    neural_channel_steer(nc);
+    lock(&nc->recv_lock);
+    msg = neural_dequeue(nc);
+    unlock(&nc->recv_lock);
+    neural_channel_unblock(nc);
     
-    time_t timestamp;                 // When this state occurred
-    ESNState *previous;               // Previous state for history
+    return msg;
+}
+
+/*
+ * Dequeue up to max messages under a single acquisition
+ * of the consumer lock; returns the number taken.
+ */
+int
+receive_neural_batch(NeuralChannel *nc, NeuralMessage **msgs, int max)
+{
+    int n;
+
+    if (nc == nil || msgs == nil)
+        return -1;
+
+    neural_channel_steer(nc);
+    lock(&nc->recv_lock);
+    for (n = 0; n < max; n++) {
+        msgs[n] = neural_dequeue(nc);
+        if (msgs[n] == nil)
+            break;
+    }
+    unlock(&nc->recv_lock);
+    neural_channel_unblock(nc);
+
+    return n;
+}
+
+static int
+neural_channel_ready(void *a)
+{
+    NeuralChannel *nc;
+
+    nc = a;
+    return nc->active != 0;
+}
+
+// Called by producers after publishing a message.
+static void
+neural_channel_notify(NeuralChannel *nc)
+{
+    coherence();
+    if (nc->receiver_waiting)
+        wakeup(&nc->recv_rendez);
+    neural_channel_arrive(nc);
+}
+
+/*
+ * Blocking receive of up to max messages.  ms < 0 waits
+ * indefinitely, ms == 0 does not wait, and ms > 0 waits at
+ * most that many milliseconds for the first message.
+ * Returns the number of messages taken, 0 on timeout.
+ * Like qread, only one receiver sleeps at a time; others
+ * queue behind wait_lock.  Raises an error if interrupted.
+ */
+int
+receive_neural_batch_wait(NeuralChannel *nc, NeuralMessage **msgs, int max, long ms)
+{
+    int n;
+
+    if (nc == nil || msgs == nil || max <= 0)
+        return -1;
+
+    n = receive_neural_batch(nc, msgs, max);
+    if (n > 0 || ms == 0)
+        return n;
+
+    qlock(&nc->wait_lock);
+    if (waserror()) {
+        nc->receiver_waiting = 0;
+        qunlock(&nc->wait_lock);
+        nexterror();
+    }
+    for (;;) {
+        nc->receiver_waiting = 1;
+        coherence();
+        n = receive_neural_batch(nc, msgs, max);
+        if (n > 0)
+            break;
+        if (ms < 0)
+            sleep(&nc->recv_rendez, neural_channel_ready, nc);
+        else {
+            tsleep(&nc->recv_rendez, neural_channel_ready, nc, ms);
+            n = receive_neural_batch(nc, msgs, max);
+            break;
+        }
+    }
+    nc->receiver_waiting = 0;
+    poperror();
+    qunlock(&nc->wait_lock);
+
+    return n;
+}
+
+NeuralMessage*
+receive_neural_message_wait(NeuralChannel *nc, long ms)
+{
+    NeuralMessage *msg;
+
+    if (receive_neural_batch_wait(nc, &msg, 1, ms) <= 0)
+        return nil;
+    return msg;
+}
+
+/*
+ * Traffic sketches.  Keys hash multiplicatively with a different
+ * odd constant per row; the top bits give the column.
+ */
+static u32int sketchmul[NCcmrows] = {
+    0x9E3779B1, 0x85EBCA77, 0xC2B2AE3D, 0x27D4EB2F,
 };
 
-// Complete Echo State Network
-struct EchoStateNetwork {
-    char *esn_id;                     // Network identifier
-    int reservoir_size;               // Number of reservoir nodes
-    float spectral_radius;            // Max eigenvalue (controls echo)
-    float input_scaling;              // Input weight scaling
-    float leak_rate;                  // Leak rate (1.0 = no leak)
-    
-    ReservoirNode **nodes;            // All reservoir nodes
-    ReservoirConnection **connections; // All connections
-    int connection_count;
-    
-    // Weight matrices
-    float **W_reservoir;              // Reservoir recurrent weights
-    float **W_input;                  // Input weights
-    float **W_output;                 // Output/readout weights (trained)
-    
-    int input_dim;                    // Input dimensionality
-    int output_dim;                   // Output dimensionality
-    
-    // Current state
-    ESNState *current_state;
-    
-    // Matula evolution history
-    uvlong *matula_history;           // History of state as integers
-    int history_size;
-    int history_capacity;
-    
-    // Framework-specific representations
-    char *dyck_grammar;               // Rewriting rules for parentheses
-    void *hypergraph;                 // Hypergraph structure
-    void *membrane_system;            // P-System configuration
-    
-    Lock esn_lock;                    // ESN synchronization
-    time_t creation_time;
+static void
+neural_sketch_add(NCSketch *sk, NeuralMessage *msg)
+{
+    u32int key, h;
+    ulong c, min;
+    int i, rank;
+
+    key = msg->tag ^ (u32int)msg->type << 24;
+    min = ~0UL;
+    for (i = 0; i < NCcmrows; i++) {
+        c = ++sk->cm[i][(key * sketchmul[i]) >> (32 - NCcmbits)];
+        if (c < min)
+            min = c;
+    }
+    if (min > sk->topcount) {
+        sk->topkey = key;
+        sk->topcount = min;
+    }
+
+    // Source domains are atoms, so the pointer names the domain
+    h = (u32int)(uintptr)msg->source_domain * sketchmul[0];
+    i = h >> (32 - NChllbits);
+    h <<= NChllbits;
+    for (rank = 1; rank <= 32 - NChllbits && (h & 0x80000000) == 0; rank++)
+        h <<= 1;
+    if (rank > sk->hll[i])
+        sk->hll[i] = rank;
+}
+
+// 64 ln(64/v) for v empty registers, HyperLogLog's small-range estimate
+static ushort hlllinear[NChllregs + 1] = {
+    0, 266, 222, 196, 177, 163, 151, 142, 133, 126, 119, 113, 107, 102, 97, 93,
+    89, 85, 81, 78, 74, 71, 68, 65, 63, 60, 58, 55, 53, 51, 48, 46,
+    44, 42, 40, 39, 37, 35, 33, 32, 30, 28, 27, 25, 24, 23, 21, 20,
+    18, 17, 16, 15, 13, 12, 11, 10, 9, 7, 6, 5, 4, 3, 2, 1, 0,
 };
 
+static ulong
+neural_sketch_distinct(NCSketch *sk)
+{
+    uvlong sum, est;
+    int i, empty;
+
+    sum = 0;
+    empty = 0;
+    for (i = 0; i < NChllregs; i++) {
+        sum += (1ULL << 32) >> sk->hll[i];
+        if (sk->hll[i] == 0)
+            empty++;
+    }
+    // alpha(64) * 64 * 64 = 2904, in units of 2^-32
+    est = (2904ULL << 32) / sum;
+    if (est <= 5 * NChllregs / 2 && empty > 0)
+        est = hlllinear[empty];
+    return est;
+}
+
 /*
- * ESN Initialization
+ * Close a sketch epoch: note the distinct sources and message
+ * rate, decide whether the rate spiked against the average of
+ * earlier epochs, then halve the key counts and clear the
+ * registers for the next epoch.  Called by the adaptation kproc.
  */
-
-EchoStateNetwork*
-create_esn(int reservoir_size, int input_dim, int output_dim, float spectral_radius)
+static void
+neural_sketch_epoch(NeuralChannel *nc)
 {
-    EchoStateNetwork *esn;
+    NCSketch *sk;
+    ulong enq;
     int i, j;
-    
-    esn = malloc(sizeof(EchoStateNetwork));
-    if (esn == nil)
-        return nil;
+
+    sk = &nc->sketch;
+    enq = nc->enqueued;
+    sk->rate = enq - sk->rate_mark;
+    sk->rate_mark = enq;
+    sk->sources = neural_sketch_distinct(sk);
+    sk->spiking = sk->rate >= NCspikemin && sk->rate > 2 * sk->rate_avg;
+    sk->rate_avg = cognitive_ewma(sk->rate_avg, sk->rate);
+
+    for (i = 0; i < NCcmrows; i++)
+        for (j = 0; j < NCcmwidth; j++)
+            sk->cm[i][j] >>= 1;
+    sk->topcount >>= 1;
+    memset(sk->hll, 0, sizeof sk->hll);
+}
+
+// Estimated count of key in nc's recent traffic, decaying by half each epoch
+ulong
+neural_sketch_count(NeuralChannel *nc, ulong key)
+{
+    ulong c, min;
+    int i;
+
+    min = ~0UL;
+    for (i = 0; i < NCcmrows; i++) {
+        c = nc->sketch.cm[i][((u32int)key * sketchmul[i]) >> (32 - NCcmbits)];
+        if (c < min)
+            min = c;
+    }
+    return min;
+}
+
+int
+queue_neural_message(NeuralChannel *nc, NeuralMessage *msg)
+{
+    NeuralLevel *l;
+    int lvl;
+
+    if (nc == nil || msg == nil)
+        return -1;
+
+    msg->next = nil;
+    msg->enqueued = fastticks(nil);
+    _xinc((long*)&nc->enqueued);
+    neural_sketch_add(&nc->sketch, msg);
+    lvl = neural_prio_level(msg->cognitive_priority);
+    l = &nc->level[lvl];
+
+    // Fast path: lock-free ring, unless older messages have spilled
+    if (l->overflow_count != 0 || neural_ring_put(l->ring, msg) < 0) {
+        lock(&l->queue_lock);
         
-    esn->esn_id = smprint("esn-%lud", time(NULL));
-    esn->reservoir_size = reservoir_size;
-    esn->spectral_radius = spectral_radius;
-    esn->input_scaling = 1.0;
-    esn->leak_rate = 1.0;
-    esn->input_dim = input_dim;
-    esn->output_dim = output_dim;
-    
-    // Allocate reservoir nodes
-    esn->nodes = malloc(reservoir_size * sizeof(ReservoirNode*));
-    for (i = 0; i < reservoir_size; i++) {
-        esn->nodes[i] = malloc(sizeof(ReservoirNode));
-        esn->nodes[i]->node_id = i;
-        esn->nodes[i]->activation = 0.0;
-        esn->nodes[i]->bias = (frand() - 0.5) * 0.1;
-        esn->nodes[i]->prime_index = nth_prime(i + 1);
-        esn->nodes[i]->decay_rate = spectral_radius;
-        esn->nodes[i]->membrane_id = smprint("m%d", i);
-        esn->nodes[i]->object_count = 0;
-        esn->nodes[i]->incoming_count = 0;
-        esn->nodes[i]->outgoing_count = 0;
+        // Append to the spill list in O(1) via the tail pointer
+        if (l->overflow_tail == nil)
+            l->overflow_head = msg;
+        else
+            l->overflow_tail->next = msg;
+        l->overflow_tail = msg;
+        l->overflow_count++;
+        
+        unlock(&l->queue_lock);
     }
+
+    atomic_setbits(&nc->active, 1 << lvl);
+    neural_channel_notify(nc);
     
-    // Allocate weight matrices
-    esn->W_reservoir = malloc(reservoir_size * sizeof(float*));
-    esn->W_input = malloc(reservoir_size * sizeof(float*));
-    esn->W_output = malloc(output_dim * sizeof(float*));
+    return 0;
+}
+
+/*
+ * Set how long messages at a level may wait before being
+ * served ahead of more urgent levels; 0 disables aging.
+ */
+int
+set_neural_level_aging(NeuralChannel *nc, int lvl, ulong ms)
+{
+    if (nc == nil || lvl < 0 || lvl >= Nprio)
+        return -1;
+    nc->level[lvl].age_limit = ms;
+    return 0;
+}
+
+int
+neural_channel_prio_stats(NeuralChannel *nc, char *buf, int len)
+{
+    NeuralLevel *l;
+    int i, n;
+
+    n = 0;
+    for (i = 0; i < Nprio; i++) {
+        l = &nc->level[i];
+        n += snprint(buf + n, len - n,
+                     "prio%d depth=%lud dequeued=%lud aged=%lud agelimit=%lud "
+                     "p50=%lud p99=%lud p999=%lud\n",
+                     i, (ulong)(l->ring->head - l->ring->tail) + l->overflow_count,
+                     l->dequeued, l->aged, l->age_limit,
+                     neural_latency_percentile(l->lathist, Nlathist, 500),
+                     neural_latency_percentile(l->lathist, Nlathist, 990),
+                     neural_latency_percentile(l->lathist, Nlathist, 999));
+    }
+    return n;
+}
+
+/*
+ * One line of counters and latency percentiles (µs) for nc.
+ * Residency is the time spent queued; e2e runs from allocation
+ * of the message to its dequeue.
+ */
+int
+neural_channel_stats(NeuralChannel *nc, char *buf, int len)
+{
+    ulong reshist[Nlathist];
+    int i, b;
+
+    memset(reshist, 0, sizeof reshist);
+    for (i = 0; i < Nprio; i++)
+        for (b = 0; b < Nlathist; b++)
+            reshist[b] += nc->level[i].lathist[b];
+    return snprint(buf, len,
+                   "%s %s %s window=%lud load=%lud enqueued=%lud dequeued=%lud "
+                   "dropped=%lud adapted=%lud res50=%lud res99=%lud "
+                   "e2e50=%lud e2e99=%lud rate=%lud sources=%lud topkey=%#lux "
+                   "edfpid=%lud edfreleases=%lud\n",
+                   nc->channel_id, nc->source_domain, nc->target_domain,
+                   nc->bandwidth_capacity, neural_channel_load(nc),
+                   nc->enqueued, nc->drained, nc->refused, nc->adapted,
+                   neural_latency_percentile(reshist, Nlathist, 500),
+                   neural_latency_percentile(reshist, Nlathist, 990),
+                   neural_latency_percentile(nc->e2ehist, Nlathist, 500),
+                   neural_latency_percentile(nc->e2ehist, Nlathist, 990),
+                   nc->sketch.rate, nc->sketch.sources, nc->sketch.topkey,
+                   nc->edfproc != nil ? nc->edfpid : 0, nc->edfreleases);
+}
+
+// One neural_channel_stats line per registered channel.
+int
+cognitive_channels_stats(char *buf, int len)
+{
+    NeuralChannel *nc;
+    int i, n;
+
+    n = 0;
+    rlock(&cognitive_state.reglock);
+    for (i = 0; i < Nchhash && n < len - 1; i++)
+        for (nc = cognitive_state.chhash[i]; nc != nil; nc = nc->hash_next)
+            n += neural_channel_stats(nc, buf + n, len - n);
+    runlock(&cognitive_state.reglock);
+    return n;
+}
+
+static int cognitive_checkpoint_stats(char*, int);
+
+/*
+ * Totals over all channels.  The residency and e2e lines list the
+ * log2(µs) histogram buckets, bucket i counting latencies below 2^i µs.
+ */
+int
+cognitive_stats(char *buf, int len)
+{
+    NeuralChannel *nc;
+    ulong enq, deq, drop, adapt;
+    ulong reshist[Nlathist], e2ehist[Nlathist];
+    int i, j, b, n;
+
+    enq = deq = drop = adapt = 0;
+    memset(reshist, 0, sizeof reshist);
+    memset(e2ehist, 0, sizeof e2ehist);
+    rlock(&cognitive_state.reglock);
+    for (i = 0; i < Nchhash; i++)
+        for (nc = cognitive_state.chhash[i]; nc != nil; nc = nc->hash_next) {
+            enq += nc->enqueued;
+            deq += nc->drained;
+            drop += nc->refused;
+            adapt += nc->adapted;
+            for (b = 0; b < Nlathist; b++) {
+                for (j = 0; j < Nprio; j++)
+                    reshist[b] += nc->level[j].lathist[b];
+                e2ehist[b] += nc->e2ehist[b];
+            }
+        }
+    n = snprint(buf, len,
+                "uptime %lud\nchannels %d\nenqueued %lud\ndequeued %lud\n"
+                "dropped %lud\nadapted %lud\npatterns %d\n",
+                TK2SEC(MACHP(0)->ticks), cognitive_state.channel_count,
+                enq, deq, drop, adapt, cognitive_state.pattern_count);
+    runlock(&cognitive_state.reglock);
+
+    n += snprint(buf + n, len - n, "residency");
+    for (b = 0; b < Nlathist; b++)
+        n += snprint(buf + n, len - n, " %lud", reshist[b]);
+    n += snprint(buf + n, len - n, "\ne2e");
+    for (b = 0; b < Nlathist; b++)
+        n += snprint(buf + n, len - n, " %lud", e2ehist[b]);
+    n += snprint(buf + n, len - n, "\n");
+    n += cognitive_checkpoint_stats(buf + n, len - n);
+    return n;
+}
+
+/*
+ * Resize the credit window from the consumers' measured drain rate.
+ * Returns 0 if the window changed, -1 otherwise.
+ */
+int
+adapt_neural_channel_capacity(NeuralChannel *nc)
+{
+    uvlong now, us, t0;
+    ulong drained, rate, want, load;
     
-    for (i = 0; i < reservoir_size; i++) {
-        esn->W_reservoir[i] = malloc(reservoir_size * sizeof(float));
-        esn->W_input[i] = malloc(input_dim * sizeof(float));
+    if (nc == nil)
+        return -1;
+
+    t0 = cogprof_start();
+    now = fastticks(nil);
+    us = fastticks2us(now - nc->drain_mark_ticks);
+    if (us < NCadaptms * 1000) {
+        cogprof_end(CPadapt, t0);
+        return -1;
+    }
+
+    drained = nc->drained;
+    rate = ((uvlong)(drained - nc->drain_mark) * 1000000) / us;
+    nc->drain_mark = drained;
+    nc->drain_mark_ticks = now;
+    nc->drain_rate = (nc->drain_rate * 3 + rate) / 4;
+
+    want = ((uvlong)nc->drain_rate * NCtargetms) / 1000;
+    if (want < NCminwindow)
+        want = NCminwindow;
+    if (want > nc->max_capacity)
+        want = nc->max_capacity;
+    // Never shrink below what is already queued
+    load = neural_channel_load(nc);
+    if (want < load)
+        want = load;
+    if (want == nc->bandwidth_capacity) {
+        cogprof_end(CPadapt, t0);
+        return -1;
+    }
+    // Cached credits would let senders overshoot a smaller window
+    if (want < nc->bandwidth_capacity)
+        neural_reclaim_credits(nc);
+
+    nc->bandwidth_capacity = want;
+    nc->adapted++;
+    qsetlimit(nc->q, want * NBavgmsg);
+    nc->last_evolution = time(NULL);
+    if (nc->sender_waiting)
+        wakeup(&nc->send_rendez);
+    
+    cognitive_event("adapt %s window=%lud drain=%lud", nc->channel_id, want, nc->drain_rate);
+    cogprof_end(CPadapt, t0);
+        
+    return 0;
+}
+
+int
+route_neural_message(NeuralChannel *nc, NeuralMessage *msg)
+{
+    // Basic routing implementation
+    // In a full implementation, this would include:
+    // - Cognitive routing algorithms
+    // - Load balancing
+    // - QoS management
+    // - Pattern detection
+    
+    // For now, simple queuing
+    return queue_neural_message(nc, msg);
+}
+
+/*
+ * Cross-node Neural Transport
+ *
+ * A NeuralLink drains a local channel and ships its messages to a
+ * peer kernel by writing batches to the peer's /proc/cognitive/neural,
+ * normally reached through a 9P mount of the peer.  The process that
+ * sets up the link hands over an open fd for that file, since the
+ * link's kproc runs in the kernel's own namespace.  Messages waiting
+ * on the channel are coalesced into one write of up to the
+ * connection's iounit, so one RPC carries many messages.
+ *
+ * Batch encoding, little-endian:
+ *	magic[2] "NB" version[1] pad[1] count[4]
+ * followed by count records:
+ *	size[4] type[1] prio[1] confidence[2] tag[4] timestamp[4]
+ *	chanlen[1] srclen[1] tgtlen[1] pad[1] payloadlen[4]
+ *	channel[chanlen] source[srclen] target[tgtlen] payload[payloadlen]
+ * size counts the bytes following the size field.
+ */
+enum {
+    NTversion = 1,
+    NTbatchhdr = 8,
+    NTrechdr = 24,                // Fixed part of a record, including size
+    NTbatchmsgs = 128,            // Messages gathered per batch
+    NTlingerms = 2,               // Wait this long for a batch to fill
+    NTdefiounit = 8192,
+};
+
+typedef struct NeuralLink NeuralLink;
+struct NeuralLink {
+    NeuralChannel *nc;            // Local channel being drained
+    char *remote;                 // Channel id on the peer
+    Chan *c;                      // Peer's neural file
+    ulong iounit;
+    int dying;
+    ulong batches;
+    ulong messages;
+    ulong bytes;
+    ulong errors;
+    NeuralLink *next;
+};
+
+static struct {
+    QLock;
+    NeuralLink *links;
+    ulong received;               // Messages accepted from peers
+    ulong unrouted;               // ... for channels we do not have
+    ulong malformed;              // Batches rejected
+} neural_transport;
+
+static int
+neural_record_size(NeuralMessage *msg, char *chan)
+{
+    return NTrechdr + strlen(chan) + strlen(msg->source_domain) +
+           strlen(msg->target_domain) + msg->payload_size;
+}
+
+/*
+ * Encode as many of msgs as fit in buf; returns the
+ * number of bytes used and sets *nenc to the message count.
+ */
+int
+neural_batch_encode(NeuralMessage **msgs, int nmsg, char *chan, uchar *buf, int len, int *nenc)
+{
+    NeuralMessage *msg;
+    uchar *p, *e;
+    int i, cl, sl, tl, n;
+
+    p = buf;
+    e = buf + len;
+    if (len < NTbatchhdr) {
+        *nenc = 0;
+        return 0;
+    }
+    p[0] = 'N';
+    p[1] = 'B';
+    p[2] = NTversion;
+    p[3] = 0;
+    p += NTbatchhdr;
+    cl = strlen(chan);
+    for (i = 0; i < nmsg; i++) {
+        msg = msgs[i];
+        n = neural_record_size(msg, chan);
+        if (n > e - p)
+            break;
+        sl = strlen(msg->source_domain);
+        tl = strlen(msg->target_domain);
+        PBIT32(p, n - 4);
+        p[4] = msg->type;
+        p[5] = msg->cognitive_priority > 255 ? 255 : msg->cognitive_priority;
+        PBIT16(p + 6, (ushort)(msg->confidence_level * 10000));
+        PBIT32(p + 8, msg->tag);
+        PBIT32(p + 12, (ulong)msg->timestamp);
+        p[16] = cl;
+        p[17] = sl;
+        p[18] = tl;
+        p[19] = 0;
+        PBIT32(p + 20, msg->payload_size);
+        p += NTrechdr;
+        memmove(p, chan, cl);
+        p += cl;
+        memmove(p, msg->source_domain, sl);
+        p += sl;
+        memmove(p, msg->target_domain, tl);
+        p += tl;
+        memmove(p, msg->cognitive_payload, msg->payload_size);
+        p += msg->payload_size;
+    }
+    PBIT32(buf + 4, i);
+    *nenc = i;
+    return p - buf;
+}
+
+/*
+ * Decode a batch written by a peer and queue each record on the
+ * local channel it names.  Returns the number of messages queued,
+ * or -1 if the batch is malformed.
+ */
+int
+neural_batch_deliver(uchar *buf, int len)
+{
+    NeuralChannel *nc;
+    NeuralMessage *msg;
+    char chan[256], src[256], tgt[256];
+    uchar *p, *e;
+    ulong count, size, plen;
+    int i, cl, sl, tl, queued;
+
+    if (len < NTbatchhdr || buf[0] != 'N' || buf[1] != 'B' || buf[2] != NTversion) {
+        neural_transport.malformed++;
+        return -1;
+    }
+    count = GBIT32(buf + 4);
+    p = buf + NTbatchhdr;
+    e = buf + len;
+    queued = 0;
+    for (i = 0; i < count; i++) {
+        if (e - p < NTrechdr)
+            goto bad;
+        size = GBIT32(p);
+        cl = p[16];
+        sl = p[17];
+        tl = p[18];
+        plen = GBIT32(p + 20);
+        if (size + 4 > e - p || NTrechdr + cl + sl + tl + plen != size + 4)
+            goto bad;
+        memmove(chan, p + NTrechdr, cl);
+        chan[cl] = 0;
+        memmove(src, p + NTrechdr + cl, sl);
+        src[sl] = 0;
+        memmove(tgt, p + NTrechdr + cl + sl, tl);
+        tgt[tl] = 0;
+
+        nc = lookup_neural_channel(chan);
+        if (nc == nil)
+            neural_transport.unrouted++;
+        else {
+            msg = neural_message_alloc(src, tgt, p + NTrechdr + cl + sl + tl, plen);
+            if (msg != nil) {
+                msg->type = p[4];
+                msg->cognitive_priority = p[5];
+                msg->confidence_level = GBIT16(p + 6) / 10000.0;
+                msg->tag = GBIT32(p + 8);
+                msg->timestamp = GBIT32(p + 12);
+                if (send_neural_message(nc, msg) < 0)
+                    neural_message_free(msg);
+                else
+                    queued++;
+            }
+        }
+        p += size + 4;
+    }
+    neural_transport.received += queued;
+    return queued;
+
+bad:
+    neural_transport.malformed++;
+    neural_transport.received += queued;
+    return -1;
+}
+
+static void
+neural_link_proc(void *a)
+{
+    NeuralLink *nl;
+    NeuralMessage *msgs[NTbatchmsgs];
+    uchar *buf;
+    int i, j, n, nenc, used;
+
+    nl = a;
+    buf = smalloc(nl->iounit);
+    while (!nl->dying) {
+        n = receive_neural_batch_wait(nl->nc, msgs, nelem(msgs), 1000);
+        if (n <= 0)
+            continue;
+        // Give a filling channel a moment to coalesce further
+        if (n < nelem(msgs)) {
+            tsleep(&up->sleep, return0, nil, NTlingerms);
+            n += receive_neural_batch(nl->nc, msgs + n, nelem(msgs) - n);
+        }
+        for (i = 0; i < n; i += nenc) {
+            used = neural_batch_encode(msgs + i, n - i, nl->remote, buf, nl->iounit, &nenc);
+            if (nenc == 0) {
+                // Larger than one write can carry; drop it
+                nl->errors++;
+                neural_message_free(msgs[i]);
+                nenc = 1;
+                continue;
+            }
+            if (waserror()) {
+                // Peer went away; stop the link
+                nl->errors++;
+                nl->dying = 1;
+                for (j = i; j < n; j++)
+                    neural_message_free(msgs[j]);
+                break;
+            }
+            if (devtab[nl->c->type]->write(nl->c, buf, used, 0) != used)
+                nl->errors++;
+            poperror();
+            nl->batches++;
+            nl->messages += nenc;
+            nl->bytes += used;
+            for (j = 0; j < nenc; j++)
+                neural_message_free(msgs[i + j]);
+        }
+    }
+    free(buf);
+    cclose(nl->c);
+    nl->c = nil;
+    pexit("", 1);
+}
+
+/*
+ * Start shipping channel_id's messages to the peer file open
+ * on fd, where they are queued on remote_id.
+ */
+void
+neural_link(char *channel_id, int fd, char *remote_id)
+{
+    NeuralLink *nl;
+    NeuralChannel *nc;
+    Chan *c;
+
+    nc = lookup_neural_channel(channel_id);
+    if (nc == nil)
+        error("unknown neural channel");
+    c = fdtochan(fd, OWRITE, 1, 1);
+    nl = malloc(sizeof(NeuralLink));
+    if (nl == nil) {
+        cclose(c);
+        error(Enomem);
+    }
+    nl->nc = nc;
+    nl->c = c;
+    nl->remote = neural_atom(remote_id != nil ? remote_id : channel_id);
+    nl->iounit = c->iounit ? c->iounit : NTdefiounit;
+
+    qlock(&neural_transport);
+    nl->next = neural_transport.links;
+    neural_transport.links = nl;
+    qunlock(&neural_transport);
+
+    kproc("neurallink", neural_link_proc, nl);
+}
+
+static int sensor_pipe_stats(char*, int);
+
+int
+neural_transport_stats(char *buf, int len)
+{
+    NeuralLink *nl;
+    int n;
+
+    n = snprint(buf, len, "received %lud unrouted %lud malformed %lud\n",
+                neural_transport.received, neural_transport.unrouted,
+                neural_transport.malformed);
+    qlock(&neural_transport);
+    for (nl = neural_transport.links; nl != nil; nl = nl->next)
+        n += snprint(buf + n, len - n,
+                     "link %s -> %s batches=%lud msgs=%lud bytes=%lud errors=%lud%s\n",
+                     nl->nc->channel_id, nl->remote, nl->batches, nl->messages,
+                     nl->bytes, nl->errors, nl->dying ? " down" : "");
+    qunlock(&neural_transport);
+    n += sensor_pipe_stats(buf + n, len - n);
+    return n;
+}
+
+/*
+ * Arenas.  Things that die together are carved from chunks and
+ * freed all at once with their arena, which costs a malloc per chunk
+ * rather than per object and keeps an owner's objects together.  The
+ * first chunk is Narenafirst bytes and each one after doubles, up to
+ * a page, so a namespace with two strings costs one small block and
+ * a busy one fills whole pages; an object larger than that gets a
+ * chunk of its own.  Pieces come back zeroed.  Arenas don't lock;
+ * their owner does.
+ */
+#define ARENAHDR ((sizeof(ArenaChunk) + 7) & ~7)
+
+static void*
+arena_alloc(Arena *a, ulong n)
+{
+    ArenaChunk *c;
+    ulong size;
+    void *p;
+
+    n = (n + 7) & ~7;
+    c = a->chunk;
+    if (c == nil || c->used + n > c->size) {
+        size = c == nil ? Narenafirst : c->size * 2;
+        if (size > Narenachunk)
+            size = Narenachunk;
+        if (size < n)
+            size = n;
+        c = malloc(ARENAHDR + size);
+        if (c == nil)
+            return nil;
+        c->size = size;
+        c->used = 0;
+        c->next = a->chunk;
+        a->chunk = c;
+    }
+    p = (uchar*)c + ARENAHDR + c->used;
+    c->used += n;
+    return p;
+}
+
+static char*
+arena_strdup(Arena *a, char *s)
+{
+    char *p;
+
+    p = arena_alloc(a, strlen(s) + 1);
+    if (p != nil)
+        strcpy(p, s);
+    return p;
+}
+
+// Free everything allocated from a; a may itself live in one of its chunks
+static void
+arena_free(Arena *a)
+{
+    ArenaChunk *c, *next;
+
+    for (c = a->chunk; c != nil; c = next) {
+        next = c->next;
+        free(c);
+    }
+}
+
+
+/*
+ * Cognitive Namespace Operations
+ *
+ * A namespace is allocated in its own arena, together with its
+ * strings and channel table, and free_cognitive_namespace releases
+ * all of it at once.  Channels are shared by the two namespaces they
+ * join and messages, patterns and shells have lifetimes of their
+ * own, so those stay outside it.
+ */
+
+CognitiveNamespace*
+create_cognitive_namespace(char *domain, char *namespace_path)
+{
+    CognitiveNamespace *cns;
+    Arena a;
+    
+    a.chunk = nil;
+    cns = arena_alloc(&a, sizeof(CognitiveNamespace));
+    if (cns == nil)
+        return nil;
+    cns->arena = a;
+    cns->domain = arena_strdup(&cns->arena, domain);
+    cns->namespace_path = arena_strdup(&cns->arena, namespace_path);
+    if (cns->domain == nil || cns->namespace_path == nil) {
+        arena_free(&cns->arena);
+        return nil;
+    }
+    cns->cognitive_load = 0;
+    cns->last_adaptation = time(NULL);
+    cns->channels = nil;
+    cns->channel_count = 0;
+    cns->patterns = nil;
+    cns->pattern_count = 0;
+    cns->adaptcpu = -1;
+    
+    // Initialize adaptation lock
+    lock(&cns->adaptation_lock);
+    unlock(&cns->adaptation_lock);
+    
+    return cns;
+}
+
+/*
+ * Free a namespace that is not, or no longer, registered, with
+ * everything in its arena.
+ */
+void
+free_cognitive_namespace(CognitiveNamespace *cns)
+{
+    if (cns != nil)
+        arena_free(&cns->arena);
+}
+
+char*
+cognitive_namespace_path(CognitiveNamespace *cns)
+{
+    return cns->namespace_path;
+}
+
+int
+bind_neural_channel_to_namespace(CognitiveNamespace *cns, NeuralChannel *nc)
+{
+    NeuralChannel **new_channels;
+    int n;
+    
+    if (cns == nil || nc == nil)
+        return -1;
+        
+    // Double the channel table in the arena when it is full
+    lock(&cns->adaptation_lock);
+    n = cns->channel_count;
+    if ((n & (n - 1)) == 0) {
+        new_channels = arena_alloc(&cns->arena, sizeof(NeuralChannel*) * (n ? 2 * n : 1));
+        if (new_channels == nil) {
+            unlock(&cns->adaptation_lock);
+            return -1;
+        }
+        if (n > 0)
+            memmove(new_channels, cns->channels, n * sizeof(NeuralChannel*));
+        cns->channels = new_channels;
+    }
+    cns->channels[n] = nc;
+    cns->channel_count = n + 1;
+    if (strcmp(nc->target_domain, cns->domain) == 0) {
+        nc->cpus = cns->cpus;
+        nc->adaptcpu = cns->adaptcpu;
+    }
+    unlock(&cns->adaptation_lock);
+    cognitive_changed(CVdomains);
+    
+    logprint("Neural channel %s bound to cognitive namespace %s\n",
+          nc->channel_id, cns->domain);
+    
+    return 0;
+}
+
+static void cognitive_adapt_cpu_start(int);
+
+/*
+ * Give the domain of cns ncpu processors, or let it run anywhere if
+ * ncpu is 0.  Returns -1 if ncpu is out of range.
+ */
+int
+namespace_set_cpus(CognitiveNamespace *cns, int ncpu)
+{
+    NeuralChannel *nc;
+    ulong mask;
+    int i, cpu;
+
+    if (cognitive_cpu_alloc(ncpu, &mask) < 0)
+        return -1;
+    cpu = -1;
+    if (mask != 0)
+        for (cpu = 0; (mask & (1UL << cpu)) == 0; cpu++)
+            ;
+    if (cpu >= 0)
+        cognitive_adapt_cpu_start(cpu);
+    lock(&cns->adaptation_lock);
+    cns->cpus = mask;
+    cns->adaptcpu = cpu;
+    for (i = 0; i < cns->channel_count; i++) {
+        nc = cns->channels[i];
+        if (strcmp(nc->target_domain, cns->domain) == 0) {
+            nc->cpus = mask;
+            nc->adaptcpu = cpu;
+        }
+    }
+    unlock(&cns->adaptation_lock);
+    cognitive_changed(CVdomains);
+    cognitive_event("domain-cpus %s cpus=%#lux", cns->domain, mask);
+    return 0;
+}
+
+int
+adapt_cognitive_namespace(CognitiveNamespace *cns)
+{
+    int i;
+    float avg_load;
+    time_t current_time;
+    
+    if (cns == nil)
+        return -1;
+        
+    lock(&cns->adaptation_lock);
+    
+    current_time = time(NULL);
+    
+    // Calculate average channel load over the sampling window
+    if (cns->channel_count > 0) {
+        ulong total_load = 0;
+        for (i = 0; i < cns->channel_count; i++) {
+            total_load += cns->channels[i]->loadsum;
+        }
+        avg_load = (float)total_load / (cns->channel_count * NCloadwin);
+    } else {
+        avg_load = 0.0;
+    }
+    
+    // Update cognitive load
+    cns->cognitive_load = (int)avg_load;
+    
+    // Adapt if needed
+    if (avg_load > 100.0) { // High cognitive load
+        // Trigger channel adaptations
+        for (i = 0; i < cns->channel_count; i++) {
+            adapt_neural_channel_capacity(cns->channels[i]);
+        }
+        
+        cns->last_adaptation = current_time;
+        
+        cognitive_event("adapt-namespace %s load=%d", cns->domain, cns->cognitive_load);
+    }
+    
+    unlock(&cns->adaptation_lock);
+    
+    return 0;
+}
+
+/*
+ * Background adaptation.  A periodic timer wakes the cogadapt kproc
+ * every NCadaptms; it samples every channel's load into its sliding
+ * window, resizes credit windows from the drain rate and adapts the
+ * namespaces, so senders never do control-plane work.  The kproc
+ * and timer start with the first registered channel.  Channels and
+ * namespaces of a domain with its own processors are adapted by a
+ * kproc wired to the first of them, woken by cogadapt once it has
+ * taken the samples.
+ */
+typedef struct AdaptCpu AdaptCpu;
+struct AdaptCpu {
+    int id;                       // Processor it is wired to
+    int started;
+    int due;                      // Set by cogadapt, cleared by the kproc
+    Rendez r;
+};
+
+static struct {
+    Lock;
+    int started;
+    int due;                      // Set by the timer, cleared by the kproc
+    ulong samples;                // Samples taken, for sketch epochs
+    Timer t;
+    Rendez r;
+    AdaptCpu cpu[MAXMACH];
+} cognitive_adaptd;
+
+static void
+cognitive_adapt_tick(Ureg*, Timer*)
+{
+    cognitive_adaptd.due = 1;
+    wakeup(&cognitive_adaptd.r);
+}
+
+static int
+cognitive_adapt_due(void*)
+{
+    return cognitive_adaptd.due;
+}
+
+static void
+neural_channel_sample(NeuralChannel *nc)
+{
+    ulong load, accepted, refused;
+
+    load = neural_channel_load(nc);
+    nc->loadsum += load - nc->loadwin[nc->loadpos];
+    nc->loadwin[nc->loadpos] = load;
+    nc->loadpos = (nc->loadpos + 1) % NCloadwin;
+
+    // Sends accepted since the last sample; idle periods leave it be
+    accepted = nc->enqueued - nc->accept_mark;
+    refused = nc->refused - nc->refuse_mark;
+    nc->accept_mark += accepted;
+    nc->refuse_mark += refused;
+    if (accepted + refused != 0)
+        nc->accept_avg = cognitive_ewma(nc->accept_avg,
+            (uvlong)accepted * 1000 / (accepted + refused));
+}
+
+/*
+ * Cross-domain correlation.  All channels close their sketch
+ * epochs on the same sample, so their spikes line up in time.
+ * The kproc collects the domains whose channels spiked in an
+ * epoch, and when more than one did the set is reported to
+ * detect_emergent_pattern, whose table turns recurring sets into
+ * significant patterns.
+ */
+enum {
+    Ncorrdomains = 8,             // Most domains correlated at once
+};
+
+static int
+correlate_spike(char **domains, int n, NeuralChannel *nc)
+{
+    int i;
+
+    if (!nc->sketch.spiking)
+        return n;
+    for (i = 0; i < n; i++)
+        if (domains[i] == nc->source_domain)
+            return n;
+    if (n < Ncorrdomains)
+        domains[n++] = nc->source_domain;
+    return n;
+}
+
+static int
+cognitive_adapt_cpu_due(void *a)
+{
+    return ((AdaptCpu*)a)->due;
+}
+
+static void
+cognitive_adaptcpuproc(void *a)
+{
+    AdaptCpu *ac;
+    NeuralChannel *nc;
+    CognitiveNamespace *cns;
+    int i;
+
+    ac = a;
+    procwired(up, ac->id);
+    for (;;) {
+        sleep(&ac->r, cognitive_adapt_cpu_due, ac);
+        ac->due = 0;
+        rlock(&cognitive_state.reglock);
+        for (i = 0; i < Nchhash; i++)
+            for (nc = cognitive_state.chhash[i]; nc != nil; nc = nc->hash_next)
+                if (nc->adaptcpu == ac->id)
+                    adapt_neural_channel_capacity(nc);
+        for (i = 0; i < Nnshash; i++)
+            for (cns = cognitive_state.nshash[i]; cns != nil; cns = cns->hash_next)
+                if (cns->adaptcpu == ac->id)
+                    adapt_cognitive_namespace(cns);
+        runlock(&cognitive_state.reglock);
+    }
+}
+
+static void
+cognitive_adapt_cpu_start(int cpu)
+{
+    AdaptCpu *ac;
+
+    ac = &cognitive_adaptd.cpu[cpu];
+    lock(&cognitive_adaptd);
+    if (ac->started) {
+        unlock(&cognitive_adaptd);
+        return;
+    }
+    ac->started = 1;
+    ac->id = cpu;
+    unlock(&cognitive_adaptd);
+    kproc("cogadapt", cognitive_adaptcpuproc, ac);
+}
+
+static void
+cognitive_adaptproc(void*)
+{
+    NeuralChannel *nc;
+    CognitiveNamespace *cns;
+    char *domains[Ncorrdomains];
+    ulong due;
+    int i, n, epoch;
+
+    for (;;) {
+        sleep(&cognitive_adaptd.r, cognitive_adapt_due, nil);
+        cognitive_adaptd.due = 0;
+        epoch = ++cognitive_adaptd.samples % NCsketchepoch == 0;
+        n = 0;
+        due = 0;
+        rlock(&cognitive_state.reglock);
+        for (i = 0; i < Nchhash; i++)
+            for (nc = cognitive_state.chhash[i]; nc != nil; nc = nc->hash_next) {
+                neural_channel_sample(nc);
+                if (epoch) {
+                    neural_sketch_epoch(nc);
+                    n = correlate_spike(domains, n, nc);
+                }
+                if (nc->adaptcpu >= 0)
+                    due |= 1UL << nc->adaptcpu;
+                else
+                    adapt_neural_channel_capacity(nc);
+            }
+        for (i = 0; i < Nnshash; i++)
+            for (cns = cognitive_state.nshash[i]; cns != nil; cns = cns->hash_next)
+                if (cns->adaptcpu >= 0)
+                    due |= 1UL << cns->adaptcpu;
+                else
+                    adapt_cognitive_namespace(cns);
+        runlock(&cognitive_state.reglock);
+        cognitive_changed(CVsample);
+
+        for (i = 0; due != 0; i++, due >>= 1)
+            if (due & 1) {
+                cognitive_adaptd.cpu[i].due = 1;
+                wakeup(&cognitive_adaptd.cpu[i].r);
+            }
+
+        // Domain names are atoms and outlive the registry lock
+        if (n > 1)
+            detect_emergent_pattern("correlated-spike", domains, n);
+    }
+}
+
+static void
+cognitive_adapt_start(void)
+{
+    lock(&cognitive_adaptd);
+    if (cognitive_adaptd.started) {
+        unlock(&cognitive_adaptd);
+        return;
+    }
+    cognitive_adaptd.started = 1;
+    unlock(&cognitive_adaptd);
+    kproc("cogadapt", cognitive_adaptproc, nil);
+    cognitive_adaptd.t.tmode = Tperiodic;
+    cognitive_adaptd.t.tns = (vlong)NCadaptms * 1000000;
+    cognitive_adaptd.t.tf = cognitive_adapt_tick;
+    cognitive_adaptd.t.ta = nil;
+    timeradd(&cognitive_adaptd.t);
+}
+
+/*
+ * Cognitive Swarm Operations
+ */
+
+CognitiveSwarm*
+create_cognitive_swarm(char *swarm_id, char *domain, Pgrp *pgrp)
+{
+    CognitiveSwarm *swarm;
+    
+    swarm = malloc(sizeof(CognitiveSwarm));
+    if (swarm == nil)
+        return nil;
+        
+    swarm->pgrp = pgrp;
+    swarm->swarm_id = strdup(swarm_id);
+    swarm->domain = strdup(domain);
+    swarm->agents = nil;
+    swarm->agent_count = 0;
+    swarm->agent_cap = 0;
+    swarm->coordination_channel = nil;
+    swarm->coherence_level = 1.0; // Start with perfect coherence
+    swarm->cast_delivery = 1000;
+    swarm->creation_time = time(NULL);
+    
+    // Initialize swarm lock
+    lock(&swarm->swarm_lock);
+    unlock(&swarm->swarm_lock);
+    
+    // Create coordination channel
+    swarm->coordination_channel = create_neural_channel(domain, "swarm-coordination", 1000);
+    
+    logprint("Cognitive swarm %s created for domain %s\n", swarm_id, domain);
+    
+    return swarm;
+}
+
+char*
+cognitive_swarm_domain(CognitiveSwarm *swarm)
+{
+    return swarm->domain;
+}
+
+/*
+ * Membership is a dense array that doubles as it fills.  Each agent
+ * records its swarm and slot in its Proc, so leaving moves the last
+ * agent into the vacated slot in constant time; pexit calls
+ * swarmexit to leave as a process dies.  A process is an agent of
+ * at most one swarm and joining another leaves the first.
+ */
+enum {
+    Nswarmagents = 8,             // Initial agent slots
+};
+
+int
+add_agent_to_swarm(CognitiveSwarm *swarm, Proc *agent)
+{
+    SwarmAgent **new_agents, *sa;
+    int n;
+    
+    if (swarm == nil || agent == nil)
+        return -1;
+    if (agent->swarm == swarm)
+        return 0;
+    if (agent->swarm != nil)
+        remove_agent_from_swarm(agent);
+    sa = malloc(sizeof(SwarmAgent));
+    if (sa == nil)
+        return -1;
+    sa->p = agent;
+    sa->swarm = swarm;
+    sa->groups = ~0UL;
+        
+    lock(&swarm->swarm_lock);
+    
+    // Expand agent array geometrically
+    if (swarm->agent_count == swarm->agent_cap) {
+        n = swarm->agent_cap ? swarm->agent_cap * 2 : Nswarmagents;
+        new_agents = realloc(swarm->agents, n * sizeof(SwarmAgent*));
+        if (new_agents == nil) {
+            unlock(&swarm->swarm_lock);
+            free(sa);
+            return -1;
+        }
+        swarm->agents = new_agents;
+        swarm->agent_cap = n;
+    }
+    
+    // New agents see only casts made after they join
+    sa->cursor = swarm->cast_seq;
+    swarm->agents[swarm->agent_count] = sa;
+    agent->swarmslot = swarm->agent_count;
+    agent->swarm = swarm;
+    agent->swarmcpus = swarm->cpus;
+    swarm->agent_count++;
+    
+    unlock(&swarm->swarm_lock);
+    cognitive_changed(CVswarms);
+    
+    cognitive_event("join %s pid=%lud agents=%d", swarm->swarm_id, agent->pid, swarm->agent_count);
+    
+    return 0;
+}
+
+void
+remove_agent_from_swarm(Proc *agent)
+{
+    CognitiveSwarm *swarm;
+    SwarmAgent *sa, *last;
+    
+    swarm = agent->swarm;
+    if (swarm == nil)
+        return;
+    lock(&swarm->swarm_lock);
+    if (agent->swarm != swarm) {
+        unlock(&swarm->swarm_lock);
+        return;
+    }
+    sa = swarm->agents[agent->swarmslot];
+    last = swarm->agents[--swarm->agent_count];
+    swarm->agents[agent->swarmslot] = last;
+    last->p->swarmslot = agent->swarmslot;
+    agent->swarm = nil;
+    agent->swarmcpus = 0;
+    if (sa->waiting) {
+        // Asleep in swarm_receive, which frees sa as it returns
+        sa->gone = 1;
+        wakeup(&sa->r);
+        sa = nil;
+    }
+    unlock(&swarm->swarm_lock);
+    free(sa);
+    cognitive_changed(CVswarms);
+    
+    cognitive_event("leave %s pid=%lud agents=%d", swarm->swarm_id, agent->pid, swarm->agent_count);
+}
+
+/*
+ * Gang scheduling: a swarm given a set of processors has its agents
+ * preferred there by runproc, and an agent readied by a peer is
+ * queued for the waker's processor, so a message round trip between
+ * agents tends to stay on one processor instead of crossing to an
+ * idle one.  Sets come from cognitive_cpu_alloc so swarms spread out.
+ */
+
+/*
+ * Gather the agents of swarm on ncpu processors, or let them run
+ * anywhere if ncpu is 0.  Returns -1 if ncpu is out of range.
+ */
+int
+swarm_set_cpus(CognitiveSwarm *swarm, int ncpu)
+{
+    ulong mask;
+    int i;
+    
+    if (cognitive_cpu_alloc(ncpu, &mask) < 0)
+        return -1;
+    lock(&swarm->swarm_lock);
+    swarm->cpus = mask;
+    for (i = 0; i < swarm->agent_count; i++)
+        swarm->agents[i]->p->swarmcpus = mask;
+    unlock(&swarm->swarm_lock);
+    cognitive_changed(CVswarms);
+    return 0;
+}
+
+/*
+ * Swarm Broadcast
+ *
+ * A cast puts one message into the swarm's fan-out ring, indexed
+ * by a sequence number, instead of sending a copy to every agent.
+ * Each agent keeps its own cursor into the ring and takes a
+ * reference to the shared message as it reads, so a cast costs
+ * one allocation whatever the swarm size and agents consume at
+ * their own pace.  The ring holds one reference to each of its
+ * last Nswarmcast casts; an agent that falls further behind skips
+ * to the oldest one held and has the overrun counted in lost.
+ * Multicasts are addressed to a mask of groups and an agent reads
+ * those sharing a bit with the groups it joined, by default all.
+ */
+
+/*
+ * Cast msg to the agents of swarm in any of groups.  The swarm
+ * takes over the caller's reference to msg.
+ */
+void
+swarm_multicast(CognitiveSwarm *swarm, NeuralMessage *msg, ulong groups)
+{
+    SwarmCast *c;
+    NeuralMessage *old;
+    SwarmAgent *sa;
+    int i;
+    
+    lock(&swarm->swarm_lock);
+    c = &swarm->cast[swarm->cast_seq & (Nswarmcast - 1)];
+    old = c->msg;
+    c->msg = msg;
+    c->groups = groups;
+    swarm->cast_seq++;
+    if (swarm->waiters > 0) {
+        for (i = 0; i < swarm->agent_count; i++) {
+            sa = swarm->agents[i];
+            if (sa->waiting && (sa->groups & groups) != 0)
+                wakeup(&sa->r);
+        }
+    }
+    unlock(&swarm->swarm_lock);
+    neural_message_free(old);
+}
+
+void
+swarm_broadcast(CognitiveSwarm *swarm, NeuralMessage *msg)
+{
+    swarm_multicast(swarm, msg, ~0UL);
+}
+
+/*
+ * Set the groups whose casts agent reads; returns -1 if agent
+ * is not in a swarm.
+ */
+int
+swarm_set_groups(Proc *agent, ulong groups)
+{
+    CognitiveSwarm *swarm;
+    
+    swarm = agent->swarm;
+    if (swarm == nil)
+        return -1;
+    lock(&swarm->swarm_lock);
+    if (agent->swarm != swarm) {
+        unlock(&swarm->swarm_lock);
+        return -1;
+    }
+    swarm->agents[agent->swarmslot]->groups = groups;
+    unlock(&swarm->swarm_lock);
+    return 0;
+}
+
+// Advance sa past casts it cannot read; called with swarm_lock held
+static NeuralMessage*
+swarm_cast_next(CognitiveSwarm *swarm, SwarmAgent *sa)
+{
+    SwarmCast *c;
+    ulong behind;
+    
+    behind = swarm->cast_seq - sa->cursor;
+    if (behind > Nswarmcast) {
+        behind -= Nswarmcast;
+        sa->lost += behind;
+        sa->cursor = swarm->cast_seq - Nswarmcast;
+        // Past 64 misses the average has decayed to zero anyway
+        if (behind > 64)
+            swarm->cast_delivery = 0;
+        else
+            while (behind-- > 0)
+                swarm->cast_delivery = cognitive_ewma(swarm->cast_delivery, 0);
+    }
+    while (sa->cursor != swarm->cast_seq) {
+        c = &swarm->cast[sa->cursor & (Nswarmcast - 1)];
+        sa->cursor++;
+        if ((c->groups & sa->groups) != 0) {
+            swarm->cast_delivery = cognitive_ewma(swarm->cast_delivery, 1000);
+            swarm->cast_latency = cognitive_ewma(swarm->cast_latency,
+                fastticks2us(fastticks(nil) - c->msg->created));
+            return neural_message_ref(c->msg);
+        }
+    }
+    return nil;
+}
+
+static int
+swarm_cast_ready(void *a)
+{
+    SwarmAgent *sa;
+    
+    sa = a;
+    return sa->gone || sa->cursor != sa->swarm->cast_seq;
+}
+
+/*
+ * Return the next cast for the calling process, which must be a
+ * swarm agent, waiting up to ms milliseconds for one (forever if
+ * ms < 0).  Returns nil on timeout or if the process leaves its
+ * swarm; the caller frees the message it gets.  Raises an error
+ * if interrupted.
+ */
+NeuralMessage*
+swarm_receive(long ms)
+{
+    CognitiveSwarm *swarm;
+    SwarmAgent *sa;
+    NeuralMessage *msg;
+    int gone;
+    
+    swarm = up->swarm;
+    if (swarm == nil)
+        return nil;
+    lock(&swarm->swarm_lock);
+    if (up->swarm != swarm) {
+        unlock(&swarm->swarm_lock);
+        return nil;
+    }
+    sa = swarm->agents[up->swarmslot];
+    while ((msg = swarm_cast_next(swarm, sa)) == nil && ms != 0) {
+        sa->waiting = 1;
+        swarm->waiters++;
+        unlock(&swarm->swarm_lock);
+        if (waserror()) {
+            lock(&swarm->swarm_lock);
+            sa->waiting = 0;
+            swarm->waiters--;
+            gone = sa->gone;
+            unlock(&swarm->swarm_lock);
+            if (gone)
+                free(sa);
+            nexterror();
+        }
+        if (ms < 0)
+            sleep(&sa->r, swarm_cast_ready, sa);
+        else
+            tsleep(&sa->r, swarm_cast_ready, sa, ms);
+        poperror();
+        lock(&swarm->swarm_lock);
+        sa->waiting = 0;
+        swarm->waiters--;
+        if (sa->gone) {
+            unlock(&swarm->swarm_lock);
+            free(sa);
+            return nil;
+        }
+        // A timed wait gets one more look
+        if (ms > 0)
+            ms = 0;
+    }
+    unlock(&swarm->swarm_lock);
+    return msg;
+}
+
+/*
+ * Coherence is measured rather than modelled: the share of casts
+ * agents read rather than lost, times the share of sends the
+ * coordination channel accepted, discounted by how long agents
+ * wait on each other, the channel's queue residency plus the
+ * cast-to-read latency, against Swarmlatus.  Each term is an
+ * EWMA kept up to date as messages move, so this is O(1).
+ */
+enum {
+    Swarmlatus = 1000,            // Coordination latency halving coherence, µs
+};
+
+float
+calculate_swarm_coherence(CognitiveSwarm *swarm)
+{
+    NeuralChannel *nc;
+    float delivery, wait;
+    
+    if (swarm == nil || swarm->agent_count == 0)
+        return 0.0;
+        
+    delivery = swarm->cast_delivery / 1000.0;
+    wait = swarm->cast_latency;
+    nc = swarm->coordination_channel;
+    if (nc != nil) {
+        delivery *= nc->accept_avg / 1000.0;
+        wait += nc->res_avg;
+    }
+    
+    swarm->coherence_level = delivery * Swarmlatus / (Swarmlatus + wait);
+    
+    return swarm->coherence_level;
+}
+
+/*
+ * Emergence Detection
+ *
+ * Patterns live in a fixed-size table keyed by a hash of their
+ * name and domain set, so observing a known pattern updates it in
+ * place.  Each pattern counts its observations over the last Npwin
+ * seconds in a ring of one-second slots, and its significance is
+ * that count against Psighalf, the count that scores one half.  At
+ * Npatterns the least recently observed pattern is evicted, so
+ * detection can run on message streams indefinitely in fixed
+ * memory.
+ */
+enum {
+    Npatterns = 256,              // Patterns kept
+    Nphash = 64,                  // Pattern table chains
+    Psighalf = 8,                 // Observations per window scoring 0.5
+};
+
+static struct {
+    Lock;
+    EmergentPattern *hash[Nphash];
+    EmergentPattern *lru_head;    // Most recently observed
+    EmergentPattern *lru_tail;    // Next to be evicted
+    int npatterns;
+    ulong evicted;                // Patterns dropped for space
+} emergence;
+
+// Domains are summed so the key does not depend on their order
+static ulong
+pattern_key(char *name, char **domains, int domain_count)
+{
+    ulong h;
+    int i;
+    
+    h = cognitive_hash(name, ~0UL);
+    for (i = 0; i < domain_count; i++)
+        h += cognitive_hash(domains[i], ~0UL) * 0x9E3779B1UL;
+    return h;
+}
+
+static int
+pattern_match(EmergentPattern *p, ulong key, char *name, char **domains, int domain_count)
+{
+    int i, j;
+    
+    if (p->key != key || p->domain_count != domain_count || strcmp(p->pattern_name, name) != 0)
+        return 0;
+    for (i = 0; i < domain_count; i++) {
+        for (j = 0; j < domain_count; j++)
+            if (strcmp(p->involved_domains[j], domains[i]) == 0)
+                break;
+        if (j == domain_count)
+            return 0;
+    }
+    return 1;
+}
+
+static void
+pattern_free(EmergentPattern *p)
+{
+    int i;
+    
+    for (i = 0; i < p->domain_count; i++)
+        free(p->involved_domains[i]);
+    free(p->involved_domains);
+    free(p->pattern_id);
+    free(p->pattern_name);
+    free(p->description);
+    free(p);
+}
+
+// Move the pattern's namespaces' counts by delta
+static void
+pattern_count_domains(EmergentPattern *p, int delta)
+{
+    CognitiveNamespace *cns;
+    int i;
+    
+    for (i = 0; i < p->domain_count; i++) {
+        cns = lookup_cognitive_namespace(p->involved_domains[i]);
+        if (cns != nil)
+            cns->pattern_count += delta;
+    }
+}
+
+static void
+pattern_lru_unlink(EmergentPattern *p)
+{
+    if (p->lru_prev != nil)
+        p->lru_prev->lru_next = p->lru_next;
+    else
+        emergence.lru_head = p->lru_next;
+    if (p->lru_next != nil)
+        p->lru_next->lru_prev = p->lru_prev;
+    else
+        emergence.lru_tail = p->lru_prev;
+}
+
+static void
+pattern_lru_push(EmergentPattern *p)
+{
+    p->lru_prev = nil;
+    p->lru_next = emergence.lru_head;
+    if (emergence.lru_head != nil)
+        emergence.lru_head->lru_prev = p;
+    else
+        emergence.lru_tail = p;
+    emergence.lru_head = p;
+}
+
+// Drop the least recently observed pattern; returns it for freeing
+static EmergentPattern*
+pattern_evict(void)
+{
+    EmergentPattern *p, **l;
+    
+    p = emergence.lru_tail;
+    pattern_lru_unlink(p);
+    for (l = &emergence.hash[p->key % Nphash]; *l != p; l = &(*l)->hash_next)
+        ;
+    *l = p->hash_next;
+    emergence.npatterns--;
+    emergence.evicted++;
+    return p;
+}
+
+// Slide the window to now, clearing the slots of seconds passed.
+static void
+pattern_window_advance(EmergentPattern *p, ulong now)
+{
+    ulong t;
+    
+    if (now - p->window_time >= Npwin) {
+        memset(p->window, 0, sizeof p->window);
+        p->window_sum = 0;
+    } else {
+        for (t = p->window_time + 1; t <= now; t++) {
+            p->window_sum -= p->window[t % Npwin];
+            p->window[t % Npwin] = 0;
+        }
+    }
+    p->window_time = now;
+}
+
+static float
+pattern_score(EmergentPattern *p)
+{
+    p->significance_score = (float)p->window_sum / (p->window_sum + Psighalf);
+    return p->significance_score;
+}
+
+// Count an observation at now; called with emergence locked.
+static float
+pattern_observe(EmergentPattern *p, ulong now)
+{
+    pattern_window_advance(p, now);
+    p->window[now % Npwin]++;
+    p->window_sum++;
+    p->last_observed = now;
+    p->observation_count++;
+    return pattern_score(p);
+}
+
+/*
+ * Record an observation of pattern_name across domains, creating
+ * the pattern if it is new.  Returns the pattern's significance,
+ * or -1 if a new pattern could not be allocated.
+ */
+float
+detect_emergent_pattern(char *pattern_name, char **domains, int domain_count)
+{
+    EmergentPattern *p, *old;
+    ulong key, now;
+    float score;
+    int i;
+    
+    key = pattern_key(pattern_name, domains, domain_count);
+    now = seconds();
+    
+    lock(&emergence);
+    for (p = emergence.hash[key % Nphash]; p != nil; p = p->hash_next)
+        if (pattern_match(p, key, pattern_name, domains, domain_count))
+            break;
+    if (p != nil) {
+        pattern_lru_unlink(p);
+        pattern_lru_push(p);
+        score = pattern_observe(p, now);
+        unlock(&emergence);
+        return score;
+    }
+    unlock(&emergence);
+    
+    p = malloc(sizeof(EmergentPattern));
+    if (p == nil)
+        return -1;
+    p->involved_domains = malloc(sizeof(char*) * domain_count);
+    if (p->involved_domains == nil) {
+        free(p);
+        return -1;
+    }
+    p->pattern_id = smprint("pattern-%08lux", key);
+    p->pattern_name = strdup(pattern_name);
+    p->description = smprint("Emergent pattern observed across %d domains", domain_count);
+    p->domain_count = domain_count;
+    for (i = 0; i < domain_count; i++)
+        p->involved_domains[i] = strdup(domains[i]);
+    p->key = key;
+    p->first_observed = now;
+    p->window_time = now;
+    
+    lock(&emergence);
+    // Lost a race to create it; count ours as an observation of theirs
+    for (old = emergence.hash[key % Nphash]; old != nil; old = old->hash_next)
+        if (pattern_match(old, key, pattern_name, domains, domain_count))
+            break;
+    if (old != nil) {
+        pattern_lru_unlink(old);
+        pattern_lru_push(old);
+        score = pattern_observe(old, now);
+        unlock(&emergence);
+        pattern_free(p);
+        return score;
+    }
+    score = pattern_observe(p, now);
+    if (emergence.npatterns >= Npatterns)
+        old = pattern_evict();
+    p->hash_next = emergence.hash[key % Nphash];
+    emergence.hash[key % Nphash] = p;
+    pattern_lru_push(p);
+    emergence.npatterns++;
+    cognitive_state.pattern_count = emergence.npatterns;
+    unlock(&emergence);
+    
+    if (old != nil) {
+        pattern_count_domains(old, -1);
+        pattern_free(old);
+    }
+    pattern_count_domains(p, 1);
+    cognitive_changed(CVpatterns);
+    cognitive_event("emergence %s domains=%d", pattern_name, domain_count);
+    
+    return score;
+}
+
+// Patterns by recency; significance reflects the window as of now.
+int
+cognitive_patterns_text(char *buf, int len)
+{
+    EmergentPattern *p;
+    ulong now;
+    int i, n;
+    
+    n = 0;
+    now = seconds();
+    lock(&emergence);
+    for (p = emergence.lru_head; p != nil && n < len - 1; p = p->lru_next) {
+        pattern_window_advance(p, now);
+        pattern_score(p);
+        n += snprint(buf + n, len - n, "%s %s observed=%d significance=%d%% domains=",
+                     p->pattern_id, p->pattern_name, p->observation_count,
+                     (int)(p->significance_score * 100));
+        for (i = 0; i < p->domain_count; i++)
+            n += snprint(buf + n, len - n, "%s%s", i ? "," : "", p->involved_domains[i]);
+        n += snprint(buf + n, len - n, "\n");
+    }
+    unlock(&emergence);
+    return n;
+}
+
+/*
+ * Initialization and Setup
+ */
+
+void
+cognitive_cities_init(void)
+{
+    // Initialize global cognitive state
+    lock(&cognitive_state);
+    
+    cognitive_state.pattern_count = 0;
+    
+    unlock(&cognitive_state);
+    
+    swarmexit = remove_agent_from_swarm;
+    
+    print("Cognitive Cities architecture initialized\n");
+    
+    // Create initial cognitive namespaces for main domains
+    create_initial_cognitive_domains();
+}
+
+void
+create_initial_cognitive_domains(void)
+{
+    CognitiveNamespace *transportation, *energy, *governance, *environment;
+    
+    // Create core cognitive domain namespaces
+    transportation = create_cognitive_namespace("transportation", 
+                                               "/cognitive-cities/domains/transportation");
+    energy = create_cognitive_namespace("energy", 
+                                       "/cognitive-cities/domains/energy");
+    governance = create_cognitive_namespace("governance", 
+                                           "/cognitive-cities/domains/governance");
+    environment = create_cognitive_namespace("environment", 
+                                            "/cognitive-cities/domains/environment");
+    
+    // Add to global state
+    register_cognitive_namespace(transportation);
+    register_cognitive_namespace(energy);
+    register_cognitive_namespace(governance);
+    register_cognitive_namespace(environment);
+    
+    print("Initial cognitive domains created: transportation, energy, governance, environment\n");
+    
+    // Create inter-domain neural transport channels
+    create_interdomain_channels(transportation, energy, governance, environment);
+}
+
+void
+create_interdomain_channels(CognitiveNamespace *transportation, 
+                           CognitiveNamespace *energy,
+                           CognitiveNamespace *governance, 
+                           CognitiveNamespace *environment)
+{
+    NeuralChannel *trans_energy, *trans_gov, *energy_env, *gov_env;
+    
+    // Create neural channels between domains
+    trans_energy = create_neural_channel("transportation", "energy", 500);
+    trans_gov = create_neural_channel("transportation", "governance", 300);
+    energy_env = create_neural_channel("energy", "environment", 400);
+    gov_env = create_neural_channel("governance", "environment", 200);
+    register_neural_channel(trans_energy);
+    register_neural_channel(trans_gov);
+    register_neural_channel(energy_env);
+    register_neural_channel(gov_env);
+    
+    // Bind channels to namespaces
+    bind_neural_channel_to_namespace(transportation, trans_energy);
+    bind_neural_channel_to_namespace(transportation, trans_gov);
+    bind_neural_channel_to_namespace(energy, trans_energy);
+    bind_neural_channel_to_namespace(energy, energy_env);
+    bind_neural_channel_to_namespace(governance, trans_gov);
+    bind_neural_channel_to_namespace(governance, gov_env);
+    bind_neural_channel_to_namespace(environment, energy_env);
+    bind_neural_channel_to_namespace(environment, gov_env);
+    
+    print("Inter-domain neural transport channels established\n");
+}
+
+/*
+ * Status files.  Each renderer formats a consistent view of the
+ * registry into buf under the read lock and returns the length;
+ * devcognitive snapshots the result when the file is opened.
+ */
+
+int
+cognitive_domains_text(char *buf, int len)
+{
+    CognitiveNamespace *cns;
+    int i, n;
+
+    n = 0;
+    rlock(&cognitive_state.reglock);
+    for (i = 0; i < Nnshash && n < len - 1; i++)
+        for (cns = cognitive_state.nshash[i]; cns != nil; cns = cns->hash_next)
+            n += snprint(buf + n, len - n, "%s %s load=%d channels=%d patterns=%d cpus=%#lux\n",
+                         cns->domain, cns->namespace_path, cns->cognitive_load,
+                         cns->channel_count, cns->pattern_count, cns->cpus);
+    runlock(&cognitive_state.reglock);
+    return n;
+}
+
+int
+cognitive_swarms_text(char *buf, int len)
+{
+    CognitiveSwarm *swarm;
+    int i, n;
+
+    n = 0;
+    rlock(&cognitive_state.reglock);
+    for (i = 0; i < Nswhash && n < len - 1; i++)
+        for (swarm = cognitive_state.swhash[i]; swarm != nil; swarm = swarm->hash_next)
+            n += snprint(buf + n, len - n, "%s %s agents=%d coherence=%d%% casts=%lud cpus=%#lux channel=%s\n",
+                         swarm->swarm_id, swarm->domain, swarm->agent_count,
+                         (int)(calculate_swarm_coherence(swarm) * 100), swarm->cast_seq,
+                         swarm->cpus,
+                         swarm->coordination_channel != nil ?
+                             swarm->coordination_channel->channel_id : "none");
+    runlock(&cognitive_state.reglock);
+    return n;
+}
+
+// Overall load is the share of all credit windows currently in use.
+int
+cognitive_monitor_text(char *buf, int len)
+{
+    NeuralChannel *nc;
+    uvlong load, window;
+    int i, n;
+
+    load = window = 0;
+    rlock(&cognitive_state.reglock);
+    for (i = 0; i < Nchhash; i++)
+        for (nc = cognitive_state.chhash[i]; nc != nil; nc = nc->hash_next) {
+            load += neural_channel_load(nc);
+            window += nc->bandwidth_capacity;
+        }
+    n = snprint(buf, len, "domains %d\nchannels %d\nswarms %d\nload %d%%\n",
+                cognitive_state.namespace_count, cognitive_state.channel_count,
+                cognitive_state.swarm_count,
+                window != 0 ? (int)(load * 100 / window) : 0);
+    runlock(&cognitive_state.reglock);
+    return n;
+}
+
+/*
+ * Transport efficiency is the share of accepted messages already
+ * delivered; coherence is the mean over all swarms.
+ */
+int
+cognitive_metrics_text(char *buf, int len)
+{
+    NeuralChannel *nc;
+    CognitiveSwarm *swarm;
+    uvlong enq, deq;
+    float coherence;
+    int i, n;
+
+    enq = deq = 0;
+    coherence = 0.0;
+    rlock(&cognitive_state.reglock);
+    for (i = 0; i < Nchhash; i++)
+        for (nc = cognitive_state.chhash[i]; nc != nil; nc = nc->hash_next) {
+            enq += nc->enqueued;
+            deq += nc->drained;
+        }
+    for (i = 0; i < Nswhash; i++)
+        for (swarm = cognitive_state.swhash[i]; swarm != nil; swarm = swarm->hash_next)
+            coherence += calculate_swarm_coherence(swarm);
+    n = snprint(buf, len, "efficiency %d%%\ncoherence %d%%\npatterns %d\ndomains %d\n",
+                enq != 0 ? (int)(deq * 100 / enq) : 100,
+                cognitive_state.swarm_count != 0 ?
+                    (int)(coherence * 100 / cognitive_state.swarm_count) : 0,
+                cognitive_state.pattern_count, cognitive_state.namespace_count);
+    runlock(&cognitive_state.reglock);
+    return n;
+}
+
+/*
+ * Binary metrics: a header record followed by one CMrecsize record
+ * per channel, swarm and domain, all little-endian:
+ *	version[1] kind[1] pad[2] name[CMnamelen] val[CMnval*8]
+ * The header has kind CMhdr, name "cognitive", and vals
+ * record count, fastticks in µs and boot seconds.
+ * Channel vals: window load enqueued dequeued dropped adapted
+ *	drain res50 res99 e2e50 e2e99
+ * Swarm vals: agents coherence(permille) then the coordination
+ *	channel's enqueued dequeued dropped
+ * Domain vals: load channels patterns
+ * Unused vals are zero; new vals may only be appended within the
+ * record, and a layout change bumps CMversion.
+ */
+static uchar*
+cognitive_metrics_rec(uchar *p, int kind, char *name, uvlong *val, int nval)
+{
+    int i;
+
+    memset(p, 0, CMrecsize);
+    p[0] = CMversion;
+    p[1] = kind;
+    strncpy((char*)p + 4, name, CMnamelen - 1);
+    for (i = 0; i < nval && i < CMnval; i++) {
+        PBIT64(p + 4 + CMnamelen + i * 8, val[i]);
+    }
+    return p + CMrecsize;
+}
+
+/*
+ * If buf cannot hold every record, the header counts only those
+ * that fit, the rest of buf is zeroed and the result is len.
+ */
+int
+cognitive_metrics_binary(uchar *buf, int len)
+{
+    NeuralChannel *nc;
+    CognitiveSwarm *swarm;
+    CognitiveNamespace *cns;
+    ulong reshist[Nlathist];
+    uvlong val[CMnval];
+    uchar *p, *e;
+    int i, j, b, nrec, total;
+
+    if (len < CMrecsize)
+        return 0;
+    rlock(&cognitive_state.reglock);
+    total = cognitive_state.channel_count + cognitive_state.swarm_count +
+            cognitive_state.namespace_count;
+    nrec = total;
+    if ((nrec + 1) * CMrecsize > len)
+        nrec = len / CMrecsize - 1;
+    e = buf + (nrec + 1) * CMrecsize;
+
+    val[0] = nrec;
+    val[1] = fastticks2us(fastticks(nil));
+    val[2] = TK2SEC(MACHP(0)->ticks);
+    p = cognitive_metrics_rec(buf, CMhdr, "cognitive", val, 3);
+
+    for (i = 0; i < Nchhash && p < e; i++)
+        for (nc = cognitive_state.chhash[i]; nc != nil && p < e; nc = nc->hash_next) {
+            memset(reshist, 0, sizeof reshist);
+            for (j = 0; j < Nprio; j++)
+                for (b = 0; b < Nlathist; b++)
+                    reshist[b] += nc->level[j].lathist[b];
+            val[0] = nc->bandwidth_capacity;
+            val[1] = neural_channel_load(nc);
+            val[2] = nc->enqueued;
+            val[3] = nc->drained;
+            val[4] = nc->refused;
+            val[5] = nc->adapted;
+            val[6] = nc->drain_rate;
+            val[7] = neural_latency_percentile(reshist, Nlathist, 500);
+            val[8] = neural_latency_percentile(reshist, Nlathist, 990);
+            val[9] = neural_latency_percentile(nc->e2ehist, Nlathist, 500);
+            val[10] = neural_latency_percentile(nc->e2ehist, Nlathist, 990);
+            p = cognitive_metrics_rec(p, CMchannel, nc->channel_id, val, 11);
+        }
+
+    for (i = 0; i < Nswhash && p < e; i++)
+        for (swarm = cognitive_state.swhash[i]; swarm != nil && p < e; swarm = swarm->hash_next) {
+            memset(val, 0, sizeof val);
+            val[0] = swarm->agent_count;
+            val[1] = (uvlong)(calculate_swarm_coherence(swarm) * 1000);
+            nc = swarm->coordination_channel;
+            if (nc != nil) {
+                val[2] = nc->enqueued;
+                val[3] = nc->drained;
+                val[4] = nc->refused;
+            }
+            p = cognitive_metrics_rec(p, CMswarm, swarm->swarm_id, val, 5);
+        }
+
+    for (i = 0; i < Nnshash && p < e; i++)
+        for (cns = cognitive_state.nshash[i]; cns != nil && p < e; cns = cns->hash_next) {
+            val[0] = cns->cognitive_load;
+            val[1] = cns->channel_count;
+            val[2] = cns->pattern_count;
+            p = cognitive_metrics_rec(p, CMdomain, cns->domain, val, 3);
+        }
+    runlock(&cognitive_state.reglock);
+
+    if (nrec < total) {
+        memset(p, 0, len - (p - buf));
+        return len;
+    }
+    return p - buf;
+}
+
+/*
+ * Large levels are generated in parallel.  The trees of a level come
+ * in blocks by their leading subtree, and the length of every block
+ * follows from counting forests, so the level is cut into spans of
+ * about equal length.  Each span restarts the iterator at its first
+ * tree's leading subtree and is walked by its own kproc into its own
+ * range of the level.  Neighbouring spans can share the word at their
+ * seam; a span keeps its bits of those words aside and the generator
+ * merges them once every span is in.
+ */
+enum {
+    RTspans = 16,                 // Most kprocs one level is split over
+    RTspanmin = 4096,             // Fewest trees per span worth a kproc
+};
+
+typedef struct TreeSpan TreeSpan;
+struct TreeSpan {
+    uint n;
+    uint sl, pos;                 // Leading subtree of the first tree
+    ulong k0, k1;                 // Trees [k0, k1) of the level
+    uvlong *l;
+    ulong w0, w1;                 // Words shared with the neighbours
+    uvlong edge[2];               // This span's bits of them
+};
+
+// forests[m][s]: forests of m nodes whose trees have at most s nodes
+static uvlong forests[MAXN][MAXN];
+
+// Multisets of j trees drawn from a kinds
+static uvlong
+multichoose(uvlong a, int j)
+{
+    uvlong c;
+    int i;
+
+    c = 1;
+    for (i = 1; i <= j; i++)
+        c = c * (a + i - 1) / i;
+    return c;
+}
+
+static void
+forests_init(void)
+{
+    uint m, s, j;
+
+    if (forests[0][0] != 0)
+        return;
+    for (s = 0; s < MAXN; s++)
+        forests[0][s] = 1;
+    for (m = 1; m < MAXN; m++)
+        for (s = 1; s < MAXN; s++)
+            for (j = 0; j * s <= m; j++)
+                forests[m][s] += multichoose(a000081[s], j) * forests[m - j * s][s - 1];
+}
+
+// Trees of n nodes whose leading subtree is tree pos of size sl
+static uvlong
+tree_block(uint n, uint sl, uint pos)
+{
+    uvlong c;
+    uint r, j;
+
+    r = n - 1 - sl;
+    c = 0;
+    for (j = 0; j * sl <= r; j++)
+        c += multichoose(a000081[sl] - pos, j) * forests[r - j * sl][sl - 1];
+    return c;
+}
+
+// Cut the n-node level into at most nspan spans; returns how many
+static int
+tree_spans(TreeSpan *sp, int nspan, uint n, uvlong *l)
+{
+    uvlong cum, c, total;
+    uint sl, pos;
+    ulong w;
+    int i;
+
+    total = a000081[n];
+    i = 0;
+    cum = 0;
+    sp[0].sl = n - 1;
+    sp[0].pos = 0;
+    sp[0].k0 = 0;
+    for (sl = n - 1; sl >= 1 && i < nspan - 1; sl--) {
+        c = forests[n - 1][sl] - forests[n - 1][sl - 1];
+        if (cum + c <= total * (i + 1) / nspan) {
+            cum += c;
+            continue;
+        }
+        for (pos = 0; pos < a000081[sl]; pos++) {
+            while (i < nspan - 1 && cum >= total * (i + 1) / nspan) {
+                i++;
+                sp[i].sl = sl;
+                sp[i].pos = pos;
+                sp[i].k0 = cum;
+            }
+            cum += tree_block(n, sl, pos);
+        }
+    }
+    nspan = i + 1;
+    w = 2 * n - 2;
+    for (i = 0; i < nspan; i++) {
+        sp[i].n = n;
+        sp[i].l = l;
+        sp[i].k1 = i + 1 < nspan ? sp[i + 1].k0 : total;
+        sp[i].w0 = sp[i].k0 * w / 64;
+        sp[i].w1 = sp[i].k1 * w > sp[i].k0 * w ? (sp[i].k1 * w - 1) / 64 : sp[i].w0;
+        sp[i].edge[0] = 0;
+        sp[i].edge[1] = 0;
+    }
+    return nspan;
+}
+
+static void
+tree_span_or(TreeSpan *sp, ulong i, uvlong v)
+{
+    if (i == sp->w0)
+        sp->edge[0] |= v;
+    else if (i == sp->w1)
+        sp->edge[1] |= v;
+    else
+        sp->l[i] |= v;
+}
+
+static void
+tree_span_put(TreeSpan *sp, ulong k, tree t)
+{
+    uvlong v;
+    ulong o;
+    int b, w;
+
+    if (sp->n == 1)
+        return;
+    w = 2 * sp->n - 2;
+    v = (t >> 1) & ((1ULL << w) - 1);
+    o = k * w;
+    b = o % 64;
+    tree_span_or(sp, o / 64, v << b);
+    if (b + w > 64)
+        tree_span_or(sp, o / 64 + 1, v >> (64 - b));
+}
+
+static void
+tree_span_fill(TreeSpan *sp)
+{
+    TreeIter it;
+    tree t;
+    ulong k;
+
+    tree_iter_init(&it, sp->n, rooted_trees.level);
+    it.sl = sp->sl;
+    it.pos = sp->pos;
+    for (k = sp->k0; k < sp->k1 && tree_iter_next(&it, &t); k++)
+        tree_span_put(sp, k, t);
+}
+
+static void
+tree_span_proc(void *a)
+{
+    tree_span_fill(a);
+    if (_xdec(&rooted_trees.pending) == 0)
+        wakeup(&rooted_trees.done);
+    pexit("", 1);
+}
+
+static int
+tree_spans_done(void*)
+{
+    return rooted_trees.pending == 0;
+}
+
+// Fill the n-node level l, split over up to conf.nmach kprocs
+static void
+generate_level(uint n, uvlong *l)
+{
+    TreeSpan sp[RTspans];
+    int i, nspan;
+
+    nspan = a000081[n] / RTspanmin;
+    if (nspan > conf.nmach)
+        nspan = conf.nmach;
+    if (nspan > RTspans)
+        nspan = RTspans;
+    if (nspan < 1 || up == nil)
+        nspan = 1;
+    nspan = tree_spans(sp, nspan, n, l);
+    rooted_trees.pending = nspan - 1;
+    coherence();
+    for (i = 1; i < nspan; i++)
+        kproc("treegen", tree_span_proc, &sp[i]);
+    tree_span_fill(&sp[0]);
+    while (waserror())
+        ;  // The spans are still writing into l; wait them out regardless
+    while (rooted_trees.pending > 0)
+        sleep(&rooted_trees.done, tree_spans_done, nil);
+    poperror();
+    for (i = 0; i < nspan; i++) {
+        l[sp[i].w0] |= sp[i].edge[0];
+        if (sp[i].w1 != sp[i].w0)
+            l[sp[i].w1] |= sp[i].edge[1];
+    }
+}
+
+static void
+generate_trees(uint n)
+{
+    uvlong *l;
+
+    if (n > MAXSTORED)
+        n = MAXSTORED;
+    if (n <= rooted_trees.max_n)
+        return;  // Already generated
+    
+    qlock(&rooted_trees);
+    forests_init();
+    for (uint i = rooted_trees.max_n + 1; i <= n; i++) {
+        l = malloc(tree_level_words(i) * sizeof(uvlong));
+        if (l == nil) {
+            print("rooted_trees: no memory for %ud-trees\n", i);
+            break;
+        }
+        generate_level(i, l);
+        rooted_trees.level[i] = l;
+        rooted_trees.list_size += a000081[i];
+        coherence();
+        rooted_trees.max_n = i;
+    }
+    qunlock(&rooted_trees);
+}
+
+/*
+ * Succinct navigation.  A stored tree's parentheses fit one word, so
+ * rank is a popcount, select and the matching of a parenthesis scan
+ * at most that word, and every move costs O(1) without building the
+ * tree.  Nodes are named by preorder number, 0 being the root; a node
+ * is the position of its '(' and its number is the rank of that.
+ */
+static int
+tree_popcount(uvlong v)
+{
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (v * 0x0101010101010101ULL) >> 56;
+}
+
+// Preorder number of the node opening at x
+static int
+tree_rank(tree t, int x)
+{
+    return tree_popcount(t & ((1ULL << x) - 1));
+}
+
+// Position of the '(' of preorder node i; -1 if there is none
+static int
+tree_select(tree t, int i, int n)
+{
+    int x;
+
+    for (x = 0; x < 2 * n; x++)
+        if ((t >> x & 1) && i-- == 0)
+            return x;
+    return -1;
+}
+
+// Position of the ')' matching the '(' at x
+static int
+tree_findclose(tree t, int x)
+{
+    int e;
+
+    for (e = 0;; x++) {
+        e += (t >> x & 1) ? 1 : -1;
+        if (e == 0)
+            return x;
+    }
+}
+
+// Position of the '(' of the node enclosing the one at x
+static int
+tree_enclose(tree t, int x)
+{
+    int e;
+
+    for (e = 0; --x >= 0;) {
+        e += (t >> x & 1) ? 1 : -1;
+        if (e == 1)
+            return x;
+    }
+    return -1;
+}
+
+/*
+ * Move from preorder node of tree k of size n to its parent,
+ * first child or next sibling; -1 if there is none.
+ */
+int
+rooted_tree_move(uint n, ulong k, int node, int move)
+{
+    tree t;
+    int x, y;
+
+    if (n < 1 || n > MAXSTORED || node < 0 || node >= n)
+        return -1;
+    generate_trees(n);
+    if (rooted_trees.max_n < n || k >= a000081[n])
+        return -1;
+    t = tree_level_get(rooted_trees.level, n, k);
+    x = tree_select(t, node, n);
+    switch (move) {
+    case RTparent:
+        y = tree_enclose(t, x);
+        break;
+    case RTchild:
+        y = (t >> (x + 1) & 1) ? x + 1 : -1;
+        break;
+    case RTsibling:
+        y = tree_findclose(t, x) + 1;
+        if (y >= 2 * n || (t >> y & 1) == 0)
+            y = -1;
+        break;
+    default:
+        y = -1;
+        break;
+    }
+    return y < 0 ? -1 : tree_rank(t, y);
+}
+
+// Start iterating over the trees of n nodes; -1 if n is out of range
+static int
+tree_iter_start(TreeIter *it, uint n)
+{
+    if (n < 1 || n > MAXN)
+        return -1;
+    generate_trees(n - 1);
+    if (rooted_trees.max_n < n - 1)
+        return -1;
+    tree_iter_init(it, n, rooted_trees.level);
+    return 0;
+}
+
+/*
+ * Tree to String Conversion
+ */
+
+/*
+ * The conversions write into the caller's buffer in the manner of
+ * seprint: they stop at e, always leave buf terminated and return
+ * the end of what they wrote, so bulk callers need not allocate.
+ */
+// Namespace path of a tree: "(()())" under domain is "/domain/shell0/shell1/shell2"
+static char*
+tree_path_seprint(char *buf, char *e, char *parens, char *domain)
+{
+    int shell_num;
+
+    buf = seprint(buf, e, "/%s", domain);
+    for (shell_num = 0; *parens != '\0'; parens++)
+        if (*parens == '(')
+            buf = seprint(buf, e, "/shell%d", shell_num++);
+    return buf;
+}
+
+// Bytes tree_path_seprint writes, less the terminator
+static int
+tree_path_len(char *parens, char *domain)
+{
+    int len, shell_num, d;
+
+    len = 1 + strlen(domain);
+    for (shell_num = 0; *parens != '\0'; parens++)
+        if (*parens == '(') {
+            len += 7;  // "/shell" and a digit
+            for (d = shell_num++; d >= 10; d /= 10)
+                len++;
+        }
+    return len;
+}
+
+// d = d<<k | s; -1 if the result doesn't fit
+static int
+treebits_shl_or(TreeBits *d, int k, TreeBits *s)
+{
+    int i, wk, bk;
+
+    if (k < 0 || d->nbits + k > Ntreewords*64 || s->nbits > k)
+        return -1;
+    wk = k / 64;
+    bk = k % 64;
+    for (i = Ntreewords - 1; i >= 0; i--) {
+        d->w[i] = i >= wk ? d->w[i - wk] << bk : 0;
+        if (bk != 0 && i > wk)
+            d->w[i] |= d->w[i - wk - 1] >> (64 - bk);
+    }
+    for (i = 0; i < Ntreewords; i++)
+        d->w[i] |= s->w[i];
+    d->nbits += k;
+    return 0;
+}
+
+// Bit-encode a parens string; -1 if it is too long
+static int
+parens_to_treebits(char *parens, TreeBits *b)
+{
+    TreeBits bit;
+    int i;
+
+    memset(b, 0, sizeof *b);
+    memset(&bit, 0, sizeof bit);
+    bit.nbits = 1;
+    for (i = strlen(parens) - 1; i >= 0; i--) {
+        bit.w[0] = parens[i] == '(';
+        if (treebits_shl_or(b, 1, &bit) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static char*
+treebits_to_parens(TreeBits *b)
+{
+    char *buf;
+    int i;
+
+    buf = malloc(b->nbits + 1);
+    if (buf == nil)
+        return nil;
+    for (i = 0; i < b->nbits; i++)
+        buf[i] = (b->w[i/64] >> (i%64)) & 1 ? '(' : ')';
+    buf[i] = '\0';
+    return buf;
+}
+
+/*
+ * Rooted Tree Structure Functions
+ */
+
+static void compute_matula_number(RootedTree*);
+
+static RootedTree*
+create_rooted_tree(tree binary_rep, uint node_count)
+{
+    RootedTree *rt;
+    
+    // The parens live in the same allocation, after the tree
+    rt = malloc(sizeof(RootedTree) + 2 * node_count + 1);
+    if (rt == nil)
+        return nil;
+    
+    rt->binary_rep = binary_rep;
+    rt->wide_rep = nil;
+    rt->node_count = node_count;
+    rt->parens_notation = (char*)(rt + 1);
+    tree_parens_seprint(rt->parens_notation, rt->parens_notation + 2 * node_count + 1,
+                        binary_rep, node_count);
+    rt->namespace_path = nil;  // Set later
+    rt->depth = 0;  // Calculate later
+    rt->subtrees = nil;
+    rt->subtree_count = 0;
+    rt->matula_number = 0;  // Calculate later
+    
+    // Compute Matula number
+    compute_matula_number(rt);
+    
+    return rt;
+}
+
+static void
+free_rooted_tree(RootedTree *rt)
+{
+    free(rt->wide_rep);
+    free(rt->namespace_path);
+    free(rt->matula_big);
+    free(rt);
+}
+
+RootedTree*
+create_rooted_tree_from_parens(char *parens)
+{
+    RootedTree *rt;
+    TreeBits bits;
+    int node_count, depth, d;
+    char *s;
+    
+    node_count = 0;
+    depth = 0;
+    d = 0;
+    for (s = parens; *s != '\0'; s++) {
+        if (*s == '(') {
+            node_count++;
+            if (++d > depth)
+                depth = d;
+        } else if (*s == ')')
+            d--;
+    }
+    if (node_count > Ntreemax || parens_to_treebits(parens, &bits) < 0)
+        return nil;
+    
+    rt = malloc(sizeof(RootedTree) + strlen(parens) + 1);
+    if (rt == nil)
+        return nil;
+    
+    // Small trees keep the single-word encoding
+    rt->wide_rep = nil;
+    rt->binary_rep = node_count <= Ntreefast ? bits.w[0] : 0;
+    if (node_count > Ntreefast) {
+        rt->wide_rep = malloc(sizeof(TreeBits));
+        if (rt->wide_rep == nil) {
+            free(rt);
+            return nil;
+        }
+        *rt->wide_rep = bits;
+    }
+    rt->node_count = node_count;
+    rt->parens_notation = strcpy((char*)(rt + 1), parens);
+    rt->namespace_path = nil;
+    rt->depth = depth;
+    rt->subtrees = nil;
+    rt->subtree_count = 0;
+    
+    // Compute Matula number from parentheses
+    compute_matula_number(rt);
+    
+    return rt;
+}
+
+/*
+ * Interned trees.
+ *
+ * Views that only need the shape of a tree, like the ESN forest,
+ * share one immutable RootedTree per Matula number instead of
+ * building their own.  Interned trees are never freed, so a
+ * reference stays good for the life of the kernel; the table is
+ * open-addressed on the Matula number and bounded to small shapes.
+ */
+enum {
+    Ninterned = 64,               // Interned tree slots, a power of two
+};
+
+static struct {
+    Lock;
+    RootedTree *slot[Ninterned];
+} tree_interned;
+
+// Shared tree for matula, nil if it is too big or the table is full
+RootedTree*
+rooted_tree_intern(uvlong matula)
+{
+    RootedTree *rt, *t;
+    char buf[Nmatulacachelen + 1];
+    int i, h, n;
+
+    if (matula == 0)
+        return nil;
+    h = matula & (Ninterned - 1);
+    lock(&tree_interned);
+    for (i = 0; i < Ninterned; i++) {
+        rt = tree_interned.slot[(h + i) & (Ninterned - 1)];
+        if (rt == nil || rt->matula_number == matula)
+            break;
+    }
+    unlock(&tree_interned);
+    if (i == Ninterned)
+        return nil;
+    if (rt != nil)
+        return rt;
+
+    // Build outside the lock and keep whichever copy lands first
+    n = matula_subtree(matula, buf, Nmatulacachelen);
+    if (n < 0)
+        return nil;
+    buf[n] = '\0';
+    t = create_rooted_tree_from_parens(buf);
+    if (t == nil)
+        return nil;
+    lock(&tree_interned);
+    for (i = 0; i < Ninterned; i++) {
+        rt = tree_interned.slot[(h + i) & (Ninterned - 1)];
+        if (rt == nil) {
+            tree_interned.slot[(h + i) & (Ninterned - 1)] = t;
+            rt = t;
+            t = nil;
+            break;
+        }
+        if (rt->matula_number == matula)
+            break;
+    }
+    unlock(&tree_interned);
+    if (t != nil)
+        free_rooted_tree(t);
+    return i < Ninterned ? rt : nil;
+}
+
+// Whether two trees have the same Matula number
+int
+matula_equal(RootedTree *a, RootedTree *b)
+{
+    MatulaBig *x, *y;
+
+    if (a->matula_hash != b->matula_hash)
+        return 0;
+    x = a->matula_big;
+    y = b->matula_big;
+    if (x == nil || y == nil)
+        return x == y;
+    return x->n == y->n && memcmp(x->limb, y->limb, x->n * sizeof(u32int)) == 0;
+}
+
+// Compute Matula number for a rooted tree structure
+static void
+compute_matula_number(RootedTree *rt)
+{
+    if (rt == nil)
+        return;
+    
+    rt->matula_big = nil;
+    rt->matula_number = parens_to_matula(rt->parens_notation);
+    rt->matula_hash = rt->matula_number;
+    if (rt->matula_number == 0) {
+        // Too wide for 64 bits, or not a tree at all
+        rt->matula_big = parens_to_matula_big(rt->parens_notation);
+        if (rt->matula_big != nil)
+            rt->matula_hash = matula_big_hash(rt->matula_big);
+    }
+}
+
+/*
+ * Rooted Shell Functions
+ *
+ * A domain holds at most one shell per tree shape.  Shells are
+ * indexed by domain and canonical Matula number, whose hash is the
+ * number itself or a digest of the exact value for trees beyond 64
+ * bits, so finding an isomorphic shell is an O(1) probe plus
+ * matula_equal rather than a comparison of parentheses.  The index
+ * doubles when it averages two shells per chain.
+ */
+enum {
+    Nshindex = 256,               // Initial index chains
+};
+
+// Trees whose Matula number could not be computed are never indexed
+static int
+shell_indexable(RootedTree *rt)
+{
+    return rt->matula_number != 0 || rt->matula_big != nil;
+}
+
+static ulong
+shell_index_hash(char *domain, RootedTree *rt)
+{
+    return (cognitive_hash(domain, ~0UL) * 0x9E3779B1UL) ^ (ulong)rt->matula_hash ^ (ulong)(rt->matula_hash >> 32);
+}
+
+// Called with cognitive_state locked
+static RootedShell*
+shell_index_find(char *domain, RootedTree *rt)
+{
+    RootedShell *shell;
+    
+    if (cognitive_state.nshindex == 0 || !shell_indexable(rt))
+        return nil;
+    shell = cognitive_state.shindex[shell_index_hash(domain, rt) & (cognitive_state.nshindex - 1)];
+    for (; shell != nil; shell = shell->index_next)
+        if (matula_equal(shell->tree_structure, rt) && strcmp(shell->domain, domain) == 0)
+            return shell;
+    return nil;
+}
+
+// Called with cognitive_state locked; the shell stays unindexed if memory runs out
+static void
+shell_index_add(RootedShell *shell)
+{
+    RootedShell **tab, *s, *next;
+    ulong i, n, h;
+    
+    if (!shell_indexable(shell->tree_structure))
+        return;
+    if (cognitive_state.shell_count >= 2 * cognitive_state.nshindex) {
+        n = cognitive_state.nshindex ? 2 * cognitive_state.nshindex : Nshindex;
+        tab = malloc(n * sizeof(RootedShell*));
+        if (tab != nil) {
+            for (i = 0; i < cognitive_state.nshindex; i++)
+                for (s = cognitive_state.shindex[i]; s != nil; s = next) {
+                    next = s->index_next;
+                    h = shell_index_hash(s->domain, s->tree_structure) & (n - 1);
+                    s->index_next = tab[h];
+                    tab[h] = s;
+                }
+            free(cognitive_state.shindex);
+            cognitive_state.shindex = tab;
+            cognitive_state.nshindex = n;
+        }
+    }
+    if (cognitive_state.nshindex == 0)
+        return;
+    h = shell_index_hash(shell->domain, shell->tree_structure) & (cognitive_state.nshindex - 1);
+    shell->index_next = cognitive_state.shindex[h];
+    cognitive_state.shindex[h] = shell;
+}
+
+// The shell of domain isomorphic to tree, or nil
+RootedShell*
+lookup_rooted_shell(char *domain, RootedTree *tree)
+{
+    RootedShell *shell;
+    
+    lock(&cognitive_state);
+    shell = shell_index_find(domain, tree);
+    unlock(&cognitive_state);
+    return shell;
+}
+
+// Free a shell that lost a race to be created; its tree stays with the caller
+static void
+rooted_shell_discard(RootedShell *shell)
+{
+    free_cognitive_namespace(shell->as_namespace);
+    free(shell->shell_id);
+    free(shell);
+}
+
+/*
+ * Create the shell of domain for tree_structure, which the shell
+ * takes over.  If the domain already has an isomorphic shell, that
+ * shell is returned and tree_structure is freed.  Returns nil,
+ * leaving tree_structure with the caller, on failure.
+ */
+RootedShell*
+create_rooted_shell(char *domain, RootedTree *tree_structure)
+{
+    RootedShell *shell, *old;
+    char *id, *p, *e;
+    int n;
+    
+    old = lookup_rooted_shell(domain, tree_structure);
+    if (old != nil) {
+        free_rooted_tree(tree_structure);
+        return old;
+    }
+    
+    shell = malloc(sizeof(RootedShell));
+    if (shell == nil)
+        return nil;
+    
+    // The shell's strings share one allocation owned by shell_id
+    id = smprint("shell-%s-%lud", domain, time(NULL));
+    if (id == nil) {
+        free(shell);
+        return nil;
+    }
+    n = strlen(id) + 1 + strlen(domain) + 1;
+    n += 2 * (tree_path_len(tree_structure->parens_notation, domain) + 1) + 6;
+    p = malloc(n);
+    if (p == nil) {
+        free(id);
+        free(shell);
+        return nil;
+    }
+    e = p + n;
+    shell->shell_id = p;
+    p = seprint(p, e, "%s", id) + 1;
+    free(id);
+    shell->domain = p;
+    p = seprint(p, e, "%s", domain) + 1;
+    shell->tree_structure = tree_structure;
+    
+    // Create namespace representation
+    shell->namespace_mount_point = p;
+    p = tree_path_seprint(p, e, tree_structure->parens_notation, domain) + 1;
+    shell->as_namespace = create_cognitive_namespace(shell->shell_id, shell->namespace_mount_point);
+    
+    // Create file representation
+    shell->file_path = p;
+    seprint(p, e, "%s.shell", shell->namespace_mount_point);
+    shell->file_channel = nil;  // Created on first access
+    
+    // Initialize relationships
+    shell->parent_shell = nil;
+    shell->child_shells = nil;
+    shell->child_count = 0;
+    
+    // Initialize addressing
+    shell->address_path = nil;
+    shell->path_depth = 0;
+    
+    shell->creation_time = time(NULL);
+    
+    // Initialize lock
+    lock(&shell->shell_lock);
+    unlock(&shell->shell_lock);
+    
+    // Add to global state, growing the array geometrically
+    lock(&cognitive_state);
+    old = shell_index_find(domain, tree_structure);
+    if (old != nil) {
+        unlock(&cognitive_state);
+        rooted_shell_discard(shell);
+        free_rooted_tree(tree_structure);
+        return old;
+    }
+    if (cognitive_state.shell_count == cognitive_state.shell_cap) {
+        int n = cognitive_state.shell_cap ? cognitive_state.shell_cap * 2 : 64;
+        RootedShell **new_shells = realloc(cognitive_state.shells, n * sizeof(RootedShell*));
+        if (new_shells == nil) {
+            print("create_rooted_shell: failed to expand shells array\n");
+            unlock(&cognitive_state);
+            // Note: shell is still partially created, caller should handle
+            return shell;
+        }
+        cognitive_state.shells = new_shells;
+        cognitive_state.shell_cap = n;
+    }
+    cognitive_state.shells[cognitive_state.shell_count++] = shell;
+    shell_index_add(shell);
+    unlock(&cognitive_state);
+    
+    return shell;
+}
+
+RootedShell*
+create_rooted_shell_from_parens(char *domain, char *parens_notation)
+{
+    RootedTree *tree = create_rooted_tree_from_parens(parens_notation);
+    
+    if (tree == nil)
+        return nil;
+    return create_rooted_shell(domain, tree);
+}
+
+/*
+ * Shell enumeration.  enumerate_rooted_shells returns a view of
+ * every tree of up to max_size nodes rather than the shells
+ * themselves: tree number i is the i'th tree in enumeration order,
+ * smallest trees first, and a shell with its namespace is created
+ * only when a tree is first looked up, by number or by Matula
+ * number.  Materialized shells are found again through two small
+ * hash tables, so memory follows the shells actually used.
+ */
+enum {
+    Nviewhash = 64,               // Hash chains per view and key
+};
+
+struct ShellRef {
+    long index;                   // Tree number, -1 if only reached by Matula number
+    RootedShell *shell;
+    ShellRef *inext;              // Chain by tree number
+    ShellRef *mnext;              // Chain by Matula number
+};
+
+struct RootedShellView {
+    QLock;                        // Held while shells are created
+    Arena arena;                  // Holds the view and its ShellRefs
+    char *domain;
+    int max_size;
+    long count;                   // Trees in the view
+    long first[MAXN + 2];         // Number of the first tree of each size
+    ShellRef *byindex[Nviewhash];
+    ShellRef *bymatula[Nviewhash];
+    int materialized;             // Shells created through the view
+};
+
+RootedShellView*
+enumerate_rooted_shells(char *domain, int max_size)
+{
+    RootedShellView *v;
+    Arena a;
+    int n;
+    
+    if (max_size > MAXN)
+        max_size = MAXN;
+    if (max_size < 1)
+        return nil;
+    a.chunk = nil;
+    v = arena_alloc(&a, sizeof(RootedShellView));
+    if (v == nil)
+        return nil;
+    v->arena = a;
+    v->domain = arena_strdup(&v->arena, domain);
+    if (v->domain == nil) {
+        arena_free(&v->arena);
+        return nil;
+    }
+    v->max_size = max_size;
+    v->first[1] = 0;
+    for (n = 1; n <= max_size; n++)
+        v->first[n + 1] = v->first[n] + a000081[n];
+    v->count = v->first[max_size + 1];
+    return v;
+}
+
+long
+rooted_shell_view_count(RootedShellView *v)
+{
+    return v->count;
+}
+
+// Tree number index as its (tree, size); -1 if out of range
+static int
+shell_view_tree(RootedShellView *v, long index, tree *t, uint *size)
+{
+    TreeIter it;
+    long k;
+    uint n;
+    
+    if (index < 0 || index >= v->count)
+        return -1;
+    for (n = 1; index >= v->first[n + 1]; n++)
+        ;
+    k = index - v->first[n];
+    *size = n;
+    if (n <= MAXSTORED) {
+        generate_trees(n);
+        if (rooted_trees.max_n < n)
+            return -1;
+        *t = tree_level_get(rooted_trees.level, n, k);
+        return 0;
+    }
+    // The largest size is never stored; stream up to the one wanted
+    if (tree_iter_start(&it, n) < 0)
+        return -1;
+    do
+        if (!tree_iter_next(&it, t))
+            return -1;
+    while (k-- > 0);
+    return 0;
+}
+
+// Find the view's shell for rt's tree; called with v qlocked
+static ShellRef*
+shell_view_find(RootedShellView *v, RootedTree *rt)
+{
+    ShellRef *r;
+    
+    for (r = v->bymatula[rt->matula_hash % Nviewhash]; r != nil; r = r->mnext)
+        if (matula_equal(r->shell->tree_structure, rt))
+            return r;
+    return nil;
+}
+
+/*
+ * Create the shell for rt, or return the one already made for
+ * the same tree, in which case rt is freed.  Called with v qlocked.
+ */
+static ShellRef*
+shell_view_add(RootedShellView *v, RootedTree *rt)
+{
+    ShellRef *r;
+    RootedShell *shell;
+    
+    r = shell_view_find(v, rt);
+    if (r != nil) {
+        free_rooted_tree(rt);
+        return r;
+    }
+    // The domain may have the shell already; then rt is freed
+    shell = create_rooted_shell(v->domain, rt);
+    if (shell == nil) {
+        free_rooted_tree(rt);
+        return nil;
+    }
+    r = arena_alloc(&v->arena, sizeof(ShellRef));
+    if (r == nil)
+        return nil;
+    rt = shell->tree_structure;
+    r->index = -1;
+    r->shell = shell;
+    r->mnext = v->bymatula[rt->matula_hash % Nviewhash];
+    v->bymatula[rt->matula_hash % Nviewhash] = r;
+    v->materialized++;
+    return r;
+}
+
+// The shell for tree number index, created on first use
+RootedShell*
+rooted_shell_at(RootedShellView *v, long index)
+{
+    ShellRef *r;
+    RootedTree *rt;
+    tree t;
+    uint n;
+    
+    qlock(v);
+    for (r = v->byindex[index % Nviewhash]; r != nil; r = r->inext)
+        if (r->index == index) {
+            qunlock(v);
+            return r->shell;
+        }
+    r = nil;
+    if (shell_view_tree(v, index, &t, &n) == 0 && (rt = create_rooted_tree(t, n)) != nil)
+        r = shell_view_add(v, rt);
+    if (r != nil && r->index < 0) {
+        r->index = index;
+        r->inext = v->byindex[index % Nviewhash];
+        v->byindex[index % Nviewhash] = r;
+    }
+    qunlock(v);
+    return r != nil ? r->shell : nil;
+}
+
+// The shell for the tree with Matula number matula, created on first use
+RootedShell*
+rooted_shell_matula(RootedShellView *v, uvlong matula)
+{
+    ShellRef *r;
+    RootedTree *rt;
+    char *parens;
+    
+    if (matula == 0)
+        return nil;
+    qlock(v);
+    for (r = v->bymatula[matula % Nviewhash]; r != nil; r = r->mnext)
+        if (r->shell->tree_structure->matula_number == matula) {
+            qunlock(v);
+            return r->shell;
+        }
+    qunlock(v);
+    
+    parens = matula_to_parens(matula);
+    if (parens == nil)
+        return nil;
+    rt = create_rooted_tree_from_parens(parens);
+    free(parens);
+    if (rt == nil)
+        return nil;
+    if (rt->node_count > v->max_size) {
+        free_rooted_tree(rt);
+        return nil;
+    }
+    qlock(v);
+    r = shell_view_add(v, rt);
+    qunlock(v);
+    return r != nil ? r->shell : nil;
+}
+
+/*
+ * Free the view and everything it allocated in one go.  Its shells
+ * stay registered in cognitive_state like any other shell.
+ */
+void
+rooted_shell_view_free(RootedShellView *v)
+{
+    if (v != nil)
+        arena_free(&v->arena);
+}
+
+/*
+ * The Matula number of the s'th registered shell in *m, 0 if it
+ * is too large for 64 bits; -1 past the last shell.
+ */
+int
+rooted_shell_no(int s, uvlong *m)
+{
+    lock(&cognitive_state);
+    if (s < 0 || s >= cognitive_state.shell_count) {
+        unlock(&cognitive_state);
+        return -1;
+    }
+    *m = cognitive_state.shells[s]->tree_structure->matula_number;
+    unlock(&cognitive_state);
+    return 0;
+}
+
+char*
+get_shell_info(RootedShell *shell)
+{
+    char *info = malloc(2048);
+    char num[24], *big;
+    
+    big = nil;
+    if (shell->tree_structure->matula_big != nil)
+        big = matula_big_fmt(shell->tree_structure->matula_big);
+    snprint(num, sizeof num, "%llud", shell->tree_structure->matula_number);
+    snprint(info, 2048,
+            "Shell ID: %s\n"
+            "Domain: %s\n"
+            "Tree Structure: %s\n"
+            "Matula Number: %s\n"
+            "Node Count: %d\n"
+            "Namespace: %s\n"
+            "File Path: %s\n"
+            "Creation: %lud\n",
+            shell->shell_id,
+            shell->domain,
+            shell->tree_structure->parens_notation,
+            big != nil ? big : num,
+            shell->tree_structure->node_count,
+            shell->namespace_mount_point,
+            shell->file_path,
+            shell->creation_time);
+    free(big);
+    
+    return info;
+}
+
+void
+print_rooted_tree_stats(void)
+{
+    ulong hits, misses;
+    uvlong sieved;
+    long nprimes;
+
+    print("Rooted Tree Statistics:\n");
+    print("  Max tree size generated: %d\n", rooted_trees.max_n);
+    print("  Total trees stored: %d\n", rooted_trees.list_size);
+    
+    for (int n = 1; n <= rooted_trees.max_n; n++)
+        print("  %d-trees: %lud\n", n, a000081[n]);
+    
+    print("  Active shells: %d\n", cognitive_state.shell_count);
+    matula_cache_stats(&hits, &misses);
+    print("  Matula cache: %lud hits, %lud misses\n", hits, misses);
+    prime_table_stats(&nprimes, &sieved);
+    print("  Prime table: %ld primes, sieved to %llud\n", nprimes, sieved);
+}
+
+/*
+ * List trees with their Matula numbers
+ * Returns a formatted string showing tree structures and encodings
+ */
+char*
+list_trees_with_matula(int max_size)
+{
+    TreeIter it;
+    RootedTree rt;
+    char parens[2 * MAXN + 1];
+    tree t;
+    
+    if (max_size > MAXN)
+        max_size = MAXN;
+    
+    // Allocate buffer for output
+    char *output = malloc(8192);
+    if (output == nil)
+        return nil;
+    
+    int pos = 0;
+    pos += snprint(output + pos, 8192 - pos, 
+                   "Rooted Trees with Matula Numbers\n");
+    pos += snprint(output + pos, 8192 - pos, 
+                   "================================\n\n");
+    pos += snprint(output + pos, 8192 - pos,
+                   "Size  Tree              Matula  Factorization\n");
+    pos += snprint(output + pos, 8192 - pos,
+                   "----  ---------------   ------  -------------\n");
+    
+    for (int n = 1; n <= max_size && pos < 8000; n++) {
+        if (tree_iter_start(&it, n) < 0)
+            break;
+        while (pos < 8000 && tree_iter_next(&it, &t)) {
+            // A scratch tree on the stack; only the Matula number is needed
+            memset(&rt, 0, sizeof rt);
+            rt.binary_rep = t;
+            rt.node_count = n;
+            rt.parens_notation = parens;
+            tree_parens_seprint(parens, parens + sizeof parens, t, n);
+            compute_matula_number(&rt);
+            pos += snprint(output + pos, 8192 - pos,
+                          " %2d   %-15s  %6llud\n",
+                          n, rt.parens_notation, rt.matula_number);
+            free(rt.matula_big);
+        }
+    }
+    
+    return output;
+}
+
+/*
+ * Demo Function - Traffic-Energy Coordination Example
+ */
+
+void
+demo_traffic_energy_coordination(void)
+{
+    CognitiveNamespace *transportation, *energy;
+    NeuralChannel *coord_channel;
+    NeuralMessage *traffic_msg, *energy_msg;
+    char *domains[2] = {"transportation", "energy"};
+    float significance;
+    
+    print("Demonstrating traffic-energy coordination...\n");
+    
+    // Get namespaces, creating them if the domains were never set up
+    transportation = lookup_cognitive_namespace("transportation");
+    if (transportation == nil)
+        transportation = create_cognitive_namespace("transportation", 
+                                                   "/cognitive-cities/domains/transportation");
+    energy = lookup_cognitive_namespace("energy");
+    if (energy == nil)
+        energy = create_cognitive_namespace("energy", 
+                                           "/cognitive-cities/domains/energy");
+    
+    // Create coordination channel
+    coord_channel = create_neural_channel("transportation", "energy", 1000);
+    
+    // Simulate traffic optimization request
+    traffic_msg = neural_message_alloc("transportation", "energy",
+                                       "OPTIMIZE_TRAFFIC_FOR_ENERGY_EFFICIENCY", 39);
+    traffic_msg->type = Tneural;
+    traffic_msg->cognitive_priority = 80; // High priority
+    traffic_msg->confidence_level = 0.9;
+    
+    // Send message
+    send_neural_message(coord_channel, traffic_msg);
+    
+    // Simulate energy response
+    energy_msg = receive_neural_message(coord_channel);
+    if (energy_msg != nil) {
+        print("Energy domain received traffic optimization request\n");
+        print("Coordinating energy grid with traffic patterns...\n");
+        
+        // Detect emergent coordination pattern
+        significance = detect_emergent_pattern("traffic-energy-synchronization", 
+                                               domains, 2);
+        
+        print("Emergent pattern detected: traffic-energy-synchronization\n");
+        print("Significance score: %.2f\n", significance);
+    }
+    
+    print("Traffic-energy coordination demo completed\n");
+}
+
+/*
+ * ═══════════════════════════════════════════════════════════════════════
+ * ECHO STATE NETWORK (ESN) IMPLEMENTATION
+ * ═══════════════════════════════════════════════════════════════════════
+ * 
+ * An Echo State Network (ESN) is the bridge structure that unifies all
+ * parallel cognitive frameworks in this system:
+ * 
+ * 1. Dyck/Parentheses Grammar   - ESN as continuously rewritten expressions
+ * 2. Rooted Trees                - ESN as dynamic forest with grafting
+ * 3. Matula Numbers              - ESN state as evolving integer factorization
+ * 4. Membrane Systems            - ESN as echo-multiset network with decay
+ * 5. Hypergraphs                 - ESN as weighted hypergraph automaton
+ * 6. Multiplicative RNN          - ESN as prime-exponent flow field
+ * 7. Statistical Physics         - ESN as deterministic microstate ensemble
+ * 8. Quantum-like Dynamics       - ESN as mixed prime-mode superposition
+ * 
+ * The ESN provides a fixed reservoir with rich recurrent dynamics where:
+ * - State evolves as: x(t+1) = f(W·x(t) + W_in·u(t))
+ * - W = sparse, random, stable reservoir matrix (spectral radius < 1)
+ * - Reservoir echoes input history through decaying activations
+ * - Only readout layer is trained; reservoir structure is fixed
+ */
+
+/*
+ * ESN Data Structures
+ */
+
+// Primes the ESN state encoding is spread over
+#define NPRIMES 100
+
+typedef struct ReservoirNode ReservoirNode;
+typedef struct ReservoirConnection ReservoirConnection;
+typedef struct ESNState ESNState;
+typedef struct ESNHistory ESNHistory;
+typedef struct ESNHypergraph ESNHypergraph;
+typedef struct ESNWeights ESNWeights;
+typedef struct ESNKernel ESNKernel;
+
+// A single neuron/node in the reservoir
+struct ReservoirNode {
+    int node_id;                      // Unique node identifier
+    float activation;                 // Current activation value
+    float bias;                       // Node bias
+    
+    // Matula representation: node as prime
+    uvlong prime_index;               // This node's prime index
+    
+    // Rooted tree representation: node as tree
+    RootedTree *tree_structure;       // Node's structural identity
+    
+    // Membrane representation: node as membrane region
+    char *membrane_id;                // Membrane identifier
+    int object_count;                 // Multiset object count
+    float decay_rate;                 // Echo decay rate (spectral radius)
+    
+    ReservoirConnection **incoming;   // Incoming connections
+    int incoming_count;
+    ReservoirConnection **outgoing;   // Outgoing connections  
+    int outgoing_count;
+};
+
+// Connection between reservoir nodes (hyperedge)
+struct ReservoirConnection {
+    int connection_id;
+    ReservoirNode *source;
+    ReservoirNode *target;
+    float weight;                     // Connection weight
+    
+    // Hypergraph representation
+    int hyperedge_id;                 // Part of which hyperedge
+    ReservoirNode **hyperedge_nodes;  // All nodes in this hyperedge
+    int hyperedge_size;
+};
+
+// Complete ESN state at time t
+struct ESNState {
+    uvlong matula_encoding;           // State as single Matula number, or its digest
+    MatulaBig *matula_big;            // Exact encoding once it exceeds 64 bits
+    float *activations;               // State as activation vector
+    int reservoir_size;
+    
+    // Dyck grammar representation: stack profile
+    char *dyck_expression;            // Current parentheses configuration
+    int stack_depth;                  // Current nesting depth
+    
+    // Rooted tree representation: forest configuration
+    RootedTree **forest;              // Dynamic forest of trees
+    int forest_size;
+    
+    // Membrane representation: multiset configuration
+    int *multisets;                   // Object counts per membrane
+    int membrane_count;
+    
+    time_t timestamp;                 // When this state occurred
+    ESNState *previous;               // Previous state for history
+    MatulaBig *bigbuf;                // Storage matula_big points into
+};
+
+/*
+ * Matula history as a delta stream.  Each step appends one record,
+ * a varint count of changed nodes and then, per change, a varint of
+ * the node's distance from the previous change shifted left 2 over
+ * its new level.  The first record of a chunk is against all-zero
+ * levels, so a chunk replays on its own and the oldest can be dropped.
+ */
+enum {
+    ESNhistchunk = 4096,              // Bytes per history chunk
+    ESNhistchunks = 64,               // Chunks kept before the oldest is reused
+    ESNhistrec = 1 + 2*NPRIMES,       // Longest record
+};
+
+struct ESNHistory {
+    ESNHistory *next;
+    long first;                       // Step of the first record
+    int nrec;
+    int len;
+    uchar data[ESNhistchunk];
+};
+
+/*
+ * Weights shared by a reservoir and its clones, see esn_clone.  W and
+ * W_input never change once drawn; a network about to train its
+ * readout takes a private W_output first.
+ */
+struct ESNWeights {
+    Ref;
+    int *W_rowptr;
+    int *W_col;
+    float *W_val;
+    float *W_input;
+    float *W_output;
+};
+
+// Complete Echo State Network
+struct EchoStateNetwork {
+    char *esn_id;                     // Network identifier
+    int reservoir_size;               // Number of reservoir nodes
+    float spectral_radius;            // Max eigenvalue (controls echo)
+    float input_scaling;              // Input weight scaling
+    float leak_rate;                  // Leak rate (1.0 = no leak)
+    float sparsity;                   // Fraction of each row of W connected
+    
+    ReservoirNode **nodes;            // All reservoir nodes
+    ReservoirNode *nodeblock;         // A clone's nodes, in one allocation
+    int clone;                        // Made by esn_clone
+    RootedTree **forest;              // Forest view, interned trees
+    int forest_size;
+    
+    // Reservoir recurrent weights in compressed sparse rows: row i
+    // is entries W_rowptr[i] to W_rowptr[i+1]-1 of W_col and W_val
+    int *W_rowptr;
+    int *W_col;                       // Column of each entry
+    float *W_val;                     // Weight of each entry
+    int W_nnz;                        // Entries in use
+    
+    // Dense weight matrices, row-major with rows padded to ESNalign bytes
+    float *W_input;                   // Input weights
+    float *W_output;                  // Output/readout weights (trained)
+    int ld_reservoir;                 // Row stride of W_output
+    int ld_input;                     // Row stride of W_input
+    ESNWeights *weights;              // Owner of the arrays once cloned, else nil
+    
+    int input_dim;                    // Input dimensionality
+    int output_dim;                   // Output dimensionality
+    
+    // Current state, the newest of a ring of ring_depth preallocated
+    // states; previous links run back through the ring_count retained
+    ESNState *current_state;
+    ESNState *ring;
+    int ring_depth;
+    int ring_head;                    // Index of current_state
+    int ring_count;
+    
+    // Matula encoding kept incrementally: levels[i] is node i's
+    // exponent in matula_acc, which is exact unless !matula_valid
+    uchar levels[NPRIMES];
+    MatulaBig matula_acc;
+    int matula_valid;
+    
+    // Matula evolution history, oldest chunk first
+    ESNHistory *history;
+    ESNHistory *history_tail;
+    int history_chunks;
+    long history_size;                // Steps recorded
+    
+    // Framework-specific representations
+    char *dyck_grammar;               // Rewriting rules for parentheses
+    ESNHypergraph *hypergraph;        // W as incidence lists, see esn_set_hyper
+    int hyper;                        // Step by propagating along hypergraph
+    void *membrane_system;            // P-System configuration
+    
+    int workers;                      // CPUs to split a step over, see esn_set_workers
+    ESNKernel *kern;                  // Stepping specialized for this size, or nil
+    
+    // Fixed-point stepping, see esn_set_fixed
+    int fixed;
+    int wshift;                       // Fraction bits of Wq_val and Wq_input
+    short *Wq_val;                    // W_val in Q(wshift)
+    short *Wq_input;                  // W_input in Q(wshift), ld_input stride
+    int *bias_q;                      // Node biases in Q(wshift+15)
+    short *xq;                        // Current activations in Q15
+    short *xq_next;                   // Activations being computed
+    short *uq;                        // Step input in Q15
+    int leak_q;                       // leak_rate in Q15
+    
+    // Readout training, see esn_train_begin
+    double *train_xtx;                // Sum of x·xᵀ, upper triangle, n x n
+    double *train_xty;                // Sum of x·yᵀ, n x output_dim
+    float train_ridge;                // Regularization added to the diagonal
+    long train_samples;
+    
+    QLock ctl_lock;                   // Serializes stepping and training from ctl
+    Lock esn_lock;                    // ESN synchronization
+    time_t creation_time;
+};
+
+/*
+ * ESN State Ring
+ *
+ * States live in a ring of ring_depth slots allocated together, with
+ * all their activation vectors in one block, so stepping the
+ * reservoir never allocates: each update writes the slot after the
+ * current one and retires the oldest.  States that must outlive the
+ * ring are copied out with esn_snapshot_state.
+ */
+enum {
+    ESNhistory = 8,                   // Default ring depth
+};
+
+static ESNState*
+esn_alloc_ring(int depth, int n)
+{
+    ESNState *ring;
+    float *act;
+    int i;
+
+    ring = malloc(depth * sizeof(ESNState));
+    act = malloc(depth * n * sizeof(float));
+    if (ring == nil || act == nil) {
+        free(ring);
+        free(act);
+        return nil;
+    }
+    for (i = 0; i < depth; i++) {
+        ring[i].activations = act + i*n;
+        ring[i].reservoir_size = n;
+        ring[i].matula_encoding = 1;
+        ring[i].matula_big = nil;
+        ring[i].bigbuf = nil;
+        ring[i].previous = nil;
+    }
+    return ring;
+}
+
+static void
+esn_free_ring(ESNState *ring, int depth)
+{
+    int i;
+
+    if (ring == nil)
+        return;
+    for (i = 0; i < depth; i++)
+        free(ring[i].bigbuf);
+    free(ring[0].activations);
+    free(ring);
+}
+
+/*
+ * Set how many states are retained, at least two so the update
+ * always reads one slot and writes another.  The current state
+ * carries over; older ones are dropped.
+ */
+int
+esn_set_history_depth(EchoStateNetwork *esn, int depth)
+{
+    ESNState *ring, *cur;
+
+    if (depth < 2)
+        depth = 2;
+    ring = esn_alloc_ring(depth, esn->reservoir_size);
+    if (ring == nil)
+        return -1;
+    cur = esn->current_state;
+    if (cur != nil) {
+        memmove(ring[0].activations, cur->activations, esn->reservoir_size * sizeof(float));
+        ring[0].matula_encoding = cur->matula_encoding;
+        ring[0].timestamp = cur->timestamp;
+        if (cur->matula_big != nil && (ring[0].bigbuf = malloc(sizeof(MatulaBig))) != nil) {
+            *ring[0].bigbuf = *cur->matula_big;
+            ring[0].matula_big = ring[0].bigbuf;
+        }
+    } else
+        ring[0].timestamp = time(NULL);
+    esn_free_ring(esn->ring, esn->ring_depth);
+    esn->ring = ring;
+    esn->ring_depth = depth;
+    esn->ring_head = 0;
+    esn->ring_count = 1;
+    esn->current_state = &ring[0];
+    return 0;
+}
+
+// Malloced copy of the state age steps back (0 is current); nil if no longer retained
+ESNState*
+esn_snapshot_state(EchoStateNetwork *esn, int age)
+{
+    ESNState *st, *copy;
+
+    if (age < 0 || age >= esn->ring_count)
+        return nil;
+    st = esn->current_state;
+    while (age-- > 0)
+        st = st->previous;
+    copy = malloc(sizeof(ESNState) + esn->reservoir_size * sizeof(float));
+    if (copy == nil)
+        return nil;
+    *copy = *st;
+    copy->activations = (float*)(copy + 1);
+    memmove(copy->activations, st->activations, esn->reservoir_size * sizeof(float));
+    copy->previous = nil;
+    copy->bigbuf = nil;
+    copy->matula_big = nil;
+    if (st->matula_big != nil && (copy->bigbuf = malloc(sizeof(MatulaBig))) != nil) {
+        *copy->bigbuf = *st->matula_big;
+        copy->matula_big = copy->bigbuf;
+    }
+    return copy;
+}
+
+void
+esn_free_state(ESNState *st)
+{
+    if (st == nil)
+        return;
+    free(st->bigbuf);
+    free(st);
+}
+
+/*
+ * ESN Initialization
+ */
+
+enum {
+    ESNalign = 64,                    // Row alignment, one cache line
+    ESNmaxnnz = 1<<26,                // Most connections in W, 512MB of CSR
+};
+
+#define ESNsparsity 0.1               // Default connectivity of W
+
+#define ESNLD(n)    (((n) + ESNalign/sizeof(float) - 1) & ~(ESNalign/sizeof(float) - 1))
+
+// Contiguous rows x cols matrix with each row starting on a cache line
+static float*
+esn_matrix(int rows, int cols, int *ld)
+{
+    *ld = ESNLD(cols);
+    return mallocalign(rows * *ld * sizeof(float), ESNalign, 0, 0);
+}
+
+/*
+ * Dot product over n floats.  Four independent accumulators keep the
+ * adds out of one long dependency chain and give the compiler
+ * straight-line code it can pair up; rows are cache-line aligned so
+ * each pass over w is sequential.
+ */
+static float
+esn_dot(float *w, float *x, int n)
+{
+    float s0, s1, s2, s3;
+    int j;
+
+    s0 = s1 = s2 = s3 = 0.0;
+    for (j = 0; j + 4 <= n; j += 4) {
+        s0 += w[j] * x[j];
+        s1 += w[j+1] * x[j+1];
+        s2 += w[j+2] * x[j+2];
+        s3 += w[j+3] * x[j+3];
+    }
+    for (; j < n; j++)
+        s0 += w[j] * x[j];
+    return (s0 + s1) + (s2 + s3);
+}
+
+// Dot product of n sparse entries (w, col) with the dense vector x
+static float
+esn_spdot(float *w, int *col, float *x, int n)
+{
+    float s0, s1;
+    int k;
+
+    s0 = s1 = 0.0;
+    for (k = 0; k + 2 <= n; k += 2) {
+        s0 += w[k] * x[col[k]];
+        s1 += w[k+1] * x[col[k+1]];
+    }
+    if (k < n)
+        s0 += w[k] * x[col[k]];
+    return s0 + s1;
+}
+
+/*
+ * Size-specialized kernels.
+ *
+ * ../port/mkesnkern generates esnkern.h with, for each common
+ * reservoir size n, a step with all d = n·ESNsparsity connections of
+ * a row written out and a readout with a constant trip count, so
+ * neither loops over reservoir_size or row lengths at run time.  They
+ * sum in the same order as esn_rows and esn_dot and give the same
+ * results.  A reservoir takes its size's kernel when it is made, if
+ * every row of W has d connections.
+ */
+struct ESNKernel {
+    int n;                            // Reservoir size
+    int d;                            // Connections in every row
+    void (*rows)(EchoStateNetwork*, float*, float*, float*, int, int);
+    void (*output)(EchoStateNetwork*, float*);
+};
+
+#include "../port/esnkern.h"
+
+static ESNKernel*
+esn_kernel(EchoStateNetwork *esn)
+{
+    ESNKernel *k;
+    int i;
+
+    for (k = esnkernels; k < esnkernels + nelem(esnkernels); k++) {
+        if (k->n != esn->reservoir_size)
+            continue;
+        if (esn->W_rowptr == nil || esn->W_nnz != k->n * k->d)
+            return nil;
+        for (i = 0; i <= k->n; i++)
+            if (esn->W_rowptr[i] != i * k->d)
+                return nil;
+        return k;
+    }
+    return nil;
+}
+
+/*
+ * An ESN with its nodes, matrices and state allocated but no weights:
+ * create_esn draws them at random, esn_image_load copies them in.
+ */
+static EchoStateNetwork*
+esn_alloc(int reservoir_size, int input_dim, int output_dim, float spectral_radius)
+{
+    EchoStateNetwork *esn;
+    int i;
+    
+    esn = malloc(sizeof(EchoStateNetwork));
+    if (esn == nil)
+        return nil;
+        
+    esn->esn_id = smprint("esn-%lud", time(NULL));
+    esn->reservoir_size = reservoir_size;
+    esn->spectral_radius = spectral_radius;
+    esn->input_scaling = 1.0;
+    esn->leak_rate = 1.0;
+    esn->sparsity = ESNsparsity;
+    esn->input_dim = input_dim;
+    esn->output_dim = output_dim;
+    esn->workers = 1;
+    
+    // Allocate reservoir nodes and the forest view over them
+    esn->nodes = malloc(reservoir_size * sizeof(ReservoirNode*));
+    esn->forest = malloc(reservoir_size * sizeof(RootedTree*));
+    for (i = 0; i < reservoir_size; i++) {
+        esn->nodes[i] = malloc(sizeof(ReservoirNode));
+        esn->nodes[i]->node_id = i;
+        esn->nodes[i]->activation = 0.0;
+        esn->nodes[i]->bias = 0.0;
+        esn->nodes[i]->prime_index = nth_prime(i + 1);
+        esn->nodes[i]->decay_rate = spectral_radius;
+        esn->nodes[i]->membrane_id = smprint("m%d", i);
+        esn->nodes[i]->object_count = 0;
+        esn->nodes[i]->incoming_count = 0;
+        esn->nodes[i]->outgoing_count = 0;
+    }
+    
+    // Allocate weight matrices
+    esn->W_input = esn_matrix(reservoir_size, input_dim, &esn->ld_input);
+    esn->W_output = esn_matrix(output_dim, reservoir_size, &esn->ld_reservoir);
+    if (esn->W_output != nil)
+        memset(esn->W_output, 0, output_dim * esn->ld_reservoir * sizeof(float));
+    esn->train_xtx = nil;
+    esn->train_xty = nil;
+    esn->train_samples = 0;
+    
+    esn->W_rowptr = nil;
+    esn->W_col = nil;
+    esn->W_val = nil;
+    esn->W_nnz = 0;
+    
+    // Initialize state
+    esn->ring = nil;
+    esn->current_state = nil;
+    if (esn_set_history_depth(esn, ESNhistory) < 0)
+        return nil;
+    
+    // Levels start at zero, so the encoding starts at 1
+    memset(esn->levels, 0, sizeof esn->levels);
+    matula_big_set(&esn->matula_acc, 1);
+    esn->matula_valid = 1;
+    esn->history = nil;
+    esn->history_tail = nil;
+    esn->history_chunks = 0;
+    esn->history_size = 0;
+    
+    esn->creation_time = time(NULL);
+    
+    return esn;
+}
+
+// A reservoir with each row of W connected to sparsity*reservoir_size nodes
+static EchoStateNetwork*
+esn_create(int reservoir_size, int input_dim, int output_dim, float spectral_radius, float sparsity)
+{
+    EchoStateNetwork *esn;
+    int i, j;
+    
+    esn = esn_alloc(reservoir_size, input_dim, output_dim, spectral_radius);
+    if (esn == nil)
+        return nil;
+    esn->sparsity = sparsity;
+    for (i = 0; i < reservoir_size; i++)
+        esn->nodes[i]->bias = (frand() - 0.5) * 0.1;
+    
+    // Initialize reservoir weights (sparse random)
+    esn_init_reservoir_weights(esn);
+    
+    // Initialize input weights (random)
+    for (i = 0; i < reservoir_size; i++) {
+        for (j = 0; j < input_dim; j++) {
+            esn->W_input[i*esn->ld_input + j] = (frand() - 0.5) * 2.0 * esn->input_scaling;
+        }
+    }
+    esn->kern = esn_kernel(esn);
+    
+    return esn;
+}
+
+EchoStateNetwork*
+create_esn(int reservoir_size, int input_dim, int output_dim, float spectral_radius)
+{
+    return esn_create(reservoir_size, input_dim, output_dim, spectral_radius, ESNsparsity);
+}
+
+/*
+ * Initialize reservoir weights with sparse random connectivity
+ * Scale to desired spectral radius
+ *
+ * The weights go straight into CSR form.  Each row gets one
+ * connection at a random column within each of sparsity*n equal
+ * bins, so rows come out sorted and building the reservoir costs
+ * time in proportion to its connections, not reservoir_size squared.
+ * A W of more than ESNmaxnnz connections is not built.
+ */
+void
+esn_init_reservoir_weights(EchoStateNetwork *esn)
+{
+    int i, j, k, b, n, d, lo, hi;
+    float sum, scale, row_sum;
+    
+    n = esn->reservoir_size;
+    d = n * esn->sparsity;
+    if (d < 1)
+        d = 1;
+    if (d > n)
+        d = n;
+    free(esn->W_rowptr);
+    free(esn->W_col);
+    free(esn->W_val);
+    esn->W_rowptr = malloc((n + 1) * sizeof(int));
+    esn->W_col = nil;
+    esn->W_val = nil;
+    if ((vlong)n * d <= ESNmaxnnz) {
+        esn->W_col = malloc(n * d * sizeof(int));
+        esn->W_val = malloc(n * d * sizeof(float));
+    }
+    esn->W_nnz = 0;
+    if (esn->W_rowptr == nil || esn->W_col == nil || esn->W_val == nil) {
+        // An unconnected reservoir rather than a half-built one
+        free(esn->W_col);
+        free(esn->W_val);
+        esn->W_col = nil;
+        esn->W_val = nil;
+        if (esn->W_rowptr != nil)
+            memset(esn->W_rowptr, 0, (n + 1) * sizeof(int));
+        return;
+    }
+    
+    // Create sparse random weights
+    k = 0;
+    for (i = 0; i < n; i++) {
+        esn->W_rowptr[i] = k;
+        for (b = 0; b < d; b++) {
+            lo = (vlong)b * n / d;
+            hi = (vlong)(b + 1) * n / d;
+            j = lo + (int)(frand() * (hi - lo));
+            if (j >= hi)
+                j = hi - 1;
+            esn->W_col[k] = j;
+            esn->W_val[k] = (frand() - 0.5) * 2.0;
+            k++;
+        }
+    }
+    esn->W_rowptr[n] = k;
+    esn->W_nnz = k;
+    
+    // Scale to spectral radius (simplified: scale by largest row sum)
+    sum = 0.0;
+    for (i = 0; i < n; i++) {
+        row_sum = esn_dot(esn->W_val + esn->W_rowptr[i], esn->W_val + esn->W_rowptr[i], d);
+        if (row_sum > sum)
+            sum = row_sum;
+    }
+    
+    if (sum > 0.0) {
+        scale = esn->spectral_radius / sqrt(sum);
+        for (k = 0; k < esn->W_nnz; k++)
+            esn->W_val[k] *= scale;
+    }
+}
+
+/*
+ * ESN as Hypergraph
+ *
+ * Node j's outgoing weights form one hyperedge, emitted by j and
+ * delivering into every node j feeds.  The incidence is kept in CSR
+ * form both ways: edge e's members are enode[eptr[e]] to
+ * enode[eptr[e+1]-1], with their weights, and node i's incidences
+ * are npos[nptr[i]] to npos[nptr[i+1]-1], positions in the edge
+ * arrays.  Nodes that feed nothing emit no edge.
+ *
+ * Stepping with esn_set_hyper propagates signals along the edges
+ * instead of multiplying rows of W.  On one CPU every edge whose
+ * emitter is active pushes into its members and a quiet edge costs
+ * nothing; split over CPUs, each node pulls over its incidences and
+ * skips quiet emitters, so writes stay disjoint.  An emitter is quiet
+ * when |x| is under ESNquiet, below Q15 resolution, so a reservoir
+ * with sparse activity steps in time proportional to its active
+ * edges rather than all of W.
+ */
+#define ESNquiet (1.0/32768)
+
+struct ESNHypergraph {
+    int nnodes;
+    int nedges;
+    int nnz;                          // Incidences, W's entries
+    int *esrc;                        // Node emitting each edge
+    int *eptr;                        // nedges+1 starts into enode, eweight and eof
+    int *enode;                       // Members of each edge
+    float *eweight;
+    int *eof;                         // Edge holding each position
+    int *nptr;                        // nnodes+1 starts into npos
+    int *npos;                        // Each node's incidences, as positions
+    float *acc;                       // Sums pushed this step
+    int pushed;                       // acc is current
+    long active;                      // Edges that fired in the last push
+};
+
+static void
+esn_hypergraph_free(ESNHypergraph *hg)
+{
+    if (hg == nil)
+        return;
+    free(hg->esrc);
+    free(hg->eptr);
+    free(hg->enode);
+    free(hg->eweight);
+    free(hg->eof);
+    free(hg->nptr);
+    free(hg->npos);
+    free(hg->acc);
+    free(hg);
+}
+
+// Push every active edge's signal into hg->acc
+static void
+esn_hyper_push(EchoStateNetwork *esn)
+{
+    ESNHypergraph *hg;
+    float *x, v;
+    int e, k;
+    long active;
+
+    hg = esn->hypergraph;
+    x = esn->current_state->activations;
+    memset(hg->acc, 0, hg->nnodes * sizeof(float));
+    active = 0;
+    for (e = 0; e < hg->nedges; e++) {
+        v = x[hg->esrc[e]];
+        if (v < ESNquiet && v > -ESNquiet)
+            continue;
+        active++;
+        for (k = hg->eptr[e]; k < hg->eptr[e+1]; k++)
+            hg->acc[hg->enode[k]] += hg->eweight[k] * v;
+    }
+    hg->active = active;
+    hg->pushed = 1;
+}
+
+// Node i's recurrence term, pushed already or pulled over its incidences
+static float
+esn_hyper_term(EchoStateNetwork *esn, int i)
+{
+    ESNHypergraph *hg;
+    float *x, v, sum;
+    int k, pos;
+
+    hg = esn->hypergraph;
+    if (hg->pushed)
+        return hg->acc[i];
+    x = esn->current_state->activations;
+    sum = 0.0;
+    for (k = hg->nptr[i]; k < hg->nptr[i+1]; k++) {
+        pos = hg->npos[k];
+        v = x[hg->esrc[hg->eof[pos]]];
+        if (v < ESNquiet && v > -ESNquiet)
+            continue;
+        sum += hg->eweight[pos] * v;
+    }
+    return sum;
+}
+
+/*
+ * Rows lo to hi-1 of one step of the recurrence, written to
+ * new_activations.  Rows are independent, so disjoint ranges may be
+ * computed at the same time.
+ */
+static void
+esn_rows(EchoStateNetwork *esn, float *new_activations, float *input, float *inproj, int lo, int hi)
+{
+    int i;
+    float sum, old_activation;
+
+    if (esn->kern != nil && !esn->hyper) {
+        esn->kern->rows(esn, new_activations, input, inproj, lo, hi);
+        return;
+    }
+    for (i = lo; i < hi; i++) {
+        sum = esn->nodes[i]->bias;
+        
+        // Reservoir recurrence: W·x(t), over row i's connections only
+        if (esn->hyper)
+            sum += esn_hyper_term(esn, i);
+        else if (esn->W_rowptr != nil)
+            sum += esn_spdot(esn->W_val + esn->W_rowptr[i], esn->W_col + esn->W_rowptr[i],
+                             esn->current_state->activations,
+                             esn->W_rowptr[i+1] - esn->W_rowptr[i]);
+        
+        // Input: W_in·u(t)
+        if (inproj != nil)
+            sum += inproj[i];
+        else
+            sum += esn_dot(esn->W_input + i*esn->ld_input, input, esn->input_dim);
+        
+        // Apply activation function (tanh) with leak rate
+        old_activation = esn->current_state->activations[i];
+        new_activations[i] = (1.0 - esn->leak_rate) * old_activation +
+                             esn->leak_rate * tanh(sum);
+        
+        // Update node
+        esn->nodes[i]->activation = new_activations[i];
+    }
+}
+
+/*
+ * Fixed-point reservoir.
+ *
+ * Boards without an FPU (the ARM kernels fall back to softfpu) step a
+ * reservoir far faster in integers: weights in Q(wshift) shorts,
+ * activations and inputs in Q15, each row summed in a 32-bit int and
+ * passed through a table tanh.  wshift is the most fraction bits that
+ * keep the largest possible row sum in range.  Inputs are clamped to
+ * [-1, 1]; the float activations are still filled in for the readout,
+ * encodings and snapshots.
+ */
+enum {
+    ESNtanhstep = 8,                  // Table spacing is 2^-ESNtanhstep
+    ESNtanhn = 6 << ESNtanhstep,      // Entries over [0, 6); past that tanh is 1 in Q15
+};
+
+static struct {
+    Lock;
+    int ready;
+    short tab[ESNtanhn + 1];          // tanh(i·2^-ESNtanhstep) in Q15
+} esntanh;
+
+static float
+esn_abs(float v)
+{
+    return v < 0.0 ? -v : v;
+}
+
+static short
+esn_q15(float v)
+{
+    int q;
+
+    if (v >= 1.0)
+        return 32767;
+    if (v <= -1.0)
+        return -32768;
+    q = v * 32768.0 + (v >= 0.0 ? 0.5 : -0.5);
+    return q > 32767 ? 32767 : q;
+}
+
+// tanh of acc, a value with frac fraction bits (15 to 30), in Q15
+static int
+esn_tanh_fixed(int acc, int frac)
+{
+    uint a, f, i;
+    int t;
+
+    a = acc < 0 ? -(uint)acc : acc;
+    // To Q16, then split into table index and interpolation fraction
+    a = frac > 16 ? a >> (frac - 16) : a << (16 - frac);
+    i = a >> (16 - ESNtanhstep);
+    if (i >= ESNtanhn)
+        t = 32767;
+    else {
+        f = a & ((1 << (16 - ESNtanhstep)) - 1);
+        t = esntanh.tab[i] + (((esntanh.tab[i+1] - esntanh.tab[i]) * (int)f) >> (16 - ESNtanhstep));
+    }
+    return acc < 0 ? -t : t;
+}
+
+static void
+esn_rows_fixed(EchoStateNetwork *esn, float *new_activations, int lo, int hi)
+{
+    short *w, *u;
+    int *col;
+    int i, j, k, nk, acc, t, x, frac;
+
+    frac = esn->wshift + 15;
+    u = esn->uq;
+    for (i = lo; i < hi; i++) {
+        acc = esn->bias_q[i];
+        if (esn->W_rowptr != nil) {
+            k = esn->W_rowptr[i];
+            nk = esn->W_rowptr[i+1] - k;
+            w = esn->Wq_val + k;
+            col = esn->W_col + k;
+            for (k = 0; k < nk; k++)
+                acc += w[k] * esn->xq[col[k]];
+        }
+        w = esn->Wq_input + i*esn->ld_input;
+        for (j = 0; j < esn->input_dim; j++)
+            acc += w[j] * u[j];
+
+        t = esn_tanh_fixed(acc, frac);
+        x = esn->xq[i];
+        if (esn->leak_q < 32768)
+            t = x + ((esn->leak_q * (t - x)) >> 15);
+        esn->xq_next[i] = t;
+        new_activations[i] = t * (1.0/32768.0);
+        esn->nodes[i]->activation = new_activations[i];
+    }
+}
+
+static void
+esn_fixed_free(EchoStateNetwork *esn)
+{
+    free(esn->Wq_val);
+    free(esn->Wq_input);
+    free(esn->bias_q);
+    free(esn->xq);
+    free(esn->xq_next);
+    free(esn->uq);
+    esn->Wq_val = nil;
+    esn->Wq_input = nil;
+    esn->bias_q = nil;
+    esn->xq = nil;
+    esn->xq_next = nil;
+    esn->uq = nil;
+    esn->fixed = 0;
+}
+
+// Reload the Q15 state from the float activations after they were set directly
+static void
+esn_fixed_sync(EchoStateNetwork *esn)
+{
+    int i;
+
+    if (!esn->fixed)
+        return;
+    for (i = 0; i < esn->reservoir_size; i++)
+        esn->xq[i] = esn_q15(esn->current_state->activations[i]);
+}
+
+/*
+ * Step esn in fixed point (on != 0) or floating point.  The weights are
+ * quantized from the float ones when fixed point is turned on.  -1 if
+ * out of memory or the weights are too large for any shift.
+ */
+int
+esn_set_fixed(EchoStateNetwork *esn, int on)
+{
+    float bound, row;
+    int i, j, k, n, d, ws;
+
+    esn_fixed_free(esn);
+    if (!on)
+        return 0;
+    esn->hyper = 0;
+
+    lock(&esntanh);
+    if (!esntanh.ready) {
+        for (i = 0; i <= ESNtanhn; i++)
+            esntanh.tab[i] = esn_q15(tanh((float)i / (1 << ESNtanhstep)));
+        esntanh.ready = 1;
+    }
+    unlock(&esntanh);
+
+    // Largest |row sum| with |x|, |u| <= 1
+    n = esn->reservoir_size;
+    d = esn->input_dim;
+    bound = 0.0;
+    for (i = 0; i < n; i++) {
+        row = esn_abs(esn->nodes[i]->bias);
+        if (esn->W_rowptr != nil)
+            for (k = esn->W_rowptr[i]; k < esn->W_rowptr[i+1]; k++)
+                row += esn_abs(esn->W_val[k]);
+        for (j = 0; j < d; j++)
+            row += esn_abs(esn->W_input[i*esn->ld_input + j]);
+        if (row > bound)
+            bound = row;
+    }
+    for (ws = 15; ws >= 0; ws--)
+        if (bound * (float)(1 << (ws + 15)) < 2147483648.0 / 2)
+            break;
+    if (ws < 0)
+        return -1;
+
+    esn->wshift = ws;
+    esn->Wq_val = malloc((esn->W_nnz > 0 ? esn->W_nnz : 1) * sizeof(short));
+    esn->Wq_input = malloc(n * esn->ld_input * sizeof(short));
+    esn->bias_q = malloc(n * sizeof(int));
+    esn->xq = malloc(n * sizeof(short));
+    esn->xq_next = malloc(n * sizeof(short));
+    esn->uq = malloc((d > 0 ? d : 1) * sizeof(short));
+    if (esn->Wq_val == nil || esn->Wq_input == nil || esn->bias_q == nil ||
+       esn->xq == nil || esn->xq_next == nil || esn->uq == nil) {
+        esn_fixed_free(esn);
+        return -1;
+    }
+    for (k = 0; k < esn->W_nnz; k++)
+        esn->Wq_val[k] = esn->W_val[k] * (1 << ws) + (esn->W_val[k] >= 0.0 ? 0.5 : -0.5);
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < d; j++) {
+            row = esn->W_input[i*esn->ld_input + j];
+            esn->Wq_input[i*esn->ld_input + j] = row * (1 << ws) + (row >= 0.0 ? 0.5 : -0.5);
+        }
+        row = esn->nodes[i]->bias;
+        esn->bias_q[i] = row * (float)(1 << (ws + 15)) + (row >= 0.0 ? 0.5 : -0.5);
+    }
+    esn->leak_q = esn->leak_rate >= 1.0 ? 32768 : esn_q15(esn->leak_rate);
+    esn->fixed = 1;
+    esn_fixed_sync(esn);
+    return 0;
+}
+
+/*
+ * Worker Pool
+ *
+ * Work can be split into parts over a pool of kernel procs, each
+ * wired to its own CPU.  cognitive_parallel posts a job, runs part 0
+ * itself and sleeps until the last worker is done; the pool runs one
+ * job at a time.  Workers are started on first use and kept.  ESN
+ * steps split by rows and membrane steps by membrane.
+ */
+enum {
+    Npoolworkers = 16,                // Most parts one job is split into
+    ESNworkers = Npoolworkers,        // Most CPUs one step is split over
+    ESNparrows = 256,                 // Fewest rows per CPU worth a handoff
+};
+
+typedef struct PoolWorker PoolWorker;
+struct PoolWorker {
+    Rendez r;
+    int id;                           // Part of the job, 1 to nparts-1
+    int go;                           // Set when a part is posted
+};
+
+static struct {
+    QLock;                            // One job at a time
+    int nproc;                        // Workers started
+    PoolWorker w[Npoolworkers - 1];
+    Rendez done;                      // Posting process waits here
+    long pending;                     // Parts still running
+    
+    // The posted job
+    void (*fn)(void*, int, int);
+    void *arg;
+    int nparts;
+} cogpool;
+
+static int
+pool_part_posted(void *a)
+{
+    return ((PoolWorker*)a)->go;
+}
+
+static int
+pool_job_done(void*)
+{
+    return cogpool.pending == 0;
+}
+
+static void
+pool_worker(void *a)
+{
+    PoolWorker *w;
+
+    w = a;
+    procwired(up, w->id);
+    for (;;) {
+        sleep(&w->r, pool_part_posted, w);
+        w->go = 0;
+        cogpool.fn(cogpool.arg, w->id, cogpool.nparts);
+        if (_xdec(&cogpool.pending) == 0)
+            wakeup(&cogpool.done);
+    }
+}
+
+// Run fn(arg, part, nparts) for every part, in parallel when nparts > 1
+static void
+cognitive_parallel(void (*fn)(void*, int, int), void *arg, int nparts)
+{
+    int i;
+
+    if (nparts > Npoolworkers)
+        nparts = Npoolworkers;
+    if (nparts <= 1 || up == nil) {
+        fn(arg, 0, 1);
+        return;
+    }
+    qlock(&cogpool);
+    while (cogpool.nproc < nparts - 1) {
+        cogpool.w[cogpool.nproc].id = cogpool.nproc + 1;
+        kproc("cogworker", pool_worker, &cogpool.w[cogpool.nproc]);
+        cogpool.nproc++;
+    }
+    cogpool.fn = fn;
+    cogpool.arg = arg;
+    cogpool.nparts = nparts;
+    cogpool.pending = nparts - 1;
+    coherence();
+    for (i = 1; i < nparts; i++) {
+        cogpool.w[i-1].go = 1;
+        wakeup(&cogpool.w[i-1].r);
+    }
+    fn(arg, 0, nparts);
+    while (waserror())
+        ;  // The workers are still running the job; wait them out regardless
+    while (cogpool.pending > 0)
+        sleep(&cogpool.done, pool_job_done, nil);
+    poperror();
+    qunlock(&cogpool);
+}
+
+typedef struct ESNRows ESNRows;
+struct ESNRows {
+    EchoStateNetwork *esn;
+    float *out;
+    float *input;
+    float *inproj;
+};
+
+static void
+esn_share(void *a, int part, int nparts)
+{
+    ESNRows *r;
+    int n;
+
+    r = a;
+    n = r->esn->reservoir_size;
+    if (r->esn->fixed)
+        esn_rows_fixed(r->esn, r->out,
+                       (vlong)n * part / nparts, (vlong)n * (part + 1) / nparts);
+    else
+        esn_rows(r->esn, r->out, r->input, r->inproj,
+                 (vlong)n * part / nparts, (vlong)n * (part + 1) / nparts);
+}
+
+static void
+esn_rows_parallel(EchoStateNetwork *esn, float *out, float *input, float *inproj)
+{
+    ESNRows r;
+
+    r.esn = esn;
+    r.out = out;
+    r.input = input;
+    r.inproj = inproj;
+    cognitive_parallel(esn_share, &r, esn->workers);
+}
+
+/*
+ * Split each step of esn over up to n CPUs.  Reservoirs smaller than
+ * ESNparrows rows per CPU keep stepping on one.
+ */
+void
+esn_set_workers(EchoStateNetwork *esn, int n)
+{
+    if (n < 1)
+        n = 1;
+    if (n > conf.nmach)
+        n = conf.nmach;
+    if (n > ESNworkers)
+        n = ESNworkers;
+    esn->workers = n;
+}
+
+static void esn_advance(EchoStateNetwork*, float*, float*);
+
+/*
+ * ESN State Update: Core recurrence equation
+ * x(t+1) = f(W·x(t) + W_in·u(t))
+ */
+void
+esn_update_state(EchoStateNetwork *esn, float *input)
+{
+    esn_advance(esn, input, nil);
+}
+
+/*
+ * One step of the recurrence.  The input term is taken from inproj,
+ * W_in·u(t) already computed for every node, when the caller has it,
+ * and from input otherwise.
+ */
+static void
+esn_advance(EchoStateNetwork *esn, float *input, float *inproj)
+{
+    ESNState *new_state;
+    float *new_activations;
+    short *xq;
+    uvlong t0;
+    int next, j;
+    
+    t0 = cogprof_start();
+    // Reuse the oldest slot; the state after it loses its predecessor
+    next = (esn->ring_head + 1) % esn->ring_depth;
+    new_state = &esn->ring[next];
+    esn->ring[(next + 1) % esn->ring_depth].previous = nil;
+    new_activations = new_state->activations;
+    
+    if (esn->fixed)
+        for (j = 0; j < esn->input_dim; j++)
+            esn->uq[j] = esn_q15(input[j]);
+    
+    // Compute new activations; one CPU propagates by pushing
+    if (esn->hyper)
+        esn->hypergraph->pushed = 0;
+    if (esn->workers > 1 && up != nil &&
+       esn->reservoir_size >= esn->workers * ESNparrows)
+        esn_rows_parallel(esn, new_activations, input, inproj);
+    else if (esn->hyper) {
+        esn_hyper_push(esn);
+        esn_rows(esn, new_activations, input, inproj, 0, esn->reservoir_size);
+    }
+    else if (esn->fixed)
+        esn_rows_fixed(esn, new_activations, 0, esn->reservoir_size);
+    else
+        esn_rows(esn, new_activations, input, inproj, 0, esn->reservoir_size);
+    
+    if (esn->fixed) {
+        xq = esn->xq;
+        esn->xq = esn->xq_next;
+        esn->xq_next = xq;
+    }
+    
+    // Update state
+    new_state->timestamp = time(NULL);
+    new_state->previous = esn->current_state;
+    
+    // Compute Matula encoding of new state
+    esn_state_to_matula(esn, new_state);
+    
+    esn->current_state = new_state;
+    esn->ring_head = next;
+    if (esn->ring_count < esn->ring_depth)
+        esn->ring_count++;
+    cogprof_end(CPesnstep, t0);
+}
+
+// p^e for a node prime and level; p < 2^10, so p^3 fits
+static u32int
+esn_prime_pow(EchoStateNetwork *esn, int i, int e)
+{
+    u32int p, r;
+
+    p = esn->nodes[i]->prime_index;
+    for (r = 1; e > 0; e--)
+        r *= p;
+    return r;
+}
+
+static void
+esn_history_put(uchar **pp, uint v)
+{
+    uchar *p;
+
+    p = *pp;
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    *pp = p;
+}
+
+static uint
+esn_history_get(uchar **pp)
+{
+    uchar *p;
+    uint v;
+    int s;
+
+    p = *pp;
+    v = 0;
+    for (s = 0; *p & 0x80; s += 7)
+        v |= (*p++ & 0x7f) << s;
+    v |= *p++ << s;
+    *pp = p;
+    return v;
+}
+
+/*
+ * Append the step to levels q to the history, starting a chunk when
+ * the record might not fit.  A full history reuses its oldest chunk;
+ * a step that finds no memory for a chunk is counted but not kept.
+ */
+static void
+esn_history_append(EchoStateNetwork *esn, uchar *q, int n)
+{
+    ESNHistory *h;
+    uchar rec[ESNhistrec], *p, *base;
+    static uchar zero[NPRIMES];
+    int i, last, nchg;
+
+    h = esn->history_tail;
+    if (h == nil || h->len + ESNhistrec > ESNhistchunk) {
+        if (esn->history_chunks == ESNhistchunks) {
+            h = esn->history;
+            esn->history = h->next;
+        } else if ((h = malloc(sizeof *h)) != nil)
+            esn->history_chunks++;
+        else {
+            esn->history_size++;
+            return;
+        }
+        h->next = nil;
+        h->first = esn->history_size;
+        h->nrec = 0;
+        h->len = 0;
+        if (esn->history_tail != nil && esn->history_tail != h)
+            esn->history_tail->next = h;
+        if (esn->history == nil)
+            esn->history = h;
+        esn->history_tail = h;
+        base = zero;
+    } else
+        base = esn->levels;
+
+    nchg = 0;
+    for (i = 0; i < n; i++)
+        if (q[i] != base[i])
+            nchg++;
+    p = rec;
+    esn_history_put(&p, nchg);
+    last = 0;
+    for (i = 0; i < n; i++)
+        if (q[i] != base[i]) {
+            esn_history_put(&p, (i - last) << 2 | q[i]);
+            last = i;
+        }
+    memmove(h->data + h->len, rec, p - rec);
+    h->len += p - rec;
+    h->nrec++;
+    esn->history_size++;
+}
+
+/*
+ * Move the encoding to levels q, record the step, and set state's
+ * encoding.  A product that overflows MatulaBig leaves the encoding
+ * 0 and is rebuilt from the levels on a later step.
+ */
+static void
+esn_matula_levels(EchoStateNetwork *esn, uchar *q, ESNState *state)
+{
+    MatulaBig *acc;
+    int i, n;
+
+    acc = &esn->matula_acc;
+    n = esn->reservoir_size < NPRIMES ? esn->reservoir_size : NPRIMES;
+    esn_history_append(esn, q, n);
+    for (i = 0; i < n; i++) {
+        if (q[i] == esn->levels[i])
+            continue;
+        if (esn->matula_valid) {
+            if (q[i] < esn->levels[i])
+                matula_big_div(acc, esn_prime_pow(esn, i, esn->levels[i] - q[i]), acc);
+            else if (matula_big_mul(acc, esn_prime_pow(esn, i, q[i] - esn->levels[i])) < 0)
+                esn->matula_valid = 0;
+        }
+        esn->levels[i] = q[i];
+    }
+    if (!esn->matula_valid) {
+        matula_big_set(acc, 1);
+        esn->matula_valid = 1;
+        for (i = 0; i < n; i++)
+            if (esn->levels[i] != 0 && matula_big_mul(acc, esn_prime_pow(esn, i, esn->levels[i])) < 0) {
+                esn->matula_valid = 0;
+                break;
+            }
+    }
+    if (!esn->matula_valid) {
+        // No exact encoding; 0 is never a Matula number
+        state->matula_big = nil;
+        state->matula_encoding = 0;
+        return;
+    }
+    state->matula_encoding = matula_big_hash(acc);
+    state->matula_big = nil;
+    if (acc->n > 2) {
+        if (state->bigbuf == nil)
+            state->bigbuf = malloc(sizeof(MatulaBig));
+        if (state->bigbuf == nil) {
+            state->matula_encoding = 0;
+            return;
+        }
+        state->bigbuf->n = acc->n;
+        memmove(state->bigbuf->limb, acc->limb, acc->n * sizeof(u32int));
+        state->matula_big = state->bigbuf;
+    }
+}
+
+/*
+ * Convert ESN state to Matula number encoding
+ * 
+ * Algorithm:
+ * 1. Quantize activations to discrete levels
+ * 2. Treat quantized levels as exponents on prime bases
+ * 3. Multiply: matula = ∏ p_i^(quantized_activation_i)
+ * 
+ * This encodes the full reservoir state as a single integer.  The
+ * product is kept from step to step and only the factors of nodes
+ * whose level changed are divided out and multiplied back in.
+ */
+void
+esn_state_to_matula(EchoStateNetwork *esn, ESNState *state)
+{
+    uchar q[NPRIMES];
+    uvlong t0;
+    int i, exponent;
+    
+    t0 = cogprof_start();
+    for (i = 0; i < esn->reservoir_size && i < NPRIMES; i++) {
+        // Quantize activation to 0-3 range
+        exponent = (int)((state->activations[i] + 1.0) * 1.5);
+        if (exponent < 0) exponent = 0;
+        if (exponent > 3) exponent = 3;
+        q[i] = exponent;
+    }
+    esn_matula_levels(esn, q, state);
+    cogprof_end(CPencode, t0);
+}
+
+/*
+ * Node levels after history step, replayed from the start of its
+ * chunk into levels (NPRIMES entries).  -1 if the step was dropped
+ * or hasn't happened.
+ */
+int
+esn_history_levels(EchoStateNetwork *esn, long step, uchar *levels)
+{
+    ESNHistory *h;
+    uchar *p;
+    int r, k, nchg, i;
+    uint v;
+
+    for (h = esn->history; h != nil; h = h->next)
+        if (step >= h->first && step < h->first + h->nrec)
+            break;
+    if (h == nil)
+        return -1;
+    memset(levels, 0, NPRIMES);
+    p = h->data;
+    for (r = 0; r <= step - h->first; r++) {
+        nchg = esn_history_get(&p);
+        i = 0;
+        for (k = 0; k < nchg; k++) {
+            v = esn_history_get(&p);
+            i += v >> 2;
+            levels[i] = v & 3;
+        }
+    }
+    return 0;
+}
+
+// Encoding of history step as in ESNState.matula_encoding; 0 if unknown
+uvlong
+esn_history_matula(EchoStateNetwork *esn, long step)
+{
+    MatulaBig b;
+    uchar levels[NPRIMES];
+    int i;
+
+    if (esn_history_levels(esn, step, levels) < 0)
+        return 0;
+    matula_big_set(&b, 1);
+    for (i = 0; i < esn->reservoir_size && i < NPRIMES; i++)
+        if (levels[i] != 0 && matula_big_mul(&b, esn_prime_pow(esn, i, levels[i])) < 0)
+            return 0;
+    return matula_big_hash(&b);
+}
+
+/*
+ * Convert Matula number back to ESN state
+ * 
+ * Algorithm:
+ * 1. Factorize matula number
+ * 2. For each prime p_i with exponent e_i:
+ *    - Set activation_i based on exponent
+ * 3. Normalize to [-1, 1] range
+ */
+void
+matula_to_esn_state(EchoStateNetwork *esn, uvlong matula)
+{
+    int exponents[NPRIMES];
+    uchar q[NPRIMES];
+    int i;
+    
+    // Factorize
+    factorize(matula, exponents, NPRIMES);
+    
+    // Set activations based on exponents
+    for (i = 0; i < esn->reservoir_size && i < NPRIMES; i++) {
+        // Convert exponent back to activation
+        esn->current_state->activations[i] = (exponents[i] / 1.5) - 1.0;
+        esn->nodes[i]->activation = esn->current_state->activations[i];
+        q[i] = exponents[i] > 3 ? 3 : exponents[i];
+    }
+    
+    // Keep the incremental encoding and history in step with the jump
+    esn_matula_levels(esn, q, esn->current_state);
+    esn->current_state->matula_big = nil;
+    esn->current_state->matula_encoding = matula;
+    esn_fixed_sync(esn);
+}
+
+/*
+ * ESN as Dyck Grammar Machine
+ * 
+ * Each reservoir node corresponds to a parenthesis type.
+ * ESN update = continuously rewriting parentheses configurations.
+ */
+char*
+esn_to_dyck_expression(EchoStateNetwork *esn)
+{
+    char *expr;
+    int i, level;
+    int pos = 0;
+    int size = esn->reservoir_size * 4; // Estimate
+    
+    expr = malloc(size);
+    
+    // Convert activation pattern to nested parentheses
+    for (i = 0; i < esn->reservoir_size; i++) {
+        int l;
+        // Activation level determines nesting
+        level = (int)((esn->nodes[i]->activation + 1.0) * 2.0);
+        
+        if (level > 0 && pos < size - 4) {
+            for (l = 0; l < level; l++) {
+                expr[pos++] = '(';
+            }
+            for (l = 0; l < level; l++) {
+                expr[pos++] = ')';
+            }
+        }
+    }
+    
+    expr[pos] = '\0';
+    return expr;
+}
+
+/*
+ * ESN as Rooted Tree Forest
+ * 
+ * Each update = grafting new subtrees at leaves.
+ * ESN trajectory = moving fixed point in forest space.
+ *
+ * The forest is a view: esn->forest holds references to interned
+ * trees, a leaf for a weakly active node and a root with one child
+ * for a strongly active one, so taking it allocates nothing.  The
+ * array is the network's and is rewritten by the next call.
+ */
+RootedTree**
+esn_to_forest(EchoStateNetwork *esn, int *forest_size)
+{
+    RootedTree *leaf, *stem;
+    int i, count;
+    
+    count = 0;
+    leaf = rooted_tree_intern(1);  // ()
+    stem = rooted_tree_intern(2);  // (())
+    if (esn->forest == nil || leaf == nil || stem == nil) {
+        *forest_size = 0;
+        return nil;
+    }
+    
+    // Each active node becomes a tree
+    for (i = 0; i < esn->reservoir_size; i++)
+        if (esn->nodes[i]->activation > 0.1)
+            esn->forest[count++] = esn->nodes[i]->activation > 0.5 ? stem : leaf;
+    
+    esn->forest_size = count;
+    *forest_size = count;
+    return esn->forest;
+}
+
+/*
+ * ESN as Membrane System
+ * 
+ * Each reservoir node = membrane region.
+ * Activation = multiset object count.
+ * Update = maximal parallel rule application.
+ * Echo = residual multisets that decay slowly.
+ */
+void
+esn_to_membrane_system(EchoStateNetwork *esn)
+{
+    int i;
+    
+    for (i = 0; i < esn->reservoir_size; i++) {
+        // Quantize activation to object count
+        esn->nodes[i]->object_count = 
+            (int)((esn->nodes[i]->activation + 1.0) * 10.0);
+        
+        if (esn->nodes[i]->object_count < 0)
+            esn->nodes[i]->object_count = 0;
+    }
+}
+
+/*
+ * Membrane Systems
+ *
+ * A P system of nmem membranes over nobj kinds of object.  Membrane
+ * 0 is the skin and every other one names its parent; contents are
+ * dense count vectors, a row of nobj counts per membrane, with one
+ * more row for the environment, which receives what the skin sends
+ * out.  A rule belongs to one membrane and rewrites a multiset of its
+ * objects into products kept here, sent out to the parent or sent in
+ * to a child.
+ *
+ * membrane_compile turns the rules into tables: the rules of each
+ * membrane in the order they were added, and for each row the
+ * products that land in it, so a step never searches.  A step is
+ * maximally parallel and runs in two phases, each split by membrane
+ * over the worker pool.  First every membrane fires its rules in
+ * order, each as often as the objects left allow, which leaves no
+ * rule applicable, and consumes their objects; then every row
+ * gathers the products delivered to it.  A membrane writes only its
+ * own row in either phase, so neither needs a lock.  Parts are cut
+ * by the work their membranes carry, not their number.  A system
+ * halts on the first step in which nothing fires.
+ */
+enum {
+    Mhere = -1,                       // Product targets; children are named by number
+    Mout = -2,
+    MPterms = 16,                     // Most terms on either side of a rule
+    MPparwork = 64,                   // Fewest terms per CPU worth a handoff
+    Nmembranes = 32,                  // Most named systems
+};
+
+typedef struct MembraneRule MembraneRule;
+typedef struct MembraneTerm MembraneTerm;
+typedef struct MembraneDelivery MembraneDelivery;
+typedef struct MembraneStep MembraneStep;
+
+struct MembraneTerm {
+    int obj;
+    uvlong mult;
+    int target;                       // Of a product: Mhere, Mout or a child
+};
+
+struct MembraneRule {
+    int membrane;
+    int nlhs, nrhs;
+    MembraneTerm *lhs;
+    MembraneTerm *rhs;
+    MembraneRule *next;               // In the order added
+};
+
+struct MembraneDelivery {
+    int rule;                         // Index into the compiled rules
+    int obj;
+    uvlong mult;
+};
+
+struct MembraneSystem {
+    QLock;                            // Serializes changes and steps
+    Arena arena;                      // The system, its rules and their terms
+    char *id;
+    int nmem;                         // Membranes; row nmem is the environment
+    int nobj;
+    int *parent;                      // -1 for the skin
+    uvlong *count;                    // (nmem+1) x nobj object counts
+    
+    MembraneRule *rules;              // As added
+    MembraneRule *lastrule;
+    int nrule;
+    
+    // Compiled tables, rebuilt when a rule is added
+    int compiled;
+    MembraneRule **crule;             // Rules by membrane, then order added
+    int *rfirst;                      // Membrane m's rules are crule[rfirst[m]] to crule[rfirst[m+1]-1]
+    MembraneDelivery *deliv;          // Products by destination row
+    int *dfirst;                      // Row m's are deliv[dfirst[m]] to deliv[dfirst[m+1]-1]
+    uvlong *work;                     // Terms handled before row m, for cutting parts
+    uvlong *apps;                     // Applications of each rule this step
+    
+    int workers;                      // CPUs to split a step over
+    int halted;
+    long steps;
+    uvlong applied;                   // Applications in the last step
+    uvlong total;                     // Applications over all steps
+};
+
+struct MembraneStep {
+    MembraneSystem *ms;
+    int phase;                        // 0 fires rules, 1 delivers products
+    uvlong applied[Npoolworkers];     // By part
+};
+
+static struct {
+    Lock;
+    MembraneSystem *tab[Nmembranes];
+    int n;
+} membrane_registry;
+
+// *c += k * mult, saturating
+static void
+membrane_add(uvlong *c, uvlong k, uvlong mult)
+{
+    if (mult != 0 && k > ~0ULL / mult)
+        k = ~0ULL;
+    else
+        k *= mult;
+    *c = *c + k < *c ? ~0ULL : *c + k;
+}
+
+/*
+ * Parse "obj[xmult][@target],..." into at most MPterms terms, the
+ * target being here, out or a child's number and allowed only in
+ * products; "-" is an empty product.  -1 on bad syntax.
+ */
+static int
+membrane_terms(MembraneSystem *ms, int m, char *s, MembraneTerm *t, int products)
+{
+    ulong v;
+    char *e;
+    int n;
+
+    if (products && strcmp(s, "-") == 0)
+        return 0;
+    for (n = 0;; n++) {
+        if (n == MPterms)
+            return -1;
+        v = strtoul(s, &e, 10);
+        if (e == s || v >= ms->nobj)
+            return -1;
+        t[n].obj = v;
+        t[n].mult = 1;
+        t[n].target = Mhere;
+        s = e;
+        if (*s == 'x') {
+            t[n].mult = strtoull(s + 1, &e, 10);
+            if (e == s + 1 || t[n].mult == 0)
+                return -1;
+            s = e;
+        }
+        if (*s == '@') {
+            if (!products)
+                return -1;
+            s++;
+            if (strncmp(s, "here", 4) == 0)
+                s += 4;
+            else if (strncmp(s, "out", 3) == 0) {
+                t[n].target = Mout;
+                s += 3;
+            } else {
+                v = strtoul(s, &e, 10);
+                if (e == s || v >= ms->nmem || ms->parent[v] != m)
+                    return -1;
+                t[n].target = v;
+                s = e;
+            }
+        }
+        if (*s == '\0')
+            return n + 1;
+        if (*s++ != ',')
+            return -1;
+    }
+}
+
+static void
+membrane_uncompile(MembraneSystem *ms)
+{
+    free(ms->crule);
+    free(ms->rfirst);
+    free(ms->deliv);
+    free(ms->dfirst);
+    free(ms->work);
+    free(ms->apps);
+    ms->crule = nil;
+    ms->rfirst = nil;
+    ms->deliv = nil;
+    ms->dfirst = nil;
+    ms->work = nil;
+    ms->apps = nil;
+    ms->compiled = 0;
+}
+
+// Row a product of a rule in membrane m lands in
+static int
+membrane_dest(MembraneSystem *ms, int m, int target)
+{
+    if (target == Mhere)
+        return m;
+    if (target == Mout)
+        return m == 0 ? ms->nmem : ms->parent[m];
+    return target;
+}
+
+static int
+membrane_compile(MembraneSystem *ms)
+{
+    MembraneRule *r;
+    int i, j, m, nrow, ndeliv;
+
+    membrane_uncompile(ms);
+    nrow = ms->nmem + 1;
+    ndeliv = 0;
+    for (r = ms->rules; r != nil; r = r->next)
+        ndeliv += r->nrhs;
+    ms->crule = malloc((ms->nrule + 1) * sizeof(MembraneRule*));
+    ms->rfirst = malloc((nrow + 1) * sizeof(int));
+    ms->deliv = malloc((ndeliv + 1) * sizeof(MembraneDelivery));
+    ms->dfirst = malloc((nrow + 1) * sizeof(int));
+    ms->work = malloc((nrow + 1) * sizeof(uvlong));
+    ms->apps = malloc((ms->nrule + 1) * sizeof(uvlong));
+    if (ms->crule == nil || ms->rfirst == nil || ms->deliv == nil ||
+       ms->dfirst == nil || ms->work == nil || ms->apps == nil) {
+        membrane_uncompile(ms);
+        return -1;
+    }
+    
+    // Counting sorts, by membrane and by destination, keep rule order
+    for (r = ms->rules; r != nil; r = r->next) {
+        ms->rfirst[r->membrane + 1]++;
+        for (j = 0; j < r->nrhs; j++)
+            ms->dfirst[membrane_dest(ms, r->membrane, r->rhs[j].target) + 1]++;
+    }
+    for (m = 0; m < nrow; m++) {
+        ms->rfirst[m + 1] += ms->rfirst[m];
+        ms->dfirst[m + 1] += ms->dfirst[m];
+    }
+    for (r = ms->rules; r != nil; r = r->next)
+        ms->crule[ms->rfirst[r->membrane]++] = r;
+    for (m = nrow; m > 0; m--)
+        ms->rfirst[m] = ms->rfirst[m - 1];
+    ms->rfirst[0] = 0;
+    for (i = 0; i < ms->nrule; i++) {
+        r = ms->crule[i];
+        for (j = 0; j < r->nrhs; j++) {
+            m = membrane_dest(ms, r->membrane, r->rhs[j].target);
+            ms->deliv[ms->dfirst[m]].rule = i;
+            ms->deliv[ms->dfirst[m]].obj = r->rhs[j].obj;
+            ms->deliv[ms->dfirst[m]].mult = r->rhs[j].mult;
+            ms->dfirst[m]++;
+        }
+    }
+    for (m = nrow; m > 0; m--)
+        ms->dfirst[m] = ms->dfirst[m - 1];
+    ms->dfirst[0] = 0;
+    
+    // A row's work is its rules' left sides and the products it gathers, plus one
+    ms->work[0] = 0;
+    for (m = 0; m < nrow; m++) {
+        ms->work[m + 1] = ms->work[m] + 1 + ms->dfirst[m + 1] - ms->dfirst[m];
+        for (i = ms->rfirst[m]; i < ms->rfirst[m + 1]; i++)
+            ms->work[m + 1] += ms->crule[i]->nlhs;
+    }
+    ms->compiled = 1;
+    return 0;
+}
+
+// First row of part of nparts, cut by work
+static int
+membrane_bound(MembraneSystem *ms, int part, int nparts)
+{
+    uvlong w;
+    int lo, hi, mid;
+
+    if (part >= nparts)
+        return ms->nmem + 1;
+    w = ms->work[ms->nmem + 1] * part / nparts;
+    lo = 0;
+    hi = ms->nmem + 1;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (ms->work[mid] < w)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Fire membrane m's rules, in order and each as often as it fits
+static uvlong
+membrane_fire(MembraneSystem *ms, int m)
+{
+    MembraneRule *r;
+    uvlong *row, k, c, applied;
+    int i, j;
+
+    row = ms->count + (vlong)m * ms->nobj;
+    applied = 0;
+    for (i = ms->rfirst[m]; i < ms->rfirst[m + 1]; i++) {
+        r = ms->crule[i];
+        k = ~0ULL;
+        for (j = 0; j < r->nlhs && k > 0; j++) {
+            c = row[r->lhs[j].obj] / r->lhs[j].mult;
+            if (c < k)
+                k = c;
+        }
+        for (j = 0; j < r->nlhs && k > 0; j++)
+            row[r->lhs[j].obj] -= k * r->lhs[j].mult;
+        ms->apps[i] = k;
+        applied += k;
+    }
+    return applied;
+}
+
+static void
+membrane_gather(MembraneSystem *ms, int m)
+{
+    MembraneDelivery *d;
+    uvlong *row;
+    int i;
+
+    row = ms->count + (vlong)m * ms->nobj;
+    for (i = ms->dfirst[m]; i < ms->dfirst[m + 1]; i++) {
+        d = &ms->deliv[i];
+        if (ms->apps[d->rule] != 0)
+            membrane_add(&row[d->obj], ms->apps[d->rule], d->mult);
+    }
+}
+
+static void
+membrane_phase(void *a, int part, int nparts)
+{
+    MembraneStep *st;
+    uvlong applied;
+    int m, hi;
+
+    st = a;
+    applied = 0;
+    hi = membrane_bound(st->ms, part + 1, nparts);
+    for (m = membrane_bound(st->ms, part, nparts); m < hi; m++)
+        if (st->phase == 0)
+            applied += membrane_fire(st->ms, m);
+        else
+            membrane_gather(st->ms, m);
+    st->applied[part] = applied;
+}
+
+static void
+membrane_free(MembraneSystem *ms)
+{
+    membrane_uncompile(ms);
+    free(ms->parent);
+    free(ms->count);
+    arena_free(&ms->arena);
+}
+
+/*
+ * A system of nmem membranes over nobj objects; parent[0] must be -1
+ * and every other membrane's parent must come before it.
+ */
+static MembraneSystem*
+create_membrane_system(int nmem, int nobj, int *parent)
+{
+    MembraneSystem *ms;
+    Arena a;
+    int m;
+
+    if (nmem < 1 || nobj < 1 || parent[0] != -1)
+        return nil;
+    for (m = 1; m < nmem; m++)
+        if (parent[m] < 0 || parent[m] >= m)
+            return nil;
+    a.chunk = nil;
+    ms = arena_alloc(&a, sizeof(MembraneSystem));
+    if (ms == nil)
+        return nil;
+    ms->arena = a;
+    ms->nmem = nmem;
+    ms->nobj = nobj;
+    ms->workers = 1;
+    ms->parent = malloc(nmem * sizeof(int));
+    ms->count = malloc((vlong)(nmem + 1) * nobj * sizeof(uvlong));
+    if (ms->parent == nil || ms->count == nil) {
+        membrane_free(ms);
+        return nil;
+    }
+    memmove(ms->parent, parent, nmem * sizeof(int));
+    return ms;
+}
+
+MembraneSystem*
+lookup_membrane_system(char *name)
+{
+    MembraneSystem *ms;
+    int i;
+
+    ms = nil;
+    lock(&membrane_registry);
+    for (i = 0; i < membrane_registry.n; i++)
+        if (strcmp(membrane_registry.tab[i]->id, name) == 0) {
+            ms = membrane_registry.tab[i];
+            break;
+        }
+    unlock(&membrane_registry);
+    return ms;
+}
+
+// Create and name a system; nil if the name is taken, there is no room or the shape is bad
+MembraneSystem*
+register_membrane_system(char *name, int nmem, int nobj, int *parent)
+{
+    MembraneSystem *ms;
+    int i;
+
+    ms = create_membrane_system(nmem, nobj, parent);
+    if (ms == nil)
+        return nil;
+    ms->id = arena_strdup(&ms->arena, name);
+    if (ms->id == nil) {
+        membrane_free(ms);
+        return nil;
+    }
+    lock(&membrane_registry);
+    for (i = 0; i < membrane_registry.n; i++)
+        if (strcmp(membrane_registry.tab[i]->id, name) == 0)
+            break;
+    if (i < membrane_registry.n || membrane_registry.n == Nmembranes) {
+        unlock(&membrane_registry);
+        membrane_free(ms);
+        return nil;
+    }
+    membrane_registry.tab[membrane_registry.n++] = ms;
+    unlock(&membrane_registry);
+    cognitive_changed(CVmembranes);
+    return ms;
+}
+
+// Add the rule lhs -> rhs to membrane m; -1 if it doesn't parse
+int
+membrane_add_rule(MembraneSystem *ms, int m, char *lhs, char *rhs)
+{
+    MembraneTerm l[MPterms], rt[MPterms];
+    MembraneRule *r;
+    int nl, nr;
+
+    if (m < 0 || m >= ms->nmem)
+        return -1;
+    nl = membrane_terms(ms, m, lhs, l, 0);
+    nr = membrane_terms(ms, m, rhs, rt, 1);
+    if (nl <= 0 || nr < 0)
+        return -1;
+    qlock(ms);
+    r = arena_alloc(&ms->arena, sizeof(MembraneRule) + (nl + nr) * sizeof(MembraneTerm));
+    if (r == nil) {
+        qunlock(ms);
+        return -1;
+    }
+    r->membrane = m;
+    r->nlhs = nl;
+    r->nrhs = nr;
+    r->lhs = (MembraneTerm*)(r + 1);
+    r->rhs = r->lhs + nl;
+    memmove(r->lhs, l, nl * sizeof(MembraneTerm));
+    memmove(r->rhs, rt, nr * sizeof(MembraneTerm));
+    if (ms->lastrule != nil)
+        ms->lastrule->next = r;
+    else
+        ms->rules = r;
+    ms->lastrule = r;
+    ms->nrule++;
+    ms->compiled = 0;
+    ms->halted = 0;
+    qunlock(ms);
+    cognitive_changed(CVmembranes);
+    return 0;
+}
+
+// Set the count of obj in membrane m
+int
+membrane_set(MembraneSystem *ms, int m, int obj, uvlong count)
+{
+    if (m < 0 || m >= ms->nmem || obj < 0 || obj >= ms->nobj)
+        return -1;
+    qlock(ms);
+    ms->count[(vlong)m * ms->nobj + obj] = count;
+    ms->halted = 0;
+    qunlock(ms);
+    cognitive_changed(CVmembranes);
+    return 0;
+}
+
+// Split each step of ms over up to n CPUs
+void
+membrane_set_workers(MembraneSystem *ms, int n)
+{
+    if (n < 1)
+        n = 1;
+    if (n > conf.nmach)
+        n = conf.nmach;
+    if (n > Npoolworkers)
+        n = Npoolworkers;
+    ms->workers = n;
+    cognitive_changed(CVmembranes);
+}
+
+/*
+ * Run up to steps maximally parallel steps, stopping early once the
+ * system halts; returns the steps taken, or -1 if the rules could not
+ * be compiled.
+ */
+long
+membrane_run(MembraneSystem *ms, long steps)
+{
+    MembraneStep st;
+    uvlong applied, t0;
+    long n;
+    int i, nparts;
+
+    qlock(ms);
+    if (!ms->compiled && membrane_compile(ms) < 0) {
+        qunlock(ms);
+        return -1;
+    }
+    t0 = cogprof_start();
+    nparts = ms->workers;
+    while (nparts > 1 && ms->work[ms->nmem + 1] < (uvlong)nparts * MPparwork)
+        nparts--;
+    st.ms = ms;
+    for (n = 0; n < steps && !ms->halted; n++) {
+        st.phase = 0;
+        memset(st.applied, 0, sizeof st.applied);
+        cognitive_parallel(membrane_phase, &st, nparts);
+        applied = 0;
+        for (i = 0; i < nparts; i++)
+            applied += st.applied[i];
+        if (applied == 0) {
+            ms->halted = 1;
+            break;
+        }
+        st.phase = 1;
+        cognitive_parallel(membrane_phase, &st, nparts);
+        ms->steps++;
+        ms->applied = applied;
+        ms->total += applied;
+    }
+    cogprof_end(CPmembrane, t0);
+    qunlock(ms);
+    if (n > 0)
+        cognitive_changed(CVmembranes);
+    return n;
+}
+
+static int
+membrane_text(MembraneSystem *ms, char *buf, int len)
+{
+    uvlong *row;
+    int m, o, n;
+
+    n = snprint(buf, len, "%s membranes=%d objects=%d rules=%d workers=%d steps=%ld applied=%llud total=%llud%s\n",
+                ms->id, ms->nmem, ms->nobj, ms->nrule, ms->workers, ms->steps,
+                ms->applied, ms->total, ms->halted ? " halted" : "");
+    for (m = 0; m <= ms->nmem && n < len - 1; m++) {
+        row = ms->count + (vlong)m * ms->nobj;
+        if (m == ms->nmem)
+            n += snprint(buf + n, len - n, "\tenv");
+        else if (m == 0)
+            n += snprint(buf + n, len - n, "\t0 skin");
+        else
+            n += snprint(buf + n, len - n, "\t%d in=%d", m, ms->parent[m]);
+        for (o = 0; o < ms->nobj && n < len - 1; o++)
+            if (row[o] != 0)
+                n += snprint(buf + n, len - n, " %d:%llud", o, row[o]);
+        n += snprint(buf + n, len - n, "\n");
+    }
+    return n;
+}
+
+/*
+ * The membranes status file: a line per system and one per row
+ * with its nonzero counts.  A system in the middle of a run shows
+ * only its first line.
+ */
+int
+cognitive_membranes_text(char *buf, int len)
+{
+    MembraneSystem *tab[Nmembranes];
+    int i, n, ntab;
+
+    lock(&membrane_registry);
+    ntab = membrane_registry.n;
+    memmove(tab, membrane_registry.tab, ntab * sizeof(MembraneSystem*));
+    unlock(&membrane_registry);
+    n = 0;
+    for (i = 0; i < ntab && n < len - 1; i++) {
+        if (!canqlock(tab[i])) {
+            n += snprint(buf + n, len - n, "%s membranes=%d objects=%d running\n",
+                         tab[i]->id, tab[i]->nmem, tab[i]->nobj);
+            continue;
+        }
+        n += membrane_text(tab[i], buf + n, len - n);
+        qunlock(tab[i]);
+    }
+    return n;
+}
+
+/*
+ * Build esn's hypergraph from the rows of W; -1 if out of memory.
+ */
+int
+esn_create_hypergraph_representation(EchoStateNetwork *esn)
+{
+    ESNHypergraph *hg;
+    int *edge, *fill;
+    int i, j, k, e, n, pos;
+
+    n = esn->reservoir_size;
+    esn_hypergraph_free(esn->hypergraph);
+    esn->hypergraph = nil;
+    esn->hyper = 0;
+    hg = malloc(sizeof(ESNHypergraph));
+    edge = malloc((n + 1) * sizeof(int));
+    if (hg == nil || edge == nil) {
+        free(hg);
+        free(edge);
+        return -1;
+    }
+    hg->nnodes = n;
+    hg->nnz = esn->W_rowptr != nil ? esn->W_nnz : 0;
+    
+    // Out-degrees, then an edge for every node that feeds another
+    for (k = 0; k < hg->nnz; k++)
+        edge[esn->W_col[k]]++;
+    for (j = 0; j < n; j++)
+        if (edge[j] > 0)
+            hg->nedges++;
+    hg->esrc = malloc((hg->nedges + 1) * sizeof(int));
+    hg->eptr = malloc((hg->nedges + 1) * sizeof(int));
+    hg->enode = malloc((hg->nnz + 1) * sizeof(int));
+    hg->eweight = malloc((hg->nnz + 1) * sizeof(float));
+    hg->eof = malloc((hg->nnz + 1) * sizeof(int));
+    hg->nptr = malloc((n + 1) * sizeof(int));
+    hg->npos = malloc((hg->nnz + 1) * sizeof(int));
+    hg->acc = malloc((n + 1) * sizeof(float));
+    fill = malloc((hg->nedges + 1) * sizeof(int));
+    if (hg->esrc == nil || hg->eptr == nil || hg->enode == nil || hg->eweight == nil ||
+       hg->eof == nil || hg->nptr == nil || hg->npos == nil || hg->acc == nil || fill == nil) {
+        esn_hypergraph_free(hg);
+        free(edge);
+        free(fill);
+        return -1;
+    }
+    e = 0;
+    pos = 0;
+    for (j = 0; j < n; j++) {
+        if (edge[j] == 0) {
+            edge[j] = -1;
+            continue;
+        }
+        hg->esrc[e] = j;
+        hg->eptr[e] = pos;
+        fill[e] = pos;
+        pos += edge[j];
+        edge[j] = e++;
+    }
+    hg->eptr[e] = pos;
+    
+    // Row i of W is node i's incidences, so they keep W's order
+    for (i = 0; i < n; i++) {
+        hg->nptr[i] = hg->nnz > 0 ? esn->W_rowptr[i] : 0;
+        for (k = hg->nptr[i]; k < hg->nnz && k < esn->W_rowptr[i+1]; k++) {
+            e = edge[esn->W_col[k]];
+            pos = fill[e]++;
+            hg->enode[pos] = i;
+            hg->eweight[pos] = esn->W_val[k];
+            hg->eof[pos] = e;
+            hg->npos[k] = pos;
+        }
+    }
+    hg->nptr[n] = hg->nnz;
+    free(edge);
+    free(fill);
+    esn->hypergraph = hg;
+    return 0;
+}
+
+/*
+ * Step esn by propagation along its hypergraph (on != 0), building
+ * it on first use, or by rows of W.  Turns fixed point off.  -1 if
+ * out of memory.
+ */
+int
+esn_set_hyper(EchoStateNetwork *esn, int on)
+{
+    esn->hyper = 0;
+    if (!on)
+        return 0;
+    esn_set_fixed(esn, 0);
+    if (esn->hypergraph == nil && esn_create_hypergraph_representation(esn) < 0)
+        return -1;
+    esn->hyper = 1;
+    return 0;
+}
+
+/*
+ * ESN Output/Readout
+ * 
+ * y(t) = W_out · x(t)
+ */
+void
+esn_compute_output(EchoStateNetwork *esn, float *output)
+{
+    int i;
+    
+    if (esn->kern != nil) {
+        esn->kern->output(esn, output);
+        return;
+    }
+    for (i = 0; i < esn->output_dim; i++)
+        output[i] = esn_dot(esn->W_output + i*esn->ld_reservoir,
+                            esn->current_state->activations, esn->reservoir_size);
+}
+
+/*
+ * ESN Readout Training
+ *
+ * Ridge regression for W_out, accumulated as the reservoir runs:
+ * each esn_train_step adds x·xᵀ and x·yᵀ for the new state x and its
+ * target y, so no state history is kept.  esn_train_finish solves
+ * (XᵀX + ridge·I)·W_outᵀ = XᵀY by Cholesky factorization in place.
+ * The accumulators are n² doubles, which bounds the trainable size.
+ */
+enum {
+    ESNtrainmax = 2048,               // Largest reservoir the trainer accepts
+};
+
+int
+esn_train_begin(EchoStateNetwork *esn, float ridge)
+{
+    int n;
+
+    n = esn->reservoir_size;
+    if (n > ESNtrainmax || ridge < 0.0)
+        return -1;
+    free(esn->train_xtx);
+    free(esn->train_xty);
+    esn->train_xtx = malloc(n * n * sizeof(double));
+    esn->train_xty = malloc(n * esn->output_dim * sizeof(double));
+    if (esn->train_xtx == nil || esn->train_xty == nil) {
+        free(esn->train_xtx);
+        free(esn->train_xty);
+        esn->train_xtx = nil;
+        esn->train_xty = nil;
+        return -1;
+    }
+    memset(esn->train_xtx, 0, n * n * sizeof(double));
+    memset(esn->train_xty, 0, n * esn->output_dim * sizeof(double));
+    esn->train_ridge = ridge;
+    esn->train_samples = 0;
+    return 0;
+}
+
+// Step esn on input and, while training, accumulate the new state against target
+void
+esn_train_step(EchoStateNetwork *esn, float *input, float *target)
+{
+    double *row, xi;
+    float *x;
+    int i, j, n, m;
+
+    esn_update_state(esn, input);
+    if (esn->train_xtx == nil || target == nil)
+        return;
+    n = esn->reservoir_size;
+    m = esn->output_dim;
+    x = esn->current_state->activations;
+    for (i = 0; i < n; i++) {
+        xi = x[i];
+        if (xi == 0.0)
+            continue;
+        row = esn->train_xtx + i*n;
+        for (j = i; j < n; j++)
+            row[j] += xi * x[j];
+        row = esn->train_xty + i*m;
+        for (j = 0; j < m; j++)
+            row[j] += xi * target[j];
+    }
+    esn->train_samples++;
+}
+
+// Give esn a W_output of its own before writing one it shares with clones
+static int
+esn_own_output(EchoStateNetwork *esn)
+{
+    float *w;
+    int ld;
+
+    if (esn->weights == nil || esn->W_output != esn->weights->W_output)
+        return 0;
+    w = esn_matrix(esn->output_dim, esn->reservoir_size, &ld);
+    if (w == nil)
+        return -1;
+    memmove(w, esn->W_output, esn->output_dim * ld * sizeof(float));
+    esn->W_output = w;
+    return 0;
+}
+
+/*
+ * Solve for W_out and stop training.  Returns -1, leaving W_out as it
+ * was, if not training, out of memory or the system isn't positive
+ * definite (no samples and no ridge).
+ */
+int
+esn_train_finish(EchoStateNetwork *esn)
+{
+    double *a, *b, *z, s;
+    int i, j, k, o, n, m;
+
+    a = esn->train_xtx;
+    b = esn->train_xty;
+    if (a == nil)
+        return -1;
+    n = esn->reservoir_size;
+    m = esn->output_dim;
+    z = malloc(n * sizeof(double));
+    if (z == nil || esn_own_output(esn) < 0) {
+        free(z);
+        return -1;
+    }
+
+    // Upper Cholesky factor U with UᵀU = XᵀX + ridge·I, over a
+    for (i = 0; i < n; i++) {
+        s = a[i*n + i] + esn->train_ridge;
+        for (k = 0; k < i; k++)
+            s -= a[k*n + i] * a[k*n + i];
+        if (s <= 0.0) {
+            free(z);
+            return -1;
+        }
+        a[i*n + i] = sqrt(s);
+        for (j = i + 1; j < n; j++) {
+            s = a[i*n + j];
+            for (k = 0; k < i; k++)
+                s -= a[k*n + i] * a[k*n + j];
+            a[i*n + j] = s / a[i*n + i];
+        }
+    }
+
+    // Each output: solve Uᵀz = XᵀY[:,o], then U·w = z
+    for (o = 0; o < m; o++) {
+        for (i = 0; i < n; i++) {
+            s = b[i*m + o];
+            for (k = 0; k < i; k++)
+                s -= a[k*n + i] * z[k];
+            z[i] = s / a[i*n + i];
+        }
+        for (i = n - 1; i >= 0; i--) {
+            s = z[i];
+            for (j = i + 1; j < n; j++)
+                s -= a[i*n + j] * z[j];
+            z[i] = s / a[i*n + i];
+        }
+        for (i = 0; i < n; i++)
+            esn->W_output[o*esn->ld_reservoir + i] = z[i];
+    }
+    free(z);
+
+    free(esn->train_xtx);
+    free(esn->train_xty);
+    esn->train_xtx = nil;
+    esn->train_xty = nil;
+    return 0;
+}
+
+long
+esn_train_samples(EchoStateNetwork *esn)
+{
+    return esn->train_xtx != nil ? esn->train_samples : -1;
+}
+
+/*
+ * ESN Registry
+ *
+ * Reservoirs created through ctl are named and kept here so later
+ * ctl commands can step and train them.
+ */
+enum {
+    Nesn = 512,                       // Most named reservoirs, clones included
+};
+
+static struct {
+    Lock;
+    EchoStateNetwork *tab[Nesn];
+    int n;
+} esn_registry;
+
+EchoStateNetwork*
+lookup_esn(char *name)
+{
+    EchoStateNetwork *esn;
+    int i;
+
+    esn = nil;
+    lock(&esn_registry);
+    for (i = 0; i < esn_registry.n; i++)
+        if (strcmp(esn_registry.tab[i]->esn_id, name) == 0) {
+            esn = esn_registry.tab[i];
+            break;
+        }
+    unlock(&esn_registry);
+    return esn;
+}
+
+// Name esn and add it to the registry; -1 if the name is taken or there is no room
+int
+esn_register(char *name, EchoStateNetwork *esn)
+{
+    int i;
+
+    free(esn->esn_id);
+    esn->esn_id = strdup(name);
+    lock(&esn_registry);
+    for (i = 0; i < esn_registry.n; i++)
+        if (strcmp(esn_registry.tab[i]->esn_id, name) == 0)
+            break;
+    if (i < esn_registry.n || esn_registry.n == Nesn) {
+        unlock(&esn_registry);
+        return -1;
+    }
+    esn_registry.tab[esn_registry.n++] = esn;
+    unlock(&esn_registry);
+    return 0;
+}
+
+// Create and name a reservoir; nil if the name is taken or there is no room
+EchoStateNetwork*
+register_esn(char *name, int size, int inputs, int outputs)
+{
+    EchoStateNetwork *esn;
+
+    if (lookup_esn(name) != nil || esn_registry.n == Nesn)
+        return nil;
+    esn = create_esn(size, inputs, outputs, 0.9);
+    if (esn == nil)
+        return nil;
+    if (esn_register(name, esn) < 0) {
+        esn_free(esn);
+        return nil;
+    }
+    return esn;
+}
+
+/*
+ * ESN Images
+ *
+ * A reservoir's weights as one flat image, EIhdrsize bytes of header
+ * and then six blocks, each starting on an EIalign boundary:
+ *
+ *	rowptr	reservoir_size+1 u32: CSR row starts
+ *	col	nnz u32: CSR columns
+ *	val	nnz f32: CSR weights
+ *	bias	reservoir_size f32
+ *	W_in	reservoir_size rows of ld_input f32
+ *	W_out	output_dim rows of ld_reservoir f32
+ *
+ * The header is little-endian u32s: EImagic, EIversion, image length,
+ * reservoir_size, input_dim, output_dim, nnz, ld_input, ld_reservoir,
+ * the bits of spectral_radius, input_scaling and leak_rate, then the
+ * six block offsets; the rest is zero.  Block data is little-endian
+ * and the floats IEEE single, the native form on every port, so a
+ * process that attaches a global segment holding an image uses the
+ * weights where they are.  The rows keep the in-kernel padding, so
+ * loading is a copy of each block.
+ */
+#define EIROUND(x)  (((x) + EIalign - 1) & ~(vlong)(EIalign - 1))
+
+static vlong
+esn_image_layout(int n, int d, int m, int nnz, long *off)
+{
+    vlong o;
+
+    o = EIhdrsize;
+    off[0] = o; o = EIROUND(o + (n + 1) * 4);
+    off[1] = o; o = EIROUND(o + (vlong)nnz * 4);
+    off[2] = o; o = EIROUND(o + (vlong)nnz * 4);
+    off[3] = o; o = EIROUND(o + n * 4);
+    off[4] = o; o = EIROUND(o + (vlong)n * ESNLD(d) * 4);
+    off[5] = o; o = EIROUND(o + (vlong)m * ESNLD(n) * 4);
+    return o;
+}
+
+static u32int
+esn_float_bits(float f)
+{
+    u32int v;
+
+    memmove(&v, &f, 4);
+    return v;
+}
+
+long
+esn_image_size(EchoStateNetwork *esn)
+{
+    long off[6];
+
+    return esn_image_layout(esn->reservoir_size, esn->input_dim, esn->output_dim,
+                            esn->W_rowptr != nil ? esn->W_nnz : 0, off);
+}
+
+// Write esn's image to buf; its length, or -1 if len is too short
+long
+esn_image_write(EchoStateNetwork *esn, uchar *buf, long len)
+{
+    long off[6], size;
+    uchar *p;
+    int i, n, nnz;
+
+    n = esn->reservoir_size;
+    nnz = esn->W_rowptr != nil ? esn->W_nnz : 0;
+    size = esn_image_layout(n, esn->input_dim, esn->output_dim, nnz, off);
+    if (len < size)
+        return -1;
+    memset(buf, 0, size);
+    PBIT32(buf, EImagic);
+    PBIT32(buf + 4, EIversion);
+    PBIT32(buf + 8, size);
+    PBIT32(buf + 12, n);
+    PBIT32(buf + 16, esn->input_dim);
+    PBIT32(buf + 20, esn->output_dim);
+    PBIT32(buf + 24, nnz);
+    PBIT32(buf + 28, esn->ld_input);
+    PBIT32(buf + 32, esn->ld_reservoir);
+    PBIT32(buf + 36, esn_float_bits(esn->spectral_radius));
+    PBIT32(buf + 40, esn_float_bits(esn->input_scaling));
+    PBIT32(buf + 44, esn_float_bits(esn->leak_rate));
+    for (i = 0; i < 6; i++) {
+        PBIT32(buf + 48 + i*4, off[i]);
+    }
+
+    for (i = 0; i <= n; i++) {
+        p = buf + off[0] + i*4;
+        PBIT32(p, esn->W_rowptr != nil ? esn->W_rowptr[i] : 0);
+    }
+    for (i = 0; i < nnz; i++) {
+        p = buf + off[1] + i*4;
+        PBIT32(p, esn->W_col[i]);
+    }
+    if (nnz > 0)
+        memmove(buf + off[2], esn->W_val, nnz * sizeof(float));
+    for (i = 0; i < n; i++)
+        memmove(buf + off[3] + i*4, &esn->nodes[i]->bias, 4);
+    memmove(buf + off[4], esn->W_input, n * esn->ld_input * sizeof(float));
+    memmove(buf + off[5], esn->W_output, esn->output_dim * esn->ld_reservoir * sizeof(float));
+    return size;
+}
+
+/*
+ * A new reservoir with the weights of the image in img, or nil if
+ * it is malformed or there is no memory.
+ */
+EchoStateNetwork*
+esn_image_load(uchar *img, long len)
+{
+    EchoStateNetwork *esn;
+    long off[6], size;
+    float f;
+    u32int v;
+    int i, n, d, m, nnz;
+
+    if (len < EIhdrsize || GBIT32(img) != EImagic || GBIT32(img + 4) != EIversion)
+        return nil;
+    n = GBIT32(img + 12);
+    d = GBIT32(img + 16);
+    m = GBIT32(img + 20);
+    nnz = GBIT32(img + 24);
+    if (n < 1 || n > 65536 || d < 1 || d > 256 || m < 1 || m > 256 ||
+       nnz < 0 || nnz > (vlong)n * n)
+        return nil;
+    if (GBIT32(img + 28) != ESNLD(d) || GBIT32(img + 32) != ESNLD(n))
+        return nil;
+    size = esn_image_layout(n, d, m, nnz, off);
+    if (GBIT32(img + 8) != size || size > len)
+        return nil;
+    for (i = 0; i < 6; i++)
+        if (GBIT32(img + 48 + i*4) != off[i])
+            return nil;
+
+    // The CSR structure must be consistent before anything follows it
+    if (GBIT32(img + off[0]) != 0 || GBIT32(img + off[0] + n*4) != nnz)
+        return nil;
+    for (i = 0; i < n; i++)
+        if (GBIT32(img + off[0] + i*4) > GBIT32(img + off[0] + (i + 1)*4))
+            return nil;
+    for (i = 0; i < nnz; i++)
+        if (GBIT32(img + off[1] + i*4) >= n)
+            return nil;
+
+    v = GBIT32(img + 36);
+    memmove(&f, &v, 4);
+    esn = esn_alloc(n, d, m, f);
+    if (esn == nil)
+        return nil;
+    v = GBIT32(img + 40);
+    memmove(&esn->input_scaling, &v, 4);
+    v = GBIT32(img + 44);
+    memmove(&esn->leak_rate, &v, 4);
+
+    esn->W_rowptr = malloc((n + 1) * sizeof(int));
+    esn->W_col = malloc((nnz > 0 ? nnz : 1) * sizeof(int));
+    esn->W_val = malloc((nnz > 0 ? nnz : 1) * sizeof(float));
+    if (esn->W_rowptr == nil || esn->W_col == nil || esn->W_val == nil ||
+       esn->W_input == nil || esn->W_output == nil) {
+        esn_free(esn);
+        return nil;
+    }
+    for (i = 0; i <= n; i++)
+        esn->W_rowptr[i] = GBIT32(img + off[0] + i*4);
+    for (i = 0; i < nnz; i++)
+        esn->W_col[i] = GBIT32(img + off[1] + i*4);
+    memmove(esn->W_val, img + off[2], nnz * sizeof(float));
+    esn->W_nnz = nnz;
+    for (i = 0; i < n; i++)
+        memmove(&esn->nodes[i]->bias, img + off[3] + i*4, 4);
+    memmove(esn->W_input, img + off[4], n * esn->ld_input * sizeof(float));
+    memmove(esn->W_output, img + off[5], m * esn->ld_reservoir * sizeof(float));
+    esn->kern = esn_kernel(esn);
+    return esn;
+}
+
+/*
+ * Checkpoints
+ *
+ * The registry and what adaptation has learned, as one image that a
+ * restarted node loads to resume with its domains, windows and
+ * reservoirs as they were, instead of rebuilding them by script and
+ * relearning the windows over minutes.  The header is CKhdrsize
+ * bytes of little-endian u32s: CKmagic, CKversion, image length,
+ * record count, seconds() when taken and a hash of the rest; then
+ * come the records, each a u32 kind and u32 length and that many
+ * bytes of body, padded to 4.  Bodies are u32s and strings, each
+ * a u16 length and the bytes:
+ *
+ *	CKdomain	domain path cpus load
+ *	CKchannel	id source target window max drain res accept
+ *			rate noblock type prio age[Nprio]
+ *	CKswarm		id domain cpus delivery latency coherence
+ *	CKesn		name mode, then the reservoir's image
+ *
+ * Processor sets are saved as counts and allocated afresh.  Messages,
+ * agents, patterns and membrane systems are not saved; they belong
+ * to processes or time windows that do not outlive a restart.
+ */
+enum {
+    CKdomain = 1,
+    CKchannel,
+    CKswarm,
+    CKesn,
+    CKstrmax = 256,               // Longest string in a record
+};
+
+typedef struct CkWriter CkWriter;
+struct CkWriter {
+    uchar *buf;
+    long n;                       // Bytes written
+    long size;                    // Bytes allocated, -1 once out of memory
+    long rec;                     // Offset of the open record's length
+    int nrec;
+};
+
+typedef struct CkReader CkReader;
+struct CkReader {
+    uchar *p;
+    uchar *e;
+    int bad;                      // Read past e
+};
+
+// n more bytes of w, or nil once allocation has failed
+static uchar*
+ck_room(CkWriter *w, long n)
+{
+    uchar *buf;
+    long size;
+
+    if (w->size < 0)
+        return nil;
+    if (w->n + n > w->size) {
+        size = w->size ? w->size : 4096;
+        while (size < w->n + n)
+            size *= 2;
+        buf = realloc(w->buf, size);
+        if (buf == nil) {
+            w->size = -1;
+            return nil;
+        }
+        w->buf = buf;
+        w->size = size;
+    }
+    buf = w->buf + w->n;
+    w->n += n;
+    return buf;
+}
+
+static void
+ck_put32(CkWriter *w, ulong v)
+{
+    uchar *p;
+
+    if ((p = ck_room(w, 4)) != nil)
+        PBIT32(p, v);
+}
+
+static void
+ck_putstr(CkWriter *w, char *s)
+{
+    uchar *p;
+    int n;
+
+    n = strlen(s);
+    if (n > CKstrmax)
+        n = CKstrmax;
+    if ((p = ck_room(w, 2 + n)) != nil) {
+        PBIT16(p, n);
+        memmove(p + 2, s, n);
+    }
+}
+
+static void
+ck_begin(CkWriter *w, int kind)
+{
+    ck_put32(w, kind);
+    w->rec = w->n;
+    ck_put32(w, 0);
+}
+
+static void
+ck_end(CkWriter *w)
+{
+    uchar *p;
+    long len;
+
+    len = w->n - w->rec - 4;
+    if ((p = ck_room(w, -len & 3)) != nil)
+        memset(p, 0, -len & 3);
+    if (w->size >= 0) {
+        PBIT32(w->buf + w->rec, len);
+        w->nrec++;
+    }
+}
+
+static ulong
+ck_get32(CkReader *r)
+{
+    ulong v;
+
+    if (r->e - r->p < 4) {
+        r->bad = 1;
+        return 0;
+    }
+    v = GBIT32(r->p);
+    r->p += 4;
+    return v;
+}
+
+// A string into s, which holds CKstrmax+1 bytes
+static void
+ck_getstr(CkReader *r, char *s)
+{
+    int n;
+
+    if (r->e - r->p < 2 || (n = GBIT16(r->p)) > CKstrmax || r->e - r->p < 2 + n) {
+        r->bad = 1;
+        s[0] = 0;
+        return;
+    }
+    memmove(s, r->p + 2, n);
+    s[n] = 0;
+    r->p += 2 + n;
+}
+
+// The next record's kind, with its body in body; 0 at the end, -1 if malformed
+static int
+ck_record(CkReader *r, CkReader *body)
+{
+    ulong kind, len;
+
+    if (r->p == r->e)
+        return 0;
+    kind = ck_get32(r);
+    len = ck_get32(r);
+    if (r->bad || kind == 0 || len > r->e - r->p || ((len + 3) & ~3) > r->e - r->p)
+        return -1;
+    body->p = r->p;
+    body->e = r->p + len;
+    body->bad = 0;
+    r->p += (len + 3) & ~3;
+    return kind;
+}
+
+static ulong
+ck_hash(uchar *p, long n)
+{
+    ulong h;
+
+    h = 2166136261UL;
+    while (n-- > 0)
+        h = (h ^ *p++) * 16777619UL;
+    return h;
+}
+
+static int
+ck_ncpu(ulong mask)
+{
+    int n;
+
+    for (n = 0; mask != 0; mask &= mask - 1)
+        n++;
+    return n;
+}
+
+/*
+ * Take a checkpoint: its length, with the image in *bufp for the
+ * caller to free, or -1 if there is no memory.
+ */
+long
+cognitive_checkpoint(uchar **bufp)
+{
+    CkWriter w;
+    CognitiveNamespace *cns;
+    NeuralChannel *nc;
+    CognitiveSwarm *swarm;
+    EchoStateNetwork *esn;
+    uchar *p;
+    long n;
+    int i, j;
+
+    memset(&w, 0, sizeof w);
+    ck_room(&w, CKhdrsize);
+    rlock(&cognitive_state.reglock);
+    for (i = 0; i < Nnshash; i++)
+        for (cns = cognitive_state.nshash[i]; cns != nil; cns = cns->hash_next) {
+            ck_begin(&w, CKdomain);
+            ck_putstr(&w, cns->domain);
+            ck_putstr(&w, cns->namespace_path);
+            ck_put32(&w, ck_ncpu(cns->cpus));
+            ck_put32(&w, cns->cognitive_load);
+            ck_end(&w);
+        }
+    for (i = 0; i < Nchhash; i++)
+        for (nc = cognitive_state.chhash[i]; nc != nil; nc = nc->hash_next) {
+            // Swarms make their own coordination channels
+            if (strcmp(nc->target_domain, "swarm-coordination") == 0)
+                continue;
+            ck_begin(&w, CKchannel);
+            ck_putstr(&w, nc->channel_id);
+            ck_putstr(&w, nc->source_domain);
+            ck_putstr(&w, nc->target_domain);
+            ck_put32(&w, nc->bandwidth_capacity);
+            ck_put32(&w, nc->max_capacity);
+            ck_put32(&w, nc->drain_rate);
+            ck_put32(&w, nc->res_avg);
+            ck_put32(&w, nc->accept_avg);
+            ck_put32(&w, nc->sketch.rate_avg);
+            ck_put32(&w, nc->noblock);
+            ck_put32(&w, nc->data_type);
+            ck_put32(&w, nc->data_prio);
+            for (j = 0; j < Nprio; j++)
+                ck_put32(&w, nc->level[j].age_limit);
+            ck_end(&w);
+        }
+    for (i = 0; i < Nswhash; i++)
+        for (swarm = cognitive_state.swhash[i]; swarm != nil; swarm = swarm->hash_next) {
+            ck_begin(&w, CKswarm);
+            ck_putstr(&w, swarm->swarm_id);
+            ck_putstr(&w, swarm->domain);
+            ck_put32(&w, ck_ncpu(swarm->cpus));
+            ck_put32(&w, swarm->cast_delivery);
+            ck_put32(&w, swarm->cast_latency);
+            ck_put32(&w, esn_float_bits(swarm->coherence_level));
+            ck_end(&w);
+        }
+    runlock(&cognitive_state.reglock);
+
+    // Reservoirs are never unregistered, so the table only grows;
+    // clones are speculative and left out
+    for (i = 0; i < esn_registry.n; i++) {
+        esn = esn_registry.tab[i];
+        if (esn->clone)
+            continue;
+        esn_ctl_lock(esn);
+        ck_begin(&w, CKesn);
+        ck_putstr(&w, esn->esn_id);
+        ck_put32(&w, esn->hyper ? ESNhyper : esn->fixed ? ESNfixed : ESNfloat);
+        n = esn_image_size(esn);
+        if ((p = ck_room(&w, n)) != nil)
+            esn_image_write(esn, p, n);
+        ck_end(&w);
+        esn_ctl_unlock(esn);
+    }
+
+    if (w.size < 0) {
+        free(w.buf);
+        return -1;
+    }
+    memset(w.buf, 0, CKhdrsize);
+    PBIT32(w.buf, CKmagic);
+    PBIT32(w.buf + 4, CKversion);
+    PBIT32(w.buf + 8, w.n);
+    PBIT32(w.buf + 12, w.nrec);
+    PBIT32(w.buf + 16, seconds());
+    PBIT32(w.buf + 20, ck_hash(w.buf + CKhdrsize, w.n - CKhdrsize));
+    *bufp = w.buf;
+    return w.n;
+}
+
+// Length of the image whose header is in hdr, or -1 if it isn't one
+long
+cognitive_checkpoint_length(uchar *hdr)
+{
+    if (GBIT32(hdr) != CKmagic || GBIT32(hdr + 4) != CKversion || GBIT32(hdr + 8) < CKhdrsize)
+        return -1;
+    return GBIT32(hdr + 8);
+}
+
+// Whether the image has a channel named id
+static int
+ck_has_channel(uchar *img, long len, char *id)
+{
+    CkReader r, body;
+    char s[CKstrmax + 1];
+
+    r.p = img + CKhdrsize;
+    r.e = img + len;
+    r.bad = 0;
+    while (ck_record(&r, &body) > 0)
+        if (body.e - body.p >= 2 && GBIT16(body.p) == strlen(id)) {
+            ck_getstr(&body, s);
+            if (strcmp(s, id) == 0)
+                return 1;
+        }
+    return 0;
+}
+
+/*
+ * A channel from src to dst that the image doesn't name and that
+ * no earlier record took, so that a boot-time channel, whose id
+ * carries the boot time, inherits what its predecessor learned.
+ */
+static NeuralChannel*
+ck_pair(uchar *img, long len, char *src, char *dst, NeuralChannel **taken, int ntaken)
+{
+    NeuralChannel *nc;
+    int i, j;
+
+    rlock(&cognitive_state.reglock);
+    for (i = 0; i < Nchhash; i++)
+        for (nc = cognitive_state.chhash[i]; nc != nil; nc = nc->hash_next) {
+            if (strcmp(nc->source_domain, src) != 0 || strcmp(nc->target_domain, dst) != 0)
+                continue;
+            for (j = 0; j < ntaken; j++)
+                if (taken[j] == nc)
+                    break;
+            if (j == ntaken && !ck_has_channel(img, len, nc->channel_id)) {
+                runlock(&cognitive_state.reglock);
+                return nc;
+            }
+        }
+    runlock(&cognitive_state.reglock);
+    return nil;
+}
+
+static void
+ck_restore_domain(CkReader *r)
+{
+    CognitiveNamespace *cns;
+    char domain[CKstrmax + 1], path[CKstrmax + 1];
+    int ncpu, load;
+
+    ck_getstr(r, domain);
+    ck_getstr(r, path);
+    ncpu = ck_get32(r);
+    load = ck_get32(r);
+    cns = lookup_cognitive_namespace(domain);
+    if (cns == nil) {
+        cns = create_cognitive_namespace(domain, path);
+        if (cns == nil)
+            return;
+        if (register_cognitive_namespace(cns) < 0) {
+            free_cognitive_namespace(cns);
+            return;
+        }
+    }
+    cns->cognitive_load = load;
+    if (ncpu > 0)
+        namespace_set_cpus(cns, ncpu);
+}
+
+static NeuralChannel*
+ck_restore_channel(CkReader *r, uchar *img, long len, NeuralChannel **taken, int ntaken)
+{
+    CognitiveNamespace *src, *dst;
+    NeuralChannel *nc;
+    char id[CKstrmax + 1], s[CKstrmax + 1], d[CKstrmax + 1];
+    ulong window, max;
+    int i;
+
+    ck_getstr(r, id);
+    ck_getstr(r, s);
+    ck_getstr(r, d);
+    window = ck_get32(r);
+    max = ck_get32(r);
+    nc = lookup_neural_channel(id);
+    if (nc == nil)
+        nc = ck_pair(img, len, s, d, taken, ntaken);
+    if (nc == nil) {
+        src = lookup_cognitive_namespace(s);
+        dst = lookup_cognitive_namespace(d);
+        if (src == nil || dst == nil)
+            return nil;
+        nc = create_neural_channel(s, d, window);
+        if (nc == nil)
+            return nil;
+        free(nc->channel_id);
+        nc->channel_id = strdup(id);
+        if (nc->channel_id == nil || register_neural_channel(nc) < 0) {
+            free_neural_channel(nc);
+            return nil;
+        }
+        bind_neural_channel_to_namespace(src, nc);
+        bind_neural_channel_to_namespace(dst, nc);
+    }
+    set_neural_channel_capacity(nc, window, max);
+    nc->drain_rate = ck_get32(r);
+    nc->res_avg = ck_get32(r);
+    nc->accept_avg = ck_get32(r);
+    nc->sketch.rate_avg = ck_get32(r);
+    set_neural_channel_noblock(nc, ck_get32(r) != 0);
+    nc->data_type = ck_get32(r);
+    nc->data_prio = ck_get32(r);
+    for (i = 0; i < Nprio; i++)
+        nc->level[i].age_limit = ck_get32(r);
+    return nc;
+}
+
+static void
+ck_restore_swarm(CkReader *r)
+{
+    CognitiveSwarm *swarm;
+    char id[CKstrmax + 1], domain[CKstrmax + 1];
+    ulong v;
+    int ncpu;
+
+    ck_getstr(r, id);
+    ck_getstr(r, domain);
+    ncpu = ck_get32(r);
+    swarm = lookup_cognitive_swarm(id);
+    if (swarm == nil) {
+        if (lookup_cognitive_namespace(domain) == nil)
+            return;
+        swarm = create_cognitive_swarm(id, domain, nil);
+        if (swarm == nil || register_cognitive_swarm(swarm) < 0)
+            return;
+    }
+    if (ncpu > 0)
+        swarm_set_cpus(swarm, ncpu);
+    lock(&swarm->swarm_lock);
+    swarm->cast_delivery = ck_get32(r);
+    swarm->cast_latency = ck_get32(r);
+    v = ck_get32(r);
+    memmove(&swarm->coherence_level, &v, 4);
+    unlock(&swarm->swarm_lock);
+}
+
+static int
+ck_restore_esn(CkReader *r)
+{
+    EchoStateNetwork *esn;
+    char name[CKstrmax + 1];
+    int mode;
+
+    ck_getstr(r, name);
+    mode = ck_get32(r);
+    if (r->bad || lookup_esn(name) != nil)
+        return 0;
+    esn = esn_image_load(r->p, r->e - r->p);
+    if (esn == nil)
+        return 0;
+    if (esn_register(name, esn) < 0) {
+        esn_free(esn);
+        return 0;
+    }
+    esn_ctl_lock(esn);
+    if (mode == ESNhyper)
+        esn_set_hyper(esn, 1);
+    else if (mode == ESNfixed)
+        esn_set_fixed(esn, 1);
+    esn_ctl_unlock(esn);
+    return 1;
+}
+
+/*
+ * Restore the checkpoint in img.  What already exists is updated
+ * in place and the rest is created: domains first, then the
+ * channels between them, swarms and reservoirs.  A reservoir that
+ * already exists is left alone.  -1 if the image is malformed, in
+ * which case nothing has changed.
+ */
+int
+cognitive_restore(uchar *img, long len)
+{
+    CkReader r, body;
+    NeuralChannel **taken;
+    int kind, pass, nrec, nchan, n[CKesn + 1];
+
+    if (len < CKhdrsize || cognitive_checkpoint_length(img) != len)
+        return -1;
+    if (GBIT32(img + 20) != ck_hash(img + CKhdrsize, len - CKhdrsize))
+        return -1;
+
+    // Every record must parse before any is applied
+    nrec = 0;
+    nchan = 0;
+    r.p = img + CKhdrsize;
+    r.e = img + len;
+    r.bad = 0;
+    while ((kind = ck_record(&r, &body)) > 0) {
+        nrec++;
+        if (kind == CKchannel)
+            nchan++;
+    }
+    if (kind < 0 || nrec != GBIT32(img + 12))
+        return -1;
+
+    taken = malloc((nchan + 1) * sizeof(NeuralChannel*));
+    if (taken == nil)
+        return -1;
+    memset(n, 0, sizeof n);
+    for (pass = CKdomain; pass <= CKesn; pass++) {
+        r.p = img + CKhdrsize;
+        r.bad = 0;
+        while ((kind = ck_record(&r, &body)) > 0) {
+            if (kind != pass)
+                continue;
+            switch (kind) {
+            case CKdomain:
+                ck_restore_domain(&body);
+                n[kind]++;
+                break;
+            case CKchannel:
+                if ((taken[n[kind]] = ck_restore_channel(&body, img, len, taken, n[kind])) != nil)
+                    n[kind]++;
+                break;
+            case CKswarm:
+                ck_restore_swarm(&body);
+                n[kind]++;
+                break;
+            case CKesn:
+                n[kind] += ck_restore_esn(&body);
+                break;
+            }
+        }
+    }
+    free(taken);
+    cognitive_event("restore domains=%d channels=%d swarms=%d esns=%d taken=%lud",
+                    n[CKdomain], n[CKchannel], n[CKswarm], n[CKesn], (ulong)GBIT32(img + 16));
+    return 0;
+}
+
+/*
+ * Periodic checkpoints.  A process hands over an open fd, as for
+ * neural_link, and a kproc rewrites the file from its start every
+ * ms milliseconds, so a node can be restarted from the last one.
+ */
+static struct {
+    QLock;
+    Chan *c;                      // Where checkpoints go, nil to stop
+    long ms;
+    ulong gen;                    // Bumped by each change of c or ms
+    int running;
+    Rendez r;
+    ulong saved;
+    ulong failed;
+    long bytes;                   // Length of the last one saved
+} cogckpt;
+
+static int
+ck_changed(void *a)
+{
+    return cogckpt.gen != (ulong)a;
+}
+
+static void
+ck_save(Chan *c)
+{
+    uchar *buf, stat[STATFIXLEN];
+    long n;
+    Dir d;
+
+    n = cognitive_checkpoint(&buf);
+    if (n < 0) {
+        cogckpt.failed++;
+        return;
+    }
+    if (waserror()) {
+        free(buf);
+        cogckpt.failed++;
+        cognitive_event("checkpoint failed: %s", up->errstr);
+        return;
+    }
+    if (devtab[c->type]->write(c, buf, n, 0) != n)
+        error(Eshortwrite);
+    poperror();
+    free(buf);
+    cogckpt.saved++;
+    cogckpt.bytes = n;
+
+    // Drop the tail of a longer one; a file server may not allow it
+    if (!waserror()) {
+        memset(&d, ~0, sizeof d);
+        d.name = d.uid = d.gid = d.muid = "";
+        d.length = n;
+        devtab[c->type]->wstat(c, stat, convD2M(&d, stat, sizeof stat));
+        poperror();
+    }
+}
+
+static void
+cognitive_checkpointproc(void*)
+{
+    Chan *c;
+    ulong gen;
+    long ms;
+
+    for (;;) {
+        qlock(&cogckpt);
+        c = cogckpt.c;
+        if (c == nil) {
+            cogckpt.running = 0;
+            qunlock(&cogckpt);
+            pexit("", 1);
+        }
+        incref(c);
+        ms = cogckpt.ms;
+        gen = cogckpt.gen;
+        qunlock(&cogckpt);
+        ck_save(c);
+        cclose(c);
+        tsleep(&cogckpt.r, ck_changed, (void*)gen, ms);
+    }
+}
+
+// Checkpoint to fd every ms milliseconds, or stop if ms is 0
+void
+cognitive_checkpoint_every(int fd, long ms)
+{
+    Chan *c, *old;
+
+    c = nil;
+    if (ms > 0)
+        c = fdtochan(fd, OWRITE, 1, 1);
+    qlock(&cogckpt);
+    old = cogckpt.c;
+    cogckpt.c = c;
+    cogckpt.ms = ms;
+    cogckpt.gen++;
+    if (c != nil && !cogckpt.running) {
+        cogckpt.running = 1;
+        kproc("cogckpt", cognitive_checkpointproc, nil);
+    }
+    qunlock(&cogckpt);
+    wakeup(&cogckpt.r);
+    if (old != nil)
+        cclose(old);
+}
+
+static int
+cognitive_checkpoint_stats(char *buf, int len)
+{
+    return snprint(buf, len, "checkpoint every %ld saved %lud failed %lud bytes %ld\n",
+                   cogckpt.c != nil ? cogckpt.ms : 0, cogckpt.saved, cogckpt.failed, cogckpt.bytes);
+}
+
+void
+esn_ctl_lock(EchoStateNetwork *esn)
+{
+    qlock(&esn->ctl_lock);
+}
+
+void
+esn_ctl_unlock(EchoStateNetwork *esn)
+{
+    qunlock(&esn->ctl_lock);
+}
+
+int
+esn_input_dim(EchoStateNetwork *esn)
+{
+    return esn->input_dim;
+}
+
+int
+esn_output_dim(EchoStateNetwork *esn)
+{
+    return esn->output_dim;
+}
+
+/*
+ * Batched driving.
+ *
+ * esn_run advances one reservoir over a whole input sequence.  The
+ * input projections W_in·u(t) for a block of ESNblock steps are
+ * computed together, each row of W_in staying in cache across the
+ * block, so only the sparse recurrence is left per step.
+ *
+ * An ESNBatch runs K reservoirs that share one network's weights in
+ * lockstep.  Their states are stored node-major (x[j*K + k] is node j
+ * of reservoir k), so each weight is loaded once and applied to K
+ * contiguous values: a sparse matrix times a K-column matrix rather
+ * than K separate matrix-vector products.
+ */
+enum {
+    ESNblock = 16,                    // Steps whose input projections are done together
+};
+
+typedef struct ESNBatch ESNBatch;
+struct ESNBatch {
+    EchoStateNetwork *esn;            // Shared weights
+    int k;                            // Reservoirs
+    float *x;                         // Current states, reservoir_size x k
+    float *xnext;                     // States being computed
+    float *acc;                       // k partial sums
+};
+
+/*
+ * Advance esn over t input rows of input_dim floats.  If outputs is
+ * not nil, the readout after each step is stored there, output_dim
+ * floats per step.  Returns the steps taken.
+ */
+int
+esn_run(EchoStateNetwork *esn, float *inputs, int t, float *outputs)
+{
+    float *proj, *w;
+    int n, d, i, s, s0, nb;
+
+    n = esn->reservoir_size;
+    d = esn->input_dim;
+    // Fixed point quantizes each input as it steps
+    proj = esn->fixed ? nil : malloc(ESNblock * n * sizeof(float));
+    for (s0 = 0; s0 < t; s0 += nb) {
+        nb = t - s0 < ESNblock ? t - s0 : ESNblock;
+        if (proj != nil)
+            for (i = 0; i < n; i++) {
+                w = esn->W_input + i*esn->ld_input;
+                for (s = 0; s < nb; s++)
+                    proj[s*n + i] = esn_dot(w, inputs + (s0 + s)*d, d);
+            }
+        for (s = 0; s < nb; s++) {
+            esn_advance(esn, inputs + (s0 + s)*d, proj != nil ? proj + s*n : nil);
+            if (outputs != nil)
+                esn_compute_output(esn, outputs + (s0 + s)*esn->output_dim);
+        }
+    }
+    free(proj);
+    return t;
+}
+
+void
+esn_batch_free(ESNBatch *b)
+{
+    if (b == nil)
+        return;
+    free(b->x);
+    free(b->xnext);
+    free(b->acc);
+    free(b);
+}
+
+// K reservoirs driven with esn's weights, all starting from esn's current state
+ESNBatch*
+esn_batch_create(EchoStateNetwork *esn, int k)
+{
+    ESNBatch *b;
+    int j, r, n;
+
+    if (k < 1)
+        return nil;
+    n = esn->reservoir_size;
+    b = malloc(sizeof(ESNBatch));
+    if (b == nil)
+        return nil;
+    b->esn = esn;
+    b->k = k;
+    b->x = malloc(n * k * sizeof(float));
+    b->xnext = malloc(n * k * sizeof(float));
+    b->acc = malloc(k * sizeof(float));
+    if (b->x == nil || b->xnext == nil || b->acc == nil) {
+        esn_batch_free(b);
+        return nil;
+    }
+    for (j = 0; j < n; j++)
+        for (r = 0; r < k; r++)
+            b->x[j*k + r] = esn->current_state->activations[j];
+    return b;
+}
+
+/*
+ * Advance every reservoir one step.  inputs holds input_dim x K
+ * floats, node-major like the states: inputs[d*K + k] is input d of
+ * reservoir k.
+ */
+void
+esn_batch_step(ESNBatch *b, float *inputs)
+{
+    EchoStateNetwork *esn;
+    float *acc, *x, *u, *t, w, a;
+    int i, j, k, r, kk, n, d;
+
+    esn = b->esn;
+    n = esn->reservoir_size;
+    d = esn->input_dim;
+    k = b->k;
+    acc = b->acc;
+    a = esn->leak_rate;
+    for (i = 0; i < n; i++) {
+        for (r = 0; r < k; r++)
+            acc[r] = esn->nodes[i]->bias;
+
+        // W·X over row i's connections
+        if (esn->W_rowptr != nil)
+            for (kk = esn->W_rowptr[i]; kk < esn->W_rowptr[i+1]; kk++) {
+                w = esn->W_val[kk];
+                x = b->x + esn->W_col[kk]*k;
+                for (r = 0; r < k; r++)
+                    acc[r] += w * x[r];
+            }
+
+        // W_in·U
+        for (j = 0; j < d; j++) {
+            w = esn->W_input[i*esn->ld_input + j];
+            u = inputs + j*k;
+            for (r = 0; r < k; r++)
+                acc[r] += w * u[r];
+        }
+
+        x = b->x + i*k;
+        t = b->xnext + i*k;
+        for (r = 0; r < k; r++)
+            t[r] = (1.0 - a) * x[r] + a * tanh(acc[r]);
+    }
+    t = b->x;
+    b->x = b->xnext;
+    b->xnext = t;
+}
+
+// Copy reservoir r's activations into out, reservoir_size floats
+void
+esn_batch_state(ESNBatch *b, int r, float *out)
+{
+    int j, n;
+
+    n = b->esn->reservoir_size;
+    if (r < 0 || r >= b->k)
+        return;
+    for (j = 0; j < n; j++)
+        out[j] = b->x[j*b->k + r];
+}
+
+static void
+esn_weights_put(ESNWeights *w)
+{
+    if (decref(w) > 0)
+        return;
+    free(w->W_rowptr);
+    free(w->W_col);
+    free(w->W_val);
+    free(w->W_input);
+    free(w->W_output);
+    free(w);
+}
+
+void
+esn_free(EchoStateNetwork *esn)
+{
+    ESNHistory *h;
+    int i;
+
+    if (esn == nil)
+        return;
+    if (esn->nodeblock != nil)
+        free(esn->nodeblock);
+    else
+        for (i = 0; i < esn->reservoir_size; i++) {
+            free(esn->nodes[i]->membrane_id);
+            free(esn->nodes[i]);
+        }
+    free(esn->nodes);
+    free(esn->forest);
+    esn_hypergraph_free(esn->hypergraph);
+    if (esn->weights != nil) {
+        if (esn->W_output != esn->weights->W_output)
+            free(esn->W_output);
+        esn_weights_put(esn->weights);
+    } else {
+        free(esn->W_rowptr);
+        free(esn->W_col);
+        free(esn->W_val);
+        free(esn->W_input);
+        free(esn->W_output);
+    }
+    esn_free_ring(esn->ring, esn->ring_depth);
+    free(esn->train_xtx);
+    free(esn->train_xty);
+    esn_fixed_free(esn);
+    while (esn->history != nil) {
+        h = esn->history;
+        esn->history = h->next;
+        free(h);
+    }
+    free(esn->esn_id);
+    free(esn);
+}
+
+/*
+ * ESN Clones
+ *
+ * A clone is a reservoir for running what-if trajectories: it shares
+ * its parent's W, W_input and readout through an ESNWeights and has
+ * only state of its own, the nodes, the state ring and the Matula
+ * levels, so each costs O(reservoir_size) however dense W is.
+ * Clones start in floating point; fixed point and the hypergraph are
+ * derived from W per network and cost O(W) again.  Training a clone
+ * or its parent copies the readout first, see esn_own_output.
+ */
+
+// Make st esn's only retained state, with the Matula levels that go with it
+static int
+esn_adopt_state(EchoStateNetwork *esn, ESNState *st, uchar *levels, MatulaBig *acc, int valid, int depth)
+{
+    ESNState *cur;
+    ESNHistory *h;
+    int i;
+
+    cur = esn->current_state;
+    esn->current_state = st;
+    if (esn_set_history_depth(esn, depth) < 0) {
+        esn->current_state = cur;
+        return -1;
+    }
+    for (i = 0; i < esn->reservoir_size; i++)
+        esn->nodes[i]->activation = esn->current_state->activations[i];
+    memmove(esn->levels, levels, sizeof esn->levels);
+    esn->matula_acc = *acc;
+    esn->matula_valid = valid;
+    while (esn->history != nil) {
+        h = esn->history;
+        esn->history = h->next;
+        free(h);
+    }
+    esn->history_tail = nil;
+    esn->history_chunks = 0;
+    esn->history_size = 0;
+    esn_fixed_sync(esn);
+    return 0;
+}
+
+// A clone of parent in its current state; the caller holds parent's ctl lock
+EchoStateNetwork*
+esn_clone(EchoStateNetwork *parent)
+{
+    EchoStateNetwork *esn;
+    ESNWeights *w;
+    int i, n, ld;
+
+    n = parent->reservoir_size;
+    w = parent->weights;
+    if (w == nil) {
+        w = malloc(sizeof *w);
+        if (w == nil)
+            return nil;
+        w->ref = 1;
+        w->W_rowptr = parent->W_rowptr;
+        w->W_col = parent->W_col;
+        w->W_val = parent->W_val;
+        w->W_input = parent->W_input;
+        w->W_output = parent->W_output;
+        parent->weights = w;
     }
-    
-    for (i = 0; i < output_dim; i++) {
-        esn->W_output[i] = malloc(reservoir_size * sizeof(float));
+
+    esn = malloc(sizeof(EchoStateNetwork));
+    if (esn == nil)
+        return nil;
+    esn->nodes = malloc(n * sizeof(ReservoirNode*));
+    esn->nodeblock = malloc(n * sizeof(ReservoirNode));
+    esn->forest = malloc(n * sizeof(RootedTree*));
+    if (parent->W_output == w->W_output)
+        esn->W_output = w->W_output;
+    else if ((esn->W_output = esn_matrix(parent->output_dim, n, &ld)) != nil)
+        memmove(esn->W_output, parent->W_output, parent->output_dim * ld * sizeof(float));
+    if (esn->nodes == nil || esn->nodeblock == nil || esn->forest == nil || esn->W_output == nil) {
+        if (esn->W_output != w->W_output)
+            free(esn->W_output);
+        free(esn->nodes);
+        free(esn->nodeblock);
+        free(esn->forest);
+        free(esn);
+        return nil;
     }
-    
-    // Initialize reservoir weights (sparse random)
-    esn_init_reservoir_weights(esn);
-    
-    // Initialize input weights (random)
-    for (i = 0; i < reservoir_size; i++) {
-        for (j = 0; j < input_dim; j++) {
-            esn->W_input[i][j] = (frand() - 0.5) * 2.0 * esn->input_scaling;
-        }
+    for (i = 0; i < n; i++) {
+        esn->nodeblock[i] = *parent->nodes[i];
+        esn->nodeblock[i].membrane_id = nil;
+        esn->nodes[i] = &esn->nodeblock[i];
     }
-    
-    // Initialize state
-    esn->current_state = malloc(sizeof(ESNState));
-    esn->current_state->activations = malloc(reservoir_size * sizeof(float));
-    esn->current_state->reservoir_size = reservoir_size;
-    esn->current_state->matula_encoding = 1; // Start with single node
-    esn->current_state->timestamp = time(NULL);
-    esn->current_state->previous = nil;
-    
-    // Initialize history
-    esn->history_capacity = 1000;
-    esn->matula_history = malloc(esn->history_capacity * sizeof(uvlong));
-    esn->history_size = 0;
-    
+
+    esn->esn_id = smprint("%s-clone", parent->esn_id);
+    esn->clone = 1;
+    esn->reservoir_size = n;
+    esn->spectral_radius = parent->spectral_radius;
+    esn->input_scaling = parent->input_scaling;
+    esn->leak_rate = parent->leak_rate;
+    esn->sparsity = parent->sparsity;
+    esn->input_dim = parent->input_dim;
+    esn->output_dim = parent->output_dim;
+    esn->workers = 1;
+    esn->kern = parent->kern;
+    esn->W_rowptr = parent->W_rowptr;
+    esn->W_col = parent->W_col;
+    esn->W_val = parent->W_val;
+    esn->W_nnz = parent->W_nnz;
+    esn->W_input = parent->W_input;
+    esn->ld_input = parent->ld_input;
+    esn->ld_reservoir = parent->ld_reservoir;
+    incref(w);
+    esn->weights = w;
     esn->creation_time = time(NULL);
-    
+
+    if (esn_adopt_state(esn, parent->current_state, parent->levels, &parent->matula_acc,
+                        parent->matula_valid, parent->ring_depth) < 0) {
+        esn->current_state = nil;
+        esn_free(esn);
+        return nil;
+    }
     return esn;
 }
 
 /*
- * Initialize reservoir weights with sparse random connectivity
- * Scale to desired spectral radius
+ * Put clone back in parent's current state, so a pool of named
+ * clones can be rerun without registering new ones.  -1 if clone
+ * does not share parent's weights or is out of memory.
  */
-void
-esn_init_reservoir_weights(EchoStateNetwork *esn)
+int
+esn_clone_reset(EchoStateNetwork *clone, EchoStateNetwork *parent)
 {
-    int i, j;
-    float sparsity = 0.1; // 10% connectivity
-    float sum, scale;
-    
-    // Create sparse random weights
-    for (i = 0; i < esn->reservoir_size; i++) {
-        for (j = 0; j < esn->reservoir_size; j++) {
-            if (frand() < sparsity) {
-                esn->W_reservoir[i][j] = (frand() - 0.5) * 2.0;
-            } else {
-                esn->W_reservoir[i][j] = 0.0;
-            }
-        }
-    }
-    
-    // Scale to spectral radius (simplified: scale by largest row sum)
-    sum = 0.0;
-    for (i = 0; i < esn->reservoir_size; i++) {
-        float row_sum = 0.0;
-        for (j = 0; j < esn->reservoir_size; j++) {
-            row_sum += esn->W_reservoir[i][j] * esn->W_reservoir[i][j];
-        }
-        if (row_sum > sum)
-            sum = row_sum;
-    }
-    
-    scale = esn->spectral_radius / sqrt(sum);
-    for (i = 0; i < esn->reservoir_size; i++) {
-        for (j = 0; j < esn->reservoir_size; j++) {
-            esn->W_reservoir[i][j] *= scale;
-        }
-    }
+    ESNState *st;
+    uchar levels[NPRIMES];
+    MatulaBig acc;
+    int valid, r;
+
+    if (!clone->clone || clone->weights == nil || clone->weights != parent->weights)
+        return -1;
+    esn_ctl_lock(parent);
+    st = esn_snapshot_state(parent, 0);
+    memmove(levels, parent->levels, sizeof levels);
+    acc = parent->matula_acc;
+    valid = parent->matula_valid;
+    esn_ctl_unlock(parent);
+    if (st == nil)
+        return -1;
+    esn_ctl_lock(clone);
+    r = esn_adopt_state(clone, st, levels, &acc, valid, clone->ring_depth);
+    esn_ctl_unlock(clone);
+    esn_free_state(st);
+    return r;
 }
 
 /*
- * ESN State Update: Core recurrence equation
- * x(t+1) = f(W·x(t) + W_in·u(t))
+ * Sensor Pipelines
+ *
+ * The path from a street sensor to a decision, run inside the
+ * kernel so it can be measured whole: one kproc reads datagrams
+ * from a UDP conversation and queues them on a neural channel, and
+ * another drains the channel, steps a reservoir on each packet and
+ * computes its readout.  The process starting a pipeline hands over
+ * an open fd for the conversation's data file, announced and in
+ * headers mode so every sender's datagrams arrive on it, as for
+ * neural_link.  After udp's header each packet is, little-endian:
+ *	stamp[8] seq[4] count[4] value[4*count]
+ * stamp is the sender's nsec(), so the decision latency, from stamp
+ * to readout, covers the IP stack, the channel and the reservoir;
+ * the count values are the reservoir's inputs, floats by their bits.
+ * Busy time counts what both kprocs spend working and not waiting,
+ * so events over busy time is the pipeline's rate per CPU.
+ *
+ * A stopped pipeline's ingest kproc leaves at the next datagram.
  */
-void
-esn_update_state(EchoStateNetwork *esn, float *input)
+enum {
+    SPudphdr = 52,                    // udp's headers mode prefix, see ip/udp.c
+    SPhdr = 16,
+    SPbatch = 64,                     // Packets stepped per drain
+    SPwaitms = 100,                   // Wait for channel credit before dropping
+};
+
+typedef struct SensorPipe SensorPipe;
+struct SensorPipe {
+    EchoStateNetwork *esn;
+    NeuralChannel *nc;
+    Chan *c;                          // Conversation's data file
+    int dying;
+    int procs;                        // kprocs still running
+    ulong packets;                    // Datagrams queued
+    ulong dropped;                    // No credit or no memory
+    ulong malformed;
+    ulong events;                     // Packets stepped to a decision
+    uvlong ingest_busy;               // fastticks working, per kproc
+    uvlong drive_busy;
+    ulong maxus;
+    ulong hist[Nlathist];             // Stamp-to-readout latency
+    SensorPipe *next;
+};
+
+static struct {
+    QLock;
+    SensorPipe *pipes;
+} sensorpipes;
+
+static void
+sensor_pipe_exit(SensorPipe *sp)
 {
-    ESNState *new_state;
-    float *new_activations;
-    int i, j;
-    float sum, old_activation;
-    
-    new_state = malloc(sizeof(ESNState));
-    new_activations = malloc(esn->reservoir_size * sizeof(float));
-    
-    // Compute new activations
-    for (i = 0; i < esn->reservoir_size; i++) {
-        sum = esn->nodes[i]->bias;
-        
-        // Reservoir recurrence: W·x(t)
-        for (j = 0; j < esn->reservoir_size; j++) {
-            sum += esn->W_reservoir[i][j] * esn->current_state->activations[j];
+    qlock(&sensorpipes);
+    sp->procs--;
+    qunlock(&sensorpipes);
+    pexit("", 1);
+}
+
+static void
+sensor_ingest_proc(void *a)
+{
+    SensorPipe *sp;
+    NeuralMessage *msg;
+    Block *b;
+    uvlong t0;
+
+    sp = a;
+    while (!sp->dying) {
+        if (waserror())
+            break;
+        b = devtab[sp->c->type]->bread(sp->c, NBmaxmsg + SPudphdr, 0);
+        if (b == nil) {
+            poperror();
+            break;
         }
-        
-        // Input: W_in·u(t)
-        for (j = 0; j < esn->input_dim; j++) {
-            sum += esn->W_input[i][j] * input[j];
+        t0 = fastticks(nil);
+        if (b->next != nil)
+            b = concatblock(b);
+        if (BLEN(b) < SPudphdr + SPhdr) {
+            freeb(b);
+            sp->malformed++;
+        } else {
+            b->rp += SPudphdr;
+            msg = neural_message_alloc_block(sp->nc->source_domain, sp->nc->target_domain, b);
+            if (msg == nil)
+                sp->dropped++;
+            else if (send_neural_message_wait(sp->nc, msg, SPwaitms) < 0) {
+                neural_message_free(msg);
+                sp->dropped++;
+            } else
+                sp->packets++;
         }
-        
-        // Apply activation function (tanh) with leak rate
-        old_activation = esn->current_state->activations[i];
-        new_activations[i] = (1.0 - esn->leak_rate) * old_activation +
-                             esn->leak_rate * tanh(sum);
-        
-        // Update node
-        esn->nodes[i]->activation = new_activations[i];
-    }
-    
-    // Update state
-    new_state->activations = new_activations;
-    new_state->reservoir_size = esn->reservoir_size;
-    new_state->timestamp = time(NULL);
-    new_state->previous = esn->current_state;
-    
-    // Compute Matula encoding of new state
-    esn_state_to_matula(esn, new_state);
-    
-    esn->current_state = new_state;
-    
-    // Store in history
-    if (esn->history_size < esn->history_capacity) {
-        esn->matula_history[esn->history_size++] = new_state->matula_encoding;
+        poperror();
+        sp->ingest_busy += fastticks(nil) - t0;
     }
+    cclose(sp->c);
+    sp->c = nil;
+    sensor_pipe_exit(sp);
 }
 
-/*
- * Convert ESN state to Matula number encoding
- * 
- * Algorithm:
- * 1. Quantize activations to discrete levels
- * 2. Treat quantized levels as exponents on prime bases
- * 3. Multiply: matula = ∏ p_i^(quantized_activation_i)
- * 
- * This encodes the full reservoir state as a single integer.
- */
-void
-esn_state_to_matula(EchoStateNetwork *esn, ESNState *state)
+static void
+sensor_drive_proc(void *a)
 {
-    uvlong matula;
-    int i, exponent;
-    uvlong prime;
-    
-    matula = 1;
-    
-    for (i = 0; i < esn->reservoir_size && i < NPRIMES; i++) {
-        // Quantize activation to 0-3 range
-        exponent = (int)((state->activations[i] + 1.0) * 1.5);
-        if (exponent < 0) exponent = 0;
-        if (exponent > 3) exponent = 3;
-        
-        // Get prime for this node
-        prime = esn->nodes[i]->prime_index;
-        
-        // Multiply matula by prime^exponent
-        {
-            int e;
-            for (e = 0; e < exponent; e++) {
-                matula *= prime;
+    SensorPipe *sp;
+    EchoStateNetwork *esn;
+    NeuralMessage *msgs[SPbatch];
+    float *u, *y;
+    uchar *p;
+    uvlong t0;
+    vlong us;
+    u32int v;
+    int i, j, n, d;
+
+    sp = a;
+    esn = sp->esn;
+    d = esn->input_dim;
+    u = smalloc((d + esn->output_dim) * sizeof(float));
+    y = u + d;
+    while (!sp->dying) {
+        if (waserror())
+            break;
+        n = receive_neural_batch_wait(sp->nc, msgs, nelem(msgs), 1000);
+        poperror();
+        if (n <= 0)
+            continue;
+        t0 = fastticks(nil);
+        esn_ctl_lock(esn);
+        for (i = 0; i < n; i++) {
+            p = msgs[i]->cognitive_payload;
+            if (msgs[i]->payload_size < SPhdr + d*4 || GBIT32(p + 12) != d) {
+                sp->malformed++;
+                continue;
+            }
+            for (j = 0; j < d; j++) {
+                v = GBIT32(p + SPhdr + j*4);
+                memmove(&u[j], &v, 4);
             }
+            esn_update_state(esn, u);
+            esn_compute_output(esn, y);
+            us = (todget(nil) - (vlong)((u32int)GBIT32(p) | (uvlong)(u32int)GBIT32(p + 4) << 32)) / 1000;
+            if (us < 0)
+                us = 0;
+            neural_latency_record(sp->hist, us);
+            if (us > sp->maxus)
+                sp->maxus = us;
+            sp->events++;
         }
+        esn_ctl_unlock(esn);
+        for (i = 0; i < n; i++)
+            neural_message_free(msgs[i]);
+        sp->drive_busy += fastticks(nil) - t0;
     }
-    
-    state->matula_encoding = matula;
+    free(u);
+    sensor_pipe_exit(sp);
 }
 
 /*
- * Convert Matula number back to ESN state
- * 
- * Algorithm:
- * 1. Factorize matula number
- * 2. For each prime p_i with exponent e_i:
- *    - Set activation_i based on exponent
- * 3. Normalize to [-1, 1] range
+ * Feed the reservoir esn_id from the UDP data file open on fd by
+ * way of channel_id.  A reservoir has one pipeline at a time; a
+ * stopped one is replaced once its kprocs are gone.
  */
 void
-matula_to_esn_state(EchoStateNetwork *esn, uvlong matula)
+sensor_pipe(char *esn_id, char *channel_id, int fd)
 {
-    int exponents[NPRIMES];
-    int i;
-    
-    // Factorize
-    factorize(matula, exponents, NPRIMES);
-    
-    // Set activations based on exponents
-    for (i = 0; i < esn->reservoir_size && i < NPRIMES; i++) {
-        // Convert exponent back to activation
-        esn->current_state->activations[i] = (exponents[i] / 1.5) - 1.0;
-        esn->nodes[i]->activation = esn->current_state->activations[i];
+    SensorPipe *sp, **l;
+    EchoStateNetwork *esn;
+    NeuralChannel *nc;
+    Chan *c;
+
+    esn = lookup_esn(esn_id);
+    if (esn == nil)
+        error("unknown reservoir");
+    nc = lookup_neural_channel(channel_id);
+    if (nc == nil)
+        error("unknown neural channel");
+    c = fdtochan(fd, OREAD, 1, 1);
+    qlock(&sensorpipes);
+    for (l = &sensorpipes.pipes; (sp = *l) != nil; l = &sp->next)
+        if (sp->esn == esn)
+            break;
+    if (sp != nil) {
+        if (sp->procs > 0) {
+            qunlock(&sensorpipes);
+            cclose(c);
+            error(Einuse);
+        }
+        *l = sp->next;
+        free(sp);
     }
-    
-    esn->current_state->matula_encoding = matula;
+    sp = malloc(sizeof(SensorPipe));
+    if (sp == nil) {
+        qunlock(&sensorpipes);
+        cclose(c);
+        error(Enomem);
+    }
+    sp->esn = esn;
+    sp->nc = nc;
+    sp->c = c;
+    sp->procs = 2;
+    sp->next = sensorpipes.pipes;
+    sensorpipes.pipes = sp;
+    qunlock(&sensorpipes);
+
+    kproc("sensoringest", sensor_ingest_proc, sp);
+    kproc("sensordrive", sensor_drive_proc, sp);
 }
 
-/*
- * ESN as Dyck Grammar Machine
- * 
- * Each reservoir node corresponds to a parenthesis type.
- * ESN update = continuously rewriting parentheses configurations.
- */
-char*
-esn_to_dyck_expression(EchoStateNetwork *esn)
+// Stop esn_id's pipeline; -1 if it has none running
+int
+sensor_pipe_stop(char *esn_id)
 {
-    char *expr;
-    int i, level;
-    int pos = 0;
-    int size = esn->reservoir_size * 4; // Estimate
-    
-    expr = malloc(size);
-    
-    // Convert activation pattern to nested parentheses
-    for (i = 0; i < esn->reservoir_size; i++) {
-        int l;
-        // Activation level determines nesting
-        level = (int)((esn->nodes[i]->activation + 1.0) * 2.0);
-        
-        if (level > 0 && pos < size - 4) {
-            for (l = 0; l < level; l++) {
-                expr[pos++] = '(';
-            }
-            for (l = 0; l < level; l++) {
-                expr[pos++] = ')';
-            }
+    SensorPipe *sp;
+    int r;
+
+    r = -1;
+    qlock(&sensorpipes);
+    for (sp = sensorpipes.pipes; sp != nil; sp = sp->next)
+        if (strcmp(sp->esn->esn_id, esn_id) == 0 && !sp->dying) {
+            sp->dying = 1;
+            r = 0;
         }
-    }
-    
-    expr[pos] = '\0';
-    return expr;
+    qunlock(&sensorpipes);
+    return r;
 }
 
 /*
- * ESN as Rooted Tree Forest
- * 
- * Each update = grafting new subtrees at leaves.
- * ESN trajectory = moving fixed point in forest space.
+ * One line per pipeline.  Latencies are in µs, the percentiles
+ * bucket upper bounds as for channels; busy times are in µs.
  */
-RootedTree**
-esn_to_forest(EchoStateNetwork *esn, int *forest_size)
+static int
+sensor_pipe_stats(char *buf, int len)
 {
-    RootedTree **forest;
-    int i, count;
-    
-    count = 0;
-    forest = malloc(esn->reservoir_size * sizeof(RootedTree*));
-    
-    // Each active node becomes a tree
-    for (i = 0; i < esn->reservoir_size; i++) {
-        if (esn->nodes[i]->activation > 0.1) {
-            // Create tree based on activation
-            char *parens = smprint("(%s)", 
-                                  esn->nodes[i]->activation > 0.5 ? "()" : "");
-            forest[count] = create_rooted_tree_from_parens(parens);
-            count++;
-            free(parens);
-        }
-    }
-    
-    *forest_size = count;
-    return forest;
+    SensorPipe *sp;
+    int n;
+
+    n = 0;
+    qlock(&sensorpipes);
+    for (sp = sensorpipes.pipes; sp != nil; sp = sp->next)
+        n += snprint(buf + n, len - n,
+                     "pipe %s %s packets=%lud dropped=%lud malformed=%lud events=%lud "
+                     "ingestus=%llud driveus=%llud p50us=%lud p99us=%lud maxus=%lud%s\n",
+                     sp->esn->esn_id, sp->nc->channel_id, sp->packets, sp->dropped,
+                     sp->malformed, sp->events, fastticks2us(sp->ingest_busy),
+                     fastticks2us(sp->drive_busy),
+                     neural_latency_percentile(sp->hist, Nlathist, 500),
+                     neural_latency_percentile(sp->hist, Nlathist, 990),
+                     sp->maxus, sp->procs < 2 ? " down" : sp->dying ? " stopping" : "");
+    qunlock(&sensorpipes);
+    return n;
 }
 
 /*
- * ESN as Membrane System
- * 
- * Each reservoir node = membrane region.
- * Activation = multiset object count.
- * Update = maximal parallel rule application.
- * Echo = residual multisets that decay slowly.
+ * Bytes of weights and state one step of esn streams through, by
+ * the arrays the recurrence reads and writes.  Propagation counts
+ * the incidences of the edges that fired in the last push, as a
+ * share of W.  An estimate: it leaves out the node headers and the
+ * Matula encoding, the same in every mode.
  */
-void
-esn_to_membrane_system(EchoStateNetwork *esn)
+static uvlong
+esn_step_bytes(EchoStateNetwork *esn)
 {
-    int i;
-    
-    for (i = 0; i < esn->reservoir_size; i++) {
-        // Quantize activation to object count
-        esn->nodes[i]->object_count = 
-            (int)((esn->nodes[i]->activation + 1.0) * 10.0);
-        
-        if (esn->nodes[i]->object_count < 0)
-            esn->nodes[i]->object_count = 0;
+    ESNHypergraph *hg;
+    uvlong n, nnz, in, rows;
+
+    n = esn->reservoir_size;
+    nnz = esn->W_nnz;
+    in = n * esn->ld_input;
+    rows = (n + 1) * sizeof(int);
+    if (esn->fixed)
+        return nnz * (sizeof(short) + sizeof(int)) + rows + in * sizeof(short) +
+               n * (sizeof(int) + 2*sizeof(short) + sizeof(float));
+    if (esn->hyper) {
+        hg = esn->hypergraph;
+        if (hg->nedges > 0)
+            nnz = nnz * hg->active / hg->nedges;
+        return nnz * (sizeof(int) + sizeof(float)) +
+               (2*hg->nedges + 1) * sizeof(int) + in * sizeof(float) +
+               n * 4*sizeof(float);
     }
+    return nnz * (sizeof(int) + sizeof(float)) + rows + in * sizeof(float) +
+           n * 2*sizeof(float);
 }
 
 /*
- * ESN as Hypergraph
- * 
- * Nodes = reservoir units
- * Hyperedges = recurrent connectivity groups
- * Update = signal propagation along hyperedges
+ * Time steps of a size-node reservoir, each row of W connected to
+ * sparsity*size nodes and stepped in mode, split over 1, 2, 4, ...
+ * CPUs.  Reports nanoseconds per step, speedup and bytes per step
+ * on the console and as esn-bench events,
+ *
+ *	esn-bench size cpus mode sparsity ns bytes
+ *
+ * followed by esn-bench size done.
  */
 void
-esn_create_hypergraph_representation(EchoStateNetwork *esn)
+esn_bench(int size, int steps, float sparsity, int mode)
 {
-    int i, j;
-    ReservoirConnection *conn;
-    
-    esn->connection_count = 0;
-    esn->connections = malloc(esn->reservoir_size * esn->reservoir_size * 
-                             sizeof(ReservoirConnection*));
-    
-    // Create hyperedges from weight matrix
-    for (i = 0; i < esn->reservoir_size; i++) {
-        for (j = 0; j < esn->reservoir_size; j++) {
-            if (esn->W_reservoir[i][j] != 0.0) {
-                conn = malloc(sizeof(ReservoirConnection));
-                conn->connection_id = esn->connection_count;
-                conn->source = esn->nodes[i];
-                conn->target = esn->nodes[j];
-                conn->weight = esn->W_reservoir[i][j];
-                conn->hyperedge_id = esn->connection_count;
-                
-                esn->connections[esn->connection_count++] = conn;
-            }
-        }
+    static char *modes[] = { "float", "fixed", "hyper" };
+    EchoStateNetwork *esn;
+    float in;
+    uvlong t0, ns, base, bytes;
+    int n, s, r;
+
+    if (steps < 1 || mode < 0 || mode >= nelem(modes))
+        error(Ebadarg);
+    esn = esn_create(size, 1, 1, 0.9, sparsity);
+    if (esn == nil)
+        error(Enomem);
+    if (waserror()) {
+        esn_free(esn);
+        nexterror();
     }
+    if (esn->W_nnz == 0)
+        error(Enomem);
+    r = 0;
+    if (mode == ESNhyper)
+        r = esn_set_hyper(esn, 1);
+    else if (mode == ESNfixed)
+        r = esn_set_fixed(esn, 1);
+    if (r < 0)
+        error(Enomem);
+    in = 0.5;
+    base = 0;
+    for (n = 1; n <= conf.nmach && n <= ESNworkers; n *= 2) {
+        esn_set_workers(esn, n);
+        esn_update_state(esn, &in);
+        t0 = fastticks(nil);
+        for (s = 0; s < steps; s++)
+            esn_update_state(esn, &in);
+        ns = fastticks2us(fastticks(nil) - t0) * 1000 / steps;
+        bytes = esn_step_bytes(esn);
+        if (n == 1)
+            base = ns;
+        print("esn-bench %d nodes %d cpus %s %.3f sparse %llud ns/step %llud bytes/step speedup %llud.%02llud\n",
+              size, n, modes[mode], sparsity, ns, bytes,
+              ns ? base / ns : 0, ns ? base * 100 / ns % 100 : 0);
+        cognitive_event("esn-bench %d %d %s %.3f %llud %llud", size, n, modes[mode], sparsity, ns, bytes);
+    }
+    cognitive_event("esn-bench %d done", size);
+    poperror();
+    esn_free(esn);
 }
 
 /*
- * ESN Output/Readout
- * 
- * y(t) = W_out · x(t)
+ * The operation profile, one line per operation summed over CPUs:
+ *
+ *	op pc calls ns maxns
+ *
+ * pc is the entry of the function the operation times, for merging
+ * with kprof's PC samples.
  */
-void
-esn_compute_output(EchoStateNetwork *esn, float *output)
+int
+cognitive_prof_text(char *buf, int len)
 {
-    int i, j;
-    float sum;
-    
-    for (i = 0; i < esn->output_dim; i++) {
-        sum = 0.0;
-        for (j = 0; j < esn->reservoir_size; j++) {
-            sum += esn->W_output[i][j] * esn->current_state->activations[j];
+    static char *names[Ncogprof] = {
+        [CPsend]     "send",
+        [CPrecv]     "recv",
+        [CPadapt]    "adapt",
+        [CPencode]   "encode",
+        [CPesnstep]  "esnstep",
+        [CPmembrane] "membrane",
+    };
+    static void *pcs[Ncogprof] = {
+        [CPsend]     send_neural_message,
+        [CPrecv]     neural_dequeue,
+        [CPadapt]    adapt_neural_channel_capacity,
+        [CPencode]   esn_state_to_matula,
+        [CPesnstep]  esn_advance,
+        [CPmembrane] membrane_run,
+    };
+    CogProf sum;
+    char *p, *e;
+    int i, op;
+
+    p = buf;
+    e = buf + len;
+    p = seprint(p, e, "profile %s\n", cogprof.on ? "on" : "off");
+    for (op = 0; op < Ncogprof; op++) {
+        memset(&sum, 0, sizeof sum);
+        for (i = 0; i < conf.nmach; i++) {
+            sum.calls += cogprof.mach[i].op[op].calls;
+            sum.ticks += cogprof.mach[i].op[op].ticks;
+            if (cogprof.mach[i].op[op].max > sum.max)
+                sum.max = cogprof.mach[i].op[op].max;
         }
-        output[i] = sum;
+        p = seprint(p, e, "%s %#p %llud %llud %llud\n", names[op], pcs[op],
+                    sum.calls, fastticks2ns(sum.ticks), fastticks2ns(sum.max));
     }
+    return p - buf;
 }
 
 /*
@@ -1940,7 +9539,7 @@ esn_get_info(EchoStateNetwork *esn)
         "  Spectral Radius: %.3f\n"
         "  Input Dim: %d, Output Dim: %d\n"
         "  Current Matula: %llud\n"
-        "  History Size: %d\n"
+        "  History Size: %ld steps\n"
         "  Created: %lud\n"
         "\n"
         "Multi-Framework Representation:\n"
@@ -1961,7 +9560,7 @@ esn_get_info(EchoStateNetwork *esn)
         esn->current_state->matula_encoding,
         (esn_to_forest(esn, &forest_size), forest_size),
         esn->reservoir_size,
-        esn->connection_count
+        esn->hypergraph != nil ? esn->hypergraph->nedges : 0
     );
     
     return info;
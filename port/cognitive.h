@@ -0,0 +1,232 @@
+/*
+ * Cognitive Cities kernel interfaces shared between
+ * cognitive.c and devcognitive.c
+ */
+
+typedef struct CognitiveNamespace CognitiveNamespace;
+typedef struct CognitiveEventReader CognitiveEventReader;
+typedef struct CognitiveSwarm CognitiveSwarm;
+typedef struct NeuralChannel NeuralChannel;
+typedef struct NeuralMessage NeuralMessage;
+typedef struct EchoStateNetwork EchoStateNetwork;
+typedef struct MembraneSystem MembraneSystem;
+
+enum {
+	NMinline	= 64,		/* payload bytes stored in the message header */
+	NMbatch		= 32,		/* headers moved between per-cpu cache and depot */
+	NMcachemax	= 2*NMbatch,	/* headers a per-cpu cache holds before draining */
+	NMslab		= 128,		/* headers carved from one allocation */
+	NBmaxmsg	= 64*1024,	/* largest Block transport payload */
+};
+
+/* binary metrics records, see cognitive_metrics_binary */
+enum {
+	CMversion	= 1,
+	CMnamelen	= 60,
+	CMnval		= 12,
+	CMrecsize	= 4+CMnamelen+CMnval*8,
+
+	CMhdr		= 0,
+	CMchannel,
+	CMswarm,
+	CMdomain,
+};
+
+/* moves for rooted_tree_move */
+enum {
+	RTparent,
+	RTchild,
+	RTsibling,
+};
+
+/* profiled operations, see cognitive_prof_text */
+enum {
+	CPsend,
+	CPrecv,
+	CPadapt,
+	CPencode,
+	CPesnstep,
+	CPmembrane,
+	Ncogprof,
+};
+
+/* ESN stepping modes, see esn_bench */
+enum {
+	ESNfloat,
+	ESNfixed,
+	ESNhyper,
+};
+
+/* ESN images, see esn_image_write */
+enum {
+	EImagic		= 0x314E5345,	/* "ESN1" read as little-endian */
+	EIversion	= 1,
+	EIhdrsize	= 128,
+	EIalign		= 64,
+};
+
+/* checkpoints, see cognitive_checkpoint */
+enum {
+	CKmagic		= 0x314B4343,	/* "CCK1" read as little-endian */
+	CKversion	= 1,
+	CKhdrsize	= 32,
+};
+
+/* message allocation */
+NeuralMessage*	neural_message_alloc(char*, char*, void*, ulong);
+NeuralMessage*	neural_message_alloc_block(char*, char*, Block*);
+NeuralMessage*	neural_message_ref(NeuralMessage*);
+void		neural_message_free(NeuralMessage*);
+char*		neural_atom(char*);
+int		neural_slab_stats(char*, int);
+
+/* neural channels */
+NeuralChannel*	create_neural_channel(char*, char*, ulong);
+void		free_neural_channel(NeuralChannel*);
+int		send_neural_message(NeuralChannel*, NeuralMessage*);
+int		send_neural_message_wait(NeuralChannel*, NeuralMessage*, long);
+void		set_neural_channel_noblock(NeuralChannel*, int);
+void		set_neural_channel_edf(NeuralChannel*, long, long, long);
+int		adapt_neural_channel_capacity(NeuralChannel*);
+NeuralMessage*	receive_neural_message(NeuralChannel*);
+NeuralMessage*	receive_neural_message_wait(NeuralChannel*, long);
+int		receive_neural_batch(NeuralChannel*, NeuralMessage**, int);
+int		receive_neural_batch_wait(NeuralChannel*, NeuralMessage**, int, long);
+int		neural_prio_level(ulong);
+int		set_neural_level_aging(NeuralChannel*, int, ulong);
+int		neural_channel_prio_stats(NeuralChannel*, char*, int);
+ulong		neural_latency_percentile(ulong*, int, int);
+int		neural_channel_stats(NeuralChannel*, char*, int);
+
+/* block transport */
+int		neural_pass_block(NeuralChannel*, Block*, int, ulong, ulong);
+long		neural_write_block(NeuralChannel*, Block*, int, ulong, ulong);
+Block*		neural_read_block(NeuralChannel*);
+NeuralMessage*	neural_message_from_block(NeuralChannel*, Block*);
+long		neural_channel_bwrite(NeuralChannel*, Block*);
+Block*		neural_channel_bread(NeuralChannel*, long);
+int		neural_channel_poll(NeuralChannel*, Pollw*);
+void		set_neural_channel_data(NeuralChannel*, int, ulong);
+int		set_neural_channel_capacity(NeuralChannel*, ulong, ulong);
+
+/* namespaces and swarms */
+CognitiveNamespace*	create_cognitive_namespace(char*, char*);
+void		free_cognitive_namespace(CognitiveNamespace*);
+char*		cognitive_namespace_path(CognitiveNamespace*);
+int		bind_neural_channel_to_namespace(CognitiveNamespace*, NeuralChannel*);
+int		adapt_cognitive_namespace(CognitiveNamespace*);
+int		namespace_set_cpus(CognitiveNamespace*, int);
+CognitiveSwarm*	create_cognitive_swarm(char*, char*, Pgrp*);
+char*		cognitive_swarm_domain(CognitiveSwarm*);
+int		add_agent_to_swarm(CognitiveSwarm*, Proc*);
+void		remove_agent_from_swarm(Proc*);
+void		swarm_multicast(CognitiveSwarm*, NeuralMessage*, ulong);
+void		swarm_broadcast(CognitiveSwarm*, NeuralMessage*);
+int		swarm_set_groups(Proc*, ulong);
+int		swarm_set_cpus(CognitiveSwarm*, int);
+NeuralMessage*	swarm_receive(long);
+
+/* emergence */
+float		detect_emergent_pattern(char*, char**, int);
+
+/* rooted tree store */
+int		rooted_tree_move(uint, ulong, int, int);
+
+/* Matula shell tree, see also matula.h */
+int		rooted_shell_no(int, uvlong*);
+
+/* registry */
+int		register_cognitive_namespace(CognitiveNamespace*);
+CognitiveNamespace*	lookup_cognitive_namespace(char*);
+void		unregister_cognitive_namespace(CognitiveNamespace*);
+int		register_neural_channel(NeuralChannel*);
+NeuralChannel*	lookup_neural_channel(char*);
+void		unregister_neural_channel(NeuralChannel*);
+NeuralChannel*	lookup_neural_channel_no(int);
+int		neural_channel_slots(void);
+int		neural_channel_no(NeuralChannel*);
+ulong		neural_channel_serial(NeuralChannel*);
+char*		neural_channel_id(NeuralChannel*);
+int		register_cognitive_swarm(CognitiveSwarm*);
+CognitiveSwarm*	lookup_cognitive_swarm(char*);
+void		unregister_cognitive_swarm(CognitiveSwarm*);
+
+/* status files */
+enum {
+	CVdomains,		/* namespaces registered, bound or moved */
+	CVchannels,		/* channels registered or removed */
+	CVswarms,		/* swarms registered, joined or left */
+	CVpatterns,		/* emergent patterns observed */
+	CVmembranes,		/* membrane systems registered or stepped */
+	CVsample,		/* counters sampled by the adaptation tick */
+	CVnum,
+};
+ulong		cognitive_version(int);
+void		cognitive_changed(int);
+void		cognitive_cities_init(void);
+int		cognitive_domains_text(char*, int);
+int		cognitive_channels_stats(char*, int);
+int		cognitive_swarms_text(char*, int);
+int		cognitive_patterns_text(char*, int);
+int		cognitive_monitor_text(char*, int);
+int		cognitive_metrics_text(char*, int);
+int		cognitive_stats(char*, int);
+int		cognitive_metrics_binary(uchar*, int);
+
+/* operation profile */
+void		cognitive_prof_ctl(int, int);
+int		cognitive_prof_text(char*, int);
+
+/* checkpoints */
+long		cognitive_checkpoint(uchar**);
+long		cognitive_checkpoint_length(uchar*);
+int		cognitive_restore(uchar*, long);
+void		cognitive_checkpoint_every(int, long);
+
+/* event stream */
+void		cognitive_event(char*, ...);
+CognitiveEventReader*	cognitive_events_open(void);
+void		cognitive_events_close(CognitiveEventReader*);
+long		cognitive_events_read(CognitiveEventReader*, void*, long);
+int		cognitive_events_poll(CognitiveEventReader*, Pollw*);
+
+/* echo state networks */
+void		esn_bench(int, int, float, int);
+EchoStateNetwork*	register_esn(char*, int, int, int);
+EchoStateNetwork*	lookup_esn(char*);
+int		esn_register(char*, EchoStateNetwork*);
+void		esn_free(EchoStateNetwork*);
+EchoStateNetwork*	esn_clone(EchoStateNetwork*);
+int		esn_clone_reset(EchoStateNetwork*, EchoStateNetwork*);
+long		esn_image_size(EchoStateNetwork*);
+long		esn_image_write(EchoStateNetwork*, uchar*, long);
+EchoStateNetwork*	esn_image_load(uchar*, long);
+void		esn_ctl_lock(EchoStateNetwork*);
+void		esn_ctl_unlock(EchoStateNetwork*);
+int		esn_input_dim(EchoStateNetwork*);
+int		esn_output_dim(EchoStateNetwork*);
+int		esn_train_begin(EchoStateNetwork*, float);
+void		esn_train_step(EchoStateNetwork*, float*, float*);
+int		esn_train_finish(EchoStateNetwork*);
+long		esn_train_samples(EchoStateNetwork*);
+int		esn_set_fixed(EchoStateNetwork*, int);
+int		esn_set_hyper(EchoStateNetwork*, int);
+int		esn_history_levels(EchoStateNetwork*, long, uchar*);
+uvlong		esn_history_matula(EchoStateNetwork*, long);
+
+/* membrane systems */
+MembraneSystem*	register_membrane_system(char*, int, int, int*);
+MembraneSystem*	lookup_membrane_system(char*);
+int		membrane_add_rule(MembraneSystem*, int, char*, char*);
+int		membrane_set(MembraneSystem*, int, int, uvlong);
+void		membrane_set_workers(MembraneSystem*, int);
+long		membrane_run(MembraneSystem*, long);
+int		cognitive_membranes_text(char*, int);
+
+/* cross-node transport */
+int		neural_batch_encode(NeuralMessage**, int, char*, uchar*, int, int*);
+int		neural_batch_deliver(uchar*, int);
+void		neural_link(char*, int, char*);
+int		neural_transport_stats(char*, int);
+void		sensor_pipe(char*, char*, int);
+int		sensor_pipe_stop(char*);
@@ -7,6 +7,11 @@
 
 extern ulong	kerndate;
 
+enum
+{
+	Maxvbuf	= 64*1024,	/* devreadv and devwritev buffer up to this */
+};
+
 void
 mkqid(Qid *q, vlong path, ulong vers, int type)
 {
@@ -422,6 +427,135 @@ devbwrite(Chan *c, Block *bp, ulong offset)
 	return n;
 }
 
+/*
+ *  vectored i/o for devices without readv or writev entries.
+ *  up to Maxvbuf bytes go through one buffer and one call of the
+ *  device, so stream and message devices see a single read or
+ *  write.  larger requests take a call per segment, stopping at
+ *  the first short one.
+ */
+long
+devreadv(Chan *c, Iovec *io, int nio, vlong off)
+{
+	long n, m, tot;
+	uchar *buf;
+	int i;
+
+	n = iovlen(io, nio);
+	if(nio == 1 || n > Maxvbuf){
+		tot = 0;
+		for(i = 0; i < nio; i++){
+			m = devtab[c->type]->read(c, io[i].base, io[i].len, off+tot);
+			tot += m;
+			if(m < io[i].len)
+				break;
+		}
+		return tot;
+	}
+	buf = smalloc(n);
+	if(waserror()){
+		free(buf);
+		nexterror();
+	}
+	n = devtab[c->type]->read(c, buf, n, off);
+	iovscatter(io, nio, 0, buf, n);
+	poperror();
+	free(buf);
+	return n;
+}
+
+long
+devwritev(Chan *c, Iovec *io, int nio, vlong off)
+{
+	long n, m, tot;
+	uchar *buf;
+	int i;
+
+	n = iovlen(io, nio);
+	if(nio == 1 || n > Maxvbuf){
+		tot = 0;
+		for(i = 0; i < nio; i++){
+			m = devtab[c->type]->write(c, io[i].base, io[i].len, off+tot);
+			tot += m;
+			if(m < io[i].len)
+				break;
+		}
+		return tot;
+	}
+	buf = smalloc(n);
+	if(waserror()){
+		free(buf);
+		nexterror();
+	}
+	iovgather(io, nio, 0, buf, n);
+	n = devtab[c->type]->write(c, buf, n, off);
+	poperror();
+	free(buf);
+	return n;
+}
+
+long
+iovlen(Iovec *io, int nio)
+{
+	long n;
+	int i;
+
+	n = 0;
+	for(i = 0; i < nio; i++)
+		n += io[i].len;
+	return n;
+}
+
+/*
+ *  copy n bytes, starting skip bytes into the segments, to buf
+ */
+long
+iovgather(Iovec *io, int nio, long skip, uchar *buf, long n)
+{
+	long m, tot;
+	int i;
+
+	tot = 0;
+	for(i = 0; i < nio && tot < n; i++){
+		if(skip >= io[i].len){
+			skip -= io[i].len;
+			continue;
+		}
+		m = io[i].len - skip;
+		if(m > n - tot)
+			m = n - tot;
+		memmove(buf+tot, (uchar*)io[i].base+skip, m);
+		tot += m;
+		skip = 0;
+	}
+	return tot;
+}
+
+/*
+ *  copy n bytes from buf into the segments, starting skip bytes in
+ */
+long
+iovscatter(Iovec *io, int nio, long skip, uchar *buf, long n)
+{
+	long m, tot;
+	int i;
+
+	tot = 0;
+	for(i = 0; i < nio && tot < n; i++){
+		if(skip >= io[i].len){
+			skip -= io[i].len;
+			continue;
+		}
+		m = io[i].len - skip;
+		if(m > n - tot)
+			m = n - tot;
+		memmove((uchar*)io[i].base+skip, buf+tot, m);
+		tot += m;
+		skip = 0;
+	}
+	return tot;
+}
+
 void
 devremove(Chan*)
 {
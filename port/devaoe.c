@@ -211,7 +211,9 @@ struct Aoedev {
 
 	uint	maxbcnt;
 	ushort	nout;
-	ushort	maxout;
+	ushort	maxout;		/* congestion window */
+	ushort	ssthresh;
+	ushort	wacks;		/* acks toward the next window increase */
 	ulong	lastwadj;
 	Srb	*head;
 	Srb	*tail;
@@ -469,19 +471,69 @@ putlba(Aoeata *a, vlong lba)
 	c[5] = lba >> 40;
 }
 
+/*
+ * stripe frames over every link that is up, sending each
+ * on the one that should drain soonest: fewest frames in
+ * flight for its round trip time.
+ */
 static Devlink*
 pickdevlink(Aoedev *d)
 {
-	ulong i, n;
-	Devlink *l;
+	ulong i, n, w, best;
+	int nout[Ndevlink];
+	Devlink *l, *bl;
+	Frame *f, *e;
 
+	memset(nout, 0, sizeof nout);
+	f = d->frames;
+	e = f + d->nframes;
+	for(; f < e; f++)
+		if(f->tag != Tfree && f->dl != nil)
+			nout[f->dl - d->dl]++;
+	bl = nil;
+	best = ~0UL;
 	for(i = 0; i < d->ndl; i++){
 		n = d->dlidx++ % d->ndl;
 		l = d->dl + n;
-		if(l && l->flag & Dup)
-			return l;
+		if((l->flag & Dup) == 0)
+			continue;
+		w = (nout[n] + 1) * (l->rttavg + 1);
+		if(w < best){
+			best = w;
+			bl = l;
+		}
+	}
+	return bl;
+}
+
+/*
+ * the window over all links grows by one frame per ack
+ * below ssthresh, by one per window of acks above it,
+ * and halves, at most once a round trip, when frames
+ * have to be resent.  cf. Jacobson&Karels, op. cit.
+ */
+static void
+wgrow(Aoedev *d)
+{
+	if(d->nout < d->maxout || d->maxout >= d->nframes)
+		return;
+	if(d->maxout < d->ssthresh || ++d->wacks >= d->maxout){
+		d->maxout++;
+		d->wacks = 0;
 	}
-	return 0;
+}
+
+static void
+wshrink(Aoedev *d, Devlink *l)
+{
+	if(MACHP(0)->ticks - d->lastwadj < l->rttavg)
+		return;
+	d->ssthresh = d->maxout / 2;
+	if(d->ssthresh < 1)
+		d->ssthresh = 1;
+	d->maxout = d->ssthresh;
+	d->wacks = 0;
+	d->lastwadj = MACHP(0)->ticks;
 }
 
 static int
@@ -636,11 +688,7 @@ loop:
 			i = tsince(f->tag);
 			if(i < timeout)
 				continue;
-			if(d->nout == d->maxout){
-				if(d->maxout > 1)
-					d->maxout--;
-				d->lastwadj = MACHP(0)->ticks;
-			}
+			wshrink(d, l);
 			a = (Aoeata*)f->hdr;
 			if(a->scnt > Dbcnt / Aoesectsz &&
 			   ++f->nl->lostjumbo > (d->nframes << 1)){
@@ -657,11 +705,6 @@ loop:
 				eventlog("%æ: rtt %ldms\n", d, TK2MS(l->rttavg));
 			}
 		}
-		if(d->nout == d->maxout && d->maxout < d->nframes &&
-		   TK2MS(MACHP(0)->ticks - d->lastwadj) > 10*1000){ /* more magic */
-			d->maxout++;
-			d->lastwadj = MACHP(0)->ticks;
-		}
 		qunlock(d);
 	}
 	runlock(&devs);
@@ -1242,11 +1285,11 @@ pstat(Aoedev *d, char *db, int len, int off)
 	p = seprint(p, e,
 		"state: %s\n"	"nopen: %d\n"	"nout: %d\n"
 		"nmaxout: %d\n"	"nframes: %d\n"	"maxbcnt: %d\n"
-		"fw: %.4ux\n"
+		"ssthresh: %d\n"	"fw: %.4ux\n"
 		"model: %s\n"	"serial: %s\n"	"firmware: %s\n",
 		state,		d->nopen,	d->nout,
 		d->maxout, 	d->nframes,	d->maxbcnt,
-		d->fwver,
+		d->ssthresh,	d->fwver,
 		d->model, 	d->serial, 	d->firmware);
 	p = seprint(p, e, "flag: ");
 	p = pflag(p, e, d->flag);
@@ -1703,6 +1746,7 @@ newdev(long major, long minor, int n)
 	for (e = f + n; f < e; f++)
 		f->tag = Tfree;
 	d->maxout = n;
+	d->ssthresh = n;
 	d->major = major;
 	d->minor = minor;
 	d->maxbcnt = Dbcnt;
@@ -1978,7 +2022,7 @@ qcfgrsp(Block *b, Netlink *nl)
 	d->nconfig = n;
 	memmove(d->config, ch + 1, n);
 	if(l != 0 && d->flag & Djumbo){
-		n = getmtu(nl->mtu) - AOEATASZ;
+		n = devmaxdata(d);	/* frames go out on every link */
 		n /= Aoesectsz;
 		if(n > ch->scnt)
 			n = ch->scnt;
@@ -2161,6 +2205,7 @@ atarsp(Block *b)
 
 	if(srb && --srb->nout == 0 && srb->len == 0)
 		wakeup(srb);
+	wgrow(d);
 	f->srb = nil;
 	f->tag = Tfree;
 	d->nout--;
@@ -35,9 +35,9 @@ enum
 
 	Maxbridge=	4,
 	Maxport=	128,		// power of 2
-	CacheHash=	257,		// prime
-	CacheLook=	5,		// how many cache entries to examine
-	CacheSize=	(CacheHash+CacheLook-1),
+	CacheHash0=	256,		// buckets to start, power of 2
+	CacheHashMax=	4096,		// most buckets, power of 2
+	CacheMax=	4*CacheHashMax,	// most entries
 	CacheTimeout=	5*60,		// timeout for cache entry in seconds
 
 	TcpMssMax = 1300,		// max desirable Tcp MSS value
@@ -84,6 +84,7 @@ static Dirtab	*dirtab[MaxQ];
 
 struct Centry
 {
+	Centry	*next;		// hash chain
 	uchar	d[Eaddrlen];
 	int	port;
 	long	expire;		// entry expires this many seconds after bootime
@@ -91,12 +92,29 @@ struct Centry
 	long	dst;
 };
 
+/*
+ * the ports' readers forward in parallel, each holding portlk
+ * for reading; bind and unbind change port[] holding it for
+ * writing.  the learning cache is changed under cachelk, with
+ * cachegen odd while anything a lookup reads is changing, so
+ * lookups take no lock.  freed entries are kept for reuse,
+ * since a lookup may still be reading one.
+ */
 struct Bridge
 {
 	QLock;
 	int	nport;
 	Port	*port[Maxport];
-	Centry	cache[CacheSize];
+	RWlock	portlk;
+
+	Lock	cachelk;
+	ulong	cachegen;	// odd while changing
+	Centry	**cache;	// CacheHashMax buckets, nhash in use
+	int	nhash;
+	int	ncache;
+	Centry	*cfree;
+	ulong	ckey;
+
 	ulong	hit;
 	ulong	miss;
 	ulong	copy;
@@ -382,7 +400,7 @@ bridgewrite(Chan *c, void *a, long n, vlong off)
 			portunbind(b, cb->nf-1, cb->f+1);
 		} else if(strcmp(arg0, "cacheflush") == 0) {
 			log(b, Logcache, "cache flush\n");
-			memset(b->cache, 0, CacheSize*sizeof(Centry));
+			cacheflushport(b, -1);
 		} else if(strcmp(arg0, "set") == 0) {
 			if(cb->nf != 2)
 				error("usage: set option");
@@ -606,11 +624,19 @@ portbind(Bridge *b, int argc, char *argv[])
 
 	poperror();
 
+	if(b->cache == nil){
+		b->cache = smalloc(CacheHashMax*sizeof(Centry*));
+		b->nhash = CacheHash0;
+		randomread(&b->ckey, sizeof(b->ckey));
+	}
+
 	/* committed to binding port */
-	b->port[port->id] = port;
 	port->bridge = b;
+	wlock(&b->portlk);
+	b->port[port->id] = port;
 	if(b->nport <= port->id)
 		b->nport = port->id+1;
+	wunlock(&b->portlk);
 
 	// assumes kproc always succeeds
 	kproc("etherread", etherread, port);	// poperror must be next
@@ -658,117 +684,242 @@ portunbind(Bridge *b, int argc, char *argv[])
 		error("bad owner hash");
 
 	port->closed = 1;
-	b->port[i] = nil;	// port is now unbound
-	cacheflushport(b, i);
 
 	// try and stop reader
 	if(port->readp)
 		postnote(port->readp, 1, "unbind", 0);
+
+	// wait out forwarding to it
+	wlock(&b->portlk);
+	b->port[i] = nil;	// port is now unbound
+	wunlock(&b->portlk);
+	cacheflushport(b, i);
 	portfree(port);
 }
 
-// assumes b is locked
-static Centry *
+static ulong
+cachehash(Bridge *b, uchar d[Eaddrlen])
+{
+	ulong h;
+
+	h = (nhgetl(d) ^ b->ckey) * 0x9e3779b1UL ^ nhgets(d+4);
+	h *= 0x85ebca6bUL;
+	return h ^ h>>16;
+}
+
+static void
+cachechanging(Bridge *b)
+{
+	b->cachegen++;
+	coherence();
+}
+
+static void
+cachechanged(Bridge *b)
+{
+	coherence();
+	b->cachegen++;
+}
+
+/*
+ * the entry for d and its port, without the lock as long as
+ * cachegen holds still; after three tries, with it
+ */
+static Centry*
+cachefind(Bridge *b, uchar d[Eaddrlen], int *port)
+{
+	Centry *p;
+	ulong gen, h;
+	int i, n;
+
+	h = cachehash(b, d);
+	for(i = 0; ; i++){
+		if(i == 3)
+			lock(&b->cachelk);
+		gen = b->cachegen;
+		coherence();
+		if((gen & 1) && i < 3)
+			continue;
+		n = 0;
+		for(p = b->cache[h & (b->nhash-1)]; p != nil && n++ < CacheMax; p = p->next)
+			if(memcmp(p->d, d, Eaddrlen) == 0){
+				*port = p->port;
+				break;
+			}
+		if(i == 3){
+			unlock(&b->cachelk);
+			return p;
+		}
+		coherence();
+		if(b->cachegen == gen)
+			return p;
+	}
+}
+
+/*
+ * the port for d, or -1
+ */
+static int
 cachelookup(Bridge *b, uchar d[Eaddrlen])
 {
-	int i;
-	uint h;
 	Centry *p;
 	long sec;
+	int port;
 
 	// dont cache multicast or broadcast
 	if(d[0] & 1)
-		return 0;
+		return -1;
 
-	h = 0;
-	for(i=0; i<Eaddrlen; i++) {
-		h *= 7;
-		h += d[i];
+	p = cachefind(b, d, &port);
+	if(p == nil) {
+		log(b, Logcache, "cache miss: %E\n", d);
+		return -1;
 	}
-	h %= CacheHash;
-	p = b->cache + h;
 	sec = TK2SEC(m->ticks);
-	for(i=0; i<CacheLook; i++,p++) {
-		if(memcmp(d, p->d, Eaddrlen) == 0) {
-			p->dst++;
-			if(sec >= p->expire) {
-				log(b, Logcache, "expired cache entry: %E %d\n",
-					d, p->port);
-				return nil;
+	p->dst++;
+	if(sec >= p->expire) {
+		log(b, Logcache, "expired cache entry: %E %d\n", d, port);
+		return -1;
+	}
+	p->expire = sec + CacheTimeout;
+	return port;
+}
+
+// under cachelk, changing
+static void
+cacheunlink(Bridge *b, Centry **l)
+{
+	Centry *p;
+
+	p = *l;
+	*l = p->next;
+	p->next = b->cfree;
+	b->cfree = p;
+	b->ncache--;
+}
+
+// under cachelk, changing
+static void
+cachereap(Bridge *b)
+{
+	Centry **l;
+	long sec;
+	int i;
+
+	sec = TK2SEC(m->ticks);
+	for(i=0; i<b->nhash; i++)
+		for(l = &b->cache[i]; *l != nil; )
+			if(sec >= (*l)->expire)
+				cacheunlink(b, l);
+			else
+				l = &(*l)->next;
+}
+
+// under cachelk, changing: double the buckets in use
+static void
+cachegrow(Bridge *b)
+{
+	Centry *p, *next, **l;
+	int i, n;
+
+	n = b->nhash;
+	b->nhash = 2*n;
+	for(i=0; i<n; i++) {
+		l = &b->cache[i];
+		for(p = *l; p != nil; p = next) {
+			next = p->next;
+			if((cachehash(b, p->d) & (2*n-1)) == i) {
+				l = &p->next;
+				continue;
 			}
-			p->expire = sec + CacheTimeout;
-			return p;
+			*l = next;
+			p->next = b->cache[i+n];
+			b->cache[i+n] = p;
 		}
 	}
-	log(b, Logcache, "cache miss: %E\n", d);
-	return nil;
 }
 
-// assumes b is locked
 static void
 cacheupdate(Bridge *b, uchar d[Eaddrlen], int port)
 {
-	int i;
-	uint h;
-	Centry *p, *pp;
-	long sec;
+	Centry *p;
+	int oport;
 
 	// dont cache multicast or broadcast
 	if(d[0] & 1) {
 		log(b, Logcache, "bad source address: %E\n", d);
 		return;
 	}
-	
-	h = 0;
-	for(i=0; i<Eaddrlen; i++) {
-		h *= 7;
-		h += d[i];
+
+	// the usual case: known, on the same port
+	p = cachefind(b, d, &oport);
+	if(p != nil && oport == port) {
+		p->expire = TK2SEC(m->ticks) + CacheTimeout;
+		p->src++;
+		return;
 	}
-	h %= CacheHash;
-	p = b->cache + h;
-	pp = p;
-	sec = p->expire;
-
-	// look for oldest entry
-	for(i=0; i<CacheLook; i++,p++) {
-		if(memcmp(p->d, d, Eaddrlen) == 0) {
-			p->expire = TK2SEC(m->ticks) + CacheTimeout;
-			if(p->port != port) {
-				log(b, Logcache, "NIC changed port %d->%d: %E\n",
-					p->port, port, d);
-				p->port = port;
-			}
-			p->src++;
-			return;
-		}
-		if(p->expire < sec) {
-			sec = p->expire;
-			pp = p;
+
+	lock(&b->cachelk);
+	cachechanging(b);
+	for(p = b->cache[cachehash(b, d) & (b->nhash-1)]; p != nil; p = p->next)
+		if(memcmp(p->d, d, Eaddrlen) == 0)
+			break;
+	if(p != nil) {
+		if(p->port != port) {
+			log(b, Logcache, "NIC changed port %d->%d: %E\n",
+				p->port, port, d);
+			p->port = port;
 		}
+		p->expire = TK2SEC(m->ticks) + CacheTimeout;
+		p->src++;
+		goto out;
+	}
+	if(b->ncache >= CacheMax)
+		cachereap(b);
+	if(b->ncache >= CacheMax) {
+		log(b, Logcache, "cache full: %E\n", d);
+		goto out;
 	}
-	if(pp->expire != 0)
-		log(b, Logcache, "bumping from cache: %E %d\n", pp->d, pp->port);
-	pp->expire = TK2SEC(m->ticks) + CacheTimeout;
-	memmove(pp->d, d, Eaddrlen);
-	pp->port = port;
-	pp->src = 1;
-	pp->dst = 0;
-	log(b, Logcache, "adding to cache: %E %d\n", pp->d, pp->port);
+	p = b->cfree;
+	if(p != nil)
+		b->cfree = p->next;
+	else if((p = malloc(sizeof(Centry))) == nil)
+		goto out;
+	memmove(p->d, d, Eaddrlen);
+	p->port = port;
+	p->expire = TK2SEC(m->ticks) + CacheTimeout;
+	p->src = 1;
+	p->dst = 0;
+	p->next = b->cache[cachehash(b, d) & (b->nhash-1)];
+	b->cache[cachehash(b, d) & (b->nhash-1)] = p;
+	b->ncache++;
+	if(b->ncache > 2*b->nhash && b->nhash < CacheHashMax)
+		cachegrow(b);
+	log(b, Logcache, "adding to cache: %E %d\n", d, port);
+out:
+	cachechanged(b);
+	unlock(&b->cachelk);
 }
 
-// assumes b is locked
+// flush entries for port, or all if port is -1
 static void
 cacheflushport(Bridge *b, int port)
 {
-	Centry *ce;
+	Centry **l;
 	int i;
 
-	ce = b->cache;
-	for(i=0; i<CacheSize; i++,ce++) {
-		if(ce->port != port)
-			continue;
-		memset(ce, 0, sizeof(Centry));
-	}
+	if(b->cache == nil)
+		return;
+	lock(&b->cachelk);
+	cachechanging(b);
+	for(i=0; i<b->nhash; i++)
+		for(l = &b->cache[i]; *l != nil; )
+			if(port < 0 || (*l)->port == port)
+				cacheunlink(b, l);
+			else
+				l = &(*l)->next;
+	cachechanged(b);
+	unlock(&b->cachelk);
 }
 
 static char *
@@ -780,17 +931,7 @@ cachedump(Bridge *b)
 	Centry *ce;
 	char c;
 
-	qlock(b);
-	if(waserror()) {
-		qunlock(b);
-		nexterror();
-	}
-	sec = TK2SEC(m->ticks);
-	n = 0;
-	for(i=0; i<CacheSize; i++)
-		if(b->cache[i].expire != 0)
-			n++;
-	
+	n = b->ncache;
 	n *= 51;	// change if print format is changed
 	n += 10;	// some slop at the end
 	buf = malloc(n);
@@ -798,25 +939,28 @@ cachedump(Bridge *b)
 		error(Enomem);
 	p = buf;
 	ep = buf + n;
-	ce = b->cache;
-	off = seconds() - sec;
-	for(i=0; i<CacheSize; i++,ce++) {
-		if(ce->expire == 0)
-			continue;	
-		c = (sec < ce->expire)?'v':'e';
-		p += snprint(p, ep-p, "%E %2d %10ld %10ld %10ld %c\n", ce->d,
-			ce->port, ce->src, ce->dst, ce->expire+off, c);
-	}
 	*p = 0;
-	poperror();
-	qunlock(b);
+	if(b->cache == nil)
+		return buf;
+
+	// entries added since are left out
+	lock(&b->cachelk);
+	sec = TK2SEC(m->ticks);
+	off = seconds() - sec;
+	for(i=0; i<b->nhash; i++)
+		for(ce = b->cache[i]; ce != nil && ep-p > 51; ce = ce->next) {
+			c = (sec < ce->expire)?'v':'e';
+			p += snprint(p, ep-p, "%E %2d %10ld %10ld %10ld %c\n", ce->d,
+				ce->port, ce->src, ce->dst, ce->expire+off, c);
+		}
+	unlock(&b->cachelk);
 
 	return buf;
 }
 
 
 
-// assumes b is locked
+// assumes b->portlk is held
 static void
 ethermultiwrite(Bridge *b, Block *bp, Port *port)
 {
@@ -965,18 +1109,18 @@ etherread(void *a)
 	Bridge *b = port->bridge;
 	Block *bp, *bp2;
 	Etherpkt *ep;
-	Centry *ce;
+	Port *oport;
 	long md;
+	int p;
 	
 	qlock(b);
 	port->readp = up;	/* hide identity under a rock for unbind */
+	qunlock(b);
 
 	while(!port->closed){
-		// release lock to read - error means it is time to quit
-		qunlock(b);
+		// error means it is time to quit
 		if(waserror()) {
 			print("etherread read error: %s\n", up->errstr);
-			qlock(b);
 			break;
 		}
 		if(0)
@@ -987,11 +1131,14 @@ etherread(void *a)
 			print("devbridge: etherread: blocklen = %d\n",
 				blocklen(bp));
 		poperror();
-		qlock(b);
 		if(bp == nil || port->closed)
 			break;
+
+		// forward alongside the other ports' readers
+		rlock(&b->portlk);
 		if(waserror()) {
 //			print("etherread bridge error\n");
+			runlock(&b->portlk);
 			if(bp)
 				freeb(bp);
 			continue;
@@ -1002,8 +1149,11 @@ etherread(void *a)
 
 		ep = (Etherpkt*)bp->rp;
 		cacheupdate(b, ep->s, port->id);
-		if(b->tcpmss)
+		if(b->tcpmss){
+			bp = unshareblock(bp);
+			ep = (Etherpkt*)bp->rp;
 			tcpmsshack(ep, BLEN(bp));
+		}
 
 		/*
 		 * delay packets to simulate a slow link
@@ -1021,24 +1171,29 @@ etherread(void *a)
 			bp2 = bp; bp = nil;
 			ethermultiwrite(b, bp2, port);
 		} else {
-			ce = cachelookup(b, ep->d);
-			if(ce == nil) {
+			p = cachelookup(b, ep->d);
+			oport = nil;
+			if(p >= 0)
+				oport = b->port[p];
+			if(oport == nil) {
 				b->miss++;
 				port->inunknown++;
 				bp2 = bp; bp = nil;
 				ethermultiwrite(b, bp2, port);
-			}else if(ce->port != port->id){
+			}else if(oport != port){
 				b->hit++;
 				bp2 = bp; bp = nil;
-				etherwrite(b->port[ce->port], bp2);
+				etherwrite(oport, bp2);
 			}
 		}
 
 		poperror();
+		runlock(&b->portlk);
 		if(bp)
 			freeb(bp);
 	}
 //	print("etherread: trying to exit\n");
+	qlock(b);
 	port->readp = nil;
 	portfree(port);
 	qunlock(b);
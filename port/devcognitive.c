@@ -11,6 +11,8 @@
 #include "dat.h"
 #include "fns.h"
 #include "../port/error.h"
+#include "../port/cognitive.h"
+#include "../port/matula.h"
 
 enum {
 	Qdir,
@@ -19,35 +21,187 @@ enum {
 	Qmonitor,
 	Qchannels,
 	Qswarms,
+	Qpatterns,
+	Qmembranes,
 	Qmetrics,
+	Qbinmetrics,
 	Qstats,
+	Qslab,
+	Qneural,
+	Qtransport,
+	Qprof,
+	Qcheckpoint,
+	Qevents,
+	Qchanlist,
+	Qchandir,
+	Qchandata,
+	Qchanctl,
+	Qchanstats,
 	Qrooted,
 	Qrootedctl,
 	Qrootedlist,
 	Qrootedtrees,
 	Qrootedshells,
+	Qrootedm,
+	Qmatula,
+	Qmatulaparens,
 };
 
+/*
+ * per-channel qids carry the channel's table slot above the type
+ * and its registration serial above that, so a slot reused by a
+ * later channel never gives a client an old path for a new file.
+ */
+#define TYPE(q)		((int)((q).path & 0xFF))
+#define CHNO(q)		((int)(((q).path >> 8) & 0xFFFFFF))
+#define SERIAL(q)	((ulong)((q).path >> 32))
+#define QID(no, t)	(((vlong)(no)<<8) | (t))
+#define CHQID(nc, t)	((uvlong)neural_channel_serial(nc)<<32 | QID(neural_channel_no(nc), t))
+/* rooted/m directories carry their tree's Matula number instead */
+#define MATULA(q)	((uvlong)(q).path >> 8)
+#define Matulamax	(1ULL<<56)
+
 Dirtab cognitivedir[] = {
 	".",		{Qdir, 0, QTDIR},	0,	0555,
 	"ctl",		{Qctl},			0,	0660,
 	"domains",	{Qdomains},		0,	0444,
 	"monitor",	{Qmonitor},		0,	0444,
-	"channels",	{Qchannels},		0,	0444,
+	"channels",	{Qchannels, 0, QTDIR},	0,	0555,
 	"swarms",	{Qswarms},		0,	0444,
+	"patterns",	{Qpatterns},		0,	0444,
+	"membranes",	{Qmembranes},		0,	0444,
 	"metrics",	{Qmetrics},		0,	0444,
+	"binmetrics",	{Qbinmetrics},		0,	0444,
 	"stats",	{Qstats},		0,	0444,
+	"slab",		{Qslab},		0,	0444,
+	"neural",	{Qneural},		0,	0220,
+	"transport",	{Qtransport},		0,	0444,
+	"prof",		{Qprof},		0,	0664,
+	"checkpoint",	{Qcheckpoint},		0,	0660,
+	"events",	{Qevents},		0,	0444,
 	"rooted",	{Qrooted, 0, QTDIR},	0,	0555,
-	"rooted/ctl",	{Qrootedctl},		0,	0660,
-	"rooted/list",	{Qrootedlist},		0,	0444,
-	"rooted/trees",	{Qrootedtrees},		0,	0444,
-	"rooted/shells",{Qrootedshells},	0,	0444,
+};
+
+static Dirtab rooteddir[] = {
+	"ctl",		{Qrootedctl},		0,	0660,
+	"list",		{Qrootedlist},		0,	0444,
+	"trees",	{Qrootedtrees},		0,	0444,
+	"shells",	{Qrootedshells},	0,	0444,
+	"m",		{Qrootedm, 0, QTDIR},	0,	0555,
+};
+
+enum {
+	Maxsnap	= 4*1024*1024,	/* largest status file snapshot, 26k binmetrics records */
+};
+
+static Dirtab chandir[] = {
+	"data",		{Qchandata},		0,	0660,
+	"ctl",		{Qchanctl},		0,	0660,
+	"stats",	{Qchanstats},		0,	0444,
+};
+
+enum {
+	CMcreate,
+	CMbind,
+	CMstart,
+	CMemerge,
+	CMlink,
+	CMadapt,
+	CMesnbench,
+	CMesncreate,
+	CMesntrain,
+	CMesnstep,
+	CMesnmode,
+	CMesnsave,
+	CMesnload,
+	CMesnclone,
+	CMswarmsched,
+	CMdomcpus,
+	CMmemcreate,
+	CMmemrule,
+	CMmemset,
+	CMmemstep,
+	CMmemworkers,
+	CMcheckpoint,
+	CMsensorpipe,
+};
+
+static Cmdtab cognitivectlmsg[] = {
+	CMcreate,	"create-namespace",	3,
+	CMbind,		"bind-channel",		0,
+	CMstart,	"start-swarm",		0,
+	CMemerge,	"detect-emergence",	0,
+	CMlink,		"link",			0,
+	CMadapt,	"adapt-namespace",	0,
+	CMesnbench,	"esn-bench",		0,
+	CMesncreate,	"esn-create",		5,
+	CMesntrain,	"esn-train",		0,
+	CMesnstep,	"esn-step",		0,
+	CMesnmode,	"esn-mode",		3,
+	CMesnsave,	"esn-save",		3,
+	CMesnload,	"esn-load",		3,
+	CMesnclone,	"esn-clone",		3,
+	CMswarmsched,	"swarm-sched",		3,
+	CMdomcpus,	"domain-cpus",		3,
+	CMmemcreate,	"membrane-create",	4,
+	CMmemrule,	"membrane-rule",	5,
+	CMmemset,	"membrane-set",		5,
+	CMmemstep,	"membrane-step",	0,
+	CMmemworkers,	"membrane-workers",	3,
+	CMcheckpoint,	"checkpoint",		0,
+	CMsensorpipe,	"sensor-pipe",		0,
+};
+
+enum {
+	CMcapacity,
+	CMpriority,
+	CMnoblock,
+	CMaging,
+	CMchanadapt,
+	CMchanedf,
+};
+
+static Cmdtab chanctlmsg[] = {
+	CMcapacity,	"capacity",	0,
+	CMpriority,	"priority",	0,
+	CMnoblock,	"noblock",	2,
+	CMaging,	"aging",	3,
+	CMchanadapt,	"adapt",	1,
+	CMchanedf,	"edf",		0,
+};
+
+enum {
+	Maxctl	= 64*1024,	/* largest batch of ctl commands */
+};
+
+typedef struct Snap Snap;
+struct Snap {
+	int	n;		/* bytes of data */
+	char	data[1];
+};
+
+enum {
+	Maxcheckpoint	= 512*1024*1024,	/* largest checkpoint restored */
+
+	Ckhdr		= 0,	/* gathering the header */
+	Ckbody,
+	Ckdone,
+};
+
+/* a checkpoint taken at open for reading, or gathered for restoring */
+typedef struct Ckpt Ckpt;
+struct Ckpt {
+	uchar	*buf;
+	long	n;		/* bytes in buf */
+	long	len;		/* bytes wanted */
+	int	state;
 };
 
 static void
 cognitiveinit(void)
 {
 	/* Initialize cognitive cities subsystem */
+	cognitive_cities_init();
 	print("Cognitive Cities device initialized\n");
 }
 
@@ -57,119 +211,1135 @@ cognitiveattach(char *spec)
 	return devattach('C', spec);
 }
 
+/* the channel q names, or nil if it has gone */
+static NeuralChannel*
+chanof(Qid q)
+{
+	NeuralChannel *nc;
+
+	nc = lookup_neural_channel_no(CHNO(q));
+	if(nc == nil || neural_channel_serial(nc) != SERIAL(q))
+		return nil;
+	return nc;
+}
+
+static NeuralChannel*
+cognitivechan(Chan *c)
+{
+	NeuralChannel *nc;
+
+	nc = chanof(c->qid);
+	if(nc == nil)
+		error(Ehungup);
+	return nc;
+}
+
+/*
+ * qid.vers of each file, from the versions cognitive.c keeps of
+ * what it shows, or 0 for streams and files that are written, which
+ * must not be cached.  Directories with a version have their failed
+ * walks cached by chan.c until it changes; the status files, read
+ * from a snapshot, can be cached or read ahead by devmnt and cfs.
+ */
+static ulong
+cognitivevers(int type)
+{
+	ulong v;
+
+	switch(type){
+	case Qdir:
+	case Qchandir:
+		return 1;
+	case Qchannels:
+		v = cognitive_version(CVchannels);
+		break;
+	case Qdomains:
+		v = cognitive_version(CVdomains) + cognitive_version(CVsample);
+		break;
+	case Qchanlist:
+		v = cognitive_version(CVchannels) + cognitive_version(CVsample);
+		break;
+	case Qswarms:
+		v = cognitive_version(CVswarms) + cognitive_version(CVsample);
+		break;
+	case Qpatterns:
+		v = cognitive_version(CVpatterns);
+		break;
+	case Qmembranes:
+		v = cognitive_version(CVmembranes);
+		break;
+	case Qmonitor:
+	case Qmetrics:
+	case Qbinmetrics:
+	case Qstats:
+	case Qslab:
+	case Qtransport:
+	case Qprof:
+	case Qchanstats:
+		v = cognitive_version(CVsample);
+		break;
+	default:
+		return 0;
+	}
+	return v+1;
+}
+
+static int
+changen(Chan *c, NeuralChannel *nc, Dirtab *tab, Dir *dp)
+{
+	Qid q;
+
+	mkqid(&q, CHQID(nc, tab->qid.path), cognitivevers(tab->qid.path), QTFILE);
+	devdir(c, q, tab->name, 0, eve, tab->perm, dp);
+	return 1;
+}
+
+/*
+ * A tree's directory under rooted/m, named by its Matula number.
+ * Any decimal number names a tree, so a name is accepted only in
+ * canonical form.
+ */
+static int
+matulagen(Chan *c, char *name, uvlong m, Dir *dp)
+{
+	char buf[24];
+	Qid q;
+
+	if(m == 0 || m >= Matulamax)
+		return -1;
+	if(name == nil){
+		snprint(buf, sizeof buf, "%llud", m);
+		name = buf;
+	}
+	mkqid(&q, QID(m, Qmatula), 0, QTDIR);
+	devdir(c, q, name, 0, eve, 0555, dp);
+	return 1;
+}
+
+static uvlong
+matulaname(char *name)
+{
+	char *e;
+	uvlong m;
+
+	if(name[0] < '1' || name[0] > '9')
+		return 0;
+	m = strtoull(name, &e, 10);
+	if(*e != 0 || m >= Matulamax)
+		return 0;
+	return m;
+}
+
+/*
+ * Top-level files come from cognitivedir.  channels/ holds list
+ * and one directory per registered channel, named by channel id
+ * and numbered by its table slot; each holds the chandir files.
+ * rooted/ holds the rooteddir files; rooted/m lists the registered
+ * shells by Matula number, and each tree's directory holds its
+ * parens file and one directory per distinct subtree, computed
+ * from the number's factorization rather than stored.
+ */
+static int
+cognitivegen(Chan *c, char *name, Dirtab*, int, int s, Dir *dp)
+{
+	NeuralChannel *nc;
+	uvlong m, k;
+	Qid q;
+	int i;
+
+	switch(TYPE(c->qid)){
+	case Qchannels:
+		if(s == DEVDOTDOT){
+			mkqid(&q, Qdir, cognitivevers(Qdir), QTDIR);
+			devdir(c, q, "#C", 0, eve, 0555, dp);
+			return 1;
+		}
+		if(name != nil){
+			if(strcmp(name, "list") == 0)
+				s = 0;
+			else{
+				nc = lookup_neural_channel(name);
+				if(nc == nil)
+					return -1;
+				s = neural_channel_no(nc)+1;
+			}
+		}
+		if(s == 0){
+			mkqid(&q, Qchanlist, cognitivevers(Qchanlist), QTFILE);
+			devdir(c, q, "list", 0, eve, 0444, dp);
+			return 1;
+		}
+		if(s-1 >= neural_channel_slots())
+			return -1;
+		nc = lookup_neural_channel_no(s-1);
+		if(nc == nil)
+			return 0;
+		mkqid(&q, CHQID(nc, Qchandir), cognitivevers(Qchandir), QTDIR);
+		devdir(c, q, neural_channel_id(nc), 0, eve, 0555, dp);
+		return 1;
+	case Qchandir:
+		if(s == DEVDOTDOT){
+			mkqid(&q, Qchannels, cognitivevers(Qchannels), QTDIR);
+			devdir(c, q, "channels", 0, eve, 0555, dp);
+			return 1;
+		}
+		nc = chanof(c->qid);
+		if(nc == nil)
+			return -1;
+		if(name != nil){
+			for(i = 0; i < nelem(chandir); i++)
+				if(strcmp(chandir[i].name, name) == 0)
+					return changen(c, nc, &chandir[i], dp);
+			return -1;
+		}
+		if(s >= nelem(chandir))
+			return -1;
+		return changen(c, nc, &chandir[s], dp);
+	case Qchandata:
+	case Qchanctl:
+	case Qchanstats:
+		/* stat of the file itself */
+		nc = chanof(c->qid);
+		if(nc == nil || s != 0)
+			return -1;
+		for(i = 0; i < nelem(chandir); i++)
+			if(chandir[i].qid.path == TYPE(c->qid))
+				return changen(c, nc, &chandir[i], dp);
+		return -1;
+	case Qchanlist:
+		if(s != 0)
+			return -1;
+		mkqid(&q, Qchanlist, cognitivevers(Qchanlist), QTFILE);
+		devdir(c, q, "list", 0, eve, 0444, dp);
+		return 1;
+	case Qrooted:
+		if(s == DEVDOTDOT)
+			break;
+		if(name != nil){
+			for(i = 0; i < nelem(rooteddir); i++)
+				if(strcmp(rooteddir[i].name, name) == 0)
+					return devgen(c, name, rooteddir, nelem(rooteddir), i, dp);
+			return -1;
+		}
+		return devgen(c, nil, rooteddir, nelem(rooteddir), s, dp);
+	case Qrootedctl:
+	case Qrootedlist:
+	case Qrootedtrees:
+	case Qrootedshells:
+		/* stat of the file itself */
+		if(s != 0)
+			return -1;
+		for(i = 0; i < nelem(rooteddir); i++)
+			if(rooteddir[i].qid.path == TYPE(c->qid))
+				return devgen(c, nil, rooteddir, nelem(rooteddir), i, dp);
+		return -1;
+	case Qrootedm:
+		if(s == DEVDOTDOT){
+			mkqid(&q, Qrooted, 0, QTDIR);
+			devdir(c, q, "rooted", 0, eve, 0555, dp);
+			return 1;
+		}
+		if(name != nil)
+			return matulagen(c, name, matulaname(name), dp);
+		if(rooted_shell_no(s, &m) < 0)
+			return -1;
+		if(m == 0 || m >= Matulamax)
+			return 0;
+		return matulagen(c, nil, m, dp);
+	case Qmatula:
+		if(s == DEVDOTDOT){
+			mkqid(&q, Qrootedm, 0, QTDIR);
+			devdir(c, q, "m", 0, eve, 0555, dp);
+			return 1;
+		}
+		m = MATULA(c->qid);
+		if(name != nil && strcmp(name, "parens") == 0)
+			s = 0;
+		else if(name != nil){
+			k = matulaname(name);
+			if(!matula_has_child(m, k))
+				return -1;
+			return matulagen(c, name, k, dp);
+		}
+		if(s == 0){
+			mkqid(&q, QID(m, Qmatulaparens), 0, QTFILE);
+			devdir(c, q, "parens", 0, eve, 0444, dp);
+			return 1;
+		}
+		k = matula_child(m, s-1);
+		if(k == 0)
+			return -1;
+		return matulagen(c, nil, k, dp);
+	case Qmatulaparens:
+		if(s != 0)
+			return -1;
+		devdir(c, c->qid, "parens", 0, eve, 0444, dp);
+		return 1;
+	}
+	i = devgen(c, name, cognitivedir, nelem(cognitivedir), s, dp);
+	if(i == 1)
+		dp->qid.vers = cognitivevers(dp->qid.path);
+	return i;
+}
+
 static Walkqid*
 cognitivewalk(Chan *c, Chan *nc, char **name, int nname)
 {
-	return devwalk(c, nc, name, nname, cognitivedir, nelem(cognitivedir), devgen);
+	return devwalk(c, nc, name, nname, nil, 0, cognitivegen);
 }
 
 static int
 cognitivestat(Chan *c, uchar *dp, int n)
 {
-	return devstat(c, dp, n, cognitivedir, nelem(cognitivedir), devgen);
+	return devstat(c, dp, n, nil, 0, cognitivegen);
+}
+
+/*
+ * Render a status file into a buffer big enough to hold it,
+ * doubling until the text fits or Maxsnap is reached.
+ */
+static Snap*
+cognitivesnap(int path)
+{
+	Snap *s;
+	char *buf;
+	int len, n;
+
+	for(len = READSTR;; len *= 2){
+		s = smalloc(sizeof(Snap)+len);
+		buf = s->data;
+		switch(path){
+		case Qdomains:
+			n = cognitive_domains_text(buf, len);
+			break;
+		case Qchanlist:
+			n = cognitive_channels_stats(buf, len);
+			break;
+		case Qswarms:
+			n = cognitive_swarms_text(buf, len);
+			break;
+		case Qpatterns:
+			n = cognitive_patterns_text(buf, len);
+			break;
+		case Qmembranes:
+			n = cognitive_membranes_text(buf, len);
+			break;
+		case Qmonitor:
+			n = cognitive_monitor_text(buf, len);
+			break;
+		case Qmetrics:
+			n = cognitive_metrics_text(buf, len);
+			break;
+		case Qstats:
+			n = cognitive_stats(buf, len);
+			break;
+		case Qbinmetrics:
+			n = cognitive_metrics_binary((uchar*)buf, len);
+			break;
+		case Qprof:
+			n = cognitive_prof_text(buf, len);
+			break;
+		default:
+			n = 0;
+			break;
+		}
+		if(n < len-1 || len >= Maxsnap){
+			s->n = n < len ? n : len;
+			return s;
+		}
+		free(s);
+	}
 }
 
 static Chan*
 cognitiveopen(Chan *c, int omode)
 {
-	return devopen(c, omode, cognitivedir, nelem(cognitivedir), devgen);
+	Ckpt *ck;
+
+	if(TYPE(c->qid) == Qcheckpoint && (omode&3) != OREAD && (omode&3) != OWRITE)
+		error(Ebadarg);
+	c = devopen(c, omode, nil, 0, cognitivegen);
+	switch(TYPE(c->qid)){
+	case Qcheckpoint:
+		/* read one taken now, or write one to restore */
+		ck = smalloc(sizeof(Ckpt));
+		if((omode&3) == OWRITE){
+			ck->buf = smalloc(CKhdrsize);
+			ck->len = CKhdrsize;
+		}else if((ck->n = cognitive_checkpoint(&ck->buf)) < 0){
+			free(ck);
+			error(Enomem);
+		}
+		c->aux = ck;
+		break;
+	case Qdomains:
+	case Qchanlist:
+	case Qswarms:
+	case Qpatterns:
+	case Qmembranes:
+	case Qmonitor:
+	case Qmetrics:
+	case Qstats:
+	case Qbinmetrics:
+	case Qprof:
+		/* snapshot now so reads see consistent offsets */
+		c->aux = cognitivesnap(TYPE(c->qid));
+		break;
+	case Qevents:
+		c->aux = cognitive_events_open();
+		break;
+	}
+	return c;
 }
 
 static void
 cognitiveclose(Chan *c)
 {
-	USED(c);
+	if((c->flag & COPEN) == 0)
+		return;
+	switch(TYPE(c->qid)){
+	case Qdomains:
+	case Qchanlist:
+	case Qswarms:
+	case Qpatterns:
+	case Qmembranes:
+	case Qmonitor:
+	case Qmetrics:
+	case Qstats:
+	case Qbinmetrics:
+	case Qprof:
+		free(c->aux);
+		c->aux = nil;
+		break;
+	case Qevents:
+		cognitive_events_close(c->aux);
+		c->aux = nil;
+		break;
+	case Qctl:
+		free(c->aux);
+		c->aux = nil;
+		break;
+	case Qcheckpoint:
+		if(c->aux != nil)
+			free(((Ckpt*)c->aux)->buf);
+		free(c->aux);
+		c->aux = nil;
+		break;
+	}
+}
+
+/*
+ * A checkpoint written to the checkpoint file is restored as soon
+ * as all of it has arrived.  Anything written after that, such as
+ * the tail of a file once holding a longer one, is ignored.
+ */
+static long
+checkpointwrite(Ckpt *ck, uchar *a, long n, vlong offset)
+{
+	uchar *buf;
+	long m, done, len;
+	int r;
+
+	if(ck->state == Ckdone)
+		return n;
+	if(offset != ck->n)
+		error(Ebadarg);
+	for(done = 0; done < n && ck->state != Ckdone; done += m){
+		m = ck->len - ck->n;
+		if(m > n - done)
+			m = n - done;
+		memmove(ck->buf + ck->n, a + done, m);
+		ck->n += m;
+		if(ck->n < ck->len)
+			continue;
+		if(ck->state == Ckhdr){
+			len = cognitive_checkpoint_length(ck->buf);
+			if(len < 0 || len > Maxcheckpoint)
+				error("not a checkpoint");
+			buf = malloc(len);
+			if(buf == nil)
+				error(Enomem);
+			memmove(buf, ck->buf, CKhdrsize);
+			free(ck->buf);
+			ck->buf = buf;
+			ck->len = len;
+			ck->state = Ckbody;
+		}
+		if(ck->n == ck->len){
+			r = cognitive_restore(ck->buf, ck->len);
+			free(ck->buf);
+			ck->buf = nil;
+			ck->state = Ckdone;
+			if(r < 0)
+				error("bad checkpoint");
+		}
+	}
+	return n;
+}
+
+/*
+ * Parse a decimal number such as -1.5 or 2e-3 for ESN commands;
+ * anything else is Ebadarg.
+ */
+static double
+ctlfloat(char *s)
+{
+	double v, scale;
+	int neg, eneg, e, digits;
+
+	neg = *s == '-';
+	if(*s == '-' || *s == '+')
+		s++;
+	v = 0;
+	digits = 0;
+	for(; *s >= '0' && *s <= '9'; s++, digits++)
+		v = v*10 + (*s - '0');
+	if(*s == '.')
+		for(scale = 0.1, s++; *s >= '0' && *s <= '9'; s++, digits++, scale /= 10)
+			v += (*s - '0')*scale;
+	if(digits == 0)
+		error(Ebadarg);
+	if(*s == 'e' || *s == 'E'){
+		s++;
+		eneg = *s == '-';
+		if(*s == '-' || *s == '+')
+			s++;
+		if(*s < '0' || *s > '9')
+			error(Ebadarg);
+		for(e = 0; *s >= '0' && *s <= '9' && e < 400; s++)
+			e = e*10 + (*s - '0');
+		while(e-- > 0)
+			v = eneg ? v/10 : v*10;
+	}
+	if(*s != 0)
+		error(Ebadarg);
+	return neg ? -v : v;
+}
+
+extern long (*_globalsegio)(char*, void*, long, vlong, int);
+
+enum {
+	Maxesnimage	= 256*1024*1024,	/* largest image esn-load reads */
+};
+
+/*
+ * esn-save name segment: write the reservoir's image (see
+ * esn_image_write) to the start of a global segment, from which
+ * processes can attach it and esn-load can recreate it.
+ */
+static void
+esnsave(Cmdbuf *cb)
+{
+	EchoStateNetwork *esn;
+	uchar *buf;
+	long n;
+
+	if(_globalsegio == nil)
+		error("no global segments");
+	esn = lookup_esn(cb->f[1]);
+	if(esn == nil)
+		error(Enonexist);
+	esn_ctl_lock(esn);
+	n = esn_image_size(esn);
+	buf = malloc(n);
+	if(buf != nil)
+		esn_image_write(esn, buf, n);
+	esn_ctl_unlock(esn);
+	if(buf == nil)
+		error(Enomem);
+	if(waserror()){
+		free(buf);
+		nexterror();
+	}
+	_globalsegio(cb->f[2], buf, n, 0, 1);
+	poperror();
+	free(buf);
+}
+
+// esn-load name segment: a new reservoir from the image at the start of a segment
+static void
+esnload(Cmdbuf *cb)
+{
+	EchoStateNetwork *esn;
+	uchar hdr[EIhdrsize], *buf;
+	long n;
+
+	if(_globalsegio == nil)
+		error("no global segments");
+	if(lookup_esn(cb->f[1]) != nil)
+		error(Eexist);
+	_globalsegio(cb->f[2], hdr, sizeof hdr, 0, 0);
+	n = GBIT32(hdr+8);
+	if(GBIT32(hdr) != EImagic || n < EIhdrsize || n > Maxesnimage)
+		error("not an esn image");
+	buf = malloc(n);
+	if(buf == nil)
+		error(Enomem);
+	if(waserror()){
+		free(buf);
+		nexterror();
+	}
+	_globalsegio(cb->f[2], buf, n, 0, 0);
+	esn = esn_image_load(buf, n);
+	if(esn == nil)
+		error("bad esn image");
+	poperror();
+	free(buf);
+	if(esn_register(cb->f[1], esn) < 0){
+		esn_free(esn);
+		error(Eexist);
+	}
+}
+
+/*
+ * esn-clone parent name: a reservoir sharing parent's weights, in
+ * parent's current state.  Naming an existing clone of parent puts
+ * it back in that state instead.
+ */
+static void
+esnclone(Cmdbuf *cb)
+{
+	EchoStateNetwork *parent, *esn;
+
+	parent = lookup_esn(cb->f[1]);
+	if(parent == nil)
+		error(Enonexist);
+	esn = lookup_esn(cb->f[2]);
+	if(esn != nil){
+		if(esn_clone_reset(esn, parent) < 0)
+			error(Eexist);
+		return;
+	}
+	esn_ctl_lock(parent);
+	esn = esn_clone(parent);
+	esn_ctl_unlock(parent);
+	if(esn == nil)
+		error(Enomem);
+	if(esn_register(cb->f[2], esn) < 0){
+		esn_free(esn);
+		error(Eexist);
+	}
+}
+
+// float, fixed or hyper as an ESN stepping mode
+static int
+esnmode(Cmdbuf *cb, char *s)
+{
+	if(strcmp(s, "float") == 0)
+		return ESNfloat;
+	if(strcmp(s, "fixed") == 0)
+		return ESNfixed;
+	if(strcmp(s, "hyper") == 0)
+		return ESNhyper;
+	cmderror(cb, "unknown esn mode: want float, fixed or hyper");
+	return -1;
+}
+
+/*
+ * esn-step name u1..ud [y1..ym]: drive the named reservoir one step,
+ * accumulating the targets y when it is being trained.
+ */
+static void
+esnstep(Cmdbuf *cb)
+{
+	EchoStateNetwork *esn;
+	float *u, *y;
+	int i, d, m;
+
+	if(cb->nf < 2)
+		cmderror(cb, "usage: esn-step name input... [target...]");
+	esn = lookup_esn(cb->f[1]);
+	if(esn == nil)
+		error(Enonexist);
+	d = esn_input_dim(esn);
+	m = esn_output_dim(esn);
+	if(cb->nf != 2+d && cb->nf != 2+d+m)
+		error(Ebadarg);
+	u = smalloc((d+m)*sizeof(float));
+	if(waserror()){
+		free(u);
+		nexterror();
+	}
+	for(i = 0; i < cb->nf-2; i++)
+		u[i] = ctlfloat(cb->f[2+i]);
+	y = cb->nf == 2+d+m ? u+d : nil;
+	esn_ctl_lock(esn);
+	esn_train_step(esn, u, y);
+	esn_ctl_unlock(esn);
+	poperror();
+	free(u);
+}
+
+enum {
+	Maxmembranes	= 65536,	/* most membranes in one system */
+	Maxmemobjects	= 4096,		/* most kinds of object */
+	Maxmemcells	= 16*1024*1024,	/* most counts, membranes by objects */
+};
+
+/*
+ * membrane-create name objects parents: parents is a comma-separated
+ * list with an entry per membrane, - for the skin and the number of
+ * an earlier membrane for every other one.
+ */
+static void
+membranecreate(Cmdbuf *cb)
+{
+	int *parent;
+	int nmem, nobj, m;
+	char *p, *e;
+
+	nobj = atoi(cb->f[2]);
+	nmem = 1;
+	for(p = cb->f[3]; *p != 0; p++)
+		if(*p == ',')
+			nmem++;
+	if(nobj < 1 || nobj > Maxmemobjects || nmem > Maxmembranes || (vlong)nmem*nobj > Maxmemcells)
+		error(Ebadarg);
+	if(lookup_membrane_system(cb->f[1]) != nil)
+		error(Eexist);
+	parent = smalloc(nmem*sizeof(int));
+	if(waserror()){
+		free(parent);
+		nexterror();
+	}
+	p = cb->f[3];
+	for(m = 0; m < nmem; m++){
+		if(*p == '-'){
+			parent[m] = -1;
+			e = p+1;
+		}else
+			parent[m] = strtol(p, &e, 10);
+		if(e == p || (*e != ',' && *e != 0))
+			cmderror(cb, "usage: membrane-create name objects -,parent,...");
+		p = e+1;
+	}
+	if(register_membrane_system(cb->f[1], nmem, nobj, parent) == nil)
+		error(Ebadarg);
+	poperror();
+	free(parent);
+}
+
+static MembraneSystem*
+cognitivemembranes(char *name)
+{
+	MembraneSystem *ms;
+
+	ms = lookup_membrane_system(name);
+	if(ms == nil)
+		error(Enonexist);
+	return ms;
+}
+
+static void
+cognitivecmd(Cmdbuf *cb)
+{
+	Cmdtab *ct;
+	CognitiveNamespace *src, *dst;
+	CognitiveSwarm *swarm;
+	NeuralChannel *nc;
+	EchoStateNetwork *esn;
+	MembraneSystem *ms;
+	int n, steps, in, out, r;
+	float ridge, sparsity;
+
+	ct = lookupcmd(cb, cognitivectlmsg, nelem(cognitivectlmsg));
+	switch(ct->index){
+	case CMcreate:
+		/* repeating a create is harmless */
+		src = lookup_cognitive_namespace(cb->f[1]);
+		if(src != nil){
+			if(strcmp(cognitive_namespace_path(src), cb->f[2]) != 0)
+				error(Eexist);
+			break;
+		}
+		src = create_cognitive_namespace(cb->f[1], cb->f[2]);
+		if(src == nil)
+			error(Enomem);
+		if(register_cognitive_namespace(src) < 0){
+			free_cognitive_namespace(src);
+			error(Eexist);
+		}
+		break;
+	case CMbind:
+		if(cb->nf < 3 || cb->nf > 4)
+			cmderror(cb, "usage: bind-channel source target [bandwidth]");
+		src = lookup_cognitive_namespace(cb->f[1]);
+		dst = lookup_cognitive_namespace(cb->f[2]);
+		if(src == nil || dst == nil)
+			error(Enonexist);
+		nc = create_neural_channel(cb->f[1], cb->f[2], cb->nf > 3 ? strtoul(cb->f[3], 0, 0) : 0);
+		if(nc == nil)
+			error(Enomem);
+		if(register_neural_channel(nc) < 0){
+			free_neural_channel(nc);
+			error(Eexist);
+		}
+		bind_neural_channel_to_namespace(src, nc);
+		bind_neural_channel_to_namespace(dst, nc);
+		break;
+	case CMstart:
+		/* agents join with their own processes; the count is advisory */
+		if(cb->nf < 3 || cb->nf > 4)
+			cmderror(cb, "usage: start-swarm id domain [agents]");
+		if(lookup_cognitive_namespace(cb->f[2]) == nil)
+			error(Enonexist);
+		swarm = lookup_cognitive_swarm(cb->f[1]);
+		if(swarm != nil){
+			if(strcmp(cognitive_swarm_domain(swarm), cb->f[2]) != 0)
+				error(Eexist);
+			break;
+		}
+		swarm = create_cognitive_swarm(cb->f[1], cb->f[2], nil);
+		if(swarm == nil)
+			error(Enomem);
+		if(register_cognitive_swarm(swarm) < 0)
+			error(Eexist);
+		break;
+	case CMemerge:
+		if(cb->nf > 3)
+			cmderror(cb, "usage: detect-emergence [domain] [threshold]");
+		cognitive_event("emergence-scan %s %s",
+			cb->nf > 1 ? cb->f[1] : "all", cb->nf > 2 ? cb->f[2] : "-");
+		break;
+	case CMlink:
+		if(cb->nf < 3 || cb->nf > 4)
+			cmderror(cb, "usage: link channel fd [remote-channel]");
+		neural_link(cb->f[1], atoi(cb->f[2]), cb->nf > 3 ? cb->f[3] : nil);
+		break;
+	case CMadapt:
+		if(cb->nf < 2 || cb->nf > 3)
+			cmderror(cb, "usage: adapt-namespace domain [auto|manual]");
+		src = lookup_cognitive_namespace(cb->f[1]);
+		if(src == nil)
+			error(Enonexist);
+		adapt_cognitive_namespace(src);
+		break;
+	case CMesnbench:
+		if(cb->nf < 2 || cb->nf > 5)
+			cmderror(cb, "usage: esn-bench size [steps [sparsity [float|fixed|hyper]]]");
+		n = atoi(cb->f[1]);
+		steps = cb->nf > 2 ? atoi(cb->f[2]) : 100;
+		sparsity = cb->nf > 3 ? ctlfloat(cb->f[3]) : 0.1;
+		r = cb->nf > 4 ? esnmode(cb, cb->f[4]) : ESNfloat;
+		if(n < 1 || n > 65536 || steps < 1 || steps > 100000 || sparsity <= 0 || sparsity > 1)
+			error(Ebadarg);
+		esn_bench(n, steps, sparsity, r);
+		break;
+	case CMesncreate:
+		n = atoi(cb->f[2]);
+		in = atoi(cb->f[3]);
+		out = atoi(cb->f[4]);
+		if(n < 1 || n > 65536 || in < 1 || in > 256 || out < 1 || out > 256)
+			error(Ebadarg);
+		if(lookup_esn(cb->f[1]) != nil)
+			error(Eexist);
+		if(register_esn(cb->f[1], n, in, out) == nil)
+			error(Enomem);
+		break;
+	case CMesntrain:
+		if(cb->nf < 3 || cb->nf > 4)
+			cmderror(cb, "usage: esn-train name begin [ridge] | esn-train name finish");
+		esn = lookup_esn(cb->f[1]);
+		if(esn == nil)
+			error(Enonexist);
+		if(strcmp(cb->f[2], "begin") == 0){
+			ridge = cb->nf > 3 ? ctlfloat(cb->f[3]) : 1e-4;
+			esn_ctl_lock(esn);
+			r = esn_train_begin(esn, ridge);
+			esn_ctl_unlock(esn);
+			if(r < 0)
+				error(Ebadarg);
+		}else if(strcmp(cb->f[2], "finish") == 0 && cb->nf == 3){
+			esn_ctl_lock(esn);
+			steps = esn_train_samples(esn);
+			r = esn_train_finish(esn);
+			esn_ctl_unlock(esn);
+			if(r < 0)
+				error("readout not trained");
+			cognitive_event("esn-trained %s %d", cb->f[1], steps);
+		}else
+			cmderror(cb, "usage: esn-train name begin [ridge] | esn-train name finish");
+		break;
+	case CMesnstep:
+		esnstep(cb);
+		break;
+	case CMesnsave:
+		esnsave(cb);
+		break;
+	case CMesnload:
+		esnload(cb);
+		break;
+	case CMesnclone:
+		esnclone(cb);
+		break;
+	case CMesnmode:
+		esn = lookup_esn(cb->f[1]);
+		if(esn == nil)
+			error(Enonexist);
+		n = esnmode(cb, cb->f[2]);
+		esn_ctl_lock(esn);
+		if(n == ESNhyper)
+			r = esn_set_hyper(esn, 1);
+		else if((r = esn_set_hyper(esn, 0)) == 0)
+			r = esn_set_fixed(esn, n == ESNfixed);
+		esn_ctl_unlock(esn);
+		if(r < 0)
+			error(Enomem);
+		break;
+	case CMswarmsched:
+		swarm = lookup_cognitive_swarm(cb->f[1]);
+		if(swarm == nil)
+			error(Enonexist);
+		if(swarm_set_cpus(swarm, atoi(cb->f[2])) < 0)
+			error(Ebadarg);
+		break;
+	case CMdomcpus:
+		src = lookup_cognitive_namespace(cb->f[1]);
+		if(src == nil)
+			error(Enonexist);
+		if(namespace_set_cpus(src, atoi(cb->f[2])) < 0)
+			error(Ebadarg);
+		break;
+	case CMmemcreate:
+		membranecreate(cb);
+		break;
+	case CMmemrule:
+		/* membrane-rule name membrane lhs rhs, as in 0x2,1 3@out,4x2@2 */
+		ms = cognitivemembranes(cb->f[1]);
+		if(membrane_add_rule(ms, atoi(cb->f[2]), cb->f[3], cb->f[4]) < 0)
+			cmderror(cb, "usage: membrane-rule name membrane obj[xN],... obj[xN][@here|@out|@child],...|-");
+		break;
+	case CMmemset:
+		ms = cognitivemembranes(cb->f[1]);
+		if(membrane_set(ms, atoi(cb->f[2]), atoi(cb->f[3]), strtoull(cb->f[4], 0, 0)) < 0)
+			error(Ebadarg);
+		break;
+	case CMmemstep:
+		if(cb->nf < 2 || cb->nf > 3)
+			cmderror(cb, "usage: membrane-step name [steps]");
+		ms = cognitivemembranes(cb->f[1]);
+		steps = cb->nf > 2 ? atoi(cb->f[2]) : 1;
+		if(steps < 1 || steps > 1000000)
+			error(Ebadarg);
+		if(membrane_run(ms, steps) < 0)
+			error(Enomem);
+		break;
+	case CMmemworkers:
+		membrane_set_workers(cognitivemembranes(cb->f[1]), atoi(cb->f[2]));
+		break;
+	case CMcheckpoint:
+		/* checkpoint ms fd: save to the open file fd every ms */
+		if(cb->nf < 2 || cb->nf > 3)
+			cmderror(cb, "usage: checkpoint ms fd | checkpoint 0");
+		n = atoi(cb->f[1]);
+		if(n < 0 || (n > 0) != (cb->nf == 3))
+			error(Ebadarg);
+		cognitive_checkpoint_every(n > 0 ? atoi(cb->f[2]) : -1, n);
+		break;
+	case CMsensorpipe:
+		/* sensor-pipe esn channel fd: step esn on the udp datagrams read from fd */
+		if(cb->nf == 3 && strcmp(cb->f[2], "stop") == 0){
+			if(sensor_pipe_stop(cb->f[1]) < 0)
+				error(Enonexist);
+			break;
+		}
+		if(cb->nf != 4)
+			cmderror(cb, "usage: sensor-pipe esn channel fd | sensor-pipe esn stop");
+		sensor_pipe(cb->f[1], cb->f[2], atoi(cb->f[3]));
+		break;
+	}
+}
+
+/*
+ * Run a batch of newline-separated ctl commands.  Every line is
+ * attempted; "lineno ok" or "lineno error" for each command is kept
+ * with the Chan and returned by reading ctl on the same fd.  The
+ * write fails if any command did.  Blank lines and lines starting
+ * with # are skipped.
+ */
+static void
+cognitivectl(Chan *c, char *a, long n)
+{
+	char *buf, *p, *e, *nl, *r, *re, *res;
+	Cmdbuf *cb;
+	int line, nline, nerr;
+
+	buf = smalloc(n+1);
+	if(waserror()){
+		free(buf);
+		nexterror();
+	}
+	memmove(buf, a, n);
+	buf[n] = 0;
+	e = buf+n;
+
+	nline = 1;
+	for(p = buf; p < e; p++)
+		if(*p == '\n')
+			nline++;
+	res = smalloc(nline*(ERRMAX+16));
+	r = res;
+	re = res + nline*(ERRMAX+16);
+	free(c->aux);
+	c->aux = res;
+
+	nerr = 0;
+	line = 0;
+	for(p = buf; p < e; p = nl+1){
+		line++;
+		nl = strchr(p, '\n');
+		if(nl == nil)
+			nl = e;
+		*nl = 0;
+		while(*p == ' ' || *p == '\t')
+			p++;
+		if(*p == 0 || *p == '#')
+			continue;
+		cb = parsecmd(p, nl-p);
+		if(waserror()){
+			r = seprint(r, re, "%d %s\n", line, up->errstr);
+			nerr++;
+		}else{
+			cognitivecmd(cb);
+			poperror();
+			r = seprint(r, re, "%d ok\n", line);
+		}
+		free(cb);
+	}
+	poperror();
+	free(buf);
+	if(nerr > 0){
+		snprint(up->genbuf, sizeof up->genbuf, "%d of %d commands failed", nerr, line);
+		error(up->genbuf);
+	}
 }
 
 static long
 cognitiveread(Chan *c, void *a, long n, vlong offset)
 {
+	NeuralChannel *nc;
+	Ckpt *ck;
+	Snap *snap;
+	Block *b;
 	char *buf;
 	int len;
 	
-	switch((int)c->qid.path){
+	switch(TYPE(c->qid)){
 	case Qdir:
-		return devdirread(c, a, n, cognitivedir, nelem(cognitivedir), devgen);
-		
-	case Qdomains:
-		/* Return list of cognitive domains */
-		buf = "transportation\nenergy\ngovernance\nenvironment\n";
-		len = strlen(buf);
-		if(offset >= len)
-			return 0;
-		if(offset + n > len)
-			n = len - offset;
-		memmove(a, buf + offset, n);
-		return n;
-		
 	case Qchannels:
-		/* Return list of neural channels */
-		buf = "transportation-energy: bandwidth=500 load=0\n"
-		      "transportation-governance: bandwidth=300 load=0\n"
-		      "energy-environment: bandwidth=400 load=0\n"
-		      "governance-environment: bandwidth=200 load=0\n";
-		len = strlen(buf);
-		if(offset >= len)
-			return 0;
-		if(offset + n > len)
-			n = len - offset;
-		memmove(a, buf + offset, n);
+	case Qchandir:
+	case Qrooted:
+	case Qrootedm:
+	case Qmatula:
+		return devdirread(c, a, n, nil, 0, cognitivegen);
+
+	case Qmatulaparens:
+		buf = matula_parens(MATULA(c->qid));
+		if(buf == nil)
+			error("tree too large to decode");
+		if(waserror()){
+			free(buf);
+			nexterror();
+		}
+		n = readstr(offset, a, n, buf);
+		poperror();
+		free(buf);
 		return n;
 		
-	case Qswarms:
-		/* Return list of cognitive swarms */
-		buf = "No active swarms\n";
-		len = strlen(buf);
-		if(offset >= len)
+	case Qchandata:
+		b = neural_channel_bread(cognitivechan(c), n);
+		if(b == nil)
 			return 0;
-		if(offset + n > len)
-			n = len - offset;
-		memmove(a, buf + offset, n);
+		if(waserror()){
+			freeb(b);
+			nexterror();
+		}
+		n = BLEN(b);
+		memmove(a, b->rp, n);
+		poperror();
+		freeb(b);
 		return n;
-		
+	
+	case Qchanctl:
+		/* the channel's id */
+		return readstr(offset, a, n, neural_channel_id(cognitivechan(c)));
+	
+	case Qchanstats:
+		nc = cognitivechan(c);
+		buf = smalloc(READSTR);
+		if(waserror()){
+			free(buf);
+			nexterror();
+		}
+		len = neural_channel_stats(nc, buf, READSTR);
+		neural_channel_prio_stats(nc, buf+len, READSTR-len);
+		n = readstr(offset, a, n, buf);
+		poperror();
+		free(buf);
+		return n;
+	
+	case Qdomains:
+	case Qchanlist:
+	case Qswarms:
+	case Qpatterns:
+	case Qmembranes:
 	case Qmonitor:
-		/* Real-time monitoring stream */
-		buf = "Cognitive Cities Monitor - Active\n"
-		      "Domains: 4 | Channels: 4 | Swarms: 0\n"
-		      "Overall cognitive load: 0%\n";
-		len = strlen(buf);
-		if(offset >= len)
+	case Qmetrics:
+	case Qstats:
+	case Qbinmetrics:
+	case Qprof:
+		/* Status snapshot taken at open */
+		snap = c->aux;
+		if(offset >= snap->n)
 			return 0;
-		if(offset + n > len)
-			n = len - offset;
-		memmove(a, buf + offset, n);
+		if(offset + n > snap->n)
+			n = snap->n - offset;
+		memmove(a, snap->data + offset, n);
 		return n;
-		
-	case Qmetrics:
-		/* System metrics */
-		buf = "Cognitive Cities Metrics\n"
-		      "========================\n"
-		      "Neural transport efficiency: 100%\n"
-		      "Swarm coordination speed: N/A\n"
-		      "Emergence detection: Active\n"
-		      "Cross-domain integration: 4 domains\n";
-		len = strlen(buf);
-		if(offset >= len)
+	
+	case Qcheckpoint:
+		ck = c->aux;
+		if(offset >= ck->n)
 			return 0;
-		if(offset + n > len)
-			n = len - offset;
-		memmove(a, buf + offset, n);
+		if(offset + n > ck->n)
+			n = ck->n - offset;
+		memmove(a, ck->buf + offset, n);
 		return n;
-		
-	case Qstats:
-		/* Statistics */
-		buf = "Cognitive Statistics\n"
-		      "===================\n"
-		      "Uptime: Active\n"
-		      "Messages processed: 0\n"
-		      "Patterns detected: 0\n"
-		      "Adaptations performed: 0\n";
-		len = strlen(buf);
-		if(offset >= len)
+
+	case Qctl:
+		/* Results of the last command batch written on this fd */
+		if(c->aux == nil)
 			return 0;
-		if(offset + n > len)
-			n = len - offset;
-		memmove(a, buf + offset, n);
+		return readstr(offset, a, n, c->aux);
+	
+	case Qevents:
+		/* Blocks until an event arrives; offset is ignored */
+		return cognitive_events_read(c->aux, a, n);
+	
+	case Qslab:
+		/* Neural message allocator statistics */
+		buf = smalloc(READSTR);
+		if(waserror()){
+			free(buf);
+			nexterror();
+		}
+		neural_slab_stats(buf, READSTR);
+		n = readstr(offset, a, n, buf);
+		poperror();
+		free(buf);
+		return n;
+	
+	case Qtransport:
+		/* Cross-node neural transport statistics */
+		buf = smalloc(READSTR);
+		if(waserror()){
+			free(buf);
+			nexterror();
+		}
+		neural_transport_stats(buf, READSTR);
+		n = readstr(offset, a, n, buf);
+		poperror();
+		free(buf);
 		return n;
 	
 	case Qrootedlist:
@@ -243,55 +1413,123 @@ cognitiveread(Chan *c, void *a, long n, vlong offset)
 	return 0;
 }
 
+static void
+chanctl(NeuralChannel *nc, void *a, long n)
+{
+	Cmdbuf *cb;
+	Cmdtab *ct;
+	vlong t[3];
+	char *e;
+	int i;
+
+	cb = parsecmd(a, n);
+	if(waserror()){
+		free(cb);
+		nexterror();
+	}
+	ct = lookupcmd(cb, chanctlmsg, nelem(chanctlmsg));
+	switch(ct->index){
+	case CMcapacity:
+		if(cb->nf < 2 || cb->nf > 3)
+			cmderror(cb, "usage: capacity window [max]");
+		set_neural_channel_capacity(nc, strtoul(cb->f[1], 0, 0),
+			cb->nf > 2 ? strtoul(cb->f[2], 0, 0) : 0);
+		break;
+	case CMpriority:
+		if(cb->nf < 2 || cb->nf > 3)
+			cmderror(cb, "usage: priority prio [type]");
+		set_neural_channel_data(nc, cb->nf > 2 ? atoi(cb->f[2]) : 0,
+			strtoul(cb->f[1], 0, 0));
+		break;
+	case CMnoblock:
+		if(strcmp(cb->f[1], "on") == 0)
+			set_neural_channel_noblock(nc, 1);
+		else if(strcmp(cb->f[1], "off") == 0)
+			set_neural_channel_noblock(nc, 0);
+		else
+			cmderror(cb, "usage: noblock on|off");
+		break;
+	case CMaging:
+		if(set_neural_level_aging(nc, atoi(cb->f[1]), strtoul(cb->f[2], 0, 0)) < 0)
+			cmderror(cb, Ebadarg);
+		break;
+	case CMchanadapt:
+		adapt_neural_channel_capacity(nc);
+		break;
+	case CMchanedf:
+		/* edf period deadline cost, or edf off; times as for /proc/n/ctl */
+		if(cb->nf == 2 && strcmp(cb->f[1], "off") == 0){
+			set_neural_channel_edf(nc, 0, 0, 0);
+			break;
+		}
+		if(cb->nf != 4)
+			cmderror(cb, "usage: edf period deadline cost | edf off");
+		for(i = 0; i < 3; i++)
+			if(e = parsetime(&t[i], cb->f[i+1]))
+				cmderror(cb, e);
+		if(t[0] < 1000)
+			cmderror(cb, "period too short");
+		set_neural_channel_edf(nc, t[0]/1000, t[1]/1000, t[2]/1000);
+		break;
+	}
+	poperror();
+	free(cb);
+}
+
 static long
 cognitivewrite(Chan *c, void *a, long n, vlong offset)
 {
 	char buf[256];
 	char *fields[8];
 	int nf;
+	Block *b;
 	
 	USED(offset);
 	
-	switch((int)c->qid.path){
+	switch(TYPE(c->qid)){
+	case Qchandata:
+		if(n > NBmaxmsg)
+			error(Etoobig);
+		b = allocb(n);
+		if(waserror()){
+			freeb(b);
+			nexterror();
+		}
+		memmove(b->wp, a, n);
+		poperror();
+		b->wp += n;
+		return neural_channel_bwrite(cognitivechan(c), b);
+	
+	case Qchanctl:
+		chanctl(cognitivechan(c), a, n);
+		return n;
+
+	case Qcheckpoint:
+		return checkpointwrite(c->aux, a, n, offset);
+	
 	case Qctl:
-		/* Control commands */
-		if(n >= sizeof(buf))
-			n = sizeof(buf) - 1;
-		memmove(buf, a, n);
-		buf[n] = 0;
-		
-		/* Parse command */
-		nf = tokenize(buf, fields, nelem(fields));
-		if(nf < 1)
+		/* Control commands, one per line */
+		if(n > Maxctl)
+			error(Etoobig);
+		cognitivectl(c, a, n);
+		return n;
+	
+	case Qprof:
+		/* Operation profile control, as kprof's kpctl */
+		if(n >= 8 && strncmp(a, "startclr", 8) == 0)
+			cognitive_prof_ctl(1, 1);
+		else if(n >= 5 && strncmp(a, "start", 5) == 0)
+			cognitive_prof_ctl(1, 0);
+		else if(n >= 4 && strncmp(a, "stop", 4) == 0)
+			cognitive_prof_ctl(0, 0);
+		else
+			error(Ebadctl);
+		return n;
+	
+	case Qneural:
+		/* Batch of neural messages from a peer node */
+		if(neural_batch_deliver(a, n) < 0)
 			error(Ebadarg);
-		
-		if(strcmp(fields[0], "create-namespace") == 0){
-			if(nf < 3)
-				error("usage: create-namespace domain path");
-			print("Creating cognitive namespace: %s at %s\n", fields[1], fields[2]);
-		}
-		else if(strcmp(fields[0], "bind-channel") == 0){
-			if(nf < 3)
-				error("usage: bind-channel source target [bandwidth]");
-			print("Binding neural channel: %s -> %s\n", fields[1], fields[2]);
-		}
-		else if(strcmp(fields[0], "start-swarm") == 0){
-			if(nf < 3)
-				error("usage: start-swarm id domain [agents]");
-			print("Starting cognitive swarm: %s in domain %s\n", fields[1], fields[2]);
-		}
-		else if(strcmp(fields[0], "detect-emergence") == 0){
-			print("Triggering emergence detection\n");
-		}
-		else if(strcmp(fields[0], "adapt-namespace") == 0){
-			if(nf < 2)
-				error("usage: adapt-namespace domain [auto|manual]");
-			print("Adapting cognitive namespace: %s\n", fields[1]);
-		}
-		else {
-			error("unknown command");
-		}
-		
 		return n;
 	
 	case Qrootedctl:
@@ -316,7 +1554,7 @@ cognitivewrite(Chan *c, void *a, long n, vlong offset)
 			if(nf < 3)
 				error("usage: enumerate domain max_size");
 			print("Enumerating rooted shells: domain=%s max_size=%s\n", fields[1], fields[2]);
-			/* Would call: enumerate_rooted_shells(fields[1], atoi(fields[2]), &shells) */
+			/* Would call: enumerate_rooted_shells(fields[1], atoi(fields[2])) */
 		}
 		else if(strcmp(fields[0], "info") == 0){
 			if(nf < 2)
@@ -341,6 +1579,45 @@ cognitivewrite(Chan *c, void *a, long n, vlong offset)
 	return 0;
 }
 
+static Block*
+cognitivebread(Chan *c, long n, ulong offset)
+{
+	if(TYPE(c->qid) == Qchandata)
+		return neural_channel_bread(cognitivechan(c), n);
+	return devbread(c, n, offset);
+}
+
+static long
+cognitivebwrite(Chan *c, Block *bp, ulong offset)
+{
+	NeuralChannel *nc;
+
+	if(TYPE(c->qid) == Qchandata){
+		if(waserror()){
+			freeblist(bp);
+			nexterror();
+		}
+		nc = cognitivechan(c);
+		if(blocklen(bp) > NBmaxmsg)
+			error(Etoobig);
+		poperror();
+		return neural_channel_bwrite(nc, bp);
+	}
+	return devbwrite(c, bp, offset);
+}
+
+static int
+cognitivepoll(Chan *c, Pollw *w)
+{
+	switch(TYPE(c->qid)){
+	case Qchandata:
+		return neural_channel_poll(cognitivechan(c), w);
+	case Qevents:
+		return cognitive_events_poll(c->aux, w);
+	}
+	return Pollin|Pollout;
+}
+
 Dev cognitivedevtab = {
 	'C',
 	"cognitive",
@@ -355,9 +1632,14 @@ Dev cognitivedevtab = {
 	devcreate,
 	cognitiveclose,
 	cognitiveread,
-	devbread,
+	cognitivebread,
 	cognitivewrite,
-	devbwrite,
+	cognitivebwrite,
 	devremove,
 	devwstat,
+	devpower,
+	devconfig,
+	nil,
+	nil,
+	cognitivepoll,
 };
@@ -225,6 +225,215 @@ print(char *fmt, ...)
 	return n;
 }
 
+/*
+ * Deferred printing for messages that can come often, such as
+ * channel and swarm events.  logprint formats into a ring of the
+ * processor it runs on, with interrupts off and no lock, and the
+ * logflush kproc copies the rings to kmesg and the console, so a
+ * slow uart holds up only it.  Each call site may print Logburst
+ * messages a second; the rest are counted, owned up to when the
+ * site next prints, and listed in #c/logsites.
+ */
+enum
+{
+	Nlogbuf		= 8*1024,	/* bytes of a processor's ring */
+	Logburst	= 10,
+	Nlogsite	= 64,
+};
+
+typedef struct Logring Logring;
+struct Logring
+{
+	char	buf[Nlogbuf];
+	ulong	wp;		/* advanced only by its processor */
+	ulong	rp;		/* advanced only by logflush */
+	ulong	lost;		/* bytes with no room */
+};
+
+typedef struct Logsite Logsite;
+struct Logsite
+{
+	uintptr	pc;
+	char	*fmt;
+	ulong	sec;		/* second being counted */
+	ulong	n;		/* messages printed in it */
+	ulong	total;
+	ulong	dropped;
+	ulong	unsaid;		/* dropped since it last printed */
+};
+
+static Logring	logring[MAXMACH];
+static struct
+{
+	Lock;
+	Logsite	site[Nlogsite];
+} logsites;
+static Rendez	logflushr;
+
+static Logsite*
+logsite(uintptr pc, char *fmt)
+{
+	Logsite *ls;
+	int i;
+
+	/* the last one takes any that don't fit */
+	for(i = 0; i < Nlogsite-1; i++){
+		ls = &logsites.site[(pc/4 + i) % (Nlogsite-1)];
+		if(ls->pc == pc)
+			return ls;
+		if(ls->pc == 0){
+			ls->pc = pc;
+			ls->fmt = fmt;
+			return ls;
+		}
+	}
+	return &logsites.site[Nlogsite-1];
+}
+
+static void
+logputs(char *s, int n)
+{
+	Logring *r;
+	ulong w;
+	int x, i, empty;
+
+	x = splhi();
+	r = &logring[m->machno];
+	w = r->wp;
+	empty = w == r->rp;
+	if(n > Nlogbuf - (w - r->rp)){
+		r->lost += n;
+		splx(x);
+		return;
+	}
+	for(i = 0; i < n; i++)
+		r->buf[(w+i) % Nlogbuf] = s[i];
+	coherence();
+	r->wp = w + n;
+	splx(x);
+	if(empty)
+		wakeup(&logflushr);
+}
+
+int
+logprint(char *fmt, ...)
+{
+	char buf[PRINTSIZE], *p, *e;
+	Logsite *ls;
+	ulong now, unsaid;
+	va_list arg;
+
+	if(noprint)
+		return -1;
+
+	now = MACHP(0)->ticks/HZ;
+	ilock(&logsites);
+	ls = logsite(getcallerpc(&fmt), fmt);
+	if(ls->sec != now){
+		ls->sec = now;
+		ls->n = 0;
+	}
+	ls->total++;
+	if(ls->n >= Logburst){
+		ls->dropped++;
+		ls->unsaid++;
+		iunlock(&logsites);
+		return 0;
+	}
+	ls->n++;
+	unsaid = ls->unsaid;
+	ls->unsaid = 0;
+	iunlock(&logsites);
+
+	p = buf;
+	e = buf + sizeof buf;
+	if(unsaid)
+		p = seprint(p, e, "(%lud more like the next) ", unsaid);
+	va_start(arg, fmt);
+	p = vseprint(p, e, fmt, arg);
+	va_end(arg);
+	logputs(buf, p - buf);
+	return p - buf;
+}
+
+static int
+logwaiting(void*)
+{
+	int i;
+
+	for(i = 0; i < conf.nmach; i++)
+		if(logring[i].rp != logring[i].wp)
+			return 1;
+	return 0;
+}
+
+static void
+logflush(void*)
+{
+	char buf[256];
+	Logring *r;
+	ulong n, o;
+	int i;
+
+	for(;;){
+		sleep(&logflushr, logwaiting, nil);
+		for(i = 0; i < conf.nmach; i++){
+			r = &logring[i];
+			while((n = r->wp - r->rp) != 0){
+				o = r->rp % Nlogbuf;
+				if(n > Nlogbuf - o)
+					n = Nlogbuf - o;
+				if(n > sizeof buf)
+					n = sizeof buf;
+				memmove(buf, r->buf+o, n);
+				coherence();
+				r->rp += n;
+				putstrn0(buf, n, 1);
+			}
+		}
+	}
+}
+
+/* the noisiest sites first: pc, total, dropped and format */
+static long
+logsitesread(char *a, long n, vlong off)
+{
+	Logsite s[Nlogsite], t;
+	char *buf, *p, *e, *q;
+	ulong lost;
+	int i, j, ns;
+
+	ilock(&logsites);
+	memmove(s, logsites.site, sizeof s);
+	iunlock(&logsites);
+	ns = 0;
+	for(i = 0; i < Nlogsite; i++)
+		if(s[i].total != 0)
+			s[ns++] = s[i];
+	for(i = 1; i < ns; i++)
+		for(j = i; j > 0 && s[j].dropped > s[j-1].dropped; j--){
+			t = s[j];
+			s[j] = s[j-1];
+			s[j-1] = t;
+		}
+	buf = smalloc(Nlogsite*100 + 64);
+	p = buf;
+	e = buf + Nlogsite*100 + 64;
+	lost = 0;
+	for(i = 0; i < conf.nmach; i++)
+		lost += logring[i].lost;
+	p = seprint(p, e, "lost %lud\n", lost);
+	for(i = 0; i < ns; i++){
+		q = strchr(s[i].fmt, '\n');
+		p = seprint(p, e, "%#p %11lud %11lud %.*s\n", s[i].pc,
+			s[i].total, s[i].dropped,
+			utfnlen(s[i].fmt, q? q-s[i].fmt: 48), s[i].fmt);
+	}
+	n = readstr(off, a, n, buf);
+	free(buf);
+	return n;
+}
+
 /*
  * Want to interlock iprints to avoid interlaced output on 
  * multiprocessor, but don't want to deadlock if one processor
@@ -578,6 +787,8 @@ enum{
 	Qdrivers,
 	Qkmesg,
 	Qkprint,
+	Qlockstat,
+	Qlogsites,
 	Qhostdomain,
 	Qhostowner,
 	Qnull,
@@ -585,8 +796,11 @@ enum{
 	Qpgrpid,
 	Qpid,
 	Qppid,
+	Qqlockstat,
 	Qrandom,
 	Qreboot,
+	Qschedlat,
+	Qschedstat,
 	Qswap,
 	Qsysname,
 	Qsysstat,
@@ -612,13 +826,18 @@ static Dirtab consdir[]={
 	"hostowner",	{Qhostowner},	0,		0664,
 	"kmesg",	{Qkmesg},	0,		0440,
 	"kprint",	{Qkprint, 0, QTEXCL},	0,	DMEXCL|0440,
+	"lockstat",	{Qlockstat},	0,		0664,
+	"logsites",	{Qlogsites},	0,		0444,
 	"null",		{Qnull},	0,		0666,
 	"osversion",	{Qosversion},	0,		0444,
 	"pgrpid",	{Qpgrpid},	NUMSIZE,	0444,
 	"pid",		{Qpid},		NUMSIZE,	0444,
 	"ppid",		{Qppid},	NUMSIZE,	0444,
+	"qlockstat",	{Qqlockstat},	0,		0664,
 	"random",	{Qrandom},	0,		0444,
 	"reboot",	{Qreboot},	0,		0664,
+	"schedlat",	{Qschedlat},	0,		0664,
+	"schedstat",	{Qschedstat},	0,		0444,
 	"swap",		{Qswap},	0,		0664,
 	"sysname",	{Qsysname},	0,		0664,
 	"sysstat",	{Qsysstat},	0,		0666,
@@ -662,6 +881,7 @@ consinit(void)
 {
 	todinit();
 	randominit();
+	kproc("logflush", logflush, nil);
 	/*
 	 * at 115200 baud, the 1024 char buffer takes 56 ms to process,
 	 * processing it every 22 ms should be fine
@@ -819,6 +1039,9 @@ consread(Chan *c, void *buf, long n, vlong off)
 		memmove(buf, tmp+k, n);
 		return n;
 
+	case Qlogsites:
+		return logsitesread(buf, n, offset);
+
 	case Qkmesg:
 		/*
 		 * This is unlocked to avoid tying up a process
@@ -868,6 +1091,54 @@ consread(Chan *c, void *buf, long n, vlong off)
 	case Qconfig:
 		return readstr((ulong)offset, buf, n, configfile);
 
+	case Qlockstat:
+		b = smalloc(16*READSTR);
+		lockstatread(b, 16*READSTR);
+		if(waserror()){
+			free(b);
+			nexterror();
+		}
+		n = readstr((ulong)offset, buf, n, b);
+		free(b);
+		poperror();
+		return n;
+
+	case Qqlockstat:
+		b = smalloc(8*READSTR);
+		qlockstats(b, 8*READSTR);
+		if(waserror()){
+			free(b);
+			nexterror();
+		}
+		n = readstr((ulong)offset, buf, n, b);
+		free(b);
+		poperror();
+		return n;
+
+	case Qschedlat:
+		b = smalloc(4*READSTR);
+		schedlatread(b, 4*READSTR);
+		if(waserror()){
+			free(b);
+			nexterror();
+		}
+		n = readstr((ulong)offset, buf, n, b);
+		free(b);
+		poperror();
+		return n;
+
+	case Qschedstat:
+		b = smalloc(conf.nmach*(NUMSIZE*4+1) + 1);	/* +1 for NUL */
+		schedstat(b, conf.nmach*(NUMSIZE*4+1) + 1);
+		if(waserror()){
+			free(b);
+			nexterror();
+		}
+		n = readstr((ulong)offset, buf, n, b);
+		free(b);
+		poperror();
+		return n;
+
 	case Qsysstat:
 		b = smalloc(conf.nmach*(NUMSIZE*11+1) + 1);	/* +1 for NUL */
 		bp = b;
@@ -1077,6 +1348,18 @@ conswrite(Chan *c, void *va, long n, vlong off)
 		free(cb);
 		break;
 
+	case Qlockstat:
+		lockstatclear();
+		break;
+
+	case Qqlockstat:
+		qlockstatsclear();
+		break;
+
+	case Qschedlat:
+		schedlatclear();
+		break;
+
 	case Qsysstat:
 		for(id = 0; id < 32; id++) {
 			if(active.machs & (1<<id)) {
@@ -1129,6 +1412,32 @@ conswrite(Chan *c, void *va, long n, vlong off)
 	return n;
 }
 
+/*
+ *  cons is readable once keys are waiting; in cooked mode
+ *  the read may still wait for the rest of the line
+ */
+static int
+conspoll(Chan *c, Pollw *w)
+{
+	int r;
+
+	switch((ulong)c->qid.path){
+	case Qcons:
+		r = Pollout;
+		if(w->mask & Pollin){
+			r |= qpoll(lineq, w, Pollin);
+			if(kbdq != nil)
+				r |= qpoll(kbdq, w, Pollin);
+		}
+		return r;
+	case Qkprint:
+		if(kprintoq != nil)
+			return qpoll(kprintoq, w, Pollin) | Pollout;
+		break;
+	}
+	return Pollin|Pollout;
+}
+
 Dev consdevtab = {
 	'c',
 	"cons",
@@ -1148,6 +1457,11 @@ Dev consdevtab = {
 	devbwrite,
 	devremove,
 	devwstat,
+	devpower,
+	devconfig,
+	nil,
+	nil,
+	conspoll,
 };
 
 static	ulong	randn;
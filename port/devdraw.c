@@ -25,6 +25,11 @@ enum
 	Qrefresh,
 };
 
+enum
+{
+	Flushms		= 16,	/* least gap between 'v' flushes, ~60Hz */
+};
+
 /*
  * Qid path is:
  *	 4 bits of file type (qids above)
@@ -163,6 +168,9 @@ static	int	screennameid;
 
 static	Rectangle	flushrect;
 static	int		waste;
+static	ulong		lastflush;	/* ticks at the last 'v' flush */
+static	int		flushpending;	/* a 'v' left to drawflusher */
+static	int		flusherstarted;
 static	DScreen*	dscreen;
 extern	void		flushmemscreen(Rectangle);
 	void		drawmesg(Client*, void*, int);
@@ -438,6 +446,46 @@ drawflush(void)
 	flushrect = Rect(10000, 10000, -10000, -10000);
 }
 
+/*
+ * Clients send 'v' after every few operations, and where
+ * flushmemscreen is a real copy that costs a frame's worth of
+ * work each time.  A 'v' less than Flushms after the last one
+ * is left to drawflusher, which takes the accumulated flushrect
+ * in one go.
+ */
+static void
+drawflusher(void*)
+{
+	for(;;){
+		tsleep(&up->sleep, return0, 0, Flushms);
+		if(!flushpending)
+			continue;
+		dlock();
+		if(flushpending){
+			lastflush = MACHP(0)->ticks;
+			flushpending = 0;
+			drawflush();
+		}
+		dunlock();
+	}
+}
+
+static void
+drawvflush(void)
+{
+	if(TK2MS(MACHP(0)->ticks - lastflush) >= Flushms){
+		lastflush = MACHP(0)->ticks;
+		flushpending = 0;
+		drawflush();
+		return;
+	}
+	flushpending = 1;
+	if(!flusherstarted){
+		flusherstarted = 1;
+		kproc("drawflush", drawflusher, nil);
+	}
+}
+
 static
 int
 drawcmp(char *a, char *b, int n)
@@ -2061,7 +2109,7 @@ drawmesg(Client *client, void *av, int n)
 		case 'v':
 			printmesg(fmt="", a, 0);
 			m = 1;
-			drawflush();
+			drawvflush();
 			continue;
 
 		/* write: 'y' id[4] R[4*4] data[x*1] */
@@ -46,6 +46,9 @@ static	void	protect(Flash*, ulong);
 static	void	eraseflash(Flash*, Flashregion*, ulong);
 static	long	readflash(Flash*, void*, long, int);
 static	long	writeflash(Flash*, long, void*,int);
+static	void	memflash(Flash*, Flashpart*);
+static	long	readmemflash(Flash*, Flashpart*, void*, long, int);
+static	void	dropmemflash(Flash*, ulong, ulong);
 
 static char Eprotect[] = "flash region protected";
 
@@ -219,6 +222,7 @@ flashread(Chan *c, void *buf, long n, vlong offset)
 	Flashpart *fp;
 	Flashregion *r;
 	int i;
+	long m;
 	ulong start, end;
 	char *s, *o;
 
@@ -236,6 +240,8 @@ flashread(Chan *c, void *buf, long n, vlong offset)
 			return 0;
 		if(offset+n > fp->end)
 			n = fp->end - offset;
+		if(fp->mem != nil && (m = readmemflash(f, fp, buf, offset, n)) >= 0)
+			return m;
 		n = readflash(f, buf, offset, n);
 		if(n < 0)
 			error(Eio);
@@ -282,6 +288,7 @@ enum {
 	CMremove,
 	CMsync,
 	CMprotectboot,
+	CMmem,
 };
 
 static Cmdtab flashcmds[] = {
@@ -290,6 +297,7 @@ static Cmdtab flashcmds[] = {
 	{CMremove,	"remove",	2},
 	{CMsync,	"sync",		0},
 	{CMprotectboot,	"protectboot",	0},
+	{CMmem,		"mem",		0},
 };
 
 static long	 
@@ -378,6 +386,15 @@ flashwrite(Chan *c, void *buf, long n, vlong offset)
 		case CMsync:
 			/* TO DO? */
 			break;
+		case CMmem:
+			if(cb->nf > 1 && strcmp(cb->f[1], "off") == 0){
+				qlock(f);
+				free(fp->mem);
+				fp->mem = nil;
+				qunlock(f);
+			}else
+				memflash(f, fp);
+			break;
 		default:
 			error(Ebadarg);
 		}
@@ -554,6 +571,7 @@ writeflash(Flash *f, long offset, void *buf, int n)
 	width = f->width;
 	wmask = width-1;
 	qlock(f);
+	dropmemflash(f, offset, offset+n);
 	archflashwp(f, 0);
 	if(waserror()){
 		archflashwp(f, 1);
@@ -605,6 +623,10 @@ eraseflash(Flash *f, Flashregion *r, ulong addr)
 	if(f->protect && r != nil && r->start == 0 && addr < r->erasesize)
 		error(Eprotect);
 	qlock(f);
+	if(r == nil)
+		dropmemflash(f, 0, f->size);
+	else
+		dropmemflash(f, addr, addr+r->erasesize);
 	archflashwp(f, 0);
 	if(waserror()){
 		archflashwp(f, 1);
@@ -625,6 +647,71 @@ eraseflash(Flash *f, Flashregion *r, ulong addr)
 	qunlock(f);
 }
 
+/*
+ * a partition read often, such as a paq root, can be kept in
+ * memory: reads are then a memmove, not a trip through the
+ * flash, and the copy goes whenever the flash under it changes.
+ */
+static void
+memflash(Flash *f, Flashpart *fp)
+{
+	uchar *p;
+	ulong n;
+
+	if(fp->mem != nil)
+		return;
+	n = fp->end - fp->start;
+	p = malloc(n);
+	if(p == nil)
+		error(Enomem);
+	if(waserror()){
+		free(p);
+		nexterror();
+	}
+	if(readflash(f, p, fp->start, n) != n)
+		error(Eio);
+	poperror();
+	qlock(f);
+	if(fp->mem == nil){
+		fp->mem = p;
+		p = nil;
+	}
+	qunlock(f);
+	free(p);
+}
+
+/* -1 if the copy has gone */
+static long
+readmemflash(Flash *f, Flashpart *fp, void *buf, long offset, int n)
+{
+	qlock(f);
+	if(fp->mem == nil){
+		qunlock(f);
+		return -1;
+	}
+	if(waserror()){
+		qunlock(f);
+		nexterror();
+	}
+	memmove(buf, fp->mem + (offset - fp->start), n);
+	poperror();
+	qunlock(f);
+	return n;
+}
+
+/* drop copies of partitions overlapping [start, end); f is qlocked */
+static void
+dropmemflash(Flash *f, ulong start, ulong end)
+{
+	Flashpart *fp;
+
+	for(fp = f->part; fp < f->part + nelem(f->part); fp++)
+		if(fp->mem != nil && start < fp->end && fp->start < end){
+			free(fp->mem);
+			fp->mem = nil;
+		}
+}
+
 /*
  * flash access taking width and interleave into account
  */
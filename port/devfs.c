@@ -60,17 +60,22 @@ enum
 	Ntrees	= 128,		/* max. number of trees */
 	Maxretries = 3,		/* max. retries of i/o errors */
 	Retrypause = 5000,	/* ms. to pause between retries */
+	Nfsproc	= 8,		/* kprocs doing i/o for split requests */
+	Nsplit	= 16,		/* max. pieces of a request in flight */
 };
 
 typedef struct Inner Inner;
 typedef struct Fsdev Fsdev;
 typedef struct Tree Tree;
+typedef struct Fsreq Fsreq;
+typedef struct Fsbatch Fsbatch;
 
 struct Inner
 {
 	char	*iname;		/* inner device name */
 	vlong	isize;		/* size of inner device */
 	Chan	*idev;		/* inner device */
+	Ref	busy;		/* i/o outstanding on idev */
 };
 
 struct Fsdev
@@ -95,6 +100,31 @@ struct Tree
 	uint	nadevs;		/* number of allocated devices in devs */
 };
 
+/*
+ * One piece of a request, done by an fsproc while the
+ * process that split the request does another piece.
+ */
+struct Fsreq
+{
+	Fsreq	*next;
+	Fsbatch	*b;
+	Fsdev	*mp;
+	Inner	*in;
+	int	isread;
+	void	*a;
+	long	l;
+	vlong	off;
+	long	r;		/* bytes, or -1 and err */
+	char	err[64];
+};
+
+struct Fsbatch
+{
+	Lock;
+	Rendez	r;
+	int	left;		/* pieces not done */
+};
+
 #define dprint if(debug)print
 
 extern Dev fsdevtab;		/* forward */
@@ -111,6 +141,15 @@ static char confstr[Maxconf];	/* textual configuration */
 
 static int debug;
 
+static struct
+{
+	Lock;
+	Rendez	work[Nfsproc];	/* each fsproc waits for a piece */
+	Fsreq	*head;
+	Fsreq	*tail;
+	int	started;
+} fsq;
+
 static char cfgstr[] = "fsdev:\n";
 
 static Qid tqid = {Qtop, 0, QTDIR};
@@ -956,7 +995,9 @@ io(Fsdev *mp, Inner *in, int isread, void *a, long l, vlong off)
 	mc = in->idev;
 	if(mc == nil)
 		error(Egone);
+	incref(&in->busy);
 	if (waserror()) {
+		decref(&in->busy);
 		print("#k: %s: byte %,lld count %ld (of #k/%s): %s error: %s\n",
 			in->iname, off, l, mp->name, (isread? "read": "write"),
 			(up && up->errstr? up->errstr: ""));
@@ -967,20 +1008,154 @@ io(Fsdev *mp, Inner *in, int isread, void *a, long l, vlong off)
 	else
 		wl = devtab[mc->type]->write(mc, a, l, off);
 	poperror();
+	decref(&in->busy);
 	return wl;
 }
 
+static void
+fsreqio(Fsreq *r)
+{
+	if(waserror()){
+		r->r = -1;
+		kstrcpy(r->err, up->errstr, sizeof r->err);
+		return;
+	}
+	r->r = io(r->mp, r->in, r->isread, r->a, r->l, r->off);
+	poperror();
+}
+
+static int
+fswork(void*)
+{
+	return fsq.head != nil;
+}
+
+static void
+fsproc(void *a)
+{
+	int me;
+	Fsreq *r;
+	Fsbatch *b;
+
+	me = (int)a;
+	while(waserror())
+		;
+	for(;;){
+		sleep(&fsq.work[me], fswork, nil);
+		lock(&fsq);
+		r = fsq.head;
+		if(r == nil){
+			unlock(&fsq);
+			continue;
+		}
+		fsq.head = r->next;
+		unlock(&fsq);
+
+		fsreqio(r);
+		b = r->b;
+		lock(b);
+		if(--b->left == 0)
+			wakeup(&b->r);
+		unlock(b);
+	}
+}
+
+static int
+fsdone(void *a)
+{
+	return ((Fsbatch*)a)->left == 0;
+}
+
+/*
+ * Do the n pieces in rq at once: the fsprocs take all
+ * but the first, which the caller does itself.
+ */
+static void
+fsrun(Fsreq *rq, int n)
+{
+	int i;
+	Fsbatch b;
+
+	if(n > 1){
+		lock(&fsq);
+		if(!fsq.started){
+			fsq.started = 1;
+			unlock(&fsq);
+			for(i = 0; i < Nfsproc; i++)
+				kproc("fsio", fsproc, (void*)i);
+			lock(&fsq);
+		}
+		memset(&b, 0, sizeof b);
+		b.left = n-1;
+		for(i = 1; i < n; i++){
+			rq[i].b = &b;
+			rq[i].next = nil;
+			if(fsq.head == nil)
+				fsq.head = &rq[i];
+			else
+				fsq.tail->next = &rq[i];
+			fsq.tail = &rq[i];
+		}
+		unlock(&fsq);
+		for(i = 0; i < Nfsproc; i++)
+			wakeup(&fsq.work[i]);
+	}
+	fsreqio(&rq[0]);
+	if(n > 1){
+		/* the fsprocs use our buffers: wait even if interrupted */
+		while(!fsdone(&b)){
+			if(waserror())
+				continue;
+			sleep(&b.r, fsdone, &b);
+			poperror();
+		}
+		lock(&b);	/* until the last fsproc lets go of b */
+		unlock(&b);
+	}
+}
+
+/* raise the error of the first piece not done in full */
+static void
+fscheck(Fsreq *rq, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++)
+		if(rq[i].r != rq[i].l)
+			error(rq[i].r < 0? rq[i].err: Eio);
+}
+
+static void
+setreq(Fsreq *r, Fsdev *mp, Inner *in, int isread, void *a, long l, vlong off)
+{
+	r->mp = mp;
+	r->in = in;
+	r->isread = isread;
+	r->a = a;
+	r->l = l;
+	r->off = off;
+	r->r = -1;
+	r->err[0] = 0;
+}
+
 /* NB: a transfer could span multiple inner devices */
 static long
 catio(Fsdev *mp, int isread, void *a, long n, vlong off)
 {
-	int	i;
+	int	i, nr;
 	long	l, res;
 	Inner	*in;
+	Fsreq	*rq;
 
 	if(debug)
 		print("catio %d %p %ld %lld\n", isread, a, n, off);
+	rq = smalloc(mp->ndevs * sizeof(Fsreq));
+	if(waserror()){
+		free(rq);
+		nexterror();
+	}
 	res = n;
+	nr = 0;
 	for (i = 0; n > 0 && i < mp->ndevs; i++){
 		in = mp->inner[i];
 		if (off >= in->isize){
@@ -994,51 +1169,81 @@ catio(Fsdev *mp, int isread, void *a, long n, vlong off)
 		if(debug)
 			print("\tdev %d %p %ld %lld\n", i, a, l, off);
 
-		if (io(mp, in, isread, a, l, off) != l)
-			error(Eio);
+		setreq(&rq[nr++], mp, in, isread, a, l, off);
 
 		a = (char*)a + l;
 		off = 0;
 		n -= l;
 	}
+	fsrun(rq, nr);
+	fscheck(rq, nr);
+	poperror();
+	free(rq);
 	if(debug)
 		print("\tres %ld\n", res - n);
 	return res - n;
 }
 
+/*
+ * Blocks on different inner devices go in parallel,
+ * Nsplit at a time.
+ */
 static long
 interio(Fsdev *mp, int isread, void *a, long n, vlong off)
 {
-	int	i;
-	long	boff, res, l, wl, wsz;
+	int	i, nr;
+	long	boff, res, l, wsz;
 	vlong	woff, blk, mblk;
+	Fsreq	*rq;
 
+	rq = smalloc(Nsplit * sizeof(Fsreq));
+	if(waserror()){
+		free(rq);
+		nexterror();
+	}
 	blk  = off / Blksize;
 	boff = off % Blksize;
 	wsz  = Blksize - boff;
 	res = n;
 	while(n > 0){
-		mblk = blk / mp->ndevs;
-		i    = blk % mp->ndevs;
-		woff = mblk*Blksize + boff;
-		if (n > wsz)
-			l = wsz;
-		else
-			l = n;
-
-		wl = io(mp, mp->inner[i], isread, a, l, woff);
-		if (wl != l)
-			error(Eio);
-
-		blk++;
-		boff = 0;
-		wsz = Blksize;
-		a = (char*)a + l;
-		n -= l;
+		for(nr = 0; n > 0 && nr < Nsplit; nr++){
+			mblk = blk / mp->ndevs;
+			i    = blk % mp->ndevs;
+			woff = mblk*Blksize + boff;
+			if (n > wsz)
+				l = wsz;
+			else
+				l = n;
+
+			setreq(&rq[nr], mp, mp->inner[i], isread, a, l, woff);
+
+			blk++;
+			boff = 0;
+			wsz = Blksize;
+			a = (char*)a + l;
+			n -= l;
+		}
+		fsrun(rq, nr);
+		fscheck(rq, nr);
 	}
+	poperror();
+	free(rq);
 	return res;
 }
 
+/* the mirror with the least i/o outstanding */
+static int
+leastbusy(Fsdev *mp)
+{
+	int i, best;
+
+	best = 0;
+	for(i = 1; i < mp->ndevs; i++)
+		if(mp->inner[i]->busy.ref < mp->inner[best]->busy.ref)
+			best = i;
+	return best;
+}
+
 static char*
 seprintconf(char *s, char *e)
 {
@@ -1059,7 +1264,7 @@ seprintconf(char *s, char *e)
 static long
 mread(Chan *c, void *a, long n, vlong off)
 {
-	int	i, retry;
+	int	i, j, first, retry;
 	long	l, res;
 	Fsdev	*mp;
 	Tree	*t;
@@ -1118,7 +1323,9 @@ mread(Chan *c, void *a, long n, vlong off)
 				 */
 				tsleep(&up->sleep, return0, 0, Retrypause);
 			}
-			for (i = 0; i < mp->ndevs; i++){
+			first = leastbusy(mp);
+			for (j = 0; j < mp->ndevs; j++){
+				i = (first + j) % mp->ndevs;
 				if (waserror())
 					continue;
 				l = io(mp, mp->inner[i], Isread, a, n, off);
@@ -1128,7 +1335,7 @@ mread(Chan *c, void *a, long n, vlong off)
 					break;		/* read a good copy */
 				}
 			}
-		} while (i == mp->ndevs && ++retry <= Maxretries);
+		} while (j == mp->ndevs && ++retry <= Maxretries);
 		if (retry > Maxretries) {
 			/* no mirror had a good copy of the block */
 			print("#k/%s: byte %,lld count %ld: CAN'T READ "
@@ -1151,8 +1358,9 @@ static long
 mwrite(Chan *c, void *a, long n, vlong off)
 {
 	int	i, allbad, anybad, retry;
-	long	l, res;
+	long	res;
 	Fsdev	*mp;
+	Fsreq	*rq;
 	Tree	*t;
 
 	dprint("mwrite %llux\n", c->qid.path);
@@ -1196,6 +1404,12 @@ mwrite(Chan *c, void *a, long n, vlong off)
 			error(Eio);
 		break;
 	case Fmirror:
+		/* all mirrors are written at once */
+		rq = smalloc(mp->ndevs * sizeof(Fsreq));
+		if(waserror()){
+			free(rq);
+			nexterror();
+		}
 		retry = 0;
 		do {
 			if (retry > 0) {
@@ -1210,17 +1424,17 @@ mwrite(Chan *c, void *a, long n, vlong off)
 			}
 			allbad = 1;
 			anybad = 0;
-			for (i = mp->ndevs - 1; i >= 0; i--){
-				if (waserror()) {
-					anybad = 1;
-					continue;
-				}
-				l = io(mp, mp->inner[i], Iswrite, a, n, off);
-				poperror();
-				if (l == n)
+			for (i = 0; i < mp->ndevs; i++)
+				setreq(&rq[i], mp, mp->inner[i], Iswrite, a, n, off);
+			fsrun(rq, mp->ndevs);
+			for (i = 0; i < mp->ndevs; i++){
+				if (rq[i].r == n)
 					allbad = 0;	/* wrote a good copy */
-				else
+				else{
 					anybad = 1;
+					if (rq[i].r < 0)
+						kstrcpy(up->errstr, rq[i].err, ERRMAX);
+				}
 			}
 		} while (anybad && ++retry <= Maxretries);
 		if (allbad) {
@@ -1233,7 +1447,8 @@ mwrite(Chan *c, void *a, long n, vlong off)
 			print("#k/%s: byte %,lld count %ld: retry wrote OK "
 				"to mirror: %s\n", mp->name, off, n,
 				(up && up->errstr? up->errstr: ""));
-
+		poperror();
+		free(rq);
 		break;
 	}
 Done:
@@ -9,53 +9,153 @@
 #define	LRES	3		/* log of PC resolution */
 #define	SZ	4		/* sizeof of count cell; well known as 4 */
 
+enum{
+	Narc	= 4096,		/* call graph arcs kept per processor */
+	Nprobe	= 8,		/* slots tried for an arc */
+	Ndepth	= 8,		/* return addresses taken per sample */
+	Nscan	= 256,		/* stack words looked through for them */
+};
+
+typedef struct Kparc Kparc;
+typedef struct Kpmach Kpmach;
+
+/* pc was sampled, or was a return address, in a call from ret */
+struct Kparc
+{
+	ulong	pc;
+	ulong	ret;
+	ulong	n;
+};
+
+/*
+ *  each processor counts into its own histogram and arcs from
+ *  its clock interrupt; reads add them up.
+ */
+struct Kpmach
+{
+	ulong	*buf;
+	Kparc	*arc;
+	ulong	lost;		/* arcs with no slot */
+};
+
 struct
 {
+	QLock;
 	int	minpc;
 	int	maxpc;
 	int	nbuf;
 	int	time;
-	ulong	*buf;
+	int	graph;		/* unwind for call arcs */
+	ulong	pid;		/* only sample this process, if set */
+	Kpmach	mach[MAXMACH];
 }kprof;
 
 enum{
 	Kprofdirqid,
 	Kprofdataqid,
+	Kprofgraphqid,
 	Kprofctlqid,
 };
 Dirtab kproftab[]={
 	".",	{Kprofdirqid, 0, QTDIR},		0,	DMDIR|0550,
 	"kpdata",	{Kprofdataqid},		0,	0600,
+	"kpgraph",	{Kprofgraphqid},	0,	0600,
 	"kpctl",	{Kprofctlqid},		0,	0600,
 };
 
+typedef struct Snap Snap;
+struct Snap
+{
+	long	n;
+	char	data[1];
+};
+
+static void
+kprofarc(Kpmach *k, ulong pc, ulong ret)
+{
+	Kparc *a;
+	ulong h;
+	int i;
+
+	h = pc*0x9E3779B1 ^ ret;
+	for(i = 0; i < Nprobe; i++){
+		a = &k->arc[(h+i) & (Narc-1)];
+		if(a->n == 0){
+			a->pc = pc;
+			a->ret = ret;
+		}else if(a->pc != pc || a->ret != ret)
+			continue;
+		a->n += TK2MS(1);
+		return;
+	}
+	k->lost++;
+}
+
+/*
+ *  the kernel keeps no frame pointers, so look up the interrupted
+ *  stack, as dumpstack does, for words that could be return
+ *  addresses and count an arc into each from the one above it.
+ *  some will be stale, but they are few beside the real ones.
+ */
+static void
+kprofgraph(Kpmach *k, Ureg *ur, ulong pc)
+{
+	ulong *sp, *top, v;
+	int d;
+
+	if(up == nil || userureg(ur))
+		return;
+	sp = (ulong*)(ur+1);
+	top = (ulong*)(up->kstack+KSTACK);
+	if(sp < (ulong*)up->kstack || sp >= top)
+		return;		/* on some other stack */
+	if(top > sp+Nscan)
+		top = sp+Nscan;
+	for(d = 0; d < Ndepth && sp < top; sp++){
+		v = *sp;
+		if(v < kprof.minpc || v >= kprof.maxpc)
+			continue;
+		kprofarc(k, pc, v);
+		pc = v;
+		d++;
+	}
+}
+
 static void
-_kproftimer(ulong pc)
+_kproftimer(Ureg *ur)
 {
 	extern void spldone(void);
+	Kpmach *k;
+	ulong pc;
 
 	if(kprof.time == 0)
 		return;
+	if(kprof.pid != 0 && (up == nil || up->pid != kprof.pid))
+		return;
+	k = &kprof.mach[m->machno];
+	if(k->buf == nil)
+		return;
 	/*
 	 *  if the pc is coming out of spllo or splx,
 	 *  use the pc saved when we went splhi.
 	 */
+	pc = ur->pc;
 	if(pc>=(ulong)spllo && pc<=(ulong)spldone)
 		pc = m->splpc;
 
-	kprof.buf[0] += TK2MS(1);
+	k->buf[0] += TK2MS(1);
 	if(kprof.minpc<=pc && pc<kprof.maxpc){
-		pc -= kprof.minpc;
-		pc >>= LRES;
-		kprof.buf[pc] += TK2MS(1);
+		k->buf[(pc-kprof.minpc) >> LRES] += TK2MS(1);
+		if(kprof.graph)
+			kprofgraph(k, ur, pc);
 	}else
-		kprof.buf[1] += TK2MS(1);
+		k->buf[1] += TK2MS(1);
 }
 
 static void
 kprofinit(void)
 {
-	if(SZ != sizeof kprof.buf[0])
+	if(SZ != sizeof kprof.mach[0].buf[0])
 		panic("kprof size");
 	kproftimer = _kproftimer;
 }
@@ -64,17 +164,27 @@ static Chan*
 kprofattach(char *spec)
 {
 	ulong n;
+	Kpmach *k;
+	int i;
 
 	/* allocate when first used */
 	kprof.minpc = KTZERO;
 	kprof.maxpc = (ulong)etext;
 	kprof.nbuf = (kprof.maxpc-kprof.minpc) >> LRES;
 	n = kprof.nbuf*SZ;
-	if(kprof.buf == 0) {
-		kprof.buf = xalloc(n);
-		if(kprof.buf == 0)
+	qlock(&kprof);
+	for(i = 0; i < conf.nmach; i++){
+		k = &kprof.mach[i];
+		if(k->arc == nil)
+			k->arc = xalloc(Narc*sizeof(Kparc));
+		if(k->buf == nil)
+			k->buf = xalloc(n);
+		if(k->buf == nil || k->arc == nil){
+			qunlock(&kprof);
 			error(Enomem);
+		}
 	}
+	qunlock(&kprof);
 	kproftab[1].length = n;
 	return devattach('K', spec);
 }
@@ -105,22 +215,92 @@ kprofopen(Chan *c, int omode)
 }
 
 static void
-kprofclose(Chan*)
+kprofclose(Chan *c)
 {
+	free(c->aux);
+	c->aux = nil;
+}
+
+/*
+ *  the arcs of all processors, added up: a line for each,
+ *  pc, caller's return address and milliseconds
+ */
+static Snap*
+kprofgraphsnap(void)
+{
+	Kparc *t, *a, *b;
+	Snap *s;
+	char *p, *e;
+	ulong h, nt;
+	int i, j;
+
+	nt = 2*Narc;
+	while(nt < 2*Narc*conf.nmach)
+		nt *= 2;
+	t = malloc(nt*sizeof(Kparc));
+	s = malloc(sizeof(Snap) + nt*30);
+	if(t == nil || s == nil){
+		free(t);
+		free(s);
+		error(Enomem);
+	}
+	for(i = 0; i < conf.nmach; i++)
+		for(j = 0, a = kprof.mach[i].arc; j < Narc; j++, a++){
+			if(a->n == 0)
+				continue;
+			for(h = a->pc*0x9E3779B1 ^ a->ret;; h++){
+				b = &t[h & (nt-1)];
+				if(b->n == 0 || b->pc == a->pc && b->ret == a->ret)
+					break;
+			}
+			b->pc = a->pc;
+			b->ret = a->ret;
+			b->n += a->n;
+		}
+	p = s->data;
+	e = p + nt*30;
+	for(b = t; b < t+nt; b++)
+		if(b->n != 0)
+			p = seprint(p, e, "%.8lux %.8lux %lud\n", b->pc, b->ret, b->n);
+	*p = 0;
+	s->n = p - s->data;
+	free(t);
+	return s;
 }
 
 static long
 kprofread(Chan *c, void *va, long n, vlong off)
 {
-	ulong end;
-	ulong w, *bp;
+	ulong end, lost;
+	ulong w, j;
 	uchar *a, *ea;
 	ulong offset = off;
+	char buf[128];
+	Snap *s;
+	int i;
 
 	switch((int)c->qid.path){
 	case Kprofdirqid:
 		return devdirread(c, va, n, kproftab, nelem(kproftab), devgen);
 
+	case Kprofgraphqid:
+		if(offset == 0 || c->aux == nil){
+			s = kprofgraphsnap();
+			free(c->aux);
+			c->aux = s;
+		}
+		s = c->aux;
+		return readstr(offset, va, n, s->data);
+
+	case Kprofctlqid:
+		lost = 0;
+		for(i = 0; i < conf.nmach; i++)
+			lost += kprof.mach[i].lost;
+		snprint(buf, sizeof buf, "%s pid %lud graph %s lost %lud\n",
+			kprof.time? "start": "stop", kprof.pid,
+			kprof.graph? "on": "off", lost);
+		return readstr(offset, va, n, buf);
+
 	case Kprofdataqid:
 		end = kprof.nbuf*SZ;
 		if(offset & (SZ-1))
@@ -134,9 +314,12 @@ kprofread(Chan *c, void *va, long n, vlong off)
 		n &= ~(SZ-1);
 		a = va;
 		ea = a + n;
-		bp = kprof.buf + offset/SZ;
+		j = offset/SZ;
 		while(a < ea){
-			w = *bp++;
+			w = 0;
+			for(i = 0; i < conf.nmach; i++)
+				w += kprof.mach[i].buf[j];
+			j++;
 			*a++ = w>>24;
 			*a++ = w>>16;
 			*a++ = w>>8;
@@ -151,18 +334,46 @@ kprofread(Chan *c, void *va, long n, vlong off)
 	return n;
 }
 
+static void
+kprofclear(void)
+{
+	Kpmach *k;
+	int i;
+
+	for(i = 0; i < conf.nmach; i++){
+		k = &kprof.mach[i];
+		memset(k->buf, 0, kprof.nbuf*SZ);
+		memset(k->arc, 0, Narc*sizeof(Kparc));
+		k->lost = 0;
+	}
+}
+
 static long
 kprofwrite(Chan *c, void *a, long n, vlong)
 {
+	char buf[32];
+
 	switch((int)(c->qid.path)){
 	case Kprofctlqid:
-		if(strncmp(a, "startclr", 8) == 0){
-			memset((char *)kprof.buf, 0, kprof.nbuf*SZ);
+		if(n >= sizeof buf)
+			error(Ebadarg);
+		memmove(buf, a, n);
+		buf[n] = 0;
+		if(strncmp(buf, "startclr", 8) == 0){
+			kprofclear();
 			kprof.time = 1;
-		}else if(strncmp(a, "start", 5) == 0)
+		}else if(strncmp(buf, "start", 5) == 0)
 			kprof.time = 1;
-		else if(strncmp(a, "stop", 4) == 0)
+		else if(strncmp(buf, "stop", 4) == 0)
 			kprof.time = 0;
+		else if(strncmp(buf, "pid", 3) == 0)
+			kprof.pid = strtoul(buf+3, 0, 0);	/* 0 for all */
+		else if(strncmp(buf, "graph on", 8) == 0)
+			kprof.graph = 1;
+		else if(strncmp(buf, "graph off", 9) == 0)
+			kprof.graph = 0;
+		else
+			error(Ebadctl);
 		break;
 	default:
 		error(Ebadusefd);
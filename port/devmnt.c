@@ -29,6 +29,7 @@ struct Mntrpc
 	uchar*	rpc;		/* I/O Data buffer */
 	uint	rpclen;		/* len of buffer */
 	Block	*b;		/* reply blocks */
+	Block	*wb;		/* Twrite data already in a Block */
 	char	done;		/* Rpc completed */
 	uvlong	stime;		/* start time for mnt statistics */
 	ulong	reqlen;		/* request length for mnt statistics */
@@ -38,6 +39,9 @@ struct Mntrpc
 
 enum
 {
+	Mntwindow = 4,			/* default Mnt.window */
+	Maxwindow = 16,
+
 	TAGSHIFT = 5,			/* ulong has to be 32 bits */
 	TAGMASK = (1<<TAGSHIFT)-1,
 	NMASK = (64*1024)>>TAGSHIFT,
@@ -64,9 +68,11 @@ void	mntgate(Mnt*);
 void	mntpntfree(Mnt*);
 void	mntqrm(Mnt*, Mntrpc*);
 Mntrpc*	mntralloc(Chan*, ulong);
-long	mntrdwr(int, Chan*, void*, long, vlong);
 int	mntrpcread(Mnt*, Mntrpc*);
 void	mountio(Mnt*, Mntrpc*);
+static void	mntio(Mnt*, Mntrpc*, int);
+static void	mntxmit(Mnt*, Mntrpc*);
+static Block*	mntwblock(Mntrpc*);
 void	mountmux(Mnt*, Mntrpc*);
 void	mountrpc(Mnt*, Mntrpc*);
 int	rpcattn(void*);
@@ -219,6 +225,7 @@ mntversion(Chan *c, char *version, int msize, int returnlen)
 	m->id = mntalloc.id++;
 	m->q = qopen(10*MAXRPC, 0, nil, nil);
 	m->msize = f.msize;
+	m->window = Mntwindow;
 	unlock(&mntalloc);
 
 	if(returnlen > 0){
@@ -647,6 +654,7 @@ mntread(Chan *c, void *buf, long n, vlong off)
 
 	p = buf;
 	if(cache) {
+		creadahead(c, off, n);
 		nc = cread(c, buf, n, off);
 		if(nc > 0) {
 			n -= nc;
@@ -681,6 +689,240 @@ mntwrite(Chan *c, void *buf, long n, vlong off)
 	return mntrdwr(Twrite, c, buf, n, off);
 }
 
+/*
+ *  Hand the reply's data Blocks to the reader, without copying,
+ *  for reads that fit one message.
+ */
+static Block*
+mntbread(Chan *c, long n, ulong off)
+{
+	Mnt *m;
+	Mntrpc *r;
+	Block *b;
+
+	m = mntchk(c);
+	if((c->flag & CCACHE) || (c->qid.type & QTDIR) || n > m->msize-IOHDRSZ)
+		return devbread(c, n, off);
+	r = mntralloc(c, m->msize);
+	if(waserror()){
+		mntfree(r);
+		nexterror();
+	}
+	r->request.type = Tread;
+	r->request.fid = c->fid;
+	r->request.offset = off;
+	r->request.count = n;
+	mountrpc(m, r);
+	b = r->b;
+	r->b = nil;
+	poperror();
+	mntfree(r);
+	if(b == nil)
+		return allocb(0);
+	if(b->next != nil)
+		b = concatblock(b);
+	return b;
+}
+
+/*
+ *  Send the writer's Block as the Twrite's data, with the header
+ *  put in front of it, for writes that fit one message.
+ */
+static long
+mntbwrite(Chan *c, Block *bp, ulong off)
+{
+	Mnt *m;
+	Mntrpc *r;
+	long n;
+
+	m = mntchk(c);
+	if(bp->next != nil)
+		bp = concatblock(bp);
+	n = BLEN(bp);
+	if((c->flag & CCACHE) || n > m->msize-IOHDRSZ)
+		return devbwrite(c, bp, off);
+	r = mntralloc(c, m->msize);
+	r->wb = bp;
+	if(waserror()){
+		mntfree(r);
+		nexterror();
+	}
+	r->request.type = Twrite;
+	r->request.fid = c->fid;
+	r->request.offset = off;
+	r->request.data = nil;		/* mntwblock sends r->wb */
+	r->request.count = n;
+	mountrpc(m, r);
+	n = r->reply.count;
+	if(n > r->request.count)
+		n = r->request.count;
+	poperror();
+	mntfree(r);
+	return n;
+}
+
+/*
+ *  gather the segments into messages of up to the server's
+ *  i/o unit, so many small segments cost one rpc.  cached
+ *  files go through mntread and mntwrite to keep the cache.
+ */
+static long
+mntrdwrv(int type, Chan *c, Iovec *io, int nio, vlong off)
+{
+	Mnt *m;
+	uchar *buf;
+	long n, nr, got, chunk, tot;
+
+	m = mntchk(c);
+	n = iovlen(io, nio);
+	chunk = m->msize-IOHDRSZ;
+	if(chunk > n)
+		chunk = n;
+	if(chunk == 0)
+		return mntrdwr(type, c, nil, 0, off);
+	buf = smalloc(chunk);
+	if(waserror()){
+		free(buf);
+		nexterror();
+	}
+	for(tot = 0; tot < n; tot += got){
+		nr = n - tot;
+		if(nr > chunk)
+			nr = chunk;
+		if(type == Twrite)
+			iovgather(io, nio, tot, buf, nr);
+		got = mntrdwr(type, c, buf, nr, off+tot);
+		if(type == Tread)
+			iovscatter(io, nio, tot, buf, got);
+		if(got < nr || up->nnote){
+			tot += got;
+			break;
+		}
+	}
+	poperror();
+	free(buf);
+	return tot;
+}
+
+static long
+mntreadv(Chan *c, Iovec *io, int nio, vlong off)
+{
+	if(c->flag & CCACHE)
+		return devreadv(c, io, nio, off);
+	return mntrdwrv(Tread, c, io, nio, off);
+}
+
+static long
+mntwritev(Chan *c, Iovec *io, int nio, vlong off)
+{
+	if(c->flag & CCACHE)
+		return devwritev(c, io, nio, off);
+	return mntrdwrv(Twrite, c, io, nio, off);
+}
+
+/*
+ * Check a reply as mountrpc does, for an rpc already sent.
+ */
+static void
+mntwaitrpc(Mnt *m, Mntrpc *r)
+{
+	mntio(m, r, 0);
+	if(r->reply.type == Rerror)
+		error(r->reply.ename);
+	if(r->reply.type == Rflush)
+		error(Eintr);
+	if(r->reply.type != r->request.type+1)
+		error(Emountrpc);
+}
+
+/*
+ * Finish with an rpc of a pipelined transfer whose answer is no
+ * longer wanted.  Its tag must not be reused until the server is
+ * done with it, so either wait for the reply or flush it.
+ */
+static void
+mntcancel(Mnt *m, Mntrpc *r, int flush)
+{
+	if(!r->done && !waserror()){
+		if(flush)
+			mntio(m, mntflushalloc(r, m->msize), 1);
+		else
+			mntio(m, r, 0);
+		poperror();
+	}
+	mntfree(r);
+}
+
+/*
+ * A transfer of several i/o units keeps up to m->window of
+ * them on the wire, so it runs at the link's bandwidth rather
+ * than one msize per round trip.  The replies are taken in
+ * order; the first short one ends the transfer, and requests
+ * beyond it are waited out and their data dropped.
+ */
+static long
+mntpipe(int type, Chan *c, Mnt *m, uchar *buf, long n, vlong off)
+{
+	Mntrpc *w[Maxwindow], *r;
+	int nw, win, cache;
+	ulong iounit, nr, nreq;
+	long cnt, sent, o;
+
+	cache = c->flag & CCACHE;
+	iounit = m->msize-IOHDRSZ;
+	win = m->window;
+	if(win > Maxwindow)
+		win = Maxwindow;
+	nw = 0;
+	sent = 0;
+	cnt = 0;
+	if(waserror()){
+		while(nw > 0)
+			mntcancel(m, w[--nw], 1);
+		nexterror();
+	}
+	while(sent < n || nw > 0){
+		while(nw < win && sent < n){
+			r = mntralloc(c, m->msize);
+			w[nw++] = r;
+			r->request.type = type;
+			r->request.fid = c->fid;
+			r->request.offset = off+sent;
+			r->request.data = (char*)buf+sent;
+			nr = n-sent;
+			if(nr > iounit)
+				nr = iounit;
+			r->request.count = nr;
+			r->reply.tag = 0;
+			r->reply.type = Tmax;
+			sent += nr;
+			mntxmit(m, r);
+		}
+		r = w[0];
+		mntwaitrpc(m, r);
+		o = r->request.offset - off;
+		nreq = r->request.count;
+		nr = r->reply.count;
+		if(nr > nreq)
+			nr = nreq;
+		if(type == Tread)
+			r->b = bl2mem(buf+o, r->b, nr);
+		else if(cache)
+			cwrite(c, buf+o, nr, off+o);
+		cnt += nr;
+		nw--;
+		memmove(w, w+1, nw*sizeof w[0]);
+		mntfree(r);
+		if(nr != nreq || up->nnote){
+			while(nw > 0)
+				mntcancel(m, w[--nw], up->nnote != 0);
+			break;
+		}
+	}
+	poperror();
+	return cnt;
+}
+
 long
 mntrdwr(int type, Chan *c, void *buf, long n, vlong off)
 {
@@ -691,6 +933,16 @@ mntrdwr(int type, Chan *c, void *buf, long n, vlong off)
 	ulong cnt, nr, nreq;
 
 	m = mntchk(c);
+	/*
+	 * Pipelining sends reads and writes ahead of the replies, which
+	 * is only safe where the offset says what is read or written.
+	 * Directories must be read in sequence, and synthetic files,
+	 * which keep their version at zero, may be streams.
+	 */
+	if(m->window > 1 && n > m->msize-IOHDRSZ
+	&& (c->qid.type & QTDIR) == 0 && c->qid.vers != 0)
+		return mntpipe(type, c, m, buf, n, off);
+
 	uba = buf;
 	cnt = 0;
 	cache = c->flag & CCACHE;
@@ -770,17 +1022,59 @@ mountrpc(Mnt *m, Mntrpc *r)
 void
 mountio(Mnt *m, Mntrpc *r)
 {
-	int n;
+	mntio(m, r, 1);
+}
 
-	while(waserror()) {
-		if(m->rip == up)
-			mntgate(m);
-		if(strcmp(up->errstr, Eintr) != 0){
-			mntflushfree(m, r);
+/*
+ * Marshal a Twrite into one Block: the header goes in front of
+ * r->wb's data when the caller's Block has the room, else the data
+ * is copied once, from the caller's buffer into the Block that is
+ * handed to bwrite, rather than through the rpc buffer.
+ */
+static Block*
+mntwblock(Mntrpc *r)
+{
+	Block *b;
+	uchar *p;
+	int hlen;
+
+	hlen = BIT32SZ+BIT8SZ+BIT16SZ+BIT32SZ+BIT64SZ+BIT32SZ;
+	if(r->wb != nil){
+		b = r->wb;
+		r->wb = nil;
+		b = padblock(b, hlen);
+	}else{
+		b = allocb(hlen+r->request.count);
+		if(waserror()){
+			freeb(b);
 			nexterror();
 		}
-		r = mntflushalloc(r, m->msize);
+		memmove(b->wp+hlen, r->request.data, r->request.count);
+		poperror();
+		b->wp += hlen+r->request.count;
 	}
+	p = b->rp;
+	PBIT32(p, hlen+r->request.count);
+	p += BIT32SZ;
+	*p++ = Twrite;
+	PBIT16(p, r->request.tag);
+	p += BIT16SZ;
+	PBIT32(p, r->request.fid);
+	p += BIT32SZ;
+	PBIT64(p, r->request.offset);
+	p += BIT64SZ;
+	PBIT32(p, r->request.count);
+	return b;
+}
+
+/*
+ * Queue and transmit a file system rpc
+ */
+static void
+mntxmit(Mnt *m, Mntrpc *r)
+{
+	int n;
+	Block *b;
 
 	lock(m);
 	r->m = m;
@@ -788,16 +1082,52 @@ mountio(Mnt *m, Mntrpc *r)
 	m->queue = r;
 	unlock(m);
 
-	/* Transmit a file system rpc */
 	if(m->msize == 0)
 		panic("msize");
-	n = convS2M(&r->request, r->rpc, m->msize);
-	if(n < 0)
-		panic("bad message type in mountio");
-	if(devtab[m->c->type]->write(m->c, r->rpc, n, 0) != n)
-		error(Emountrpc);
+	if(r->request.type == Twrite){
+		b = mntwblock(r);
+		n = BLEN(b);
+		if(devtab[m->c->type]->bwrite(m->c, b, 0) != n)
+			error(Emountrpc);
+	}else{
+		n = sizeS2M(&r->request);
+		if(n > r->rpclen){
+			free(r->rpc);
+			r->rpclen = 0;
+			if((r->rpc = mallocz(n, 0)) == nil)
+				error(Enomem);
+			r->rpclen = n;
+		}
+		n = convS2M(&r->request, r->rpc, r->rpclen);
+		if(n < 0)
+			panic("bad message type in mountio");
+		if(devtab[m->c->type]->write(m->c, r->rpc, n, 0) != n)
+			error(Emountrpc);
+	}
 	r->stime = fastticks(nil);
 	r->reqlen = n;
+}
+
+/*
+ * Send r unless mntxmit already has, and wait for its reply,
+ * flushing it if interrupted.
+ */
+static void
+mntio(Mnt *m, Mntrpc *r, int send)
+{
+	while(waserror()) {
+		if(m->rip == up)
+			mntgate(m);
+		if(strcmp(up->errstr, Eintr) != 0){
+			mntflushfree(m, r);
+			nexterror();
+		}
+		r = mntflushalloc(r, m->msize);
+		send = 1;
+	}
+
+	if(send)
+		mntxmit(m, r);
 
 	/* Gate readers onto the mount point one at a time */
 	for(;;) {
@@ -1041,6 +1371,13 @@ mntralloc(Chan *c, ulong msize)
 {
 	Mntrpc *new;
 
+	/*
+	 * Only requests other than Twrite are marshalled into the
+	 * buffer, and mntxmit grows it for the rare large one, so
+	 * a large msize need not cost its size in every rpc.
+	 */
+	if(msize > MAXRPC)
+		msize = MAXRPC;
 	lock(&mntalloc);
 	new = mntalloc.rpcfree;
 	if(new == nil){
@@ -1083,6 +1420,7 @@ mntralloc(Chan *c, ulong msize)
 	new->done = 0;
 	new->flushed = nil;
 	new->b = nil;
+	new->wb = nil;
 	return new;
 }
 
@@ -1091,6 +1429,8 @@ mntfree(Mntrpc *r)
 {
 	if(r->b != nil)
 		freeblist(r->b);
+	if(r->wb != nil)
+		freeblist(r->wb);
 	lock(&mntalloc);
 	if(mntalloc.nrpcfree >= 10){
 		free(r->rpc);
@@ -1189,9 +1529,13 @@ Dev mntdevtab = {
 	mntcreate,
 	mntclose,
 	mntread,
-	devbread,
+	mntbread,
 	mntwrite,
-	devbwrite,
+	mntbwrite,
 	mntremove,
 	mntwstat,
+	devpower,
+	devconfig,
+	mntreadv,
+	mntwritev,
 };
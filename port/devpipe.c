@@ -7,7 +7,30 @@
 
 #include	"netif.h"
 
+typedef struct Loan	Loan;
 typedef struct Pipe	Pipe;
+
+/*
+ *  A reader with a big buffer and nothing queued for it lends
+ *  the buffer: the next writer copies straight into the reader's
+ *  memory with procctlmemio, once instead of twice through a Block.
+ *  The loan is only made with no writer inside qwrite, so data
+ *  from one writer cannot overtake its own earlier writes.
+ */
+struct Loan
+{
+	Lock	lk;
+	QLock	copy;		/* held by the writer filling it */
+	Rendez	r;
+	Queue	*q;		/* the reader's queue */
+	Proc	*p;		/* reader lending, nil if none */
+	ulong	va;
+	long	n;
+	long	got;		/* bytes copied in */
+	int	done;
+	int	qwriters;	/* writers in qwrite */
+};
+
 struct Pipe
 {
 	QLock;
@@ -17,6 +40,7 @@ struct Pipe
 	long	perm;
 	Queue	*q[2];
 	int	qref[2];
+	Loan	loan[2];	/* for readers of q[0] and q[1] */
 };
 
 struct
@@ -32,6 +56,11 @@ enum
 	Qdata1,
 };
 
+enum
+{
+	Loanmin	= 16*1024,	/* smallest read that lends its buffer */
+};
+
 Dirtab pipedir[] =
 {
 	".",		{Qdir,0,QTDIR},	0,		DMDIR|0500,
@@ -261,6 +290,8 @@ pipeclose(Chan *c)
 			if(p->qref[0] == 0){
 				qhangup(p->q[1], 0);
 				qclose(p->q[0]);
+				wakeup(&p->loan[0].r);
+				wakeup(&p->loan[1].r);
 			}
 			break;
 		case Qdata1:
@@ -268,6 +299,8 @@ pipeclose(Chan *c)
 			if(p->qref[1] == 0){
 				qhangup(p->q[0], 0);
 				qclose(p->q[1]);
+				wakeup(&p->loan[0].r);
+				wakeup(&p->loan[1].r);
 			}
 			break;
 		}
@@ -295,6 +328,183 @@ pipeclose(Chan *c)
 		qunlock(p);
 }
 
+static int
+loanover(void *a)
+{
+	Loan *l;
+
+	l = a;
+	return l->done || l->qwriters > 0 || qcanread(l->q) || qisclosed(l->q);
+}
+
+/*
+ *  take a loan back, waiting for a writer in the middle of copying
+ */
+static long
+loanback(Loan *l)
+{
+	long got;
+
+	qlock(&l->copy);
+	lock(&l->lk);
+	got = l->got;
+	l->p = nil;
+	l->done = 0;
+	unlock(&l->lk);
+	qunlock(&l->copy);
+	return got;
+}
+
+/*
+ *  read from q[i], lending va to the writers if it is worth it
+ */
+static long
+loanread(Pipe *p, int i, void *va, long n)
+{
+	Loan *l;
+	Queue *q;
+	Segment *s;
+	long got;
+
+	l = &p->loan[i];
+	q = p->q[i];
+	if(n < Loanmin || up == nil)
+		return qread(q, va, n);
+	s = seg(up, (ulong)va, 0);
+	if(s == nil || (s->type&SG_TYPE) == SG_TEXT)
+		return qread(q, va, n);
+	lock(&l->lk);
+	if(l->p != nil || l->qwriters > 0 || qcanread(q) || qisclosed(q)){
+		unlock(&l->lk);
+		return qread(q, va, n);
+	}
+	l->q = q;
+	l->p = up;
+	l->va = (ulong)va;
+	l->n = n;
+	l->got = 0;
+	l->done = 0;
+	unlock(&l->lk);
+
+	if(waserror()){
+		got = loanback(l);
+		if(got > 0)
+			return got;
+		nexterror();
+	}
+	sleep(&l->r, loanover, l);
+	poperror();
+
+	got = loanback(l);
+	if(got > 0)
+		return got;
+	return qread(q, va, n);
+}
+
+/*
+ *  copy what fits into a reader's loan; 0 if there is none
+ */
+static long
+loanwrite(Pipe *p, int i, void *va, long n)
+{
+	Loan *l;
+	long got, m;
+
+	l = &p->loan[i];
+	if(l->p == nil)
+		return 0;
+	qlock(&l->copy);
+	lock(&l->lk);
+	if(l->p == nil || l->done || l->qwriters > 0
+	|| qcanread(p->q[i]) || qisclosed(p->q[i])){
+		unlock(&l->lk);
+		qunlock(&l->copy);
+		return 0;
+	}
+	unlock(&l->lk);
+
+	got = 0;
+	if(waserror()){
+		lock(&l->lk);
+		l->got = got;
+		l->done = 1;
+		unlock(&l->lk);
+		qunlock(&l->copy);
+		wakeup(&l->r);
+		nexterror();
+	}
+	while(got < n && got < l->n){
+		m = l->n - got;
+		if(m > n - got)
+			m = n - got;
+		got += procctlmemio(l->p, l->va+got, m, (char*)va+got, 0);
+	}
+	poperror();
+
+	lock(&l->lk);
+	l->got = got;
+	l->done = 1;
+	unlock(&l->lk);
+	qunlock(&l->copy);
+	wakeup(&l->r);
+	return got;
+}
+
+/*
+ *  a reader waiting on a loan goes back to qread
+ *  whenever someone writes the queue instead
+ */
+static void
+qwriter(Loan *l, int d)
+{
+	lock(&l->lk);
+	l->qwriters += d;
+	unlock(&l->lk);
+	wakeup(&l->r);
+}
+
+/*
+ *  write to q[i], into a waiting reader's buffer first
+ */
+static long
+pipeput(Pipe *p, int i, void *va, long n)
+{
+	Loan *l;
+	long got;
+
+	l = &p->loan[i];
+	got = loanwrite(p, i, va, n);
+	if(got == n)
+		return n;
+	qwriter(l, 1);
+	if(waserror()){
+		qwriter(l, -1);
+		nexterror();
+	}
+	qwrite(p->q[i], (char*)va+got, n-got);
+	poperror();
+	qwriter(l, -1);
+	return n;
+}
+
+static long
+pipebput(Pipe *p, int i, Block *bp)
+{
+	Loan *l;
+	long n;
+
+	l = &p->loan[i];
+	qwriter(l, 1);
+	if(waserror()){
+		qwriter(l, -1);
+		nexterror();
+	}
+	n = qbwrite(p->q[i], bp);
+	poperror();
+	qwriter(l, -1);
+	return n;
+}
+
 static long
 piperead(Chan *c, void *va, long n, vlong)
 {
@@ -306,9 +516,9 @@ piperead(Chan *c, void *va, long n, vlong)
 	case Qdir:
 		return devdirread(c, va, n, pipedir, NPIPEDIR, pipegen);
 	case Qdata0:
-		return qread(p->q[0], va, n);
+		return loanread(p, 0, va, n);
 	case Qdata1:
-		return qread(p->q[1], va, n);
+		return loanread(p, 1, va, n);
 	default:
 		panic("piperead");
 	}
@@ -354,11 +564,11 @@ pipewrite(Chan *c, void *va, long n, vlong)
 
 	switch(NETTYPE(c->qid.path)){
 	case Qdata0:
-		n = qwrite(p->q[1], va, n);
+		n = pipeput(p, 1, va, n);
 		break;
 
 	case Qdata1:
-		n = qwrite(p->q[0], va, n);
+		n = pipeput(p, 0, va, n);
 		break;
 
 	default:
@@ -385,11 +595,11 @@ pipebwrite(Chan *c, Block *bp, ulong)
 	p = c->aux;
 	switch(NETTYPE(c->qid.path)){
 	case Qdata0:
-		n = qbwrite(p->q[1], bp);
+		n = pipebput(p, 1, bp);
 		break;
 
 	case Qdata1:
-		n = qbwrite(p->q[0], bp);
+		n = pipebput(p, 0, bp);
 		break;
 
 	default:
@@ -401,6 +611,31 @@ pipebwrite(Chan *c, Block *bp, ulong)
 	return n;
 }
 
+static int
+pipepoll(Chan *c, Pollw *w)
+{
+	Pipe *p;
+	int r, i;
+
+	p = c->aux;
+	switch(NETTYPE(c->qid.path)){
+	case Qdata0:
+		i = 0;
+		break;
+	case Qdata1:
+		i = 1;
+		break;
+	default:
+		return Pollin|Pollout;
+	}
+	r = 0;
+	if(w->mask & Pollin)
+		r |= qpoll(p->q[i], w, Pollin);
+	if(w->mask & Pollout)
+		r |= qpoll(p->q[i^1], w, Pollout);
+	return r;
+}
+
 Dev pipedevtab = {
 	'|',
 	"pipe",
@@ -420,4 +655,9 @@ Dev pipedevtab = {
 	pipebwrite,
 	devremove,
 	pipewstat,
+	devpower,
+	devconfig,
+	nil,
+	nil,
+	pipepoll,
 };
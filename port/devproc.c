@@ -31,6 +31,8 @@ enum
 	Qwait,
 	Qprofile,
 	Qsyscall,
+	Qstats,
+	Qbinstats,
 };
 
 enum
@@ -70,6 +72,37 @@ enum{
 };
 
 #define	STATSIZE	(2*KNAMELEN+12+9*12)
+
+/*
+ * stats has a line of name and value for each of Pstats' counters;
+ * binstats has the values as 8-byte little-endian integers.
+ */
+enum
+{
+	Nstats		= Nsysclass + 2*Nioclass + 3,
+	STATLINE	= 32,
+};
+
+static char *statsname[Nstats] = {
+	"sysother",
+	"sysio",
+	"sysfile",
+	"sysns",
+	"sysproc",
+	"sysmem",
+	"syssync",
+	"rother",
+	"rfile",
+	"rnet",
+	"rcog",
+	"wother",
+	"wfile",
+	"wnet",
+	"wcog",
+	"faults",
+	"vcsw",
+	"icsw",
+};
 /*
  * Status, fd, and ns are left fully readable (0444) because of their use in debugging,
  * particularly on shared servers.
@@ -95,6 +128,8 @@ Dirtab procdir[] =
 	"wait",		{Qwait},	0,			0400,
 	"profile",	{Qprofile},	0,			0400,
 	"syscall",	{Qsyscall},	0,			0400,	
+	"stats",	{Qstats},	Nstats*STATLINE,	0444,
+	"binstats",	{Qbinstats},	Nstats*8,		0444,
 };
 
 static
@@ -146,7 +181,6 @@ static char *sname[]={ "Text", "Data", "Bss", "Stack", "Shared", "Phys", };
 #define	NOTEID(q)	((q).vers)
 
 void	procctlreq(Proc*, char*, int);
-int	procctlmemio(Proc*, ulong, int, void*, int);
 Chan*	proctext(Chan*, Proc*);
 Segment* txt2data(Proc*, Segment*);
 int	procstopped(void*);
@@ -418,6 +452,8 @@ procopen(Chan *c, int omode)
 	case Qregs:
 	case Qfpregs:
 	case Qsyscall:	
+	case Qstats:
+	case Qbinstats:
 		nonone(p);
 		break;
 
@@ -670,6 +706,24 @@ eventsavailable(void *)
 	return tproduced > tconsumed;
 }
 
+static void
+procstats(Proc *p, uvlong *v)
+{
+	Pstats *s;
+	int i;
+
+	s = &p->stats;
+	for(i = 0; i < Nsysclass; i++)
+		*v++ = s->nsys[i];
+	for(i = 0; i < Nioclass; i++)
+		*v++ = s->rbytes[i];
+	for(i = 0; i < Nioclass; i++)
+		*v++ = s->wbytes[i];
+	*v++ = s->nfault;
+	*v++ = s->vcsw;
+	*v = s->icsw;
+}
+
 static long
 procread(Chan *c, void *va, long n, vlong off)
 {
@@ -677,6 +731,7 @@ procread(Chan *c, void *va, long n, vlong off)
 	char *a, flag[10], *sps, *srv, statbuf[NSEG*64];
 	int i, j, m, navail, ne, pid, rsize;
 	long l;
+	uvlong sv[Nstats];
 	uchar *rptr;
 	ulong offset;
 	Confmem *cm;
@@ -869,6 +924,24 @@ procread(Chan *c, void *va, long n, vlong off)
 		memmove(a, statbuf+offset, n);
 		return n;
 
+	case Qstats:
+		procstats(p, sv);
+		for(i = 0; i < Nstats; i++)
+			snprint(statbuf+i*STATLINE, STATLINE+1, "%-11s%20llud\n",
+				statsname[i], sv[i]);
+		return readstr(offset, a, n, statbuf);
+
+	case Qbinstats:
+		procstats(p, sv);
+		for(i = 0; i < Nstats; i++)
+			PBIT64((uchar*)statbuf+8*i, sv[i]);
+		if(offset >= Nstats*8)
+			return 0;
+		if(offset+n > Nstats*8)
+			n = Nstats*8 - offset;
+		memmove(a, statbuf+offset, n);
+		return n;
+
 	case Qsegment:
 		j = 0;
 		for(i = 0; i < NSEG; i++) {
@@ -992,7 +1065,7 @@ mntscan(Mntwalk *mw, Proc *p)
 	if(mw->mh)
 		last = mw->cm->mountid;
 
-	for(i = 0; i < MNTHASH; i++) {
+	for(i = 0; i < 1<<pg->mntlog; i++) {
 		for(f = pg->mnthash[i]; f; f = f->hash) {
 			for(t = f->mount; t; t = t->next) {
 				if(mw->mh == 0 ||
@@ -1261,7 +1334,7 @@ procctlclosefiles(Proc *p, int all, int fd)
 	closefgrp(f);
 }
 
-static char *
+char *
 parsetime(vlong *rt, char *s)
 {
 	uvlong ticks;
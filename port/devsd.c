@@ -17,6 +17,8 @@ extern SDifc* sdifc[];
 
 static char Echange[] = "media or partition has changed";
 
+static void sdcinval(SDunit*);
+
 static char devletters[] = "0123456789"
 	"abcdefghijklmnopqrstuvwxyz"
 	"ABCDEFGHIJKLMNOPQRSTUVWXYZ";
@@ -184,6 +186,7 @@ sdinitpart(SDunit* unit)
 		unit->sectors = unit->secsize = 0;
 		sdincvers(unit);
 	}
+	sdcinval(unit);
 
 	/* device must be connected or not; other values are trouble */
 	if(unit->inquiry[0] & 0xC0)	/* see SDinq0periphqual */
@@ -336,6 +339,33 @@ sdreset(void)
 	}
 }
 
+/*
+ * probe each controller's units at boot, a kproc per controller,
+ * rather than at the first walk of #S, so that disks slow to
+ * spin up do it together and alongside other devices' probes.
+ */
+static void
+sdprobe(void *a)
+{
+	SDev *sdev;
+	int i;
+
+	sdev = a;
+	for(i = 0; i < sdev->nunit; i++)
+		sdgetunit(sdev, i);
+}
+
+static void
+sdinit(void)
+{
+	int i;
+	SDev *sdev;
+
+	for(i = 0; i < nelem(devs); i++)
+		if((sdev = devs[i]) != nil)
+			devasync(sdev->name, sdprobe, sdev, nil);
+}
+
 void
 sdadddevs(SDev *sdev)
 {
@@ -728,6 +758,575 @@ sdclose(Chan* c)
 	}
 }
 
+/*
+ * Block request queue.  Requests wait on the unit in block order;
+ * whoever finds a free slot (iodepth of them, for controllers with
+ * tagged commands) takes the next batch in a one-way sweep from
+ * iohead, merging requests in the same direction that continue
+ * one another, and runs it as a single bio call.
+ */
+enum {
+	Bqueued,
+	Bbusy,
+	Bdone,
+};
+
+struct SDbio {
+	SDbio*	next;
+	int	write;
+	uchar*	data;
+	long	nb;
+	uvlong	bno;
+	long	rlen;
+	int	state;
+	int	kick;
+	Rendez	r;
+};
+
+static int
+sdiowake(void* a)
+{
+	return ((SDbio*)a)->kick;
+}
+
+/* unit->iolock held */
+static void
+sdiokick(SDunit* unit)
+{
+	SDbio *b;
+
+	if((b = unit->ioq) != nil){
+		b->kick = 1;
+		wakeup(&b->r);
+	}
+}
+
+/* unit->iolock held */
+static void
+sdunqueue(SDunit* unit, SDbio* b)
+{
+	SDbio **l;
+
+	for(l = &unit->ioq; *l != nil; l = &(*l)->next)
+		if(*l == b){
+			*l = b->next;
+			break;
+		}
+}
+
+/* unit->iolock held; remove the next batch from the queue */
+static SDbio*
+sdiopick(SDunit* unit)
+{
+	SDbio *b, *e, *n, **l;
+	long nb, max;
+
+	for(l = &unit->ioq; (b = *l) != nil; l = &b->next)
+		if(b->bno >= unit->iohead)
+			break;
+	if(b == nil){
+		l = &unit->ioq;
+		if((b = *l) == nil)
+			return nil;
+	}
+	max = SDmaxio/unit->secsize;
+	nb = b->nb;
+	for(e = b; (n = e->next) != nil; e = n){
+		if(n->write != b->write || n->bno != e->bno+e->nb || nb+n->nb > max)
+			break;
+		nb += n->nb;
+		unit->iomerged++;
+	}
+	*l = e->next;
+	e->next = nil;
+	for(n = b; n != nil; n = n->next)
+		n->state = Bbusy;
+	unit->iohead = e->bno+e->nb;
+	return b;
+}
+
+static long
+sdiocall(SDunit* unit, int write, void* data, long nb, uvlong bno)
+{
+	long l;
+
+	if(waserror())
+		return -1;
+	l = unit->dev->ifc->bio(unit, 0, write, data, nb, bno);
+	poperror();
+	return l;
+}
+
+/*
+ * A batch straight into its callers' buffers, when
+ * the interface can scatter one transfer over them.
+ */
+static int
+sdiorunv(SDunit* unit, SDbio* batch)
+{
+	SDiov v[SDmaxiov];
+	SDbio *b;
+	long l, o, n;
+	int nv;
+
+	nv = 0;
+	for(b = batch; b != nil; b = b->next){
+		if(nv == SDmaxiov)
+			return -1;
+		v[nv].data = b->data;
+		v[nv].len = b->nb*unit->secsize;
+		nv++;
+	}
+	if(waserror())
+		l = -1;
+	else{
+		l = unit->dev->ifc->biov(unit, 0, batch->write, v, nv, batch->bno);
+		poperror();
+	}
+	o = 0;
+	for(b = batch; b != nil; b = b->next){
+		n = b->nb*unit->secsize;
+		if(l < 0)
+			b->rlen = l;
+		else if(l <= o)
+			b->rlen = 0;
+		else
+			b->rlen = l-o < n ? l-o : n;
+		o += n;
+	}
+	return 0;
+}
+
+static void
+sdiorun(SDunit* unit, SDbio* batch)
+{
+	SDbio *b;
+	uchar *buf;
+	long l, o, nb, n;
+
+	if(batch->next != nil && unit->dev->ifc->biov != nil
+	&& sdiorunv(unit, batch) == 0)
+		return;
+	nb = 0;
+	for(b = batch; b != nil; b = b->next)
+		nb += b->nb;
+	buf = nil;
+	if(batch->next != nil)
+		buf = sdmalloc(nb*unit->secsize);
+	if(buf == nil){
+		for(b = batch; b != nil; b = b->next)
+			b->rlen = sdiocall(unit, b->write, b->data, b->nb, b->bno);
+		return;
+	}
+
+	if(batch->write)
+		for(b = batch; b != nil; b = b->next)
+			memmove(buf+(b->bno-batch->bno)*unit->secsize, b->data, b->nb*unit->secsize);
+	l = sdiocall(unit, batch->write, buf, nb, batch->bno);
+	for(b = batch; b != nil; b = b->next){
+		o = (b->bno-batch->bno)*unit->secsize;
+		n = b->nb*unit->secsize;
+		if(l < 0)
+			b->rlen = l;
+		else if(l <= o)
+			b->rlen = 0;
+		else
+			b->rlen = l-o < n ? l-o : n;
+		if(!batch->write && b->rlen > 0)
+			memmove(b->data, buf+o, b->rlen);
+	}
+	sdfree(buf);
+}
+
+static long
+sdqio(SDunit* unit, int write, void* data, long nb, uvlong bno)
+{
+	SDbio b, *batch, *x, **l;
+	int depth;
+
+	memset(&b, 0, sizeof b);
+	b.write = write;
+	b.data = data;
+	b.nb = nb;
+	b.bno = bno;
+	b.state = Bqueued;
+
+	lock(&unit->iolock);
+	for(l = &unit->ioq; *l != nil; l = &(*l)->next)
+		if((*l)->bno > bno)
+			break;
+	b.next = *l;
+	*l = &b;
+	for(;;){
+		if(b.state == Bdone)
+			break;
+		depth = unit->iodepth > 0 ? unit->iodepth : 1;
+		if(b.state == Bqueued && unit->ionrun < depth){
+			batch = sdiopick(unit);
+			if(++unit->ionrun < depth)
+				sdiokick(unit);
+			unlock(&unit->iolock);
+
+			sdiorun(unit, batch);
+
+			lock(&unit->iolock);
+			unit->ionrun--;
+			while((x = batch) != nil){
+				batch = x->next;
+				x->state = Bdone;
+				x->kick = 1;
+				if(x != &b)
+					wakeup(&x->r);
+			}
+			sdiokick(unit);
+			continue;
+		}
+		b.kick = 0;
+		unlock(&unit->iolock);
+		if(waserror()){
+			/* let a request at the controller finish */
+			lock(&unit->iolock);
+			if(b.state == Bqueued){
+				sdunqueue(unit, &b);
+				sdiokick(unit);
+				unlock(&unit->iolock);
+				nexterror();
+			}
+			continue;
+		}
+		sleep(&b.r, sdiowake, &b);
+		poperror();
+		lock(&unit->iolock);
+	}
+	/* wakeups happen under iolock, so b is no longer in use */
+	unlock(&unit->iolock);
+	return b.rlen;
+}
+
+/*
+ * Block cache.  Off until "cache n" on a unit's ctl file gives
+ * it n lines of Clinesz bytes; "cache 0" turns it off again.
+ * Reads fill whole lines, and a run of reads that each start
+ * where the last ended reads further ahead.  Writes go through
+ * to the disk and replace the lines they cover.  A read that
+ * overlapped a write in time doesn't fill, so the cache never
+ * holds older data than the disk.
+ */
+enum {
+	Clinesz	= 16*1024,
+	Chash	= 1024,
+	Cmaxra	= 32,		/* lines read ahead */
+	Cmaxline= 64*1024,
+};
+
+struct SDcline {
+	SDcline*hnext;
+	SDcline*next;		/* lru, most recent first */
+	SDcline*prev;
+	uvlong	line;
+	int	valid;
+	uchar*	data;
+};
+
+struct SDcache {
+	QLock;
+	int	nline;
+	long	spl;		/* sectors per line */
+	SDcline*line;
+	SDcline*hash[Chash];
+	SDcline	lru;
+	ulong	gen;		/* bumped by every write */
+	int	nwrite;		/* writes in progress */
+	uvlong	next;		/* line after the last read */
+	int	seq;		/* sequential reads in a row */
+
+	ulong	hits;
+	ulong	misses;
+	ulong	readahead;
+};
+
+static void
+sdclru(SDcache* c, SDcline* l)
+{
+	l->prev->next = l->next;
+	l->next->prev = l->prev;
+	l->next = c->lru.next;
+	l->prev = &c->lru;
+	c->lru.next->prev = l;
+	c->lru.next = l;
+}
+
+static SDcline*
+sdclook(SDcache* c, uvlong line)
+{
+	SDcline *l;
+
+	for(l = c->hash[line%Chash]; l != nil; l = l->hnext)
+		if(l->line == line)
+			return l;
+	return nil;
+}
+
+static void
+sdcunhash(SDcache* c, SDcline* l)
+{
+	SDcline **ll;
+
+	if(!l->valid)
+		return;
+	for(ll = &c->hash[l->line%Chash]; *ll != nil; ll = &(*ll)->hnext)
+		if(*ll == l){
+			*ll = l->hnext;
+			break;
+		}
+	l->valid = 0;
+}
+
+/* c locked */
+static void
+sdcfill(SDcache* c, uvlong line, uchar* data)
+{
+	SDcline *l;
+
+	if((l = sdclook(c, line)) == nil){
+		l = c->lru.prev;
+		sdcunhash(c, l);
+		l->line = line;
+		l->valid = 1;
+		l->hnext = c->hash[line%Chash];
+		c->hash[line%Chash] = l;
+	}
+	memmove(l->data, data, Clinesz);
+	sdclru(c, l);
+}
+
+/* c locked */
+static void
+sdcdrop(SDcache* c, uvlong first, uvlong last)
+{
+	int i;
+	SDcline *l;
+
+	if(last-first >= c->nline){
+		for(i = 0; i < c->nline; i++)
+			sdcunhash(c, &c->line[i]);
+		return;
+	}
+	for(; first <= last; first++)
+		if((l = sdclook(c, first)) != nil)
+			sdcunhash(c, l);
+}
+
+static void
+sdcfree(SDcache* c)
+{
+	int i;
+
+	for(i = 0; i < c->nline; i++)
+		sdfree(c->line[i].data);
+	free(c->line);
+	c->line = nil;
+	c->nline = 0;
+	memset(c->hash, 0, sizeof c->hash);
+}
+
+/* unit->ctl held */
+static void
+sdcsize(SDunit* unit, int n)
+{
+	int i;
+	SDcache *c;
+	SDcline *l;
+
+	if(n < 0 || n > Cmaxline)
+		error(Ebadarg);
+	if(n > 0 && (unit->secsize == 0 || Clinesz%unit->secsize))
+		error(Ebadarg);
+	if((c = unit->cache) == nil){
+		if(n == 0)
+			return;
+		if((c = malloc(sizeof(SDcache))) == nil)
+			error(Enomem);
+		unit->cache = c;
+	}
+	qlock(c);
+	sdcfree(c);
+	c->lru.next = c->lru.prev = &c->lru;
+	c->hits = c->misses = c->readahead = 0;
+	c->seq = 0;
+	if(n > 0 && (c->line = malloc(n*sizeof(SDcline))) == nil){
+		qunlock(c);
+		error(Enomem);
+	}
+	for(i = 0; i < n; i++){
+		l = &c->line[i];
+		if((l->data = sdmalloc(Clinesz)) == nil)
+			break;
+		l->next = c->lru.next;
+		l->prev = &c->lru;
+		c->lru.next->prev = l;
+		c->lru.next = l;
+	}
+	c->nline = i;
+	c->spl = Clinesz/unit->secsize;
+	qunlock(c);
+}
+
+/* forget everything; the disk changed underneath */
+static void
+sdcinval(SDunit* unit)
+{
+	SDcache *c;
+
+	if((c = unit->cache) == nil)
+		return;
+	qlock(c);
+	c->gen++;
+	sdcdrop(c, 0, ~0ULL);
+	qunlock(c);
+}
+
+static long
+sdcread(SDunit* unit, SDcache* c, uchar* a, long nb, uvlong bno)
+{
+	uchar *buf;
+	long l, o, n, max, spl, ss;
+	ulong gen;
+	int ra, nwrite;
+	uvlong first, last, i, s0;
+	SDcline *cl;
+
+	ss = unit->secsize;
+	spl = c->spl;
+	first = bno/spl;
+	last = (bno+nb-1)/spl;
+	if(first == c->next)
+		c->seq++;
+	else
+		c->seq = 0;
+	c->next = last+1;
+	for(i = first; i <= last; i++)
+		if(sdclook(c, i) == nil)
+			break;
+	if(i > last){
+		c->hits++;
+		for(i = first; i <= last; i++){
+			cl = sdclook(c, i);
+			s0 = i*spl;
+			o = bno > s0? bno - s0: 0;
+			n = (s0+spl < bno+nb? s0+spl: bno+nb) - (s0+o);
+			memmove(a + (s0+o-bno)*ss, cl->data + o*ss, n*ss);
+			sdclru(c, cl);
+		}
+		qunlock(c);
+		return nb*ss;
+	}
+	c->misses++;
+
+	/* whole lines, and more of a sequential stream */
+	max = SDmaxio/ss;
+	ra = c->seq*2;
+	if(ra > Cmaxra)
+		ra = Cmaxra;
+	if(ra > c->nline/4)
+		ra = c->nline/4;
+	s0 = first*spl;
+	n = (last+1+ra)*spl - s0;
+	while(n > max && ra > 0){
+		ra--;
+		n -= spl;
+	}
+	if(s0+n > unit->sectors)
+		n = unit->sectors - s0;
+	gen = c->gen;
+	nwrite = c->nwrite;
+	qunlock(c);
+
+	if(n > max || bno+nb > s0+n || (buf = sdmalloc(n*ss)) == nil)
+		return sdqio(unit, 0, a, nb, bno);
+	if(waserror()){
+		sdfree(buf);
+		nexterror();
+	}
+	l = sdqio(unit, 0, buf, n, s0);
+	poperror();
+	if(l < 0){
+		sdfree(buf);
+		return l;
+	}
+	o = (bno-s0)*ss;
+	if(l <= o)
+		n = 0;
+	else
+		n = l-o < nb*ss? l-o: nb*ss;
+	memmove(a, buf+o, n);
+
+	qlock(c);
+	if(c->gen == gen && nwrite == 0 && c->nline > 0 && c->spl == spl){
+		for(i = 0; (i+1)*Clinesz <= l; i++)
+			sdcfill(c, first+i, buf + i*Clinesz);
+		if(first+i > last+1)
+			c->readahead += first+i - (last+1);
+	}
+	qunlock(c);
+	sdfree(buf);
+	return n;
+}
+
+static long
+sdcwrite(SDunit* unit, SDcache* c, uchar* a, long nb, uvlong bno)
+{
+	long l, spl, ss;
+	ulong gen;
+	uvlong i, first, last;
+
+	ss = unit->secsize;
+	spl = c->spl;
+	sdcdrop(c, bno/spl, (bno+nb-1)/spl);
+	gen = ++c->gen;
+	c->nwrite++;
+	qunlock(c);
+
+	if(waserror()){
+		qlock(c);
+		c->gen++;
+		c->nwrite--;
+		qunlock(c);
+		nexterror();
+	}
+	l = sdqio(unit, 1, a, nb, bno);
+	poperror();
+
+	qlock(c);
+	if(l == nb*ss && c->gen == gen && c->nline > 0 && c->spl == spl){
+		first = (bno+spl-1)/spl;
+		last = (bno+nb)/spl;
+		for(i = first; i < last; i++)
+			sdcfill(c, i, a + (i*spl-bno)*ss);
+	}
+	c->gen++;
+	c->nwrite--;
+	qunlock(c);
+	return l;
+}
+
+static long
+sdcio(SDunit* unit, int write, uchar* a, long nb, uvlong bno)
+{
+	SDcache *c;
+
+	if((c = unit->cache) == nil)
+		return sdqio(unit, write, a, nb, bno);
+	qlock(c);
+	if(c->nline == 0){
+		qunlock(c);
+		return sdqio(unit, write, a, nb, bno);
+	}
+	if(write)
+		return sdcwrite(unit, c, a, nb, bno);
+	return sdcread(unit, c, a, nb, bno);
+}
+
 static long
 sdbio(Chan* c, int write, char* a, long len, uvlong off)
 {
@@ -813,7 +1412,7 @@ sdbio(Chan* c, int write, char* a, long len, uvlong off)
 		len = nb*unit->secsize - offset;
 	if(write){
 		if(offset || (len%unit->secsize)){
-			l = unit->dev->ifc->bio(unit, 0, 0, b, nb, bno);
+			l = sdcio(unit, 0, b, nb, bno);
 			if(l < 0)
 				error(Eio);
 			if(l < (nb*unit->secsize)){
@@ -824,7 +1423,7 @@ sdbio(Chan* c, int write, char* a, long len, uvlong off)
 			}
 		}
 		memmove(b+offset, a, len);
-		l = unit->dev->ifc->bio(unit, 0, 1, b, nb, bno);
+		l = sdcio(unit, 1, b, nb, bno);
 		if(l < 0)
 			error(Eio);
 		if(l < offset)
@@ -833,7 +1432,7 @@ sdbio(Chan* c, int write, char* a, long len, uvlong off)
 			len = l - offset;
 	}
 	else{
-		l = unit->dev->ifc->bio(unit, 0, 0, b, nb, bno);
+		l = sdcio(unit, 0, b, nb, bno);
 		if(l < 0)
 			error(Eio);
 		if(l < offset)
@@ -871,6 +1470,8 @@ sdrio(SDreq* r, void* a, long n)
 	}
 	r->data = data;
 	r->dlen = n;
+	if(r->write)
+		sdcinval(r->unit);
 
 	if(waserror()){
 		sdfree(data);
@@ -1153,6 +1754,13 @@ sdread(Chan *c, void *a, long n, vlong off)
 				pp++;
 			}
 		}
+		l += snprint(p+l, m-l, "ioqueue depth %d merged %lud\n",
+			unit->iodepth > 0 ? unit->iodepth : 1, unit->iomerged);
+		if(unit->cache != nil && unit->cache->nline > 0)
+			l += snprint(p+l, m-l,
+				"cache lines %d hits %lud misses %lud readahead %lud\n",
+				unit->cache->nline, unit->cache->hits,
+				unit->cache->misses, unit->cache->readahead);
 		qunlock(&unit->ctl);
 		decref(&sdev->r);
 		l = readstr(offset, a, n, p);
@@ -1304,6 +1912,11 @@ sdwrite(Chan* c, void* a, long n, vlong off)
 				error(Ebadctl);
 			sddelpart(unit, cb->f[1]);
 		}
+		else if(strcmp(cb->f[0], "cache") == 0){
+			if(cb->nf != 2)
+				error(Ebadctl);
+			sdcsize(unit, strtol(cb->f[1], 0, 0));
+		}
 		else if(unit->dev->ifc->wctl)
 			unit->dev->ifc->wctl(unit, cb);
 		else
@@ -1508,7 +2121,7 @@ Dev sddevtab = {
 	"sd",
 
 	sdreset,
-	devinit,
+	sdinit,
 	devshutdown,
 	sdattach,
 	sdwalk,
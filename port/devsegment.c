@@ -52,7 +52,9 @@ static Lock globalseglock;
 
 
 	Segment* (*_globalsegattach)(Proc*, char*);
+	long (*_globalsegio)(char*, void*, long, vlong, int);
 static	Segment* globalsegattach(Proc *p, char *name);
+static	long	globalsegio(char*, void*, long, vlong, int);
 static	int	cmddone(void*);
 static	void	segmentkproc(void*);
 static	void	docmd(Globalseg *g, int cmd);
@@ -170,6 +172,7 @@ static void
 segmentinit(void)
 {
 	_globalsegattach = globalsegattach;
+	_globalsegio = globalsegio;
 }
 
 static Chan*
@@ -494,6 +497,59 @@ globalsegattach(Proc *p, char *name)
 	return s;
 }
 
+/*
+ *  kernel access to a named segment's contents: n bytes at
+ *  offset off are read into or written from a, through the
+ *  segment's kproc like the data file.
+ */
+static long
+globalsegio(char *name, void *a, long n, vlong off, int write)
+{
+	int x;
+	Globalseg *g;
+
+	g = nil;
+	lock(&globalseglock);
+	for(x = 0; x < nelem(globalseg); x++){
+		g = globalseg[x];
+		if(g != nil && strcmp(g->name, name) == 0){
+			incref(g);
+			break;
+		}
+	}
+	unlock(&globalseglock);
+	if(x == nelem(globalseg))
+		error(Enonexist);
+	if(waserror()){
+		putgseg(g);
+		nexterror();
+	}
+	devpermcheck(g->uid, g->perm, write ? OWRITE : OREAD);
+	if(g->s == nil)
+		error("segment not yet allocated");
+	if(off < 0 || n < 0 || off + n > g->s->top - g->s->base)
+		error(Ebadarg);
+	qlock(&g->l);
+	if(waserror()){
+		qunlock(&g->l);
+		nexterror();
+	}
+	if(g->kproc == nil){
+		g->cmd = Cnone;
+		kproc(g->name, segmentkproc, g);
+		docmd(g, Cstart);
+	}
+	g->off = off + g->s->base;
+	g->data = a;
+	g->dlen = n;
+	docmd(g, write ? Cwrite : Cread);
+	qunlock(&g->l);
+	poperror();
+	putgseg(g);
+	poperror();
+	return n;
+}
+
 static void
 docmd(Globalseg *g, int cmd)
 {
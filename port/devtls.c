@@ -9,6 +9,7 @@
 #include	"../port/error.h"
 
 #include	<libsec.h>
+#include	"../port/aes.h"
 
 typedef struct OneWay	OneWay;
 typedef struct Secret		Secret;
@@ -22,6 +23,8 @@ enum {
 	MaxCipherRecLen	= MaxRecLen + 2048,
 	RecHdrLen		= 5,
 	MaxMacLen		= SHA1dlen,
+	RecTrailer	= MaxMacLen + 16,	/* mac and the largest block padding */
+	CopyMax		= 256,		/* split a Block by copying up to this */
 
 	/* protocol versions we can accept */
 	TLSVersion		= 0x0301,
@@ -679,30 +682,64 @@ regurgitate(TlsRec *s, uchar *p, int n)
 }
 
 /*
- *  remove at most n bytes from the queue
+ *  remove at most n bytes from the queue, copying as little
+ *  as possible: a record is usually a prefix of one Block
+ *  from below, or starts in one that has room for the rest.
  */
 static Block*
 qgrab(Block **l, int n)
 {
-	Block *bb, *b;
+	Block *bb, *b, *rb;
 	int i;
 
 	b = *l;
+	i = 0;
+	for(bb = b; bb != nil && i < n; bb = bb->next)
+		i += BLEN(bb);
+	if(i < n)
+		n = i;
+
 	if(BLEN(b) == n){
 		*l = b->next;
 		b->next = nil;
 		return b;
 	}
+	if(BLEN(b) > n && n > CopyMax){
+		i = BLEN(b) - n;
+		rb = nil;
+		if(i <= CopyMax){
+			/* move the few bytes left over out of the way */
+			rb = allocb(i);
+			memmove(rb->wp, b->rp + n, i);
+			rb->wp += i;
+			b->wp = b->rp + n;
+			bb = b;
+		}else if((bb = shareblock(b, b->rp, b->rp + n)) != nil){
+			if((rb = shareblock(b, b->rp + n, b->wp)) == nil)
+				freeb(bb);
+		}
+		if(rb != nil){
+			rb->next = b->next;
+			*l = rb;
+			if(bb != b)
+				freeb(b);
+			bb->next = nil;
+			return bb;
+		}
+	}
+	if(BLEN(b) < n && b->lim - b->rp >= n){
+		/* pull the rest up into b */
+		*l = b->next;
+		b->next = nil;
+		i = n - BLEN(b);
+		consume(l, b->wp, i);
+		b->wp += i;
+		return b;
+	}
 
-	i = 0;
-	for(bb = b; bb != nil && i < n; bb = bb->next)
-		i += BLEN(bb);
-	if(i > n)
-		i = n;
-
-	bb = allocb(i);
-	consume(l, bb->wp, i);
-	bb->wp += i;
+	bb = allocb(n);
+	consume(l, bb->wp, n);
+	bb->wp += n;
 	return bb;
 }
 
@@ -1498,7 +1535,8 @@ tlswrite(Chan *c, void *a, long n, vlong off)
 			if(m > MaxRecLen)
 				m = MaxRecLen;
 
-			b = allocb(m);
+			/* room for tlsrecwrite to add the mac and encrypt in place */
+			b = allocb(m + RecTrailer);
 			if(waserror()){
 				freeb(b);
 				nexterror();
@@ -2034,14 +2072,14 @@ static int
 aesenc(Secret *sec, uchar *buf, int n)
 {
 	n = blockpad(buf, n, 16);
-	aesCBCencrypt(buf, n, sec->enckey);
+	aescbcenc(sec->enckey, buf, n);
 	return n;
 }
 
 static int
 aesdec(Secret *sec, uchar *buf, int n)
 {
-	aesCBCdecrypt(buf, n, sec->enckey);
+	aescbcdec(sec->enckey, buf, n);
 	return (*sec->unpad)(buf, n, 16);
 }
 
@@ -81,6 +81,8 @@ uartenable(Uart *p)
 	if(p->baud == 0)
 		uartctl(p, "b9600");
 	(*p->phys->enable)(p, 1);
+	if(p->fifo)
+		(*p->phys->fifo)(p, p->fifo);
 
 	/*
 	 * use ilock because uartclock can otherwise interrupt here
@@ -425,6 +427,7 @@ uartctl(Uart *p, char *cmd)
 		case 'I':
 			uartdrainoutput(p);
 			(*p->phys->fifo)(p, n);
+			p->fifo = n;
 			break;
 		case 'K':
 		case 'k':
@@ -676,39 +679,77 @@ uartstageinput(Uart *p)
 }
 
 /*
- *  receive a character at interrupt time
+ *  bytes that can be staged at p->iw without wrapping;
+ *  one slot is kept free to tell full from empty
+ */
+static int
+uartstageroom(Uart *p)
+{
+	if(p->iw < p->ir)
+		return p->ir - p->iw - 1;
+	if(p->ir == p->istage)
+		return p->ie - p->iw - 1;
+	return p->ie - p->iw;
+}
+
+/*
+ *  receive n characters at interrupt time, as drained from
+ *  a fifo or left by dma, with one ilock for the lot
  */
 void
-uartrecv(Uart *p,  char ch)
+uartrecvn(Uart *p, uchar *s, int n)
 {
-	uchar *next;
+	int i, m;
 
 	/* software flow control */
 	if(p->xonoff){
-		if(ch == CTLS){
-			p->blocked = 1;
-		}else if(ch == CTLQ){
-			p->blocked = 0;
-			p->ctsbackoff = 2; /* clock gets output going again */
+		for(i = 0; i < n; i++){
+			if(s[i] == CTLS){
+				p->blocked = 1;
+			}else if(s[i] == CTLQ){
+				p->blocked = 0;
+				p->ctsbackoff = 2; /* clock gets output going again */
+			}
 		}
 	}
 
-	/* receive the character */
-	if(p->putc)
-		p->putc(p->iq, ch);
-	else if (p->iw) {		/* maybe the line isn't enabled yet */
-		ilock(&p->rlock);
-		next = p->iw + 1;
-		if(next == p->ie)
-			next = p->istage;
-		if(next == p->ir)
+	/* receive the characters */
+	if(p->putc){
+		for(i = 0; i < n; i++)
+			p->putc(p->iq, s[i]);
+		return;
+	}
+	if(p->iw == nil)		/* maybe the line isn't enabled yet */
+		return;
+	ilock(&p->rlock);
+	while(n > 0){
+		if((m = uartstageroom(p)) == 0){
 			uartstageinput(p);
-		if(next != p->ir){
-			*p->iw = ch;
-			p->iw = next;
+			if((m = uartstageroom(p)) == 0)
+				break;
 		}
-		iunlock(&p->rlock);
+		if(m > n)
+			m = n;
+		memmove(p->iw, s, m);
+		s += m;
+		n -= m;
+		p->iw += m;
+		if(p->iw == p->ie)
+			p->iw = p->istage;
 	}
+	iunlock(&p->rlock);
+}
+
+/*
+ *  receive a character at interrupt time
+ */
+void
+uartrecv(Uart *p,  char ch)
+{
+	uchar c;
+
+	c = ch;
+	uartrecvn(p, &c, 1);
 }
 
 /*
@@ -17,9 +17,6 @@ enum {
 
 static long	now;	/* Low order 32 bits of time in µs */
 extern ulong	delayedscheds;
-extern Schedq	runq[Nrq];
-extern int	nrdy;
-extern ulong	runvec;
 
 /* Statistics stuff */
 ulong		nilcount;
@@ -37,9 +34,13 @@ enum{
 	Rl,
 };
 
-static char *testschedulability(Proc*);
+static char *testschedulability(Proc*, int);
 static Proc *qschedulability;
 
+/* admitted C/T and C/D on each processor, in Uscale parts */
+static ulong	edfutil[MAXMACH];
+static ulong	edfdensity[MAXMACH];
+
 enum {
 	Onemicrosecond =	1,
 	Onemillisecond =	1000,
@@ -190,6 +191,7 @@ release(Proc *p)
 			 * one period after this release
 			 */
 			e->t = e->r + e->T;
+			e->a = e->t;
 		}
 		e->d = e->r + e->D;
 		e->S = e->C;
@@ -226,8 +228,8 @@ releaseintr(Ureg*, Timer *t)
 		return;
 	case Ready:
 		/* remove proc from current runq */
-		rq = &runq[p->priority];
-		if(dequeueproc(rq, p) != p){
+		rq = procschedq(p);
+		if(rq == nil || dequeueproc(rq, p) != p){
 			DPRINT("releaseintr: can't find proc or lock race\n");
 			release(p);	/* It'll start best effort */
 			edfunlock();
@@ -336,6 +338,43 @@ edfrun(Proc *p, int edfpri)
 	e->s = now;
 }
 
+/*
+ * partitioned edf: an admitted proc runs only on the processor it
+ * was packed onto, the first by number that can take it.  where
+ * the densities C/D would sum to no more than one, it fits without
+ * further ado; otherwise, if the utilizations C/T would, the full
+ * test decides for that processor's procs alone.
+ */
+static char *
+edfplace(Proc *p)
+{
+	Edf *e;
+	char *err;
+	int i;
+
+	e = p->edf;
+	e->util = ((uvlong)e->C*Uscale + e->T-1) / e->T;
+	e->density = ((uvlong)e->C*Uscale + e->D-1) / e->D;
+	err = "not schedulable";
+	for(i = 0; i < conf.nmach; i++){
+		if(p->wired != nil && p->wired->machno != i)
+			continue;
+		if((active.machs & (1<<i)) == 0)
+			continue;
+		if(edfutil[i] + e->util > Uscale)
+			continue;
+		if(edfdensity[i] + e->density > Uscale
+		&& (err = testschedulability(p, i)) != nil)
+			continue;
+		if(edfqalloc(i) < 0)
+			return Enomem;
+		e->cpu = i;
+		DPRINT("edfplace %lud on cpu%d\n", p->pid, i);
+		return nil;
+	}
+	return err;
+}
+
 char *
 edfadmit(Proc *p)
 {
@@ -363,13 +402,15 @@ edfadmit(Proc *p)
 		return "C > D";
 
 	qlock(&edfschedlock);
-	if (err = testschedulability(p)){
+	if (err = edfplace(p)){
 		qunlock(&edfschedlock);
 		return err;
 	}
 	e->flags |= Admitted;
 
 	edflock(p);
+	edfutil[e->cpu] += e->util;
+	edfdensity[e->cpu] += e->density;
 
 	if(p->trace && (pt = proctrace))
 		pt(p, SAdmit, 0);
@@ -445,6 +486,8 @@ edfstop(Proc *p)
 		if(p->trace && (pt = proctrace))
 			pt(p, SExpel, 0);
 		e->flags &= ~Admitted;
+		edfutil[e->cpu] -= e->util;
+		edfdensity[e->cpu] -= e->density;
 		if(e->tt)
 			timerdel(e);
 		edfunlock();
@@ -495,12 +538,39 @@ edfyield(void)
 	sleep(&up->sleep, yfn, nil);
 }
 
+/*
+ * An event for sporadic proc p, such as a message for it to
+ * consume.  If it has yielded and a period has passed since its
+ * last release, release it now instead of when its timer goes off.
+ * Returns whether it was released.
+ */
+int
+edfarrive(Proc *p)
+{
+	Edf *e;
+
+	if((e = edflock(p)) == nil)
+		return 0;
+	if((e->flags & (Sporadic|Yield)) != (Sporadic|Yield)
+	|| p->state != Wakeme || p->trend != &p->sleep || now - e->a < 0){
+		edfunlock();
+		return 0;
+	}
+	DPRINT("%lud edfarrive %lud[%s]\n", now, p->pid, statename[p->state]);
+	if(p->tt != nil && p->tf == releaseintr)
+		timerdel(p);
+	release(p);
+	edfunlock();
+	if(p->trend)
+		wakeup(p->trend);
+	p->trend = nil;
+	return 1;
+}
+
 int
 edfready(Proc *p)
 {
 	Edf *e;
-	Schedq *rq;
-	Proc *l, *pp;
 	void (*pt)(Proc*, int, vlong);
 	long n;
 
@@ -562,29 +632,7 @@ edfready(Proc *p)
 	}
 	edfunlock();
 	DPRINT("^");
-	rq = &runq[PriEdf];
-	/* insert in queue in earliest deadline order */
-	lock(runq);
-	l = nil;
-	for(pp = rq->head; pp; pp = pp->rnext){
-		if(pp->edf->d > e->d)
-			break;
-		l = pp;
-	}
-	p->rnext = pp;
-	if (l == nil)
-		rq->head = p;
-	else
-		l->rnext = p;
-	if(pp == nil)
-		rq->tail = p;
-	rq->n++;
-	nrdy++;
-	runvec |= 1 << PriEdf;
-	p->priority = PriEdf;
-	p->readytime = m->ticks;
-	p->state = Ready;
-	unlock(runq);
+	edfqueueproc(p, e->cpu);
 	if(p->trace && (pt = proctrace))
 		pt(p, SReady, 0);
 	return 1;
@@ -618,7 +666,7 @@ testenq(Proc *p)
 }
 
 static char *
-testschedulability(Proc *theproc)
+testschedulability(Proc *theproc, int cpu)
 {
 	Proc *p;
 	long H, G, Cb, ticks;
@@ -631,7 +679,8 @@ testschedulability(Proc *theproc)
 		p = proctab(i);
 		if(p->state == Dead)
 			continue;
-		if ((p->edf == nil || (p->edf->flags & Admitted) == 0) && p != theproc)
+		if (p != theproc
+		&& (p->edf == nil || (p->edf->flags & Admitted) == 0 || p->edf->cpu != cpu))
 			continue;
 		p->edf->testtype = Rl;
 		p->edf->testtime = 0;
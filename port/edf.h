@@ -11,6 +11,8 @@ enum {
 	Extratime		= 0x40,
 
 	Infinity = ~0ULL,
+
+	Uscale = 1000000,		/* utilizations are in parts per million */
 };
 
 typedef struct Edf		Edf;
@@ -28,11 +30,17 @@ struct Edf {
 	long		d;		/* (this) deadline */
 	long		t;		/* Start of next period, t += T at release */
 	long		s;		/* Time at which this proc was last scheduled */
+	long		a;		/* Sporadic: earliest next release, r + T */
 	/* for schedulability testing */
 	long		testDelta;
 	int		testtype;	/* Release or Deadline */
 	long		testtime;
 	Proc		*testnext;
+	/* for partitioning */
+	int		cpu;		/* processor admitted to */
+	ulong		util;		/* C/T */
+	ulong		density;	/* C/D */
+	int		heapi;		/* place on cpu's deadline heap */
 	/* other */
 	ushort		flags;
 	Timer;
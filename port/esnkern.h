@@ -0,0 +1,302 @@
+/* generated by ../port/mkesnkern; do not edit */
+
+static void
+esn_rows_64(EchoStateNetwork *esn, float *new_activations, float *input, float *inproj, int lo, int hi)
+{
+    float *x, *w, s0, s1, sum;
+    int *c, i;
+
+    x = esn->current_state->activations;
+    for (i = lo; i < hi; i++) {
+        w = esn->W_val + i*6;
+        c = esn->W_col + i*6;
+        s0 = w[0] * x[c[0]];
+        s1 = w[1] * x[c[1]];
+        s0 += w[2] * x[c[2]];
+        s1 += w[3] * x[c[3]];
+        s0 += w[4] * x[c[4]];
+        s1 += w[5] * x[c[5]];
+        sum = esn->nodes[i]->bias;
+        sum += s0 + s1;
+        if (inproj != nil)
+            sum += inproj[i];
+        else
+            sum += esn_dot(esn->W_input + i*esn->ld_input, input, esn->input_dim);
+        new_activations[i] = (1.0 - esn->leak_rate) * x[i] +
+                             esn->leak_rate * tanh(sum);
+        esn->nodes[i]->activation = new_activations[i];
+    }
+}
+
+static void
+esn_output_64(EchoStateNetwork *esn, float *output)
+{
+    float *w, *x, s0, s1, s2, s3;
+    int o, j;
+
+    x = esn->current_state->activations;
+    for (o = 0; o < esn->output_dim; o++) {
+        w = esn->W_output + o*esn->ld_reservoir;
+        s0 = s1 = s2 = s3 = 0.0;
+        for (j = 0; j < 64; j += 16) {
+            s0 += w[j] * x[j];
+            s1 += w[j+1] * x[j+1];
+            s2 += w[j+2] * x[j+2];
+            s3 += w[j+3] * x[j+3];
+            s0 += w[j+4] * x[j+4];
+            s1 += w[j+5] * x[j+5];
+            s2 += w[j+6] * x[j+6];
+            s3 += w[j+7] * x[j+7];
+            s0 += w[j+8] * x[j+8];
+            s1 += w[j+9] * x[j+9];
+            s2 += w[j+10] * x[j+10];
+            s3 += w[j+11] * x[j+11];
+            s0 += w[j+12] * x[j+12];
+            s1 += w[j+13] * x[j+13];
+            s2 += w[j+14] * x[j+14];
+            s3 += w[j+15] * x[j+15];
+        }
+        output[o] = (s0 + s1) + (s2 + s3);
+    }
+}
+
+static void
+esn_rows_256(EchoStateNetwork *esn, float *new_activations, float *input, float *inproj, int lo, int hi)
+{
+    float *x, *w, s0, s1, sum;
+    int *c, i;
+
+    x = esn->current_state->activations;
+    for (i = lo; i < hi; i++) {
+        w = esn->W_val + i*25;
+        c = esn->W_col + i*25;
+        s0 = w[0] * x[c[0]];
+        s1 = w[1] * x[c[1]];
+        s0 += w[2] * x[c[2]];
+        s1 += w[3] * x[c[3]];
+        s0 += w[4] * x[c[4]];
+        s1 += w[5] * x[c[5]];
+        s0 += w[6] * x[c[6]];
+        s1 += w[7] * x[c[7]];
+        s0 += w[8] * x[c[8]];
+        s1 += w[9] * x[c[9]];
+        s0 += w[10] * x[c[10]];
+        s1 += w[11] * x[c[11]];
+        s0 += w[12] * x[c[12]];
+        s1 += w[13] * x[c[13]];
+        s0 += w[14] * x[c[14]];
+        s1 += w[15] * x[c[15]];
+        s0 += w[16] * x[c[16]];
+        s1 += w[17] * x[c[17]];
+        s0 += w[18] * x[c[18]];
+        s1 += w[19] * x[c[19]];
+        s0 += w[20] * x[c[20]];
+        s1 += w[21] * x[c[21]];
+        s0 += w[22] * x[c[22]];
+        s1 += w[23] * x[c[23]];
+        s0 += w[24] * x[c[24]];
+        sum = esn->nodes[i]->bias;
+        sum += s0 + s1;
+        if (inproj != nil)
+            sum += inproj[i];
+        else
+            sum += esn_dot(esn->W_input + i*esn->ld_input, input, esn->input_dim);
+        new_activations[i] = (1.0 - esn->leak_rate) * x[i] +
+                             esn->leak_rate * tanh(sum);
+        esn->nodes[i]->activation = new_activations[i];
+    }
+}
+
+static void
+esn_output_256(EchoStateNetwork *esn, float *output)
+{
+    float *w, *x, s0, s1, s2, s3;
+    int o, j;
+
+    x = esn->current_state->activations;
+    for (o = 0; o < esn->output_dim; o++) {
+        w = esn->W_output + o*esn->ld_reservoir;
+        s0 = s1 = s2 = s3 = 0.0;
+        for (j = 0; j < 256; j += 16) {
+            s0 += w[j] * x[j];
+            s1 += w[j+1] * x[j+1];
+            s2 += w[j+2] * x[j+2];
+            s3 += w[j+3] * x[j+3];
+            s0 += w[j+4] * x[j+4];
+            s1 += w[j+5] * x[j+5];
+            s2 += w[j+6] * x[j+6];
+            s3 += w[j+7] * x[j+7];
+            s0 += w[j+8] * x[j+8];
+            s1 += w[j+9] * x[j+9];
+            s2 += w[j+10] * x[j+10];
+            s3 += w[j+11] * x[j+11];
+            s0 += w[j+12] * x[j+12];
+            s1 += w[j+13] * x[j+13];
+            s2 += w[j+14] * x[j+14];
+            s3 += w[j+15] * x[j+15];
+        }
+        output[o] = (s0 + s1) + (s2 + s3);
+    }
+}
+
+static void
+esn_rows_1024(EchoStateNetwork *esn, float *new_activations, float *input, float *inproj, int lo, int hi)
+{
+    float *x, *w, s0, s1, sum;
+    int *c, i;
+
+    x = esn->current_state->activations;
+    for (i = lo; i < hi; i++) {
+        w = esn->W_val + i*102;
+        c = esn->W_col + i*102;
+        s0 = w[0] * x[c[0]];
+        s1 = w[1] * x[c[1]];
+        s0 += w[2] * x[c[2]];
+        s1 += w[3] * x[c[3]];
+        s0 += w[4] * x[c[4]];
+        s1 += w[5] * x[c[5]];
+        s0 += w[6] * x[c[6]];
+        s1 += w[7] * x[c[7]];
+        s0 += w[8] * x[c[8]];
+        s1 += w[9] * x[c[9]];
+        s0 += w[10] * x[c[10]];
+        s1 += w[11] * x[c[11]];
+        s0 += w[12] * x[c[12]];
+        s1 += w[13] * x[c[13]];
+        s0 += w[14] * x[c[14]];
+        s1 += w[15] * x[c[15]];
+        s0 += w[16] * x[c[16]];
+        s1 += w[17] * x[c[17]];
+        s0 += w[18] * x[c[18]];
+        s1 += w[19] * x[c[19]];
+        s0 += w[20] * x[c[20]];
+        s1 += w[21] * x[c[21]];
+        s0 += w[22] * x[c[22]];
+        s1 += w[23] * x[c[23]];
+        s0 += w[24] * x[c[24]];
+        s1 += w[25] * x[c[25]];
+        s0 += w[26] * x[c[26]];
+        s1 += w[27] * x[c[27]];
+        s0 += w[28] * x[c[28]];
+        s1 += w[29] * x[c[29]];
+        s0 += w[30] * x[c[30]];
+        s1 += w[31] * x[c[31]];
+        s0 += w[32] * x[c[32]];
+        s1 += w[33] * x[c[33]];
+        s0 += w[34] * x[c[34]];
+        s1 += w[35] * x[c[35]];
+        s0 += w[36] * x[c[36]];
+        s1 += w[37] * x[c[37]];
+        s0 += w[38] * x[c[38]];
+        s1 += w[39] * x[c[39]];
+        s0 += w[40] * x[c[40]];
+        s1 += w[41] * x[c[41]];
+        s0 += w[42] * x[c[42]];
+        s1 += w[43] * x[c[43]];
+        s0 += w[44] * x[c[44]];
+        s1 += w[45] * x[c[45]];
+        s0 += w[46] * x[c[46]];
+        s1 += w[47] * x[c[47]];
+        s0 += w[48] * x[c[48]];
+        s1 += w[49] * x[c[49]];
+        s0 += w[50] * x[c[50]];
+        s1 += w[51] * x[c[51]];
+        s0 += w[52] * x[c[52]];
+        s1 += w[53] * x[c[53]];
+        s0 += w[54] * x[c[54]];
+        s1 += w[55] * x[c[55]];
+        s0 += w[56] * x[c[56]];
+        s1 += w[57] * x[c[57]];
+        s0 += w[58] * x[c[58]];
+        s1 += w[59] * x[c[59]];
+        s0 += w[60] * x[c[60]];
+        s1 += w[61] * x[c[61]];
+        s0 += w[62] * x[c[62]];
+        s1 += w[63] * x[c[63]];
+        s0 += w[64] * x[c[64]];
+        s1 += w[65] * x[c[65]];
+        s0 += w[66] * x[c[66]];
+        s1 += w[67] * x[c[67]];
+        s0 += w[68] * x[c[68]];
+        s1 += w[69] * x[c[69]];
+        s0 += w[70] * x[c[70]];
+        s1 += w[71] * x[c[71]];
+        s0 += w[72] * x[c[72]];
+        s1 += w[73] * x[c[73]];
+        s0 += w[74] * x[c[74]];
+        s1 += w[75] * x[c[75]];
+        s0 += w[76] * x[c[76]];
+        s1 += w[77] * x[c[77]];
+        s0 += w[78] * x[c[78]];
+        s1 += w[79] * x[c[79]];
+        s0 += w[80] * x[c[80]];
+        s1 += w[81] * x[c[81]];
+        s0 += w[82] * x[c[82]];
+        s1 += w[83] * x[c[83]];
+        s0 += w[84] * x[c[84]];
+        s1 += w[85] * x[c[85]];
+        s0 += w[86] * x[c[86]];
+        s1 += w[87] * x[c[87]];
+        s0 += w[88] * x[c[88]];
+        s1 += w[89] * x[c[89]];
+        s0 += w[90] * x[c[90]];
+        s1 += w[91] * x[c[91]];
+        s0 += w[92] * x[c[92]];
+        s1 += w[93] * x[c[93]];
+        s0 += w[94] * x[c[94]];
+        s1 += w[95] * x[c[95]];
+        s0 += w[96] * x[c[96]];
+        s1 += w[97] * x[c[97]];
+        s0 += w[98] * x[c[98]];
+        s1 += w[99] * x[c[99]];
+        s0 += w[100] * x[c[100]];
+        s1 += w[101] * x[c[101]];
+        sum = esn->nodes[i]->bias;
+        sum += s0 + s1;
+        if (inproj != nil)
+            sum += inproj[i];
+        else
+            sum += esn_dot(esn->W_input + i*esn->ld_input, input, esn->input_dim);
+        new_activations[i] = (1.0 - esn->leak_rate) * x[i] +
+                             esn->leak_rate * tanh(sum);
+        esn->nodes[i]->activation = new_activations[i];
+    }
+}
+
+static void
+esn_output_1024(EchoStateNetwork *esn, float *output)
+{
+    float *w, *x, s0, s1, s2, s3;
+    int o, j;
+
+    x = esn->current_state->activations;
+    for (o = 0; o < esn->output_dim; o++) {
+        w = esn->W_output + o*esn->ld_reservoir;
+        s0 = s1 = s2 = s3 = 0.0;
+        for (j = 0; j < 1024; j += 16) {
+            s0 += w[j] * x[j];
+            s1 += w[j+1] * x[j+1];
+            s2 += w[j+2] * x[j+2];
+            s3 += w[j+3] * x[j+3];
+            s0 += w[j+4] * x[j+4];
+            s1 += w[j+5] * x[j+5];
+            s2 += w[j+6] * x[j+6];
+            s3 += w[j+7] * x[j+7];
+            s0 += w[j+8] * x[j+8];
+            s1 += w[j+9] * x[j+9];
+            s2 += w[j+10] * x[j+10];
+            s3 += w[j+11] * x[j+11];
+            s0 += w[j+12] * x[j+12];
+            s1 += w[j+13] * x[j+13];
+            s2 += w[j+14] * x[j+14];
+            s3 += w[j+15] * x[j+15];
+        }
+        output[o] = (s0 + s1) + (s2 + s3);
+    }
+}
+
+static ESNKernel esnkernels[] = {
+    {64, 6, esn_rows_64, esn_output_64},
+    {256, 25, esn_rows_256, esn_output_256},
+    {1024, 102, esn_rows_1024, esn_output_1024},
+};
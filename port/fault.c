@@ -22,6 +22,7 @@ fault(ulong addr, int read)
 	spllo();
 
 	m->pfault++;
+	up->stats.nfault++;
 	for(tries = 200; tries > 0; tries--) {	/* TODO: reset to 20 */
 		s = seg(up, addr, 1);		/* leaves s->lk qlocked if seg != nil */
 		if(s == 0) {
@@ -67,6 +68,12 @@ faulterror(char *s, Chan *c, int freemem)
 	pexit(s, freemem);
 }
 
+enum
+{
+	Minahead	= 1,	/* pages read after a demand-loaded one */
+	Maxahead	= 15,
+};
+
 void	(*checkaddr)(ulong, Segment *, Page *);
 ulong	addr2check;
 
@@ -87,9 +94,16 @@ fixfault(Segment *s, ulong addr, int read, int doputmmu)
 		*p = ptealloc();
 
 	etp = *p;
-	pg = &etp->pages[(soff&(PTEMAPMEM-1))/BY2PG];
 	type = s->type&SG_TYPE;
 
+	/*
+	 * A pte still shared with a forked segment is copied before
+	 * a fault that could map one of its pages writable.
+	 */
+	if(etp->ref > 1 && (!read || conf.copymode || s->ref > 1))
+		etp = pteunshare(s, p);
+	pg = &etp->pages[(soff&(PTEMAPMEM-1))/BY2PG];
+
 	if(pg < etp->first)
 		etp->first = pg;
 	if(pg > etp->last)
@@ -125,6 +139,12 @@ fixfault(Segment *s, ulong addr, int read, int doputmmu)
 		if(pagedout(*pg))
 			pio(s, addr, soff, pg);
 
+		/* pio let go of s->lk, and s may have forked meanwhile */
+		if(etp->ref > 1 && (!read || conf.copymode || s->ref > 1)){
+			etp = pteunshare(s, p);
+			pg = &etp->pages[(soff&(PTEMAPMEM-1))/BY2PG];
+		}
+
 		/*
 		 *  It's only possible to copy on write if
 		 *  we're the only user of the segment.
@@ -176,7 +196,13 @@ fixfault(Segment *s, ulong addr, int read, int doputmmu)
 
 		if (checkaddr && addr == addr2check)
 			(*checkaddr)(addr, s, *pg);
-		mmuphys = PPN((*pg)->pa) |PTEWRITE|PTEUNCACHED|PTEVALID;
+		mmuphys = PPN((*pg)->pa)|PTEVALID;
+		if(s->type & SG_RONLY)
+			mmuphys |= PTERONLY;
+		else
+			mmuphys |= PTEWRITE;
+		if((s->type & SG_CACHED) == 0)
+			mmuphys |= PTEUNCACHED;
 		(*pg)->modref = PG_MOD|PG_REF;
 		break;
 	}
@@ -188,31 +214,109 @@ fixfault(Segment *s, ulong addr, int read, int doputmmu)
 	return 0;
 }
 
+/*
+ * Demand loads read around the faulting page: the pages after it
+ * come in with the same read and go into the image cache, where their
+ * own faults find them.  The window doubles while a segment's loads
+ * are sequential and halves when they are not.  Called with s->lk held.
+ */
+static int
+readaround(Segment *s, ulong soff)
+{
+	Page *pg;
+	ulong off;
+	int n;
+
+	if(soff == s->lastsoff+BY2PG)
+		s->ahead *= 2;
+	else
+		s->ahead /= 2;
+	if(s->ahead < Minahead)
+		s->ahead = Minahead;
+	if(s->ahead > Maxahead)
+		s->ahead = Maxahead;
+	s->lastsoff = soff;
+	if(palloc.freecount < swapalloc.headroom)
+		return 0;
+
+	/* stop at the end of the file or the first page already cached */
+	for(n = 0; n < s->ahead; n++) {
+		off = soff + (n+1)*BY2PG;
+		if(off >= s->flen)
+			break;
+		pg = lookpage(s->image, s->fstart+off);
+		if(pg != nil) {
+			putpage(pg);
+			break;
+		}
+	}
+	return n;
+}
+
+/* Cache the pages read around a demand load, n bytes at buf */
+static void
+cacheahead(Segment *s, Image *i, ulong daddr, ulong va, char *buf, int n)
+{
+	Page *pg;
+	KMap *k;
+	int len;
+
+	for(; n > 0; n -= BY2PG, buf += BY2PG, daddr += BY2PG, va += BY2PG) {
+		len = n < BY2PG ? n : BY2PG;
+		if(len < BY2PG && daddr+len != s->fstart+s->flen)
+			break;		/* short read */
+		if(palloc.freecount < swapalloc.headroom)
+			break;
+		pg = lookpage(i, daddr);
+		if(pg != nil) {
+			putpage(pg);
+			continue;
+		}
+		pg = newpage(0, 0, va);
+		k = kmap(pg);
+		memmove((void*)VA(k), buf, len);
+		if(len < BY2PG)
+			memset((char*)VA(k)+len, 0, BY2PG-len);
+		kunmap(k);
+		if(s->flushme)
+			memset(pg->cachectl, PG_TXTFLUSH, sizeof(pg->cachectl));
+		pg->daddr = daddr;
+		cachepage(pg, i);
+		putpage(pg);
+	}
+}
+
 void
 pio(Segment *s, ulong addr, ulong soff, Page **p)
 {
 	Page *new;
 	KMap *k;
 	Chan *c;
-	int n, ask;
-	char *kaddr;
+	int n, ask, ahead;
+	char *kaddr, *buf;
 	ulong daddr;
 	Page *loadrec;
+	Image *i;
 
 retry:
 	loadrec = *p;
+	ahead = 0;
+	i = nil;
 	if(loadrec == 0) {	/* from a text/data image */
 		daddr = s->fstart+soff;
 		new = lookpage(s->image, daddr);
 		if(new != nil) {
+			s->lastsoff = soff;
 			*p = new;
 			return;
 		}
 
 		c = s->image->c;
+		i = s->image;
+		ahead = readaround(s, soff);
 		ask = s->flen-soff;
-		if(ask > BY2PG)
-			ask = BY2PG;
+		if(ask > (ahead+1)*BY2PG)
+			ask = (ahead+1)*BY2PG;
 	}
 	else {			/* from a swap image */
 		daddr = swapaddr(loadrec);
@@ -231,23 +335,39 @@ retry:
 	new = newpage(0, 0, addr);
 	k = kmap(new);
 	kaddr = (char*)VA(k);
+	buf = nil;
+	if(ahead > 0)
+		buf = smalloc(ask);
 
 	while(waserror()) {
 		if(strcmp(up->errstr, Eintr) == 0)
 			continue;
 		kunmap(k);
 		putpage(new);
+		free(buf);
 		faulterror(Eioload, c, 0);
 	}
 
-	n = devtab[c->type]->read(c, kaddr, ask, daddr);
-	if(n != ask)
-		faulterror(Eioload, c, 0);
-	if(ask < BY2PG)
-		memset(kaddr+ask, 0, BY2PG-ask);
+	if(buf == nil) {
+		n = devtab[c->type]->read(c, kaddr, ask, daddr);
+		if(n != ask)
+			faulterror(Eioload, c, 0);
+		if(ask < BY2PG)
+			memset(kaddr+ask, 0, BY2PG-ask);
+	}
+	else {
+		n = devtab[c->type]->read(c, buf, ask, daddr);
+		if(n < BY2PG)
+			error(Eioload);
+		memmove(kaddr, buf, BY2PG);
+	}
 
 	poperror();
 	kunmap(k);
+	if(buf != nil) {
+		cacheahead(s, i, daddr+BY2PG, addr+BY2PG, buf+BY2PG, n-BY2PG);
+		free(buf);
+	}
 	qlock(&s->lk);
 	if(loadrec == 0) {	/* This is demand load */
 		/*
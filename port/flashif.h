@@ -14,6 +14,7 @@ struct Flashpart {
 	char*	name;
 	ulong	start;
 	ulong	end;
+	uchar*	mem;		/* copy in memory read instead of the flash */
 };
 
 enum {
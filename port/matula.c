@@ -0,0 +1,846 @@
+/*
+ * Matula numbers, the prime table they are built on, and the
+ * enumeration of rooted trees.
+ *
+ * This file is compiled into the kernel and, built with -DMATULAUSER,
+ * into user programs: matula-test checks it and matulabench times
+ * it, so both run the code the kernel runs.  It uses only what the
+ * kernel and libc have in common.
+ */
+
+#ifdef MATULAUSER
+#include <u.h>
+#include <libc.h>
+#else
+#include "u.h"
+#include "../port/lib.h"
+#include "mem.h"
+#include "dat.h"
+#include "fns.h"
+#endif
+#include "../port/matula.h"
+
+// Number of rooted trees with n nodes
+ulong a000081[MAXN + 1] = {
+    0, 1, 1, 2, 4, 9, 20, 48, 115, 286, 719, 1842, 4766, 12486, 32973, 87811,
+    235381, 634847,
+};
+
+/*
+ * Matula Number Functions
+ * 
+ * Matula numbers provide a bijection between rooted trees and natural numbers
+ * using prime factorization. This encoding allows trees to be uniquely represented
+ * as integers.
+ * 
+ * The mapping works as follows:
+ * - The empty tree (single node) maps to 1
+ * - A tree with children c1, c2, ..., cn maps to p(M(c1)) * p(M(c2)) * ... * p(M(cn))
+ *   where p(k) is the k-th prime number and M(t) is the Matula number of tree t
+ * 
+ * Examples from A000081:
+ * []              → 1 → becomes p(1) = 2
+ * [[]]            → 2 → becomes p(2) = 3
+ * [] []           → 1*1 → becomes 2^2 = 4
+ * [[[]]]          → 3 → becomes p(3) = 5
+ * [[] []]         → 2*1 → becomes 3*2 = 6
+ * [[],[]]         → 4 → becomes p(4) = 7
+ * [] [] []        → 1*1*1 → becomes 2^3 = 8
+ */
+
+/*
+ * Prime table.
+ *
+ * Primes are found on demand with a segmented sieve over the odd
+ * numbers: each segment is a bitset of Nsieveodds odds, crossed off
+ * by the primes already in the table and then by the segment's own
+ * primes while the table is still shorter than the square root of
+ * the segment.  Found primes are appended to chunks that never move,
+ * so nth_prime is a lock-free index once a prime has been published
+ * and only extending the table takes the qlock.
+ */
+enum {
+    Nprimechunk = 4096,           // Primes per table chunk
+    Nprimemax = 1<<20,            // Most primes the table will hold
+    Nsieveodds = 32768,           // Odd numbers per sieve segment
+};
+
+static struct {
+    QLock;                        // Held while sieving, which can be long
+    u32int *chunk[Nprimemax/Nprimechunk];
+    long n;                       // Primes published
+    uvlong next;                  // First odd not yet sieved
+    ulong segment[Nsieveodds/32]; // Sieve bitset, set = composite
+} primetab;
+
+#define PRIME(i)    (primetab.chunk[(i)/Nprimechunk][(i)%Nprimechunk])
+
+static void
+prime_append(u32int p)
+{
+    long n;
+
+    n = primetab.n;
+    if (primetab.chunk[n/Nprimechunk] == nil) {
+        primetab.chunk[n/Nprimechunk] = malloc(Nprimechunk*sizeof(u32int));
+        if (primetab.chunk[n/Nprimechunk] == nil)
+            return;
+    }
+    PRIME(n) = p;
+    coherence();
+    primetab.n = n + 1;
+}
+
+// Sieve the next segment; called with primetab locked
+static void
+prime_sieve_segment(void)
+{
+    uvlong lo, hi, q, m;
+    long i, x;
+
+    if (primetab.n == 0) {
+        prime_append(2);
+        primetab.next = 3;
+    }
+    lo = primetab.next;
+    hi = lo + 2*Nsieveodds;
+    memset(primetab.segment, 0, sizeof primetab.segment);
+
+    for (i = 1; i < primetab.n; i++) {
+        q = PRIME(i);
+        if (q*q >= hi)
+            break;
+        m = q*q;
+        if (m < lo) {
+            m = (lo + q - 1) / q * q;
+            if ((m & 1) == 0)
+                m += q;
+        }
+        for (x = (m - lo)/2; x < Nsieveodds; x += q)
+            primetab.segment[x/32] |= 1UL << (x%32);
+    }
+
+    for (x = 0; x < Nsieveodds; x++) {
+        if (primetab.segment[x/32] & (1UL << (x%32)))
+            continue;
+        q = lo + 2*x;
+        if (q*q < hi && q*q >= lo)
+            for (m = (q*q - lo)/2; m < Nsieveodds; m += q)
+                primetab.segment[m/32] |= 1UL << (m%32);
+        if (primetab.n == Nprimemax)
+            break;
+        prime_append(q);
+    }
+    primetab.next = hi;
+}
+
+// Grow the table until it holds n primes or reaches past value v
+static int
+prime_extend(long n, uvlong v)
+{
+    long had;
+
+    qlock(&primetab);
+    while ((primetab.n < n || primetab.next <= v) && primetab.n < Nprimemax) {
+        had = primetab.n;
+        prime_sieve_segment();
+        if (primetab.n == had)
+            break;  // Out of memory
+    }
+    qunlock(&primetab);
+    return primetab.n >= n;
+}
+
+// Get the n-th prime number (1-indexed: prime(1) = 2, prime(2) = 3, etc.)
+uvlong
+nth_prime(uvlong n)
+{
+    if (n < 1 || n > Nprimemax)
+        return 0;  // Out of range
+    if (n > primetab.n && !prime_extend(n, 0))
+        return 0;
+    return PRIME(n - 1);
+}
+
+// Find which prime a number is (inverse of nth_prime)
+// Returns n such that nth_prime(n) == p, or 0 if p is not prime
+int
+prime_index(uvlong p)
+{
+    long lo, hi, mid;
+
+    if (p < 2)
+        return 0;
+    if (primetab.next <= p)
+        prime_extend(0, p);
+    lo = 0;
+    hi = primetab.n;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (PRIME(mid) < p)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < primetab.n && PRIME(lo) == p)
+        return lo + 1;
+    return 0;
+}
+
+// Simple prime factorization for Matula number decoding
+// Returns the exponents of each prime factor
+void
+factorize(uvlong n, int *exponents, int max_primes)
+{
+    uvlong p;
+
+    for (int i = 0; i < max_primes; i++)
+        exponents[i] = 0;
+    
+    for (int i = 0; i < max_primes && n > 1; i++) {
+        p = nth_prime(i + 1);
+        if (p == 0)
+            break;
+        while (n % p == 0) {
+            exponents[i]++;
+            n /= p;
+        }
+    }
+}
+
+/*
+ * Matula encoding and decoding.
+ *
+ * parens_to_matula makes one pass over the string with an explicit
+ * stack holding the running product of each open node, so it never
+ * allocates or copies.  Decoding factors the number and decodes each
+ * child; decoded subtrees are kept in a direct-mapped cache shared
+ * by every caller, so the small subtrees that recur in every
+ * enumeration are decoded once.
+ */
+typedef struct MatulaSlot MatulaSlot;
+struct MatulaSlot {
+    uvlong matula;
+    char *parens;                 // Not NUL-terminated
+    int len;
+};
+
+static struct {
+    Lock;
+    MatulaSlot slot[Nmatulacache];
+    ulong hits;
+    ulong misses;
+} matula_cache;
+
+// Compute Matula number from parentheses notation; 0 if unbalanced or too large
+uvlong
+parens_to_matula(char *parens)
+{
+    uvlong stack[Nmatulastack];
+    uvlong v, p;
+    int sp;
+    char *s;
+
+    if (parens == nil || parens[0] == '\0')
+        return 1;  // Empty tree = 1
+
+    sp = 0;
+    for (s = parens; *s != '\0'; s++) {
+        switch (*s) {
+        case '(':
+            if (sp == Nmatulastack)
+                return 0;
+            stack[sp++] = 1;
+            break;
+        case ')':
+            if (sp == 0)
+                return 0;
+            v = stack[--sp];
+            if (sp == 0)
+                return v;  // Root closed; the rest is ignored
+            p = nth_prime(v);
+            if (p == 0 || stack[sp - 1] > ~0ULL / p)
+                return 0;  // Past the prime table or 64 bits
+            stack[sp - 1] *= p;
+            break;
+        }
+    }
+    return 0;  // Unbalanced
+}
+
+static int
+matula_cache_get(uvlong matula, char *buf, int len)
+{
+    MatulaSlot *ms;
+    int n;
+
+    n = -1;
+    ms = &matula_cache.slot[matula % Nmatulacache];
+    lock(&matula_cache);
+    if (ms->parens != nil && ms->matula == matula && ms->len <= len) {
+        memmove(buf, ms->parens, ms->len);
+        n = ms->len;
+        matula_cache.hits++;
+    } else
+        matula_cache.misses++;
+    unlock(&matula_cache);
+    return n;
+}
+
+static void
+matula_cache_put(uvlong matula, char *parens, int len)
+{
+    MatulaSlot *ms;
+    char *copy, *old;
+
+    if (len > Nmatulacachelen)
+        return;
+    copy = malloc(len);
+    if (copy == nil)
+        return;
+    memmove(copy, parens, len);
+    ms = &matula_cache.slot[matula % Nmatulacache];
+    lock(&matula_cache);
+    old = ms->parens;
+    ms->matula = matula;
+    ms->parens = copy;
+    ms->len = len;
+    unlock(&matula_cache);
+    free(old);
+}
+
+static int matula_decode(uvlong, char*, int);
+
+// Decode matula into buf through the cache; length or -1
+int
+matula_subtree(uvlong matula, char *buf, int len)
+{
+    int n;
+
+    n = matula_cache_get(matula, buf, len);
+    if (n >= 0)
+        return n;
+    n = matula_decode(matula, buf, len);
+    if (n > 0)
+        matula_cache_put(matula, buf, n);
+    return n;
+}
+
+/*
+ * Write the children of matula into buf, in increasing order of their
+ * Matula numbers, assuming the primes before the first-th have been
+ * divided out.  Returns the length written or -1 if buf is too small
+ * or a factor is beyond the prime table.
+ */
+int
+matula_factors(uvlong matula, int first, char *buf, int len)
+{
+    uvlong p;
+    int i, k, n;
+
+    n = 0;
+    for (i = first; matula > 1; i++) {
+        p = nth_prime(i);
+        if (p == 0)
+            return -1;
+        if (p > matula / p) {
+            // What remains is itself prime
+            i = prime_index(matula);
+            if (i == 0)
+                return -1;
+            k = matula_subtree(i, buf + n, len - n);
+            if (k < 0)
+                return -1;
+            n += k;
+            break;
+        }
+        while (matula % p == 0) {
+            matula /= p;
+            k = matula_subtree(i, buf + n, len - n);
+            if (k < 0)
+                return -1;
+            n += k;
+        }
+    }
+    return n;
+}
+
+/*
+ * Write the canonical parens string for matula into buf.  Returns
+ * the length written, without a NUL, or -1 on failure.
+ */
+static int
+matula_decode(uvlong matula, char *buf, int len)
+{
+    int n;
+
+    if (matula == 0 || len < 2)
+        return -1;
+    n = matula_factors(matula, 1, buf + 1, len - 2);
+    if (n < 0)
+        return -1;
+    buf[0] = '(';
+    buf[n + 1] = ')';
+    return n + 2;
+}
+
+// Convert Matula number to parentheses notation; nil if it can't be decoded
+char*
+matula_to_parens(uvlong matula)
+{
+    char *buf, *r;
+    int n;
+
+    buf = malloc(Nmatulamax);
+    if (buf == nil)
+        return nil;
+    n = matula_subtree(matula, buf, Nmatulamax - 1);
+    if (n < 0) {
+        free(buf);
+        return nil;
+    }
+    buf[n] = '\0';
+    r = realloc(buf, n + 1);
+    return r != nil ? r : buf;
+}
+
+/*
+ * Multi-precision Matula numbers.
+ *
+ * Every node below the root has its Matula number used as a prime
+ * index, so only the root's product can outgrow a uvlong while the
+ * tree is still encodable: a root with many children overflows long
+ * before any subtree does.  MatulaBig is a fixed array of 32-bit
+ * limbs, enough for the widest ESN state, and the root's product
+ * moves into one only once it no longer fits.  Decoding removes the
+ * small primes in batches: one pass over the limbs reduces the number
+ * modulo the product of a run of primes, and a remainder per prime
+ * then says which of them divide.
+ */
+void
+matula_big_set(MatulaBig *b, uvlong v)
+{
+    b->n = 0;
+    while (v != 0) {
+        b->limb[b->n++] = v;
+        v >>= 32;
+    }
+}
+
+// b *= m; -1 if the product doesn't fit
+int
+matula_big_mul(MatulaBig *b, u32int m)
+{
+    uvlong t;
+    int i;
+
+    t = 0;
+    for (i = 0; i < b->n; i++) {
+        t += (uvlong)b->limb[i] * m;
+        b->limb[i] = t;
+        t >>= 32;
+    }
+    if (t != 0) {
+        if (b->n == Nmatulalimbs)
+            return -1;
+        b->limb[b->n++] = t;
+    }
+    return 0;
+}
+
+// Remainder of b / d; the quotient goes to q unless q is nil (q may be b)
+u32int
+matula_big_div(MatulaBig *b, u32int d, MatulaBig *q)
+{
+    uvlong r;
+    int i, n;
+
+    r = 0;
+    n = b->n;
+    for (i = n - 1; i >= 0; i--) {
+        r = r << 32 | b->limb[i];
+        if (q != nil)
+            q->limb[i] = r / d;
+        r %= d;
+    }
+    if (q != nil) {
+        while (n > 0 && q->limb[n - 1] == 0)
+            n--;
+        q->n = n;
+    }
+    return r;
+}
+
+// 64-bit digest of a Matula number, equal to it when it fits
+uvlong
+matula_big_hash(MatulaBig *b)
+{
+    uvlong h;
+    int i;
+
+    if (b->n <= 2)
+        return b->n == 0 ? 0 : b->limb[0] | (b->n == 2 ? (uvlong)b->limb[1] << 32 : 0);
+    h = 0xcbf29ce484222325ULL;
+    for (i = 0; i < b->n; i++) {
+        h ^= b->limb[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// Decimal form of b, malloced
+char*
+matula_big_fmt(MatulaBig *b)
+{
+    MatulaBig q;
+    char *buf, *p, *e, t;
+
+    buf = malloc(Nmatulalimbs*10 + 1);
+    if (buf == nil)
+        return nil;
+    q = *b;
+    p = buf;
+    do
+        *p++ = '0' + matula_big_div(&q, 10, &q);
+    while (q.n > 0);
+    *p = '\0';
+    for (e = p - 1, p = buf; p < e; p++, e--) {
+        t = *p;
+        *p = *e;
+        *e = t;
+    }
+    return buf;
+}
+
+/*
+ * Matula number of a tree of any width.  Returns nil if the string
+ * is unbalanced, a subtree is beyond the prime table, or the root's
+ * product overflows a MatulaBig.  The result is malloced.
+ */
+MatulaBig*
+parens_to_matula_big(char *parens)
+{
+    uvlong stack[Nmatulastack];
+    uvlong v, p;
+    MatulaBig *root;
+    int sp;
+    char *s;
+
+    root = malloc(sizeof(MatulaBig));
+    if (root == nil)
+        return nil;
+    root->n = 0;
+    if (parens == nil || parens[0] == '\0') {
+        matula_big_set(root, 1);
+        return root;
+    }
+
+    sp = 0;
+    for (s = parens; *s != '\0'; s++) {
+        switch (*s) {
+        case '(':
+            if (sp == Nmatulastack)
+                goto bad;
+            stack[sp++] = 1;
+            break;
+        case ')':
+            if (sp == 0)
+                goto bad;
+            v = stack[--sp];
+            if (sp == 0) {
+                if (root->n == 0)
+                    matula_big_set(root, v);
+                return root;
+            }
+            p = nth_prime(v);
+            if (p == 0)
+                goto bad;
+            if (sp == 1 && root->n != 0) {
+                // The root's product already spilled
+                if (matula_big_mul(root, p) < 0)
+                    goto bad;
+            } else if (stack[sp - 1] > ~0ULL / p) {
+                if (sp > 1)
+                    goto bad;  // Too large to index a prime
+                matula_big_set(root, stack[0]);
+                if (matula_big_mul(root, p) < 0)
+                    goto bad;
+            } else
+                stack[sp - 1] *= p;
+            break;
+        }
+    }
+bad:
+    free(root);
+    return nil;
+}
+
+// Convert a Matula number of any size to parentheses notation; nil on failure
+char*
+matula_big_to_parens(MatulaBig *matula)
+{
+    MatulaBig n;
+    uvlong p[Nmatulabatch], prod;
+    u32int r;
+    char *buf, *s;
+    int i, j, k, nb, len;
+
+    if (matula->n <= 2)
+        return matula_to_parens(matula_big_hash(matula));
+    buf = malloc(Nmatulamax);
+    if (buf == nil)
+        return nil;
+    n = *matula;
+    len = 1;
+    for (i = 1; n.n > 2; i += nb) {
+        // A run of primes whose product fits a limb
+        prod = 1;
+        for (nb = 0; nb < Nmatulabatch; nb++) {
+            p[nb] = nth_prime(i + nb);
+            if (p[nb] == 0 || prod > 0xFFFFFFFFULL / p[nb])
+                break;
+            prod *= p[nb];
+        }
+        if (nb == 0)
+            goto bad;  // A factor beyond the prime table
+        r = matula_big_div(&n, prod, nil);
+        for (j = 0; j < nb; j++) {
+            if (r % p[j] != 0)
+                continue;
+            while (matula_big_div(&n, p[j], nil) == 0) {
+                matula_big_div(&n, p[j], &n);
+                k = matula_subtree(i + j, buf + len, Nmatulamax - len - 2);
+                if (k < 0)
+                    goto bad;
+                len += k;
+            }
+        }
+    }
+    k = matula_factors(matula_big_hash(&n), i, buf + len, Nmatulamax - len - 2);
+    if (k < 0)
+        goto bad;
+    len += k;
+    buf[0] = '(';
+    buf[len++] = ')';
+    buf[len] = '\0';
+    s = realloc(buf, len + 1);
+    return s != nil ? s : buf;
+bad:
+    free(buf);
+    return nil;
+}
+
+/*
+ * Matula shell tree.  Every positive integer is the Matula number
+ * of exactly one rooted tree, and the children of tree m are the
+ * trees k for which the k'th prime divides m.  The device's
+ * rooted/m directory is synthesized from these: walking from m to
+ * child k is one prime lookup and a division, so nothing is stored
+ * per shell and a walk costs O(depth).
+ */
+
+// Whether k names a child of m
+int
+matula_has_child(uvlong m, uvlong k)
+{
+    uvlong p;
+    
+    if (m == 0 || k == 0)
+        return 0;
+    p = nth_prime(k);
+    return p != 0 && m % p == 0;
+}
+
+/*
+ * The Matula number of the s'th distinct child of m, smallest
+ * first, or 0 if there is none or its prime is beyond the prime
+ * table.
+ */
+uvlong
+matula_child(uvlong m, int s)
+{
+    uvlong p, i;
+    
+    for (i = 1; m > 1; i++) {
+        p = nth_prime(i);
+        if (p == 0)
+            return 0;
+        if (p * p > m) {
+            // What is left is a prime
+            if (s > 0)
+                return 0;
+            return prime_index(m);
+        }
+        if (m % p != 0)
+            continue;
+        if (s-- == 0)
+            return i;
+        while (m % p == 0)
+            m /= p;
+    }
+    return 0;
+}
+
+char*
+matula_parens(uvlong m)
+{
+    return matula_to_parens(m);
+}
+
+void
+matula_cache_stats(ulong *hits, ulong *misses)
+{
+    *hits = matula_cache.hits;
+    *misses = matula_cache.misses;
+}
+
+void
+prime_table_stats(long *n, uvlong *next)
+{
+    *n = primetab.n;
+    *next = primetab.next;
+}
+
+/*
+ * Rooted Tree Generation Functions (A000081)
+ * 
+ * A tree of n nodes is a root over a multiset of smaller trees whose
+ * sizes sum to n-1.  tree_iter_next walks those multisets in
+ * non-increasing (size, index) order with an explicit stack, the
+ * same order the old recursive assembly produced, so it needs only
+ * the levels below n and emits the trees of size n one at a time.
+ */
+
+// Tree k of the n-node level, in the encoding tree_iter_next returns
+tree
+tree_level_get(uvlong **level, uint n, ulong k)
+{
+    uvlong *l, v;
+    ulong o;
+    int b, w;
+
+    if (n == 1)
+        return 1;
+    w = 2 * n - 2;
+    o = k * w;
+    l = level[n] + o / 64;
+    b = o % 64;
+    v = l[0] >> b;
+    if (b + w > 64)
+        v |= l[1] << (64 - b);
+    return 1ULL | (v & ((1ULL << w) - 1)) << 1;
+}
+
+// Store t as tree k of the n-node level l, which starts out zeroed
+void
+tree_level_put(uvlong *l, uint n, ulong k, tree t)
+{
+    uvlong v;
+    ulong o;
+    int b, w;
+
+    if (n == 1)
+        return;
+    w = 2 * n - 2;
+    v = (t >> 1) & ((1ULL << w) - 1);
+    o = k * w;
+    b = o % 64;
+    l[o / 64] |= v << b;
+    if (b + w > 64)
+        l[o / 64 + 1] |= v >> (64 - b);
+}
+
+// Words to allocate for the n-node level; a spare lets tree_level_get always read two
+ulong
+tree_level_words(uint n)
+{
+    return a000081[n] * (2 * n - 2) / 64 + 2;
+}
+
+// Iterate over the trees of n nodes, built from the smaller levels in level
+void
+tree_iter_init(TreeIter *it, uint n, uvlong **level)
+{
+    it->level = level;
+    it->n = n;
+    it->sp = 0;
+    it->done = 0;
+    it->t = 0;
+    it->sl = n - 1;
+    it->pos = 0;
+    it->rem = n - 1;
+}
+
+// Undo the last placement and move on to the next candidate
+static int
+tree_iter_pop(TreeIter *it)
+{
+    if (it->sp == 0)
+        return 0;
+    it->sp--;
+    it->t = it->stack[it->sp].t;
+    it->sl = it->stack[it->sp].sl;
+    it->pos = it->stack[it->sp].pos + 1;
+    it->rem = it->stack[it->sp].rem;
+    return 1;
+}
+
+// Next tree of it->n nodes, stored with its root bit as (1 | t<<1)
+int
+tree_iter_next(TreeIter *it, tree *out)
+{
+    if (it->done)
+        return 0;
+    if (it->n == 1) {
+        it->done = 1;
+        *out = 1;
+        return 1;
+    }
+    for (;;) {
+        if (it->rem == 0) {
+            *out = 1ULL | (it->t << 1);
+            if (!tree_iter_pop(it))
+                it->done = 1;
+            return 1;
+        }
+        if (it->sl > it->rem) {
+            it->sl = it->rem;
+            it->pos = 0;
+        } else if (it->pos >= a000081[it->sl]) {
+            if (--it->sl == 0) {
+                if (!tree_iter_pop(it)) {
+                    it->done = 1;
+                    return 0;
+                }
+                continue;
+            }
+            it->pos = 0;
+        }
+        it->stack[it->sp].t = it->t;
+        it->stack[it->sp].sl = it->sl;
+        it->stack[it->sp].pos = it->pos;
+        it->stack[it->sp].rem = it->rem;
+        it->sp++;
+        it->t = (it->t << (2 * it->sl)) | tree_level_get(it->level, it->sl, it->pos);
+        it->rem -= it->sl;
+    }
+}
+
+/*
+ * Write the parens of tree t, of len nodes, in the manner of seprint:
+ * stop at e, always leave buf terminated and return the end.
+ */
+char*
+tree_parens_seprint(char *buf, char *e, tree t, uint len)
+{
+    uint i;
+
+    if (buf >= e)
+        return buf;
+    for (i = 0; i < 2 * len && buf < e - 1; i++) {
+        *buf++ = (t & 1) ? '(' : ')';
+        t >>= 1;
+    }
+    *buf = '\0';
+    return buf;
+}
@@ -0,0 +1,84 @@
+/*
+ * Matula numbers and rooted tree enumeration, shared between the
+ * kernel and user programs; see matula.c.  A user program includes
+ * <u.h> and <libc.h> first and is built with -DMATULAUSER.
+ */
+
+typedef uvlong tree;		/* parens less the root's pair, bit i set for '(' */
+typedef struct MatulaBig MatulaBig;
+typedef struct TreeIter TreeIter;
+
+#ifdef MATULAUSER
+/* the user programs built on matula.c are single-threaded */
+#define coherence()
+#endif
+
+#define MAXN	17		/* largest tree size enumerated */
+
+enum {
+	Nmatulastack	= 64,		/* deepest tree parens_to_matula accepts */
+	Nmatulacache	= 1024,		/* decode cache slots */
+	Nmatulacachelen	= 256,		/* longest string kept in the cache */
+	Nmatulamax	= 4096,		/* longest string matula_to_parens builds */
+
+	Nmatulalimbs	= 96,		/* 3072 bits */
+	Nmatulabatch	= 8,		/* most primes reduced in one pass */
+};
+
+struct MatulaBig {
+	int	n;			/* limbs in use; limb[n-1] != 0 */
+	u32int	limb[Nmatulalimbs];	/* least significant first */
+};
+
+/* enumeration state for the trees of one size */
+struct TreeIter {
+	uvlong	**level;		/* level[s] holds the trees of s < n nodes */
+	uint	n;
+	int	sp;
+	int	done;
+	tree	t;			/* subtrees placed so far */
+	uint	sl;			/* size of the subtree being tried */
+	uint	pos;			/* index of it within level[sl] */
+	uint	rem;			/* nodes still to place */
+	struct {
+		tree	t;
+		uint	sl, pos, rem;
+	} stack[MAXN];			/* every push places at least one node */
+};
+
+extern ulong	a000081[MAXN + 1];	/* rooted trees with n nodes */
+
+/* primes */
+uvlong		nth_prime(uvlong);
+int		prime_index(uvlong);
+void		factorize(uvlong, int*, int);
+void		prime_table_stats(long*, uvlong*);
+
+/* Matula numbers */
+uvlong		parens_to_matula(char*);
+char*		matula_to_parens(uvlong);
+int		matula_subtree(uvlong, char*, int);
+int		matula_factors(uvlong, int, char*, int);
+void		matula_cache_stats(ulong*, ulong*);
+
+/* Matula numbers beyond 64 bits */
+void		matula_big_set(MatulaBig*, uvlong);
+int		matula_big_mul(MatulaBig*, u32int);
+u32int		matula_big_div(MatulaBig*, u32int, MatulaBig*);
+uvlong		matula_big_hash(MatulaBig*);
+char*		matula_big_fmt(MatulaBig*);
+MatulaBig*	parens_to_matula_big(char*);
+char*		matula_big_to_parens(MatulaBig*);
+
+/* Matula shell tree */
+int		matula_has_child(uvlong, uvlong);
+uvlong		matula_child(uvlong, int);
+char*		matula_parens(uvlong);
+
+/* rooted tree levels */
+tree		tree_level_get(uvlong**, uint, ulong);
+void		tree_level_put(uvlong*, uint, ulong, tree);
+ulong		tree_level_words(uint);
+void		tree_iter_init(TreeIter*, uint, uvlong**);
+int		tree_iter_next(TreeIter*, tree*);
+char*		tree_parens_seprint(char*, char*, tree, uint);
@@ -80,6 +80,8 @@ struct Netif
 	int	minmtu;
 	int 	maxmtu;
 	int	mtu;
+	int	tso;			/* largest tcp super-frame it cuts up, 0 if none */
+	int	csum;			/* sums tcp and udp over ipv4 it sends */
 	uchar	addr[Nmaxaddr];
 	uchar	bcast[Nmaxaddr];
 	Netaddr	*maddr;			/* known multicast addresses */
@@ -5,10 +5,55 @@
 #include	"fns.h"
 #include	"../port/error.h"
 
-#define	pghash(daddr)	palloc.hash[(daddr>>PGSHIFT)&(PGHSIZE-1)]
+#define	pghash(i, daddr)	(&palloc.hash[((daddr)>>PGSHIFT ^ (uintptr)(i)/sizeof(Image)) & palloc.hashmask])
 
 struct	Palloc palloc;
 
+/*
+ * Each processor keeps a few free pages with no image, so most
+ * allocations and frees of anonymous pages never take palloc.
+ * The cache is refilled from the head of the free list and drained
+ * back to it Pcbatch pages at a time, and emptied whenever an
+ * allocation has to wait for memory.  Cached pages are neither on
+ * the free list nor counted in palloc.freecount.
+ */
+enum
+{
+	Npcache	= 32,
+	Pcbatch	= 8,
+};
+
+typedef struct Pcache Pcache;
+struct Pcache
+{
+	Lock;
+	int	n;
+	Page	*pg[Npcache];
+};
+
+static	Pcache	pcache[MAXMACH];
+
+/*
+ * Pages zeroed ahead of need by a kproc at the lowest fixed
+ * priority, so it runs only on processors with nothing else to do.
+ * newpage hands them out when asked for a clear page.  Like the
+ * caches above they are off the free list, linked through next.
+ */
+enum
+{
+	Nzero	= 256,		/* zeroed pages to keep */
+	Zlow	= Nzero/2,	/* refill below this */
+};
+
+static struct
+{
+	Lock;
+	Page	*head;
+	int	n;
+	int	started;
+	Rendez	r;
+} zpool;
+
 void
 pageinit(void)
 {
@@ -26,6 +71,14 @@ pageinit(void)
 	if(palloc.pages == 0)
 		panic("pageinit");
 
+	/* a hash bucket for every 8 pages, each with its own lock */
+	for(m = PGHSIZE; m < np/8; m <<= 1)
+		;
+	palloc.hash = xalloc(m*sizeof(Pghash));
+	if(palloc.hash == 0)
+		panic("pageinit: hash");
+	palloc.hashmask = m - 1;
+
 	color = 0;
 	palloc.head = palloc.pages;
 	p = palloc.head;
@@ -67,7 +120,7 @@ pageinit(void)
 static void
 pageunchain(Page *p)
 {
-	if(canlock(&palloc))
+	if(tcanlock(&palloc))
 		panic("pageunchain (palloc %p)", &palloc);
 	if(p->prev)
 		p->prev->next = p->next;
@@ -84,7 +137,7 @@ pageunchain(Page *p)
 void
 pagechaintail(Page *p)
 {
-	if(canlock(&palloc))
+	if(tcanlock(&palloc))
 		panic("pagechaintail");
 	if(palloc.tail) {
 		p->prev = palloc.tail;
@@ -102,7 +155,7 @@ pagechaintail(Page *p)
 void
 pagechainhead(Page *p)
 {
-	if(canlock(&palloc))
+	if(tcanlock(&palloc))
 		panic("pagechainhead");
 	if(palloc.head) {
 		p->next = palloc.head;
@@ -117,16 +170,259 @@ pagechainhead(Page *p)
 	palloc.freecount++;
 }
 
+static Page*
+pcacheget(int color)
+{
+	Pcache *pc;
+	Page *p;
+	int i;
+
+	pc = &pcache[m->machno];
+	lock(pc);
+	for(i = pc->n-1; i >= 0; i--)
+		if(pc->pg[i]->color == color) {
+			p = pc->pg[i];
+			pc->pg[i] = pc->pg[--pc->n];
+			unlock(pc);
+			return p;
+		}
+	unlock(pc);
+	return nil;
+}
+
+/*
+ * Unchain the head of the free list if it has no image, else nil.
+ * Called with palloc locked.  A locked page may be about to gain
+ * an image (see duppage), so it is left alone.
+ */
+static Page*
+headblank(void)
+{
+	Page *p;
+	Image *i;
+
+	p = palloc.head;
+	if(p == nil || !canlock(p))
+		return nil;
+	i = p->image;
+	unlock(p);
+	if(i != nil)
+		return nil;
+	pageunchain(p);
+	return p;
+}
+
+/* Move a batch of free pages to this processor's cache; palloc is locked */
+static void
+pcachefill(void)
+{
+	Pcache *pc;
+	Page *p;
+
+	pc = &pcache[m->machno];
+	lock(pc);
+	while(pc->n < Pcbatch && palloc.freecount > swapalloc.highwater+Pcbatch) {
+		if((p = headblank()) == nil)
+			break;
+		pc->pg[pc->n++] = p;
+	}
+	unlock(pc);
+}
+
+static void
+pcachereturn(Page **pg, int n)
+{
+	tlock(&palloc);
+	while(n > 0)
+		pagechainhead(pg[--n]);
+	if(palloc.r.p != 0)
+		wakeup(&palloc.r);
+	tunlock(&palloc);
+}
+
+/*
+ * Keep a freed page with no image on this processor, draining
+ * the oldest batch if the cache is full.  Returns 0 if memory is
+ * short and the page belongs on the free list.
+ */
+static int
+pcacheput(Page *p)
+{
+	Pcache *pc;
+	Page *drain[Pcbatch];
+	int n;
+
+	if(palloc.r.p != 0 || palloc.freecount < swapalloc.highwater)
+		return 0;
+	pc = &pcache[m->machno];
+	n = 0;
+	lock(pc);
+	if(pc->n == Npcache) {
+		n = Pcbatch;
+		memmove(drain, pc->pg, n*sizeof drain[0]);
+		pc->n -= n;
+		memmove(pc->pg, pc->pg+n, pc->n*sizeof pc->pg[0]);
+	}
+	pc->pg[pc->n++] = p;
+	unlock(pc);
+	if(n > 0)
+		pcachereturn(drain, n);
+	return 1;
+}
+
+/* Give every processor's cached pages back; returns how many */
+static int
+pcacheflush(void)
+{
+	Pcache *pc;
+	Page *pg[Npcache];
+	int i, n, tot;
+
+	tot = 0;
+	for(i = 0; i < conf.nmach; i++) {
+		pc = &pcache[i];
+		lock(pc);
+		n = pc->n;
+		memmove(pg, pc->pg, n*sizeof pg[0]);
+		pc->n = 0;
+		unlock(pc);
+		if(n > 0)
+			pcachereturn(pg, n);
+		tot += n;
+	}
+	return tot;
+}
+
+static int
+zeroneeded(void*)
+{
+	return zpool.n < Zlow && palloc.freecount > swapalloc.headroom;
+}
+
+static void
+zeroproc(void*)
+{
+	Page *p;
+	KMap *k;
+
+	procpriority(up, 0, 1);
+	for(;;) {
+		up->psstate = "Idle";
+		sleep(&zpool.r, zeroneeded, 0);
+		up->psstate = "Zero";
+		while(zpool.n < Nzero) {
+			p = nil;
+			tlock(&palloc);
+			if(palloc.freecount > swapalloc.headroom)
+				p = headblank();
+			tunlock(&palloc);
+			if(p == nil)
+				break;
+
+			k = kmap(p);
+			memset((void*)VA(k), 0, BY2PG);
+			kunmap(k);
+
+			lock(&zpool);
+			p->next = zpool.head;
+			zpool.head = p;
+			zpool.n++;
+			unlock(&zpool);
+		}
+	}
+}
+
+/* A zeroed page of the given colour, if the pool has one */
+static Page*
+zeroget(int color)
+{
+	Page *p, **l;
+	int start;
+
+	lock(&zpool);
+	for(l = &zpool.head; (p = *l) != nil; l = &p->next)
+		if(p->color == color) {
+			*l = p->next;
+			p->next = nil;
+			zpool.n--;
+			break;
+		}
+	start = !zpool.started && up != nil;
+	if(start)
+		zpool.started = 1;
+	else if(zpool.n < Zlow)
+		wakeup(&zpool.r);
+	unlock(&zpool);
+	if(start)
+		kproc("pagezero", zeroproc, 0);
+	return p;
+}
+
+/* Give the zeroed pages back to the free list; returns how many */
+static int
+zeroflush(void)
+{
+	Page *p, *l;
+	int n;
+
+	lock(&zpool);
+	l = zpool.head;
+	n = zpool.n;
+	zpool.head = nil;
+	zpool.n = 0;
+	unlock(&zpool);
+	if(n == 0)
+		return 0;
+	tlock(&palloc);
+	while((p = l) != nil) {
+		l = p->next;
+		pagechainhead(p);
+	}
+	if(palloc.r.p != 0)
+		wakeup(&palloc.r);
+	tunlock(&palloc);
+	return n;
+}
+
+static void
+pageclaim(Page *p, ulong va, uchar ct)	/* Always called with a locked page */
+{
+	int i;
+
+	if(p->ref != 0)
+		panic("newpage: p->ref %d != 0", p->ref);
+
+	uncachepage(p);
+	p->ref++;
+	p->va = va;
+	p->modref = 0;
+	for(i = 0; i < MAXMACH; i++)
+		p->cachectl[i] = ct;
+}
+
 Page*
 newpage(int clear, Segment **s, ulong va)
 {
 	Page *p;
 	KMap *k;
 	uchar ct;
-	int i, hw, dontalloc, color;
+	int hw, dontalloc, color;
 
-	lock(&palloc);
 	color = getpgcolor(va);
+	if(palloc.freecount > swapalloc.highwater) {
+		p = nil;
+		if(clear && (p = zeroget(color)) != nil)
+			clear = 0;
+		if(p != nil || (p = pcacheget(color)) != nil) {
+			/* no image, so nothing else can find it */
+			lock(p);
+			pageclaim(p, va, PG_NOFLUSH);
+			unlock(p);
+			goto done;
+		}
+	}
+
+	tlock(&palloc);
 	hw = swapalloc.highwater;
 	for(;;) {
 		if(palloc.freecount > hw)
@@ -134,7 +430,11 @@ newpage(int clear, Segment **s, ulong va)
 		if(up->kp && palloc.freecount > 0)
 			break;
 
-		unlock(&palloc);
+		tunlock(&palloc);
+		if(pcacheflush() + zeroflush() > 0) {
+			tlock(&palloc);
+			continue;
+		}
 		dontalloc = 0;
 		if(s && *s) {
 			qunlock(&((*s)->lk));
@@ -162,7 +462,7 @@ newpage(int clear, Segment **s, ulong va)
 		if(dontalloc)
 			return 0;
 
-		lock(&palloc);
+		tlock(&palloc);
 	}
 
 	/* First try for our colour */
@@ -178,20 +478,14 @@ newpage(int clear, Segment **s, ulong va)
 	}
 
 	pageunchain(p);
+	pcachefill();
 
 	lock(p);
-	if(p->ref != 0)
-		panic("newpage: p->ref %d != 0", p->ref);
-
-	uncachepage(p);
-	p->ref++;
-	p->va = va;
-	p->modref = 0;
-	for(i = 0; i < MAXMACH; i++)
-		p->cachectl[i] = ct;
+	pageclaim(p, va, ct);
 	unlock(p);
-	unlock(&palloc);
+	tunlock(&palloc);
 
+done:
 	if(clear) {
 		k = kmap(p);
 		memset((void*)VA(k), 0, BY2PG);
@@ -215,7 +509,31 @@ putpage(Page *p)
 		return;
 	}
 
-	lock(&palloc);
+	/*
+	 * Only the last reference to a page with an image needs
+	 * palloc, since lookpage can still find the page by it.
+	 */
+	lock(p);
+	if(p->ref == 0)
+		panic("putpage");
+	if(p->ref > 1 || p->image == nil) {
+		if(--p->ref > 0) {
+			unlock(p);
+			return;
+		}
+		unlock(p);
+		if(pcacheput(p))
+			return;
+		tlock(&palloc);
+		pagechainhead(p);
+		if(palloc.r.p != 0)
+			wakeup(&palloc.r);
+		tunlock(&palloc);
+		return;
+	}
+	unlock(p);
+
+	tlock(&palloc);
 	lock(p);
 
 	if(p->ref == 0)
@@ -223,7 +541,7 @@ putpage(Page *p)
 
 	if(--p->ref > 0) {
 		unlock(p);
-		unlock(&palloc);
+		tunlock(&palloc);
 		return;
 	}
 
@@ -236,7 +554,7 @@ putpage(Page *p)
 		wakeup(&palloc.r);
 
 	unlock(p);
-	unlock(&palloc);
+	tunlock(&palloc);
 }
 
 Page*
@@ -244,10 +562,10 @@ auxpage(void)
 {
 	Page *p;
 
-	lock(&palloc);
+	tlock(&palloc);
 	p = palloc.head;
 	if(palloc.freecount < swapalloc.highwater) {
-		unlock(&palloc);
+		tunlock(&palloc);
 		return 0;
 	}
 	pageunchain(p);
@@ -258,7 +576,7 @@ auxpage(void)
 	p->ref++;
 	uncachepage(p);
 	unlock(p);
-	unlock(&palloc);
+	tunlock(&palloc);
 
 	return p;
 }
@@ -291,11 +609,11 @@ retry:
 
 	/*
 	 *  normal lock ordering is to call
-	 *  lock(&palloc) before lock(p).
+	 *  tlock(&palloc) before lock(p).
 	 *  To avoid deadlock, we have to drop
 	 *  our locks and try again.
 	 */
-	if(!canlock(&palloc)){
+	if(!tcanlock(&palloc)){
 		unlock(p);
 		if(up)
 			sched();
@@ -305,7 +623,7 @@ retry:
 
 	/* No freelist cache when memory is very low */
 	if(palloc.freecount < swapalloc.highwater) {
-		unlock(&palloc);
+		tunlock(&palloc);
 		uncachepage(p);
 		return 1;
 	}
@@ -317,7 +635,7 @@ retry:
 
 	/* No page of the correct color */
 	if(np == 0) {
-		unlock(&palloc);
+		tunlock(&palloc);
 		uncachepage(p);
 		return 1;
 	}
@@ -336,7 +654,7 @@ retry:
 * once they finally lock(np).
 */
 	lock(np);
-	unlock(&palloc);
+	tunlock(&palloc);
 
 	/* Cache the new version */
 	uncachepage(np);
@@ -366,12 +684,14 @@ void
 uncachepage(Page *p)			/* Always called with a locked page */
 {
 	Page **l, *f;
+	Pghash *h;
 
 	if(p->image == 0)
 		return;
 
-	lock(&palloc.hashlock);
-	l = &pghash(p->daddr);
+	h = pghash(p->image, p->daddr);
+	lock(h);
+	l = &h->head;
 	for(f = *l; f; f = f->hash) {
 		if(f == p) {
 			*l = p->hash;
@@ -379,7 +699,7 @@ uncachepage(Page *p)			/* Always called with a locked page */
 		}
 		l = &f->hash;
 	}
-	unlock(&palloc.hashlock);
+	unlock(h);
 	putimage(p->image);
 	p->image = 0;
 	p->daddr = 0;
@@ -388,7 +708,7 @@ uncachepage(Page *p)			/* Always called with a locked page */
 void
 cachepage(Page *p, Image *i)
 {
-	Page **l;
+	Pghash *h;
 
 	/* If this ever happens it should be fixed by calling
 	 * uncachepage instead of panic. I think there is a race
@@ -399,21 +719,23 @@ cachepage(Page *p, Image *i)
 		panic("cachepage");
 
 	incref(i);
-	lock(&palloc.hashlock);
+	h = pghash(i, p->daddr);
+	lock(h);
 	p->image = i;
-	l = &pghash(p->daddr);
-	p->hash = *l;
-	*l = p;
-	unlock(&palloc.hashlock);
+	p->hash = h->head;
+	h->head = p;
+	unlock(h);
 }
 
 void
 cachedel(Image *i, ulong daddr)
 {
 	Page *f, **l;
+	Pghash *h;
 
-	lock(&palloc.hashlock);
-	l = &pghash(daddr);
+	h = pghash(i, daddr);
+	lock(h);
+	l = &h->head;
 	for(f = *l; f; f = f->hash) {
 		if(f->image == i && f->daddr == daddr) {
 			lock(f);
@@ -428,37 +750,53 @@ cachedel(Image *i, ulong daddr)
 		}
 		l = &f->hash;
 	}
-	unlock(&palloc.hashlock);
+	unlock(h);
 }
 
+/*
+ * A hit on a page someone is using only takes the page's lock;
+ * palloc is needed only to take a free page off the free list.
+ */
 Page *
 lookpage(Image *i, ulong daddr)
 {
 	Page *f;
+	Pghash *h;
 
-	lock(&palloc.hashlock);
-	for(f = pghash(daddr); f; f = f->hash) {
-		if(f->image == i && f->daddr == daddr) {
-			unlock(&palloc.hashlock);
+	h = pghash(i, daddr);
+	lock(h);
+	for(f = h->head; f; f = f->hash)
+		if(f->image == i && f->daddr == daddr)
+			break;
+	unlock(h);
+	if(f == nil)
+		return 0;
 
-			lock(&palloc);
-			lock(f);
-			if(f->image != i || f->daddr != daddr) {
-				unlock(f);
-				unlock(&palloc);
-				return 0;
-			}
-			if(++f->ref == 1)
-				pageunchain(f);
-			unlock(&palloc);
-			unlock(f);
+	lock(f);
+	if(f->image != i || f->daddr != daddr) {
+		unlock(f);
+		return 0;
+	}
+	if(f->ref > 0) {
+		f->ref++;
+		unlock(f);
+		return f;
+	}
+	unlock(f);
 
-			return f;
-		}
+	tlock(&palloc);
+	lock(f);
+	if(f->image != i || f->daddr != daddr) {
+		unlock(f);
+		tunlock(&palloc);
+		return 0;
 	}
-	unlock(&palloc.hashlock);
+	if(++f->ref == 1)
+		pageunchain(f);
+	tunlock(&palloc);
+	unlock(f);
 
-	return 0;
+	return f;
 }
 
 Pte*
@@ -492,11 +830,31 @@ ptealloc(void)
 	Pte *new;
 
 	new = smalloc(sizeof(Pte));
+	new->ref = 1;
 	new->first = &new->pages[PTEPERTAB];
 	new->last = new->pages;
 	return new;
 }
 
+/*
+ * Ptes are shared by the segments dupseg makes until one of
+ * them changes; give s its own copy of *p first.  Only s's
+ * dupseg can add a sharer, and s->lk is held, so a ref of 1
+ * cannot change under us.
+ */
+Pte*
+pteunshare(Segment *s, Pte **p)
+{
+	Pte *old;
+
+	old = *p;
+	if(old->ref > 1){
+		*p = ptecpy(old);
+		freepte(s, old);
+	}
+	return *p;
+}
+
 void
 freepte(Segment *s, Pte *p)
 {
@@ -504,6 +862,8 @@ freepte(Segment *s, Pte *p)
 	void (*fn)(Page*);
 	Page *pt, **pg, **ptop;
 
+	if(decref(p) != 0)
+		return;
 	switch(s->type&SG_TYPE) {
 	case SG_PHYSICAL:
 		fn = s->pseg->pgfree;
@@ -565,7 +925,7 @@ checkpagerefs(void)
 	 * be useful.
 	 */
 	s = splhi();
-	lock(&palloc);
+	tlock(&palloc);
 	countpagerefs(ref, 0);
 	portcountpagerefs(ref, 0);
 	nwrong = 0;
@@ -581,7 +941,7 @@ checkpagerefs(void)
 	countpagerefs(ref, 1);
 	portcountpagerefs(ref, 1);
 	iprint("%lud mistakes found\n", nwrong);
-	unlock(&palloc);
+	tunlock(&palloc);
 	splx(s);
 }
 
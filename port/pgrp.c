@@ -51,6 +51,8 @@ newpgrp(void)
 	p = smalloc(sizeof(Pgrp));
 	p->ref = 1;
 	p->pgrpid = incref(&pgrpid);
+	p->mntlog = MNTLOG;
+	p->mnthash = smalloc(MNTHASH*sizeof(Mhead*));
 	return p;
 }
 
@@ -83,7 +85,7 @@ closepgrp(Pgrp *p)
 	wlock(&p->ns);
 	p->pgrpid = -1;
 
-	e = &p->mnthash[MNTHASH];
+	e = &p->mnthash[1<<p->mntlog];
 	for(h = p->mnthash; h < e; h++) {
 		for(f = *h; f; f = next) {
 			wlock(&f->lock);
@@ -97,6 +99,8 @@ closepgrp(Pgrp *p)
 	}
 	wunlock(&p->ns);
 	qunlock(&p->debug);
+	free(p->negwalk);
+	free(p->mnthash);
 	free(p);
 }
 
@@ -132,9 +136,16 @@ pgrpcpy(Pgrp *to, Pgrp *from)
 	Mhead *f, **tom, **l, *mh;
 
 	wlock(&from->ns);
+	if(to->mntlog != from->mntlog){
+		/* same size, so each chain copies to the same bucket */
+		free(to->mnthash);
+		to->mnthash = smalloc((1<<from->mntlog)*sizeof(Mhead*));
+		to->mntlog = from->mntlog;
+	}
+	to->nmhead = from->nmhead;
 	order = 0;
 	tom = to->mnthash;
-	for(i = 0; i < MNTHASH; i++) {
+	for(i = 0; i < 1<<from->mntlog; i++) {
 		l = tom++;
 		for(f = from->mnthash[i]; f; f = f->hash) {
 			rlock(&f->lock);
@@ -162,6 +173,54 @@ pgrpcpy(Pgrp *to, Pgrp *from)
 	wunlock(&from->ns);
 }
 
+/*
+ * fdtochan reads f->fd without the lock, so an outgrown array is
+ * kept until the Fgrp goes, linked through the word before it
+ * onto f->oldfd.  Arrays at least double as they grow, so those
+ * kept take no more room than the one in use.
+ */
+Chan**
+fdalloc(int n)
+{
+	Chan **a;
+
+	a = malloc((n+1)*sizeof(Chan*));
+	if(a == nil)
+		return nil;
+	return a+1;
+}
+
+/*
+ * Replace f's fd array by a, n long; called with f locked.
+ * A reader that sees the new nfd sees the new array.
+ */
+void
+fdreplace(Fgrp *f, Chan **a, int n)
+{
+	Chan **o;
+
+	o = f->fd;
+	memmove(a, o, f->nfd*sizeof(Chan*));
+	coherence();
+	f->fd = a;
+	coherence();
+	f->nfd = n;
+	o[-1] = (Chan*)f->oldfd;
+	f->oldfd = o;
+}
+
+static void
+fdfree(Fgrp *f)
+{
+	Chan **a, **o;
+
+	for(a = f->oldfd; a != nil; a = o){
+		o = (Chan**)a[-1];
+		free(a-1);
+	}
+	free(f->fd-1);
+}
+
 Fgrp*
 dupfgrp(Fgrp *f)
 {
@@ -171,7 +230,9 @@ dupfgrp(Fgrp *f)
 
 	new = smalloc(sizeof(Fgrp));
 	if(f == nil){
-		new->fd = smalloc(DELTAFD*sizeof(Chan*));
+		new->fd = fdalloc(DELTAFD);
+		if(new->fd == nil)
+			panic("dupfgrp");
 		new->nfd = DELTAFD;
 		new->ref = 1;
 		return new;
@@ -183,7 +244,7 @@ dupfgrp(Fgrp *f)
 	i = new->nfd%DELTAFD;
 	if(i != 0)
 		new->nfd += DELTAFD - i;
-	new->fd = malloc(new->nfd*sizeof(Chan*));
+	new->fd = fdalloc(new->nfd);
 	if(new->fd == nil){
 		unlock(f);
 		free(new);
@@ -227,7 +288,7 @@ closefgrp(Fgrp *f)
 		}
 	up->closingfgrp = nil;
 
-	free(f->fd);
+	fdfree(f);
 	free(f);
 }
 
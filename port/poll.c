@@ -0,0 +1,345 @@
+#include	"u.h"
+#include	"../port/lib.h"
+#include	"mem.h"
+#include	"dat.h"
+#include	"fns.h"
+#include	"../port/error.h"
+
+/*
+ *  Event sets.  A device that can tell whether a read or write
+ *  would block keeps a Pollq on the objects its readers and writers
+ *  sleep on (qio keeps one in every Queue) and calls pollwakeup when
+ *  their state changes.  evwatch adds an fd to the process's set;
+ *  pollwakeup moves its Pollw to the set's ready list, so evwait only
+ *  looks at fds that have changed.  Each is checked again through
+ *  the device's poll function before it is reported, and stays on
+ *  the ready list while it is still ready.
+ */
+
+enum
+{
+	Nevhash	= 64,
+	Maxev	= 1024,		/* events one evwait returns */
+};
+
+struct Evset
+{
+	Lock	rl;		/* ready list; taken at interrupt level */
+	QLock	ql;		/* evwatch and evwait */
+	Rendez	r;
+	Pollw	*rhead;
+	Pollw	*rtail;
+	Pollw	*hash[Nevhash];
+	int	n;
+};
+
+static int
+qslot(Pollw *w, Pollq *q)
+{
+	return w->q[0] == q ? 0 : 1;
+}
+
+static void
+evready(Pollw *w)
+{
+	Evset *e;
+
+	e = w->set;
+	ilock(&e->rl);
+	if(!w->ready){
+		w->ready = 1;
+		w->rnext = nil;
+		if(e->rhead == nil)
+			e->rhead = w;
+		else
+			e->rtail->rnext = w;
+		e->rtail = w;
+	}
+	iunlock(&e->rl);
+	wakeup(&e->r);
+}
+
+static void
+evunready(Pollw *w)
+{
+	Evset *e;
+	Pollw *x, *prev;
+
+	e = w->set;
+	ilock(&e->rl);
+	if(w->ready){
+		prev = nil;
+		for(x = e->rhead; x != nil; prev = x, x = x->rnext)
+			if(x == w){
+				if(prev == nil)
+					e->rhead = w->rnext;
+				else
+					prev->rnext = w->rnext;
+				if(e->rtail == w)
+					e->rtail = prev;
+				break;
+			}
+		w->ready = 0;
+	}
+	iunlock(&e->rl);
+}
+
+/*
+ *  called by a device's poll function for each object
+ *  w should be woken by; linking twice is harmless
+ */
+void
+pollon(Pollw *w, Pollq *q)
+{
+	int i;
+
+	if(w->q[0] == q || w->q[1] == q)
+		return;
+	for(i = 0; i < nelem(w->q); i++)
+		if(w->q[i] == nil)
+			break;
+	if(i == nelem(w->q))
+		panic("pollon");
+	ilock(q);
+	w->q[i] = q;
+	w->qnext[i] = q->head;
+	q->head = w;
+	iunlock(q);
+}
+
+static void
+polloff(Pollw *w)
+{
+	int i;
+	Pollq *q;
+	Pollw **l;
+
+	for(i = 0; i < nelem(w->q); i++){
+		q = w->q[i];
+		if(q == nil)
+			continue;
+		ilock(q);
+		if(w->q[i] == q){
+			for(l = &q->head; *l != nil; l = &(*l)->qnext[qslot(*l, q)])
+				if(*l == w){
+					*l = w->qnext[i];
+					break;
+				}
+			w->q[i] = nil;
+			w->qnext[i] = nil;
+		}
+		iunlock(q);
+	}
+}
+
+/*
+ *  the object's state has changed; may be called at interrupt level
+ */
+void
+pollwakeup(Pollq *q)
+{
+	Pollw *w;
+
+	if(q->head == nil)
+		return;
+	ilock(q);
+	for(w = q->head; w != nil; w = w->qnext[qslot(w, q)])
+		evready(w);
+	iunlock(q);
+}
+
+/*
+ *  the object is going away
+ */
+void
+pollclose(Pollq *q)
+{
+	int i;
+	Pollw *w, *next;
+
+	if(q->head == nil)
+		return;
+	ilock(q);
+	for(w = q->head; w != nil; w = next){
+		i = qslot(w, q);
+		next = w->qnext[i];
+		w->q[i] = nil;
+		w->qnext[i] = nil;
+		evready(w);
+	}
+	q->head = nil;
+	iunlock(q);
+}
+
+static int
+chanpoll(Pollw *w)
+{
+	Dev *d;
+
+	d = devtab[w->c->type];
+	if(d->poll == nil)
+		return Pollin|Pollout;
+	return d->poll(w->c, w);
+}
+
+static void
+pollfree(Pollw *w)
+{
+	polloff(w);
+	evunready(w);
+	cclose(w->c);
+	free(w);
+}
+
+void
+evfree(Evset *e)
+{
+	int i;
+	Pollw *w;
+
+	for(i = 0; i < Nevhash; i++)
+		while((w = e->hash[i]) != nil){
+			e->hash[i] = w->hnext;
+			pollfree(w);
+		}
+	free(e);
+}
+
+/*
+ *  evwatch(fd, mask, tag): watch fd for mask (Pollin|Pollout),
+ *  change what is watched, or stop watching with mask 0.  The
+ *  set holds its own reference, so close an fd only after it
+ *  is removed.
+ */
+long
+sysevwatch(ulong *arg)
+{
+	int fd;
+	ulong mask;
+	Chan *c;
+	Evset *e;
+	Pollw *w, **l;
+
+	fd = arg[0];
+	mask = arg[1] & (Pollin|Pollout);
+	if(fd < 0)
+		error(Ebadfd);
+	if((e = up->evset) == nil){
+		e = smalloc(sizeof(Evset));
+		up->evset = e;
+	}
+
+	qlock(&e->ql);
+	if(waserror()){
+		qunlock(&e->ql);
+		nexterror();
+	}
+	for(l = &e->hash[fd%Nevhash]; (w = *l) != nil; l = &w->hnext)
+		if(w->fd == fd)
+			break;
+	if(mask == 0){
+		if(w == nil)
+			error(Ebadfd);
+		*l = w->hnext;
+		e->n--;
+		pollfree(w);
+	}else if(w != nil){
+		w->mask = mask;
+		w->tag = arg[2];
+		evready(w);
+	}else{
+		c = fdtochan(fd, -1, 0, 1);
+		w = malloc(sizeof(Pollw));
+		if(w == nil){
+			cclose(c);
+			error(Enomem);
+		}
+		w->set = e;
+		w->c = c;
+		w->fd = fd;
+		w->mask = mask;
+		w->tag = arg[2];
+		*l = w;
+		e->n++;
+		evready(w);
+	}
+	poperror();
+	qunlock(&e->ql);
+	return 0;
+}
+
+static int
+evpending(void *a)
+{
+	return ((Evset*)a)->rhead != nil;
+}
+
+/*
+ *  evwait(ev, nev, ms): wait for watched fds to become ready and store
+ *  up to nev (tag, events) pairs of ulongs at ev.  ms < 0 waits for
+ *  ever, 0 does not wait.  Returns the number stored, 0 on timeout.
+ */
+long
+sysevwait(ulong *arg)
+{
+	int nev, n, r;
+	long ms;
+	ulong *ev;
+	Evset *e;
+	Pollw *w, *next;
+
+	nev = arg[1];
+	if(nev <= 0)
+		error(Ebadarg);
+	if(nev > Maxev)
+		nev = Maxev;
+	validaddr(arg[0], nev*2*sizeof(ulong), 1);
+	evenaddr(arg[0]);
+	ev = (ulong*)arg[0];
+	ms = arg[2];
+	if((e = up->evset) == nil)
+		error(Ebadarg);
+
+	qlock(&e->ql);
+	if(waserror()){
+		qunlock(&e->ql);
+		nexterror();
+	}
+	for(;;){
+		ilock(&e->rl);
+		w = e->rhead;
+		e->rhead = nil;
+		e->rtail = nil;
+		iunlock(&e->rl);
+
+		n = 0;
+		for(; w != nil; w = next){
+			/* a wakeup from here on requeues w */
+			ilock(&e->rl);
+			next = w->rnext;
+			w->ready = 0;
+			iunlock(&e->rl);
+
+			r = chanpoll(w) & (w->mask|Pollhup);
+			if(r == 0)
+				continue;
+			if(n < nev){
+				ev[2*n] = w->tag;
+				ev[2*n+1] = r;
+				n++;
+			}
+			evready(w);
+		}
+		if(n > 0 || ms == 0)
+			break;
+		if(ms < 0)
+			sleep(&e->r, evpending, e);
+		else{
+			tsleep(&e->r, evpending, e, ms);
+			ms = 0;
+		}
+	}
+	poperror();
+	qunlock(&e->ql);
+	return n;
+}
@@ -7,26 +7,112 @@
 #include "ureg.h"
 #include "../port/error.h"
 
+/*
+ * Each processor's timers hang in a hierarchical wheel.  A level 0
+ * slot spans 1<<wheelshift fastticks, about Wres ns; a slot at
+ * level l spans Wslots of level l-1.  A timer goes in the lowest
+ * level whose range from the cursor covers it, so adding and
+ * deleting are constant time.  When the cursor enters a new turn
+ * of a level, the matching slot of the level above is cascaded
+ * down.  Level 0 slots are not sorted; timerintr runs whatever in
+ * the cursor's slot is due.
+ */
 enum {
 	Maxtimerloops = 20*1000,
+
+	Wbits	= 6,
+	Wslots	= 1<<Wbits,
+	Wmask	= Wslots-1,
+	Wlevels	= 4,
+	Wres	= 65536,	/* ns in a level 0 slot, roughly */
+
+	Maxidle	= 1000,		/* ms a tickless processor sleeps at most */
+	Idleslack = 1000000,	/* ns grid idle wakeups are rounded up to */
 };
 
 struct Timers
 {
 	Lock;
-	Timer	*head;
+	uvlong	cur;			/* level 0 slot being run */
+	uvlong	next;			/* last timerset, 0 if none */
+	int	n;			/* timers in the wheel */
+	int	idle;			/* hz timer is off: see tickless */
+	uvlong	idlestart;
+	uvlong	busy[Wlevels];		/* slots with timers in */
+	Timer	*wheel[Wlevels][Wslots];
 };
 
 static Timers timers[MAXMACH];
+static Timer *hztimer[MAXMACH];
 static int timersinited;
+static int wheelshift;
+
+ulong idlemachs;
+static Lock idlelock;
 
 ulong intrcount[MAXMACH];
 ulong fcallcount[MAXMACH];
 
+static int
+lowbit(uvlong v)
+{
+	int i;
+
+	for(i = 0; (v & 1) == 0; i++)
+		v >>= 1;
+	return i;
+}
+
+/* put t in the slot its twhen belongs in, relative to tt->cur */
+static void
+tlink(Timers *tt, Timer *t)
+{
+	uvlong u, d;
+	int l, i;
+	Timer **slot;
+
+	u = t->twhen >> wheelshift;
+	if(u < tt->cur)
+		u = tt->cur;
+	d = u - tt->cur;
+	for(l = 0; l < Wlevels-1; l++)
+		if(d < 1ULL<<(Wbits*(l+1)))
+			break;
+	if(d >= (uvlong)Wmask<<(Wbits*l))
+		u = tt->cur + ((uvlong)Wmask<<(Wbits*l));	/* cascaded again later */
+	i = (u >> (Wbits*l)) & Wmask;
+	slot = &tt->wheel[l][i];
+	t->tnext = *slot;
+	if(*slot != nil)
+		(*slot)->tlink = &t->tnext;
+	*slot = t;
+	t->tlink = slot;
+	t->tslot = l*Wslots + i;
+	tt->busy[l] |= 1ULL<<i;
+	tt->n++;
+}
+
+static void
+tunlink(Timers *tt, Timer *t)
+{
+	int l, i;
+
+	*t->tlink = t->tnext;
+	if(t->tnext != nil)
+		t->tnext->tlink = t->tlink;
+	t->tnext = nil;
+	t->tlink = nil;
+	l = t->tslot / Wslots;
+	i = t->tslot % Wslots;
+	if(tt->wheel[l][i] == nil)
+		tt->busy[l] &= ~(1ULL<<i);
+	tt->n--;
+}
+
 static vlong
 tadd(Timers *tt, Timer *nt)
 {
-	Timer *t, **last;
+	uvlong now, p;
 
 	/* Called with tt locked */
 	assert(nt->tt == nil);
@@ -41,56 +127,159 @@ tadd(Timers *tt, Timer *nt)
 		break;
 	case Tperiodic:
 		assert(nt->tns >= 100000);	/* At least 100 µs period */
+		p = ns2fastticks(nt->tns);
 		if(nt->twhen == 0){
-			/* look for another timer at same frequency for combining */
-			for(t = tt->head; t; t = t->tnext){
-				if(t->tmode == Tperiodic && t->tns == nt->tns)
-					break;
-			}
-			if (t)
-				nt->twhen = t->twhen;
-			else
-				nt->twhen = fastticks(nil);
+			/* in phase with any other timer of the same period */
+			now = fastticks(nil);
+			nt->twhen = now - now%p;
 		}
-		nt->twhen += ns2fastticks(nt->tns);
+		nt->twhen += p;
 		break;
 	}
 
-	for(last = &tt->head; t = *last; last = &t->tnext){
-		if(t->twhen > nt->twhen)
-			break;
+	if(wheelshift == 0){
+		for(wheelshift = 1; 1ULL<<wheelshift < ns2fastticks(Wres); wheelshift++)
+			;
 	}
-	nt->tnext = *last;
-	*last = nt;
+	if(tt->n == 0)
+		tt->cur = fastticks(nil) >> wheelshift;
+	tlink(tt, nt);
 	nt->tt = tt;
-	if(last == &tt->head)
+	if(tt->next == 0 || nt->twhen < tt->next){
+		tt->next = nt->twhen;
 		return nt->twhen;
+	}
 	return 0;
 }
 
-static uvlong
+static void
 tdel(Timer *dt)
 {
-
-	Timer *t, **last;
 	Timers *tt;
 
 	tt = dt->tt;
 	if (tt == nil)
-		return 0;
-	for(last = &tt->head; t = *last; last = &t->tnext){
-		if(t == dt){
-			assert(dt->tt);
-			dt->tt = nil;
-			*last = t->tnext;
+		return;
+	tunlink(tt, dt);
+	dt->tt = nil;
+}
+
+/*
+ * The cursor has reached the start of a turn of level 0: bring
+ * down the slots above whose turn has also started, top first.
+ */
+static void
+tcascade(Timers *tt)
+{
+	int l, i;
+	Timer *t, *next;
+
+	for(l = 1; l < Wlevels-1; l++)
+		if(tt->cur & ((1ULL<<(Wbits*(l+1)))-1))
 			break;
+	for(; l >= 1; l--){
+		i = (tt->cur >> (Wbits*l)) & Wmask;
+		t = tt->wheel[l][i];
+		tt->wheel[l][i] = nil;
+		tt->busy[l] &= ~(1ULL<<i);
+		for(; t != nil; t = next){
+			next = t->tnext;
+			tt->n--;
+			tlink(tt, t);
 		}
 	}
-	if(last == &tt->head && tt->head)
-		return tt->head->twhen;
+}
+
+/*
+ * Move the cursor towards level 0 slot unow, stopping at the
+ * next slot with timers in or the next turn, whichever is first.
+ */
+static void
+tadvance(Timers *tt, uvlong unow)
+{
+	uvlong b, bits, c;
+
+	b = (tt->cur | Wmask) + 1;
+	bits = tt->busy[0] & ~((2ULL<<(tt->cur & Wmask)) - 1);
+	c = b;
+	if(bits != 0)
+		c = (tt->cur & ~(uvlong)Wmask) + lowbit(bits);
+	if(c > unow)
+		c = unow;
+	tt->cur = c;
+	if((c & Wmask) == 0)
+		tcascade(tt);
+}
+
+/* a timer in the cursor's slot that is due */
+static Timer*
+tdue(Timers *tt, uvlong now)
+{
+	Timer *t;
+
+	for(t = tt->wheel[0][tt->cur & Wmask]; t != nil; t = t->tnext)
+		if(t->twhen <= now)
+			return t;
+	return nil;
+}
+
+/*
+ * When timerintr next has work: the earliest timer in the first
+ * busy level 0 slot, or when the first busy slot above cascades.
+ */
+static uvlong
+tnext(Timers *tt)
+{
+	int l, k, i;
+	uvlong bits, when, lc;
+	Timer *t;
+
+	if(tt->n == 0)
+		return 0;
+	for(l = 0; l < Wlevels; l++){
+		if(tt->busy[l] == 0)
+			continue;
+		lc = tt->cur >> (Wbits*l);
+		k = lc & Wmask;
+		bits = tt->busy[l];
+		if(k != 0)
+			bits = bits>>k | bits<<(Wslots-k);
+		k = lowbit(bits);
+		if(l > 0)
+			return (lc + k) << (Wbits*l) << wheelshift;
+		i = (lc + k) & Wmask;
+		when = ~0ULL;
+		for(t = tt->wheel[0][i]; t != nil; t = t->tnext)
+			if(t->twhen < when)
+				when = t->twhen;
+		return when;
+	}
 	return 0;
 }
 
+/*
+ * Without its hz timer a processor wakes only for real timers, so
+ * an idle one sets its clock no more than Maxidle ahead, and onto
+ * an Idleslack grid.  That runs timers close together, on this
+ * and on the other idle processors, in one wakeup.
+ */
+static uvlong
+tidlenext(Timers *tt)
+{
+	uvlong when, max, slack;
+
+	when = tnext(tt);
+	if(!tt->idle)
+		return when;
+	max = tt->idlestart + ms2fastticks(Maxidle);
+	if(when == 0 || when > max)
+		when = max;
+	slack = ns2fastticks(Idleslack);
+	if(slack > 0)
+		when += slack - when%slack;
+	return when;
+}
+
 /* add or modify a timer */
 void
 timeradd(Timer *nt)
@@ -119,14 +308,15 @@ void
 timerdel(Timer *dt)
 {
 	Timers *tt;
-	uvlong when;
 
+	/*
+	 * The interrupt set for dt, if any, is left to go off:
+	 * timerintr finds nothing due and sets the next one.
+	 */
 	ilock(dt);
 	if(tt = dt->tt){
 		ilock(tt);
-		when = tdel(dt);
-		if(when && tt == &timers[m->machno])
-			timerset(tt->head->twhen);
+		tdel(dt);
 		iunlock(tt);
 	}
 	iunlock(dt);
@@ -149,7 +339,7 @@ hzclock(Ureg *ur)
 	kmapinval();
 
 	if(kproftimer != nil)
-		kproftimer(ur->pc);
+		kproftimer(ur);
 
 	if((active.machs&(1<<m->machno)) == 0)
 		return;
@@ -159,8 +349,6 @@ hzclock(Ureg *ur)
 		exit(0);
 	}
 
-	checkalarms();
-
 	if(up && up->state == Running)
 		hzsched();	/* in proc.c */
 }
@@ -170,7 +358,7 @@ timerintr(Ureg *u, Tval)
 {
 	Timer *t;
 	Timers *tt;
-	uvlong when, now;
+	uvlong when, now, unow;
 	int count, callhzclock;
 
 	intrcount[m->machno]++;
@@ -181,22 +369,21 @@ timerintr(Ureg *u, Tval)
 		panic("timerintr: zero fastticks()");
 	ilock(tt);
 	count = Maxtimerloops;
-	while((t = tt->head) != nil){
+	unow = now >> wheelshift;
+	while(tt->n > 0){
+		if((t = tdue(tt, now)) == nil){
+			if(tt->cur >= unow)
+				break;
+			tadvance(tt, unow);
+			continue;
+		}
 		/*
 		 * No need to ilock t here: any manipulation of t
 		 * requires tdel(t) and this must be done with a
 		 * lock to tt held.  We have tt, so the tdel will
 		 * wait until we're done
 		 */
-		when = t->twhen;
-		if(when > now){
-			timerset(when);
-			iunlock(tt);
-			if(callhzclock)
-				hzclock(u);
-			return;
-		}
-		tt->head = t->tnext;
+		tunlink(tt, t);
 		assert(t->tt == tt);
 		t->tt = nil;
 		fcallcount[m->machno]++;
@@ -215,7 +402,13 @@ timerintr(Ureg *u, Tval)
 				"counter\n");
 		}
 	}
+	when = tidlenext(tt);
+	tt->next = when;
+	if(when)
+		timerset(when);
 	iunlock(tt);
+	if(callhzclock)
+		hzclock(u);
 }
 
 void
@@ -235,9 +428,88 @@ timersinit(void)
 	t->tt = nil;
 	t->tns = 1000000000/HZ;
 	t->tf = nil;
+	hztimer[m->machno] = t;
 	timeradd(t);
 }
 
+/*
+ * Tickless idle.  Called by the scheduler before idlehands, with
+ * the processor going idle: take its hz timer off the wheel, so
+ * that clock interrupts only come for timers that are due.  A
+ * processor is only let go tickless when something will wake
+ * it: it is the only one, or the architecture can interrupt it
+ * with idlewake when a process is readied for it.
+ */
+void
+tickless(void)
+{
+	Timer *t;
+	Timers *tt;
+	uvlong when;
+
+	if(conf.nmach > 1 && idlewake == nil)
+		return;
+	/* processor 0 keeps MACHP(0)->ticks for everyone else */
+	if(m->machno == 0 && conf.nmach > 1)
+		return;
+	t = hztimer[m->machno];
+	if(t == nil)
+		return;
+	tt = &timers[m->machno];
+	ilock(t);
+	ilock(tt);
+	if(t->tt == tt){
+		tdel(t);
+		tt->idle = 1;
+		tt->idlestart = fastticks(nil);
+		when = tidlenext(tt);
+		tt->next = when;
+		timerset(when);
+	}
+	iunlock(tt);
+	iunlock(t);
+
+	lock(&idlelock);
+	idlemachs |= 1<<m->machno;
+	unlock(&idlelock);
+	coherence();
+}
+
+/*
+ * Back from idlehands: put the hz timer back, in phase, and
+ * count the ticks slept through.
+ */
+void
+tickful(void)
+{
+	Timer *t;
+	Timers *tt;
+	uvlong now, period;
+
+	t = hztimer[m->machno];
+	tt = &timers[m->machno];
+	if(t == nil || !tt->idle)
+		return;
+	lock(&idlelock);
+	idlemachs &= ~(1<<m->machno);
+	unlock(&idlelock);
+
+	ilock(t);
+	ilock(tt);
+	if(tt->idle){
+		tt->idle = 0;
+		now = fastticks(nil);
+		period = ns2fastticks(t->tns);
+		if(period > 0)
+			m->ticks += (now - tt->idlestart) / period;
+		t->twhen = 0;
+		if(t->tt == nil && tadd(tt, t) != 0)
+			timerset(t->twhen);
+	}
+	iunlock(tt);
+	iunlock(t);
+}
+
 Timer*
 addclock0link(void (*f)(void), int ms)
 {
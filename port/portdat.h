@@ -1,3 +1,4 @@
+typedef struct Aio	Aio;
 typedef struct Alarms	Alarms;
 typedef struct Block	Block;
 typedef struct Chan	Chan;
@@ -9,9 +10,11 @@ typedef struct Dirtab	Dirtab;
 typedef struct Edf	Edf;
 typedef struct Egrp	Egrp;
 typedef struct Evalue	Evalue;
+typedef struct Evset	Evset;
 typedef struct Fgrp	Fgrp;
 typedef struct DevConf	DevConf;
 typedef struct Image	Image;
+typedef struct Iovec	Iovec;
 typedef struct Log	Log;
 typedef struct Logflag	Logflag;
 typedef struct Mntcache Mntcache;
@@ -19,17 +22,22 @@ typedef struct Mount	Mount;
 typedef struct Mntrpc	Mntrpc;
 typedef struct Mntwalk	Mntwalk;
 typedef struct Mnt	Mnt;
+typedef struct Negwalk	Negwalk;
 typedef struct Mhead	Mhead;
 typedef struct Note	Note;
 typedef struct Page	Page;
 typedef struct Path	Path;
 typedef struct Palloc	Palloc;
 typedef struct Pallocmem	Pallocmem;
+typedef struct Pghash	Pghash;
 typedef struct Perf	Perf;
 typedef struct PhysUart	PhysUart;
 typedef struct Pgrp	Pgrp;
 typedef struct Physseg	Physseg;
+typedef struct Pollq	Pollq;
+typedef struct Pollw	Pollw;
 typedef struct Proc	Proc;
+typedef struct Pstats	Pstats;
 typedef struct Pte	Pte;
 typedef struct QLock	QLock;
 typedef struct Queue	Queue;
@@ -39,10 +47,12 @@ typedef struct Rgrp	Rgrp;
 typedef struct RWlock	RWlock;
 typedef struct Sargs	Sargs;
 typedef struct Schedq	Schedq;
+typedef struct Runq	Runq;
 typedef struct Segment	Segment;
 typedef struct Sema	Sema;
 typedef struct Timer	Timer;
 typedef struct Timers	Timers;
+typedef struct Tlock	Tlock;
 typedef struct Uart	Uart;
 typedef struct Waitq	Waitq;
 typedef struct Walkqid	Walkqid;
@@ -102,12 +112,28 @@ struct Rendez
 	Proc	*p;
 };
 
+/*
+ *  ticket lock, for hot locks where waiters should be served
+ *  in order and spin reading their own turn, not on a tas
+ */
+struct Tlock
+{
+	ulong	key;		/* held only to take a ticket */
+	ulong	next;		/* next ticket to hand out */
+	ulong	owner;		/* ticket now holding the lock */
+	uintptr	pc;
+	Proc	*p;
+};
+
 struct QLock
 {
 	Lock	use;		/* to access Qlock structure */
 	Proc	*head;		/* next process waiting for object */
 	Proc	*tail;		/* last process waiting for object */
 	int	locked;		/* flag */
+	Proc	*owner;		/* holder, to spin while it runs */
+	uintptr	pc;		/* holder's call of qlock */
+	uvlong	start;		/* fastticks when it was taken */
 };
 
 struct RWlock
@@ -119,12 +145,14 @@ struct RWlock
 	Proc	*wproc;		/* writing proc */
 	int	readers;	/* number of readers */
 	int	writer;		/* number of writers */
+	uvlong	wstart;		/* fastticks when the writer took it */
 };
 
 struct Alarms
 {
-	QLock;
-	Proc	*head;
+	Lock;
+	Proc	*head;		/* alarms gone off, for alarmkproc */
+	Proc	*tail;
 };
 
 struct Sargs
@@ -163,6 +191,10 @@ enum
 	Budpck	=	(1<<3),		/* udp checksum */
 	Btcpck	=	(1<<4),		/* tcp checksum */
 	Bpktck	=	(1<<5),		/* packet checksum */
+	Bclass	=	(3<<6),		/* allocb size class+1, for its caches */
+	Btso	=	(1<<8),		/* tcp super-segment, cut at mss on the way out */
+	Bcsum	=	(1<<9),		/* tcp/udp checksum left to the device */
+	Bdirect	=	(1<<10),	/* sender holds no protocol locks: loopback may deliver in place */
 };
 
 struct Block
@@ -175,8 +207,10 @@ struct Block
 	uchar*	lim;			/* 1 past the end of the buffer */
 	uchar*	base;			/* start of the buffer */
 	void	(*free)(Block*);
+	Block*	shared;			/* Block whose buffer this shares, freed after it */
 	ushort	flag;
 	ushort	checksum;		/* IP checksum of complete packet (minus media header) */
+	ushort	mss;			/* payload per segment, if Btso */
 };
 
 #define BLEN(s)	((s)->wp - (s)->rp)
@@ -251,11 +285,59 @@ struct Dev
 	int	(*wstat)(Chan*, uchar*, int);
 	void	(*power)(int);	/* power mgt: power(1) => on, power (0) => off */
 	int	(*config)(int, char*, DevConf*);	/* returns nil on error */
+	long	(*readv)(Chan*, Iovec*, int, vlong);	/* optional: nil uses devreadv */
+	long	(*writev)(Chan*, Iovec*, int, vlong);	/* optional: nil uses devwritev */
+	int	(*poll)(Chan*, Pollw*);	/* optional: nil is always ready */
 
 	/* not initialised */
 	int	attached;				/* debugging */
 };
 
+/*
+ *  one segment of a preadv or pwritev, as the user passes it
+ */
+struct Iovec
+{
+	void*	base;
+	ulong	len;
+};
+
+/*
+ *  readiness, as evwait reports it
+ */
+enum
+{
+	Pollin	= 1<<0,		/* read would not block */
+	Pollout	= 1<<1,		/* write would not block */
+	Pollhup	= 1<<2,		/* hung up */
+};
+
+/*
+ *  event set entries watching a device object
+ */
+struct Pollq
+{
+	Lock;
+	Pollw	*head;
+};
+
+/*
+ *  one fd in an event set
+ */
+struct Pollw
+{
+	Evset	*set;
+	Chan	*c;
+	int	fd;
+	ulong	mask;		/* Pollin|Pollout wanted */
+	ulong	tag;		/* returned with its events */
+	int	ready;		/* on the set's ready list */
+	Pollw	*rnext;
+	Pollw	*hnext;		/* in the set's fd hash */
+	Pollq	*q[2];		/* devices watch at most a reader and a writer side */
+	Pollw	*qnext[2];
+};
+
 struct Dirtab
 {
 	char	name[KNAMELEN];
@@ -317,6 +399,7 @@ struct Mnt
 	Mnt	*list;		/* Free list */
 	int	flags;		/* cache */
 	int	msize;		/* data + IOHDRSZ */
+	int	window;		/* Treads or Twrites kept in flight by one large i/o */
 	char	*version;	/* 9P version */
 	Queue	*q;		/* input queue */
 };
@@ -391,6 +474,7 @@ struct Image
 
 struct Pte
 {
+	Ref;				/* segments sharing it since fork */
 	Page	*pages[PTEPERTAB];	/* Page map for this chunk of pte */
 	Page	**first;		/* First used entry */
 	Page	**last;			/* Last used entry */
@@ -409,6 +493,7 @@ enum
 
 	SG_RONLY	= 0040,		/* Segment is read only */
 	SG_CEXEC	= 0100,		/* Detach at exec */
+	SG_CACHED	= 0200,		/* Physical segment is ordinary memory */
 };
 
 #define PG_ONSWAP	1
@@ -417,6 +502,7 @@ enum
 #define swapaddr(s)	(((ulong)s)&~PG_ONSWAP)
 
 #define SEGMAXSIZE	(SEGMAPSIZE*PTEMAPMEM)
+#define NTLBVA		16	/* pages procflushva drops one by one */
 
 struct Physseg
 {
@@ -449,6 +535,8 @@ struct Segment
 	ulong	fstart;		/* start address in file for demand load */
 	ulong	flen;		/* length of segment in file */
 	int	flushme;	/* maintain icache for this segment */
+	ulong	lastsoff;	/* offset of the last demand load */
+	int	ahead;		/* pages pio reads around it */
 	Image	*image;		/* text in file attached to this segment */
 	Physseg *pseg;
 	ulong*	profile;	/* Tick profile area */
@@ -458,6 +546,11 @@ struct Segment
 	Lock	semalock;
 	Sema	sema;
 	ulong	mark;		/* portcountrefs */
+	ulong	clock;		/* pager sweeps of this segment */
+	int	hand;		/* pte the next sweep starts at */
+	ulong	age;		/* mean idle sweeps, last time round */
+	uvlong	agesum;
+	ulong	agecount;
 };
 
 enum
@@ -465,13 +558,17 @@ enum
 	RENDLOG	=	5,
 	RENDHASH =	1<<RENDLOG,	/* Hash to lookup rendezvous tags */
 	MNTLOG	=	5,
-	MNTHASH =	1<<MNTLOG,	/* Hash to walk mount table */
+	MNTHASH =	1<<MNTLOG,	/* Initial hash to walk mount table */
+	MNTMAXLOG =	14,		/* mount table grows no larger */
 	NFD =		100,		/* per process file descriptors */
 	PGHLOG  =	9,
-	PGHSIZE	=	1<<PGHLOG,	/* Page hash for image lookup */
+	PGHSIZE	=	1<<PGHLOG,	/* Smallest page hash for image lookup */
 };
 #define REND(p,s)	((p)->rendhash[(s)&((1<<RENDLOG)-1)])
-#define MOUNTH(p,qid)	((p)->mnthash[(qid).path&((1<<MNTLOG)-1)])
+/* the top bits of a Fibonacci hash of (type, dev, qid.path) */
+#define MNTHASHV(t,d,qid,log)	((((ulong)(qid).path ^ (ulong)((qid).path>>32) ^ (t)<<24 ^ (d)<<8) \
+				* 0x9E3779B1UL) >> (32-(log)))
+#define MOUNTH(p,t,d,qid)	((p)->mnthash[MNTHASHV(t, d, qid, (p)->mntlog)])
 
 struct Pgrp
 {
@@ -480,7 +577,12 @@ struct Pgrp
 	ulong	pgrpid;
 	QLock	debug;			/* single access via devproc.c */
 	RWlock	ns;			/* Namespace n read/one write lock */
-	Mhead	*mnthash[MNTHASH];
+	Mhead	**mnthash;		/* 1<<mntlog chains */
+	int	mntlog;
+	int	nmhead;			/* Mheads in mnthash */
+	Lock	neglock;
+	Negwalk	*negwalk;		/* names known absent from mnt directories */
+	ulong	neggen;			/* bumped by mount and unmount */
 };
 
 struct Rgrp
@@ -516,11 +618,12 @@ struct Fgrp
 	int	nfd;			/* number allocated */
 	int	maxfd;			/* highest fd in use */
 	int	exceed;			/* debugging */
+	Chan	**oldfd;		/* outgrown fd arrays, see fdalloc */
 };
 
 enum
 {
-	DELTAFD	= 20		/* incremental increase in Fgrp.fd's */
+	DELTAFD	= 20		/* least increase in Fgrp.fd's */
 };
 
 struct Pallocmem
@@ -529,17 +632,23 @@ struct Pallocmem
 	ulong npage;
 };
 
-struct Palloc
+struct Pghash
 {
 	Lock;
+	Page	*head;
+};
+
+struct Palloc
+{
+	Tlock;
 	Pallocmem	mem[4];
 	Page	*head;			/* most recently used */
 	Page	*tail;			/* least recently used */
 	ulong	freecount;		/* how many pages on free list now */
 	Page	*pages;			/* array of all pages */
 	ulong	user;			/* how many user pages */
-	Page	*hash[PGHSIZE];
-	Lock	hashlock;
+	Pghash	*hash;			/* Image page cache, sized by pageinit */
+	ulong	hashmask;
 	Rendez	r;			/* Sleep for free mem */
 	QLock	pwait;			/* Queue of procs waiting for memory */
 };
@@ -572,6 +681,8 @@ struct Timer
 	Tval	tticks;		/* tns converted to ticks */
 	Tval	twhen;		/* ns represented in fastticks */
 	Timer	*tnext;
+	Timer	**tlink;	/* what points at this one in its wheel slot */
+	int	tslot;		/* which slot, level*Wslots + slot */
 };
 
 enum
@@ -640,6 +751,37 @@ enum
 	PriRoot		= 13,		/* base priority for root processes */
 };
 
+enum
+{
+	Sysother	= 0,	/* Pstats.nsys, by sysclass[] */
+	Sysio,			/* reads and writes */
+	Sysfile,		/* opening, closing and stat */
+	Sysns,			/* the name space */
+	Sysproc,
+	Sysmem,
+	Syssync,		/* rendezvous, semaphores and events */
+	Nsysclass,
+
+	Ioother		= 0,	/* Pstats bytes, by the Chan's device (iocount) */
+	Iofile,			/* storage and mounted file servers */
+	Ionet,
+	Iocog,			/* cognitive channels */
+	Nioclass,
+};
+
+/*
+ *  cheap counts kept for /proc/n/stats
+ */
+struct Pstats
+{
+	ulong	nsys[Nsysclass];	/* system calls */
+	uvlong	rbytes[Nioclass];	/* bytes read */
+	uvlong	wbytes[Nioclass];	/* bytes written */
+	ulong	nfault;			/* page faults */
+	ulong	vcsw;			/* switches away to block */
+	ulong	icsw;			/* switches away while runnable */
+};
+
 struct Schedq
 {
 	Lock;
@@ -648,6 +790,23 @@ struct Schedq
 	int	n;
 };
 
+/*
+ *  a processor's queues of ready best-effort processes and
+ *  of the edf processes admitted to it
+ */
+struct Runq
+{
+	Lock;
+	Schedq	q[Npriq];
+	ulong	runvec;
+	int	n;		/* processes on q */
+	ulong	balancetime;	/* ticks at last rebalance */
+	ulong	steals;		/* processes taken from other runqs */
+	ulong	migrations;	/* processes run here after running elsewhere */
+	Proc**	edf;		/* heap of released edf processes, by deadline */
+	int	nedf;
+};
+
 struct Proc
 {
 	Label	sched;		/* known to l.s */
@@ -685,6 +844,7 @@ struct Proc
 
 	ulong	parentpid;
 	ulong	time[6];	/* User, Sys, Real; child U, S, R */
+	Pstats	stats;
 
 	uvlong	kentry;		/* Kernel entry time stamp (for profiling) */
 	/*
@@ -713,8 +873,12 @@ struct Proc
 	Rendez	sleep;		/* place for syssleep/debug */
 	int	notepending;	/* note issued but not acted on */
 	int	kp;		/* true if a kernel process */
-	Proc	*palarm;	/* Next alarm time */
+	Proc	*palarm;	/* Next alarm gone off */
 	ulong	alarm;		/* Time of call */
+	int	alarmq;		/* on the alarms list */
+	Timer	alarmt;		/* goes off at alarm */
+	Evset	*evset;		/* fds watched by evwait */
+	Aio	*aio;		/* asynchronous i/o ring */
 	int	newtlb;		/* Pager has changed my pte's, I must flush */
 	int	noswap;		/* process is not swappable */
 
@@ -753,6 +917,7 @@ struct Proc
 
 	Mach	*wired;
 	Mach	*mp;		/* machine this process last ran on */
+	Runq	*readyq;	/* runq it is waiting on, if Ready */
 	Ref	nlocks;		/* number of locks held by proc */
 	ulong	delaysched;
 	ulong	priority;	/* priority level */
@@ -762,12 +927,16 @@ struct Proc
 	ulong	lastupdate;
 	uchar	yield;		/* non-zero if the process just did a sleep(0) */
 	ulong	readytime;	/* time process came ready */
+	uvlong	readyticks;	/* fastticks when it came ready */
 	ulong	movetime;	/* last time process switched processors */
 	int	preempted;	/* true if this process hasn't finished the interrupt
 				 *  that last preempted it
 				 */
 	Edf	*edf;		/* if non-null, real-time proc, edf contains scheduling params */
 	int	trace;		/* process being traced? */
+	void	*swarm;		/* cognitive swarm this proc is an agent of */
+	int	swarmslot;	/* its index in the swarm's agents */
+	ulong	swarmcpus;	/* processors the swarm is gathered on */
 
 	ulong	qpc;		/* pc calling last blocking qlock */
 
@@ -797,6 +966,7 @@ enum
 extern	Conf	conf;
 extern	char*	conffile;
 extern	int	cpuserver;
+extern	int	todfastuser;
 extern	Dev*	devtab[];
 extern	char*	eve;
 extern	char	hostdomain[];
@@ -813,6 +983,7 @@ extern	Image	swapimage;
 extern	char*	sysname;
 extern	uint	qiomaxatomic;
 extern	char*	sysctab[];
+extern	ulong	idlemachs;
 
 	Watchdog*watchdog;
 	int	watchdogon;
@@ -925,6 +1096,7 @@ struct Uart
 	int	oerr;			/* rcvr overruns */
 	int	berr;			/* no input buffers */
 	int	serr;			/* input queue overflow */
+	int	fifo;			/* receive fifo trigger level, kept across opens */
 
 	/* buffers */
 	int	(*putc)(Queue*, int);
@@ -991,6 +1163,7 @@ enum
 	Qflow		= (1<<3),	/* producer flow controlled */
 	Qcoalesce	= (1<<4),	/* coalesce packets on read */
 	Qkick		= (1<<5),	/* always call the kick routine after qwrite */
+	Qchain		= (1<<6),	/* bytes only, qbwrite may queue Block chains as they are */
 };
 
 #define DEVDOTDOT -1
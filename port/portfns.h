@@ -5,6 +5,7 @@ int		addphysseg(Physseg*);
 void		addbootfile(char*, uchar*, ulong);
 void		addwatchdog(Watchdog*);
 Block*		adjustblock(Block*, int);
+void		aiofree(Aio*);
 void		alarmkproc(void*);
 Block*		allocb(int);
 int		anyhigher(void);
@@ -26,7 +27,6 @@ void		chandevinit(void);
 void		chandevreset(void);
 void		chandevshutdown(void);
 void		chanfree(Chan*);
-void		checkalarms(void);
 void		checkb(Block*, char*);
 void		cinit(void);
 Chan*		cclone(Chan*);
@@ -48,6 +48,7 @@ Block*		copyblock(Block*, int);
 void		copypage(Page*, Page*);
 void		countpagerefs(ulong*, int);
 int		cread(Chan*, uchar*, int, vlong);
+void		creadahead(Chan*, vlong, int);
 void		cunmount(Chan*, Chan*);
 void		cupdate(Chan*, uchar*, int, vlong);
 void		cwrite(Chan*, uchar*, int, vlong);
@@ -57,6 +58,7 @@ int		decrypt(void*, void*, int);
 void		delay(int);
 Proc*		dequeueproc(Schedq*, Proc*);
 Chan*		devattach(int, char*);
+void		devasync(char*, void (*)(void*), void*, char*);
 Block*		devbread(Chan*, long, ulong);
 long		devbwrite(Chan*, Block*, ulong);
 Chan*		devclone(Chan*);
@@ -70,22 +72,29 @@ int		devno(int, int);
 Chan*		devopen(Chan*, int, Dirtab*, int, Devgen*);
 void		devpermcheck(char*, ulong, int);
 void		devpower(int);
+long		devreadv(Chan*, Iovec*, int, vlong);
 void		devremove(Chan*);
 void		devreset(void);
 void		devshutdown(void);
 int		devstat(Chan*, uchar*, int, Dirtab*, int, Devgen*);
 Walkqid*	devwalk(Chan*, Chan*, char**, int, Dirtab*, int, Devgen*);
 int		devwstat(Chan*, uchar*, int);
+long		devwritev(Chan*, Iovec*, int, vlong);
 void		drawactive(int);
 void		drawcmap(void);
 void		dumpaproc(Proc*);
 void		dumpregs(Ureg*);
 void		dumpstack(void);
 Fgrp*		dupfgrp(Fgrp*);
+Chan**		fdalloc(int);
+void		fdreplace(Fgrp*, Chan**, int);
 int		duppage(Page*);
 void		dupswap(Page*);
 void		edfinit(Proc*);
+int		edfqalloc(int);
+void		edfqueueproc(Proc*, int);
 char*		edfadmit(Proc*);
+int		edfarrive(Proc*);
 int		edfready(Proc*);
 void		edfrecord(Proc*);
 void		edfrun(Proc*, int);
@@ -98,6 +107,7 @@ int		eqchan(Chan*, Chan*, int);
 int		eqchantdqid(Chan*, int, int, Qid, int);
 int		eqqid(Qid, Qid);
 void		error(char*);
+void		evfree(Evset*);
 long		execregs(ulong, ulong, ulong);
 void		exhausted(char*);
 void		exit(int);
@@ -127,14 +137,20 @@ int		haswaitq(void*);
 long		hostdomainwrite(char*, int);
 long		hostownerwrite(char*, int);
 void		hzsched(void);
+int		(*hwrandom)(ulong*);
 Block*		iallocb(int);
 void		iallocsummary(void);
+void		(*idlewake)(ulong);
 long		ibrk(ulong, int);
 void		ilock(Lock*);
 void		iunlock(Lock*);
 long		incref(Ref*);
 void		initseg(void);
+void		iocount(Proc*, Chan*, long, int);
 int		iprint(char*, ...);
+long		iovgather(Iovec*, int, long, uchar*, long);
+long		iovlen(Iovec*, int);
+long		iovscatter(Iovec*, int, long, uchar*, long);
 void		isdir(Chan*);
 int		iseve(void);
 int		islo(void);
@@ -150,18 +166,21 @@ void		kickpager(void);
 void		killbig(char*);
 void		kproc(char*, void(*)(void*), void*);
 void		kprocchild(Proc*, void (*)(void*), void*);
-void		(*kproftimer)(ulong);
+void		(*kproftimer)(Ureg*);
 void		ksetenv(char*, char*, int);
 void		kstrcpy(char*, char*, int);
 void		kstrdup(char**, char*);
 long		latin1(Rune*, int);
 int		lock(Lock*);
+void		lockstatclear(void);
+int		lockstatread(char*, int);
 void		logopen(Log*);
 void		logclose(Log*);
 char*		logctl(Log*, int, char**, Logflag*);
 void		logn(Log*, int, void*, int);
 long		logread(Log*, void*, ulong, long);
 void		log(Log*, int, char*, ...);
+int		logprint(char*, ...);
 Cmdtab*		lookupcmd(Cmdbuf*, Cmdtab*, int);
 Page*		lookpage(Image*, ulong);
 #define		MS2NS(n) (((vlong)(n))*1000000LL)
@@ -175,9 +194,12 @@ void		mfreeseg(Segment*, ulong, int);
 void		microdelay(int);
 uvlong		mk64fract(uvlong, uvlong);
 void		mkqid(Qid*, vlong, ulong, int);
+void		(*mmuflushva)(ulong);
+int		(*mmuref)(Proc*, ulong);
 void		mmurelease(Proc*);
 void		mmuswitch(Proc*);
 Chan*		mntauth(Chan*, char*);
+long		mntrdwr(int, Chan*, void*, long, vlong);
 long		mntversion(Chan*, char*, int, int);
 void		mouseresize(void);
 void		mountfree(Mount*);
@@ -212,12 +234,16 @@ ulong	pagenumber(Page*);
 void		pagersummary(void);
 void		panic(char*, ...);
 Cmdbuf*		parsecmd(char *a, int n);
+char*		parsetime(vlong*, char*);
 void		pathclose(Path*);
 ulong		perfticks(void);
 void		pexit(char*, int);
 void		pgrpcpy(Pgrp*, Pgrp*);
 void		pgrpnote(ulong, char*, long, int);
 void		pio(Segment *, ulong, ulong, Page **);
+void		pollclose(Pollq*);
+void		pollon(Pollw*, Pollq*);
+void		pollwakeup(Pollq*);
 #define		poperror()		up->nerrlab--
 void		portcountpagerefs(ulong*, int);
 int		postnote(Proc*, int, char*, int);
@@ -227,17 +253,21 @@ void		prflush(void);
 void		printinit(void);
 ulong		procalarm(ulong);
 void		procctl(Proc*);
+int		procctlmemio(Proc*, ulong, int, void*, int);
+Schedq*		procschedq(Proc*);
 void		procdump(void);
 int		procfdprint(Chan*, int, int, char*, int);
 int		procindex(ulong);
 void		procinit0(void);
 void		procflushseg(Segment*);
+void		procflushva(Segment*, ulong*, int);
 void		procpriority(Proc*, int, int);
 Proc*		proctab(int);
 extern void	(*proctrace)(Proc*, int, vlong); 
 void		procwired(Proc*, int);
 Pte*		ptealloc(void);
 Pte*		ptecpy(Pte*);
+Pte*		pteunshare(Segment*, Pte**);
 int		pullblock(Block**, int);
 Block*		pullupblock(Block*, int);
 Block*		pullupqueue(Queue*, int);
@@ -262,14 +292,18 @@ void		qflush(Queue*);
 void		qfree(Queue*);
 int		qfull(Queue*);
 Block*		qget(Queue*);
+Block*		qgetn(Queue*, int);
 void		qhangup(Queue*, char*);
 int		qisclosed(Queue*);
 int		qiwrite(Queue*, void*, int);
 int		qlen(Queue*);
 void		qlock(QLock*);
+int		qlockstats(char*, int);
+void		qlockstatsclear(void);
 Queue*		qopen(int, int, void (*)(void*), void*);
 int		qpass(Queue*, Block*);
 int		qpassnolim(Queue*, Block*);
+int		qpoll(Queue*, Pollw*, int);
 int		qproduce(Queue*, void*, int);
 void		qputback(Queue*, Block*);
 long		qread(Queue*, void*, int);
@@ -280,6 +314,7 @@ void		qunlock(QLock*);
 int		qwindow(Queue*);
 int		qwrite(Queue*, void*, int);
 void		qnoblock(Queue*, int);
+void		qcoalesce(Queue*, int);
 int		rand(void);
 void		randominit(void);
 ulong		randomread(void*, ulong);
@@ -302,6 +337,9 @@ Proc*		runproc(void);
 void		savefpregs(FPsave*);
 void		sched(void);
 void		scheddump(void);
+void		schedlatclear(void);
+int		schedlatread(char*, int);
+int		schedstat(char*, int);
 void		schedinit(void);
 void		(*screenputs)(char*, int);
 long		seconds(void);
@@ -315,9 +353,11 @@ void		setmalloctag(void*, ulong);
 void		setrealloctag(void*, ulong);
 void		setregisters(Ureg*, char*, char*, int);
 void		setswapchan(Chan*);
+Block*		shareblock(Block*, uchar*, uchar*);
 char*		skipslash(char*);
 void		sleep(Rendez*, int(*)(void*), void*);
 void*		smalloc(ulong);
+void*		smallocz(ulong, int);
 int		splhi(void);
 int		spllo(void);
 void		splx(int);
@@ -326,6 +366,10 @@ char*		srvname(Chan*);
 int		swapcount(ulong);
 int		swapfull(void);
 void		swapinit(void);
+extern void	(*swarmexit)(Proc*);
+int		tcanlock(Tlock*);
+void		tickful(void);
+void		tickless(void);
 void		timeradd(Timer*);
 void		timerdel(Timer*);
 void		timersinit(void);
@@ -333,13 +377,18 @@ void		timerintr(Ureg*, Tval);
 void		timerset(Tval);
 ulong		tk2ms(ulong);
 #define		TK2MS(x) ((x)*(1000/HZ))
+void		(*tlbshoot)(ulong);
+void		tlbshootintr(void);
+int		tlock(Tlock*);
 uvlong		tod2fastticks(vlong);
 vlong		todget(vlong*);
 void		todsetfreq(vlong);
 void		todinit(void);
+void		todpageinit(void);
 void		todset(vlong, vlong, int);
 Block*		trimblock(Block*, int, int);
 void		tsleep(Rendez*, int (*)(void*), void*, ulong);
+void		tunlock(Tlock*);
 int		uartctl(Uart*, char*);
 int		uartgetc(void);
 void		uartkick(void*);
@@ -348,11 +397,13 @@ void		uartsetmouseputc(Uart*, int (*)(Queue*, int));
 void		uartputc(int);
 void		uartputs(char*, int);
 void		uartrecv(Uart*, char);
+void		uartrecvn(Uart*, uchar*, int);
 int		uartstageoutput(Uart*);
 void		unbreak(Proc*);
 void		uncachepage(Page*);
 long		unionread(Chan*, void*, long);
 void		unlock(Lock*);
+Block*		unshareblock(Block*);
 uvlong		us2fastticks(uvlong);
 void		userinit(void);
 ulong		userpc(void);
@@ -391,5 +442,6 @@ long		_xdec(long*);
 long		lcycles(void);
 
 #pragma varargck argpos iprint	1
+#pragma varargck argpos logprint	1
 #pragma	varargck argpos	panic	1
 #pragma varargck argpos pprint	1
@@ -8,8 +8,9 @@
 #include	<trace.h>
 
 int	schedgain = 30;	/* units in seconds */
-int	nrdy;
+long	nrdy;
 Ref	noteidalloc;
+void	(*swarmexit)(Proc*);	/* takes an exiting proc out of its swarm */
 
 void updatecpu(Proc*);
 int reprioritize(Proc*);
@@ -36,9 +37,17 @@ enum
 	Scaling=2,
 };
 
-Schedq	runq[Nrq];
+Schedq	runq[Nrq];		/* runq[PriEdf] stands for the edf heaps */
 ulong	runvec;
 
+/*
+ *  Best-effort processes wait on the runq of the processor they
+ *  last ran on or are wired to, so ready and runproc on different
+ *  processors seldom share a lock.  A processor with nothing of its
+ *  own to run steals from the one with the most waiting.
+ */
+static Runq	machrunq[MAXMACH];
+
 char *statename[] =
 {	/* BUG: generate automatically */
 	"Dead",
@@ -59,6 +68,7 @@ char *statename[] =
 static void pidhash(Proc*);
 static void pidunhash(Proc*);
 static void rebalance(void);
+static void schedlat(Proc*);
 
 /*
  * Always splhi()'ed.
@@ -94,7 +104,7 @@ schedinit(void)		/* never returns */
 			up->qnext = procalloc.free;
 			procalloc.free = up;
 
-			unlock(&palloc);
+			tunlock(&palloc);
 			unlock(&procalloc);
 			break;
 		}
@@ -139,7 +149,7 @@ sched(void)
 		if(up->nlocks.ref)
 		if(up->state != Moribund)
 		if(up->delaysched < 20
-		|| palloc.Lock.p == up
+		|| palloc.Tlock.p == up
 		|| procalloc.Lock.p == up){
 			up->delaysched++;
  			delayedscheds++;
@@ -151,6 +161,10 @@ sched(void)
 
 		/* statistics */
 		m->cs++;
+		if(up->state == Running)
+			up->stats.icsw++;
+		else
+			up->stats.vcsw++;
 
 		procsave(up);
 		if(setlabel(&up->sched)){
@@ -179,13 +193,13 @@ sched(void)
 int
 anyready(void)
 {
-	return runvec;
+	return runvec | machrunq[m->machno].runvec;
 }
 
 int
 anyhigher(void)
 {
-	return runvec & ~((1<<(up->priority+1))-1);
+	return (runvec | machrunq[m->machno].runvec) & ~((1<<(up->priority+1))-1);
 }
 
 /*
@@ -195,8 +209,7 @@ void
 hzsched(void)
 {
 	/* once a second, rebalance will reprioritize ready procs */
-	if(m->machno == 0)
-		rebalance();
+	rebalance();
 
 	/* unless preempted, get to run for at least 100ms */
 	if(anyhigher()
@@ -336,13 +349,13 @@ reprioritize(Proc *p)
 /*
  * add a process to a scheduling queue
  */
-void
-queueproc(Schedq *rq, Proc *p)
+static void
+queueproc(Runq *r, int pri, Proc *p)
 {
-	int pri;
+	Schedq *rq;
 
-	pri = rq - runq;
-	lock(runq);
+	rq = &r->q[pri];
+	lock(r);
 	p->priority = pri;
 	p->rnext = 0;
 	if(rq->tail)
@@ -351,24 +364,28 @@ queueproc(Schedq *rq, Proc *p)
 		rq->head = p;
 	rq->tail = p;
 	rq->n++;
-	nrdy++;
-	runvec |= 1<<pri;
-	unlock(runq);
+	r->n++;
+	r->runvec |= 1<<pri;
+	p->readyq = r;
+	p->readytime = m->ticks;
+#ifndef NOSCHEDLAT
+	p->readyticks = fastticks(nil);
+#endif
+	unlock(r);
+	_xinc(&nrdy);
 }
 
 /*
- *  try to remove a process from a scheduling queue (called splhi)
+ *  take tp off rq, whose lock is held, clearing its
+ *  bit in vec if it empties
  */
-Proc*
-dequeueproc(Schedq *rq, Proc *tp)
+static Proc*
+unqueue(Schedq *rq, Proc *tp, ulong *vec, int pri)
 {
 	Proc *l, *p;
 
-	if(!canlock(runq))
-		return nil;
-
 	/*
-	 *  the queue may have changed before we locked runq,
+	 *  the queue may have changed before we locked it,
 	 *  refind the target process.
 	 */
 	l = 0;
@@ -381,10 +398,8 @@ dequeueproc(Schedq *rq, Proc *tp)
 	/*
 	 *  p->mach==0 only when process state is saved
 	 */
-	if(p == 0 || p->mach){
-		unlock(runq);
+	if(p == 0 || p->mach)
 		return nil;
-	}
 	if(p->rnext == 0)
 		rq->tail = l;
 	if(l)
@@ -392,29 +407,231 @@ dequeueproc(Schedq *rq, Proc *tp)
 	else
 		rq->head = p->rnext;
 	if(rq->head == nil)
-		runvec &= ~(1<<(rq-runq));
+		*vec &= ~(1<<pri);
 	rq->n--;
-	nrdy--;
+	_xdec(&nrdy);
 	if(p->state != Ready)
 		print("dequeueproc %s %lud %s\n", p->text, p->pid, statename[p->state]);
+	return p;
+}
 
-	unlock(runq);
+/*
+ *  released edf processes wait on a heap, earliest deadline
+ *  first, on the processor they were admitted to.
+ */
+static int
+edfbefore(Proc *a, Proc *b)
+{
+	return a->edf->d - b->edf->d < 0;
+}
+
+static void
+edfset(Runq *r, int i, Proc *p)
+{
+	r->edf[i] = p;
+	p->edf->heapi = i;
+}
+
+static void
+edfup(Runq *r, int i)
+{
+	Proc *p;
+	int j;
+
+	p = r->edf[i];
+	for(; i > 0; i = j){
+		j = (i-1)/2;
+		if(!edfbefore(p, r->edf[j]))
+			break;
+		edfset(r, i, r->edf[j]);
+	}
+	edfset(r, i, p);
+}
+
+static void
+edfdown(Runq *r, int i)
+{
+	Proc *p;
+	int j;
+
+	p = r->edf[i];
+	for(; (j = 2*i+1) < r->nedf; i = j){
+		if(j+1 < r->nedf && edfbefore(r->edf[j+1], r->edf[j]))
+			j++;
+		if(!edfbefore(r->edf[j], p))
+			break;
+		edfset(r, i, r->edf[j]);
+	}
+	edfset(r, i, p);
+}
+
+/*
+ *  make room on a processor's heap for every process,
+ *  when the first edf process is admitted to it
+ */
+int
+edfqalloc(int cpu)
+{
+	Runq *r;
+
+	r = &machrunq[cpu];
+	if(r->edf == nil)
+		r->edf = malloc(conf.nproc*sizeof(Proc*));
+	return r->edf == nil? -1: 0;
+}
+
+void
+edfqueueproc(Proc *p, int cpu)
+{
+	Runq *r;
+
+	r = &machrunq[cpu];
+	lock(r);
+	if(r->edf == nil || r->nedf >= conf.nproc)
+		panic("edfqueueproc");
+	p->priority = PriEdf;
+	p->readyq = r;
+	p->readytime = m->ticks;
+#ifndef NOSCHEDLAT
+	p->readyticks = fastticks(nil);
+#endif
+	p->state = Ready;
+	edfset(r, r->nedf, p);
+	edfup(r, r->nedf++);
+	r->runvec |= 1<<PriEdf;
+	unlock(r);
+	_xinc(&nrdy);
+}
+
+static Proc*
+edfunqueue(Proc *tp)
+{
+	Runq *r;
+	Proc *p;
+	int i;
+
+	r = tp->readyq;
+	if(r == nil || !canlock(r))
+		return nil;
+	p = nil;
+	i = tp->edf->heapi;
+	if(i < r->nedf && r->edf[i] == tp && tp->mach == 0){
+		p = tp;
+		if(i < --r->nedf){
+			edfset(r, i, r->edf[r->nedf]);
+			edfdown(r, i);
+			edfup(r, i);
+		}
+		if(r->nedf == 0)
+			r->runvec &= ~(1<<PriEdf);
+		p->readyq = nil;
+		_xdec(&nrdy);
+	}
+	unlock(r);
+	return p;
+}
+
+/*
+ *  try to remove a process from a scheduling queue (called splhi)
+ */
+Proc*
+dequeueproc(Schedq *rq, Proc *tp)
+{
+	Proc *p;
+	Runq *r;
+
+	if(rq == &runq[PriEdf])
+		return edfunqueue(tp);
+	if(rq >= runq && rq < &runq[Nrq]){
+		if(!canlock(runq))
+			return nil;
+		p = unqueue(rq, tp, &runvec, rq-runq);
+		unlock(runq);
+		return p;
+	}
+
+	r = tp->readyq;
+	if(r == nil || rq < r->q || rq >= &r->q[Npriq] || !canlock(r))
+		return nil;
+	p = unqueue(rq, tp, &r->runvec, rq-r->q);
+	if(p != nil){
+		r->n--;
+		p->readyq = nil;
+	}
+	unlock(r);
 	return p;
 }
 
+/*
+ *  the queue a Ready process is waiting on, if any
+ */
+Schedq*
+procschedq(Proc *p)
+{
+	Runq *r;
+
+	if(p->priority >= Npriq)
+		return &runq[p->priority];
+	r = p->readyq;
+	if(r == nil)
+		return nil;
+	return &r->q[p->priority];
+}
+
+/*
+ *  keep a process on the processor it is wired to or last ran on
+ */
+static Runq*
+procrunq(Proc *p)
+{
+	if(p->wired)
+		return &machrunq[p->wired->machno];
+	if(p->mp)
+		return &machrunq[p->mp->machno];
+	return &machrunq[m->machno];
+}
+
 /*
  *  ready(p) picks a new priority for a process and sticks it in the
  *  runq for that priority.
  */
+/*
+ *  a processor asleep in tickless idle has to be woken for a
+ *  process queued for it, or for work it could take: a runq
+ *  backing up behind its processor, or anything (r == nil).
+ */
+static void
+wakeidle(Runq *r)
+{
+	ulong w, mine;
+
+	coherence();
+	w = idlemachs & ~(1<<m->machno);
+	if(w == 0 || idlewake == nil)
+		return;
+	if(r != nil){
+		mine = 1<<(r - machrunq);
+		if(w & mine){
+			(*idlewake)(mine);
+			return;
+		}
+		if(r->n < 2)
+			return;
+	}
+	(*idlewake)(w & -w);	/* the lowest numbered one */
+}
+
 void
 ready(Proc *p)
 {
 	int s, pri;
-	Schedq *rq;
+	Runq *r;
 	void (*pt)(Proc*, int, vlong);
 
 	s = splhi();
 	if(edfready(p)){
+		if(p->state == Ready && (r = p->readyq) != nil)
+			wakeidle(r);
 		splx(s);
 		return;
 	}
@@ -422,12 +639,20 @@ ready(Proc *p)
 	if(up != p)
 		m->readied = p;	/* group scheduling */
 
+	/*
+	 *  a swarm agent woken by a peer follows it to this
+	 *  processor if it is one of the swarm's
+	 */
+	if(up != nil && up != p && p->swarm != nil && p->swarm == up->swarm
+	&& !p->wired && (p->swarmcpus & (1<<m->machno)))
+		p->mp = MACHP(m->machno);
+
 	updatecpu(p);
 	pri = reprioritize(p);
-	p->priority = pri;
-	rq = &runq[pri];
 	p->state = Ready;
-	queueproc(rq, p);
+	r = procrunq(p);
+	queueproc(r, pri, p);
+	wakeidle(r);
 	pt = proctrace;
 	if(pt)
 		pt(p, SReady, 0);
@@ -450,29 +675,27 @@ yield(void)
 /*
  *  recalculate priorities once a second.  We need to do this
  *  since priorities will otherwise only be recalculated when
- *  the running process blocks.
+ *  the running process blocks.  Each processor does its own runq.
  */
-ulong balancetime;
-
 static void
 rebalance(void)
 {
 	int pri, npri, t, x;
+	Runq *r;
 	Schedq *rq;
 	Proc *p;
 
+	r = &machrunq[m->machno];
 	t = m->ticks;
-	if(t - balancetime < HZ)
+	if(t - r->balancetime < HZ)
 		return;
-	balancetime = t;
+	r->balancetime = t;
 
-	for(pri=0, rq=runq; pri<Npriq; pri++, rq++){
+	for(pri=0, rq=r->q; pri<Npriq; pri++, rq++){
 another:
 		p = rq->head;
 		if(p == nil)
 			continue;
-		if(p->mp != MACHP(m->machno))
-			continue;
 		if(pri == p->basepri)
 			continue;
 		updatecpu(p);
@@ -481,13 +704,57 @@ another:
 			x = splhi();
 			p = dequeueproc(rq, p);
 			if(p)
-				queueproc(&runq[npri], p);
+				queueproc(r, npri, p);
 			splx(x);
 			goto another;
 		}
 	}
 }
-	
+
+/*
+ *  can this processor run p, if it has been looking for
+ *  work i times?  Every time around affinity goes down.
+ *  Swarm agents may run on any of their swarm's processors
+ *  and wait a round longer before moving elsewhere.
+ */
+static int
+canrun(Proc *p, int i)
+{
+	if(p->wired)
+		return p->wired == MACHP(m->machno);
+	return p->mp == nil || p->mp == MACHP(m->machno)
+		|| (p->swarmcpus & (1<<m->machno))
+		|| i > (p->swarmcpus != 0);
+}
+
+/*
+ *  find a process on the busiest other runq that this
+ *  processor may take
+ */
+static Proc*
+steal(int i, Schedq **rqp)
+{
+	Runq *r, *busy;
+	Schedq *rq;
+	Proc *p;
+	int n;
+
+	busy = nil;
+	for(n = 0; n < conf.nmach; n++){
+		r = &machrunq[n];
+		if(n != m->machno && r->n > 0 && (busy == nil || r->n > busy->n))
+			busy = r;
+	}
+	if(busy == nil)
+		return nil;
+	for(rq = &busy->q[Npriq-1]; rq >= busy->q; rq--)
+		for(p = rq->head; p; p = p->rnext)
+			if(canrun(p, i)){
+				*rqp = rq;
+				return p;
+			}
+	return nil;
+}
 
 /*
  *  pick a process to run
@@ -495,19 +762,22 @@ another:
 Proc*
 runproc(void)
 {
+	Runq *r;
 	Schedq *rq;
 	Proc *p;
 	ulong start, now;
-	int i;
+	int i, stolen;
 	void (*pt)(Proc*, int, vlong);
 
 	start = perfticks();
+	r = &machrunq[m->machno];
+	stolen = 0;
 
 	/* cooperative scheduling until the clock ticks */
 	if((p=m->readied) && p->mach==0 && p->state==Ready
-	&& runq[Nrq-1].head == nil && runq[Nrq-2].head == nil){
+	&& r->nedf == 0
+	&& (rq = procschedq(p)) != nil){
 		skipscheds++;
-		rq = &runq[p->priority];
 		goto found;
 	}
 
@@ -515,26 +785,30 @@ runproc(void)
 
 loop:
 	/*
-	 *  find a process that last ran on this processor (affinity),
-	 *  or one that hasn't moved in a while (load balancing).  Every
-	 *  time around the loop affinity goes down.
+	 *  find the highest priority process this processor can run:
+	 *  the earliest deadline of the edf processes admitted here
+	 *  first, then our own runq, then one stolen from the busiest
+	 *  other runq.
 	 */
 	spllo();
 	for(i = 0;; i++){
-		/*
-		 *  find the highest priority target process that this
-		 *  processor can run given affinity constraints.
-		 *
-		 */
-		for(rq = &runq[Nrq-1]; rq >= runq; rq--){
-			for(p = rq->head; p; p = p->rnext){
-				if(p->mp == nil || p->mp == MACHP(m->machno)
-				|| (!p->wired && i > 0))
+		if(r->nedf > 0 && (p = r->edf[0]) != nil){
+			rq = &runq[PriEdf];
+			goto found;
+		}
+
+		for(rq = &r->q[Npriq-1]; rq >= r->q; rq--)
+			for(p = rq->head; p; p = p->rnext)
+				if(p->wired == nil || p->wired == MACHP(m->machno))
 					goto found;
-			}
+
+		if((p = steal(i, &rq)) != nil){
+			stolen = 1;
+			goto found;
 		}
 
-		/* waste time or halt the CPU */
+		/* waste time or halt the CPU, without clock ticks */
+		tickless();
 		idlehands();
 
 		/* remember how much time we're here */
@@ -545,12 +819,20 @@ loop:
 
 found:
 	splhi();
+	tickful();
 	p = dequeueproc(rq, p);
-	if(p == nil)
+	if(p == nil){
+		stolen = 0;
 		goto loop;
+	}
 
+	if(stolen)
+		r->steals++;
+	if(p->mp != nil && p->mp != MACHP(m->machno))
+		r->migrations++;
 	p->state = Scheding;
 	p->mp = MACHP(m->machno);
+	schedlat(p);
 
 	if(edflock(p)){
 		edfrun(p, rq == &runq[PriEdf]);	/* start deadline timer and do admin */
@@ -562,6 +844,153 @@ found:
 	return p;
 }
 
+/*
+ *  per processor: id, processes waiting on its runq,
+ *  steals from other runqs and processes migrated to it
+ */
+int
+schedstat(char *buf, int n)
+{
+	int id;
+	Runq *r;
+	char *p, *e;
+
+	p = buf;
+	e = buf + n;
+	for(id = 0; id < conf.nmach; id++){
+		r = &machrunq[id];
+		p = seprint(p, e, "%11d %11d %11lud %11lud\n",
+			id, r->n, r->steals, r->migrations);
+	}
+	return p - buf;
+}
+
+/*
+ *  how long processes wait between ready and runproc, in
+ *  microseconds: histograms with a bin for each power of two,
+ *  by priority and by the processor that ran them, and the
+ *  worst waits seen.  Each processor writes only its own
+ *  histogram.  Build with NOSCHEDLAT to leave it all out.
+ */
+enum
+{
+	Nlatbin	= 24,		/* waits of 2^23us (8s) and more share the last */
+	Nworst	= 16,
+};
+
+typedef struct Latency Latency;
+struct Latency
+{
+	uvlong	us;
+	ulong	pid;
+	char	text[KNAMELEN];
+	int	pri;
+	int	machno;
+	ulong	ticks;		/* when it ran */
+};
+
+static struct
+{
+	Lock;
+	long	pri[Nrq][Nlatbin];
+	ulong	mach[MAXMACH][Nlatbin];
+	Latency	worst[Nworst];	/* worst[0] is the least bad */
+	uvlong	floor;		/* us of worst[0] */
+} latency;
+
+static void
+schedlat(Proc *p)
+{
+#ifndef NOSCHEDLAT
+	uvlong us;
+	int i, bin;
+	Latency *w;
+
+	us = fastticks2us(fastticks(nil) - p->readyticks);
+	for(bin = 0; bin < Nlatbin-1 && (us>>bin) > 1; bin++)
+		;
+	_xinc(&latency.pri[p->priority][bin]);
+	latency.mach[m->machno][bin]++;
+
+	if(us <= latency.floor || !canlock(&latency))
+		return;
+	if(us > latency.worst[0].us){
+		/* drop the least bad, keep the rest in order */
+		for(i = 1; i < Nworst && latency.worst[i].us < us; i++)
+			latency.worst[i-1] = latency.worst[i];
+		w = &latency.worst[i-1];
+		w->us = us;
+		w->pid = p->pid;
+		strncpy(w->text, p->text, sizeof w->text-1);
+		w->text[sizeof w->text-1] = 0;
+		w->pri = p->priority;
+		w->machno = m->machno;
+		w->ticks = m->ticks;
+		latency.floor = latency.worst[0].us;
+	}
+	unlock(&latency);
+#else
+	USED(p);
+#endif
+}
+
+/* a histogram line, if it has counted anything */
+static char*
+latbins(char *p, char *e, char *what, int id, ulong *h)
+{
+	int i, n;
+
+	for(n = Nlatbin; n > 0 && h[n-1] == 0; n--)
+		;
+	if(n == 0)
+		return p;
+	p = seprint(p, e, "%s %d", what, id);
+	for(i = 0; i < n; i++)
+		p = seprint(p, e, " %lud", h[i]);
+	return seprint(p, e, "\n");
+}
+
+/*
+ *  pri n: bins for priority n, mach n: for processor n, bin i
+ *  counting waits shorter than 2^(i+1)us; then the worst waits,
+ *  worst first.
+ */
+int
+schedlatread(char *buf, int n)
+{
+	int i;
+	char *p, *e;
+	Latency *w;
+
+	p = buf;
+	e = buf + n;
+	for(i = 0; i < Nrq; i++)
+		p = latbins(p, e, "pri", i, (ulong*)latency.pri[i]);
+	for(i = 0; i < conf.nmach; i++)
+		p = latbins(p, e, "mach", i, latency.mach[i]);
+	lock(&latency);
+	for(i = Nworst-1; i >= 0; i--){
+		w = &latency.worst[i];
+		if(w->us == 0)
+			break;
+		p = seprint(p, e, "worst %llud %lud %s %d %d %lud\n",
+			w->us, w->pid, w->text, w->pri, w->machno, w->ticks);
+	}
+	unlock(&latency);
+	return p - buf;
+}
+
+void
+schedlatclear(void)
+{
+	lock(&latency);
+	memset(latency.pri, 0, sizeof latency.pri);
+	memset(latency.mach, 0, sizeof latency.mach);
+	memset(latency.worst, 0, sizeof latency.worst);
+	latency.floor = 0;
+	unlock(&latency);
+}
+
 int
 canpage(Proc *p)
 {
@@ -631,12 +1060,17 @@ newproc(void)
 	p->nlocks.ref = 0;
 	p->delaysched = 0;
 	p->trace = 0;
+	p->swarm = nil;
+	p->swarmcpus = 0;
+	p->evset = nil;
+	p->aio = nil;
 	kstrdup(&p->user, "*nouser");
 	kstrdup(&p->text, "*notext");
 	kstrdup(&p->args, "");
 	p->nargs = 0;
 	p->setargs = 0;
 	memset(p->seg, 0, sizeof p->seg);
+	memset(&p->stats, 0, sizeof p->stats);
 	p->pid = incref(&pidalloc);
 	pidhash(p);
 	p->noteid = incref(&noteidalloc);
@@ -780,6 +1214,7 @@ sleep(Rendez *r, int (*f)(void*), void *arg)
 
 		/* statistics */
 		m->cs++;
+		up->stats.vcsw++;
 
 		procsave(up);
 		if(setlabel(&up->sched)) {
@@ -1048,11 +1483,22 @@ pexit(char *exitstr, int freemem)
 	if(up->syscalltrace)
 		free(up->syscalltrace);
 	up->alarm = 0;
+	timerdel(&up->alarmt);
 	if (up->tt)
 		timerdel(up);
 	pt = proctrace;
 	if(pt)
 		pt(up, SDead, 0);
+	if(up->swarm != nil && swarmexit != nil)
+		swarmexit(up);
+	if(up->evset != nil){
+		evfree(up->evset);
+		up->evset = nil;
+	}
+	if(up->aio != nil){
+		aiofree(up->aio);
+		up->aio = nil;
+	}
 
 	/* nil out all the resources under lock (free later) */
 	qlock(&up->debug);
@@ -1170,7 +1616,7 @@ pexit(char *exitstr, int freemem)
 
 	/* Sched must not loop for these locks */
 	lock(&procalloc);
-	lock(&palloc);
+	tlock(&palloc);
 
 	edfstop(up);
 	up->state = Moribund;
@@ -1317,22 +1763,173 @@ procflushseg(Segment *s)
 				sched();
 }
 
+/*
+ *  targeted shootdowns: each processor running a proc that
+ *  shares the segment drops just the listed pages from its
+ *  tables and tlb, rather than everything at its next tick.
+ */
+static struct {
+	QLock;
+	ulong	va[NTLBVA];
+	int	nva;
+	Proc*	proc[MAXMACH];	/* whose mappings to drop, nil when done */
+	Proc*	missed[MAXMACH];	/* had switched away by then */
+} shoot;
+
+static int
+procmach(Proc *p)
+{
+	int nm;
+
+	for(nm = 0; nm < conf.nmach; nm++)
+		if(MACHP(nm)->proc == p)
+			return nm;
+	return -1;
+}
+
+static int
+hasseg(Proc *p, Segment *s)
+{
+	int ns;
+
+	if(p == nil)
+		return 0;
+	for(ns = 0; ns < NSEG; ns++)
+		if(p->seg[ns] == s)
+			return 1;
+	return 0;
+}
+
+/*
+ *  the pages at va[0..n) of s are going away, for up as well
+ *  as any other procs using s.  past NTLBVA pages only n is
+ *  looked at, and everyone flushes the lot as before.
+ */
 void
-scheddump(void)
+procflushva(Segment *s, ulong *va, int n)
 {
+	int i, nm, x, miss;
+	ulong mask;
 	Proc *p;
-	Schedq *rq;
 
-	for(rq = &runq[Nrq-1]; rq >= runq; rq--){
-		if(rq->head == 0)
+	if(n == 0)
+		return;
+	if(n > NTLBVA || mmuflushva == nil || (conf.nmach > 1 && tlbshoot == nil)){
+		if(s->ref > 1)
+			procflushseg(s);
+		if(hasseg(up, s))
+			flushmmu();
+		return;
+	}
+
+	qlock(&shoot);
+	memmove(shoot.va, va, n*sizeof(ulong));
+	shoot.nva = n;
+	mask = 0;
+	if(s->ref > 1)
+		for(i = 0; i < conf.nproc; i++){
+			p = &procalloc.arena[i];
+			if(p == up || p->state == Dead || !hasseg(p, s))
+				continue;
+			/*
+			 *  not running, so it rebuilds its tables when
+			 *  it next is; look again in case it just did.
+			 */
+			if((nm = procmach(p)) < 0){
+				p->newtlb = 1;
+				coherence();
+				if((nm = procmach(p)) < 0)
+					continue;
+			}
+			shoot.missed[nm] = nil;
+			shoot.proc[nm] = p;
+			mask |= 1<<nm;
+		}
+	if(mask){
+		coherence();
+		(*tlbshoot)(mask);
+	}
+
+	if(hasseg(up, s)){
+		x = splhi();
+		for(i = 0; i < n; i++)
+			(*mmuflushva)(va[i]);
+		splx(x);
+	}
+
+	miss = 0;
+	for(nm = 0; nm < conf.nmach; nm++)
+		if(mask & (1<<nm)){
+			while(shoot.proc[nm] != nil)
+				;
+			if(shoot.missed[nm] != nil)
+				miss++;
+		}
+	qunlock(&shoot);
+
+	/* a target moved before its processor looked: the slow way */
+	if(miss)
+		procflushseg(s);
+}
+
+/*
+ *  the tlbshoot interrupt, on each target processor.
+ */
+void
+tlbshootintr(void)
+{
+	int i;
+	Proc *p;
+
+	p = shoot.proc[m->machno];
+	if(p == nil)
+		return;
+	if(p == up)
+		for(i = 0; i < shoot.nva; i++)
+			(*mmuflushva)(shoot.va[i]);
+	else
+		shoot.missed[m->machno] = p;
+	coherence();
+	shoot.proc[m->machno] = nil;
+}
+
+static void
+dumpq(Schedq *rq, int pri)
+{
+	Proc *p;
+
+	print("rq%d:", pri);
+	for(p = rq->head; p; p = p->rnext)
+		print(" %lud(%lud)", p->pid, m->ticks - p->readytime);
+	print("\n");
+	delay(150);
+}
+
+void
+scheddump(void)
+{
+	int id, pri;
+	Runq *r;
+
+	for(pri = Nrq-1; pri >= Npriq; pri--)
+		if(runq[pri].head)
+			dumpq(&runq[pri], pri);
+	for(id = 0; id < conf.nmach; id++){
+		r = &machrunq[id];
+		if(r->n == 0 && r->nedf == 0)
 			continue;
-		print("rq%ld:", rq-runq);
-		for(p = rq->head; p; p = p->rnext)
-			print(" %lud(%lud)", p->pid, m->ticks - p->readytime);
-		print("\n");
-		delay(150);
+		print("cpu%d:\n", id);
+		if(r->nedf > 0){
+			print("edf:");
+			for(pri = 0; pri < r->nedf; pri++)
+				print(" %lud(%ld)", r->edf[pri]->pid, r->edf[pri]->edf->d);
+			print("\n");
+		}
+		for(pri = Npriq-1; pri >= 0; pri--)
+			if(r->q[pri].head)
+				dumpq(&r->q[pri], pri);
 	}
-	print("nrdy %d\n", nrdy);
+	print("nrdy %ld\n", nrdy);
 }
 
 void
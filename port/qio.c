@@ -12,6 +12,7 @@ static ulong copyblockcnt;
 static ulong consumecnt;
 static ulong producecnt;
 static ulong qcopycnt;
+static ulong splitsharecnt;
 
 static int debugging;
 
@@ -46,12 +47,15 @@ struct Queue
 	QLock	wlock;		/* mutex for writing processes */
 	Rendez	wr;		/* process waiting to write */
 
+	Pollq	poll;		/* event sets watching it */
+
 	char	err[ERRMAX];
 };
 
 enum
 {
 	Maxatomic	= 64*1024,
+	Sharemin	= 256,		/* bytes worth sharing a buffer rather than copying */
 };
 
 uint	qiomaxatomic = Maxatomic;
@@ -63,8 +67,8 @@ ixsummary(void)
 	iallocsummary();
 	print("pad %lud, concat %lud, pullup %lud, copy %lud\n",
 		padblockcnt, concatblockcnt, pullupblockcnt, copyblockcnt);
-	print("consume %lud, produce %lud, qcopy %lud\n",
-		consumecnt, producecnt, qcopycnt);
+	print("consume %lud, produce %lud, qcopy %lud, splitshare %lud\n",
+		consumecnt, producecnt, qcopycnt, splitsharecnt);
 }
 
 /*
@@ -83,6 +87,17 @@ freeblist(Block *b)
 	}
 }
 
+/*
+ *  a copy goes out the way the block would: cut up,
+ *  or summed by the device
+ */
+static void
+copytxflags(Block *nbp, Block *bp)
+{
+	nbp->flag |= bp->flag & (Btso|Bcsum);
+	nbp->mss = bp->mss;
+}
+
 /*
  *  pad a block to the front (or the back if size is negative)
  */
@@ -108,6 +123,7 @@ padblock(Block *bp, int size)
 		nbp->wp = nbp->rp;
 		memmove(nbp->wp, bp->rp, n);
 		nbp->wp += n;
+		copytxflags(nbp, bp);
 		freeb(bp);
 		nbp->rp -= size;
 	} else {
@@ -124,6 +140,7 @@ padblock(Block *bp, int size)
 		nbp = allocb(size+n);
 		memmove(nbp->wp, bp->rp, n);
 		nbp->wp += n;
+		copytxflags(nbp, bp);
 		freeb(bp);
 	}
 	QDEBUG checkb(nbp, "padblock 1");
@@ -182,6 +199,7 @@ concatblock(Block *bp)
 		nb->wp += len;
 	}
 	concatblockcnt += BLEN(nb);
+	copytxflags(nb, bp);
 	freeblist(bp);
 	QDEBUG checkb(nb, "concatblock 1");
 	return nb;
@@ -350,6 +368,7 @@ adjustblock(Block* bp, int len)
 
 	if(bp->rp+len > bp->lim){
 		nbp = copyblock(bp, len);
+		copytxflags(nbp, bp);
 		freeblist(bp);
 		QDEBUG checkb(nbp, "adjustblock 1");
 
@@ -432,12 +451,61 @@ qget(Queue *q)
 
 	iunlock(q);
 
-	if(dowakeup)
+	if(dowakeup){
 		wakeup(&q->wr);
+		pollwakeup(&q->poll);
+	}
 
 	return b;
 }
 
+/*
+ *  get up to n blocks from a queue, linked by next, taking
+ *  the lock and waking the writer once for all of them
+ */
+Block*
+qgetn(Queue *q, int n)
+{
+	int dowakeup;
+	Block *b, *first, **l;
+
+	/* sync with qwrite */
+	ilock(q);
+
+	first = nil;
+	l = &first;
+	for(; n > 0 && (b = q->bfirst) != nil; n--){
+		q->bfirst = b->next;
+		b->next = nil;
+		q->len -= BALLOC(b);
+		q->dlen -= BLEN(b);
+		QDEBUG checkb(b, "qgetn");
+		*l = b;
+		l = &b->next;
+	}
+	if(first == nil){
+		q->state |= Qstarve;
+		iunlock(q);
+		return nil;
+	}
+
+	/* if writer flow controlled, restart */
+	if((q->state & Qflow) && q->len < q->limit/2){
+		q->state &= ~Qflow;
+		dowakeup = 1;
+	} else
+		dowakeup = 0;
+
+	iunlock(q);
+
+	if(dowakeup){
+		wakeup(&q->wr);
+		pollwakeup(&q->poll);
+	}
+
+	return first;
+}
+
 /*
  *  throw away the next 'len' bytes in the queue
  */
@@ -485,8 +553,10 @@ qdiscard(Queue *q, int len)
 
 	iunlock(q);
 
-	if(dowakeup)
+	if(dowakeup){
 		wakeup(&q->wr);
+		pollwakeup(&q->poll);
+	}
 
 	return sofar;
 }
@@ -553,8 +623,10 @@ qconsume(Queue *q, void *vp, int len)
 
 	iunlock(q);
 
-	if(dowakeup)
+	if(dowakeup){
 		wakeup(&q->wr);
+		pollwakeup(&q->poll);
+	}
 
 	if(tofree != nil)
 		freeblist(tofree);
@@ -562,6 +634,10 @@ qconsume(Queue *q, void *vp, int len)
 	return len;
 }
 
+/*
+ *  add a block, or a list of them linked by next, to a queue
+ *  under one lock and with one wakeup of its reader
+ */
 int
 qpass(Queue *q, Block *b)
 {
@@ -609,8 +685,10 @@ qpass(Queue *q, Block *b)
 	}
 	iunlock(q);
 
-	if(dowakeup)
+	if(dowakeup){
 		wakeup(&q->rr);
+		pollwakeup(&q->poll);
+	}
 
 	return len;
 }
@@ -657,8 +735,10 @@ qpassnolim(Queue *q, Block *b)
 	}
 	iunlock(q);
 
-	if(dowakeup)
+	if(dowakeup){
 		wakeup(&q->rr);
+		pollwakeup(&q->poll);
+	}
 
 	return len;
 }
@@ -734,8 +814,10 @@ qproduce(Queue *q, void *vp, int len)
 		q->state |= Qflow;
 	iunlock(q);
 
-	if(dowakeup)
+	if(dowakeup){
 		wakeup(&q->rr);
+		pollwakeup(&q->poll);
+	}
 
 	return len;
 }
@@ -1005,12 +1087,34 @@ qwakeup_iunlock(Queue *q)
 		if(q->kick)
 			q->kick(q->arg);
 		wakeup(&q->wr);
+		pollwakeup(&q->poll);
 	}
 }
 
 /*
  *  get next block from a queue (up to a limit)
  */
+/*
+ *  split b after len bytes into two Blocks sharing its buffer,
+ *  returning the first and the rest in *rest; nil if out of memory
+ */
+static Block*
+splitshare(Block *b, int len, Block **rest)
+{
+	Block *nb, *rb;
+
+	if((nb = shareblock(b, b->rp, b->rp+len)) == nil)
+		return nil;
+	if((rb = shareblock(b, b->rp+len, b->wp)) == nil){
+		freeb(nb);
+		return nil;
+	}
+	freeb(b);
+	splitsharecnt++;
+	*rest = rb;
+	return nb;
+}
+
 Block*
 qbread(Queue *q, int len)
 {
@@ -1041,15 +1145,29 @@ qbread(Queue *q, int len)
 	b = qremove(q);
 	n = BLEN(b);
 
-	/* split block if it's too big and this is not a message queue */
+	/*
+	 *  split block if it's too big and this is not a message queue:
+	 *  copy a small part, otherwise share the buffer between the two
+	 */
 	nb = b;
 	if(n > len){
 		if((q->state&Qmsg) == 0){
 			n -= len;
-			b = allocb(n);
-			memmove(b->wp, nb->rp+len, n);
-			b->wp += n;
-			qputback(q, b);
+			if(len < Sharemin && len <= n){
+				nb = allocb(len);
+				memmove(nb->wp, b->rp, len);
+				nb->wp += len;
+				b->rp += len;
+				qputback(q, b);
+			} else if(n >= Sharemin && (nb = splitshare(b, len, &b)) != nil){
+				qputback(q, b);
+			} else {
+				nb = b;
+				b = allocb(n);
+				memmove(b->wp, nb->rp+len, n);
+				b->wp += n;
+				qputback(q, b);
+			}
 		}
 		nb->wp = nb->rp + len;
 	}
@@ -1164,10 +1282,17 @@ ulong noblockcnt;
 long
 qbwrite(Queue *q, Block *b)
 {
-	int n, dowakeup;
+	int n, len, dowakeup;
+	Block *last;
 	Proc *p;
 
-	n = BLEN(b);
+	/*
+	 *  a queue of messages, or one whose reader takes each write
+	 *  as a block, needs the chain made one block
+	 */
+	if(b->next != nil && (q->bypass != nil || (q->state & Qchain) == 0))
+		b = concatblock(b);
+	n = blocklen(b);
 
 	if(q->bypass){
 		(*q->bypass)(q->arg, b);
@@ -1178,7 +1303,7 @@ qbwrite(Queue *q, Block *b)
 	qlock(&q->wlock);
 	if(waserror()){
 		if(b != nil)
-			freeb(b);
+			freeblist(b);
 		qunlock(&q->wlock);
 		nexterror();
 	}
@@ -1195,7 +1320,7 @@ qbwrite(Queue *q, Block *b)
 	if(q->len >= q->limit){
 		if(q->noblock){
 			iunlock(q);
-			freeb(b);
+			freeblist(b);
 			noblockcnt += n;
 			qunlock(&q->wlock);
 			poperror();
@@ -1203,16 +1328,20 @@ qbwrite(Queue *q, Block *b)
 		}
 	}
 
-	/* queue the block */
+	/* queue the block, or the chain */
 	if(q->bfirst)
 		q->blast->next = b;
 	else
 		q->bfirst = b;
-	q->blast = b;
-	b->next = 0;
-	q->len += BALLOC(b);
-	q->dlen += n;
+	len = BALLOC(b);
 	QDEBUG checkb(b, "qbwrite");
+	for(last = b; last->next != nil; last = last->next){
+		QDEBUG checkb(last->next, "qbwrite");
+		len += BALLOC(last->next);
+	}
+	q->blast = last;
+	q->len += len;
+	q->dlen += n;
 	b = nil;
 
 	/* make sure other end gets awakened */
@@ -1229,6 +1358,7 @@ qbwrite(Queue *q, Block *b)
 	/* wakeup anyone consuming at the other end */
 	if(dowakeup){
 		p = wakeup(&q->rr);
+		pollwakeup(&q->poll);
 
 		/* if we just wokeup a higher priority process, let it run */
 		if(p != nil && p->priority > up->priority)
@@ -1359,6 +1489,7 @@ qiwrite(Queue *q, void *vp, int len)
 			if(q->kick)
 				q->kick(q->arg);
 			wakeup(&q->rr);
+			pollwakeup(&q->poll);
 		}
 
 		sofar += n;
@@ -1375,6 +1506,7 @@ void
 qfree(Queue *q)
 {
 	qclose(q);
+	pollclose(&q->poll);
 	free(q);
 }
 
@@ -1408,6 +1540,7 @@ qclose(Queue *q)
 	/* wake up readers/writers */
 	wakeup(&q->rr);
 	wakeup(&q->wr);
+	pollwakeup(&q->poll);
 }
 
 /*
@@ -1429,6 +1562,7 @@ qhangup(Queue *q, char *msg)
 	/* wake up readers/writers */
 	wakeup(&q->rr);
 	wakeup(&q->wr);
+	pollwakeup(&q->poll);
 }
 
 /*
@@ -1477,6 +1611,36 @@ qwindow(Queue *q)
 	return l;
 }
 
+/*
+ *  watch q for an event set.  returns what would not block now:
+ *  what (Pollin or Pollout) if ready, with Pollhup once closed.
+ *  otherwise flags q so the next change calls pollwakeup.
+ */
+int
+qpoll(Queue *q, Pollw *w, int what)
+{
+	int r;
+
+	pollon(w, &q->poll);
+	r = 0;
+	ilock(q);
+	if(q->state & Qclosed)
+		r = what|Pollhup;
+	else if(what == Pollin){
+		if(q->bfirst != nil)
+			r = Pollin;
+		else
+			q->state |= Qstarve;
+	} else {
+		if(q->len < q->limit)
+			r = Pollout;
+		else
+			q->state |= Qflow;
+	}
+	iunlock(q);
+	return r;
+}
+
 /*
  *  return true if we can read without blocking
  */
@@ -1504,6 +1668,20 @@ qnoblock(Queue *q, int onoff)
 	q->noblock = onoff;
 }
 
+/*
+ *  set/clear coalescing of whole blocks on read
+ */
+void
+qcoalesce(Queue *q, int onoff)
+{
+	ilock(q);
+	if(onoff)
+		q->state |= Qcoalesce;
+	else
+		q->state &= ~Qcoalesce;
+	iunlock(q);
+}
+
 /*
  *  flush the output queue
  */
@@ -1525,6 +1703,7 @@ qflush(Queue *q)
 
 	/* wake up readers/writers */
 	wakeup(&q->wr);
+	pollwakeup(&q->poll);
 }
 
 int
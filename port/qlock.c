@@ -4,19 +4,124 @@
 #include "dat.h"
 #include "fns.h"
 
+enum
+{
+	Maxspin	= 20000,	/* times round the spin loop before sleeping */
+	Nqlsite	= 256,
+};
+
 struct {
 	ulong rlock;
 	ulong rlockq;
+	ulong rlockspin;
 	ulong wlock;
 	ulong wlockq;
+	ulong wlockspin;
 	ulong qlock;
 	ulong qlockq;
+	ulong qlockspin;
 } rwstats;
 
+/*
+ *  per calling pc of qlock and wlock: how often the lock was
+ *  taken, spun for, slept for, and how long it was held
+ */
+typedef struct Qlsite Qlsite;
+struct Qlsite
+{
+	uintptr	pc;
+	ulong	locks;
+	ulong	spins;		/* spun for the holder to finish */
+	ulong	spinwins;	/* ... and got the lock without sleeping */
+	ulong	sleeps;
+	uvlong	hold;		/* fastticks */
+	uvlong	maxhold;
+};
+
+static struct
+{
+	Lock;
+	Qlsite	site[Nqlsite];
+	Qlsite	other;		/* when site is full */
+} qlsites;
+
+static Qlsite*
+qlsite(uintptr pc)
+{
+	int i, h;
+	Qlsite *s;
+
+	h = (pc>>2) % Nqlsite;
+	for(i = 0; i < Nqlsite; i++){
+		s = &qlsites.site[h];
+		if(s->pc == pc)
+			return s;
+		if(s->pc == 0){
+			lock(&qlsites);
+			if(s->pc == 0)
+				s->pc = pc;
+			unlock(&qlsites);
+			if(s->pc == pc)
+				return s;
+		}
+		if(++h == Nqlsite)
+			h = 0;
+	}
+	return &qlsites.other;
+}
+
+static void
+held(uintptr pc, uvlong start)
+{
+	Qlsite *s;
+	uvlong t;
+
+	if(start == 0)
+		return;
+	s = qlsite(pc);
+	t = fastticks(nil) - start;
+	s->hold += t;
+	if(t > s->maxhold)
+		s->maxhold = t;
+}
+
+static int
+qlsitecmp(void *a, void *b)
+{
+	Qlsite *x, *y;
+
+	x = a;
+	y = b;
+	if(x->hold != y->hold)
+		return x->hold < y->hold ? 1 : -1;
+	if(x->sleeps != y->sleeps)
+		return x->sleeps < y->sleeps ? 1 : -1;
+	return 0;
+}
+
+/*
+ *  is p holding a lock and running on another processor?
+ *  If so it is likely to let go sooner than we could
+ *  sleep and be woken.
+ */
+static int
+onproc(Proc *p)
+{
+	Mach *mp;
+
+	if(p == nil || p == up || conf.nmach == 1)
+		return 0;
+	mp = p->mach;
+	return mp != nil && mp != MACHP(m->machno) && p->state == Running;
+}
+
 void
 qlock(QLock *q)
 {
 	Proc *p;
+	Qlsite *s;
+	uintptr pc;
+	int spins;
 
 	if(m->ilockdepth != 0)
 		print("qlock: %#p: ilockdepth %d\n", getcallerpc(&q), m->ilockdepth);
@@ -25,16 +130,37 @@ qlock(QLock *q)
 
 	if(q->use.key == 0x55555555)
 		panic("qlock: q %#p, key 5*\n", q);
+	pc = getcallerpc(&q);
+	s = qlsite(pc);
+	s->locks++;
+	spins = 0;
 	lock(&q->use);
 	rwstats.qlock++;
+	while(q->locked && spins < Maxspin && onproc(q->owner)){
+		unlock(&q->use);
+		do
+			spins++;
+		while(q->locked && spins < Maxspin && onproc(q->owner));
+		lock(&q->use);
+	}
+	if(spins){
+		rwstats.qlockspin++;
+		s->spins++;
+	}
 	if(!q->locked) {
 		q->locked = 1;
+		q->owner = up;
+		q->pc = pc;
+		q->start = fastticks(nil);
 		unlock(&q->use);
+		if(spins)
+			s->spinwins++;
 		return;
 	}
 	if(up == 0)
 		panic("qlock");
 	rwstats.qlockq++;
+	s->sleeps++;
 	p = q->tail;
 	if(p == 0)
 		q->head = up;
@@ -43,7 +169,7 @@ qlock(QLock *q)
 	q->tail = up;
 	up->qnext = 0;
 	up->state = Queueing;
-	up->qpc = getcallerpc(&q);
+	up->qpc = pc;
 	unlock(&q->use);
 	sched();
 }
@@ -58,7 +184,11 @@ canqlock(QLock *q)
 		return 0;
 	}
 	q->locked = 1;
+	q->owner = up;
+	q->pc = getcallerpc(&q);
+	q->start = fastticks(nil);
 	unlock(&q->use);
+	qlsite(q->pc)->locks++;
 	return 1;
 }
 
@@ -71,16 +201,22 @@ qunlock(QLock *q)
 	if (q->locked == 0)
 		print("qunlock called with qlock not held, from %#p\n",
 			getcallerpc(&q));
+	held(q->pc, q->start);
 	p = q->head;
 	if(p){
 		q->head = p->qnext;
 		if(q->head == 0)
 			q->tail = 0;
+		q->owner = p;
+		q->pc = p->qpc;
+		q->start = fastticks(nil);
 		unlock(&q->use);
 		ready(p);
 		return;
 	}
 	q->locked = 0;
+	q->owner = nil;
+	q->start = 0;
 	unlock(&q->use);
 }
 
@@ -88,9 +224,20 @@ void
 rlock(RWlock *q)
 {
 	Proc *p;
+	int spins;
 
+	spins = 0;
 	lock(&q->use);
 	rwstats.rlock++;
+	while(q->writer && spins < Maxspin && onproc(q->wproc)){
+		unlock(&q->use);
+		do
+			spins++;
+		while(q->writer && spins < Maxspin && onproc(q->wproc));
+		lock(&q->use);
+	}
+	if(spins)
+		rwstats.rlockspin++;
 	if(q->writer == 0 && q->head == nil){
 		/* no writer, go for it */
 		q->readers++;
@@ -132,6 +279,9 @@ runlock(RWlock *q)
 	if(q->head == 0)
 		q->tail = 0;
 	q->writer = 1;
+	q->wproc = p;
+	q->wpc = p->qpc;
+	q->wstart = fastticks(nil);
 	unlock(&q->use);
 	ready(p);
 }
@@ -140,20 +290,42 @@ void
 wlock(RWlock *q)
 {
 	Proc *p;
+	Qlsite *s;
+	uintptr pc;
+	int spins;
 
+	pc = getcallerpc(&q);
+	s = qlsite(pc);
+	s->locks++;
+	spins = 0;
 	lock(&q->use);
 	rwstats.wlock++;
+	while(q->writer && q->readers == 0 && spins < Maxspin && onproc(q->wproc)){
+		unlock(&q->use);
+		do
+			spins++;
+		while(q->writer && spins < Maxspin && onproc(q->wproc));
+		lock(&q->use);
+	}
+	if(spins){
+		rwstats.wlockspin++;
+		s->spins++;
+	}
 	if(q->readers == 0 && q->writer == 0){
 		/* noone waiting, go for it */
-		q->wpc = getcallerpc(&q);
+		q->wpc = pc;
 		q->wproc = up;
+		q->wstart = fastticks(nil);
 		q->writer = 1;
 		unlock(&q->use);
+		if(spins)
+			s->spinwins++;
 		return;
 	}
 
 	/* wait */
 	rwstats.wlockq++;
+	s->sleeps++;
 	p = q->tail;
 	if(up == nil)
 		panic("wlock");
@@ -164,6 +336,7 @@ wlock(RWlock *q)
 	q->tail = up;
 	up->qnext = 0;
 	up->state = QueueingW;
+	up->qpc = pc;
 	unlock(&q->use);
 	sched();
 }
@@ -174,6 +347,8 @@ wunlock(RWlock *q)
 	Proc *p;
 
 	lock(&q->use);
+	held(q->wpc, q->wstart);
+	q->wstart = 0;
 	p = q->head;
 	if(p == nil){
 		q->writer = 0;
@@ -185,6 +360,9 @@ wunlock(RWlock *q)
 		q->head = p->qnext;
 		if(q->head == nil)
 			q->tail = nil;
+		q->wproc = p;
+		q->wpc = p->qpc;
+		q->wstart = fastticks(nil);
 		unlock(&q->use);
 		ready(p);
 		return;
@@ -221,3 +399,51 @@ canrlock(RWlock *q)
 	unlock(&q->use);
 	return 0;
 }
+
+/*
+ *  totals for each kind of lock, then a line for each calling
+ *  pc, longest held first: locks spins spinwins sleeps holdus maxholdus
+ */
+int
+qlockstats(char *buf, int n)
+{
+	int i, ns;
+	char *p, *e;
+	Qlsite *s, *t;
+
+	t = smalloc((Nqlsite+1)*sizeof(Qlsite));
+	ns = 0;
+	for(i = 0; i <= Nqlsite; i++){
+		s = i < Nqlsite ? &qlsites.site[i] : &qlsites.other;
+		if(s->locks != 0)
+			t[ns++] = *s;
+	}
+	qsort(t, ns, sizeof(Qlsite), qlsitecmp);
+
+	p = buf;
+	e = buf + n;
+	p = seprint(p, e, "qlock %lud sleeps %lud spins %lud\n",
+		rwstats.qlock, rwstats.qlockq, rwstats.qlockspin);
+	p = seprint(p, e, "rlock %lud sleeps %lud spins %lud\n",
+		rwstats.rlock, rwstats.rlockq, rwstats.rlockspin);
+	p = seprint(p, e, "wlock %lud sleeps %lud spins %lud\n",
+		rwstats.wlock, rwstats.wlockq, rwstats.wlockspin);
+	for(i = 0; i < ns; i++){
+		s = &t[i];
+		p = seprint(p, e, "%#p %lud %lud %lud %lud %llud %llud\n",
+			s->pc, s->locks, s->spins, s->spinwins, s->sleeps,
+			fastticks2us(s->hold), fastticks2us(s->maxhold));
+	}
+	free(t);
+	return p - buf;
+}
+
+void
+qlockstatsclear(void)
+{
+	lock(&qlsites);
+	memset(qlsites.site, 0, sizeof qlsites.site);
+	memset(&qlsites.other, 0, sizeof qlsites.other);
+	unlock(&qlsites);
+	memset(&rwstats, 0, sizeof rwstats);
+}
@@ -5,6 +5,41 @@
 #include	"fns.h"
 #include	"../port/error.h"
 
+/*
+ *  Clock jitter, gathered slowly into the ring below, seeds a
+ *  master key; rdrand or the like (hwrandom) is mixed in where
+ *  the processor has it.  Output comes from ChaCha20, a generator
+ *  on each processor keyed from the master, so readers neither
+ *  block nor share a lock once the first seed is in.  Each one
+ *  replaces its key from its own stream after every request, so
+ *  the state never gives away what it produced before.
+ */
+enum
+{
+	Seedbytes	= 32,
+	Reseedms	= 60*1000,
+	Chunk		= 1024,		/* bytes made under one lock */
+};
+
+typedef struct Chacha Chacha;
+struct Chacha
+{
+	Lock;
+	u32int	key[8];
+	ulong	gen;		/* of the master key this came from */
+	uchar	buf[64];
+	int	nbuf;		/* unused bytes at the end of buf */
+};
+
+static struct
+{
+	Lock;
+	u32int	key[8];
+	u32int	ctr;
+	ulong	gen;		/* reseeds; 0 until the first */
+} master;
+
+static Chacha chacha[MAXMACH];
 
 struct Rb
 {
@@ -81,21 +116,11 @@ randomclock(void)
 		wakeup(&rb.consumer);
 }
 
-void
-randominit(void)
-{
-	/* Frequency close but not equal to HZ */
-	addclock0link(randomclock, 13);
-	rb.ep = rb.buf + sizeof(rb.buf);
-	rb.rp = rb.wp = rb.buf;
-	kproc("genrandom", genrandom, 0);
-}
-
 /*
  *  consume random bytes from a circular buffer
  */
-ulong
-randomread(void *xp, ulong n)
+static ulong
+ringread(void *xp, ulong n)
 {
 	uchar *e, *p;
 	ulong x;
@@ -137,3 +162,178 @@ randomread(void *xp, ulong n)
 
 	return n;
 }
+
+#define	ROTL(v, n)	((v)<<(n) | (v)>>(32-(n)))
+#define	QR(a, b, c, d)	a += b; d ^= a; d = ROTL(d, 16); \
+			c += d; b ^= c; b = ROTL(b, 12); \
+			a += b; d ^= a; d = ROTL(d, 8); \
+			c += d; b ^= c; b = ROTL(b, 7)
+
+/* the ChaCha20 block function of RFC 7539 */
+static void
+chachablock(u32int *key, u32int ctr, u32int nonce, uchar *out)
+{
+	u32int s[16], x[16], v;
+	int i;
+
+	s[0] = 0x61707865;
+	s[1] = 0x3320646e;
+	s[2] = 0x79622d32;
+	s[3] = 0x6b206574;
+	memmove(s+4, key, 8*sizeof(u32int));
+	s[12] = ctr;
+	s[13] = nonce;
+	s[14] = 0;
+	s[15] = 0;
+	memmove(x, s, sizeof x);
+	for(i = 0; i < 10; i++){
+		QR(x[0], x[4], x[8], x[12]);
+		QR(x[1], x[5], x[9], x[13]);
+		QR(x[2], x[6], x[10], x[14]);
+		QR(x[3], x[7], x[11], x[15]);
+		QR(x[0], x[5], x[10], x[15]);
+		QR(x[1], x[6], x[11], x[12]);
+		QR(x[2], x[7], x[8], x[13]);
+		QR(x[3], x[4], x[9], x[14]);
+	}
+	for(i = 0; i < 16; i++){
+		v = x[i] + s[i];
+		out[4*i] = v;
+		out[4*i+1] = v>>8;
+		out[4*i+2] = v>>16;
+		out[4*i+3] = v>>24;
+	}
+	memset(x, 0, sizeof x);
+	memset(s, 0, sizeof s);
+}
+
+static void
+setkey(u32int *key, uchar *p)
+{
+	int i;
+
+	for(i = 0; i < 8; i++, p += 4)
+		key[i] = p[0] | p[1]<<8 | p[2]<<16 | p[3]<<24;
+}
+
+/*
+ *  fold pool into the master key; the processors rekey
+ *  from it when they see the new generation
+ */
+static void
+reseed(uchar *pool)
+{
+	uchar b[64];
+	u32int k[8];
+	int i;
+
+	setkey(k, pool);
+	ilock(&master);
+	for(i = 0; i < 8; i++)
+		k[i] ^= master.key[i];
+	chachablock(k, 0, ~0, b);
+	setkey(master.key, b);
+	master.gen++;
+	iunlock(&master);
+	memset(b, 0, sizeof b);
+	memset(k, 0, sizeof k);
+}
+
+static void
+seedproc(void*)
+{
+	uchar pool[Seedbytes];
+	ulong w;
+	int i;
+
+	for(;;){
+		ringread(pool, sizeof pool);
+		if(hwrandom != nil)
+			for(i = 0; i+sizeof w <= sizeof pool; i += sizeof w)
+				if((*hwrandom)(&w)){
+					pool[i] ^= w;
+					pool[i+1] ^= w>>8;
+					pool[i+2] ^= w>>16;
+					pool[i+3] ^= w>>24;
+				}
+		reseed(pool);
+		memset(pool, 0, sizeof pool);
+		tsleep(&up->sleep, return0, 0, Reseedms);
+	}
+}
+
+void
+randominit(void)
+{
+	/* Frequency close but not equal to HZ */
+	addclock0link(randomclock, 13);
+	rb.ep = rb.buf + sizeof(rb.buf);
+	rb.rp = rb.wp = rb.buf;
+	kproc("genrandom", genrandom, 0);
+	kproc("randomseed", seedproc, 0);
+}
+
+/* up to Chunk bytes from c, which is locked */
+static void
+chacharead(Chacha *c, uchar *p, ulong n)
+{
+	uchar b[64];
+	ulong i;
+
+	if(c->gen != master.gen){
+		ilock(&master);
+		chachablock(master.key, master.ctr++, m->machno, b);
+		c->gen = master.gen;
+		iunlock(&master);
+		setkey(c->key, b);
+		c->nbuf = 0;
+	}
+	i = 0;
+	if(c->nbuf > 0){
+		i = c->nbuf;
+		if(i > n)
+			i = n;
+		memmove(p, c->buf+sizeof c->buf-c->nbuf, i);
+		memset(c->buf+sizeof c->buf-c->nbuf, 0, i);
+		c->nbuf -= i;
+	}
+	for(; i+sizeof b <= n; i += sizeof b)
+		chachablock(c->key, i/sizeof b + 1, 0, p+i);
+	if(i < n){
+		chachablock(c->key, i/sizeof b + 1, 0, b);
+		memmove(p+i, b, n-i);
+	}
+
+	/* a new key and what is left of its first block for next time */
+	chachablock(c->key, 0, 0, c->buf);
+	setkey(c->key, c->buf);
+	memset(c->buf, 0, 32);
+	c->nbuf = sizeof c->buf - 32;
+	memset(b, 0, sizeof b);
+}
+
+/*
+ *  random bytes for the kernel and #c/random; until the first
+ *  seed is in they come straight from the ring, as they used to
+ */
+ulong
+randomread(void *xp, ulong n)
+{
+	Chacha *c;
+	uchar *p;
+	ulong i, k;
+
+	if(master.gen == 0)
+		return ringread(xp, n);
+	p = xp;
+	for(i = 0; i < n; i += k){
+		k = n - i;
+		if(k > Chunk)
+			k = Chunk;
+		c = &chacha[m->machno];
+		lock(c);
+		chacharead(c, p+i, k);
+		unlock(c);
+	}
+	return n;
+}
@@ -1,9 +1,13 @@
 /*
  * Storage Device.
  */
+typedef struct SDbio SDbio;
+typedef struct SDcache SDcache;
+typedef struct SDcline SDcline;
 typedef struct SDev SDev;
 typedef struct SDifc SDifc;
 typedef struct SDio SDio;
+typedef struct SDiov SDiov;
 typedef struct SDpart SDpart;
 typedef struct SDperm SDperm;
 typedef struct SDreq SDreq;
@@ -43,6 +47,14 @@ struct SDunit {
 	int	state;
 	SDreq*	req;
 	SDperm	rawperm;
+
+	Lock	iolock;			/* request queue */
+	SDbio*	ioq;			/* waiting, in block order */
+	int	ionrun;			/* batches at the controller */
+	int	iodepth;		/* set by the driver; 0 is 1 */
+	uvlong	iohead;			/* block after the last batch */
+	ulong	iomerged;		/* requests merged into another */
+	SDcache*cache;			/* nil or block cache */
 };
 
 /*
@@ -83,6 +95,14 @@ struct SDifc {
 	void	(*clear)(SDev*);
 	char*	(*rtopctl)(SDev*, char*, char*);
 	int	(*wtopctl)(SDev*, Cmdbuf*);
+
+	/* optional: bio scattered over up to SDmaxiov buffers */
+	long	(*biov)(SDunit*, int, int, SDiov*, int, uvlong);
+};
+
+struct SDiov {
+	uchar*	data;
+	long	len;		/* bytes, whole sectors */
 };
 
 struct SDreq {
@@ -132,6 +152,7 @@ enum {
 	SDbusy		= 0x08,		/* busy */
 
 	SDmaxio		= 2048*1024,
+	SDmaxiov	= 32,
 	SDnpart		= 16,
 };
 
@@ -158,6 +179,7 @@ struct SDio {
 	int	(*cmd)(u32int, u32int, u32int*);
 	void	(*iosetup)(int, void*, int, int);
 	void	(*io)(int, uchar*, int);
+	void	(*iov)(int, SDiov*, int);	/* optional */
 };
 
 extern SDio sdio;
@@ -74,6 +74,8 @@ struct Ctlr {
 };
 
 extern SDifc sdmmcifc;
+
+static long mmcbiov(SDunit*, int, int, SDiov*, int, uvlong);
 extern SDio sdio;
 
 static uint
@@ -138,6 +140,8 @@ mmcpnp(void)
 	sdev->ctlr = ctl;
 	ctl->dev = sdev;
 	ctl->io = &sdio;
+	if(sdio.iov != nil)
+		sdmmcifc.biov = mmcbiov;
 	return sdev;
 }
 
@@ -296,6 +300,47 @@ mmcbio(SDunit *unit, int lun, int write, void *data, long nb, uvlong bno)
 	return (b - bno) * len;
 }
 
+/*
+ * One multi-block command for the sectors of all the
+ * buffers in v, which the host controller scatters.
+ */
+static long
+mmcbiov(SDunit *unit, int lun, int write, SDiov *v, int nv, uvlong bno)
+{
+	int i, len, tries;
+	long nb;
+	u32int r[4];
+	Ctlr *ctl;
+	SDio *io;
+
+	USED(lun);
+	ctl = unit->dev->ctlr;
+	io = ctl->io;
+	assert(unit->subno == 0);
+	if(unit->sectors == 0)
+		error("media change");
+	len = unit->secsize;
+	nb = 0;
+	for(i = 0; i < nv; i++)
+		nb += v[i].len / len;
+	tries = 0;
+	while(waserror())
+		if(++tries == 3)
+			nexterror();
+	io->iosetup(write, v[0].data, len, nb);
+	if(waserror()){
+		io->cmd(STOP_TRANSMISSION, 0, r);
+		nexterror();
+	}
+	io->cmd(write? WRITE_MULTIPLE_BLOCK: READ_MULTIPLE_BLOCK,
+		ctl->ocr & Ccs? bno: bno * len, r);
+	io->iov(write, v, nv);
+	poperror();
+	io->cmd(STOP_TRANSMISSION, 0, r);
+	poperror();
+	return nb * len;
+}
+
 static int
 mmcrio(SDreq*)
 {
@@ -38,6 +38,7 @@ static struct Imagealloc
 }imagealloc;
 
 Segment* (*_globalsegattach)(Proc*, char*);
+long (*_globalsegio)(char*, void*, long, vlong, int);
 
 void
 initseg(void)
@@ -199,10 +200,17 @@ dupseg(Segment **seg, int segno, int share)
 		n->flen = s->flen;
 		break;
 	}
+	/*
+	 * Share the ptes rather than copy them: each segment
+	 * copies a pte when it first changes it (pteunshare),
+	 * and the pages in it are copied on write as before.
+	 */
 	size = s->mapsize;
 	for(i = 0; i < size; i++)
-		if(pte = s->map[i])
-			n->map[i] = ptecpy(pte);
+		if(pte = s->map[i]){
+			incref(pte);
+			n->map[i] = pte;
+		}
 
 	n->flushme = s->flushme;
 	if(s->ref > 1)
@@ -232,6 +240,8 @@ segpage(Segment *s, Page *p)
 	pte = &s->map[off/PTEMAPMEM];
 	if(*pte == 0)
 		*pte = ptealloc();
+	else
+		pteunshare(s, pte);
 
 	pg = &(*pte)->pages[(off&(PTEMAPMEM-1))/BY2PG];
 	*pg = p;
@@ -331,7 +341,7 @@ imagereclaim(void)
 	if(!canqlock(&imagealloc.ireclaim))
 		return;
 
-	lock(&palloc);
+	tlock(&palloc);
 	ticks = fastticks(nil);
 	n = 0;
 	/*
@@ -349,7 +359,7 @@ imagereclaim(void)
 		}
 	}
 	ticks = fastticks(nil) - ticks;
-	unlock(&palloc);
+	tunlock(&palloc);
 	irstats.loops++;
 	irstats.ticks += ticks;
 	if(ticks > irstats.maxt)
@@ -476,7 +486,6 @@ ibrk(ulong addr, int seg)
 		s->top = newtop;
 		s->size = newsize;
 		qunlock(&s->lk);
-		flushmmu();
 		return 0;
 	}
 
@@ -516,8 +525,8 @@ ibrk(ulong addr, int seg)
 void
 mfreeseg(Segment *s, ulong start, int pages)
 {
-	int i, j, size;
-	ulong soff;
+	int i, j, size, nva;
+	ulong soff, va[NTLBVA];
 	Page *pg;
 	Page *list;
 
@@ -526,6 +535,7 @@ mfreeseg(Segment *s, ulong start, int pages)
 
 	size = s->mapsize;
 	list = nil;
+	nva = 0;
 	for(i = soff/PTEMAPMEM; i < size; i++) {
 		if(pages <= 0)
 			break;
@@ -534,6 +544,7 @@ mfreeseg(Segment *s, ulong start, int pages)
 			j = 0;
 			continue;
 		}
+		pteunshare(s, &s->map[i]);
 		while(j < PTEPERTAB) {
 			pg = s->map[i]->pages[j];
 			/*
@@ -541,11 +552,11 @@ mfreeseg(Segment *s, ulong start, int pages)
 			 * but we have to make sure other processors flush the
 			 * entry from their TLBs before the page is freed.
 			 * We construct a list of the pages to be freed, zero
-			 * the entries, then (below) call procflushseg, and call
+			 * the entries, then (below) call procflushva, and call
 			 * putpage on the whole list.
 			 *
 			 * Swapped-out pages don't appear in TLBs, so it's okay
-			 * to putswap those pages before procflushseg.
+			 * to putswap those pages before procflushva.
 			 */
 			if(pg){
 				if(onswap(pg))
@@ -553,6 +564,9 @@ mfreeseg(Segment *s, ulong start, int pages)
 				else{
 					pg->next = list;
 					list = pg;
+					if(nva < NTLBVA)
+						va[nva] = s->base + i*PTEMAPMEM + j*BY2PG;
+					nva++;
 				}
 				s->map[i]->pages[j] = 0;
 			}
@@ -563,9 +577,8 @@ mfreeseg(Segment *s, ulong start, int pages)
 		j = 0;
 	}
 out:
-	/* flush this seg in all other processes */
-	if(s->ref > 1)
-		procflushseg(s);
+	/* flush the freed pages in this and all other processes */
+	procflushva(s, va, nva);
 
 	/* free the pages */
 	for(pg = list; pg != nil; pg = list){
@@ -707,7 +720,7 @@ found:
 	if(len > ps->size)
 		error(Enovmem);
 
-	attr &= ~SG_TYPE;		/* Turn off what is not allowed */
+	attr &= ~(SG_TYPE|SG_CACHED);	/* Turn off what is not allowed */
 	attr |= ps->attr;		/* Copy in defaults */
 
 	s = newseg(attr, va, len/BY2PG);
@@ -11,6 +11,21 @@ static int	needpages(void*);
 static void	pageout(Proc*, Segment*);
 static void	pagepte(int, Page**);
 static void	pager(void*);
+static void	swapio(void*);
+
+enum
+{
+	Nclust	= 16,		/* pages in one swap write */
+	Nswapq	= 8,		/* clusters queued for the writers */
+	Nswapio	= 2,		/* writer kprocs, so writes overlap */
+};
+
+typedef struct Swapio Swapio;
+struct Swapio
+{
+	int	n;
+	Page	*pg[Nclust];	/* at consecutive swap addresses */
+};
 
 Image 	swapimage;
 
@@ -18,18 +33,38 @@ static 	int	swopen;
 static	Page	**iolist;
 static	int	ioptr;
 
-static	ulong	genage, genclock, gencount;
-static	uvlong	gensum;
+/* swap slots reserved for the segment pageout is working on */
+static	ulong	clbase;
+static	int	clleft;
 
+static struct
+{
+	Lock;
+	Rendez	room;		/* pager waits for a free slot */
+	Rendez	work[Nswapio];	/* each writer waits for a cluster */
+	uint	rd;
+	uint	wr;
+	int	busy;		/* writers doing i/o */
+	Swapio	q[Nswapq];
+	ulong	writes;
+	ulong	pages;
+} swapq;
+
+static	ulong	nscan, nref, nmmuref;
+
+/*
+ * The pager's clock hand has been all the way round s:
+ * pages are aged against the mean of the sweep just done.
+ */
 static void
-gentick(void)
+segtick(Segment *s)
 {
-	genclock++;
-	if(gencount)
-		genage = gensum / gencount;
+	s->clock++;
+	if(s->agecount)
+		s->age = s->agesum / s->agecount;
 	else
-		genage = 0;
-	gensum = gencount = 0;
+		s->age = 0;
+	s->agesum = s->agecount = 0;
 }
 
 void
@@ -70,6 +105,70 @@ newswap(void)
 	return (look-swapalloc.swmap) * BY2PG;
 }
 
+/*
+ * Up to n consecutive swap slots, as many as are free after the
+ * first free one; *np is set to how many were allocated.
+ */
+static ulong
+newswapn(int *np)
+{
+	uchar *look;
+	int n;
+
+	lock(&swapalloc);
+
+	if(swapalloc.free == 0){
+		unlock(&swapalloc);
+		return ~0;
+	}
+
+	look = memchr(swapalloc.last, 0, swapalloc.top-swapalloc.last);
+	if(look == 0)
+		panic("inconsistent swap");
+
+	for(n = 1; n < *np && look+n < swapalloc.top && look[n] == 0; n++)
+		;
+	memset(look, 1, n);
+	swapalloc.last = look+n-1;
+	swapalloc.free -= n;
+	unlock(&swapalloc);
+	*np = n;
+	return (look-swapalloc.swmap) * BY2PG;
+}
+
+/*
+ * Next slot of the cluster reserved for this segment, so that
+ * its pages go to disk in runs.
+ */
+static ulong
+clusterswap(void)
+{
+	ulong daddr;
+
+	if(clleft == 0){
+		clleft = Nclust;
+		clbase = newswapn(&clleft);
+		if(clbase == ~0){
+			clleft = 0;
+			return ~0;
+		}
+	}
+	daddr = clbase;
+	clbase += BY2PG;
+	clleft--;
+	return daddr;
+}
+
+static void
+clusterfree(void)
+{
+	while(clleft > 0){
+		putswap((Page*)clbase);
+		clbase += BY2PG;
+		clleft--;
+	}
+}
+
 void
 putswap(Page *p)
 {
@@ -107,10 +206,14 @@ kickpager(void)
 {
 	static int started;
 
+	int i;
+
 	if(started)
 		wakeup(&swapalloc.r);
 	else {
 		kproc("pager", pager, 0);
+		for(i = 0; i < Nswapio; i++)
+			kproc("swapio", swapio, (void*)i);
 		started = 1;
 	}
 }
@@ -136,10 +239,8 @@ loop:
 	while(needpages(junk)) {
 		if(swapimage.c) {
 			p++;
-			if(p >= ep){
+			if(p >= ep)
 				p = proctab(0);
-				gentick();			
-			}
 
 			if(p->state == Dead || p->noswap)
 				continue;
@@ -191,7 +292,7 @@ loop:
 static void
 pageout(Proc *p, Segment *s)
 {
-	int type, i, size;
+	int type, n, size, ref;
 	ulong age;
 	Pte *l;
 	Page **pg, *entry;
@@ -211,45 +312,62 @@ pageout(Proc *p, Segment *s)
 	}
 
 	if(waserror()) {
+		clusterfree();
 		qunlock(&s->lk);
 		putseg(s);
 		return;
 	}
 
-	/* Pass through the pte tables looking for memory pages to swap out */
+	/*
+	 * Sweep the pte tables from where the last pass stopped.
+	 * A page is stamped with the segment's clock whenever it
+	 * is seen referenced, by its fault or by the mmu, and goes
+	 * out once it has been idle longer than the segment's mean.
+	 */
 	type = s->type&SG_TYPE;
 	size = s->mapsize;
-	for(i = 0; i < size; i++) {
-		l = s->map[i];
-		if(l == 0)
+	for(n = 0; n <= size; n++) {
+		if(s->hand >= size) {
+			s->hand = 0;
+			segtick(s);
+		}
+		l = s->map[s->hand++];
+		if(l == 0 || l->ref > 1)	/* mapped by a forked segment too */
 			continue;
 		for(pg = l->first; pg < l->last; pg++) {
 			entry = *pg;
 			if(pagedout(entry))
 				continue;
 
-			if(entry->modref & PG_REF) {
-				entry->modref &= ~PG_REF;
-				entry->gen = genclock;
+			nscan++;
+			ref = entry->modref & PG_REF;
+			entry->modref &= ~PG_REF;
+			if(mmuref != nil && (*mmuref)(p, entry->va)) {
+				nmmuref++;
+				ref = 1;
+			}
+			if(ref) {
+				nref++;
+				entry->gen = s->clock;
 			}
 
-			if(genclock < entry->gen)
-				age = ~(entry->gen - genclock);
-			else
-				age = genclock - entry->gen;
-			gensum += age;
-			gencount++;
-			if(age <= genage)
+			age = s->clock - entry->gen;
+			s->agesum += age;
+			s->agecount++;
+			if(age <= s->age)
 				continue;
 
 			pagepte(type, pg);
 
-			if(ioptr >= conf.nswppo)
+			if(ioptr >= conf.nswppo) {
+				s->hand--;	/* finish this pte next time */
 				goto out;
+			}
 		}
 	}
 out:
 	poperror();
+	clusterfree();
 	qunlock(&s->lk);
 	putseg(s);
 }
@@ -307,7 +425,7 @@ pagepte(int type, Page **pg)
 		 *  get a new swap address and clear any pages
 		 *  referring to it from the cache
 		 */
-		daddr = newswap();
+		daddr = clusterswap();
 		if(daddr == ~0)
 			break;
 		cachedel(&swapimage, daddr);
@@ -346,6 +464,10 @@ pagersummary(void)
 		palloc.user-palloc.freecount,
 		palloc.user, conf.nswap-swapalloc.free, conf.nswap,
 		ioptr);
+	print("clock: %lud scanned %lud referenced %lud by mmu\n",
+		nscan, nref, nmmuref);
+	print("swapio: %lud writes %lud pages %ud queued %d busy\n",
+		swapq.writes, swapq.pages, swapq.wr-swapq.rd, swapq.busy);
 }
 
 static int
@@ -361,41 +483,115 @@ pageiocomp(void *a, void *b)
 		return -1;
 }
 
+static int
+swaproom(void*)
+{
+	return swapq.wr - swapq.rd < Nswapq;
+}
+
+/*
+ * Hand the iolist to the swapio writers a run of consecutive
+ * swap addresses at a time, waiting only when they are Nswapq
+ * clusters behind.
+ */
 static void
 executeio(void)
 {
+	Swapio *io;
+	int i, j, n;
+
+	qsort(iolist, ioptr, sizeof iolist[0], pageiocomp);
+	if(ioptr > conf.nswppo)
+		panic("executeio: ioptr %d > %d", ioptr, conf.nswppo);
+	for(i = 0; i < ioptr; i += n) {
+		for(n = 1; i+n < ioptr && n < Nclust; n++)
+			if(iolist[i+n]->daddr != iolist[i]->daddr + n*BY2PG)
+				break;
+		while(!swaproom(nil))
+			sleep(&swapq.room, swaproom, nil);
+		lock(&swapq);
+		io = &swapq.q[swapq.wr % Nswapq];
+		io->n = n;
+		memmove(io->pg, &iolist[i], n*sizeof(Page*));
+		swapq.wr++;
+		unlock(&swapq);
+		for(j = 0; j < Nswapio; j++)
+			wakeup(&swapq.work[j]);
+	}
+	ioptr = 0;
+}
+
+static int
+swapwork(void*)
+{
+	return swapq.wr != swapq.rd;
+}
+
+/*
+ * Write clusters of pages to the swap channel.  A cluster of
+ * more than one page is copied into a buffer so that it goes
+ * out in a single write.
+ */
+static void
+swapio(void *a)
+{
+	Swapio io;
 	Page *out;
-	int i, n;
+	int i, n, me;
 	Chan *c;
-	char *kaddr;
+	uchar *buf, *kaddr;
 	KMap *k;
 
-	c = swapimage.c;
-	qsort(iolist, ioptr, sizeof iolist[0], pageiocomp);
-	for(i = 0; i < ioptr; i++) {
-		if(ioptr > conf.nswppo)
-			panic("executeio: ioptr %d > %d", ioptr, conf.nswppo);
-		out = iolist[i];
-		k = kmap(out);
-		kaddr = (char*)VA(k);
-
-		if(waserror())
-			panic("executeio: page out I/O error");
-
-		n = devtab[c->type]->write(c, kaddr, BY2PG, out->daddr);
-		if(n != BY2PG)
-			nexterror();
-
-		kunmap(k);
-		poperror();
-
-		/* Free up the page after I/O */
-		lock(out);
-		out->ref--;
-		unlock(out);
-		putpage(out);
+	me = (int)a;
+	buf = smalloc(Nclust*BY2PG);
+	if(waserror())
+		panic("swapio: page out I/O error");
+	for(;;){
+		sleep(&swapq.work[me], swapwork, nil);
+		lock(&swapq);
+		if(swapq.rd == swapq.wr){
+			unlock(&swapq);
+			continue;
+		}
+		io = swapq.q[swapq.rd++ % Nswapq];
+		swapq.busy++;
+		unlock(&swapq);
+		wakeup(&swapq.room);
+
+		up->psstate = "Swapio";
+		c = swapimage.c;
+		if(io.n == 1){
+			k = kmap(io.pg[0]);
+			kaddr = (uchar*)VA(k);
+			n = devtab[c->type]->write(c, kaddr, BY2PG, io.pg[0]->daddr);
+			kunmap(k);
+		}else{
+			for(i = 0; i < io.n; i++){
+				k = kmap(io.pg[i]);
+				memmove(buf+i*BY2PG, (uchar*)VA(k), BY2PG);
+				kunmap(k);
+			}
+			n = devtab[c->type]->write(c, buf, io.n*BY2PG, io.pg[0]->daddr);
+		}
+		if(n != io.n*BY2PG)
+			error(Eio);
+
+		/* Free up the pages after I/O */
+		for(i = 0; i < io.n; i++){
+			out = io.pg[i];
+			lock(out);
+			out->ref--;
+			unlock(out);
+			putpage(out);
+		}
+		lock(&swapq);
+		swapq.busy--;
+		swapq.writes++;
+		swapq.pages += io.n;
+		unlock(&swapq);
+		up->psstate = "Idle";
+		wakeup(&palloc.r);
 	}
-	ioptr = 0;
 }
 
 static int
@@ -9,6 +9,11 @@
  * The sys*() routines needn't poperror() as they return directly to syscall().
  */
 
+enum
+{
+	Maxiov	= 1024,		/* segments in one preadv or pwritev */
+};
+
 static void
 unlockfgrp(Fgrp *f)
 {
@@ -24,11 +29,15 @@ unlockfgrp(Fgrp *f)
 int
 growfd(Fgrp *f, int fd)	/* fd is always >= 0 */
 {
-	Chan **newfd, **oldfd;
+	Chan **newfd;
+	int n;
 
 	if(fd < f->nfd)
 		return 0;
-	if(fd >= f->nfd+DELTAFD)
+	n = 2*f->nfd;
+	if(n < f->nfd+DELTAFD)
+		n = f->nfd+DELTAFD;
+	if(fd >= n)
 		return -1;	/* out of range */
 	/*
 	 * Unbounded allocation is unwise
@@ -38,14 +47,10 @@ growfd(Fgrp *f, int fd)	/* fd is always >= 0 */
 		print("no free file descriptors\n");
 		return -1;
 	}
-	newfd = malloc((f->nfd+DELTAFD)*sizeof(Chan*));
+	newfd = fdalloc(n);
 	if(newfd == 0)
 		goto Exhausted;
-	oldfd = f->fd;
-	memmove(newfd, oldfd, f->nfd*sizeof(Chan*));
-	f->fd = newfd;
-	free(oldfd);
-	f->nfd += DELTAFD;
+	fdreplace(f, newfd, n);
 	if(fd > f->maxfd){
 		if(fd/100 > f->maxfd/100)
 			f->exceed = (fd/100)*100;
@@ -116,23 +121,51 @@ newfd2(int fd[2], Chan *c[2])
 	return 0;
 }
 
+/*
+ *  take a reference to c unless it has already gone
+ */
+static int
+increfnz(Chan *c)
+{
+	long x;
+
+	lock(c);
+	x = c->ref;
+	if(x > 0)
+		c->ref++;
+	unlock(c);
+	return x > 0;
+}
+
+/*
+ *  without the Fgrp lock: a chan taken from the array is held
+ *  only if it is still live and still at fd once held; Chans
+ *  are never freed, only recycled, and fd arrays outlive any
+ *  reader (see fdalloc).
+ */
 Chan*
 fdtochan(int fd, int mode, int chkmnt, int iref)
 {
-	Chan *c;
+	Chan *c, **a;
 	Fgrp *f;
+	int n;
 
-	c = 0;
 	f = up->fgrp;
-
-	lock(f);
-	if(fd<0 || f->nfd<=fd || (c = f->fd[fd])==0) {
-		unlock(f);
-		error(Ebadfd);
+	for(;;){
+		n = f->nfd;
+		coherence();
+		a = f->fd;
+		if(fd<0 || n<=fd || (c = a[fd])==0)
+			error(Ebadfd);
+		if(!iref)
+			break;
+		if(increfnz(c)){
+			coherence();
+			if(f->fd[fd] == c)
+				break;
+			cclose(c);
+		}
 	}
-	if(iref)
-		incref(c);
-	unlock(f);
 
 	if(chkmnt && (c->flag&CMSG)) {
 		if(iref)
@@ -623,6 +656,46 @@ mountfix(Chan *c, uchar *op, long n, long maxn)
 	return e-op;
 }
 
+/*
+ *  charge n bytes read or written through c to p
+ */
+void
+iocount(Proc *p, Chan *c, long n, int mode)
+{
+	int k;
+
+	if(n <= 0)
+		return;
+	switch(devtab[c->type]->dc){
+	case 'M':
+	case 'S':
+	case 'k':
+	case 'F':
+	case 'f':
+	case 'w':
+	case L'æ':
+		k = Iofile;
+		break;
+	case 'I':
+	case 'l':
+	case 'E':
+	case 'D':
+	case 'a':
+		k = Ionet;
+		break;
+	case 'C':
+		k = Iocog;
+		break;
+	default:
+		k = Ioother;
+		break;
+	}
+	if(mode == OREAD)
+		p->stats.rbytes[k] += n;
+	else
+		p->stats.wbytes[k] += n;
+}
+
 static long
 read(ulong *arg, vlong *offp)
 {
@@ -684,6 +757,7 @@ read(ulong *arg, vlong *offp)
 	c->devoffset += nn;
 	c->offset += nnn;
 	unlock(c);
+	iocount(up, c, nn, OREAD);
 
 	poperror();
 	cclose(c);
@@ -757,6 +831,7 @@ write(ulong *arg, vlong *offp)
 		c->offset -= n - m;
 		unlock(c);
 	}
+	iocount(up, c, m, OWRITE);
 
 	poperror();
 	cclose(c);
@@ -787,6 +862,145 @@ syspwrite(ulong *arg)
 	return write(arg, &v);
 }
 
+/*
+ *  copy the user's segments in, so they cannot change
+ *  under the device, and check them
+ */
+static Iovec*
+iovcopy(ulong uiov, int nio, int towrite, long *np)
+{
+	Iovec *io;
+	long n;
+	int i;
+
+	if(nio <= 0 || nio > Maxiov)
+		error(Ebadarg);
+	validaddr(uiov, nio*sizeof(Iovec), 0);
+	io = smalloc(nio*sizeof(Iovec));
+	if(waserror()){
+		free(io);
+		nexterror();
+	}
+	memmove(io, (void*)uiov, nio*sizeof(Iovec));
+	n = 0;
+	for(i = 0; i < nio; i++){
+		if(io[i].len > 0x7FFFFFFF - n)
+			error(Ebadarg);
+		validaddr((ulong)io[i].base, io[i].len, towrite);
+		n += io[i].len;
+	}
+	poperror();
+	*np = n;
+	return io;
+}
+
+static long
+rwv(ulong *arg, vlong *offp, int mode)
+{
+	Chan *c;
+	Dev *d;
+	Iovec *io;
+	long m, n, nres;
+	vlong off;
+
+	io = iovcopy(arg[1], arg[2], mode == OREAD, &n);
+	c = nil;
+	nres = 0;
+	if(waserror()){
+		if(c != nil){
+			if(nres != 0){
+				lock(c);
+				c->offset -= nres;
+				unlock(c);
+			}
+			cclose(c);
+		}
+		free(io);
+		nexterror();
+	}
+	c = fdtochan(arg[0], mode, 1, 1);
+	if(c->qid.type & QTDIR)
+		error(Eisdir);
+
+	if(offp == nil){	/* use and maintain channel's offset */
+		lock(c);
+		off = c->offset;
+		if(mode == OWRITE){
+			c->offset += n;
+			nres = n;
+		}
+		unlock(c);
+	}else
+		off = *offp;
+	if(off < 0)
+		error(Enegoff);
+
+	d = devtab[c->type];
+	if(mode == OREAD){
+		if(d->readv != nil)
+			m = d->readv(c, io, arg[2], off);
+		else
+			m = devreadv(c, io, arg[2], off);
+		if(offp == nil){
+			lock(c);
+			c->devoffset += m;
+			c->offset += m;
+			unlock(c);
+		}
+	}else{
+		if(d->writev != nil)
+			m = d->writev(c, io, arg[2], off);
+		else
+			m = devwritev(c, io, arg[2], off);
+		if(offp == nil && m < n){
+			lock(c);
+			c->offset -= n - m;
+			unlock(c);
+		}
+	}
+	iocount(up, c, m, mode);
+
+	poperror();
+	cclose(c);
+	free(io);
+
+	return m;
+}
+
+long
+syspreadv(ulong *arg)
+{
+	vlong v;
+	va_list list;
+
+	/* use varargs to guarantee alignment of vlong */
+	va_start(list, arg[2]);
+	v = va_arg(list, vlong);
+	va_end(list);
+
+	if(v == ~0ULL)
+		return rwv(arg, nil, OREAD);
+
+	return rwv(arg, &v, OREAD);
+}
+
+long
+syspwritev(ulong *arg)
+{
+	vlong v;
+	va_list list;
+
+	/* use varargs to guarantee alignment of vlong */
+	va_start(list, arg[2]);
+	v = va_arg(list, vlong);
+	va_end(list);
+
+	if(v == ~0ULL)
+		return rwv(arg, nil, OWRITE);
+
+	return rwv(arg, &v, OWRITE);
+}
+
 static void
 sseek(ulong *arg)
 {
@@ -408,6 +408,10 @@ sysexec(ulong *arg)
 	 * Free old memory.
 	 * Special segments are maintained across exec
 	 */
+	if(up->aio != nil){
+		aiofree(up->aio);
+		up->aio = nil;
+	}
 	for(i = SSEG; i <= BSEG; i++) {
 		putseg(up->seg[i]);
 		/* prevent a second free if we have an error */
@@ -786,7 +790,6 @@ syssegfree(ulong *arg)
 
 	mfreeseg(s, from, (to - from) / BY2PG);
 	qunlock(&s->lk);
-	flushmmu();
 
 	return 0;
 }
@@ -1131,3 +1134,152 @@ syssemrelease(ulong *arg)
 		error(Ebadarg);
 	return semrelease(s, addr, delta);
 }
+
+/*
+ * Wait and wake on a word of memory, for user-space locks and
+ * rings that only enter the kernel under contention.  Waiters
+ * are keyed by segment and offset, not by address, so that
+ * processes with a global segment attached at different places
+ * meet.  The handshake is semacquire's: a waiter is queued with
+ * waiting set before it looks at the word one last time, and a
+ * waker clears waiting before calling wakeup.
+ */
+enum
+{
+	Nwaddr	= 64,		/* wait table buckets */
+};
+
+typedef struct Waddr Waddr;
+struct Waddr
+{
+	Rendez;
+	Segment	*s;
+	ulong	off;
+	int	waiting;
+	Waddr	*next;
+};
+
+static struct
+{
+	Lock;
+	Waddr	*head;
+} waddrtab[Nwaddr];
+
+#define WADDRH(s, off)	(((ulong)(s)>>4 ^ (off)>>2) % Nwaddr)
+
+static void
+waddrqueue(Waddr *w)
+{
+	int h;
+
+	h = WADDRH(w->s, w->off);
+	lock(&waddrtab[h]);
+	w->next = waddrtab[h].head;
+	waddrtab[h].head = w;
+	unlock(&waddrtab[h]);
+}
+
+static void
+waddrdequeue(Waddr *w)
+{
+	int h;
+	Waddr **l;
+
+	h = WADDRH(w->s, w->off);
+	lock(&waddrtab[h]);
+	for(l = &waddrtab[h].head; *l != nil; l = &(*l)->next)
+		if(*l == w){
+			*l = w->next;
+			break;
+		}
+	unlock(&waddrtab[h]);
+}
+
+static int
+waddrwoke(void *a)
+{
+	coherence();
+	return !((Waddr*)a)->waiting;
+}
+
+/*
+ * Sleep while *addr == val, for up to ms milliseconds if ms is
+ * not zero.  1 means a wakeaddr woke us; 0 means the word had
+ * already changed or the time ran out.
+ */
+long
+syswaitaddr(ulong *arg)
+{
+	long *addr, val;
+	ulong ms;
+	int woken;
+	Segment *s;
+	Waddr w;
+
+	validaddr(arg[0], sizeof(long), 0);
+	evenaddr(arg[0]);
+	addr = (long*)arg[0];
+	val = arg[1];
+	ms = arg[2];
+
+	if((s = seg(up, (ulong)addr, 0)) == nil)
+		error(Ebadarg);
+	if(*addr != val)
+		return 0;
+
+	w.s = s;
+	w.off = (ulong)addr - s->base;
+	w.waiting = 1;
+	waddrqueue(&w);
+	coherence();
+	woken = 0;
+	if(*addr == val){
+		if(waserror()){
+			waddrdequeue(&w);
+			nexterror();
+		}
+		if(ms == 0)
+			sleep(&w, waddrwoke, &w);
+		else
+			tsleep(&w, waddrwoke, &w, ms);
+		poperror();
+		woken = !w.waiting;
+	}
+	waddrdequeue(&w);
+	return woken;
+}
+
+/*
+ * Wake up to n processes waiting on addr; returns how many.
+ */
+long
+syswakeaddr(ulong *arg)
+{
+	long n, woke;
+	ulong off;
+	int h;
+	Segment *s;
+	Waddr *w;
+
+	validaddr(arg[0], sizeof(long), 0);
+	evenaddr(arg[0]);
+	n = arg[1];
+	if(n <= 0)
+		return 0;
+
+	if((s = seg(up, arg[0], 0)) == nil)
+		error(Ebadarg);
+	off = arg[0] - s->base;
+	h = WADDRH(s, off);
+	woke = 0;
+	lock(&waddrtab[h]);
+	for(w = waddrtab[h].head; w != nil && woke < n; w = w->next)
+		if(w->s == s && w->off == off && w->waiting){
+			w->waiting = 0;
+			coherence();
+			wakeup(w);
+			woke++;
+		}
+	unlock(&waddrtab[h]);
+	return woke;
+}
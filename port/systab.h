@@ -1,5 +1,22 @@
 #include "/sys/src/libc/9syscall/sys.h"
 
+#ifndef PREADV
+#define PREADV		54
+#define PWRITEV		55
+#endif
+#ifndef WAITADDR
+#define WAITADDR	56
+#define WAKEADDR	57
+#endif
+#ifndef EVWATCH
+#define EVWATCH		58
+#define EVWAIT		59
+#endif
+#ifndef AIOSETUP
+#define AIOSETUP	60
+#define AIOENTER	61
+#endif
+
 typedef long Syscall(ulong*);
 
 Syscall sysr1;
@@ -53,6 +70,14 @@ Syscall sysawait;
 Syscall syspread;
 Syscall syspwrite;
 Syscall systsemacquire;
+Syscall syspreadv;
+Syscall syspwritev;
+Syscall syswaitaddr;
+Syscall syswakeaddr;
+Syscall sysevwatch;
+Syscall sysevwait;
+Syscall sysaiosetup;
+Syscall sysaioenter;
 Syscall	sysdeath;
 
 Syscall *systab[]={
@@ -107,6 +132,14 @@ Syscall *systab[]={
 	[PREAD]		syspread,
 	[PWRITE]	syspwrite,
 	[TSEMACQUIRE]	systsemacquire,
+	[PREADV]	syspreadv,
+	[PWRITEV]	syspwritev,
+	[WAITADDR]	syswaitaddr,
+	[WAKEADDR]	syswakeaddr,
+	[EVWATCH]	sysevwatch,
+	[EVWAIT]	sysevwait,
+	[AIOSETUP]	sysaiosetup,
+	[AIOENTER]	sysaioenter,
 };
 
 char *sysctab[]={
@@ -161,6 +194,73 @@ char *sysctab[]={
 	[PREAD]		"Pread",
 	[PWRITE]	"Pwrite",
 	[TSEMACQUIRE]	"Tsemacquire",
+	[PREADV]	"Preadv",
+	[PWRITEV]	"Pwritev",
+	[WAITADDR]	"Waitaddr",
+	[WAKEADDR]	"Wakeaddr",
+	[EVWATCH]	"Evwatch",
+	[EVWAIT]	"Evwait",
+	[AIOSETUP]	"Aiosetup",
+	[AIOENTER]	"Aioenter",
+};
+
+/* Pstats.nsys; anything not listed is Sysother */
+uchar sysclass[sizeof systab/sizeof systab[0]]={
+	[BIND]		Sysns,
+	[CHDIR]		Sysfile,
+	[CLOSE]		Sysfile,
+	[DUP]		Sysfile,
+	[ALARM]		Sysproc,
+	[EXEC]		Sysproc,
+	[EXITS]		Sysproc,
+	[FAUTH]		Sysns,
+	[_FSTAT]	Sysfile,
+	[SEGBRK]	Sysmem,
+	[_MOUNT]	Sysns,
+	[OPEN]		Sysfile,
+	[_READ]		Sysio,
+	[OSEEK]		Sysfile,
+	[SLEEP]		Sysproc,
+	[_STAT]		Sysfile,
+	[RFORK]		Sysproc,
+	[_WRITE]	Sysio,
+	[PIPE]		Sysfile,
+	[CREATE]	Sysfile,
+	[FD2PATH]	Sysfile,
+	[BRK_]		Sysmem,
+	[REMOVE]	Sysfile,
+	[_WSTAT]	Sysfile,
+	[_FWSTAT]	Sysfile,
+	[NOTIFY]	Sysproc,
+	[NOTED]		Sysproc,
+	[SEGATTACH]	Sysmem,
+	[SEGDETACH]	Sysmem,
+	[SEGFREE]	Sysmem,
+	[SEGFLUSH]	Sysmem,
+	[RENDEZVOUS]	Syssync,
+	[UNMOUNT]	Sysns,
+	[_WAIT]		Sysproc,
+	[SEMACQUIRE]	Syssync,
+	[SEMRELEASE]	Syssync,
+	[SEEK]		Sysfile,
+	[FVERSION]	Sysns,
+	[STAT]		Sysfile,
+	[FSTAT]		Sysfile,
+	[WSTAT]		Sysfile,
+	[FWSTAT]	Sysfile,
+	[MOUNT]		Sysns,
+	[AWAIT]		Sysproc,
+	[PREAD]		Sysio,
+	[PWRITE]	Sysio,
+	[TSEMACQUIRE]	Syssync,
+	[PREADV]	Sysio,
+	[PWRITEV]	Sysio,
+	[WAITADDR]	Syssync,
+	[WAKEADDR]	Syssync,
+	[EVWATCH]	Syssync,
+	[EVWAIT]	Syssync,
+	[AIOSETUP]	Sysio,
+	[AIOENTER]	Sysio,
 };
 
 int nsyscall = (sizeof systab/sizeof systab[0]);
@@ -20,6 +20,87 @@ struct
 	ulong	inglare;
 } lockstats;
 
+#ifdef LOCKSTATS
+/*
+ *  contention by the pc that took the lock: acquisitions,
+ *  how many had to wait, lcycles spent waiting and the
+ *  longest hold.  Sites are added without taking a Lock,
+ *  since that would come back here.
+ */
+enum
+{
+	Nlocksite	= 512,		/* power of 2 */
+};
+
+typedef struct Locksite Locksite;
+struct Locksite
+{
+	ulong	pc;
+	ulong	locks;
+	ulong	contended;
+	uvlong	spin;
+	long	maxhold;
+};
+
+static Locksite	locksite[Nlocksite];
+static Locksite	lockother;	/* when locksite is full */
+static ulong	locksitekey;
+
+static Locksite*
+lsite(ulong pc)
+{
+	int i, h, x;
+	Locksite *s;
+
+	h = (pc>>2) & (Nlocksite-1);
+	for(i = 0; i < Nlocksite; i++){
+		s = &locksite[h];
+		if(s->pc == pc)
+			return s;
+		if(s->pc == 0){
+			x = splhi();
+			while(tas(&locksitekey))
+				;
+			if(s->pc == 0)
+				s->pc = pc;
+			locksitekey = 0;
+			coherence();
+			splx(x);
+			if(s->pc == pc)
+				return s;
+		}
+		h = (h+1) & (Nlocksite-1);
+	}
+	return &lockother;
+}
+
+static void
+lockheld(Lock *l)
+{
+	Locksite *s;
+	long t;
+
+	t = l->lockcycles + lcycles();
+	s = lsite(l->pc);
+	if(t > s->maxhold)
+		s->maxhold = t;
+}
+
+static int
+lsitecmp(void *a, void *b)
+{
+	Locksite *x, *y;
+
+	x = a;
+	y = b;
+	if(x->spin != y->spin)
+		return x->spin < y->spin ? 1 : -1;
+	if(x->contended != y->contended)
+		return x->contended < y->contended ? 1 : -1;
+	return 0;
+}
+#endif
+
 static void
 inccnt(Ref *r)
 {
@@ -68,10 +149,18 @@ lock(Lock *l)
 {
 	int i;
 	ulong pc;
+#ifdef LOCKSTATS
+	Locksite *s;
+	long t0;
+#endif
 
 	pc = getcallerpc(&l);
 
 	lockstats.locks++;
+#ifdef LOCKSTATS
+	s = lsite(pc);
+	s->locks++;
+#endif
 	if(up)
 		inccnt(&up->nlocks);	/* prevent being scheded */
 	if(tas(&l->key) == 0){
@@ -80,7 +169,7 @@ lock(Lock *l)
 		l->pc = pc;
 		l->p = up;
 		l->isilock = 0;
-#ifdef LOCKCYCLES
+#if defined(LOCKCYCLES) || defined(LOCKSTATS)
 		l->lockcycles = -lcycles();
 #endif
 		return 0;
@@ -89,6 +178,10 @@ lock(Lock *l)
 		deccnt(&up->nlocks);
 
 	lockstats.glare++;
+#ifdef LOCKSTATS
+	s->contended++;
+	t0 = lcycles();
+#endif
 	for(;;){
 		lockstats.inglare++;
 		i = 0;
@@ -115,7 +208,10 @@ lock(Lock *l)
 			l->pc = pc;
 			l->p = up;
 			l->isilock = 0;
-#ifdef LOCKCYCLES
+#ifdef LOCKSTATS
+			s->spin += lcycles() - t0;
+#endif
+#if defined(LOCKCYCLES) || defined(LOCKSTATS)
 			l->lockcycles = -lcycles();
 #endif
 			return 1;
@@ -130,13 +226,25 @@ ilock(Lock *l)
 {
 	ulong x;
 	ulong pc;
+#ifdef LOCKSTATS
+	Locksite *s;
+	long t0;
+#endif
 
 	pc = getcallerpc(&l);
 	lockstats.locks++;
+#ifdef LOCKSTATS
+	s = lsite(pc);
+	s->locks++;
+#endif
 
 	x = splhi();
 	if(tas(&l->key) != 0){
 		lockstats.glare++;
+#ifdef LOCKSTATS
+		s->contended++;
+		t0 = lcycles();
+#endif
 		/*
 		 * Cannot also check l->pc, l->m, or l->isilock here
 		 * because they might just not be set yet, or
@@ -148,8 +256,12 @@ ilock(Lock *l)
 			while(l->key)
 				;
 			x = splhi();
-			if(tas(&l->key) == 0)
+			if(tas(&l->key) == 0){
+#ifdef LOCKSTATS
+				s->spin += lcycles() - t0;
+#endif
 				goto acquire;
+			}
 		}
 	}
 acquire:
@@ -161,7 +273,7 @@ acquire:
 	l->p = up;
 	l->isilock = 1;
 	l->m = MACHP(m->machno);
-#ifdef LOCKCYCLES
+#if defined(LOCKCYCLES) || defined(LOCKSTATS)
 	l->lockcycles = -lcycles();
 #endif
 }
@@ -183,7 +295,10 @@ canlock(Lock *l)
 	l->p = up;
 	l->m = MACHP(m->machno);
 	l->isilock = 0;
-#ifdef LOCKCYCLES
+#ifdef LOCKSTATS
+	lsite(l->pc)->locks++;
+#endif
+#if defined(LOCKCYCLES) || defined(LOCKSTATS)
 	l->lockcycles = -lcycles();
 #endif
 	return 1;
@@ -192,6 +307,9 @@ canlock(Lock *l)
 void
 unlock(Lock *l)
 {
+#ifdef LOCKSTATS
+	lockheld(l);
+#endif
 #ifdef LOCKCYCLES
 	l->lockcycles += lcycles();
 	cumlockcycles += l->lockcycles;
@@ -219,6 +337,107 @@ unlock(Lock *l)
 	}
 }
 
+/*
+ *  ticket locks: each locker takes the next ticket and spins
+ *  until the holder hands over to it.  Waiters spin reading owner,
+ *  which only the holder writes, and are served in order.  key
+ *  is held, splhi, only long enough to take a ticket.
+ */
+static ulong
+ticket(Tlock *t)
+{
+	ulong me;
+	int x;
+
+	x = splhi();
+	while(tas(&t->key))
+		;
+	me = t->next++;
+	t->key = 0;
+	coherence();
+	splx(x);
+	return me;
+}
+
+int
+tlock(Tlock *t)
+{
+	ulong me, pc;
+	int i;
+
+	pc = getcallerpc(&t);
+	lockstats.locks++;
+#ifdef LOCKSTATS
+	lsite(pc)->locks++;
+#endif
+	if(up)
+		inccnt(&up->nlocks);	/* prevent being scheded */
+	me = ticket(t);
+	if(t->owner != me){
+		lockstats.glare++;
+#ifdef LOCKSTATS
+		lsite(pc)->contended++;
+#endif
+		for(i = 0; t->owner != me; ){
+			lockstats.inglare++;
+			if(i++ > 100000000){
+				i = 0;
+				print("tlock %#p loop ticket %lud owner %lud pc %#lux held by pc %#p\n",
+					t, me, t->owner, pc, t->pc);
+			}
+		}
+	}
+	t->pc = pc;
+	t->p = up;
+	return me != t->owner;
+}
+
+int
+tcanlock(Tlock *t)
+{
+	int x, ok;
+
+	if(up)
+		inccnt(&up->nlocks);
+	x = splhi();
+	if(tas(&t->key)){
+		splx(x);
+		if(up)
+			deccnt(&up->nlocks);
+		return 0;
+	}
+	ok = t->next == t->owner;
+	if(ok)
+		t->next++;
+	t->key = 0;
+	coherence();
+	splx(x);
+	if(!ok){
+		if(up)
+			deccnt(&up->nlocks);
+		return 0;
+	}
+	t->pc = getcallerpc(&t);
+	t->p = up;
+	return 1;
+}
+
+void
+tunlock(Tlock *t)
+{
+	if(t->next == t->owner)
+		print("tunlock: not locked: pc %#p\n", getcallerpc(&t));
+	if(t->p != up)
+		print("tunlock: up changed: pc %#p, acquired at pc %#p, lock p %#p, unlock up %#p\n", getcallerpc(&t), t->pc, t->p, up);
+	t->p = nil;
+	coherence();
+	t->owner++;
+	coherence();
+
+	if(up && deccnt(&up->nlocks) == 0 && up->delaysched && islo())
+		sched();
+}
+
 ulong ilockpcs[0x100] = { [0xff] = 1 };
 static int n;
 
@@ -227,6 +446,9 @@ iunlock(Lock *l)
 {
 	ulong sr;
 
+#ifdef LOCKSTATS
+	lockheld(l);
+#endif
 #ifdef LOCKCYCLES
 	l->lockcycles += lcycles();
 	cumilockcycles += l->lockcycles;
@@ -253,3 +475,52 @@ iunlock(Lock *l)
 		up->lastilock = nil;
 	splx(sr);
 }
+
+/*
+ *  the lock sites, most lcycles spent waiting first:
+ *  pc locks contended spincycles maxholdcycles
+ */
+int
+lockstatread(char *buf, int n)
+{
+#ifdef LOCKSTATS
+	int i, ns;
+	char *p, *e;
+	Locksite *s, *t;
+
+	t = smalloc((Nlocksite+1)*sizeof(Locksite));
+	ns = 0;
+	for(i = 0; i <= Nlocksite; i++){
+		s = i < Nlocksite ? &locksite[i] : &lockother;
+		if(s->locks != 0)
+			t[ns++] = *s;
+	}
+	qsort(t, ns, sizeof(Locksite), lsitecmp);
+	p = buf;
+	e = buf + n;
+	p = seprint(p, e, "locks %lud glare %lud inglare %lud\n",
+		lockstats.locks, lockstats.glare, lockstats.inglare);
+	for(i = 0; i < ns; i++){
+		s = &t[i];
+		p = seprint(p, e, "%#8.8lux %11lud %11lud %20llud %11ld\n",
+			s->pc, s->locks, s->contended, s->spin, s->maxhold);
+	}
+	free(t);
+	return p - buf;
+#else
+	return snprint(buf, n, "locks %lud glare %lud inglare %lud\n",
+		lockstats.locks, lockstats.glare, lockstats.inglare);
+#endif
+}
+
+void
+lockstatclear(void)
+{
+#ifdef LOCKSTATS
+	memset(locksite, 0, sizeof locksite);
+	memset(&lockother, 0, sizeof lockother);
+#endif
+	lockstats.locks = 0;
+	lockstats.glare = 0;
+	lockstats.inglare = 0;
+}
@@ -1,8 +1,18 @@
+/*
+ * Compiled into the kernel and, with -DTHWACKUSER, into
+ * thwackbench, so the benchmark runs the kernel's code.
+ */
+
+#ifdef THWACKUSER
+#include <u.h>
+#include <libc.h>
+#else
 #include "u.h"
 #include "lib.h"
 #include "mem.h"
 #include "dat.h"
 #include "fns.h"
+#endif
 
 #include "thwack.h"
 
@@ -56,10 +66,12 @@ thwackinit(Thwack *tw)
 	int i;
 
 	memset(tw, 0, sizeof *tw);
+	tw->depth = ThwDepth;
 	for(i = 0; i < EWinBlocks; i++){
 		tw->blocks[i].data = tw->data[i];
 		tw->blocks[i].edata = tw->blocks[i].data;
 		tw->blocks[i].hash = tw->hash[i];
+		tw->blocks[i].chain = tw->chain[i];
 		tw->blocks[i].acked = 0;
 	}
 }
@@ -95,50 +107,83 @@ thwackack(Thwack *tw, ulong seq, ulong mask)
 }
 
 /*
- * find a string in the dictionary
+ * length of the common prefix of s and t, at most n;
+ * a word at a time when they are aligned alike
  */
 static int
-thwmatch(ThwBlock *b, ThwBlock *eblocks, uchar **ss, uchar *esrc, ulong h)
+thwcmp(uchar *s, uchar *t, int n)
 {
-	int then, toff, w, ok;
+	uchar *s0, *e;
+
+	s0 = s;
+	e = s + n;
+	if((((uintptr)s ^ (uintptr)t) & (sizeof(ulong)-1)) == 0){
+		for(; s < e && ((uintptr)s & (sizeof(ulong)-1)) != 0; s++, t++)
+			if(*s != *t)
+				return s - s0;
+		for(; s + sizeof(ulong) <= e; s += sizeof(ulong), t += sizeof(ulong))
+			if(*(ulong*)s != *(ulong*)t)
+				break;
+	}
+	for(; s < e && *s == *t; s++, t++)
+		;
+	return s - s0;
+}
+
+/*
+ * find the longest string in the dictionary,
+ * following up to depth entries of each block's hash chain
+ */
+static int
+thwmatch(ThwBlock *b, ThwBlock *eblocks, uchar **ss, uchar *esrc, ulong h, int depth)
+{
+	int then, toff, w, lastw, ok, len, best, bestoff, d;
 	uchar *s, *t;
 
 	s = *ss;
 	if(esrc < s + MinMatch)
 		return 0;
 
+	best = MinMatch - 1;
+	bestoff = 0;
 	toff = 0;
 	for(; b < eblocks; b++){
 		then = b->hash[(h ^ b->seq) & HashMask];
 		toff += b->maxoff;
-		w = (ushort)(then - b->begin);
-
-		if(w >= b->maxoff)
-			continue;
-
-
-		/*
-		 * don't need to check for the end because
-		 * 1) s too close check above
-		 * 2) entries too close not added to hash tables
-		 */
-		t = w + b->data;
-		if(s[0] != t[0] || s[1] != t[1] || s[2] != t[2])
-			continue;
-		ok = b->edata - t;
-		if(esrc - s > ok)
-			esrc = s + ok;
-
-		t += 3;
-		for(s += 3; s < esrc; s++){
-			if(*s != *t)
+		lastw = b->maxoff;
+		for(d = 0; d < depth; d++){
+			/*
+			 * chains only go back in time; anything else
+			 * is left over from the slot's last use
+			 */
+			w = (ushort)(then - b->begin);
+			if(w >= lastw)
 				break;
-			t++;
+			lastw = w;
+			then = b->chain[w];
+
+			/*
+			 * entries too close to the end are not added
+			 * to the hash tables, and a match in an old block
+			 * must not run off its end
+			 */
+			t = w + b->data;
+			ok = b->edata - t;
+			if(ok > esrc - s)
+				ok = esrc - s;
+			if(ok <= best || s[best] != t[best])
+				continue;
+			len = thwcmp(s, t, ok);
+			if(len > best){
+				best = len;
+				bestoff = toff - w;
+			}
 		}
-		*ss = s;
-		return toff - w;
 	}
-	return 0;
+	if(best < MinMatch)
+		return 0;
+	*ss = s + best;
+	return bestoff;
 }
 
 /*
@@ -155,8 +200,18 @@ thwmatch(ThwBlock *b, ThwBlock *eblocks, uchar **ss, uchar *esrc, ulong h)
 */
 #define hashit(c)	((((ulong)(c) & 0xffffff) * 0x6b43a9b5) >> (32 - HashLog))
 
+static void
+thwinsert(ThwBlock *b, ulong h, int now)
+{
+	ushort *hp;
+
+	hp = &b->hash[(h ^ b->seq) & HashMask];
+	b->chain[(ushort)(now - b->begin)] = *hp;
+	*hp = now;
+}
+
 /*
- * lz77 compression with single lookup in a hash table for each block
+ * lz77 compression, searching a hash chain in each block
  */
 int
 thwack(Thwack *tw, uchar *dst, uchar *src, int n, ulong seq, ulong stats[ThwStats])
@@ -237,7 +292,7 @@ thwack(Thwack *tw, uchar *dst, uchar *src, int n, ulong seq, ulong stats[ThwStat
 		h = hashit(cont);
 
 		sss = s;
-		toff = thwmatch(blocks, eblocks, &sss, esrc, h);
+		toff = thwmatch(blocks, eblocks, &sss, esrc, h, tw->depth);
 		ss = sss;
 
 		len = ss - s;
@@ -279,7 +334,7 @@ thwack(Thwack *tw, uchar *dst, uchar *src, int n, ulong seq, ulong stats[ThwStat
 			}
 
 			if(s + MinMatch <= esrc){
-				blocks->hash[(h ^ blocks->seq) & HashMask] = now;
+				thwinsert(blocks, h, now);
 				if(s + MinMatch < esrc)
 					cont = (cont << 8) | s[MinMatch];
 			}
@@ -345,7 +400,7 @@ thwack(Thwack *tw, uchar *dst, uchar *src, int n, ulong seq, ulong stats[ThwStat
 		for(; s != ss; s++){
 			if(s + MinMatch <= esrc){
 				h = hashit(cont);
-				blocks->hash[(h ^ blocks->seq) & HashMask] = now;
+				thwinsert(blocks, h, now);
 				if(s + MinMatch < esrc)
 					cont = (cont << 8) | s[MinMatch];
 			}
@@ -13,6 +13,7 @@ enum
 	HashMask	= HashSize - 1,
 
 	MinMatch	= 3,		/* shortest match possible */
+	ThwDepth	= 8,		/* hash chain entries tried in each block */
 
 	MaxOff		= 8,
 	OffBase		= 6,
@@ -35,14 +36,17 @@ struct ThwBlock
 	uchar	*edata;			/* last byte of valid data */
 	ushort	maxoff;			/* time of last valid hash entry */
 	ushort	*hash;
+	ushort	*chain;			/* previous time with the same hash */
 	uchar	*data;
 };
 
 struct Thwack
 {
 	int		slot;		/* next block to use */
+	int		depth;		/* chain entries tried; 1 is a single probe */
 	ThwBlock	blocks[EWinBlocks];
 	ushort		hash[EWinBlocks][HashSize];
+	ushort		chain[EWinBlocks][ThwMaxBlock];
 	uchar		data[EWinBlocks][ThwMaxBlock];
 };
 
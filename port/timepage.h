@@ -0,0 +1,28 @@
+/*
+ * The time page, attached read-only as physical segment
+ * "timepage", lets a process work out todget's answer without
+ * a system call:
+ *
+ *	do{
+ *		seq = tp->seq;
+ *		ticks = the fast clock (cycles() on the pc);
+ *		ns = tp->off + ((ticks - tp->last) * tp->multiplier >> 32);
+ *	}while((seq & 1) || seq != tp->seq);
+ *
+ * with the product taken to 96 bits, as mul64fract does.  It
+ * is only right when tp->direct is set, meaning the fast clock
+ * is readable from user mode and agrees across processors;
+ * otherwise read /dev/bintime.  Between updates, at least once
+ * a second, a clock being slewed can be a few µs off todget.
+ */
+typedef struct Timepage	Timepage;
+
+struct Timepage
+{
+	ulong	seq;		/* odd while the kernel updates it */
+	ulong	direct;		/* see above */
+	uvlong	hz;		/* of the fast clock */
+	uvlong	last;		/* fast clock at off */
+	vlong	off;		/* ns since the epoch at last */
+	uvlong	multiplier;	/* ns per tick <<32 */
+};
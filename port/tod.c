@@ -4,6 +4,7 @@
 #include	"dat.h"
 #include	"fns.h"
 #include	"../port/error.h"
+#include	"../port/timepage.h"
 
 /*
  * Compute nanosecond epoch time from the fastest ticking clock
@@ -53,6 +54,54 @@ struct {
 
 static void todfix(void);
 
+int	todfastuser;		/* set by the arch: see timepage.h */
+static	Timepage	*timepage;
+
+/*
+ *  publish tod's state to the time page; tod is locked.
+ */
+static void
+todpage(void)
+{
+	Timepage *tp;
+
+	tp = timepage;
+	if(tp == nil)
+		return;
+	tp->seq++;
+	coherence();
+	tp->direct = todfastuser;
+	tp->hz = tod.hz;
+	tp->last = tod.last;
+	tp->off = tod.off;
+	tp->multiplier = tod.multiplier;
+	coherence();
+	tp->seq++;
+}
+
+/*
+ *  after xinit; the page is read-only to user processes.
+ */
+void
+todpageinit(void)
+{
+	Physseg ps;
+
+	timepage = xspanalloc(BY2PG, BY2PG, 0);
+	if(timepage == nil)
+		return;
+	memset(timepage, 0, BY2PG);
+	memset(&ps, 0, sizeof ps);
+	ps.attr = SG_PHYSICAL|SG_RONLY|SG_CACHED;
+	ps.name = "timepage";
+	ps.pa = PADDR(timepage);
+	ps.size = BY2PG;
+	addphysseg(&ps);
+	ilock(&tod);
+	todpage();
+	iunlock(&tod);
+}
+
 void
 todinit(void)
 {
@@ -82,6 +131,7 @@ todsetfreq(vlong f)
 	tod.divider = mk64fract(f, TODFREQ) + 1;
 	tod.umultiplier = mk64fract(MicroFREQ, f);
 	tod.udivider = mk64fract(f, MicroFREQ) + 1;
+	todpage();
 	iunlock(&tod);
 }
 
@@ -118,6 +168,7 @@ todset(vlong t, vlong delta, int n)
 		tod.send = tod.sstart + n;
 		tod.delta = delta;
 	}
+	todpage();
 	iunlock(&tod);
 }
 
@@ -150,6 +201,7 @@ todget(vlong *ticksp)
 			t = tod.send;
 		tod.off = tod.off + tod.delta*(t - tod.sstart);
 		tod.sstart = t;
+		todpage();
 	}
 
 	/* convert to epoch */
@@ -211,6 +263,7 @@ if(x > 30000000000ULL) iprint("todfix %llud\n", x);
 		/* protect against overflows */
 		tod.last = ticks;
 		tod.off = x;
+		todpage();
 
 		iunlock(&tod);
 	}
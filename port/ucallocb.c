@@ -32,6 +32,7 @@ _ucallocb(int size)
 	b->next = nil;
 	b->list = nil;
 	b->free = 0;
+	b->shared = nil;
 	b->flag = 0;
 	b->ref = 0;
 	_xinc(&b->ref);
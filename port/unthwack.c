@@ -1,8 +1,13 @@
+#ifdef THWACKUSER
+#include <u.h>
+#include <libc.h>
+#else
 #include "u.h"
 #include "lib.h"
 #include "mem.h"
 #include "dat.h"
 #include "fns.h"
+#endif
 
 #include "thwack.h"
 
@@ -11,7 +16,9 @@ enum
 	DMaxFastLen	= 7,
 	DBigLenCode	= 0x3c,		/* minimum code for large lenth encoding */
 	DBigLenBits	= 6,
-	DBigLenBase	= 1		/* starting items to encode for big lens */
+	DBigLenBase	= 1,		/* starting items to encode for big lens */
+
+	ShortCopy	= 8,		/* matches copied a byte at a time */
 };
 
 static uchar lenval[1 << (DBigLenBits - 1)] =
@@ -282,8 +289,21 @@ unthwack(Unthwack *ut, uchar *dst, int ndst, uchar *src, int nsrc, ulong seq)
 		s = b->data + b->maxoff - off;
 		blocks->maxoff += len;
 
-		for(i = 0; i < len; i++)
-			d[i] = s[i];
+		/*
+		 * a match in this block may overlap what it makes;
+		 * copy it one period, off bytes, at a time
+		 */
+		if(len < ShortCopy)
+			for(i = 0; i < len; i++)
+				d[i] = s[i];
+		else if(b != blocks || off >= len)
+			memmove(d, s, len);
+		else if(off >= ShortCopy)
+			for(i = 0; i < len; i += off)
+				memmove(d + i, s + i, len - i < off ? len - i : off);
+		else
+			for(i = 0; i < len; i++)
+				d[i] = s[i];
 		d += len;
 	}
 	if(utnbits < overbits)
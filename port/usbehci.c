@@ -193,6 +193,8 @@ struct Qio
 	char*	err;		/* error string */
 	char*	tag;		/* debug (no room in Qh for this) */
 	ulong	bw;
+	Td*	wtd;		/* written behind, not yet waited for */
+	ulong	wload;		/* and its load */
 };
 
 struct Ctlio
@@ -363,6 +365,7 @@ union Ed
 };
 
 int ehcidebug = 0;
+int ehciwb = 1;		/* write bulk transfers behind; *noehciwb=1 stops it */
 
 static Edpool edpool;
 static char Ebug[] = "not yet implemented";
@@ -1777,6 +1780,8 @@ seprintep(char *s, char *e, Ep *ep)
 	return s;
 }
 
+static char* epiowbwait(Ep*, Qio*);
+
 /*
  * halt condition was cleared on the endpoint. update our toggles.
  */
@@ -1793,6 +1798,7 @@ clrhalt(Ep *ep)
 		io = ep->aux;
 		if(ep->mode != OREAD){
 			qlock(&io[OWRITE]);
+			epiowbwait(ep, &io[OWRITE]);
 			io[OWRITE].toggle = Tddata0;
 			deprint("ep clrhalt for io %#p\n", io+OWRITE);
 			qunlock(&io[OWRITE]);
@@ -2269,6 +2275,68 @@ epiowait(Hci *hp, Qio *io, int tmout, ulong load)
 	iunlock(ctlr);
 }
 
+/*
+ * Collect the results of a finished transfer starting at td0,
+ * copying what was read to c, and free its Tds.
+ */
+static long
+epioreap(Qio *io, Td *td0, uchar *c)
+{
+	int saved;
+	long tot;
+	Td *td, *ntd;
+
+	tot = 0;
+	saved = 0;
+	for(td = td0; td != nil; td = ntd){
+		/*
+		 * Use td tok, not io tok, because of setup packets.
+		 * Also, we must save the next toggle value from the
+		 * last completed Td (in case of a short packet, or
+		 * fewer than the requested number of packets in the
+		 * Td being transferred).
+		 */
+		if(td->csw & (Tdhalt|Tdactive))
+			saved++;
+		else{
+			if(!saved){
+				io->toggle = td->csw & Tddata1;
+				coherence();
+			}
+			tot += td->ndata;
+			if(c != nil && (td->csw & Tdtok) == Tdtokin && td->ndata > 0){
+				memmove(c, td->data, td->ndata);
+				c += td->ndata;
+			}
+		}
+		ntd = td->next;
+		tdfree(td);
+	}
+	return tot;
+}
+
+/*
+ * Bulk writes are written behind: epio queues the Tds and
+ * returns, and the next write on the endpoint, a clrhalt or
+ * the close waits for them here.  The next write builds its
+ * Tds while the controller is still busy with these.  An error
+ * in a written-behind transfer is returned by whoever waits.
+ * Called with io qlocked.
+ */
+static char*
+epiowbwait(Ep *ep, Qio *io)
+{
+	Td *td0;
+
+	td0 = io->wtd;
+	if(td0 == nil)
+		return nil;
+	io->wtd = nil;
+	epiowait(ep->hp, io, ep->tmout, io->wload);
+	epioreap(io, td0, nil);
+	return io->err;
+}
+
 /*
  * Non iso I/O.
  * To make it work for control transfers, the caller may
@@ -2277,7 +2345,7 @@ epiowait(Hci *hp, Qio *io, int tmout, ulong load)
 static long
 epio(Ep *ep, Qio *io, void *a, long count, int mustlock)
 {
-	int saved, ntds, tmout;
+	int tmout, wb, toggle;
 	long n, tot;
 	ulong load;
 	char *err;
@@ -2285,12 +2353,13 @@ epio(Ep *ep, Qio *io, void *a, long count, int mustlock)
 	uchar *c;
 	Ctlr *ctlr;
 	Qh* qh;
-	Td *td, *ltd, *td0, *ntd;
+	Td *td, *ltd, *td0;
 
 	qh = io->qh;
 	ctlr = ep->hp->aux;
 	io->debug = ep->debug;
 	tmout = ep->tmout;
+	wb = ehciwb && ep->ttype == Tbulk && io->tok == Tdtokout;
 	ddeprint("epio: %s ep%d.%d io %#p count %ld load %uld\n",
 		io->tok == Tdtokin ? "in" : "out",
 		ep->dev->nb, ep->nb, io, count, ctlr->load);
@@ -2305,16 +2374,6 @@ epio(Ep *ep, Qio *io, void *a, long count, int mustlock)
 			nexterror();
 		}
 	}
-	io->err = nil;
-	ilock(ctlr);
-	if(qh->state == Qclose){	/* Tds released by cancelio */
-		iunlock(ctlr);
-		error(io->err ? io->err : Eio);
-	}
-	if(qh->state != Qidle)
-		panic("epio: qh not idle");
-	qh->state = Qinstall;
-	iunlock(ctlr);
 
 	c = a;
 	td0 = ltd = nil;
@@ -2340,6 +2399,30 @@ epio(Ep *ep, Qio *io, void *a, long count, int mustlock)
 
 	ltd->csw |= Tdioc;		/* the last one interrupts */
 	coherence();
+	toggle = io->toggle;
+
+	/* the previous write, still going while we built these */
+	err = epiowbwait(ep, io);
+	io->err = nil;
+	ilock(ctlr);
+	if(err == nil && qh->state == Qclose)	/* Tds released by cancelio */
+		err = io->err ? io->err : Eio;
+	if(err != nil){
+		iunlock(ctlr);
+		epioreap(io, td0, nil);
+		if(mustlock){
+			qunlock(io);
+			poperror();
+		}
+		if(err == Estalled)
+			return 0;	/* that's our convention */
+		error(err);
+	}
+	io->toggle = toggle;
+	if(qh->state != Qidle)
+		panic("epio: qh not idle");
+	qh->state = Qinstall;
+	iunlock(ctlr);
 
 	ddeprint("ehci: load %uld ctlr load %uld\n", load, ctlr->load);
 	if(ehcidebug > 1 || ep->debug > 1)
@@ -2359,48 +2442,29 @@ epio(Ep *ep, Qio *io, void *a, long count, int mustlock)
 	if(ctlr->poll.does)
 		wakeup(&ctlr->poll);
 
+	if(wb){
+		io->wtd = td0;
+		io->wload = load;
+		if(mustlock){
+			qunlock(io);
+			poperror();
+		}
+		return count;
+	}
+
 	epiowait(ep->hp, io, tmout, load);
 	if(ehcidebug > 1 || ep->debug > 1){
 		dumptd(td0, "epio: got: ");
 		qhdump(qh);
 	}
 
-	tot = 0;
-	c = a;
-	saved = 0;
-	ntds = 0;
-	for(td = td0; td != nil; td = ntd){
-		ntds++;
-		/*
-		 * Use td tok, not io tok, because of setup packets.
-		 * Also, we must save the next toggle value from the
-		 * last completed Td (in case of a short packet, or
-		 * fewer than the requested number of packets in the
-		 * Td being transferred).
-		 */
-		if(td->csw & (Tdhalt|Tdactive))
-			saved++;
-		else{
-			if(!saved){
-				io->toggle = td->csw & Tddata1;
-				coherence();
-			}
-			tot += td->ndata;
-			if(c != nil && (td->csw & Tdtok) == Tdtokin && td->ndata > 0){
-				memmove(c, td->data, td->ndata);
-				c += td->ndata;
-			}
-		}
-		ntd = td->next;
-		tdfree(td);
-	}
+	tot = epioreap(io, td0, a);
 	err = io->err;
 	if(mustlock){
 		qunlock(io);
 		poperror();
 	}
-	ddeprint("epio: io %#p: %d tds: return %ld err '%s'\n",
-		io, ntds, tot, err);
+	ddeprint("epio: io %#p: return %ld err '%s'\n", io, tot, err);
 	if(err == Estalled)
 		return 0;	/* that's our convention */
 	if(err != nil)
@@ -2917,8 +2981,9 @@ cancelio(Ctlr *ctlr, Qio *io)
 	/* wait for epio if running */
 	qunlock(io);
 
-	qhfree(ctlr, qh);
+	qhfree(ctlr, qh);		/* and any written-behind Tds */
 	io->qh = nil;
+	io->wtd = nil;
 }
 
 static void
@@ -3044,6 +3109,13 @@ epclose(Ep *ep)
 				ep->toggle[OREAD] = 1;
 		}
 		if(ep->mode != OREAD){
+			/* let the last write finish */
+			qlock(&io[OWRITE]);
+			if(!waserror()){
+				epiowbwait(ep, &io[OWRITE]);
+				poperror();
+			}
+			qunlock(&io[OWRITE]);
 			cancelio(ctlr, &io[OWRITE]);
 			if(io[OWRITE].toggle == Tddata1)
 				ep->toggle[OWRITE] = 1;
@@ -3175,6 +3247,8 @@ init(Hci *hp)
 	ctlr = hp->aux;
 	opio = ctlr->opio;
 	dprint("ehci %#p init\n", ctlr->capio);
+	if(getconf("*noehciwb") != nil)
+		ehciwb = 0;
 
 	ilock(ctlr);
 	/*
@@ -724,6 +724,7 @@ syscall(Ureg* ureg)
 		up->s = *((Sargs*)(sp+BY2WD));
 		up->psstate = sysctab[scallnr];
 
+		up->stats.nsys[sysclass[scallnr]]++;
 		ret = systab[scallnr](up->s.args);
 		poperror();
 	}else{
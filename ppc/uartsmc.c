@@ -469,7 +469,7 @@ smckick(Uart *uart)
 static void
 smcinterrupt(Ureg*, void* u)
 {
-	int i, nc;
+	int nc;
 	char *buf;
 	BD *rxb;
 	UartData *ud;
@@ -498,8 +498,7 @@ smcinterrupt(Ureg*, void* u)
 		dczap(buf, Rxsize);	/* invalidate data cache before copying */
 		if ((rxb->status & BDEmpty) == 0){
 			nc = rxb->length;
-			for (i=0; i<nc; i++)
-				uartrecv(uart, *buf++);
+			uartrecvn(uart, (uchar*)buf, nc);
 			sync();
 			rxb->status |= BDEmpty;
 		}else{
@@ -151,7 +151,6 @@ procrestore(Proc* p)
 		return;
 	cycles(&t);
 	p->pcycles -= t;
-	wakewfi();		/* in case there's another runnable proc */
 
 	/* let it fault in at first use */
 //	fpuprocrestore(p);
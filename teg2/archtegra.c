@@ -738,14 +738,32 @@ cpustart(void)
 	panic("cpu%d: schedinit returned", m->machno);
 }
 
-/* mainly used to break out of wfi */
-void
-sgintr(Ureg *ureg, void *)
+/*
+ * inter-processor interrupts are sgis, one per purpose.
+ * the wakeup only has to break the target out of wfi;
+ * the scheduler then finds what was readied for it.
+ */
+static void
+wakeintr(Ureg *, void *)
+{
+}
+
+static void
+tegidlewake(ulong mask)
+{
+	intrcpus(mask, Wakeirq);
+}
+
+static void
+tlbintr(Ureg *, void *)
+{
+	tlbshootintr();
+}
+
+static void
+tegtlbshoot(ulong mask)
 {
-	iprint("cpu%d: got sgi\n", m->machno);
-	/* try to prod cpu1 into life when it gets stuck */
-	if (m->machno != 0)
-		clockprod(ureg);
+	intrcpus(mask, Tlbirq);
 }
 
 void
@@ -771,8 +789,10 @@ archreset(void)
 
 	if (irqtooearly)
 		panic("archreset: too early for irqenable");
-	irqenable(Cpu0irq, sgintr, nil, "cpu0");
-	irqenable(Cpu1irq, sgintr, nil, "cpu1");
+	irqenable(Wakeirq, wakeintr, nil, "wake");
+	idlewake = tegidlewake;
+	irqenable(Tlbirq, tlbintr, nil, "tlbshoot");
+	tlbshoot = tegtlbshoot;
 	/* ... */
 }
 
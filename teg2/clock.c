@@ -27,7 +27,7 @@ enum {
 	Tcycles		= Clockfreqbase / HZ,	/* cycles per clock tick */
 
 	MinPeriod	= Tcycles / 100,
-	MaxPeriod	= Tcycles,
+	MaxPeriod	= Tcycles * HZ,		/* tickless idle sleeps up to 1s */
 
 	Dogtimeout	= Dogsectimeout * Clockfreqbase,
 };
@@ -193,19 +193,6 @@ clockintr(Ureg* ureg, void *arg)
 	mpclocksanity();
 }
 
-void
-clockprod(Ureg *ureg)
-{
-	Ltimer *tn;
-
-	timerintr(ureg, 0);
-	tegclockintr();
-	if (m->machno != 0) {		/* cpu1 gets stuck */
-		tn = &((Ploctmr *)soc.loctmr)->loc;
-		setltimer(tn, Tcycles);
-	}
-}
-
 static void
 clockreset(Ltimer *tn)
 {
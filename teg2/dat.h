@@ -161,6 +161,8 @@ struct PMMU
 {
 	Page*	mmul2;
 	Page*	mmul2cache;	/* free mmu pages */
+	uchar	asid[MAXMACH];	/* last asid on each processor */
+	ulong	tlbgen;		/* bumped when mappings are taken away */
 };
 
 #include "../port/portdat.h"
@@ -410,8 +412,8 @@ enum Irqs {
 	 *  0—15 are software-generated by other cpus;
 	 * 16—31 are private peripheral intrs.
 	 */
-	Cpu0irq		= 0,
-	Cpu1irq,
+	Wakeirq		= 0,		/* sgi: idlewake */
+	Tlbirq,				/* sgi: tlbshoot */
 	/* ... */
 	Cpu15irq	= 15,
 	Glbtmrirq	= 27,
@@ -188,5 +188,6 @@ archinit(void)
 {
 	addarchfile("cputype", 0444, cputyperead, nil);
 	addarchfile("timebase",0444, tbread, nil);
+	addarchfile("dmacache", 0444, dmastatsread, nil);
 //	addarchfile("nsec", 0444, nsread, nil);
 }
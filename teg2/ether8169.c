@@ -585,7 +585,7 @@ rtl8169ifstat(Ether* edev, void* a, long n, ulong offset)
 
 	/* copy hw statistics into ctlr->dtcc */
 	dtcc = ctlr->dtcc;
-	allcache->invse(dtcc, sizeof *dtcc);
+	dmawbinv(dtcc, sizeof *dtcc);
 	ilock(&ctlr->reglock);
 	csr32w(ctlr, Dtccr+4, 0);
 	csr32w(ctlr, Dtccr, PCIWADDR(dtcc)|Cmd);	/* initiate dma? */
@@ -597,6 +597,7 @@ rtl8169ifstat(Ether* edev, void* a, long n, ulong offset)
 	iunlock(&ctlr->reglock);
 	if(csr32r(ctlr, Dtccr) & Cmd)
 		error(Eio);
+	dmainv(dtcc, sizeof *dtcc);
 
 	edev->oerrs = dtcc->txer;
 	edev->crcs = dtcc->rxer;
@@ -736,6 +737,7 @@ rtl8169replenish(Ether *edev)
 				break;
 			}
 			ctlr->rb[rdt] = bp;
+			dmawbinv(bp->rp, Mps);
 			d->addrhi = 0;
 			coherence();
 			d->addrlo = PCIWADDR(bp->rp);
@@ -827,7 +829,7 @@ qpkt(Ether *edev, int rdh, ulong control)
 	bp->wp = bp->rp + len;
 	bp->next = nil;
 
-	allcache->invse(bp->rp, len);	/* clear any stale cached packet */
+	dmainv(bp->rp, len);	/* clear any stale cached packet */
 	ckrderrs(ctlr, bp, control);
 	etheriq(edev, bp, 1);
 
@@ -962,7 +964,7 @@ tproc(void* arg)
 
 			/* make sure the whole packet is in ram */
 			len = BLEN(bp);
-			allcache->wbse(bp->rp, len);
+			dmawb(bp->rp, len);
 
 			d = &ctlr->td[x];
 			assert(d);
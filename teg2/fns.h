@@ -31,7 +31,6 @@ extern void cacheiinv(void);
 extern void cacheuwbinv(void);
 extern uintptr cankaddr(uintptr pa);
 extern void chkmissing(void);
-extern void clockprod(Ureg *);
 extern void clockshutdown(void);
 extern int clz(ulong);
 extern int cmpswap(long*, long, long);
@@ -51,7 +50,11 @@ extern void cpwrsc(int op1, int crn, int crm, int op2, ulong val);
 extern u32int dacget(void);
 extern void dacput(u32int);
 extern void dmainit(void);
+extern void dmainv(void*, int);
 extern int dmastart(void *, int, void *, int, uint, Rendez *, int *);
+extern long dmastatsread(Chan*, void*, long, vlong);
+extern void dmawb(void*, int);
+extern void dmawbinv(void*, int);
 extern void dmatest(void);
 extern void dump(void *vaddr, int words);
 extern u32int farget(void);
@@ -73,7 +76,7 @@ extern u32int getscr(void);
 extern ulong getwayssets(void);
 extern void intcmask(uint);
 extern void intcunmask(uint);
-extern void intrcpu(int);
+extern void intrcpus(ulong, uint);
 extern void intrcpushutdown(void);
 extern void intrshutdown(void);
 extern void intrsoff(void);
@@ -90,6 +93,7 @@ extern void memdiag(ulong *);
 extern void mmuidmap(uintptr phys, int mbs);
 extern void mmuinvalidate(void);		/* 'mmu' or 'tlb'? */
 extern void mmuinvalidateaddr(u32int);		/* 'mmu' or 'tlb'? */
+extern void mmuinvalidateasid(u32int);
 extern void mousectl(Cmdbuf *cb);
 extern ulong pcibarsize(Pcidev*, int);
 extern void pcibussize(Pcidev*, ulong*, ulong*);
@@ -115,6 +119,7 @@ extern void pcisetmwi(Pcidev*);
 extern int pcisetpms(Pcidev*, int);
 extern u32int pidget(void);
 extern void pidput(u32int);
+extern void asidput(u32int);
 extern void prcachecfg(void);
 extern vlong probeaddr(uintptr);
 extern void procrestore(Proc *);
@@ -141,7 +146,6 @@ extern void tegwdogintr(Ureg *, void *);
 extern u32int ttbget(void);
 extern void ttbput(u32int);
 extern void _vrst(void);
-extern void wakewfi(void);
 extern void watchdoginit(void);
 extern void wfi(void);
 
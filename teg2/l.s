@@ -661,6 +661,11 @@ TEXT mmuinvalidateaddr(SB), $-4			/* invalidate single entry */
 	BARRIERS
 	RET
 
+TEXT mmuinvalidateasid(SB), $-4			/* invalidate an asid's entries */
+	MTCP	CpSC, 0, R0, C(CpTLB), C(CpTLBinvu), CpTBLasid
+	BARRIERS
+	RET
+
 TEXT cpidget(SB), 1, $-4			/* main ID */
 	MFCP	CpSC, 0, R0, C(CpID), C(CpIDidct), CpIDid
 	RET
@@ -727,6 +732,12 @@ TEXT pidput(SB), 1, $-4				/* address translation pid */
 	ISB
 	RET
 
+TEXT asidput(SB), 1, $-4			/* context id holding the asid */
+	DSB
+	MTCP	CpSC, 0, R0, C(CpPID), C(0), 1
+	ISB
+	RET
+
 /*
  * access to yet more coprocessor registers
  */
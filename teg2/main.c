@@ -942,10 +942,13 @@ unadvertwfi(void)		/* do not advertise my wfi status */
 	iunlock(&active);
 }
 
+/*
+ * wait for an interrupt.  the clock or another processor's
+ * idlewake (see archtegra.c) gets us going again.
+ */
 void
 idlehands(void)
 {
-#ifdef use_ipi
 	int advertised;
 
 	/* don't go into wfi until my local timer is ticking */
@@ -965,21 +968,4 @@ idlehands(void)
 	if (advertised)
 		unadvertwfi();
 	m->inidlehands--;
-#endif
-}
-
-void
-wakewfi(void)
-{
-#ifdef use_ipi
-	uint cpu;
-
-	/*
-	 * find any cpu other than me currently in wfi.
-	 * need not be exact.
-	 */
-	cpu = BI2BY*BY2WD - 1 - clz(active.wfi & ~(1 << m->machno));
-	if (cpu < MAXMACH)
-		intrcpu(cpu);
-#endif
 }
@@ -40,6 +40,29 @@ enum {
 
 #define ISHOLE(type)	((type) == 0)
 
+/*
+ * user tlb entries are tagged with an asid, so a switch
+ * back to a process whose entries a processor still holds
+ * needn't refill them.  asid 0 is never given out; it is
+ * current while the l1 changes under a switch.  a process's
+ * entries go stale when tlbgen moves on.
+ */
+enum {
+	Nasid		= 64,			/* of the 256 */
+};
+
+typedef struct Asid Asid;
+struct Asid {
+	int	pid;
+	ulong	gen;
+};
+
+static struct {
+	int	cur;
+	int	next;
+	Asid	a[Nasid];
+} asids[MAXMACH];
+
 typedef struct Range Range;
 struct Range {
 	uintptr	startva;
@@ -51,6 +74,7 @@ struct Range {
 };
 
 static void mmul1empty(void);
+static void tegmmuflushva(ulong);
 
 static char *
 typename(int type)
@@ -362,6 +386,7 @@ mmuinit(void)
 	coherence();
 	mmul1empty();
 	coherence();
+	mmuflushva = tegmmuflushva;
 //	mmudump(l1);			/* DEBUG */
 }
 
@@ -414,6 +439,29 @@ mmul1empty(void)
 	allcache->wbse(&m->mmul1[L1lo], (L1hi - L1lo)*sizeof(PTE));
 }
 
+/* asid for proc on this processor, with its stale entries gone */
+static int
+asidget(Proc* proc)
+{
+	int a;
+	Asid *ap;
+
+	a = proc->asid[m->machno];
+	ap = &asids[m->machno].a[a];
+	if(a != 0 && ap->pid == proc->pid && ap->gen == proc->tlbgen)
+		return a;
+	if(a == 0 || ap->pid != proc->pid){
+		a = asids[m->machno].next % (Nasid-1) + 1;
+		asids[m->machno].next = a;
+		ap = &asids[m->machno].a[a];
+		proc->asid[m->machno] = a;
+	}
+	ap->pid = proc->pid;
+	ap->gen = proc->tlbgen;
+	mmuinvalidateasid(a);
+	return a;
+}
+
 void
 mmuswitch(Proc* proc)
 {
@@ -432,8 +480,11 @@ mmuswitch(Proc* proc)
 	if(proc->newtlb){
 		mmul2empty(proc, 1);
 		proc->newtlb = 0;
+		proc->tlbgen++;
 	}
 
+	/* no walks may tag the old asid with the new map */
+	asidput(0);
 	mmul1empty();
 
 	/* move in new map */
@@ -452,13 +503,12 @@ mmuswitch(Proc* proc)
 	/* could be smarter about how much? */
 	allcache->wbse(&l1[L1X(UZERO)], (L1hi - L1lo)*sizeof(PTE));
 
-	/* lose any possible stale tlb entries */
-	mmuinvalidate();
+	/* keep tlb entries of this and other processes' asids */
+	asids[m->machno].cur = asidget(proc);
+	asidput(asids[m->machno].cur);
 
 	//print("mmuswitch l1lo %d l1hi %d %d\n",
 	//	m->mmul1lo, m->mmul1hi, proc->kp);
-
-	wakewfi();		/* in case there's another runnable proc */
 }
 
 void
@@ -480,6 +530,7 @@ mmurelease(Proc* proc)
 	/* write back dirty and invalidate caches */
 	l1cache->wbinv();
 
+	proc->tlbgen++;
 	mmul2empty(proc, 0);
 	for(page = proc->mmul2cache; page != nil; page = next){
 		next = page->next;
@@ -501,6 +552,28 @@ mmurelease(Proc* proc)
 	mmuinvalidate();
 }
 
+/*
+ * drop the current process's mapping of va from its l2 page
+ * and this processor's tlb, for procflushva.
+ */
+static void
+tegmmuflushva(ulong va)
+{
+	PTE *l1, *pte;
+
+	if(up == nil)
+		return;
+	l1 = &m->mmul1[L1X(va)];
+	if(*l1 == Fault)
+		return;
+	pte = UINT2PTR(KADDR(PPN(*l1)));
+	if(pte[L2X(va)] == Fault)
+		return;
+	pte[L2X(va)] = Fault;
+	allcache->wbse(&pte[L2X(va)], sizeof pte[0]);
+	mmuinvalidateaddr(PPN(va) | asids[m->machno].cur);
+}
+
 void
 putmmu(uintptr va, uintptr pa, Page* page)
 {
@@ -561,7 +634,7 @@ putmmu(uintptr va, uintptr pa, Page* page)
 	 *	PTEWRITE|PTEVALID;
 	 *	PTEWRITE|PTEUNCACHED|PTEVALID;
 	 */
-	x = Small;
+	x = Small|L2nonglobal;
 	if(!(pa & PTEUNCACHED))
 		x |= L2ptedramattrs;
 	if(pa & PTEWRITE)
@@ -572,7 +645,7 @@ putmmu(uintptr va, uintptr pa, Page* page)
 	allcache->wbse(&pte[L2X(va)], sizeof pte[0]);
 
 	/* clear out the current entry */
-	mmuinvalidateaddr(PPN(va));
+	mmuinvalidateaddr(PPN(va) | asids[m->machno].cur);
 
 	/*  write back dirty entries - we need this because the pio() in
 	 *  fault.c is writing via a different virt addr and won't clean
@@ -401,13 +401,15 @@ intrsto(int cpu)			/* unused */
 	USED(idp);
 }
 
+/* send software-generated interrupt sgi to each cpu in mask */
 void
-intrcpu(int cpu)
+intrcpus(ulong mask, uint sgi)
 {
 	Intrdistregs *idp = (Intrdistregs *)soc.intrdist;
 
 	ilock(&distlock);
-	idp->swgen = Totargets | 1 << (cpu + 16) | m->machno;
+	coherence();
+	idp->swgen = Totargets | (mask & MASK(8)) << 16 | sgi;
 	iunlock(&distlock);
 }
 
@@ -0,0 +1,405 @@
+/*
+ * chanbench - neural channel throughput and latency benchmark
+ *
+ * Drives N producer and M consumer processes through one neural
+ * channel's data file, each wired to its own CPU in turn, and
+ * reports messages per second, p50/p99/p999 delivery latency and
+ * CPU time per message.  Each producer's payload and its sequence
+ * of message sizes come from a seeded generator, so a run is
+ * repeatable across kernel builds.
+ *
+ * Each run prints one line of key=value fields:
+ *
+ *	chanbench run=0 producers=2 consumers=2 size=64-64 msgs=200000
+ *		seed=1 secs=0.412 msgps=485436 p50us=3.1 p99us=18.0
+ *		p999us=41.7 cpuusmsg=1.96
+ */
+
+#include <u.h>
+#include <libc.h>
+
+enum {
+	Maxprocs	= 64,
+	Maxmsg		= 64*1024,	/* NBmaxmsg in the kernel */
+	Stop		= -1,		/* producer id of the end marker */
+};
+
+typedef struct Hdr Hdr;
+struct Hdr {
+	vlong	stamp;		/* nsec() at send */
+	long	seq;
+	long	prod;		/* Stop ends a consumer */
+};
+
+char	*dev = "/proc/cognitive";
+char	*chanid;
+int	nprod = 1;
+int	ncons = 1;
+vlong	nmsg = 100000;		/* per producer */
+int	minsize = 64;
+int	maxsize = 64;
+ulong	seed = 1;
+int	nrun = 1;
+ulong	window;
+int	ncpu;
+int	lost;
+
+/* shared with the workers, which are rfork(RFMEM) children */
+vlong	*lat;
+long	nlat;
+long	finished;
+vlong	lastrecv[Maxprocs];
+long	cpums[2*Maxprocs];
+
+void
+usage(void)
+{
+	fprint(2, "usage: chanbench [-p producers] [-c consumers] [-n msgs] [-s min[,max]]\n");
+	fprint(2, "\t[-S seed] [-r runs] [-w window] [-C channel] [-d dev]\n");
+	exits("usage");
+}
+
+/* xorshift32, so payloads do not depend on the libc rand */
+ulong
+next(ulong *s)
+{
+	ulong x;
+
+	x = *s;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *s = x;
+}
+
+int
+cpus(void)
+{
+	char buf[8192];
+	int fd, n, i, c;
+
+	fd = open("/dev/sysstat", OREAD);
+	if(fd < 0)
+		return 1;
+	n = readn(fd, buf, sizeof buf);
+	close(fd);
+	c = 0;
+	for(i = 0; i < n; i++)
+		if(buf[i] == '\n')
+			c++;
+	return c > 0 ? c : 1;
+}
+
+void
+wire(int cpu)
+{
+	char file[64];
+	int fd;
+
+	if(ncpu < 2)
+		return;
+	snprint(file, sizeof file, "/proc/%d/ctl", getpid());
+	fd = open(file, OWRITE);
+	if(fd < 0)
+		return;
+	fprint(fd, "wired %d", cpu % ncpu);
+	close(fd);
+}
+
+int
+ctl(char *file, char *fmt, ...)
+{
+	char buf[256];
+	va_list arg;
+	int fd, n;
+
+	fd = open(file, OWRITE);
+	if(fd < 0)
+		sysfatal("open %s: %r", file);
+	va_start(arg, fmt);
+	n = vsnprint(buf, sizeof buf, fmt, arg);
+	va_end(arg);
+	n = write(fd, buf, n);
+	close(fd);
+	return n;
+}
+
+/*
+ * Bind a fresh bench-src to bench-dst channel and return its id.
+ * Channel ids end in their creation time, so the newest is the
+ * largest name with the prefix.
+ */
+char*
+setup(void)
+{
+	char file[128], *best, *p;
+	Dir *d;
+	int fd, i, n;
+
+	snprint(file, sizeof file, "%s/ctl", dev);
+	ctl(file, "create-namespace bench-src /cognitive-cities/bench/src");
+	ctl(file, "create-namespace bench-dst /cognitive-cities/bench/dst");
+	/* a bind in the same second as the last reuses that channel */
+	ctl(file, "bind-channel bench-src bench-dst");
+
+	snprint(file, sizeof file, "%s/channels", dev);
+	fd = open(file, OREAD);
+	if(fd < 0)
+		sysfatal("open %s: %r", file);
+	n = dirreadall(fd, &d);
+	close(fd);
+	best = nil;
+	for(i = 0; i < n; i++){
+		p = d[i].name;
+		if(strncmp(p, "bench-src-bench-dst-", 20) != 0)
+			continue;
+		if(best == nil || strlen(p) > strlen(best) ||
+		   strlen(p) == strlen(best) && strcmp(p, best) > 0)
+			best = p;
+	}
+	if(best == nil)
+		sysfatal("no bench-src-bench-dst channel");
+	best = strdup(best);
+	free(d);
+	return best;
+}
+
+int
+opendata(int mode)
+{
+	char file[256];
+	int fd;
+
+	snprint(file, sizeof file, "%s/channels/%s/data", dev, chanid);
+	fd = open(file, mode);
+	if(fd < 0)
+		sysfatal("open %s: %r", file);
+	return fd;
+}
+
+void
+cputime(int slot)
+{
+	long t[4];
+
+	times(t);
+	cpums[slot] = t[0] + t[1];
+}
+
+void
+producer(int id)
+{
+	uchar *buf;
+	Hdr h;
+	ulong s;
+	vlong i;
+	int fd, n, k;
+
+	wire(id);
+	fd = opendata(OWRITE);
+	buf = malloc(Maxmsg);
+	if(buf == nil)
+		sysfatal("malloc: %r");
+	s = seed * 2654435761UL + id + 1;
+	if(s == 0)
+		s = 1;
+	for(k = sizeof h; k < maxsize; k++)
+		buf[k] = next(&s);
+	for(i = 0; i < nmsg; i++){
+		n = minsize;
+		if(maxsize > minsize)
+			n += next(&s) % (maxsize - minsize + 1);
+		h.seq = i;
+		h.prod = id;
+		h.stamp = nsec();
+		memmove(buf, &h, sizeof h);
+		if(write(fd, buf, n) != n)
+			sysfatal("producer %d: write: %r", id);
+	}
+
+	/* the last producer out stops every consumer */
+	if(ainc(&finished) == nprod){
+		h.prod = Stop;
+		memmove(buf, &h, sizeof h);
+		for(k = 0; k < ncons; k++)
+			if(write(fd, buf, sizeof h) != sizeof h)
+				sysfatal("producer %d: stop: %r", id);
+	}
+	close(fd);
+	cputime(id);
+	exits(nil);
+}
+
+void
+consumer(int id)
+{
+	uchar *buf;
+	Hdr h;
+	vlong now;
+	int fd, n;
+
+	wire(nprod + id);
+	fd = opendata(OREAD);
+	buf = malloc(Maxmsg);
+	if(buf == nil)
+		sysfatal("malloc: %r");
+	for(;;){
+		n = read(fd, buf, Maxmsg);
+		if(n < 0)
+			sysfatal("consumer %d: read: %r", id);
+		if(n < sizeof h)
+			continue;
+		now = nsec();
+		memmove(&h, buf, sizeof h);
+		if(h.prod == Stop)
+			break;
+		lat[ainc(&nlat) - 1] = now - h.stamp;
+		lastrecv[id] = now;
+	}
+	close(fd);
+	cputime(nprod + id);
+	exits(nil);
+}
+
+int
+vlongcmp(void *a, void *b)
+{
+	vlong x, y;
+
+	x = *(vlong*)a;
+	y = *(vlong*)b;
+	return x < y ? -1 : x > y;
+}
+
+double
+pct(vlong *v, long n, double p)
+{
+	long i;
+
+	if(n == 0)
+		return 0;
+	i = p * (n - 1);
+	return v[i] / 1000.0;
+}
+
+void
+run(int r)
+{
+	vlong start, end, total;
+	double secs;
+	long ms;
+	int i;
+
+	total = nprod * nmsg;
+	nlat = 0;
+	finished = 0;
+	memset(lastrecv, 0, sizeof lastrecv);
+	memset(cpums, 0, sizeof cpums);
+
+	for(i = 0; i < ncons; i++)
+		switch(rfork(RFPROC|RFMEM|RFFDG)){
+		case -1:
+			sysfatal("rfork: %r");
+		case 0:
+			consumer(i);
+		}
+	start = nsec();
+	for(i = 0; i < nprod; i++)
+		switch(rfork(RFPROC|RFMEM|RFFDG)){
+		case -1:
+			sysfatal("rfork: %r");
+		case 0:
+			producer(i);
+		}
+	for(i = 0; i < nprod + ncons; i++)
+		if(waitpid() < 0)
+			sysfatal("waitpid: %r");
+
+	end = start;
+	for(i = 0; i < ncons; i++)
+		if(lastrecv[i] > end)
+			end = lastrecv[i];
+	secs = (end - start) / 1e9;
+	ms = 0;
+	for(i = 0; i < nprod + ncons; i++)
+		ms += cpums[i];
+	if(nlat != total){
+		fprint(2, "chanbench: received %ld of %lld messages\n", nlat, total);
+		lost = 1;
+	}
+	qsort(lat, nlat, sizeof lat[0], vlongcmp);
+
+	print("chanbench run=%d producers=%d consumers=%d size=%d-%d msgs=%lld seed=%lud "
+		"secs=%.3f msgps=%.0f p50us=%.1f p99us=%.1f p999us=%.1f cpuusmsg=%.2f\n",
+		r, nprod, ncons, minsize, maxsize, total, seed,
+		secs, secs > 0 ? nlat / secs : 0,
+		pct(lat, nlat, 0.5), pct(lat, nlat, 0.99), pct(lat, nlat, 0.999),
+		nlat > 0 ? ms * 1000.0 / nlat : 0);
+}
+
+void
+main(int argc, char *argv[])
+{
+	char file[256], *p;
+	int r;
+
+	ARGBEGIN{
+	case 'p':
+		nprod = atoi(EARGF(usage()));
+		break;
+	case 'c':
+		ncons = atoi(EARGF(usage()));
+		break;
+	case 'n':
+		nmsg = strtoll(EARGF(usage()), 0, 0);
+		break;
+	case 's':
+		p = EARGF(usage());
+		minsize = maxsize = atoi(p);
+		if((p = strchr(p, ',')) != nil)
+			maxsize = atoi(p+1);
+		break;
+	case 'S':
+		seed = strtoul(EARGF(usage()), 0, 0);
+		break;
+	case 'r':
+		nrun = atoi(EARGF(usage()));
+		break;
+	case 'w':
+		window = strtoul(EARGF(usage()), 0, 0);
+		break;
+	case 'C':
+		chanid = EARGF(usage());
+		break;
+	case 'd':
+		dev = EARGF(usage());
+		break;
+	default:
+		usage();
+	}ARGEND
+	if(argc != 0)
+		usage();
+	if(nprod < 1 || ncons < 1 || nprod > Maxprocs || ncons > Maxprocs || nmsg < 1)
+		usage();
+	if(minsize < sizeof(Hdr))
+		minsize = sizeof(Hdr);
+	if(maxsize < minsize)
+		maxsize = minsize;
+	if(maxsize > Maxmsg)
+		sysfatal("message size %d over %d", maxsize, Maxmsg);
+
+	ncpu = cpus();
+	lat = malloc(nprod * nmsg * sizeof lat[0]);
+	if(lat == nil)
+		sysfatal("malloc: %r");
+	if(chanid == nil)
+		chanid = setup();
+	if(window != 0){
+		snprint(file, sizeof file, "%s/channels/%s/ctl", dev, chanid);
+		if(ctl(file, "capacity %lud", window) < 0)
+			sysfatal("capacity: %r");
+	}
+	for(r = 0; r < nrun; r++)
+		run(r);
+	exits(lost ? "lost messages" : nil);
+}
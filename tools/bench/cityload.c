@@ -0,0 +1,555 @@
+/*
+ * cityload - replay multi-domain sensor traffic into neural channels
+ *
+ * Each stream is one source and target domain pair, sent over the
+ * newest channel between them (bound if there is none).  Its send
+ * times come either from a recorded trace or from a seeded
+ * generator, at a fixed interval or with Poisson arrivals, and
+ * optionally in bursts; the whole schedule is computed before the
+ * run, so a run is repeatable.
+ *
+ * Pacing is open loop: a sender never waits for a slow channel to
+ * push its schedule back, and every message is stamped with the time
+ * it was meant to go, not the time it went.  Latency is measured
+ * from that intended time, so a stall in the kernel shows up in the
+ * latency of every message queued behind it instead of being hidden
+ * by the sender falling behind (coordinated omission).  How far the
+ * senders fell behind is reported as late and maxlagus.
+ *
+ * A trace is text, one message per line, times in microseconds from
+ * the start of the trace:
+ *
+ *	# usec src dst size
+ *	0 transportation energy 64
+ *	1250 energy environment 512
+ *
+ * Each stream prints one line of key=value fields, then a total:
+ *
+ *	cityload stream=transportation-energy msgs=10000 recv=10000 secs=10.000
+ *		msgps=1000 p50us=6.1 p99us=48.0 p999us=212.5 maxus=903.0
+ *		late=3 maxlagus=1510.2
+ */
+
+#include <u.h>
+#include <libc.h>
+#include <bio.h>
+
+enum {
+	Maxstreams	= 64,
+	Maxmsg		= 64*1024,	/* NBmaxmsg in the kernel */
+	Maxsched	= 50*1000*1000,	/* most messages one stream schedules */
+	Early		= 2*1000*1000,	/* ns before a send we stop sleeping */
+	Late		= 1000*1000,	/* ns behind schedule a send counts late */
+	Stop		= -1,
+};
+
+typedef struct Hdr Hdr;
+struct Hdr {
+	vlong	due;		/* intended send time, ns since the run began */
+	long	seq;
+	long	stream;		/* Stop ends the receiver */
+};
+
+typedef struct Stream Stream;
+struct Stream {
+	char	*src;
+	char	*dst;
+	double	rate;		/* msgs/s, synthetic streams */
+	int	minsize;
+	int	maxsize;
+	char	*chanid;
+
+	vlong	*due;		/* schedule, ns from the start */
+	int	*size;
+	long	n;
+	long	cap;
+
+	vlong	*lat;		/* per seq, -1 until received */
+	long	recv;
+	long	late;
+	vlong	maxlag;
+	vlong	lastrecv;
+};
+
+char	*dev = "/proc/cognitive";
+Stream	streams[Maxstreams];
+int	nstreams;
+double	secs = 10;
+ulong	seed = 1;
+int	poisson;
+double	speed = 1;
+long	burstms;		/* burst period, 0 for none */
+double	burstduty;		/* fraction of the period in burst */
+double	burstx = 1;		/* rate multiplier in a burst */
+vlong	start;
+
+void
+usage(void)
+{
+	fprint(2, "usage: cityload [-s src:dst:rate[:min[-max]]]... [-t secs] [-p] [-S seed]\n");
+	fprint(2, "\t[-b periodms:duty%%:factor] [-r trace [-x speed]] [-d dev]\n");
+	exits("usage");
+}
+
+/* xorshift32, so schedules do not depend on the libc rand */
+ulong
+next(ulong *s)
+{
+	ulong x;
+
+	x = *s;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *s = x;
+}
+
+double
+unit(ulong *s)
+{
+	return (next(s) + 0.5) / 4294967296.0;
+}
+
+Stream*
+stream(char *src, char *dst)
+{
+	Stream *st;
+	int i;
+
+	for(i = 0; i < nstreams; i++)
+		if(strcmp(streams[i].src, src) == 0 && strcmp(streams[i].dst, dst) == 0)
+			return &streams[i];
+	if(nstreams == Maxstreams)
+		sysfatal("more than %d streams", Maxstreams);
+	st = &streams[nstreams++];
+	st->src = strdup(src);
+	st->dst = strdup(dst);
+	st->minsize = st->maxsize = 64;
+	return st;
+}
+
+void
+schedule(Stream *st, vlong due, int size)
+{
+	if(st->n == Maxsched)
+		sysfatal("%s-%s: more than %d messages", st->src, st->dst, Maxsched);
+	if(st->n == st->cap){
+		st->cap = st->cap ? 2*st->cap : 1024;
+		st->due = realloc(st->due, st->cap * sizeof st->due[0]);
+		st->size = realloc(st->size, st->cap * sizeof st->size[0]);
+		if(st->due == nil || st->size == nil)
+			sysfatal("malloc: %r");
+	}
+	if(size < sizeof(Hdr))
+		size = sizeof(Hdr);
+	if(size > Maxmsg)
+		size = Maxmsg;
+	st->due[st->n] = due;
+	st->size[st->n] = size;
+	st->n++;
+}
+
+/* src:dst:rate[:min[-max]] */
+void
+parsestream(char *spec)
+{
+	char *f[4], *p;
+	Stream *st;
+	int n;
+
+	n = getfields(spec, f, nelem(f), 0, ":");
+	if(n < 3)
+		usage();
+	st = stream(f[0], f[1]);
+	if(st->rate != 0)
+		sysfatal("stream %s-%s given twice", f[0], f[1]);
+	st->rate = atof(f[2]);
+	if(st->rate <= 0)
+		usage();
+	if(n > 3){
+		st->minsize = st->maxsize = atoi(f[3]);
+		if((p = strchr(f[3], '-')) != nil)
+			st->maxsize = atoi(p+1);
+		if(st->maxsize < st->minsize)
+			st->maxsize = st->minsize;
+	}
+}
+
+/* periodms:duty%:factor */
+void
+parseburst(char *spec)
+{
+	char *f[3];
+
+	if(getfields(spec, f, nelem(f), 0, ":") != 3)
+		usage();
+	burstms = atol(f[0]);
+	burstduty = atof(f[1]) / 100;
+	burstx = atof(f[2]);
+	if(burstms <= 0 || burstduty <= 0 || burstduty > 1 || burstx <= 0)
+		usage();
+}
+
+void
+synthesize(Stream *st, ulong s)
+{
+	double t, r, end;
+	vlong period;
+	int size;
+
+	end = secs * 1e9;
+	period = burstms * 1000000LL;
+	for(t = 0; t < end;){
+		size = st->minsize;
+		if(st->maxsize > st->minsize)
+			size += next(&s) % (st->maxsize - st->minsize + 1);
+		schedule(st, t, size);
+		r = st->rate;
+		if(period > 0 && (vlong)t % period < burstduty * period)
+			r *= burstx;
+		t += (poisson ? -log(unit(&s)) : 1.0) * 1e9 / r;
+	}
+}
+
+void
+readtrace(char *file)
+{
+	Biobuf *b;
+	char *line, *f[5];
+	vlong us, last;
+	int n, lineno;
+
+	b = Bopen(file, OREAD);
+	if(b == nil)
+		sysfatal("open %s: %r", file);
+	last = 0;
+	lineno = 0;
+	while((line = Brdstr(b, '\n', 1)) != nil){
+		lineno++;
+		n = tokenize(line, f, nelem(f));
+		if(n == 0 || f[0][0] == '#'){
+			free(line);
+			continue;
+		}
+		if(n != 4)
+			sysfatal("%s:%d: want usec src dst size", file, lineno);
+		us = strtoll(f[0], 0, 10);
+		if(us < last)
+			sysfatal("%s:%d: time goes backwards", file, lineno);
+		last = us;
+		schedule(stream(f[1], f[2]), us * 1000 / speed, atoi(f[3]));
+		free(line);
+	}
+	Bterm(b);
+}
+
+int
+ctl(char *fmt, ...)
+{
+	char file[256], buf[256];
+	va_list arg;
+	int fd, n;
+
+	snprint(file, sizeof file, "%s/ctl", dev);
+	fd = open(file, OWRITE);
+	if(fd < 0)
+		sysfatal("open %s: %r", file);
+	va_start(arg, fmt);
+	n = vsnprint(buf, sizeof buf, fmt, arg);
+	va_end(arg);
+	n = write(fd, buf, n);
+	close(fd);
+	return n;
+}
+
+/*
+ * The newest src-dst channel, bound first if there is none.
+ * Channel ids end in their creation time, so the newest is the
+ * largest name with the prefix.
+ */
+char*
+channel(Stream *st, int bind)
+{
+	char file[128], prefix[128], *best, *p;
+	Dir *d;
+	int fd, i, n, np;
+
+	snprint(prefix, sizeof prefix, "%s-%s-", st->src, st->dst);
+	np = strlen(prefix);
+	snprint(file, sizeof file, "%s/channels", dev);
+	fd = open(file, OREAD);
+	if(fd < 0)
+		sysfatal("open %s: %r", file);
+	n = dirreadall(fd, &d);
+	close(fd);
+	best = nil;
+	for(i = 0; i < n; i++){
+		p = d[i].name;
+		if(strncmp(p, prefix, np) != 0)
+			continue;
+		if(best == nil || strlen(p) > strlen(best) ||
+		   strlen(p) == strlen(best) && strcmp(p, best) > 0)
+			best = p;
+	}
+	if(best != nil)
+		best = strdup(best);
+	free(d);
+	if(best != nil || !bind)
+		return best;
+
+	/* the boot domains live under /cognitive-cities/domains, so this is harmless for them */
+	ctl("create-namespace %s /cognitive-cities/domains/%s", st->src, st->src);
+	ctl("create-namespace %s /cognitive-cities/domains/%s", st->dst, st->dst);
+	if(ctl("bind-channel %s %s", st->src, st->dst) < 0)
+		sysfatal("bind-channel %s %s: %r", st->src, st->dst);
+	if((best = channel(st, 0)) == nil)
+		sysfatal("no %s channel after bind", prefix);
+	return best;
+}
+
+int
+opendata(Stream *st, int mode)
+{
+	char file[256];
+	int fd;
+
+	snprint(file, sizeof file, "%s/channels/%s/data", dev, st->chanid);
+	fd = open(file, mode);
+	if(fd < 0)
+		sysfatal("open %s: %r", file);
+	return fd;
+}
+
+void
+sender(int id)
+{
+	Stream *st;
+	uchar *buf;
+	vlong now, lag;
+	ulong s;
+	long i;
+	Hdr h;
+	int fd, k;
+
+	st = &streams[id];
+	fd = opendata(st, OWRITE);
+	buf = malloc(Maxmsg);
+	if(buf == nil)
+		sysfatal("malloc: %r");
+	s = seed * 2654435761UL + id + 1;
+	if(s == 0)
+		s = 1;
+	for(k = sizeof h; k < Maxmsg; k++)
+		buf[k] = next(&s);
+	h.stream = id;
+	for(i = 0; i < st->n; i++){
+		/* sleep to within Early of the slot, never past it */
+		now = nsec() - start;
+		if(st->due[i] - now > Early)
+			sleep((st->due[i] - now - Early/2) / 1000000);
+		now = nsec() - start;
+		lag = now - st->due[i];
+		if(lag > Late)
+			st->late++;
+		if(lag > st->maxlag)
+			st->maxlag = lag;
+		h.due = st->due[i];
+		h.seq = i;
+		memmove(buf, &h, sizeof h);
+		if(write(fd, buf, st->size[i]) != st->size[i])
+			sysfatal("%s: write: %r", st->chanid);
+	}
+	h.stream = Stop;
+	memmove(buf, &h, sizeof h);
+	if(write(fd, buf, sizeof h) != sizeof h)
+		sysfatal("%s: stop: %r", st->chanid);
+	close(fd);
+	exits(nil);
+}
+
+void
+receiver(int id)
+{
+	Stream *st;
+	uchar *buf;
+	vlong now;
+	Hdr h;
+	int fd, n;
+
+	st = &streams[id];
+	fd = opendata(st, OREAD);
+	buf = malloc(Maxmsg);
+	if(buf == nil)
+		sysfatal("malloc: %r");
+	for(;;){
+		n = read(fd, buf, Maxmsg);
+		if(n < 0)
+			sysfatal("%s: read: %r", st->chanid);
+		if(n < sizeof h)
+			continue;
+		now = nsec() - start;
+		memmove(&h, buf, sizeof h);
+		if(h.stream == Stop)
+			break;
+		if(h.stream != id || h.seq < 0 || h.seq >= st->n || st->lat[h.seq] >= 0)
+			continue;	/* another writer's traffic on the channel */
+		st->lat[h.seq] = now - h.due;
+		st->recv++;
+		st->lastrecv = now;
+	}
+	close(fd);
+	exits(nil);
+}
+
+int
+vlongcmp(void *a, void *b)
+{
+	vlong x, y;
+
+	x = *(vlong*)a;
+	y = *(vlong*)b;
+	return x < y ? -1 : x > y;
+}
+
+double
+pct(vlong *v, long n, double p)
+{
+	if(n == 0)
+		return 0;
+	return v[(long)(p * (n - 1))] / 1000.0;
+}
+
+/* sort the received latencies of st into v and print its line */
+void
+report(char *name, vlong *v, long n, long sent, long late, vlong maxlag, vlong end)
+{
+	double s;
+
+	qsort(v, n, sizeof v[0], vlongcmp);
+	s = end / 1e9;
+	print("cityload stream=%s msgs=%ld recv=%ld secs=%.3f msgps=%.0f p50us=%.1f p99us=%.1f "
+		"p999us=%.1f maxus=%.1f late=%ld maxlagus=%.1f\n",
+		name, sent, n, s, s > 0 ? n / s : 0, pct(v, n, 0.5), pct(v, n, 0.99),
+		pct(v, n, 0.999), n > 0 ? v[n-1] / 1000.0 : 0, late, maxlag / 1000.0);
+}
+
+void
+main(int argc, char *argv[])
+{
+	char *trace, name[256];
+	vlong *all, end;
+	long i, j, n, total, late;
+	vlong maxlag;
+	int k, lost;
+	Stream *st;
+
+	trace = nil;
+	ARGBEGIN{
+	case 's':
+		parsestream(EARGF(usage()));
+		break;
+	case 't':
+		secs = atof(EARGF(usage()));
+		break;
+	case 'p':
+		poisson = 1;
+		break;
+	case 'S':
+		seed = strtoul(EARGF(usage()), 0, 0);
+		break;
+	case 'b':
+		parseburst(EARGF(usage()));
+		break;
+	case 'r':
+		trace = EARGF(usage());
+		break;
+	case 'x':
+		speed = atof(EARGF(usage()));
+		break;
+	case 'd':
+		dev = EARGF(usage());
+		break;
+	default:
+		usage();
+	}ARGEND
+	if(argc != 0 || secs <= 0 || speed <= 0)
+		usage();
+	if(trace != nil && nstreams > 0)
+		sysfatal("-r and -s do not mix");
+
+	if(trace != nil)
+		readtrace(trace);
+	else{
+		if(nstreams == 0){
+			/* the boot-time channels, at a city's sensor rates */
+			parsestream(strdup("transportation:energy:1000:64-512"));
+			parsestream(strdup("transportation:governance:200:64-1024"));
+			parsestream(strdup("energy:environment:500:64-256"));
+			parsestream(strdup("governance:environment:50:256-4096"));
+		}
+		for(k = 0; k < nstreams; k++)
+			synthesize(&streams[k], seed * 2246822519UL + k + 1);
+	}
+	if(nstreams == 0)
+		sysfatal("no traffic");
+
+	total = 0;
+	for(k = 0; k < nstreams; k++){
+		st = &streams[k];
+		st->chanid = channel(st, 1);
+		st->lat = malloc((st->n > 0 ? st->n : 1) * sizeof st->lat[0]);
+		if(st->lat == nil)
+			sysfatal("malloc: %r");
+		for(i = 0; i < st->n; i++)
+			st->lat[i] = -1;
+		total += st->n;
+	}
+
+	for(k = 0; k < nstreams; k++)
+		switch(rfork(RFPROC|RFMEM|RFFDG)){
+		case -1:
+			sysfatal("rfork: %r");
+		case 0:
+			receiver(k);
+		}
+	start = nsec();
+	for(k = 0; k < nstreams; k++)
+		switch(rfork(RFPROC|RFMEM|RFFDG)){
+		case -1:
+			sysfatal("rfork: %r");
+		case 0:
+			sender(k);
+		}
+	for(k = 0; k < 2*nstreams; k++)
+		if(waitpid() < 0)
+			sysfatal("waitpid: %r");
+
+	all = malloc((total > 0 ? total : 1) * sizeof all[0]);
+	if(all == nil)
+		sysfatal("malloc: %r");
+	n = 0;
+	late = 0;
+	maxlag = 0;
+	end = 0;
+	lost = 0;
+	for(k = 0; k < nstreams; k++){
+		st = &streams[k];
+		j = 0;
+		for(i = 0; i < st->n; i++)
+			if(st->lat[i] >= 0)
+				all[n++] = st->lat[j++] = st->lat[i];
+		snprint(name, sizeof name, "%s-%s", st->src, st->dst);
+		report(name, st->lat, j, st->n, st->late, st->maxlag, st->lastrecv);
+		late += st->late;
+		if(st->maxlag > maxlag)
+			maxlag = st->maxlag;
+		if(st->lastrecv > end)
+			end = st->lastrecv;
+		if(st->recv != st->n){
+			fprint(2, "cityload: %s received %ld of %ld messages\n", name, st->recv, st->n);
+			lost = 1;
+		}
+	}
+	report("total", all, n, total, late, maxlag, end);
+	exits(lost ? "lost messages" : nil);
+}
@@ -0,0 +1,144 @@
+/*
+ * drawbench - devdraw redraw rate benchmark
+ *
+ * Redraws the whole window -n times per test and flushes after
+ * each frame, as a dashboard does, and reports frames per second:
+ *
+ *	fill	solid colour fill, alternating two colours
+ *	copy	scroll the window up by one text line
+ *	text	fill then a screenful of text
+ *	blend	fill through a half-transparent mask
+ *
+ * Run it in a fresh rio window of a fixed size, so results are
+ * comparable across kernels; each test prints one line of
+ * key=value fields, the best of -r runs:
+ *
+ *	drawbench test=fill size=800x600 frames=500 fps=1210.3
+ */
+
+#include <u.h>
+#include <libc.h>
+#include <draw.h>
+
+typedef struct Test Test;
+struct Test {
+	char	*name;
+	void	(*frame)(int);
+};
+
+int	nframe = 500;
+int	nrep = 3;
+Image	*col[2];
+Image	*half;
+
+void
+usage(void)
+{
+	fprint(2, "usage: drawbench [-n frames] [-r runs] [test ...]\n");
+	exits("usage");
+}
+
+void
+fillframe(int i)
+{
+	draw(screen, screen->r, col[i&1], nil, ZP);
+}
+
+void
+copyframe(int i)
+{
+	Rectangle r;
+
+	r = screen->r;
+	r.max.y -= font->height;
+	draw(screen, r, screen, nil, addpt(r.min, Pt(0, font->height)));
+	r.min.y = r.max.y;
+	r.max.y += font->height;
+	draw(screen, r, col[i&1], nil, ZP);
+}
+
+void
+textframe(int i)
+{
+	Point p;
+
+	draw(screen, screen->r, col[i&1], nil, ZP);
+	for(p = screen->r.min; p.y + font->height <= screen->r.max.y; p.y += font->height)
+		string(screen, p, col[~i&1], ZP, font,
+			"sensor=17 t=1712345678 value=23.45 C ok ok ok ok ok ok ok ok ok ok");
+}
+
+void
+blendframe(int i)
+{
+	draw(screen, screen->r, col[i&1], half, ZP);
+}
+
+Test tests[] = {
+	"fill",	fillframe,
+	"copy",	copyframe,
+	"text",	textframe,
+	"blend",	blendframe,
+};
+
+void
+bench(Test *t)
+{
+	int i, r;
+	vlong t0, ns, best;
+
+	best = -1;
+	for(r = 0; r < nrep; r++) {
+		t0 = nsec();
+		for(i = 0; i < nframe; i++) {
+			t->frame(i);
+			flushimage(display, 1);
+		}
+		ns = nsec() - t0;
+		if(best < 0 || ns < best)
+			best = ns;
+	}
+	print("drawbench test=%s size=%dx%d frames=%d fps=%.1f\n",
+		t->name, Dx(screen->r), Dy(screen->r), nframe,
+		best > 0 ? nframe * 1e9 / best : 0);
+}
+
+void
+main(int argc, char *argv[])
+{
+	int i, j;
+
+	ARGBEGIN{
+	case 'n':
+		nframe = atoi(EARGF(usage()));
+		break;
+	case 'r':
+		nrep = atoi(EARGF(usage()));
+		break;
+	default:
+		usage();
+	}ARGEND
+	if(nframe < 1 || nrep < 1)
+		usage();
+
+	if(initdraw(nil, nil, "drawbench") < 0)
+		sysfatal("initdraw: %r");
+	col[0] = allocimage(display, Rect(0,0,1,1), screen->chan, 1, DPalebluegreen);
+	col[1] = allocimage(display, Rect(0,0,1,1), screen->chan, 1, DDarkblue);
+	half = allocimage(display, Rect(0,0,1,1), GREY8, 1, 0x7F7F7FFF);
+	if(col[0] == nil || col[1] == nil || half == nil)
+		sysfatal("allocimage: %r");
+
+	if(argc == 0)
+		for(i = 0; i < nelem(tests); i++)
+			bench(&tests[i]);
+	for(j = 0; j < argc; j++) {
+		for(i = 0; i < nelem(tests); i++)
+			if(strcmp(argv[j], tests[i].name) == 0)
+				break;
+		if(i == nelem(tests))
+			usage();
+		bench(&tests[i]);
+	}
+	exits(nil);
+}
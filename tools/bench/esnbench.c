@@ -0,0 +1,175 @@
+/*
+ * esnbench - echo state network step rate by reservoir size and sparsity
+ *
+ * Runs the kernel's own reservoir, through esn-bench on the ctl file,
+ * for every combination of reservoir size, connectivity and stepping
+ * mode (float rows of W, Q15 fixed point, or propagation along the
+ * hypergraph), and prints one row per CPU count the kernel splits a
+ * step over.  Rows come from the esn-bench events, so the events file
+ * is opened before the first command.
+ *
+ *	  size sparse  mode cpus    ns/step   steps/s  bytes/step     MB/s budget
+ *	 10000  0.050 float    1    4000000       250    40720004    10180 over
+ *
+ * The step count is chosen so each combination streams about the
+ * same number of connections, unless -n gives it.  With -l, each row
+ * says whether a step fits in that many microseconds.  A reservoir
+ * the kernel cannot allocate prints its error in place of a row.
+ */
+
+#include <u.h>
+#include <libc.h>
+#include <bio.h>
+
+enum {
+	Maxlist		= 16,
+	Work		= 200000000,	/* connections streamed per combination */
+	Minsteps	= 10,
+	Maxsteps	= 100000,
+};
+
+char	*dev = "/proc/cognitive";
+int	sizes[Maxlist] = { 100, 1000, 10000, 50000 };
+int	nsizes = 4;
+double	sparse[Maxlist] = { 0.01, 0.05, 0.10, 0.20 };
+int	nsparse = 4;
+char	*modes[Maxlist] = { "float", "fixed", "hyper" };
+int	nmodes = 3;
+int	nsteps;
+vlong	budget;		/* ns, 0 for none */
+Biobuf	*events;
+int	ctlfd;
+int	errors;
+
+void
+usage(void)
+{
+	fprint(2, "usage: esnbench [-s size,...] [-p percent,...] [-m mode,...] [-n steps]\n");
+	fprint(2, "\t[-l budgetus] [-d dev]\n");
+	exits("usage");
+}
+
+int
+list(char *s, char **f)
+{
+	int n;
+
+	n = getfields(s, f, Maxlist, 1, ",");
+	if(n < 1)
+		usage();
+	return n;
+}
+
+int
+steps(int size, double sp)
+{
+	vlong n;
+
+	if(nsteps > 0)
+		return nsteps;
+	n = Work / ((vlong)size * size * sp + 1);
+	if(n < Minsteps)
+		n = Minsteps;
+	if(n > Maxsteps)
+		n = Maxsteps;
+	return n;
+}
+
+/* read esn-bench events for size until its done line, printing a row each */
+void
+rows(int size)
+{
+	char *line, *f[8];
+	vlong ns, bytes;
+	int n;
+
+	while((line = Brdstr(events, '\n', 1)) != nil){
+		n = tokenize(line, f, nelem(f));
+		if(n < 3 || strcmp(f[1], "esn-bench") != 0 || atoi(f[2]) != size){
+			free(line);
+			continue;
+		}
+		if(n == 4 && strcmp(f[3], "done") == 0){
+			free(line);
+			return;
+		}
+		if(n != 8){
+			free(line);
+			continue;
+		}
+		ns = strtoll(f[6], 0, 10);
+		bytes = strtoll(f[7], 0, 10);
+		print("%6d %6s %5s %4s %10lld %9.0f %11lld %8.0f", size, f[5], f[4], f[3],
+			ns, ns > 0 ? 1e9 / ns : 0, bytes, ns > 0 ? bytes * 1e3 / ns : 0);
+		if(budget > 0)
+			print(" %s", ns <= budget ? "ok" : "over");
+		print("\n");
+		free(line);
+	}
+	sysfatal("events: %r");
+}
+
+void
+main(int argc, char *argv[])
+{
+	char file[128], *f[Maxlist], err[ERRMAX];
+	int i, j, k, n, fd;
+
+	ARGBEGIN{
+	case 's':
+		nsizes = list(EARGF(usage()), f);
+		for(i = 0; i < nsizes; i++)
+			sizes[i] = atoi(f[i]);
+		break;
+	case 'p':
+		nsparse = list(EARGF(usage()), f);
+		for(i = 0; i < nsparse; i++)
+			sparse[i] = atof(f[i]) / 100;
+		break;
+	case 'm':
+		nmodes = list(EARGF(usage()), modes);
+		break;
+	case 'n':
+		nsteps = atoi(EARGF(usage()));
+		break;
+	case 'l':
+		budget = strtoll(EARGF(usage()), 0, 10) * 1000;
+		break;
+	case 'd':
+		dev = EARGF(usage());
+		break;
+	default:
+		usage();
+	}ARGEND
+	if(argc != 0)
+		usage();
+
+	snprint(file, sizeof file, "%s/events", dev);
+	fd = open(file, OREAD);
+	if(fd < 0)
+		sysfatal("open %s: %r", file);
+	events = Bfdopen(fd, OREAD);
+	if(events == nil)
+		sysfatal("Bfdopen: %r");
+	snprint(file, sizeof file, "%s/ctl", dev);
+	ctlfd = open(file, OWRITE);
+	if(ctlfd < 0)
+		sysfatal("open %s: %r", file);
+
+	print("%6s %6s %5s %4s %10s %9s %11s %8s%s\n", "size", "sparse", "mode", "cpus",
+		"ns/step", "steps/s", "bytes/step", "MB/s", budget > 0 ? " budget" : "");
+	for(i = 0; i < nsizes; i++)
+		for(j = 0; j < nsparse; j++)
+			for(k = 0; k < nmodes; k++){
+				n = fprint(ctlfd, "esn-bench %d %d %.4f %s", sizes[i],
+					steps(sizes[i], sparse[j]), sparse[j], modes[k]);
+				if(n < 0){
+					rerrstr(err, sizeof err);
+					print("%6d %6.3f %5s %s\n", sizes[i], sparse[j], modes[k], err);
+					errors++;
+					continue;
+				}
+				rows(sizes[i]);
+			}
+	exits(errors ? "errors" : nil);
+}
@@ -0,0 +1,231 @@
+/*
+ * matulabench - Matula number and rooted tree enumeration benchmark
+ *
+ * Times the kernel's own port/matula.c, built for user space, by
+ * tree size: enumerating the trees of n nodes, encoding each one's
+ * parens to its Matula number and decoding the number back.  Every
+ * size is checked against OEIS before it is reported: the count of
+ * trees against A000081, their numbers for distinctness, and each
+ * decoded tree's size against A061775, so a faster encoder that is
+ * wrong fails here rather than in the kernel.
+ *
+ * A tree with a subtree numbered past the prime table has no 64-bit
+ * Matula number; those are counted as unencoded and left out of the
+ * decode rate and checks.
+ *
+ * Each size prints one line of key=value fields, rates per second
+ * and the best of -r repetitions:
+ *
+ *	matulabench n=12 trees=4766 unencoded=5 enumps=25404305
+ *		encodeps=4726191 decodeps=1069099 ok
+ */
+
+#include <u.h>
+#include <libc.h>
+#include "../../port/matula.h"
+
+/* OEIS A000081, rooted trees with n nodes */
+static uvlong oeis000081[] = {
+	0, 1, 1, 2, 4, 9, 20, 48, 115, 286, 719, 1842, 4766, 12486, 32973,
+	87811, 235381, 634847, 1721159, 4688676, 12826228,
+};
+
+/* OEIS A061775, nodes in the tree with Matula number n */
+static uchar oeis061775[] = {
+	0,
+	1, 2, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 6, 5, 5, 6, 5, 6,
+	6, 6, 6, 6, 7, 6, 7, 6, 6, 7, 6, 6, 7, 6, 7, 7, 6, 6, 7, 7,
+	6, 7, 6, 7, 8, 7, 7, 7, 7, 8, 7, 7, 6, 8, 8, 7, 7, 7, 6, 8,
+	7, 7, 8, 7, 8, 8, 6, 7, 8, 8, 7, 8, 7, 7, 9, 7, 8, 8, 7, 8,
+	9, 7, 7, 8, 8, 7, 8, 8, 7, 9, 8, 8, 8, 8, 8, 8, 8, 8, 9, 9,
+};
+
+int	maxn = 15;
+int	nrep = 3;
+uvlong	*level[MAXN + 1];
+int	failed;
+
+void
+usage(void)
+{
+	fprint(2, "usage: matulabench [-n maxnodes] [-r reps]\n");
+	exits("usage");
+}
+
+int
+uvlongcmp(void *a, void *b)
+{
+	uvlong x, y;
+
+	x = *(uvlong*)a;
+	y = *(uvlong*)b;
+	return x < y ? -1 : x > y;
+}
+
+double
+rate(ulong n, vlong ns)
+{
+	return ns > 0 ? n * 1e9 / ns : 0;
+}
+
+void
+fail(int n, char *fmt, ...)
+{
+	char buf[256];
+	va_list arg;
+
+	va_start(arg, fmt);
+	vsnprint(buf, sizeof buf, fmt, arg);
+	va_end(arg);
+	print("matulabench n=%d FAIL %s\n", n, buf);
+	failed = 1;
+}
+
+/* nodes in a parens string, or -1 if it does not re-encode to m */
+int
+checkdecode(char *buf, int len, uvlong m)
+{
+	int i, nodes;
+
+	buf[len] = '\0';
+	if(parens_to_matula(buf) != m)
+		return -1;
+	nodes = 0;
+	for(i = 0; i < len; i++)
+		nodes += buf[i] == '(';
+	return nodes;
+}
+
+/* decode every Matula number A061775 lists and check its size */
+void
+oracle(void)
+{
+	char buf[Nmatulacachelen];
+	int m, len;
+
+	for(m = 1; m < nelem(oeis061775); m++) {
+		len = matula_subtree(m, buf, sizeof buf - 1);
+		if(len < 0 || checkdecode(buf, len, m) != oeis061775[m]) {
+			print("matulabench a061775 FAIL m=%d\n", m);
+			failed = 1;
+			return;
+		}
+	}
+	print("matulabench a061775=%d ok\n", nelem(oeis061775) - 1);
+}
+
+void
+bench(int n)
+{
+	TreeIter it;
+	tree t;
+	uvlong *l, *m;
+	char *parens, buf[2*MAXN + 1];
+	ulong k, count, words, over;
+	vlong t0, best[3], ns;
+	int r, len, stride;
+
+	words = tree_level_words(n);
+	l = mallocz(words * sizeof(uvlong), 1);
+	stride = 2 * n + 1;
+	parens = malloc(a000081[n] * stride);
+	m = malloc(a000081[n] * sizeof(uvlong));
+	if(l == nil || parens == nil || m == nil)
+		sysfatal("malloc: %r");
+	best[0] = best[1] = best[2] = -1;
+	level[n] = l;
+
+	for(r = 0; r < nrep; r++) {
+		/* enumerate, packing each tree into the level as the kernel does */
+		memset(l, 0, words * sizeof(uvlong));
+		t0 = nsec();
+		tree_iter_init(&it, n, level);
+		for(count = 0; count < a000081[n] && tree_iter_next(&it, &t); count++)
+			tree_level_put(l, n, count, t);
+		ns = nsec() - t0;
+		if(best[0] < 0 || ns < best[0])
+			best[0] = ns;
+		if(count != oeis000081[n] || tree_iter_next(&it, &t)) {
+			fail(n, "enumerated %lud trees, A000081 has %llud", count, oeis000081[n]);
+			goto out;
+		}
+
+		for(k = 0; k < count; k++)
+			tree_parens_seprint(parens + k * stride, parens + (k + 1) * stride,
+				tree_level_get(level, n, k), n);
+
+		t0 = nsec();
+		for(k = 0; k < count; k++)
+			m[k] = parens_to_matula(parens + k * stride);
+		ns = nsec() - t0;
+		if(best[1] < 0 || ns < best[1])
+			best[1] = ns;
+
+		t0 = nsec();
+		for(k = 0; k < count; k++)
+			if(m[k] != 0 && matula_subtree(m[k], buf, sizeof buf - 1) != 2 * n)
+				break;
+		ns = nsec() - t0;
+		if(best[2] < 0 || ns < best[2])
+			best[2] = ns;
+		if(k < count) {
+			fail(n, "tree %lud, Matula %llud, does not decode to %d nodes", k, m[k], n);
+			goto out;
+		}
+	}
+
+	/* decoding is canonical, so each number must come back to itself */
+	over = 0;
+	for(k = 0; k < count; k++) {
+		if(m[k] == 0) {
+			over++;
+			continue;
+		}
+		len = matula_subtree(m[k], buf, sizeof buf - 1);
+		if(len < 0 || checkdecode(buf, len, m[k]) != n) {
+			fail(n, "Matula %llud does not round-trip", m[k]);
+			goto out;
+		}
+	}
+	qsort(m, count, sizeof m[0], uvlongcmp);
+	for(k = over + 1; k < count; k++)
+		if(m[k] == m[k - 1]) {
+			fail(n, "Matula %llud is repeated", m[k]);
+			goto out;
+		}
+
+	print("matulabench n=%d trees=%lud unencoded=%lud enumps=%.0f encodeps=%.0f decodeps=%.0f ok\n",
+		n, count, over, rate(count, best[0]), rate(count, best[1]), rate(count - over, best[2]));
+	l = nil;
+out:
+	if(l != nil){
+		level[n] = nil;
+		free(l);
+	}
+	free(parens);
+	free(m);
+}
+
+void
+main(int argc, char *argv[])
+{
+	int n;
+
+	ARGBEGIN{
+	case 'n':
+		maxn = atoi(EARGF(usage()));
+		break;
+	case 'r':
+		nrep = atoi(EARGF(usage()));
+		break;
+	default:
+		usage();
+	}ARGEND
+	if(argc != 0 || maxn < 1 || maxn > MAXN || nrep < 1)
+		usage();
+
+	oracle();
+	for(n = 1; n <= maxn && !failed; n++)
+		bench(n);
+	exits(failed ? "failed" : nil);
+}
@@ -0,0 +1,178 @@
+/*
+ * membench - memmove and memset speed, libc's against the arm
+ * kernel's (teg2/lmem.s, assembled here as kmemmove and kmemset)
+ *
+ * Each size in -s is moved and set -n times at each of the
+ * from/to misalignments in -a (from,to byte offsets) and the
+ * best of -r runs reported as bytes per cpu cycle, using the
+ * clock rate from #P/cputype or -m MHz.  The data is cold only
+ * for sizes beyond the caches.
+ *
+ *	membench op=memmove impl=kernel size=1500 align=2,0 bpc=0.82
+ *	membench op=memset impl=libc size=4096 align=0,0 bpc=1.96
+ */
+
+#include <u.h>
+#include <libc.h>
+
+void*	kmemmove(void*, void*, ulong);
+void*	kmemset(void*, int, ulong);
+
+typedef struct Impl Impl;
+struct Impl
+{
+	char	*name;
+	void*	(*move)(void*, void*, ulong);
+	void*	(*set)(void*, int, ulong);
+};
+
+Impl impls[] = {
+	"libc",		memmove,	memset,
+	"kernel",	kmemmove,	kmemset,
+};
+
+char	*sizes = "16,64,256,1500,4096,65536,1048576";
+char	*aligns = "0,0 2,0 0,2 1,3";
+long	niter = 0;
+int	nrep = 3;
+double	mhz;
+
+void
+usage(void)
+{
+	fprint(2, "usage: membench [-s sizes] [-a 'from,to ...'] [-n iter] [-r runs] [-m mhz]\n");
+	exits("usage");
+}
+
+double
+cpumhz(void)
+{
+	char buf[128], *f[4];
+	int fd, n;
+
+	fd = open("#P/cputype", OREAD);
+	if(fd < 0)
+		return 0;
+	n = read(fd, buf, sizeof buf - 1);
+	close(fd);
+	if(n <= 0)
+		return 0;
+	buf[n] = 0;
+	n = tokenize(buf, f, nelem(f));
+	if(n < 2)
+		return 0;
+	return atof(f[n-1]);
+}
+
+/* best ns for iter calls of op 0 (move) or 1 (set) */
+vlong
+run(Impl *im, int op, uchar *to, uchar *from, ulong size, long iter)
+{
+	long i;
+	int r;
+	vlong t0, ns, best;
+
+	best = -1;
+	for(r = 0; r < nrep; r++){
+		t0 = nsec();
+		if(op == 0)
+			for(i = 0; i < iter; i++)
+				im->move(to, from, size);
+		else
+			for(i = 0; i < iter; i++)
+				im->set(to, i, size);
+		ns = nsec() - t0;
+		if(best < 0 || ns < best)
+			best = ns;
+	}
+	return best;
+}
+
+void
+check(Impl *im, uchar *to, uchar *from, ulong size)
+{
+	ulong i;
+
+	for(i = 0; i < size; i++)
+		from[i] = i*7;
+	im->move(to, from, size);
+	if(memcmp(to, from, size) != 0)
+		sysfatal("%s memmove wrong at size %lud", im->name, size);
+	im->set(to, 0x5a, size);
+	for(i = 0; i < size; i++)
+		if(to[i] != 0x5a)
+			sysfatal("%s memset wrong at size %lud", im->name, size);
+}
+
+void
+main(int argc, char *argv[])
+{
+	char *sf[32], *af[16], *p;
+	int i, j, k, op, ns, na, fa, ta;
+	long iter;
+	ulong size;
+	uchar *from, *to;
+	vlong t;
+	Impl *im;
+
+	ARGBEGIN{
+	case 's':
+		sizes = EARGF(usage());
+		break;
+	case 'a':
+		aligns = EARGF(usage());
+		break;
+	case 'n':
+		niter = atol(EARGF(usage()));
+		break;
+	case 'r':
+		nrep = atoi(EARGF(usage()));
+		break;
+	case 'm':
+		mhz = atof(EARGF(usage()));
+		break;
+	default:
+		usage();
+	}ARGEND
+	if(nrep < 1 || argc != 0)
+		usage();
+	if(mhz <= 0)
+		mhz = cpumhz();
+	if(mhz <= 0)
+		sysfatal("no clock rate: use -m");
+
+	ns = getfields(sizes, sf, nelem(sf), 1, ",");
+	na = tokenize(aligns, af, nelem(af));
+	for(i = 0; i < ns; i++){
+		size = strtoul(sf[i], nil, 0);
+		from = malloc(size+8);
+		to = malloc(size+8);
+		if(from == nil || to == nil)
+			sysfatal("malloc: %r");
+		iter = niter;
+		if(iter <= 0)
+			iter = 64*1024*1024 / (size+16);
+		for(j = 0; j < na; j++){
+			fa = strtol(af[j], &p, 0) & 7;
+			ta = 0;
+			if(*p == ',')
+				ta = strtol(p+1, nil, 0) & 7;
+			for(k = 0; k < nelem(impls); k++){
+				im = &impls[k];
+				check(im, to+ta, from+fa, size);
+				for(op = 0; op < 2; op++){
+					if(op == 1 && fa != 0)
+						continue;	/* memset has no from */
+					t = run(im, op, to+ta, from+fa, size, iter);
+					print("membench op=%s impl=%s size=%lud align=%d,%d bpc=%.2f\n",
+						op == 0? "memmove": "memset", im->name,
+						size, fa, ta,
+						(double)size*iter / (t*mhz/1000.0));
+				}
+			}
+		}
+		free(from);
+		free(to);
+	}
+	exits(nil);
+}
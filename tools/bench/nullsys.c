@@ -0,0 +1,81 @@
+/*
+ * nullsys - null system call latency benchmark
+ *
+ * Times alarm(0), about the cheapest call the kernel has, made
+ * through the libc stub's int $64 gate and then through the
+ * sysenter entry pc kernels set up with sysenterinit.  Each is
+ * the best of -r runs of -n calls; -i skips sysenter, for kernels
+ * or processors without it.
+ *
+ * Each entry path prints one line of key=value fields:
+ *
+ *	nullsys path=int calls=1000000 runs=3 nscall=301.4
+ *	nullsys path=sysenter calls=1000000 runs=3 nscall=118.9
+ */
+
+#include <u.h>
+#include <libc.h>
+
+long	sysenteralarm(ulong);
+
+long	ncall = 1000000;
+int	nrep = 3;
+int	intonly;
+
+void
+usage(void)
+{
+	fprint(2, "usage: nullsys [-i] [-n calls] [-r runs]\n");
+	exits("usage");
+}
+
+long
+intalarm(ulong ms)
+{
+	return alarm(ms);
+}
+
+void
+bench(char *path, long (*call)(ulong))
+{
+	long i;
+	int r;
+	vlong t0, ns, best;
+
+	best = -1;
+	for(r = 0; r < nrep; r++) {
+		t0 = nsec();
+		for(i = 0; i < ncall; i++)
+			call(0);
+		ns = nsec() - t0;
+		if(best < 0 || ns < best)
+			best = ns;
+	}
+	print("nullsys path=%s calls=%ld runs=%d nscall=%.1f\n",
+		path, ncall, nrep, (double)best / ncall);
+}
+
+void
+main(int argc, char *argv[])
+{
+	ARGBEGIN{
+	case 'i':
+		intonly = 1;
+		break;
+	case 'n':
+		ncall = atol(EARGF(usage()));
+		break;
+	case 'r':
+		nrep = atoi(EARGF(usage()));
+		break;
+	default:
+		usage();
+	}ARGEND
+	if(ncall < 1 || nrep < 1 || argc != 0)
+		usage();
+
+	bench("int", intalarm);
+	if(!intonly)
+		bench("sysenter", sysenteralarm);
+	exits(nil);
+}
@@ -0,0 +1,17 @@
+#include "/sys/src/libc/9syscall/sys.h"
+
+#define SYSENTER	BYTE $0x0F; BYTE $0x34
+
+/*
+ * alarm(0) through sysenter rather than int $64: number in AX,
+ * stack in CX, return pc in DX, arguments where the kernel
+ * always looks for them, one word above the return address.
+ */
+TEXT sysenteralarm(SB), $0
+	MOVL	$ALARM, AX
+	MOVL	SP, CX
+	MOVL	$sysenterret(SB), DX
+	SYSENTER
+
+TEXT sysenterret(SB), $0
+	RET
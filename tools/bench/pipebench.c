@@ -0,0 +1,456 @@
+/*
+ * pipebench - sensor packets over UDP to reservoir decisions
+ *
+ * Drives the kernel's sensor pipelines (sensor-pipe in the cognitive
+ * ctl file) end to end: each datagram is read from a UDP
+ * conversation by an ingest kproc, queued on a neural channel, and
+ * stepped through a reservoir whose readout is the decision.  -p
+ * pipelines each get a port, a channel and a reservoir of -n nodes
+ * with -i inputs, and one sender pacing packets open loop at -r per
+ * second (0 sends as fast as the stack takes them).  Packets are
+ * stamped with the time they were due, not sent, so a stall shows
+ * in the latency of everything behind it.
+ *
+ * The kernel measures the decision latency, stamp to readout, and
+ * the time its kprocs spend working; events over that time is the
+ * rate one CPU sustains.  Percentiles are the kernel's log2 bucket
+ * bounds, and the total's are the worst pipeline's.
+ *
+ *	pipebench pipe=0 sent=100000 late=0 events=100000 dropped=0 secs=10.002
+ *		eps=9998 busyms=812.4 epspercore=123091 p50us=64 p99us=256 maxus=1630
+ *
+ * Needs a kernel with the cognitive device, such as pc/pccog.
+ */
+
+#include <u.h>
+#include <libc.h>
+
+enum {
+	Maxpipes	= 16,	/* pipe lines the transport file holds */
+	Hdr		= 16,	/* stamp[8] seq[4] count[4], then count floats */
+	Maxinputs	= 256,
+	Early		= 2*1000*1000,	/* ns before a send we stop sleeping */
+	Quiet		= 500,	/* ms without progress that ends the drain */
+};
+
+typedef struct Pipe Pipe;
+struct Pipe {
+	char	esn[64];
+	char	*chanid;
+	int	port;
+	int	data;		/* announced conversation, kept open for the run */
+	long	sent;
+	long	late;
+
+	/* from the kernel's pipe line */
+	ulong	events;
+	ulong	dropped;
+	ulong	malformed;
+	uvlong	busyus;
+	ulong	p50us;
+	ulong	p99us;
+	ulong	maxus;
+};
+
+char	*dev = "/proc/cognitive";
+char	*host;
+Pipe	pipes[Maxpipes];
+int	npipes = 1;
+int	size = 256;
+int	inputs = 4;
+int	outputs = 1;
+double	rate = 10000;
+double	secs = 10;
+int	baseport = 17300;
+ulong	seed = 1;
+vlong	start;
+
+void
+usage(void)
+{
+	fprint(2, "usage: pipebench [-p pipes] [-n size] [-i inputs] [-o outputs] [-r pkts/s]\n");
+	fprint(2, "\t[-t secs] [-P port] [-h host] [-S seed] [-d dev]\n");
+	exits("usage");
+}
+
+/* xorshift32, as in cityload */
+ulong
+next(ulong *s)
+{
+	ulong x;
+
+	x = *s;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *s = x;
+}
+
+void
+put32(uchar *p, ulong v)
+{
+	p[0] = v;
+	p[1] = v>>8;
+	p[2] = v>>16;
+	p[3] = v>>24;
+}
+
+int
+ctl(char *fmt, ...)
+{
+	char file[256], buf[256];
+	va_list arg;
+	int fd, n;
+
+	snprint(file, sizeof file, "%s/ctl", dev);
+	fd = open(file, OWRITE);
+	if(fd < 0)
+		sysfatal("open %s: %r", file);
+	va_start(arg, fmt);
+	n = vsnprint(buf, sizeof buf, fmt, arg);
+	va_end(arg);
+	n = write(fd, buf, n);
+	close(fd);
+	return n;
+}
+
+/* the newest src-dst channel, as in cityload; ids end in their creation time */
+char*
+channel(char *src, char *dst)
+{
+	char file[128], prefix[128], *best, *p;
+	Dir *d;
+	int fd, i, n, np;
+
+	snprint(prefix, sizeof prefix, "%s-%s-", src, dst);
+	np = strlen(prefix);
+	snprint(file, sizeof file, "%s/channels", dev);
+	fd = open(file, OREAD);
+	if(fd < 0)
+		sysfatal("open %s: %r", file);
+	n = dirreadall(fd, &d);
+	close(fd);
+	best = nil;
+	for(i = 0; i < n; i++){
+		p = d[i].name;
+		if(strncmp(p, prefix, np) != 0)
+			continue;
+		if(best == nil || strlen(p) > strlen(best) ||
+		   strlen(p) == strlen(best) && strcmp(p, best) > 0)
+			best = p;
+	}
+	if(best != nil)
+		best = strdup(best);
+	free(d);
+	return best;
+}
+
+/* reservoir, channel and announced port for pipeline k, then start it */
+void
+setup(int k)
+{
+	char addr[64], adir[40], file[64], dst[32], err[ERRMAX];
+	Pipe *pp;
+	int cfd;
+
+	pp = &pipes[k];
+	snprint(pp->esn, sizeof pp->esn, "pipebench%d-%dx%dx%d", k, size, inputs, outputs);
+	if(ctl("esn-create %s %d %d %d", pp->esn, size, inputs, outputs) < 0){
+		/* reservoirs outlive the run; reuse the last one */
+		rerrstr(err, sizeof err);
+		if(strstr(err, "exist") == nil)
+			sysfatal("esn-create %s: %s", pp->esn, err);
+	}
+
+	snprint(dst, sizeof dst, "pipebench%d", k);
+	ctl("create-namespace pipebench-sensors /cognitive-cities/domains/pipebench-sensors");
+	ctl("create-namespace %s /cognitive-cities/domains/%s", dst, dst);
+	pp->chanid = channel("pipebench-sensors", dst);
+	if(pp->chanid == nil){
+		if(ctl("bind-channel pipebench-sensors %s", dst) < 0)
+			sysfatal("bind-channel %s: %r", dst);
+		if((pp->chanid = channel("pipebench-sensors", dst)) == nil)
+			sysfatal("no channel to %s after bind", dst);
+	}
+
+	pp->port = baseport + k;
+	snprint(addr, sizeof addr, "udp!*!%d", pp->port);
+	cfd = announce(addr, adir);
+	if(cfd < 0)
+		sysfatal("announce %s: %r", addr);
+	if(fprint(cfd, "headers") < 0)
+		sysfatal("%s: headers: %r", adir);
+	snprint(file, sizeof file, "%s/data", adir);
+	pp->data = open(file, ORDWR);
+	if(pp->data < 0)
+		sysfatal("open %s: %r", file);
+	if(ctl("sensor-pipe %s %s %d", pp->esn, pp->chanid, pp->data) < 0)
+		sysfatal("sensor-pipe %s: %r", pp->esn);
+}
+
+int
+dialpipe(Pipe *pp)
+{
+	char addr[128];
+	int fd;
+
+	snprint(addr, sizeof addr, "udp!%s!%d", host, pp->port);
+	fd = dial(addr, nil, nil, nil);
+	if(fd < 0)
+		sysfatal("dial %s: %r", addr);
+	return fd;
+}
+
+/*
+ * Open loop: packet i is due at i/rate seconds and stamped with
+ * that time.  The inputs are a slow sine per input plus noise.
+ */
+void
+sender(int k)
+{
+	Pipe *pp;
+	uchar buf[Hdr + 4*Maxinputs];
+	vlong due, now, stamp;
+	double t;
+	float v;
+	ulong s, bits;
+	long i, n;
+	int fd, j, len;
+
+	pp = &pipes[k];
+	fd = dialpipe(pp);
+	s = seed * 2654435761UL + k + 1;
+	if(s == 0)
+		s = 1;
+	len = Hdr + 4*inputs;
+	n = rate > 0 ? secs * rate : -1;
+	for(i = 0; n < 0 || i < n; i++){
+		if(rate > 0){
+			due = i * 1e9 / rate;
+			now = nsec() - start;
+			if(due - now > Early)
+				sleep((due - now - Early/2) / 1000000);
+			if(nsec() - start - due > Early)
+				pp->late++;
+			stamp = start + due;
+		}else{
+			stamp = nsec();
+			if(stamp - start >= secs * 1e9)
+				break;
+		}
+		put32(buf, stamp);
+		put32(buf+4, stamp >> 32);
+		put32(buf+8, i);
+		put32(buf+12, inputs);
+		t = (stamp - start) / 1e9;
+		for(j = 0; j < inputs; j++){
+			v = 0.8 * sin(2*PI*t / (j + 1)) + 0.2 * ((next(&s) & 0xFFFF) / 32768.0 - 1);
+			memmove(&bits, &v, 4);
+			put32(buf + Hdr + 4*j, bits);
+		}
+		if(write(fd, buf, len) != len)
+			sysfatal("%s: write: %r", pp->esn);
+		pp->sent++;
+	}
+	close(fd);
+	exits(nil);
+}
+
+/* the kernel's pipe lines, into pipes[] */
+void
+readstats(void)
+{
+	char file[256], *buf, *line, *e, *f[16], *v;
+	Pipe *pp;
+	int fd, n, m, i, k;
+
+	snprint(file, sizeof file, "%s/transport", dev);
+	fd = open(file, OREAD);
+	if(fd < 0)
+		sysfatal("open %s: %r", file);
+	buf = malloc(65536);
+	if(buf == nil)
+		sysfatal("malloc: %r");
+	n = readn(fd, buf, 65536-1);
+	close(fd);
+	if(n < 0)
+		sysfatal("read %s: %r", file);
+	buf[n] = 0;
+	for(line = buf; line < buf+n; line = e+1){
+		if((e = strchr(line, '\n')) == nil)
+			e = buf+n;
+		*e = 0;
+		m = tokenize(line, f, nelem(f));
+		if(m < 3 || strcmp(f[0], "pipe") != 0)
+			continue;
+		for(k = 0; k < npipes; k++)
+			if(strcmp(f[1], pipes[k].esn) == 0)
+				break;
+		if(k == npipes)
+			continue;
+		pp = &pipes[k];
+		for(i = 3; i < m; i++){
+			if((v = strchr(f[i], '=')) == nil)
+				continue;
+			*v++ = 0;
+			if(strcmp(f[i], "events") == 0)
+				pp->events = strtoul(v, 0, 10);
+			else if(strcmp(f[i], "dropped") == 0)
+				pp->dropped = strtoul(v, 0, 10);
+			else if(strcmp(f[i], "malformed") == 0)
+				pp->malformed = strtoul(v, 0, 10);
+			else if(strcmp(f[i], "ingestus") == 0)
+				pp->busyus = strtoull(v, 0, 10);
+			else if(strcmp(f[i], "driveus") == 0)
+				pp->busyus += strtoull(v, 0, 10);
+			else if(strcmp(f[i], "p50us") == 0)
+				pp->p50us = strtoul(v, 0, 10);
+			else if(strcmp(f[i], "p99us") == 0)
+				pp->p99us = strtoul(v, 0, 10);
+			else if(strcmp(f[i], "maxus") == 0)
+				pp->maxus = strtoul(v, 0, 10);
+		}
+	}
+	free(buf);
+}
+
+ulong
+handled(void)
+{
+	ulong n;
+	int k;
+
+	n = 0;
+	for(k = 0; k < npipes; k++)
+		n += pipes[k].events + pipes[k].dropped + pipes[k].malformed;
+	return n;
+}
+
+void
+report(char *name, long sent, long late, ulong events, ulong dropped, uvlong busyus,
+	ulong p50, ulong p99, ulong max, double s)
+{
+	print("pipebench %s sent=%ld late=%ld events=%lud dropped=%lud secs=%.3f eps=%.0f "
+		"busyms=%.1f epspercore=%.0f p50us=%lud p99us=%lud maxus=%lud\n",
+		name, sent, late, events, dropped, s, s > 0 ? events / s : 0,
+		busyus / 1000.0, busyus > 0 ? events * 1e6 / busyus : 0, p50, p99, max);
+}
+
+void
+main(int argc, char *argv[])
+{
+	char name[32];
+	long sent, late, total;
+	ulong last, events, dropped, p50, p99, max;
+	uvlong busy;
+	vlong end, quiet;
+	Pipe *pp;
+	int k, fd;
+
+	ARGBEGIN{
+	case 'p':
+		npipes = atoi(EARGF(usage()));
+		break;
+	case 'n':
+		size = atoi(EARGF(usage()));
+		break;
+	case 'i':
+		inputs = atoi(EARGF(usage()));
+		break;
+	case 'o':
+		outputs = atoi(EARGF(usage()));
+		break;
+	case 'r':
+		rate = atof(EARGF(usage()));
+		break;
+	case 't':
+		secs = atof(EARGF(usage()));
+		break;
+	case 'P':
+		baseport = atoi(EARGF(usage()));
+		break;
+	case 'h':
+		host = EARGF(usage());
+		break;
+	case 'S':
+		seed = strtoul(EARGF(usage()), 0, 0);
+		break;
+	case 'd':
+		dev = EARGF(usage());
+		break;
+	default:
+		usage();
+	}ARGEND
+	if(argc != 0 || npipes < 1 || npipes > Maxpipes || size < 1 || inputs < 1 ||
+	   inputs > Maxinputs || outputs < 1 || rate < 0 || secs <= 0)
+		usage();
+	if(host == nil && (host = getenv("sysname")) == nil)
+		sysfatal("no -h host and no $sysname");
+
+	for(k = 0; k < npipes; k++)
+		setup(k);
+
+	start = nsec();
+	for(k = 0; k < npipes; k++)
+		switch(rfork(RFPROC|RFMEM|RFFDG)){
+		case -1:
+			sysfatal("rfork: %r");
+		case 0:
+			sender(k);
+		}
+	for(k = 0; k < npipes; k++)
+		waitpid();
+	total = 0;
+	for(k = 0; k < npipes; k++)
+		total += pipes[k].sent;
+
+	/* until every packet is accounted for or the pipelines go quiet */
+	last = 0;
+	quiet = nsec();
+	for(;;){
+		readstats();
+		if(handled() >= total)
+			break;
+		if(handled() != last){
+			last = handled();
+			quiet = nsec();
+		}else if(nsec() - quiet > Quiet*1000000LL)
+			break;
+		sleep(50);
+	}
+	end = nsec() - start;
+
+	sent = late = 0;
+	events = dropped = p50 = p99 = max = 0;
+	busy = 0;
+	for(k = 0; k < npipes; k++){
+		pp = &pipes[k];
+		snprint(name, sizeof name, "pipe=%d", k);
+		report(name, pp->sent, pp->late, pp->events, pp->dropped, pp->busyus,
+			pp->p50us, pp->p99us, pp->maxus, end / 1e9);
+		sent += pp->sent;
+		late += pp->late;
+		events += pp->events;
+		dropped += pp->dropped;
+		busy += pp->busyus;
+		if(pp->p50us > p50)
+			p50 = pp->p50us;
+		if(pp->p99us > p99)
+			p99 = pp->p99us;
+		if(pp->maxus > max)
+			max = pp->maxus;
+	}
+	if(npipes > 1)
+		report("total", sent, late, events, dropped, busy, p50, p99, max, end / 1e9);
+
+	/* a stopped pipeline's ingest kproc leaves at its next datagram */
+	for(k = 0; k < npipes; k++){
+		pp = &pipes[k];
+		ctl("sensor-pipe %s stop", pp->esn);
+		fd = dialpipe(pp);
+		write(fd, "", 1);
+		close(fd);
+		close(pp->data);
+	}
+	exits(nil);
+}
@@ -0,0 +1,213 @@
+/*
+ * thwackbench - thwack compression ratio and speed benchmark
+ *
+ * Runs the kernel's own port/thwack.c and port/unthwack.c, built
+ * for user space, over a stream cut into packets the size devsdp
+ * sends.  The peer is lossless and acknowledges every packet before
+ * the next is sent, the best case for the sliding dictionary.  Each
+ * packet is decompressed and compared with its input, so a faster
+ * matcher that loses bytes fails here rather than on the wire.
+ *
+ * The input is the named files, one stream, or else sensor readings
+ * generated from a fixed seed.  Each hash chain depth given to -d
+ * prints one line of key=value fields, speeds in MB/s of input and
+ * the best of -r repetitions; depth 1 is the single probe per block
+ * thwack used before it kept chains:
+ *
+ *	thwackbench depth=8 bytes=2000000 packets=1429 raw=0 out=435446
+ *		ratio=0.218 compmbs=35.2 decompmbs=314.1 ok
+ */
+
+#include <u.h>
+#include <libc.h>
+#include "../../port/thwack.h"
+
+enum
+{
+	Maxlist	= 16,
+	Packet	= 1400,
+	Gensize	= 2000000,
+};
+
+int	depths[Maxlist] = { 1, 4, 8, 16 };
+int	ndepths = 4;
+int	nrep = 3;
+uchar	*in;
+long	nin;
+uchar	*out;
+int	*outlen;
+int	failed;
+
+void
+usage(void)
+{
+	fprint(2, "usage: thwackbench [-d depth,...] [-r reps] [file ...]\n");
+	exits("usage");
+}
+
+double
+mbs(long n, vlong ns)
+{
+	return ns > 0 ? n * 1e3 / ns : 0;
+}
+
+void
+readin(int argc, char *argv[])
+{
+	int i, fd;
+	long n;
+
+	for(i = 0; i < argc; i++){
+		if((fd = open(argv[i], OREAD)) < 0)
+			sysfatal("open %s: %r", argv[i]);
+		for(;;){
+			in = realloc(in, nin + 8192);
+			if(in == nil)
+				sysfatal("realloc: %r");
+			n = read(fd, in + nin, 8192);
+			if(n < 0)
+				sysfatal("read %s: %r", argv[i]);
+			if(n == 0)
+				break;
+			nin += n;
+		}
+		close(fd);
+	}
+}
+
+/* readings as the city's sensors report them */
+void
+generate(void)
+{
+	static char *domain[] = { "transportation", "energy", "environment", "governance" };
+	static char *unit[] = { "kmh", "kw", "ppm", "count" };
+	ulong x, t;
+	int d, v;
+	char *p, *e;
+
+	in = malloc(Gensize + 128);
+	if(in == nil)
+		sysfatal("malloc: %r");
+	p = (char*)in;
+	e = p + Gensize;
+	x = 1;
+	for(t = 1700000000; p < e; t++){
+		x = x * 1103515245 + 12345;
+		d = (x >> 16) % nelem(domain);
+		v = (x >> 8) % 1000;
+		p = seprint(p, e, "%s sensor=%lud t=%lud value=%d.%02d %s\n",
+			domain[d], (x >> 20) % 64, t, v / 10, v % 100, unit[d]);
+	}
+	nin = p - (char*)in;
+}
+
+void
+bench(int depth)
+{
+	Thwack *tw;
+	Unthwack *ut;
+	ulong stats[ThwStats], seq;
+	uchar buf[ThwMaxBlock];
+	long i, n, m, nout, nraw, rawbytes;
+	vlong t0, ns, best[2];
+	int r, k, npkt;
+
+	tw = malloc(sizeof *tw);
+	ut = malloc(sizeof *ut);
+	if(tw == nil || ut == nil)
+		sysfatal("malloc: %r");
+	best[0] = best[1] = -1;
+	npkt = (nin + Packet - 1) / Packet;
+	nout = nraw = rawbytes = 0;
+	for(r = 0; r < nrep; r++){
+		thwackinit(tw);
+		tw->depth = depth;
+		memset(stats, 0, sizeof stats);
+		t0 = nsec();
+		for(k = 0, i = 0; i < nin; k++, i += n){
+			n = nin - i;
+			if(n > Packet)
+				n = Packet;
+			seq = k + 1;
+			outlen[k] = thwack(tw, out + i, in + i, n, seq, stats);
+			if(outlen[k] >= 0)
+				thwackack(tw, seq, 0);
+		}
+		ns = nsec() - t0;
+		if(best[0] < 0 || ns < best[0])
+			best[0] = ns;
+
+		/* the peer never sees packets sent uncompressed */
+		unthwackinit(ut);
+		nout = nraw = rawbytes = 0;
+		t0 = nsec();
+		for(k = 0, i = 0; i < nin; k++, i += n){
+			n = nin - i;
+			if(n > Packet)
+				n = Packet;
+			if(outlen[k] < 0){
+				nraw++;
+				rawbytes += n;
+				nout += n;
+				continue;
+			}
+			m = unthwack(ut, buf, sizeof buf, out + i, outlen[k], k + 1);
+			if(m != n || memcmp(buf, in + i, n) != 0){
+				print("thwackbench depth=%d FAIL packet %d of %ld bytes came back as %ld\n",
+					depth, k, n, m);
+				failed = 1;
+				goto done;
+			}
+			nout += outlen[k];
+		}
+		ns = nsec() - t0;
+		if(best[1] < 0 || ns < best[1])
+			best[1] = ns;
+	}
+
+	print("thwackbench depth=%d bytes=%ld packets=%d raw=%ld out=%ld ratio=%.3f compmbs=%.1f decompmbs=%.1f ok\n",
+		depth, nin, npkt, nraw, nout, (double)nout / nin, mbs(nin, best[0]), mbs(nin - rawbytes, best[1]));
+done:
+	free(tw);
+	free(ut);
+}
+
+void
+main(int argc, char *argv[])
+{
+	char *f[Maxlist];
+	int i;
+
+	ARGBEGIN{
+	case 'd':
+		ndepths = getfields(EARGF(usage()), f, Maxlist, 1, ",");
+		if(ndepths < 1)
+			usage();
+		for(i = 0; i < ndepths; i++)
+			if((depths[i] = atoi(f[i])) < 1)
+				usage();
+		break;
+	case 'r':
+		nrep = atoi(EARGF(usage()));
+		break;
+	default:
+		usage();
+	}ARGEND
+	if(nrep < 1)
+		usage();
+
+	if(argc > 0)
+		readin(argc, argv);
+	else
+		generate();
+	if(nin < MinMatch)
+		sysfatal("too little input");
+	out = malloc(nin);
+	outlen = malloc(((nin + Packet - 1) / Packet) * sizeof outlen[0]);
+	if(out == nil || outlen == nil)
+		sysfatal("malloc: %r");
+
+	for(i = 0; i < ndepths && !failed; i++)
+		bench(depths[i]);
+	exits(failed ? "failed" : nil);
+}
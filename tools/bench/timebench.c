@@ -0,0 +1,116 @@
+/*
+ * timebench - cost and agreement of the ways to read the time
+ *
+ * Reads the time -n times through nsec(), which is a read of
+ * /dev/bintime, and through the kernel's time page (see
+ * port/timepage.h), and reports ns per read of each.  It then
+ * alternates the two and reports the largest gap between a page
+ * reading and the nsec() readings either side of it, which
+ * should be no more than the cost of a read.
+ *
+ *	timebench path=nsec reads=1000000 nsread=612.0
+ *	timebench path=page reads=1000000 nsread=14.2
+ *	timebench agree reads=100000 maxbeforens=0 maxafterns=0 ok
+ *
+ * Without a time page, or when the kernel says it can't be
+ * read directly, only the first line appears.
+ */
+
+#include <u.h>
+#include <libc.h>
+#include "../../port/timepage.h"
+
+long	nread = 1000000;
+Timepage	*tp;
+
+void
+usage(void)
+{
+	fprint(2, "usage: timebench [-n reads]\n");
+	exits("usage");
+}
+
+/* the middle 64 bits of a*b, as the kernel's mul64fract */
+uvlong
+mulfract(uvlong a, uvlong b)
+{
+	uvlong al, ah, bl, bh;
+
+	al = a & 0xffffffffULL;
+	ah = a >> 32;
+	bl = b & 0xffffffffULL;
+	bh = b >> 32;
+	return ((al*bl)>>32) + al*bh + ah*bl + ((ah*bh)<<32);
+}
+
+vlong
+pagensec(void)
+{
+	ulong seq;
+	uvlong ticks;
+	vlong ns;
+
+	do{
+		seq = tp->seq;
+		cycles(&ticks);
+		ns = tp->off + mulfract(ticks - tp->last, tp->multiplier);
+	}while((seq & 1) || seq != tp->seq);
+	return ns;
+}
+
+void
+bench(char *path, vlong (*get)(void))
+{
+	long i;
+	vlong t0, t1;
+
+	t0 = nsec();
+	for(i = 0; i < nread; i++)
+		get();
+	t1 = nsec();
+	print("timebench path=%s reads=%ld nsread=%.1f\n",
+		path, nread, (double)(t1 - t0) / nread);
+}
+
+void
+agree(void)
+{
+	long i, n;
+	vlong a, b, c, before, after;
+
+	n = nread / 10;
+	before = after = 0;
+	for(i = 0; i < n; i++){
+		a = nsec();
+		b = pagensec();
+		c = nsec();
+		if(a - b > before)
+			before = a - b;
+		if(b - c > after)
+			after = b - c;
+	}
+	print("timebench agree reads=%ld maxbeforens=%lld maxafterns=%lld %s\n",
+		n, before, after, before == 0 && after == 0 ? "ok" : "FAIL");
+}
+
+void
+main(int argc, char *argv[])
+{
+	ARGBEGIN{
+	case 'n':
+		nread = atol(EARGF(usage()));
+		break;
+	default:
+		usage();
+	}ARGEND
+	if(nread < 10 || argc != 0)
+		usage();
+
+	bench("nsec", nsec);
+	tp = segattach(0, "timepage", nil, sizeof(Timepage));
+	if(tp == (void*)-1 || !tp->direct)
+		exits(nil);
+	bench("page", pagensec);
+	agree();
+	exits(nil);
+}
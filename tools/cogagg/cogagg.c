@@ -0,0 +1,474 @@
+/*
+ * cogagg - serve the merged cognitive state of several cities
+ *
+ * Each peer is a directory holding a cognitive device, such as
+ * /proc/cognitive or an import of one, or the dial string of a
+ * machine exporting its own, as by
+ *
+ *	aux/listen1 -t 'tcp!*!17040' /bin/exportfs -r /proc/cognitive
+ *
+ * which is mounted on /n/cog.host in cogagg's own name space.
+ * Each peer's binmetrics snapshot is fetched at most once every
+ * -i milliseconds, when one of the files below is opened, and the
+ * merged state is served on -m (default /mnt/cogagg):
+ *
+ *	domains		each domain's nodes, mean load, channels and patterns
+ *	channels	each src-dst pair, summed over its channels and peers
+ *	nodes		each peer and how its last fetch went
+ *	ctl		"interval ms" or "refresh"
+ *
+ * A file's qid.vers moves only when a fetch changes what it says,
+ * so a client caching the mount sees unchanged files as unchanged.
+ * A peer that cannot be fetched drops out of the merge until it
+ * can; one that is mounted is remounted on its next fetch.
+ *
+ *	cogagg -i 2000 /proc/cognitive tcp!leeds!17040 tcp!york!17040
+ */
+
+#include <u.h>
+#include <libc.h>
+#include <auth.h>
+#include <fcall.h>
+#include <thread.h>
+#include <9p.h>
+
+/* binmetrics layout, as port/cognitive.h */
+enum {
+	CMversion	= 1,
+	CMnamelen	= 60,
+	CMnval		= 12,
+	CMrecsize	= 4+CMnamelen+CMnval*8,
+
+	CMhdr		= 0,
+	CMchannel,
+	CMswarm,
+	CMdomain,
+};
+
+/* channel values summed across channels; the rest are latencies, maxed */
+enum {
+	CVsummed	= 7,
+	CVres99		= 8,
+	CVe2e99		= 10,
+};
+
+enum {
+	Qdomains,
+	Qchannels,
+	Qnodes,
+	Qctl,
+	Nfile,
+};
+
+typedef struct Peer Peer;
+struct Peer {
+	char	*addr;		/* dial string, or nil for a directory */
+	char	*dir;		/* where its device is */
+	int	mounted;
+	uchar	*snap;		/* last binmetrics, or nil */
+	long	len;
+	vlong	fetched;	/* nsec of the last attempt */
+	long	oksec;		/* time of the last success */
+	char	err[ERRMAX];
+};
+
+typedef struct Agg Agg;
+struct Agg {
+	char	name[CMnamelen+1];
+	int	kind;
+	int	n;		/* records merged */
+	uvlong	val[CMnval];
+};
+
+Peer	*peers;
+int	npeers;
+long	interval = 1000;
+File	*files[Nfile];
+char	*text[Nfile];	/* as of the last merge */
+Agg	*aggs;
+ulong	naggs;		/* slots, a power of two */
+ulong	nagg;
+
+void
+usage(void)
+{
+	fprint(2, "usage: cogagg [-i ms] [-m mtpt] [-s srvname] peer...\n");
+	exits("usage");
+}
+
+uvlong
+get64(uchar *p)
+{
+	return (uvlong)p[0] | (uvlong)p[1]<<8 | (uvlong)p[2]<<16 | (uvlong)p[3]<<24 |
+		(uvlong)p[4]<<32 | (uvlong)p[5]<<40 | (uvlong)p[6]<<48 | (uvlong)p[7]<<56;
+}
+
+ulong
+agghash(int kind, char *name)
+{
+	ulong h;
+
+	h = kind;
+	while(*name)
+		h = h*31 + *name++;
+	return h;
+}
+
+Agg*
+agglookup(int kind, char *name)
+{
+	Agg *a, *old;
+	ulong i, n;
+
+	if(2*(nagg+1) > naggs){
+		old = aggs;
+		n = naggs;
+		naggs = naggs ? 2*naggs : 1024;
+		aggs = emalloc9p(naggs * sizeof(Agg));
+		memset(aggs, 0, naggs * sizeof(Agg));
+		nagg = 0;
+		for(i = 0; i < n; i++)
+			if(old[i].name[0] != 0){
+				a = agglookup(old[i].kind, old[i].name);
+				*a = old[i];
+			}
+		free(old);
+	}
+	for(i = agghash(kind, name) & (naggs-1);; i = (i+1) & (naggs-1)){
+		a = &aggs[i];
+		if(a->name[0] == 0){
+			strecpy(a->name, a->name+sizeof a->name, name);
+			a->kind = kind;
+			nagg++;
+			return a;
+		}
+		if(a->kind == kind && strcmp(a->name, name) == 0)
+			return a;
+	}
+}
+
+int
+aggcmp(void *a, void *b)
+{
+	return strcmp((*(Agg**)a)->name, (*(Agg**)b)->name);
+}
+
+/* channel ids are src-dst-time; channels between one pair merge */
+void
+pairname(char *name)
+{
+	char *p;
+
+	p = strrchr(name, '-');
+	if(p == nil || p[1] == 0)
+		return;
+	if(strspn(p+1, "0123456789") == strlen(p+1))
+		*p = 0;
+}
+
+/* mount p if it needs it and read its snapshot, which the kernel renders at open */
+int
+fetch(Peer *p)
+{
+	char path[256];
+	uchar *buf;
+	long n, m, k;
+	int fd;
+
+	if(p->addr != nil && !p->mounted){
+		if((fd = dial(p->addr, nil, nil, nil)) < 0)
+			return -1;
+		if(amount(fd, p->dir, MREPL, "") < 0){
+			close(fd);
+			return -1;
+		}
+		close(fd);
+		p->mounted = 1;
+	}
+	snprint(path, sizeof path, "%s/binmetrics", p->dir);
+	buf = nil;
+	n = m = 0;
+	if((fd = open(path, OREAD)) >= 0){
+		for(;;){
+			if(n == m){
+				m = m ? 2*m : 64*CMrecsize;
+				buf = erealloc9p(buf, m);
+			}
+			if((k = read(fd, buf+n, m-n)) <= 0)
+				break;
+			n += k;
+		}
+		close(fd);
+	}
+	if(fd < 0 || k < 0 || n < CMrecsize || buf[0] != CMversion || buf[1] != CMhdr){
+		if(fd >= 0 && k == 0)
+			werrstr("bad binmetrics");
+		free(buf);
+		if(p->mounted){
+			unmount(nil, p->dir);
+			p->mounted = 0;
+		}
+		return -1;
+	}
+	free(p->snap);
+	p->snap = buf;
+	p->len = n;
+	return 0;
+}
+
+/* replace the text of file q, moving its version if it changed */
+void
+settext(int q, char *s)
+{
+	if(text[q] != nil && strcmp(text[q], s) == 0){
+		free(s);
+		return;
+	}
+	free(text[q]);
+	text[q] = s;
+	files[q]->qid.vers++;
+	files[q]->length = strlen(s);
+}
+
+void
+merge(void)
+{
+	char name[CMnamelen+1];
+	uchar *r, *e;
+	uvlong v;
+	Agg *a, **sorted;
+	Peer *p;
+	Fmt dom, chan, node;
+	ulong i, n;
+	int j, kind;
+
+	memset(aggs, 0, naggs * sizeof(Agg));
+	nagg = 0;
+	for(p = peers; p < peers+npeers; p++){
+		if(p->snap == nil)
+			continue;
+		e = p->snap + p->len - p->len % CMrecsize;
+		for(r = p->snap + CMrecsize; r < e; r += CMrecsize){
+			kind = r[1];
+			if(r[0] != CMversion || (kind != CMchannel && kind != CMdomain))
+				continue;
+			memmove(name, r+4, CMnamelen);
+			name[CMnamelen] = 0;
+			if(name[0] == 0)
+				continue;
+			if(kind == CMchannel)
+				pairname(name);
+			a = agglookup(kind, name);
+			a->n++;
+			for(j = 0; j < CMnval; j++){
+				v = get64(r+4+CMnamelen+j*8);
+				if(kind == CMdomain || j < CVsummed)
+					a->val[j] += v;
+				else if(v > a->val[j])
+					a->val[j] = v;
+			}
+		}
+	}
+
+	sorted = emalloc9p((nagg+1) * sizeof(Agg*));
+	n = 0;
+	for(i = 0; i < naggs; i++)
+		if(aggs[i].name[0] != 0)
+			sorted[n++] = &aggs[i];
+	qsort(sorted, n, sizeof(Agg*), aggcmp);
+	fmtstrinit(&dom);
+	fmtstrinit(&chan);
+	for(i = 0; i < n; i++){
+		a = sorted[i];
+		if(a->kind == CMdomain)
+			fmtprint(&dom, "%s nodes=%d load=%llud channels=%llud patterns=%llud\n",
+				a->name, a->n, a->val[0]/a->n, a->val[1], a->val[2]);
+		else
+			fmtprint(&chan, "%s channels=%d window=%llud load=%llud enqueued=%llud "
+				"dequeued=%llud dropped=%llud res99=%llud e2e99=%llud\n",
+				a->name, a->n, a->val[0], a->val[1], a->val[2], a->val[3],
+				a->val[4], a->val[CVres99], a->val[CVe2e99]);
+	}
+	free(sorted);
+	settext(Qdomains, fmtstrflush(&dom));
+	settext(Qchannels, fmtstrflush(&chan));
+
+	fmtstrinit(&node);
+	for(p = peers; p < peers+npeers; p++)
+		if(p->err[0] == 0)
+			fmtprint(&node, "%s ok fetched=%ld\n", p->dir, p->oksec);
+		else
+			fmtprint(&node, "%s error fetched=%ld %s\n", p->dir, p->oksec, p->err);
+	settext(Qnodes, fmtstrflush(&node));
+}
+
+/* fetch the peers not fetched for an interval, or all of them */
+void
+refresh(int all)
+{
+	vlong now;
+	Peer *p;
+	int fetched;
+
+	now = nsec();
+	fetched = 0;
+	for(p = peers; p < peers+npeers; p++){
+		if(!all && p->fetched != 0 && now - p->fetched < interval*1000000LL)
+			continue;
+		p->fetched = now;
+		if(fetch(p) < 0){
+			rerrstr(p->err, sizeof p->err);
+			free(p->snap);
+			p->snap = nil;
+			p->len = 0;
+		}else{
+			p->err[0] = 0;
+			p->oksec = time(0);
+		}
+		fetched = 1;
+	}
+	if(fetched)
+		merge();
+}
+
+int
+ftype(Fid *fid)
+{
+	return (int)(uintptr)fid->file->aux;
+}
+
+void
+fsopen(Req *r)
+{
+	int q;
+
+	q = ftype(r->fid);
+	if(q != Qctl){
+		if((r->ifcall.mode&3) != OREAD){
+			respond(r, "permission denied");
+			return;
+		}
+		refresh(0);
+		r->fid->aux = estrdup9p(text[q]);
+		r->ofcall.qid = r->fid->file->qid;
+	}
+	respond(r, nil);
+}
+
+void
+fsread(Req *r)
+{
+	char buf[64];
+
+	if(ftype(r->fid) == Qctl){
+		snprint(buf, sizeof buf, "interval %ld\n", interval);
+		readstr(r, buf);
+	}else
+		readstr(r, r->fid->aux);
+	respond(r, nil);
+}
+
+void
+fswrite(Req *r)
+{
+	char *s, *f[3];
+	int n;
+
+	if(ftype(r->fid) != Qctl){
+		respond(r, "permission denied");
+		return;
+	}
+	s = emalloc9p(r->ifcall.count+1);
+	memmove(s, r->ifcall.data, r->ifcall.count);
+	s[r->ifcall.count] = 0;
+	n = tokenize(s, f, nelem(f));
+	if(n == 2 && strcmp(f[0], "interval") == 0 && atol(f[1]) >= 0)
+		interval = atol(f[1]);
+	else if(n == 1 && strcmp(f[0], "refresh") == 0)
+		refresh(1);
+	else{
+		free(s);
+		respond(r, "bad ctl message");
+		return;
+	}
+	free(s);
+	r->ofcall.count = r->ifcall.count;
+	respond(r, nil);
+}
+
+void
+fsdestroyfid(Fid *fid)
+{
+	free(fid->aux);
+}
+
+Srv fs = {
+	.open=		fsopen,
+	.read=		fsread,
+	.write=		fswrite,
+	.destroyfid=	fsdestroyfid,
+};
+
+char *filenames[Nfile] = {
+	[Qdomains]	"domains",
+	[Qchannels]	"channels",
+	[Qnodes]	"nodes",
+	[Qctl]		"ctl",
+};
+
+void
+main(int argc, char *argv[])
+{
+	char *mtpt, *srvname, *f[3], *s;
+	int i, q;
+	Peer *p;
+
+	mtpt = "/mnt/cogagg";
+	srvname = nil;
+	ARGBEGIN{
+	case 'i':
+		interval = atol(EARGF(usage()));
+		break;
+	case 'm':
+		mtpt = EARGF(usage());
+		break;
+	case 's':
+		srvname = EARGF(usage());
+		break;
+	default:
+		usage();
+	}ARGEND
+	if(argc == 0 || interval < 0)
+		usage();
+
+	npeers = argc;
+	peers = emalloc9p(npeers * sizeof(Peer));
+	memset(peers, 0, npeers * sizeof(Peer));
+	for(i = 0; i < argc; i++){
+		p = &peers[i];
+		strecpy(p->err, p->err+sizeof p->err, "not fetched");
+		if(strchr(argv[i], '!') == nil){
+			p->dir = argv[i];
+			continue;
+		}
+		p->addr = argv[i];
+		s = estrdup9p(argv[i]);
+		if(getfields(s, f, nelem(f), 0, "!") < 2)
+			sysfatal("bad dial string %s", argv[i]);
+		p->dir = smprint("/n/cog.%s", f[1]);
+		free(s);
+	}
+
+	fs.tree = alloctree(nil, nil, DMDIR|0555, nil);
+	for(q = 0; q < Nfile; q++){
+		files[q] = createfile(fs.tree->root, filenames[q], nil,
+			q == Qctl ? 0664 : 0444, (void*)(uintptr)q);
+		if(files[q] == nil)
+			sysfatal("createfile %s: %r", filenames[q]);
+	}
+	naggs = 1024;
+	aggs = emalloc9p(naggs * sizeof(Agg));
+	merge();
+	postmountsrv(&fs, srvname, mtpt, MREPL);
+	exits(nil);
+}
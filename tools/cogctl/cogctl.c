@@ -11,6 +11,7 @@
 
 #include <u.h>
 #include <libc.h>
+#include <bio.h>
 
 typedef struct CogCmd CogCmd;
 struct CogCmd {
@@ -28,6 +29,8 @@ void cmd_swarm_status(int argc, char *argv[]);
 void cmd_detect_emergence(int argc, char *argv[]);
 void cmd_adapt_namespace(int argc, char *argv[]);
 void cmd_stats(int argc, char *argv[]);
+void cmd_batch(int argc, char *argv[]);
+void batch(char *file);
 void cmd_help(int argc, char *argv[]);
 /* Rooted shell commands */
 void cmd_rooted_create(int argc, char *argv[]);
@@ -45,6 +48,7 @@ CogCmd commands[] = {
 	{"detect-emergence", "cogctl detect-emergence [domain] [threshold]", cmd_detect_emergence},
 	{"adapt-namespace", "cogctl adapt-namespace <domain> [auto|manual]", cmd_adapt_namespace},
 	{"stats", "cogctl stats [domain]", cmd_stats},
+	{"batch", "cogctl batch [file]   (or cogctl -f file)", cmd_batch},
 	{"rooted-create", "cogctl rooted-create <domain> <parens>", cmd_rooted_create},
 	{"rooted-enumerate", "cogctl rooted-enumerate <domain> <max_size>", cmd_rooted_enumerate},
 	{"rooted-list", "cogctl rooted-list", cmd_rooted_list},
@@ -60,6 +64,7 @@ usage(void)
 	CogCmd *cmd;
 	
 	fprint(2, "usage: cogctl <command> [args...]\n");
+	fprint(2, "       cogctl -f script\n");
 	fprint(2, "\nCognitive Cities Control Utility\n");
 	fprint(2, "\ncommands:\n");
 	for(cmd = commands; cmd->name; cmd++){
@@ -72,12 +77,22 @@ void
 main(int argc, char *argv[])
 {
 	CogCmd *cmd;
+	char *script;
 	
+	script = nil;
 	ARGBEGIN{
+	case 'f':
+		script = EARGF(usage());
+		break;
 	default:
 		usage();
 	}ARGEND
 	
+	if(script != nil){
+		if(argc != 0)
+			usage();
+		batch(script);
+	}
 	if(argc < 1)
 		usage();
 		
@@ -93,6 +108,128 @@ main(int argc, char *argv[])
 	exits("unknown command");
 }
 
+/*
+ * Send a file of ctl commands, one per line, holding ctl open.
+ * Lines are packed into writes of up to Maxbatch bytes, the
+ * kernel's limit, each split at a line boundary, and the kernel's
+ * per-line results for each write are printed with their line
+ * numbers in the file.  Only a script over Maxbatch costs more
+ * than one write.
+ */
+enum {
+	Maxbatch	= 64*1024,	/* Maxctl in devcognitive.c */
+};
+
+int	batchline;	/* script lines before the current write */
+int	batcherrs;
+
+/* write one batch and print its results; lines is how many it holds */
+void
+batchflush(int fd, char *buf, int n, int lines)
+{
+	char *res, *p, *q, err[ERRMAX];
+	long m, k, len;
+	
+	if(n == 0)
+		return;
+	/* failed commands are reported in the results; anything else fails the lot */
+	if(write(fd, buf, n) < 0){
+		rerrstr(err, sizeof err);
+		if(strstr(err, "commands failed") == nil){
+			fprint(2, "cogctl: lines %d-%d: %s\n", batchline+1, batchline+lines, err);
+			batcherrs += lines;
+			batchline += lines;
+			return;
+		}
+	}
+	len = 8192;
+	res = malloc(len);
+	m = 0;
+	while(res != nil && (k = pread(fd, res+m, len-1-m, m)) > 0){
+		m += k;
+		if(m == len-1)
+			res = realloc(res, len *= 2);
+	}
+	if(res == nil)
+		sysfatal("malloc: %r");
+	res[m] = 0;
+	for(p = res; *p != 0; p = q){
+		if((q = strchr(p, '\n')) != nil)
+			*q++ = 0;
+		else
+			q = p + strlen(p);
+		k = strtol(p, &p, 10);
+		if(strcmp(p, " ok") != 0)
+			batcherrs++;
+		print("%ld%s\n", batchline + k, p);
+	}
+	free(res);
+	batchline += lines;
+}
+
+void
+batch(char *file)
+{
+	int fd, in, n, nline;
+	char *buf, *line;
+	Biobuf bin;
+	long len;
+	
+	in = 0;
+	if(file != nil && strcmp(file, "-") != 0){
+		in = open(file, OREAD);
+		if(in < 0){
+			fprint(2, "cogctl: cannot open %s: %r\n", file);
+			exits("open");
+		}
+	}
+	Binit(&bin, in, OREAD);
+	
+	fd = open("/proc/cognitive/ctl", ORDWR);
+	if(fd < 0){
+		fprint(2, "cogctl: cannot open /proc/cognitive/ctl: %r\n");
+		exits("open");
+	}
+	
+	buf = malloc(Maxbatch);
+	if(buf == nil)
+		sysfatal("malloc: %r");
+	n = 0;
+	nline = 0;
+	while((line = Brdstr(&bin, '\n', 0)) != nil){
+		len = strlen(line);
+		if(len >= Maxbatch){
+			batchflush(fd, buf, n, nline);
+			n = nline = 0;
+			print("%d command longer than %d bytes\n", ++batchline, Maxbatch);
+			batcherrs++;
+			free(line);
+			continue;
+		}
+		if(n + len + 1 > Maxbatch){
+			batchflush(fd, buf, n, nline);
+			n = nline = 0;
+		}
+		memmove(buf+n, line, len);
+		n += len;
+		if(len == 0 || buf[n-1] != '\n')
+			buf[n++] = '\n';
+		nline++;
+		free(line);
+	}
+	batchflush(fd, buf, n, nline);
+	
+	close(fd);
+	Bterm(&bin);
+	exits(batcherrs ? "errors" : nil);
+}
+
+void
+cmd_batch(int argc, char *argv[])
+{
+	batch(argc >= 2 ? argv[1] : nil);
+}
+
 void
 cmd_help(int argc, char *argv[])
 {
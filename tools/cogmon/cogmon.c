@@ -11,7 +11,7 @@
 #include <u.h>
 #include <libc.h>
 
-void monitor_live(void);
+void monitor_live(char *domain, long ms);
 void display_metrics(char *domain);
 void monitor_channels(void);
 void usage(void);
@@ -19,10 +19,11 @@ void usage(void);
 void
 usage(void)
 {
-	fprint(2, "usage: cogmon [-l] [-d domain] [-c] [-m]\n");
+	fprint(2, "usage: cogmon [-l] [-i ms] [-d domain] [-c] [-m]\n");
 	fprint(2, "\nCognitive Cities Monitoring Tool\n");
 	fprint(2, "\noptions:\n");
 	fprint(2, "  -l        live monitoring mode\n");
+	fprint(2, "  -i ms     live update interval (default 1000)\n");
 	fprint(2, "  -d domain monitor specific domain\n");
 	fprint(2, "  -c        monitor neural channels\n");
 	fprint(2, "  -m        display metrics\n");
@@ -35,12 +36,16 @@ main(int argc, char *argv[])
 	int live_mode = 0;
 	int channel_mode = 0;
 	int metrics_mode = 0;
+	long interval = 1000;
 	char *domain = "all";
 	
 	ARGBEGIN{
 	case 'l':
 		live_mode = 1;
 		break;
+	case 'i':
+		interval = atol(EARGF(usage()));
+		break;
 	case 'd':
 		domain = EARGF(usage());
 		break;
@@ -59,7 +64,7 @@ main(int argc, char *argv[])
 		print("=============================\n");
 		print("Domain: %s\n", domain);
 		print("Press Ctrl+C to exit\n\n");
-		monitor_live();
+		monitor_live(domain, interval > 0 ? interval : 1000);
 	}
 	else if(channel_mode){
 		monitor_channels();
@@ -75,33 +80,251 @@ main(int argc, char *argv[])
 	exits(nil);
 }
 
-void
-monitor_live(void)
+/*
+ * Live mode.  A child process copies the events file to the screen
+ * as the kernel reports them, each read blocking until there is
+ * something to say.  The parent takes a binmetrics snapshot every
+ * interval, turns the channel and swarm counters into per-second
+ * rates, and prints only the rows that render differently from
+ * last time, so an idle channel costs one record compare per tick.
+ */
+
+/* binmetrics layout, as port/cognitive.h */
+enum {
+	CMversion	= 1,
+	CMnamelen	= 60,
+	CMnval		= 12,
+	CMrecsize	= 4+CMnamelen+CMnval*8,
+
+	CMhdr		= 0,
+	CMchannel,
+	CMswarm,
+	CMdomain,
+};
+
+typedef struct Row Row;
+struct Row {
+	char	name[CMnamelen];
+	int	kind;
+	uvlong	val[CMnval];
+	char	*line;		/* as last printed */
+	ulong	tick;		/* last snapshot it was in */
+};
+
+Row	*rows;
+ulong	nrows;		/* slots, a power of two */
+ulong	nused;
+
+uvlong
+get64(uchar *p)
+{
+	return (uvlong)p[0] | (uvlong)p[1]<<8 | (uvlong)p[2]<<16 | (uvlong)p[3]<<24 |
+		(uvlong)p[4]<<32 | (uvlong)p[5]<<40 | (uvlong)p[6]<<48 | (uvlong)p[7]<<56;
+}
+
+ulong
+rowhash(int kind, char *name)
+{
+	ulong h;
+
+	h = kind;
+	while(*name)
+		h = h*31 + *name++;
+	return h;
+}
+
+Row*
+rowlookup(int kind, char *name)
 {
+	Row *r, *old;
+	ulong i, n;
+
+	if(2*(nused+1) > nrows){
+		old = rows;
+		n = nrows;
+		nrows = nrows ? 2*nrows : 1024;
+		rows = mallocz(nrows * sizeof(Row), 1);
+		if(rows == nil)
+			sysfatal("malloc: %r");
+		nused = 0;
+		for(i = 0; i < n; i++)
+			if(old[i].name[0] != 0){
+				r = rowlookup(old[i].kind, old[i].name);
+				*r = old[i];
+			}
+		free(old);
+	}
+	for(i = rowhash(kind, name) & (nrows-1);; i = (i+1) & (nrows-1)){
+		r = &rows[i];
+		if(r->name[0] == 0){
+			strecpy(r->name, r->name+CMnamelen, name);
+			r->kind = kind;
+			nused++;
+			return r;
+		}
+		if(r->kind == kind && strcmp(r->name, name) == 0)
+			return r;
+	}
+}
+
+/* the whole snapshot; the kernel renders it when the file is opened */
+uchar*
+snapshot(long *len)
+{
+	uchar *buf;
+	long n, m, k;
 	int fd;
-	char buf[4096];
-	int n;
-	
-	fd = open("/proc/cognitive/monitor", OREAD);
+
+	fd = open("/proc/cognitive/binmetrics", OREAD);
+	if(fd < 0)
+		return nil;
+	buf = nil;
+	n = m = 0;
+	for(;;){
+		if(n == m){
+			m = m ? 2*m : 64*CMrecsize;
+			buf = realloc(buf, m);
+			if(buf == nil)
+				sysfatal("malloc: %r");
+		}
+		if((k = read(fd, buf+n, m-n)) <= 0)
+			break;
+		n += k;
+	}
+	close(fd);
+	*len = n;
+	return buf;
+}
+
+double
+rate(uvlong now, uvlong then, double secs)
+{
+	if(secs <= 0 || now < then)
+		return 0;
+	return (now - then) / secs;
+}
+
+/* render one record against its previous values; nil if it is filtered out */
+char*
+render(Row *r, uvlong *v, double secs, char *domain)
+{
+	uvlong *o;
+
+	if(strcmp(domain, "all") != 0 && strstr(r->name, domain) == nil)
+		return nil;
+	o = r->val;
+	switch(r->kind){
+	case CMchannel:
+		return smprint("chan %-40s win %5llud load %5llud enq/s %8.0f deq/s %8.0f drop/s %6.0f "
+			"res99 %lludus e2e99 %lludus",
+			r->name, v[0], v[1], rate(v[2], o[2], secs), rate(v[3], o[3], secs),
+			rate(v[4], o[4], secs), v[8], v[10]);
+	case CMswarm:
+		return smprint("swarm %-39s agents %3llud coherence %4llud enq/s %8.0f deq/s %8.0f drop/s %6.0f",
+			r->name, v[0], v[1], rate(v[2], o[2], secs), rate(v[3], o[3], secs),
+			rate(v[4], o[4], secs));
+	case CMdomain:
+		return smprint("domain %-38s load %5llud channels %4llud patterns %4llud",
+			r->name, v[0], v[1], v[2]);
+	}
+	return nil;
+}
+
+void
+events(void)
+{
+	char buf[8192];
+	int fd, n;
+
+	fd = open("/proc/cognitive/events", OREAD);
 	if(fd < 0){
-		fprint(2, "cogmon: cannot open /proc/cognitive/monitor: %r\n");
+		fprint(2, "cogmon: cannot open /proc/cognitive/events: %r\n");
 		exits("open");
 	}
-	
-	/* Continuous monitoring loop */
-	while((n = read(fd, buf, sizeof buf)) > 0){
+	/* Each read blocks until the kernel has new events */
+	while((n = read(fd, buf, sizeof buf - 1)) > 0){
 		buf[n] = 0;
 		print("%s", buf);
-		
-		/* Check for emergence alerts */
-		if(strstr(buf, "EMERGENCE")){
+		if(strstr(buf, " emergence "))
 			print("\n🚨 EMERGENCE ALERT DETECTED 🚨\n\n");
-		}
-		
-		sleep(1000); /* Update every second */
 	}
-	
 	close(fd);
+	exits(nil);
+}
+
+void
+monitor_live(char *domain, long ms)
+{
+	char name[CMnamelen+1], *line;
+	uchar *buf, *p, *e;
+	uvlong v[CMnval], now, last;
+	double secs;
+	ulong tick, i;
+	long len;
+	int j, kind, changed;
+	Row *r;
+
+	switch(rfork(RFPROC|RFFDG|RFMEM|RFNOWAIT)){
+	case -1:
+		sysfatal("rfork: %r");
+	case 0:
+		events();
+	}
+
+	last = 0;
+	for(tick = 1;; tick++){
+		buf = snapshot(&len);
+		if(buf == nil || len < CMrecsize || buf[0] != CMversion || buf[1] != CMhdr){
+			fprint(2, "cogmon: cannot read /proc/cognitive/binmetrics: %r\n");
+			exits("binmetrics");
+		}
+		now = get64(buf+4+CMnamelen+8);
+		secs = last != 0 ? (now - last) / 1e6 : 0;
+		last = now;
+
+		changed = 0;
+		e = buf + len - len % CMrecsize;
+		for(p = buf + CMrecsize; p < e; p += CMrecsize){
+			kind = p[1];
+			if(p[0] != CMversion || kind == CMhdr)
+				continue;
+			memmove(name, p+4, CMnamelen);
+			name[CMnamelen] = 0;
+			if(name[0] == 0)
+				continue;
+			for(j = 0; j < CMnval; j++)
+				v[j] = get64(p+4+CMnamelen+j*8);
+			r = rowlookup(kind, name);
+			r->tick = tick;
+			line = render(r, v, secs, domain);
+			memmove(r->val, v, sizeof v);
+			if(line == nil)
+				continue;
+			if(r->line != nil && strcmp(r->line, line) == 0){
+				free(line);
+				continue;
+			}
+			print("%s\n", line);
+			free(r->line);
+			r->line = line;
+			changed++;
+		}
+		free(buf);
+
+		/* rows the kernel no longer reports */
+		for(i = 0; i < nrows; i++){
+			r = &rows[i];
+			if(r->name[0] == 0 || r->tick == tick || r->line == nil)
+				continue;
+			print("gone %s\n", r->name);
+			free(r->line);
+			r->line = nil;
+			changed++;
+		}
+		if(changed)
+			print("-- %lud rows, %d changed\n", nused, changed);
+		sleep(ms);
+	}
 }
 
 void
@@ -134,9 +357,9 @@ monitor_channels(void)
 	char buf[8192];
 	int n;
 	
-	fd = open("/proc/cognitive/channels", OREAD);
+	fd = open("/proc/cognitive/channels/list", OREAD);
 	if(fd < 0){
-		fprint(2, "cogmon: cannot open /proc/cognitive/channels: %r\n");
+		fprint(2, "cogmon: cannot open /proc/cognitive/channels/list: %r\n");
 		exits("open");
 	}
 	
@@ -3,162 +3,16 @@
  * 
  * Comprehensive tests for the Matula number encoding/decoding implementation.
  * Tests edge cases, roundtrip conversion, and mathematical properties.
+ * 
+ * The code under test is the kernel's own port/matula.c, built for
+ * user space with -DMATULAUSER.
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <assert.h>
-
-// Prime number table
-static unsigned long long primes[] = {
-    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71,
-    73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131, 137, 139, 149, 151,
-    157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223, 227, 229
-};
-#define NPRIMES (sizeof(primes)/sizeof(primes[0]))
+#include <u.h>
+#include <libc.h>
+#include "../../port/matula.h"
 
-static unsigned long long
-nth_prime(int n)
-{
-    if (n < 1 || n > NPRIMES)
-        return 0;
-    return primes[n - 1];
-}
-
-static void
-factorize(unsigned long long n, int *exponents, int max_primes)
-{
-    for (int i = 0; i < max_primes; i++)
-        exponents[i] = 0;
-    
-    for (int i = 0; i < NPRIMES && i < max_primes && n > 1; i++) {
-        while (n % primes[i] == 0) {
-            exponents[i]++;
-            n /= primes[i];
-        }
-    }
-}
-
-static int
-parse_children(char *parens, char ***children_out)
-{
-    if (parens == NULL || parens[0] == '\0')
-        return 0;
-    
-    char *p = parens;
-    if (*p == '(')
-        p++;
-    
-    int child_count = 0;
-    int depth = 0;
-    int child_start = -1;
-    
-    int max_children = strlen(parens) / 2;
-    char **children = malloc(max_children * sizeof(char*));
-    if (children == NULL)
-        return 0;
-    
-    for (int i = 0; p[i] != '\0'; i++) {
-        if (p[i] == '(') {
-            if (depth == 0)
-                child_start = i;
-            depth++;
-        } else if (p[i] == ')') {
-            depth--;
-            if (depth == 0 && child_start >= 0) {
-                int child_len = i - child_start + 1;
-                children[child_count] = malloc(child_len + 1);
-                if (children[child_count] != NULL) {
-                    memcpy(children[child_count], p + child_start, child_len);
-                    children[child_count][child_len] = '\0';
-                    child_count++;
-                }
-                child_start = -1;
-            }
-        }
-    }
-    
-    *children_out = children;
-    return child_count;
-}
-
-static unsigned long long
-parens_to_matula(char *parens)
-{
-    if (parens == NULL || parens[0] == '\0')
-        return 1;
-    
-    if (strcmp(parens, "()") == 0)
-        return 1;
-    
-    char **children = NULL;
-    int child_count = parse_children(parens, &children);
-    
-    if (child_count == 0)
-        return 1;
-    
-    unsigned long long result = 1;
-    for (int i = 0; i < child_count; i++) {
-        unsigned long long child_matula = parens_to_matula(children[i]);
-        unsigned long long prime = nth_prime(child_matula);
-        
-        if (prime == 0) {
-            result = 0;
-            break;
-        }
-        
-        result *= prime;
-        if (result == 0)
-            break;
-    }
-    
-    for (int i = 0; i < child_count; i++)
-        free(children[i]);
-    free(children);
-    
-    return result;
-}
-
-static char*
-matula_to_parens(unsigned long long matula)
-{
-    if (matula == 1) {
-        char *result = malloc(3);
-        if (result != NULL)
-            strcpy(result, "()");
-        return result;
-    }
-    
-    int exponents[NPRIMES];
-    factorize(matula, exponents, NPRIMES);
-    
-    char *result = malloc(4096);
-    if (result == NULL)
-        return NULL;
-    
-    result[0] = '(';
-    int pos = 1;
-    
-    for (int i = 0; i < NPRIMES && pos < 4090; i++) {
-        for (int j = 0; j < exponents[i] && pos < 4090; j++) {
-            char *child = matula_to_parens(i + 1);
-            if (child != NULL) {
-                int child_len = strlen(child);
-                if (pos + child_len < 4090) {
-                    strcpy(result + pos, child);
-                    pos += child_len;
-                }
-                free(child);
-            }
-        }
-    }
-    
-    result[pos++] = ')';
-    result[pos] = '\0';
-    
-    return result;
-}
+#define NPRIMES 100
 
 // Test helper
 static int test_count = 0;
@@ -166,16 +20,16 @@ static int test_passed = 0;
 static int test_failed = 0;
 
 #define TEST(name) \
-    printf("\n  Test %d: %s\n", ++test_count, name);
+    print("\n  Test %d: %s\n", ++test_count, name);
 
 #define ASSERT_EQ(actual, expected, msg) \
     do { \
         if ((actual) == (expected)) { \
-            printf("    ✓ %s\n", msg); \
+            print("    ✓ %s\n", msg); \
             test_passed++; \
         } else { \
-            printf("    ✗ %s (expected %llu, got %llu)\n", msg, \
-                   (unsigned long long)(expected), (unsigned long long)(actual)); \
+            print("    ✗ %s (expected %llud, got %llud)\n", msg, \
+                   (uvlong)(expected), (uvlong)(actual)); \
             test_failed++; \
         } \
     } while(0)
@@ -183,10 +37,10 @@ static int test_failed = 0;
 #define ASSERT_STR_EQ(actual, expected, msg) \
     do { \
         if (strcmp((actual), (expected)) == 0) { \
-            printf("    ✓ %s\n", msg); \
+            print("    ✓ %s\n", msg); \
             test_passed++; \
         } else { \
-            printf("    ✗ %s (expected '%s', got '%s')\n", msg, expected, actual); \
+            print("    ✗ %s (expected '%s', got '%s')\n", msg, expected, actual); \
             test_failed++; \
         } \
     } while(0)
@@ -221,14 +75,14 @@ void test_composite_encoding()
     ASSERT_EQ(parens_to_matula("(()())"), 4, "2^2 = two leaf children");
     
     // 6 = 2 × 3 (two children: () and (()))
-    unsigned long long m6 = parens_to_matula("(()(()))");
+    uvlong m6 = parens_to_matula("(()(()))");
     ASSERT_EQ(m6, 6, "2 × 3 = children with Matula 1 and 2");
     
     // 8 = 2^3 (three leaf children)
     ASSERT_EQ(parens_to_matula("(()()())"), 8, "2^3 = three leaf children");
     
     // 9 = 3^2 (two children, both (()))
-    unsigned long long m9 = parens_to_matula("((())(()))");
+    uvlong m9 = parens_to_matula("((())(()))");
     ASSERT_EQ(m9, 9, "3^2 = two depth-3 children");
 }
 
@@ -259,7 +113,7 @@ void test_roundtrip()
     
     struct {
         char *parens;
-        unsigned long long expected_matula;
+        uvlong expected_matula;
     } tests[] = {
         {"()", 1},
         {"(())", 2},
@@ -271,14 +125,14 @@ void test_roundtrip()
     
     for (int i = 0; i < sizeof(tests)/sizeof(tests[0]); i++) {
         // Encode
-        unsigned long long matula = parens_to_matula(tests[i].parens);
+        uvlong matula = parens_to_matula(tests[i].parens);
         ASSERT_EQ(matula, tests[i].expected_matula, "Encode matches expected");
         
         // Decode
         char *decoded = matula_to_parens(matula);
         
         // Re-encode to verify equivalence
-        unsigned long long re_encoded = parens_to_matula(decoded);
+        uvlong re_encoded = parens_to_matula(decoded);
         ASSERT_EQ(re_encoded, matula, "Roundtrip preserves Matula number");
         
         free(decoded);
@@ -314,14 +168,14 @@ void test_edge_cases()
     
     // Empty/null input
     ASSERT_EQ(parens_to_matula(""), 1, "Empty string");
-    ASSERT_EQ(parens_to_matula(NULL), 1, "NULL input");
+    ASSERT_EQ(parens_to_matula(nil), 1, "nil input");
     
     // Just parentheses
     ASSERT_EQ(parens_to_matula("()"), 1, "Single pair");
     
     // Deep nesting
-    unsigned long long deep = parens_to_matula("(((((((())))))))");
-    printf("    Deep nesting Matula: %llu\n", deep);
+    uvlong deep = parens_to_matula("(((((((())))))))");
+    print("    Deep nesting Matula: %llud\n", deep);
     test_passed++; // Just verify it doesn't crash
 }
 
@@ -333,7 +187,7 @@ void test_known_sequence()
     struct {
         char *description;
         char *parens;
-        unsigned long long matula;
+        uvlong matula;
     } known[] = {
         {"[]", "()", 1},
         {"[[]]", "(())", 2},
@@ -346,16 +200,105 @@ void test_known_sequence()
     };
     
     for (int i = 0; i < sizeof(known)/sizeof(known[0]); i++) {
-        unsigned long long m = parens_to_matula(known[i].parens);
+        uvlong m = parens_to_matula(known[i].parens);
         ASSERT_EQ(m, known[i].matula, known[i].description);
     }
 }
 
-int main()
+void test_cached_decoding()
+{
+    TEST("Cached decoding");
+    
+    // Every number whose factors stay within the prime table
+    // must decode and re-encode to itself, cold and warm
+    int bad = 0, checked = 0;
+    ulong hits, misses;
+    for (int pass = 0; pass < 2; pass++) {
+        for (uvlong m = 1; m <= 2000; m++) {
+            char *t = matula_to_parens(m);
+            if (t == nil)
+                continue;
+            checked++;
+            if (parens_to_matula(t) != m)
+                bad++;
+            free(t);
+        }
+    }
+    ASSERT_EQ(bad, 0, "Decode then encode is the identity for 1..2000");
+    ASSERT_EQ(checked > 0, 1, "Numbers within the prime table decode");
+    matula_cache_stats(&hits, &misses);
+    ASSERT_EQ(hits > 0, 1, "Repeated subtrees come from the cache");
+    
+    // Unbalanced input fails instead of guessing
+    ASSERT_EQ(parens_to_matula("(()"), 0, "Unclosed root");
+    ASSERT_EQ(parens_to_matula(")("), 0, "Close before open");
+}
+
+void test_large_primes()
+{
+    TEST("Prime table beyond the first 100 primes");
+    
+    ASSERT_EQ(nth_prime(101), 547, "101st prime");
+    ASSERT_EQ(nth_prime(1000), 7919, "1000th prime");
+    ASSERT_EQ(nth_prime(100000), 1299709, "100000th prime");
+    ASSERT_EQ(prime_index(7919), 1000, "7919 is the 1000th prime");
+    ASSERT_EQ(prime_index(7917), 0, "7917 is not prime");
+    
+    // Single chains walk A007097: 1, 2, 3, 5, 11, 31, 127, 709, 5381, 52711, ...
+    ASSERT_EQ(parens_to_matula("((((((((((()))))))))))"), 648391, "Chain of 11 nodes");
+    ASSERT_EQ(parens_to_matula("(((((((((((())))))))))))"), 9737333, "Chain of 12 nodes");
+    
+    char *t = matula_to_parens(9737333);
+    ASSERT_STR_EQ(t, "(((((((((((())))))))))))", "Decode chain of 12 nodes");
+    free(t);
+}
+
+void test_wide_roots()
+{
+    TEST("Roots wider than 64 bits");
+    
+    // 40 chains of three nodes under one root: 5^40 needs 93 bits
+    char wide[256], *t;
+    int n = 0;
+    wide[n++] = '(';
+    for (int i = 0; i < 40; i++) {
+        memcpy(wide + n, "((()))", 6);
+        n += 6;
+    }
+    wide[n++] = ')';
+    wide[n] = '\0';
+    
+    ASSERT_EQ(parens_to_matula(wide), 0, "64-bit encoder reports overflow");
+    MatulaBig *b = parens_to_matula_big(wide);
+    ASSERT_EQ(b != nil, 1, "Wide root encodes exactly");
+    
+    // 5^40 = 9094947017729282379150390625
+    MatulaBig five;
+    matula_big_set(&five, 1);
+    for (int i = 0; i < 40; i++)
+        matula_big_mul(&five, 5);
+    ASSERT_EQ(b->n == five.n && memcmp(b->limb, five.limb, b->n * 4) == 0, 1, "Value is 5^40");
+    ASSERT_EQ(matula_big_hash(b) == matula_big_hash(&five), 1, "Equal numbers hash equal");
+    
+    t = matula_big_to_parens(b);
+    ASSERT_STR_EQ(t, wide, "Decodes back to the same tree");
+    free(t);
+    free(b);
+    
+    // Mixed children come back in ascending order
+    b = parens_to_matula_big("(((((()))))()((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))(()))");
+    t = b != nil ? matula_big_to_parens(b) : nil;
+    ASSERT_STR_EQ(t, "(()(())((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((()))((((())))))", "Canonical order after decoding");
+    free(t);
+    free(b);
+}
+
+void
+main(void)
 {
-    printf("╔════════════════════════════════════════════════════════════════╗\n");
-    printf("║          Matula Numbers - Comprehensive Test Suite            ║\n");
-    printf("╚════════════════════════════════════════════════════════════════╝\n");
+    print("╔════════════════════════════════════════════════════════════════╗\n");
+    print("║          Matula Numbers - Comprehensive Test Suite            ║\n");
+    print("╚════════════════════════════════════════════════════════════════╝\n");
     
     test_basic_encoding();
     test_prime_encoding();
@@ -365,19 +308,22 @@ int main()
     test_factorization();
     test_edge_cases();
     test_known_sequence();
+    test_cached_decoding();
+    test_large_primes();
+    test_wide_roots();
     
-    printf("\n═══════════════════════════════════════════════════════════════\n");
-    printf("  Test Summary\n");
-    printf("═══════════════════════════════════════════════════════════════\n");
-    printf("  Total tests: %d\n", test_count);
-    printf("  Assertions passed: %d\n", test_passed);
-    printf("  Assertions failed: %d\n", test_failed);
+    print("\n═══════════════════════════════════════════════════════════════\n");
+    print("  Test Summary\n");
+    print("═══════════════════════════════════════════════════════════════\n");
+    print("  Total tests: %d\n", test_count);
+    print("  Assertions passed: %d\n", test_passed);
+    print("  Assertions failed: %d\n", test_failed);
     
     if (test_failed == 0) {
-        printf("\n  ✓ All tests passed!\n\n");
-        return 0;
+        print("\n  ✓ All tests passed!\n\n");
+        exits(nil);
     } else {
-        printf("\n  ✗ Some tests failed.\n\n");
-        return 1;
+        print("\n  ✗ Some tests failed.\n\n");
+        exits("failed");
     }
 }
@@ -1,21 +1,28 @@
 /*
  * Parallel vs Sequential Execution Demo
- * 
+ *
  * Demonstrates how membrane computing's parallel execution model
  * collapses branching complexity compared to sequential execution.
- * 
- * This program simulates both models and compares their complexity.
+ *
+ * The membrane model is run for real, to the extent a machine allows:
+ * the 2^n assignments are divided among worker processes (one per
+ * CPU, sharing memory through rfork), each membrane of the division
+ * is a word of 64 assignments tested by bit-sliced clause evaluation,
+ * idle workers steal half of the busiest one's remaining range, and
+ * the first satisfying assignment stops everyone.  The comparison
+ * reports measured times and speedups, not step counts.
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <time.h>
-#include <math.h>
+#include <u.h>
+#include <libc.h>
 
 /* Maximum problem size for demonstration */
-#define MAX_VARS 20
+#define MAX_VARS 40
 #define MAX_CLAUSES 100
+#define MAX_PROCS 64
+
+/* Words of 64 assignments a worker takes at a time */
+#define CHUNK_WORDS 256
 
 /* SAT Problem structure */
 typedef struct {
@@ -24,33 +31,66 @@ typedef struct {
     int clauses[MAX_CLAUSES][3];  /* Each clause has up to 3 literals */
 } SATProblem;
 
+/* One worker of the parallel solver and the chunks it still owns */
+typedef struct {
+    Lock;
+    uvlong next;        /* first chunk not yet taken */
+    uvlong end;         /* one past its last chunk */
+    uvlong words;       /* words evaluated */
+    int steals;         /* ranges taken from other workers */
+} Worker;
+
+/* One timed solver run */
+typedef struct {
+    int procs;
+    int sat;
+    uvlong assignment;
+    uvlong tested;      /* assignments evaluated before stopping */
+    int steals;
+    vlong ns;
+} Run;
+
 /* Statistics for execution models */
 typedef struct {
-    long long sequential_steps;
-    long long parallel_steps;
-    long long membranes_created;
-    double sequential_time_sec;
-    double parallel_time_sec;
+    Run scalar;         /* one assignment at a time */
+    Run sliced;         /* 64 at a time, one worker */
+    Run parallel;       /* 64 at a time, every worker */
 } ExecutionStats;
 
-/* 
- * Generate a random 3-SAT problem 
+static SATProblem *problem;
+static Worker workers[MAX_PROCS];
+static int nworkers;
+static uvlong nchunks;
+static uvlong nwords;
+static uvlong lastmask;         /* valid assignments in a word, for n < 6 */
+static Lock foundlock;
+static int found;
+static uvlong solution;
+
+/* bit b of variable v's word is set when assignment b gives v true */
+static uvlong lowvars[6] = {
+    0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+    0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL,
+};
+
+/*
+ * Generate a random 3-SAT problem
  */
 SATProblem generate_sat_problem(int num_vars, int num_clauses) {
     SATProblem prob;
     prob.num_vars = num_vars;
     prob.num_clauses = num_clauses;
-    
+
     for (int i = 0; i < num_clauses; i++) {
         for (int j = 0; j < 3; j++) {
             /* Random variable (1 to num_vars) */
-            int var = (rand() % num_vars) + 1;
+            int var = nrand(num_vars) + 1;
             /* Random polarity (positive or negative) */
-            int polarity = (rand() % 2) ? 1 : -1;
+            int polarity = nrand(2) ? 1 : -1;
             prob.clauses[i][j] = var * polarity;
         }
     }
-    
+
     return prob;
 }
 
@@ -62,7 +102,7 @@ int satisfies_clause(int *assignment, int *clause, int num_vars) {
         int lit = clause[i];
         int var = abs(lit) - 1;  /* 0-indexed */
         int polarity = (lit > 0) ? 1 : 0;
-        
+
         if (assignment[var] == polarity) {
             return 1;  /* Clause satisfied */
         }
@@ -86,302 +126,484 @@ int satisfies_formula(int *assignment, SATProblem *prob) {
  * Sequential SAT solver
  * Tries all 2^n assignments one by one
  */
-int solve_sat_sequential(SATProblem *prob, ExecutionStats *stats) {
+int solve_sat_sequential(SATProblem *prob, Run *run) {
     int num_vars = prob->num_vars;
-    long long total_assignments = 1LL << num_vars;  /* 2^n */
+    uvlong total_assignments = 1ULL << num_vars;  /* 2^n */
     int assignment[MAX_VARS];
-    
-    clock_t start = clock();
-    stats->sequential_steps = 0;
-    
+
+    vlong start = nsec();
+    memset(run, 0, sizeof *run);
+    run->procs = 1;
+
     /* Try each assignment sequentially */
-    for (long long i = 0; i < total_assignments; i++) {
+    for (uvlong i = 0; i < total_assignments; i++) {
         /* Convert i to binary assignment */
         for (int j = 0; j < num_vars; j++) {
             assignment[j] = (i >> j) & 1;
         }
-        
-        stats->sequential_steps++;
-        
+
+        run->tested++;
+
         /* Check if this assignment satisfies the formula */
         if (satisfies_formula(assignment, prob)) {
-            clock_t end = clock();
-            stats->sequential_time_sec = (double)(end - start) / CLOCKS_PER_SEC;
-            return 1;  /* SAT */
+            run->sat = 1;
+            run->assignment = i;
+            break;
         }
     }
-    
-    clock_t end = clock();
-    stats->sequential_time_sec = (double)(end - start) / CLOCKS_PER_SEC;
-    return 0;  /* UNSAT */
+
+    run->ns = nsec() - start;
+    return run->sat;
 }
 
 /*
- * Parallel membrane SAT solver (simulation)
- * 
- * Phase 1: Create 2^n membranes via parallel division (n steps)
- * Phase 2: Each membrane checks its assignment (log m steps)
- * Phase 3: Collect results via parallel OR (log(2^n) = n steps)
+ * Evaluate the formula on the 64 assignments w*64 ... w*64+63 at once.
+ * Variables 0-5 take every combination within the word; the rest are
+ * the bits of w and so the same for all 64.  Returns the satisfying
+ * assignments as a bit mask.
  */
-int solve_sat_membrane(SATProblem *prob, ExecutionStats *stats) {
-    int num_vars = prob->num_vars;
-    long long total_membranes = 1LL << num_vars;  /* 2^n */
-    
-    clock_t start = clock();
-    
-    /* Phase 1: Membrane division (parallel) */
-    /* Each round doubles the membrane count */
-    stats->parallel_steps = num_vars;  /* n parallel doubling steps */
-    stats->membranes_created = total_membranes;
-    
-    /* Phase 2: Clause checking (parallel across all membranes) */
-    /* Each membrane checks independently */
-    /* With parallel clause evaluation: log(num_clauses) steps */
-    int clause_check_steps = (int)ceil(log2(prob->num_clauses + 1));
-    stats->parallel_steps += clause_check_steps;
-    
-    /* Phase 3: Result collection (parallel OR) */
-    /* Binary tree reduction: log(2^n) = n steps */
-    stats->parallel_steps += num_vars;
-    
-    /* Simulate actual checking (for timing comparison) */
-    int found_sat = 0;
-    int assignment[MAX_VARS];
-    
-    for (long long i = 0; i < total_membranes && !found_sat; i++) {
-        for (int j = 0; j < num_vars; j++) {
-            assignment[j] = (i >> j) & 1;
+static uvlong eval_word(SATProblem *prob, uvlong w) {
+    uvlong sat = lastmask;
+
+    for (int i = 0; i < prob->num_clauses && sat != 0; i++) {
+        uvlong clause = 0;
+        for (int j = 0; j < 3; j++) {
+            int lit = prob->clauses[i][j];
+            int var = abs(lit) - 1;
+            uvlong x;
+
+            if (var < 6)
+                x = lowvars[var];
+            else
+                x = (w >> (var - 6)) & 1 ? ~0ULL : 0;
+            clause |= lit > 0 ? x : ~x;
         }
-        if (satisfies_formula(assignment, prob)) {
-            found_sat = 1;
+        sat &= clause;
+    }
+    return sat;
+}
+
+/* Take a chunk from worker id's own range, or -1 if it is empty */
+static vlong take_chunk(Worker *w) {
+    vlong c = -1;
+
+    lock(w);
+    if (w->next < w->end)
+        c = w->next++;
+    unlock(w);
+    return c;
+}
+
+/*
+ * Steal the upper half of the largest range left among the other
+ * workers.  Returns 0 when every range is empty.
+ */
+static int steal_chunks(int id) {
+    Worker *me = &workers[id];
+
+    for (;;) {
+        Worker *victim = nil;
+        uvlong most = 0;
+
+        for (int i = 0; i < nworkers; i++) {
+            Worker *w = &workers[i];
+            uvlong left = w->end > w->next ? w->end - w->next : 0;
+            if (i != id && left > most) {
+                most = left;
+                victim = w;
+            }
+        }
+        if (victim == nil)
+            return 0;
+
+        lock(victim);
+        if (victim->end <= victim->next) {
+            /* emptied while we looked; look again */
+            unlock(victim);
+            continue;
+        }
+        uvlong mid = victim->end - (victim->end - victim->next + 1) / 2;
+        uvlong end = victim->end;
+        victim->end = mid;
+        unlock(victim);
+
+        lock(me);
+        me->next = mid;
+        me->end = end;
+        me->steals++;
+        unlock(me);
+        return 1;
+    }
+}
+
+/* Worker body: test chunk after chunk until the space is done or solved */
+static void work(int id) {
+    Worker *me = &workers[id];
+
+    while (!found) {
+        vlong c = take_chunk(me);
+        if (c < 0) {
+            if (!steal_chunks(id))
+                break;
+            continue;
+        }
+
+        uvlong w = c * CHUNK_WORDS;
+        uvlong end = w + CHUNK_WORDS;
+        if (end > nwords)
+            end = nwords;
+        for (; w < end; w++) {
+            uvlong sat = eval_word(problem, w);
+            if (sat != 0) {
+                int b = 0;
+                while (!(sat & 1ULL << b))
+                    b++;
+                lock(&foundlock);
+                if (!found) {
+                    solution = w * 64 + b;
+                    found = 1;
+                }
+                unlock(&foundlock);
+                w++;
+                break;
+            }
+        }
+        me->words += w - c * CHUNK_WORDS;
+    }
+}
+
+/* Start worker id as a process sharing our memory */
+static int spawn_worker(int id) {
+    int pid;
+
+    switch (pid = rfork(RFPROC|RFMEM)) {
+    case -1:
+        return -1;
+    case 0:
+        work(id);
+        _exits(nil);
+    }
+    return pid;
+}
+
+/*
+ * Parallel membrane SAT solver
+ *
+ * The division into 2^n membranes becomes a division of the space into
+ * chunks, handed out to procs workers in equal ranges.  Each membrane
+ * checks its assignments, 64 per word, and the parallel OR of the
+ * results is the first worker to find one raising found.
+ */
+int solve_sat_membrane(SATProblem *prob, int procs, Run *run) {
+    int pids[MAX_PROCS];
+
+    problem = prob;
+    nwords = prob->num_vars > 6 ? 1ULL << (prob->num_vars - 6) : 1;
+    lastmask = prob->num_vars >= 6 ? ~0ULL : (1ULL << (1 << prob->num_vars)) - 1;
+    nchunks = (nwords + CHUNK_WORDS - 1) / CHUNK_WORDS;
+    if (procs > nchunks)
+        procs = nchunks;
+    nworkers = procs;
+    found = 0;
+    solution = 0;
+    for (int i = 0; i < procs; i++) {
+        Worker *w = &workers[i];
+        memset(w, 0, sizeof *w);
+        w->next = nchunks * i / procs;
+        w->end = nchunks * (i + 1) / procs;
+    }
+
+    vlong start = nsec();
+    int started = 1;
+    for (int i = 1; i < procs; i++) {
+        pids[i] = spawn_worker(i);
+        if (pids[i] < 0) {
+            /* run with what we have; the others' ranges get stolen */
+            fprint(2, "rfork: %r\n");
             break;
         }
+        started++;
+    }
+    work(0);
+    for (int i = 1; i < started; i++)
+        waitpid();
+
+    memset(run, 0, sizeof *run);
+    run->ns = nsec() - start;
+    run->procs = started;
+    run->sat = found;
+    run->assignment = solution;
+    for (int i = 0; i < procs; i++) {
+        run->tested += workers[i].words * 64;
+        run->steals += workers[i].steals;
     }
-    
-    clock_t end = clock();
-    stats->parallel_time_sec = (double)(end - start) / CLOCKS_PER_SEC;
-    
-    return found_sat;
+    if (run->tested > 1ULL << prob->num_vars)
+        run->tested = 1ULL << prob->num_vars;
+    return run->sat;
+}
+
+static double speedup(Run *base, Run *r) {
+    return r->ns > 0 ? (double)base->ns / r->ns : 0;
 }
 
 /*
  * Print a visual comparison
  */
 void print_comparison(int num_vars, ExecutionStats *stats) {
-    printf("\n");
-    printf("╔════════════════════════════════════════════════════════════════╗\n");
-    printf("║        Sequential vs Parallel Execution Comparison            ║\n");
-    printf("╠════════════════════════════════════════════════════════════════╣\n");
-    printf("║ Problem Size: %2d variables                                    ║\n", num_vars);
-    printf("╠════════════════════════════════════════════════════════════════╣\n");
-    printf("║                                                                ║\n");
-    printf("║ SEQUENTIAL MODEL (Classical Turing Machine)                   ║\n");
-    printf("║ --------------------------------------------------------       ║\n");
-    printf("║   Steps taken:        %20lld                  ║\n", stats->sequential_steps);
-    printf("║   Actual time:        %20.6f seconds         ║\n", stats->sequential_time_sec);
-    printf("║   Complexity:         O(2^n) = O(2^%d)                        ║\n", num_vars);
-    printf("║                                                                ║\n");
-    printf("║ PARALLEL MODEL (Membrane Computing / P-System)                ║\n");
-    printf("║ --------------------------------------------------------       ║\n");
-    printf("║   Parallel rounds:    %20lld                  ║\n", stats->parallel_steps);
-    printf("║   Membranes created:  %20lld                  ║\n", stats->membranes_created);
-    printf("║   Simulated time:     %20.6f seconds         ║\n", stats->parallel_time_sec);
-    printf("║   Time complexity:    O(n) = O(%d)                            ║\n", num_vars);
-    printf("║   Space complexity:   O(2^n) = O(2^%d)                        ║\n", num_vars);
-    printf("║                                                                ║\n");
-    printf("║ COMPLEXITY COLLAPSE                                           ║\n");
-    printf("║ --------------------------------------------------------       ║\n");
-    
-    /* Calculate speedup ratio */
-    double theoretical_speedup = (double)stats->sequential_steps / stats->parallel_steps;
-    
-    printf("║   Sequential/Parallel steps ratio: %20.2f         ║\n", theoretical_speedup);
-    printf("║                                                                ║\n");
-    printf("║   The exponential factor (2^n) moves from TIME to SPACE!      ║\n");
-    printf("║                                                                ║\n");
-    printf("╚════════════════════════════════════════════════════════════════╝\n");
+    print("\n");
+    print("╔════════════════════════════════════════════════════════════════╗\n");
+    print("║        Sequential vs Parallel Execution Comparison             ║\n");
+    print("╠════════════════════════════════════════════════════════════════╣\n");
+    print("║ Problem Size: %2d variables                                     ║\n", num_vars);
+    print("╠════════════════════════════════════════════════════════════════╣\n");
+    print("║                                                                ║\n");
+    print("║ SEQUENTIAL MODEL (one assignment at a time)                    ║\n");
+    print("║ --------------------------------------------------------       ║\n");
+    print("║   Assignments tested: %20llud                     ║\n", stats->scalar.tested);
+    print("║   Measured time:      %20.6f seconds             ║\n", stats->scalar.ns / 1e9);
+    print("║                                                                ║\n");
+    print("║ BIT-SLICED MEMBRANES (64 assignments per word, 1 worker)       ║\n");
+    print("║ --------------------------------------------------------       ║\n");
+    print("║   Assignments tested: %20llud                     ║\n", stats->sliced.tested);
+    print("║   Measured time:      %20.6f seconds             ║\n", stats->sliced.ns / 1e9);
+    print("║   Speedup:            %20.2fx                    ║\n", speedup(&stats->scalar, &stats->sliced));
+    print("║                                                                ║\n");
+    print("║ PARALLEL MEMBRANES (%2d workers, work stealing)                 ║\n", stats->parallel.procs);
+    print("║ --------------------------------------------------------       ║\n");
+    print("║   Assignments tested: %20llud                     ║\n", stats->parallel.tested);
+    print("║   Ranges stolen:      %20d                     ║\n", stats->parallel.steals);
+    print("║   Measured time:      %20.6f seconds             ║\n", stats->parallel.ns / 1e9);
+    print("║   Speedup over 1:     %20.2fx                    ║\n", speedup(&stats->sliced, &stats->parallel));
+    print("║   Speedup overall:    %20.2fx                    ║\n", speedup(&stats->scalar, &stats->parallel));
+    print("║                                                                ║\n");
+    print("║ A satisfiable formula stops at its first solution, so a worker ║\n");
+    print("║ starting near one can make the speedup exceed the worker count.║\n");
+    print("║ Only an unsatisfiable formula searches the whole 2^n space.    ║\n");
+    print("║                                                                ║\n");
+    print("╚════════════════════════════════════════════════════════════════╝\n");
 }
 
 /*
  * Demonstrate Matula encoding and parallel semantics
  */
-void demonstrate_matula_parallel() {
-    printf("\n");
-    printf("╔════════════════════════════════════════════════════════════════╗\n");
-    printf("║           Matula Numbers and Parallel Semantics               ║\n");
-    printf("╠════════════════════════════════════════════════════════════════╣\n");
-    printf("║                                                                ║\n");
-    printf("║ Matula Encoding Example: Tree with structure (()()())         ║\n");
-    printf("║                                                                ║\n");
-    printf("║   Parentheses:     (()()())                                    ║\n");
-    printf("║   Interpretation:  Root with 3 children of type ()            ║\n");
-    printf("║   Matula number:   8 = 2³                                     ║\n");
-    printf("║   Factorization:   2³ means \"three of type 1\"                 ║\n");
-    printf("║                                                                ║\n");
-    printf("║ Computational Interpretation:                                 ║\n");
-    printf("║ --------------------------------------------------------       ║\n");
-    printf("║                                                                ║\n");
-    printf("║   SEQUENTIAL MODEL:                                           ║\n");
-    printf("║     for i = 1 to 3:                                           ║\n");
-    printf("║         execute_child()                                       ║\n");
-    printf("║     Time: 3 sequential steps                                  ║\n");
-    printf("║                                                                ║\n");
-    printf("║   PARALLEL MODEL (Membrane):                                  ║\n");
-    printf("║     execute_all_children_simultaneously()                     ║\n");
-    printf("║     Time: 1 parallel step                                     ║\n");
-    printf("║     Space: 3 concurrent membranes                             ║\n");
-    printf("║                                                                ║\n");
-    printf("║   The exponent (³) encodes MULTIPLICITY (how many),           ║\n");
-    printf("║   not DURATION (how long).                                    ║\n");
-    printf("║                                                                ║\n");
-    printf("║   Multiplicity = Weight (spatial) ≠ Time (temporal)           ║\n");
-    printf("║                                                                ║\n");
-    printf("╚════════════════════════════════════════════════════════════════╝\n");
+void demonstrate_matula_parallel(void) {
+    print("\n");
+    print("╔════════════════════════════════════════════════════════════════╗\n");
+    print("║           Matula Numbers and Parallel Semantics               ║\n");
+    print("╠════════════════════════════════════════════════════════════════╣\n");
+    print("║                                                                ║\n");
+    print("║ Matula Encoding Example: Tree with structure (()()())         ║\n");
+    print("║                                                                ║\n");
+    print("║   Parentheses:     (()()())                                    ║\n");
+    print("║   Interpretation:  Root with 3 children of type ()            ║\n");
+    print("║   Matula number:   8 = 2³                                     ║\n");
+    print("║   Factorization:   2³ means \"three of type 1\"                 ║\n");
+    print("║                                                                ║\n");
+    print("║ Computational Interpretation:                                 ║\n");
+    print("║ --------------------------------------------------------       ║\n");
+    print("║                                                                ║\n");
+    print("║   SEQUENTIAL MODEL:                                           ║\n");
+    print("║     for i = 1 to 3:                                           ║\n");
+    print("║         execute_child()                                       ║\n");
+    print("║     Time: 3 sequential steps                                  ║\n");
+    print("║                                                                ║\n");
+    print("║   PARALLEL MODEL (Membrane):                                  ║\n");
+    print("║     execute_all_children_simultaneously()                     ║\n");
+    print("║     Time: 1 parallel step                                     ║\n");
+    print("║     Space: 3 concurrent membranes                             ║\n");
+    print("║                                                                ║\n");
+    print("║   The exponent (³) encodes MULTIPLICITY (how many),           ║\n");
+    print("║   not DURATION (how long).                                    ║\n");
+    print("║                                                                ║\n");
+    print("║   Multiplicity = Weight (spatial) ≠ Time (temporal)           ║\n");
+    print("║                                                                ║\n");
+    print("╚════════════════════════════════════════════════════════════════╝\n");
 }
 
 /*
  * Show complexity growth comparison
  */
-void show_complexity_growth() {
-    printf("\n");
-    printf("╔════════════════════════════════════════════════════════════════╗\n");
-    printf("║             Complexity Growth: Sequential vs Parallel         ║\n");
-    printf("╠════════════════════════════════════════════════════════════════╣\n");
-    printf("║  n  │ Sequential O(2^n) │ Parallel O(n) │ Membranes O(2^n)  ║\n");
-    printf("╠═════╪═══════════════════╪═══════════════╪════════════════════╣\n");
-    
+void show_complexity_growth(void) {
+    print("\n");
+    print("╔════════════════════════════════════════════════════════════════╗\n");
+    print("║             Complexity Growth: Sequential vs Parallel         ║\n");
+    print("╠════════════════════════════════════════════════════════════════╣\n");
+    print("║  n  │ Sequential O(2^n) │ Parallel O(n) │ Membranes O(2^n)  ║\n");
+    print("╠═════╪═══════════════════╪═══════════════╪════════════════════╣\n");
+
     for (int n = 1; n <= 20; n++) {
-        long long seq_steps = 1LL << n;
-        long long par_steps = 2 * n;  /* Approximate */
-        long long membranes = 1LL << n;
-        
-        printf("║ %2d  │ %17lld │ %13lld │ %18lld ║\n", 
+        vlong seq_steps = 1LL << n;
+        vlong par_steps = 2 * n;  /* Approximate */
+        vlong membranes = 1LL << n;
+
+        print("║ %2d  │ %17lld │ %13lld │ %18lld ║\n",
                n, seq_steps, par_steps, membranes);
     }
-    
-    printf("╚═════╧═══════════════════╧═══════════════╧════════════════════╝\n");
-    printf("\n");
-    printf("Observations:\n");
-    printf("  • Sequential steps grow exponentially (2^n)\n");
-    printf("  • Parallel steps grow linearly (2n)\n");
-    printf("  • Membrane count grows exponentially (2^n)\n");
-    printf("  • The exponential cost MOVES from TIME to SPACE\n");
-    printf("  • For n=20: Sequential needs ~1M steps, Parallel needs ~40 steps\n");
-    printf("  • But: Parallel needs ~1M membranes!\n");
-    printf("\n");
+
+    print("╚═════╧═══════════════════╧═══════════════╧════════════════════╝\n");
+    print("\n");
+    print("Observations:\n");
+    print("  • Sequential steps grow exponentially (2^n)\n");
+    print("  • Parallel steps grow linearly (2n)\n");
+    print("  • Membrane count grows exponentially (2^n)\n");
+    print("  • The exponential cost MOVES from TIME to SPACE\n");
+    print("  • For n=20: Sequential needs ~1M steps, Parallel needs ~40 steps\n");
+    print("  • But: Parallel needs ~1M membranes!\n");
+    print("\n");
+}
+
+static void usage(void) {
+    fprint(2, "usage: %s [-p procs] [-s seed] [num_vars [num_clauses]]\n", argv0);
+    fprint(2, "  num_vars: Number of Boolean variables (1-%d, default: 10)\n", MAX_VARS);
+    fprint(2, "  num_clauses: Number of clauses (1-%d, default: 30)\n", MAX_CLAUSES);
+    exits("usage");
 }
 
 /*
  * Main demonstration
  */
-int main(int argc, char **argv) {
+void main(int argc, char **argv) {
     int num_vars = 10;  /* Default problem size */
     int num_clauses = 30;
-    
-    if (argc > 1) {
-        num_vars = atoi(argv[1]);
+    int procs = 0;
+    long seed = time(0);
+    char *s;
+
+    ARGBEGIN {
+    case 'p':
+        procs = atoi(EARGF(usage()));
+        break;
+    case 's':
+        seed = atol(EARGF(usage()));
+        break;
+    default:
+        usage();
+    } ARGEND
+
+    if (argc > 0) {
+        num_vars = atoi(argv[0]);
         if (num_vars < 1 || num_vars > MAX_VARS) {
-            fprintf(stderr, "Error: num_vars must be between 1 and %d\n", MAX_VARS);
-            return 1;
+            fprint(2, "Error: num_vars must be between 1 and %d\n", MAX_VARS);
+            exits("usage");
         }
     }
-    
-    if (argc > 2) {
-        num_clauses = atoi(argv[2]);
+
+    if (argc > 1) {
+        num_clauses = atoi(argv[1]);
         if (num_clauses < 1 || num_clauses > MAX_CLAUSES) {
-            fprintf(stderr, "Error: num_clauses must be between 1 and %d\n", MAX_CLAUSES);
-            return 1;
+            fprint(2, "Error: num_clauses must be between 1 and %d\n", MAX_CLAUSES);
+            exits("usage");
         }
     }
-    
-    srand(time(NULL));
-    
-    printf("╔════════════════════════════════════════════════════════════════╗\n");
-    printf("║  Membrane Computing: P vs NP Complexity Collapse Demo         ║\n");
-    printf("╠════════════════════════════════════════════════════════════════╣\n");
-    printf("║                                                                ║\n");
-    printf("║  This demo shows how membrane computing's maximal parallelism ║\n");
-    printf("║  collapses the exponential branching of NP problems into      ║\n");
-    printf("║  polynomial TIME at the cost of exponential SPACE.            ║\n");
-    printf("║                                                                ║\n");
-    printf("╚════════════════════════════════════════════════════════════════╝\n");
-    
+
+    if (procs <= 0 && (s = getenv("NPROC")) != nil) {
+        procs = atoi(s);
+        free(s);
+    }
+    if (procs <= 0)
+        procs = 1;
+    if (procs > MAX_PROCS)
+        procs = MAX_PROCS;
+
+    srand(seed);
+
+    print("╔════════════════════════════════════════════════════════════════╗\n");
+    print("║  Membrane Computing: P vs NP Complexity Collapse Demo         ║\n");
+    print("╠════════════════════════════════════════════════════════════════╣\n");
+    print("║                                                                ║\n");
+    print("║  This demo shows how membrane computing's maximal parallelism ║\n");
+    print("║  collapses the exponential branching of NP problems into      ║\n");
+    print("║  polynomial TIME at the cost of exponential SPACE.            ║\n");
+    print("║                                                                ║\n");
+    print("╚════════════════════════════════════════════════════════════════╝\n");
+
     /* Show Matula encoding and parallel semantics */
     demonstrate_matula_parallel();
-    
+
     /* Show complexity growth table */
     show_complexity_growth();
-    
-    printf("\n");
-    printf("═══════════════════════════════════════════════════════════════════\n");
-    printf(" Running SAT Problem Simulation\n");
-    printf("═══════════════════════════════════════════════════════════════════\n");
-    
+
+    print("\n");
+    print("═══════════════════════════════════════════════════════════════════\n");
+    print(" Running SAT Problem\n");
+    print("═══════════════════════════════════════════════════════════════════\n");
+
     /* Generate a SAT problem */
     SATProblem prob = generate_sat_problem(num_vars, num_clauses);
-    ExecutionStats stats = {0};
-    
-    printf("\nGenerated 3-SAT problem:\n");
-    printf("  Variables: %d\n", num_vars);
-    printf("  Clauses: %d\n", num_clauses);
-    printf("  Total assignments to check: %lld (2^%d)\n", 
-           1LL << num_vars, num_vars);
-    
+    ExecutionStats stats;
+
+    print("\nGenerated 3-SAT problem (seed %ld):\n", seed);
+    print("  Variables: %d\n", num_vars);
+    print("  Clauses: %d\n", num_clauses);
+    print("  Total assignments to check: %llud (2^%d)\n",
+           1ULL << num_vars, num_vars);
+
     /* Solve sequentially */
-    printf("\nSolving with SEQUENTIAL model...\n");
-    int seq_result = solve_sat_sequential(&prob, &stats);
-    printf("  Result: %s\n", seq_result ? "SATISFIABLE" : "UNSATISFIABLE");
-    
-    /* Solve in parallel (simulated) */
-    printf("\nSolving with PARALLEL (membrane) model...\n");
-    int par_result = solve_sat_membrane(&prob, &stats);
-    printf("  Result: %s\n", par_result ? "SATISFIABLE" : "UNSATISFIABLE");
-    
+    print("\nSolving with SEQUENTIAL model...\n");
+    int seq_result = solve_sat_sequential(&prob, &stats.scalar);
+    print("  Result: %s\n", seq_result ? "SATISFIABLE" : "UNSATISFIABLE");
+
+    /* Solve with bit-sliced membranes, first alone, then on every worker */
+    print("\nSolving with BIT-SLICED membranes on 1 worker...\n");
+    int sliced_result = solve_sat_membrane(&prob, 1, &stats.sliced);
+    print("  Result: %s\n", sliced_result ? "SATISFIABLE" : "UNSATISFIABLE");
+
+    print("\nSolving with PARALLEL membranes on %d workers...\n", procs);
+    int par_result = solve_sat_membrane(&prob, procs, &stats.parallel);
+    print("  Result: %s\n", par_result ? "SATISFIABLE" : "UNSATISFIABLE");
+    if (par_result)
+        print("  Assignment: %#llux\n", stats.parallel.assignment);
+
+    if (seq_result != sliced_result || seq_result != par_result) {
+        fprint(2, "solvers disagree: sequential %d, sliced %d, parallel %d\n",
+               seq_result, sliced_result, par_result);
+        exits("disagree");
+    }
+
     /* Print comparison */
     print_comparison(num_vars, &stats);
-    
-    printf("\n");
-    printf("═══════════════════════════════════════════════════════════════════\n");
-    printf(" Key Insights\n");
-    printf("═══════════════════════════════════════════════════════════════════\n");
-    printf("\n");
-    printf("1. CLASSICAL MODEL (Turing Machine):\n");
-    printf("   • Must check all 2^n assignments SEQUENTIALLY\n");
-    printf("   • Time complexity: O(2^n)\n");
-    printf("   • Space complexity: O(n)\n");
-    printf("   • NP-complete problem: exponential time\n");
-    printf("\n");
-    printf("2. MEMBRANE MODEL (P-System):\n");
-    printf("   • Creates 2^n membranes in n PARALLEL steps\n");
-    printf("   • Each membrane checks ONE assignment\n");
-    printf("   • All checks happen SIMULTANEOUSLY\n");
-    printf("   • Time complexity: O(n) parallel steps\n");
-    printf("   • Space complexity: O(2^n) membranes\n");
-    printf("\n");
-    printf("3. THE COMPLEXITY COLLAPSE:\n");
-    printf("   • Exponential branching no longer costs exponential TIME\n");
-    printf("   • Instead, it costs exponential SPACE (membranes)\n");
-    printf("   • In terms of parallel time: P = NP in membrane model\n");
-    printf("   • In terms of space: P ≠ NP (still distinct)\n");
-    printf("\n");
-    printf("4. MATULA ENCODING CONNECTION:\n");
-    printf("   • Matula factorization: 8 = 2³\n");
-    printf("   • Exponent 3 = multiplicity = 3 concurrent copies\n");
-    printf("   • NOT: 3 sequential time steps\n");
-    printf("   • Multiplicity is a WEIGHT (spatial), not DURATION (temporal)\n");
-    printf("\n");
-    printf("5. PHYSICAL REALITY:\n");
-    printf("   • Creating 2^n membranes is infeasible for large n\n");
-    printf("   • For n=10: 1,024 membranes (feasible)\n");
-    printf("   • For n=30: 1,073,741,824 membranes (infeasible)\n");
-    printf("   • Theory shows the collapse; practice shows the limits\n");
-    printf("\n");
-    printf("═══════════════════════════════════════════════════════════════════\n");
-    
-    printf("\nUsage: %s [num_vars] [num_clauses]\n", argv[0]);
-    printf("  num_vars: Number of Boolean variables (1-%d, default: 10)\n", MAX_VARS);
-    printf("  num_clauses: Number of clauses (1-%d, default: 30)\n", MAX_CLAUSES);
-    printf("\n");
-    
-    return 0;
+
+    print("\n");
+    print("═══════════════════════════════════════════════════════════════════\n");
+    print(" Key Insights\n");
+    print("═══════════════════════════════════════════════════════════════════\n");
+    print("\n");
+    print("1. CLASSICAL MODEL (Turing Machine):\n");
+    print("   • Must check all 2^n assignments SEQUENTIALLY\n");
+    print("   • Time complexity: O(2^n)\n");
+    print("   • Space complexity: O(n)\n");
+    print("   • NP-complete problem: exponential time\n");
+    print("\n");
+    print("2. MEMBRANE MODEL (P-System):\n");
+    print("   • Creates 2^n membranes in n PARALLEL steps\n");
+    print("   • Each membrane checks ONE assignment\n");
+    print("   • All checks happen SIMULTANEOUSLY\n");
+    print("   • Time complexity: O(n) parallel steps\n");
+    print("   • Space complexity: O(2^n) membranes\n");
+    print("   • Here: %d workers × 64 assignments per word = %d at once\n",
+           stats.parallel.procs, stats.parallel.procs * 64);
+    print("\n");
+    print("3. THE COMPLEXITY COLLAPSE:\n");
+    print("   • Exponential branching no longer costs exponential TIME\n");
+    print("   • Instead, it costs exponential SPACE (membranes)\n");
+    print("   • In terms of parallel time: P = NP in membrane model\n");
+    print("   • In terms of space: P ≠ NP (still distinct)\n");
+    print("   • A real machine has a fixed width, so the measured speedup\n");
+    print("     is a constant factor and the time is still O(2^n)\n");
+    print("\n");
+    print("4. MATULA ENCODING CONNECTION:\n");
+    print("   • Matula factorization: 8 = 2³\n");
+    print("   • Exponent 3 = multiplicity = 3 concurrent copies\n");
+    print("   • NOT: 3 sequential time steps\n");
+    print("   • Multiplicity is a WEIGHT (spatial), not DURATION (temporal)\n");
+    print("\n");
+    print("5. PHYSICAL REALITY:\n");
+    print("   • Creating 2^n membranes is infeasible for large n\n");
+    print("   • For n=10: 1,024 membranes (feasible)\n");
+    print("   • For n=30: 1,073,741,824 membranes (infeasible)\n");
+    print("   • Theory shows the collapse; practice shows the limits\n");
+    print("\n");
+    print("═══════════════════════════════════════════════════════════════════\n");
+
+    exits(nil);
 }
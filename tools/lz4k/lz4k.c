@@ -0,0 +1,189 @@
+/*
+ * lz4k - compress standard input to standard output in the lz4
+ * legacy frame format, for kernels that the pc boot loaders
+ * expand (pcboot/unlz4.guts.c): a 4-byte magic, then for each
+ * 8MB of input a 4-byte little-endian length and an lz4 block.
+ *
+ * Matches are found through hash chains over the last 64K,
+ * following at most -d links per position (default 64); more
+ * is slower and smaller.  The output also suits lz4 -d.
+ *
+ *	mk 9pcf.lz4	# in ../../pc
+ */
+
+#include <u.h>
+#include <libc.h>
+
+enum {
+	Magic		= 0x184C2102,
+	Blockmax	= 8*1024*1024,
+	Minmatch	= 4,
+	Mflimit		= 12,		/* no match starts in the last 12 bytes */
+	Lastlits	= 5,		/* and the last 5 are literals */
+	Maxoff		= 65535,
+	Window		= 1<<16,
+	Hbits		= 16,
+};
+
+int	depth = 64;
+long	head[1<<Hbits];
+long	chain[Window];
+
+void
+usage(void)
+{
+	fprint(2, "usage: lz4k [-d depth] <file >file.lz4\n");
+	exits("usage");
+}
+
+ulong
+hash(uchar *p)
+{
+	ulong v;
+
+	v = p[0] | p[1]<<8 | p[2]<<16 | (ulong)p[3]<<24;
+	return (v * 2654435761UL) >> (32-Hbits);
+}
+
+void
+insert(uchar *in, long i)
+{
+	ulong h;
+
+	h = hash(in+i);
+	chain[i & (Window-1)] = head[h];
+	head[h] = i;
+}
+
+uchar*
+putlen(uchar *op, ulong n)
+{
+	for(; n >= 255; n -= 255)
+		*op++ = 255;
+	*op++ = n;
+	return op;
+}
+
+uchar*
+putseq(uchar *op, uchar *lit, long nlit, long off, long len)
+{
+	int tok;
+
+	tok = (nlit < 15? nlit: 15) << 4;
+	if(len > 0)
+		tok |= len-Minmatch < 15? len-Minmatch: 15;
+	*op++ = tok;
+	if(nlit >= 15)
+		op = putlen(op, nlit-15);
+	memmove(op, lit, nlit);
+	op += nlit;
+	if(len > 0){
+		*op++ = off;
+		*op++ = off>>8;
+		if(len-Minmatch >= 15)
+			op = putlen(op, len-Minmatch-15);
+	}
+	return op;
+}
+
+/* compress in[0:n] to out, which must hold n + n/255 + 16 bytes */
+long
+compress(uchar *in, long n, uchar *out)
+{
+	uchar *op;
+	long i, c, anchor, lim, max, len, best, off, d;
+
+	memset(head, 0xff, sizeof head);	/* all -1 */
+	op = out;
+	anchor = 0;
+	lim = n - Mflimit;
+	for(i = 0; i < lim; ){
+		best = 0;
+		off = 0;
+		max = n - Lastlits - i;
+		d = depth;
+		for(c = head[hash(in+i)]; c >= 0 && i-c <= Maxoff && d-- > 0; c = chain[c & (Window-1)]){
+			if(in[c+best] != in[i+best])
+				continue;
+			for(len = 0; len < max && in[c+len] == in[i+len]; len++)
+				;
+			if(len > best){
+				best = len;
+				off = i - c;
+				if(len == max)
+					break;
+			}
+		}
+		if(best < Minmatch){
+			insert(in, i++);
+			continue;
+		}
+		op = putseq(op, in+anchor, i-anchor, off, best);
+		for(c = i+best; i < c; i++)
+			if(i < lim)
+				insert(in, i);
+		anchor = i;
+	}
+	op = putseq(op, in+anchor, n-anchor, 0, 0);
+	return op - out;
+}
+
+void
+put4(uchar *p, ulong v)
+{
+	p[0] = v;
+	p[1] = v>>8;
+	p[2] = v>>16;
+	p[3] = v>>24;
+}
+
+void
+main(int argc, char *argv[])
+{
+	uchar *in, *out, hdr[4];
+	long n, m, r, i;
+
+	ARGBEGIN{
+	case 'd':
+		depth = atoi(EARGF(usage()));
+		break;
+	default:
+		usage();
+	}ARGEND
+	if(argc != 0 || depth < 1)
+		usage();
+
+	in = nil;
+	n = 0;
+	m = 0;
+	for(;;){
+		if(n == m){
+			m += 1024*1024;
+			if((in = realloc(in, m)) == nil)
+				sysfatal("realloc: %r");
+		}
+		r = read(0, in+n, m-n);
+		if(r < 0)
+			sysfatal("read: %r");
+		if(r == 0)
+			break;
+		n += r;
+	}
+	out = malloc(Blockmax + Blockmax/255 + 16);
+	if(out == nil)
+		sysfatal("malloc: %r");
+
+	put4(hdr, Magic);
+	if(write(1, hdr, 4) != 4)
+		sysfatal("write: %r");
+	for(i = 0; i < n; i += m){
+		m = n - i;
+		if(m > Blockmax)
+			m = Blockmax;
+		r = compress(in+i, m, out);
+		put4(hdr, r);
+		if(write(1, hdr, 4) != 4 || write(1, out, r) != r)
+			sysfatal("write: %r");
+	}
+	exits(nil);
+}